@@ -0,0 +1,241 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include "alloc_stats.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const char* alloc_tag_names[NUM_ALLOC_TAGS] = {"other", "simulation", "render", "present", "glfw"};
+
+static std::atomic<uint64_t> alloc_counts[NUM_ALLOC_TAGS];
+static std::atomic<uint64_t> alloc_bytes[NUM_ALLOC_TAGS];
+static std::atomic<uint64_t> free_count;
+static thread_local AllocTag thread_tag = ALLOC_OTHER;
+static thread_local bool thread_guarded = false;
+
+static void count_allocation(size_t size, AllocTag tag)
+{
+    if(thread_guarded)
+    {
+        // Disarmed first, in case reporting allocates
+        thread_guarded = false;
+        fprintf(stderr, "Allocated %zu bytes (%s) with the allocation guard armed.\n", size, alloc_tag_names[tag]);
+        abort();
+    }
+    alloc_counts[tag].fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes[tag].fetch_add(size, std::memory_order_relaxed);
+}
+
+void read_alloc_counts(AllocCounts* counts)
+{
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti)
+    {
+        counts->allocations[ti] = alloc_counts[ti].load(std::memory_order_relaxed);
+        counts->bytes[ti] = alloc_bytes[ti].load(std::memory_order_relaxed);
+    }
+    counts->frees = free_count.load(std::memory_order_relaxed);
+}
+
+// Read without stdio, which would allocate a buffer every call
+uint64_t read_resident_bytes()
+{
+#if defined(__linux__)
+    int file = open("/proc/self/statm", O_RDONLY);
+    if(file < 0) return 0;
+    char text[128];
+    ssize_t length = read(file, text, sizeof(text) - 1);
+    close(file);
+    if(length <= 0) return 0;
+    text[length] = '\0';
+    // Total size, then resident, in pages
+    const char* resident = strchr(text, ' ');
+    return resident ? strtoull(resident + 1, 0, 10) * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+void* counted_malloc(size_t size, AllocTag tag)
+{
+    count_allocation(size, tag);
+    return malloc(size);
+}
+
+void* counted_realloc(void* block, size_t size, AllocTag tag)
+{
+    count_allocation(size, tag);
+    return realloc(block, size);
+}
+
+void counted_free(void* block)
+{
+    if(block) free_count.fetch_add(1, std::memory_order_relaxed);
+    free(block);
+}
+
+AllocTag set_alloc_tag(AllocTag tag)
+{
+    AllocTag previous = thread_tag;
+    thread_tag = tag;
+    return previous;
+}
+
+void set_alloc_guard(bool armed)
+{
+    thread_guarded = armed;
+}
+
+/*
+################################################
+##                 BLOCK POOL                 ##
+################################################
+*/
+
+// Keeps the payload as aligned as malloc's
+struct alignas(16) PoolHeader
+{
+    size_t size_class;
+    size_t size;
+};
+
+#define POOL_OVERSIZED POOL_CLASSES
+
+static size_t pool_class(size_t size)
+{
+    size_t size_class = 0;
+    while(((size_t)1 << (size_class + POOL_MIN_SHIFT)) < size) ++size_class;
+    return size_class;
+}
+
+static bool carve_pool_chunk(BlockPool* pool)
+{
+    uint8_t* chunk = (uint8_t*)counted_malloc(POOL_CHUNK, pool->tag);
+    if(!chunk) return false;
+    pool->cursor = chunk;
+    pool->end = chunk + POOL_CHUNK;
+    pool->chunk_bytes += POOL_CHUNK;
+    return true;
+}
+
+void init_block_pool(BlockPool* pool, AllocTag tag)
+{
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->tag = tag;
+    memset(pool->free_blocks, 0, sizeof(pool->free_blocks));
+    pool->cursor = pool->end = 0;
+    pool->pooled = pool->oversized = pool->chunk_bytes = 0;
+    carve_pool_chunk(pool);
+}
+
+void* pool_alloc(BlockPool* pool, size_t size)
+{
+    if(size > POOL_MAX_BLOCK)
+    {
+        PoolHeader* header = (PoolHeader*)counted_malloc(sizeof(PoolHeader) + size, pool->tag);
+        if(!header) return 0;
+        header->size_class = POOL_OVERSIZED;
+        header->size = size;
+        std::lock_guard<std::mutex> guard(pool->lock);
+        ++pool->oversized;
+        return header + 1;
+    }
+
+    size_t size_class = pool_class(size);
+    size_t capacity = (size_t)1 << (size_class + POOL_MIN_SHIFT);
+    std::lock_guard<std::mutex> guard(pool->lock);
+    PoolHeader* header;
+    if(PoolBlock* block = pool->free_blocks[size_class])
+    {
+        pool->free_blocks[size_class] = block->next;
+        header = (PoolHeader*)block - 1;
+    }
+    else
+    {
+        size_t stride = sizeof(PoolHeader) + capacity;
+        if((size_t)(pool->end - pool->cursor) < stride && !carve_pool_chunk(pool)) return 0;
+        header = (PoolHeader*)pool->cursor;
+        pool->cursor += stride;
+    }
+    header->size_class = size_class;
+    header->size = size;
+    ++pool->pooled;
+    return header + 1;
+}
+
+void pool_free(BlockPool* pool, void* block)
+{
+    if(!block) return;
+    PoolHeader* header = (PoolHeader*)block - 1;
+    if(header->size_class == POOL_OVERSIZED)
+    {
+        counted_free(header);
+        return;
+    }
+    std::lock_guard<std::mutex> guard(pool->lock);
+    PoolBlock* free_block = (PoolBlock*)block;
+    free_block->next = pool->free_blocks[header->size_class];
+    pool->free_blocks[header->size_class] = free_block;
+}
+
+void* pool_realloc(BlockPool* pool, void* block, size_t size)
+{
+    if(!block) return pool_alloc(pool, size);
+    PoolHeader* header = (PoolHeader*)block - 1;
+    // Shrinking, or growing within the class, keeps the block
+    if(header->size_class != POOL_OVERSIZED && size <= ((size_t)1 << (header->size_class + POOL_MIN_SHIFT)))
+    {
+        header->size = size;
+        return block;
+    }
+    void* moved = pool_alloc(pool, size);
+    if(!moved) return 0;
+    memcpy(moved, block, header->size < size ? header->size : size);
+    pool_free(pool, block);
+    return moved;
+}
+
+/*
+    The replacements. The array, nothrow and sized forms of the standard
+    library all forward to these four.
+*/
+void* operator new(size_t size)
+{
+    count_allocation(size, thread_tag);
+    void* block = malloc(size ? size : 1);
+    if(!block) throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void* block) noexcept
+{
+    counted_free(block);
+}
+
+void* operator new(size_t size, std::align_val_t align)
+{
+    count_allocation(size, thread_tag);
+    size_t alignment = (size_t)align < sizeof(void*) ? sizeof(void*) : (size_t)align;
+#ifdef _WIN32
+    void* block = _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* block = 0;
+    if(posix_memalign(&block, alignment, size ? size : 1)) block = 0;
+#endif
+    if(!block) throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void* block, std::align_val_t) noexcept
+{
+    if(block) free_count.fetch_add(1, std::memory_order_relaxed);
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
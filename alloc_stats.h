@@ -0,0 +1,108 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+/*
+    Allocation telemetry. The global operator new and delete are replaced
+    by counting versions over malloc, and GLFW gets counting callbacks
+    too, so every heap allocation is attributed to the subsystem the
+    allocating thread has tagged itself with. A thread can also arm a
+    guard that aborts on its next allocation, which is how --no-alloc
+    holds the steady-state frame to zero allocations.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+enum AllocTag: uint8_t
+{
+    ALLOC_OTHER,
+    ALLOC_SIMULATION,
+    ALLOC_RENDER,
+    ALLOC_PRESENT,
+    ALLOC_GLFW,
+    NUM_ALLOC_TAGS
+};
+
+extern const char* alloc_tag_names[NUM_ALLOC_TAGS];
+
+// Totals since startup, over every thread
+struct AllocCounts
+{
+    uint64_t allocations[NUM_ALLOC_TAGS];
+    uint64_t bytes[NUM_ALLOC_TAGS];
+    uint64_t frees;
+};
+
+void read_alloc_counts(AllocCounts* counts);
+// Resident set size of the process, 0 where it isn't read (Linux only)
+uint64_t read_resident_bytes();
+
+// For allocators outside operator new, counted under 'tag' whatever the
+// thread's own tag is
+void* counted_malloc(size_t size, AllocTag tag);
+void* counted_realloc(void* block, size_t size, AllocTag tag);
+void counted_free(void* block);
+
+AllocTag set_alloc_tag(AllocTag tag);
+// While armed, the calling thread's next allocation aborts the process
+void set_alloc_guard(bool armed);
+
+struct AllocScope
+{
+    AllocTag previous;
+
+    explicit AllocScope(AllocTag tag)
+    {
+        previous = set_alloc_tag(tag);
+    }
+    ~AllocScope()
+    {
+        set_alloc_tag(previous);
+    }
+};
+
+/*
+    Size-class pool for allocators that churn small blocks, like GLFW's
+    monitor, event and clipboard structures. Requests up to
+    POOL_MAX_BLOCK bytes are rounded up to a power of two and served from
+    that class's free list, refilled by carving POOL_CHUNK-byte chunks
+    that are never returned, so once the pool has warmed up a steady
+    stream of them reaches malloc no more. Larger requests go straight to
+    counted_malloc(). Every block is preceded by a header holding its
+    class, which is how frees and reallocs find their way back.
+*/
+#define POOL_MIN_SHIFT 4
+#define POOL_MAX_SHIFT 12
+#define POOL_MAX_BLOCK (1 << POOL_MAX_SHIFT)
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_CHUNK 65536
+
+struct PoolBlock
+{
+    PoolBlock* next;
+};
+
+struct BlockPool
+{
+    std::mutex lock;
+    AllocTag tag;
+    PoolBlock* free_blocks[POOL_CLASSES];
+    uint8_t* cursor;
+    uint8_t* end;
+    // Requests served from the free lists, sent on to malloc, and bytes
+    // of chunks carved so far
+    uint64_t pooled, oversized, chunk_bytes;
+};
+
+// Carves the first chunk up front so the pool starts warm
+void init_block_pool(BlockPool* pool, AllocTag tag);
+void* pool_alloc(BlockPool* pool, size_t size);
+void* pool_realloc(BlockPool* pool, void* block, size_t size);
+void pool_free(BlockPool* pool, void* block);
+
+#define ALLOC_JOIN(a, b) a##b
+#define ALLOC_SCOPE_AT(tag, line) AllocScope ALLOC_JOIN(alloc_scope_, line)(tag)
+#define ALLOC_SCOPE(tag) ALLOC_SCOPE_AT(tag, __LINE__)
+
+#endif
@@ -0,0 +1,499 @@
+#include <cstdio>
+#include <cstring>
+#include "assets.h"
+#include "present.h"
+#include "threads.h"
+
+/*
+################################################
+##                STORY PAGES                 ##
+################################################
+*/
+
+#define STORY_READ_LINE 256
+#define STORY_MAX_PATH 1024
+
+// The whole file in a block of its own, 0 if it can't be read
+static char* read_text_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file) return 0;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = length >= 0 ? new char[(size_t)length + 1] : 0;
+    bool ok = text && fread(text, 1, (size_t)length, file) == (size_t)length;
+    fclose(file);
+    if(!ok)
+    {
+        delete[] text;
+        return 0;
+    }
+    *size = (size_t)length;
+    return text;
+}
+
+// The next line of the text at '*cursor' into 'line' without its ending,
+// cut to fit. 'length' is the whole line's. False past the last line.
+static bool next_line(const char** cursor, const char* end, char* line, size_t line_size, size_t* length)
+{
+    const char* start = *cursor;
+    if(start == end) return false;
+
+    const char* newline = (const char*)memchr(start, '\n', (size_t)(end - start));
+    const char* stop = newline ? newline : end;
+    *cursor = newline ? newline + 1 : end;
+    while(stop > start && stop[-1] == '\r') --stop;
+
+    *length = (size_t)(stop - start);
+    size_t kept = *length < line_size ? *length : line_size - 1;
+    memcpy(line, start, kept);
+    line[kept] = '\0';
+    return true;
+}
+
+static bool parse_story_pages(StoryPageData* data, const char* text, size_t size, const char* path)
+{
+    bool ok = true;
+    int page = -1;
+    char line[STORY_READ_LINE];
+    size_t length = 0, line_number = 0;
+    const char* cursor = text;
+    while(ok && next_line(&cursor, text + size, line, sizeof(line), &length))
+    {
+        ++line_number;
+        if(!length || line[0] == '#') continue;
+
+        if(!strncmp(line, "page ", 5))
+        {
+            unsigned index = 0;
+            float seconds = STORY_DEFAULT_SECONDS;
+            if(sscanf(line, "page %u %f", &index, &seconds) < 1 || index >= NUM_PAGES)
+            {
+                fprintf(stderr, "%s:%zu: expected 'page INDEX [SECONDS]' with INDEX below %d.\n", path, line_number, NUM_PAGES);
+                ok = false;
+                continue;
+            }
+            else if(data->defined[index])
+            {
+                fprintf(stderr, "%s:%zu: page %u is defined twice.\n", path, line_number, index);
+                ok = false;
+            }
+            page = (int)index;
+            data->defined[index] = 1;
+            data->display_time[index] = seconds;
+            continue;
+        }
+
+        if(page < 0)
+        {
+            fprintf(stderr, "%s:%zu: text before the first 'page' line.\n", path, line_number);
+            ok = false;
+        }
+        else if(length > STORY_MAX_LINE)
+        {
+            fprintf(stderr, "%s:%zu: line is longer than %d characters.\n", path, line_number, STORY_MAX_LINE);
+            ok = false;
+        }
+        else if(data->num_lines[page] == STORY_MAX_LINES)
+        {
+            fprintf(stderr, "%s:%zu: page %d has more than %d lines.\n", path, line_number, page, STORY_MAX_LINES);
+            ok = false;
+        }
+        else
+        {
+            memcpy(data->line_text[page][data->num_lines[page]++], line, length + 1);
+        }
+    }
+    return ok;
+}
+
+// The payload of a mapped cache compiled from this very text, or 0
+static const StoryPageData* check_story_cache(const uint8_t* cache, size_t cache_size, uint64_t source_hash, size_t source_size)
+{
+    if(cache_size != sizeof(StoryCacheHeader) + sizeof(StoryPageData)) return 0;
+
+    const StoryCacheHeader* header = (const StoryCacheHeader*)cache;
+    if(header->magic != STORY_CACHE_MAGIC || header->version != STORY_CACHE_VERSION || header->data_size != sizeof(StoryPageData)) return 0;
+    if(header->source_hash != source_hash || header->source_size != source_size) return 0;
+
+    // A cache isn't trusted further than the parser's own limits
+    const StoryPageData* data = (const StoryPageData*)(cache + sizeof(StoryCacheHeader));
+    for(size_t pi = 0; pi < NUM_PAGES; ++pi)
+    {
+        if(data->defined[pi] > 1 || data->num_lines[pi] > STORY_MAX_LINES) return 0;
+        for(size_t li = 0; li < data->num_lines[pi]; ++li)
+        {
+            if(!memchr(data->line_text[pi][li], '\0', STORY_MAX_LINE + 1)) return 0;
+        }
+    }
+    return data;
+}
+
+static bool write_story_cache(const char* cache_path, const StoryPageData& data, uint64_t source_hash, size_t source_size)
+{
+    char temp_path[STORY_MAX_PATH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+    FILE* file = fopen(temp_path, "wb");
+    if(!file) return false;
+
+    StoryCacheHeader header = {STORY_CACHE_MAGIC, STORY_CACHE_VERSION, (uint32_t)sizeof(StoryPageData), 0, source_hash, (uint64_t)source_size};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(&data, sizeof(data), 1, file) == 1;
+    if(fclose(file) != 0) ok = false;
+#if defined(_WIN32)
+    // rename() does not replace an existing file there
+    if(ok) remove(cache_path);
+#endif
+    if(ok && rename(temp_path, cache_path) != 0) ok = false;
+    if(!ok) remove(temp_path);
+    return ok;
+}
+
+StoryPages* load_story_pages(const char* path)
+{
+    size_t source_size = 0;
+    char* text = read_text_file(path, &source_size);
+    if(!text)
+    {
+        fprintf(stderr, "Could not open story pages '%s'.\n", path);
+        return 0;
+    }
+    uint64_t source_hash = hash_bytes(14695981039346656037ull, text, source_size);
+
+    char cache_path[STORY_MAX_PATH];
+    bool cached = snprintf(cache_path, sizeof(cache_path), "%s.cache", path) < (int)sizeof(cache_path);
+
+    StoryPages* pages = new StoryPages{};
+    if(cached && map_file(cache_path, &pages->cache, &pages->cache_size))
+    {
+        pages->data = check_story_cache(pages->cache, pages->cache_size, source_hash, source_size);
+        if(!pages->data)
+        {
+            unmap_file(pages->cache, pages->cache_size);
+            pages->cache = 0;
+        }
+    }
+
+    if(pages->data)
+    {
+        printf("Story pages: '%s' from its cache\n", path);
+    }
+    else
+    {
+        if(!parse_story_pages(&pages->parsed, text, source_size, path))
+        {
+            delete[] text;
+            free_story_pages(pages);
+            return 0;
+        }
+        pages->data = &pages->parsed;
+        if(cached && write_story_cache(cache_path, pages->parsed, source_hash, source_size))
+        {
+            printf("Story pages: '%s' compiled into '%s'\n", path, cache_path);
+        }
+        else
+        {
+            printf("Story pages: '%s' parsed, could not write its cache\n", path);
+        }
+    }
+    delete[] text;
+
+    for(size_t pi = 0; pi < NUM_PAGES; ++pi)
+    {
+        for(size_t li = 0; li < pages->data->num_lines[pi]; ++li) pages->lines[pi][li] = pages->data->line_text[pi][li];
+    }
+    return pages;
+}
+
+void free_story_pages(StoryPages* pages)
+{
+    while(pages)
+    {
+        StoryPages* retired = pages->retired;
+        if(pages->cache) unmap_file(pages->cache, pages->cache_size);
+        delete pages;
+        pages = retired;
+    }
+}
+
+// An undefined page is left empty, which ends the story there
+static void apply_story_page(GameState* state, const StoryPages& pages, size_t pi)
+{
+    TextAnimation* msg_animation = &state->msg_animation;
+    TextPage& page = msg_animation->pages[pi];
+    page.num_lines = pages.data->defined[pi] ? pages.data->num_lines[pi] : 0;
+    page.lines = arena_array<const char*>(&state->level, page.num_lines);
+    for(size_t li = 0; li < page.num_lines; ++li) page.lines[li] = pages.lines[pi][li];
+    page.display_time = pages.data->defined[pi] ? pages.data->display_time[pi] : 0.0f;
+    compile_text_page(&page, &state->level);
+
+    // A page on screen keeps typing from where it was, as far as it goes
+    if(msg_animation->current_page == pi && msg_animation->current_line >= page.num_lines)
+    {
+        msg_animation->current_line = page.num_lines ? page.num_lines - 1 : 0;
+    }
+}
+
+void apply_story_pages(GameState* state, const StoryPages& pages)
+{
+    for(size_t pi = 0; pi < NUM_PAGES; ++pi)
+    {
+        if(pages.data->defined[pi]) apply_story_page(state, pages, pi);
+    }
+}
+
+/*
+################################################
+##                 HOT RELOAD                 ##
+################################################
+*/
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+static bool same_story_page(const StoryPages& a, const StoryPages& b, size_t pi)
+{
+    const StoryPageData& da = *a.data;
+    const StoryPageData& db = *b.data;
+    if(da.defined[pi] != db.defined[pi] || da.display_time[pi] != db.display_time[pi] || da.num_lines[pi] != db.num_lines[pi]) return false;
+    for(size_t li = 0; li < da.num_lines[pi]; ++li)
+    {
+        if(strcmp(a.lines[pi][li], b.lines[pi][li])) return false;
+    }
+    return true;
+}
+
+// Swaps in the pages that differ from '*pages', which is kept as retired
+static void apply_reloaded_pages(StoryPages** pages, StoryPages* reloaded, GameState* state, FrameRenderer* renderer, const char* path)
+{
+    size_t changed = 0;
+    for(size_t pi = 0; pi < NUM_PAGES; ++pi)
+    {
+        bool same = *pages ? same_story_page(**pages, *reloaded, pi) : !reloaded->data->defined[pi];
+        if(same) continue;
+        apply_story_page(state, *reloaded, pi);
+        ++changed;
+    }
+    if(changed && renderer) invalidate_hud(renderer);
+    reloaded->retired = *pages;
+    *pages = reloaded;
+    printf("Reloaded '%s': %zu of %d pages changed\n", path, changed, NUM_PAGES);
+}
+
+struct AssetWatcher
+{
+    std::thread thread;
+    // Written to stop the thread
+    int wake_fd;
+    int inotify_fd;
+
+    const char* atlas_path;
+    const char* pages_path;
+    // Watches of the directories the files are in, and their names there
+    int atlas_watch, pages_watch;
+    const char* atlas_name;
+    const char* pages_name;
+
+    // Read on the thread, taken by apply_asset_reloads()
+    std::mutex mutex;
+    AtlasFile atlas;
+    StoryPages* pages;
+    size_t dropped;
+};
+
+static const char* file_name(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int watch_directory(AssetWatcher* watcher, const char* path)
+{
+    char directory[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    if(!slash) strcpy(directory, ".");
+    else snprintf(directory, sizeof(directory), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+
+    // Editors save by renaming a new file over the old, pack_atlas too
+    int watch = inotify_add_watch(watcher->inotify_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(watch < 0) fprintf(stderr, "Could not watch '%s': %s\n", directory, strerror(errno));
+    return watch;
+}
+
+static void reload_atlas(AssetWatcher* watcher)
+{
+    AtlasFile atlas;
+    if(!open_atlas_file(&atlas, watcher->atlas_path)) return;
+
+    std::lock_guard<std::mutex> lock(watcher->mutex);
+    if(watcher->atlas.data)
+    {
+        close_atlas_file(&watcher->atlas);
+        ++watcher->dropped;
+    }
+    watcher->atlas = atlas;
+}
+
+static void reload_pages(AssetWatcher* watcher)
+{
+    StoryPages* pages = load_story_pages(watcher->pages_path);
+    if(!pages) return;
+
+    std::lock_guard<std::mutex> lock(watcher->mutex);
+    if(watcher->pages)
+    {
+        free_story_pages(watcher->pages);
+        ++watcher->dropped;
+    }
+    watcher->pages = pages;
+}
+
+static void asset_watcher_main(AssetWatcher* watcher)
+{
+    enter_thread_role(THREAD_BACKGROUND);
+    for(;;)
+    {
+        pollfd fds[2] = {{watcher->wake_fd, POLLIN, 0}, {watcher->inotify_fd, POLLIN, 0}};
+        if(poll(fds, 2, -1) < 0 && errno != EINTR) return;
+        if(fds[0].revents) return;
+        if(!fds[1].revents) continue;
+
+        // A burst of events for one file reloads it once
+        bool atlas_changed = false, pages_changed = false;
+        alignas(inotify_event) char buffer[16384];
+        ssize_t bytes = read(watcher->inotify_fd, buffer, sizeof(buffer));
+        for(ssize_t offset = 0; offset < bytes;)
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            if(event->len)
+            {
+                if(event->wd == watcher->atlas_watch && !strcmp(event->name, watcher->atlas_name)) atlas_changed = true;
+                if(event->wd == watcher->pages_watch && !strcmp(event->name, watcher->pages_name)) pages_changed = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+
+        if(atlas_changed) reload_atlas(watcher);
+        if(pages_changed) reload_pages(watcher);
+        // Wakes a frame loop idling in the event wait to take them
+        if(atlas_changed || pages_changed) glfwPostEmptyEvent();
+    }
+}
+
+AssetWatcher* start_asset_watcher(const char* atlas_path, const char* pages_path)
+{
+    AssetWatcher* watcher = new AssetWatcher{};
+    watcher->atlas_path = atlas_path;
+    watcher->pages_path = pages_path;
+    watcher->atlas_watch = watcher->pages_watch = -1;
+    watcher->wake_fd = eventfd(0, EFD_CLOEXEC);
+    watcher->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if(watcher->wake_fd < 0 || watcher->inotify_fd < 0)
+    {
+        fprintf(stderr, "Could not set up asset hot reload.\n");
+        stop_asset_watcher(watcher);
+        return 0;
+    }
+
+    if(atlas_path)
+    {
+        watcher->atlas_watch = watch_directory(watcher, atlas_path);
+        watcher->atlas_name = file_name(atlas_path);
+    }
+    if(pages_path)
+    {
+        watcher->pages_watch = watch_directory(watcher, pages_path);
+        watcher->pages_name = file_name(pages_path);
+    }
+    if(watcher->atlas_watch < 0 && watcher->pages_watch < 0)
+    {
+        fprintf(stderr, "--watch has no --atlas or --pages file to watch.\n");
+        stop_asset_watcher(watcher);
+        return 0;
+    }
+
+    printf("Watching%s%s%s%s for changes\n",
+        watcher->atlas_watch >= 0 ? " " : "", watcher->atlas_watch >= 0 ? atlas_path : "",
+        watcher->pages_watch >= 0 ? " " : "", watcher->pages_watch >= 0 ? pages_path : "");
+    watcher->thread = std::thread(asset_watcher_main, watcher);
+    return watcher;
+}
+
+void stop_asset_watcher(AssetWatcher* watcher)
+{
+    if(watcher->thread.joinable())
+    {
+        uint64_t one = 1;
+        if(write(watcher->wake_fd, &one, sizeof(one)) < 0) perror("asset watcher wake");
+        watcher->thread.join();
+    }
+    if(watcher->inotify_fd >= 0) close(watcher->inotify_fd);
+    if(watcher->wake_fd >= 0) close(watcher->wake_fd);
+    close_atlas_file(&watcher->atlas);
+    free_story_pages(watcher->pages);
+    if(watcher->dropped) printf("Hot reload dropped %zu reloads for newer ones\n", watcher->dropped);
+    delete watcher;
+}
+
+void apply_asset_reloads(AssetWatcher* watcher, AtlasFile* atlas, FrameRenderer* renderer, StoryPages** pages, GameState* state)
+{
+    AtlasFile reloaded_atlas;
+    StoryPages* reloaded_pages;
+    {
+        std::lock_guard<std::mutex> lock(watcher->mutex);
+        reloaded_atlas = watcher->atlas;
+        reloaded_pages = watcher->pages;
+        watcher->atlas = AtlasFile{};
+        watcher->pages = 0;
+    }
+
+    if(reloaded_atlas.data && renderer)
+    {
+        // Every slot moves off the old mapping before it is closed, to the
+        // built-in sprite when the new atlas lacks it
+        AtlasSlot slots[] = {
+            {"title", &renderer->title_sprite, 1},
+            {"particle", &renderer->particle_sprite, 1},
+            {"font", &renderer->font.sheet, FONT_NUM_GLYPHS},
+        };
+        const Sprite builtins[] = {builtin_title_sprite, builtin_particle_sprite, builtin_text_spritesheet};
+        size_t num_slots = sizeof(slots) / sizeof(slots[0]);
+        size_t changed = 0;
+        for(size_t si = 0; si < num_slots; ++si)
+        {
+            Sprite replacement = builtins[si];
+            const AtlasFileEntry* entry = find_atlas_file_entry(reloaded_atlas, slots[si].name);
+            if(entry && entry->num_frames == slots[si].num_frames) replacement = atlas_file_sprite(reloaded_atlas, *entry);
+            else if(entry) fprintf(stderr, "Atlas sprite '%s' has %u frames, expected %zu.\n", slots[si].name, entry->num_frames, slots[si].num_frames);
+            if(replace_renderer_sprite(renderer, slots[si].sprite, replacement, slots[si].num_frames)) ++changed;
+        }
+        close_atlas_file(atlas);
+        *atlas = reloaded_atlas;
+        printf("Reloaded '%s': %zu of %zu sprites changed\n", watcher->atlas_path, changed, num_slots);
+    }
+    else close_atlas_file(&reloaded_atlas);
+
+    if(reloaded_pages) apply_reloaded_pages(pages, reloaded_pages, state, renderer, watcher->pages_path);
+}
+
+#else
+
+struct AssetWatcher {};
+
+AssetWatcher* start_asset_watcher(const char*, const char*)
+{
+    fprintf(stderr, "Asset hot reload is Linux only.\n");
+    return 0;
+}
+
+void stop_asset_watcher(AssetWatcher* watcher) { delete watcher; }
+void apply_asset_reloads(AssetWatcher*, AtlasFile*, FrameRenderer*, StoryPages**, GameState*) {}
+
+#endif
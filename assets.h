@@ -0,0 +1,113 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+/*
+    Story pages and asset hot reload. --pages reads the story's text from
+    a file instead of leaving the pages init_game_state() sets up empty:
+
+        page INDEX [SECONDS]
+        TEXT OF THE FIRST LINE
+        TEXT OF THE NEXT LINE
+
+    Each 'page' line starts a page, SECONDS is how long it stays up once
+    typed out, and every line up to the next one is a line of it, up to
+    STORY_MAX_LINE characters. Lines starting with '#' and blank lines are
+    skipped, a single space makes an empty line. How pages lead on to one
+    another stays the game's, see PageFlow.
+
+    With --watch a thread of its own blocks on an inotify watch of the
+    directories the --atlas and --pages files are in, since editors and
+    pack_atlas replace a file rather than write it in place. A changed
+    atlas is mapped and validated and a changed pages file parsed on that
+    thread; the result waits in a mailbox for the frame loop, which takes
+    it between frames. Only the sprites whose pixels differ and the pages
+    whose text differs are swapped in, and only what was drawn from them
+    is dropped: the glyph runs and scaled strips of a changed sprite, the
+    title and HUD layers. Caches of an unchanged sprite are moved over to
+    its copy in the new file as they are. A reload that is still being
+    read when a newer one arrives is dropped for it. Linux only;
+    start_asset_watcher() returns 0 anywhere else.
+
+    A pages file is compiled once: parsed, then written beside it as
+    PATH.cache, a header and the StoryPageData parsed from it, which
+    holds no pointers. Later runs read the text only to hash it; when the
+    cache's version, layout size and source hash and size all match, it
+    is mapped and its pages used in place, and any mismatch parses the
+    text and writes the cache again. The cache is written to a temporary
+    file and renamed over the old one, so a game still mapping that one
+    keeps its copy. One that can't be written just costs the next run a
+    parse.
+
+    The game core collides against its own sprites, so as with --atlas
+    only art that is just drawn reloads, and replaced pages stay in memory
+    until exit since saved rollback states may still point at them.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "render.h"
+
+#define STORY_MAX_LINES 16
+#define STORY_MAX_LINE 32
+#define STORY_DEFAULT_SECONDS 3.0f
+
+#define STORY_CACHE_MAGIC 0x50595453u // "STYP"
+// Bump when StoryPageData changes in a way its size doesn't show
+#define STORY_CACHE_VERSION 1
+
+// The parsed pages, fixed-width and pointer-free: the payload of the cache
+struct StoryPageData
+{
+    uint8_t defined[NUM_PAGES];
+    float display_time[NUM_PAGES];
+    uint32_t num_lines[NUM_PAGES];
+    char line_text[NUM_PAGES][STORY_MAX_LINES][STORY_MAX_LINE + 1];
+};
+
+struct StoryCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // sizeof(StoryPageData) when written
+    uint32_t data_size;
+    uint32_t reserved;
+    // FNV-1a and size of the text it was compiled from
+    uint64_t source_hash;
+    uint64_t source_size;
+};
+
+struct StoryPages
+{
+    // 'parsed', or the payload of the mapped cache
+    const StoryPageData* data;
+    StoryPageData parsed;
+    // lines[pi][li] points at data->line_text[pi][li]
+    const char* lines[NUM_PAGES][STORY_MAX_LINES];
+
+    // The mapped cache, 0 when parsed
+    const uint8_t* cache;
+    size_t cache_size;
+
+    // Versions this one replaced, freed along with it
+    StoryPages* retired;
+};
+
+// Returns 0 and says why when the file is missing or malformed
+StoryPages* load_story_pages(const char* path);
+void free_story_pages(StoryPages* pages);
+// Fills the pages of 'state' that 'pages' defines
+void apply_story_pages(GameState* state, const StoryPages& pages);
+
+struct AssetWatcher;
+
+// Either path may be 0. 'atlas_path' is only watched where the renderer
+// draws the sprites it maps, not on the GPU's own atlas.
+AssetWatcher* start_asset_watcher(const char* atlas_path, const char* pages_path);
+void stop_asset_watcher(AssetWatcher* watcher);
+
+// Call between frames. Swaps in whatever was reloaded since the last
+// call: sprites into 'renderer', replacing 'atlas', and pages into
+// 'state', replacing '*pages'. 'renderer' may be 0 to leave sprites be.
+void apply_asset_reloads(AssetWatcher* watcher, AtlasFile* atlas, FrameRenderer* renderer, StoryPages** pages, GameState* state);
+
+#endif
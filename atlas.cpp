@@ -0,0 +1,137 @@
+#include <cstdio>
+#include <cstring>
+#include "atlas.h"
+
+#if defined(_WIN32)
+#define ATLAS_USE_MMAP 0
+#else
+#define ATLAS_USE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool map_file(const char* path, const uint8_t** data, size_t* size)
+{
+#if ATLAS_USE_MMAP
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) return false;
+
+    *data = (const uint8_t*)mapped;
+    *size = (size_t)info.st_size;
+    return true;
+#else
+    FILE* file = fopen(path, "rb");
+    if(!file) return false;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(length <= 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    // uint64_t storage keeps the row data 8-byte aligned
+    uint64_t* block = new uint64_t[((size_t)length + 7) / 8];
+    bool ok = fread(block, 1, (size_t)length, file) == (size_t)length;
+    fclose(file);
+    if(!ok)
+    {
+        delete[] block;
+        return false;
+    }
+
+    *data = (const uint8_t*)block;
+    *size = (size_t)length;
+    return true;
+#endif
+}
+
+void unmap_file(const uint8_t* data, size_t size)
+{
+#if ATLAS_USE_MMAP
+    munmap((void*)data, size);
+#else
+    (void)size;
+    delete[] (const uint64_t*)data;
+#endif
+}
+
+static bool validate_atlas_file(const AtlasFile& atlas)
+{
+    if(atlas.size < sizeof(AtlasFileHeader)) return false;
+
+    const AtlasFileHeader* header = (const AtlasFileHeader*)atlas.data;
+    if(header->magic != ATLAS_MAGIC || header->version != ATLAS_VERSION) return false;
+    if(header->num_entries > (atlas.size - sizeof(AtlasFileHeader)) / sizeof(AtlasFileEntry)) return false;
+
+    const AtlasFileEntry* entries = (const AtlasFileEntry*)(atlas.data + sizeof(AtlasFileHeader));
+    for(size_t ei = 0; ei < header->num_entries; ++ei)
+    {
+        const AtlasFileEntry& entry = entries[ei];
+        if(memchr(entry.name, '\0', ATLAS_NAME_LENGTH) == 0) return false;
+        if(entry.width == 0 || entry.width > 64 || entry.frame_height == 0 || entry.frame_height > UINT16_MAX || entry.num_frames == 0) return false;
+        if(entry.row_bits != atlas_row_bits(entry.width)) return false;
+        if(entry.offset % ATLAS_ALIGNMENT || entry.offset > atlas.size) return false;
+
+        uint64_t rows = (uint64_t)entry.frame_height * entry.num_frames;
+        if(rows > (atlas.size - entry.offset) / (entry.row_bits / 8)) return false;
+    }
+    return true;
+}
+
+bool open_atlas_file(AtlasFile* atlas, const char* path)
+{
+    *atlas = AtlasFile{};
+    if(!map_file(path, &atlas->data, &atlas->size))
+    {
+        fprintf(stderr, "Could not read sprite atlas '%s'.\n", path);
+        return false;
+    }
+
+    if(!validate_atlas_file(*atlas))
+    {
+        fprintf(stderr, "'%s' is not a valid sprite atlas.\n", path);
+        close_atlas_file(atlas);
+        return false;
+    }
+
+    atlas->entries = (const AtlasFileEntry*)(atlas->data + sizeof(AtlasFileHeader));
+    atlas->num_entries = ((const AtlasFileHeader*)atlas->data)->num_entries;
+    return true;
+}
+
+void close_atlas_file(AtlasFile* atlas)
+{
+    if(!atlas->data) return;
+    unmap_file(atlas->data, atlas->size);
+    *atlas = AtlasFile{};
+}
+
+const AtlasFileEntry* find_atlas_file_entry(const AtlasFile& atlas, const char* name)
+{
+    for(size_t ei = 0; ei < atlas.num_entries; ++ei)
+    {
+        if(!strncmp(atlas.entries[ei].name, name, ATLAS_NAME_LENGTH)) return &atlas.entries[ei];
+    }
+    return 0;
+}
+
+Sprite atlas_file_sprite(const AtlasFile& atlas, const AtlasFileEntry& entry)
+{
+    return Sprite{(uint16_t)entry.width, (uint16_t)entry.frame_height, (uint8_t)entry.row_bits, atlas.data + entry.offset};
+}
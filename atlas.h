@@ -0,0 +1,64 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+/*
+    Sprite atlas file. pack_atlas turns ASCII-art sprite sheets into one
+    binary file: a header, an index of named entries and the packed rows,
+    laid out exactly like PackedSprite, each frame bottom row first, so
+    the game can point Sprite views straight into the mapped file without
+    parsing anything.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "game.h"
+
+#define ATLAS_MAGIC 0x534c5441u // "ATLS"
+#define ATLAS_VERSION 2
+#define ATLAS_NAME_LENGTH 16
+// Row data starts on this boundary so 64-bit rows load aligned
+#define ATLAS_ALIGNMENT 8
+
+struct AtlasFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t reserved;
+};
+
+// One sheet: 'num_frames' frames of width x frame_height stacked vertically
+struct AtlasFileEntry
+{
+    char name[ATLAS_NAME_LENGTH];
+    uint32_t width, frame_height, num_frames;
+    uint32_t row_bits;
+    uint64_t offset;
+};
+
+struct AtlasFile
+{
+    const uint8_t* data;
+    size_t size;
+    const AtlasFileEntry* entries;
+    size_t num_entries;
+};
+
+// Row width in bits for a sprite 'width' pixels wide, as SpriteRow picks it
+inline uint32_t atlas_row_bits(uint32_t width)
+{
+    return width <= 16 ? 16 : width <= 32 ? 32 : 64;
+}
+
+// A whole file mapped read-only, or read into one 8-byte aligned block
+// where there is no mmap. Sound banks are mapped the same way.
+bool map_file(const char* path, const uint8_t** data, size_t* size);
+void unmap_file(const uint8_t* data, size_t size);
+
+bool open_atlas_file(AtlasFile* atlas, const char* path);
+void close_atlas_file(AtlasFile* atlas);
+const AtlasFileEntry* find_atlas_file_entry(const AtlasFile& atlas, const char* name);
+// Sprite view of an entry's first frame; later frames follow at frame_height rows each
+Sprite atlas_file_sprite(const AtlasFile& atlas, const AtlasFileEntry& entry);
+
+#endif
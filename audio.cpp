@@ -0,0 +1,487 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "atlas.h"
+#include "audio.h"
+#include "game.h"
+#include "threads.h"
+#include "trace.h"
+
+#ifdef SPACE_INVADERS_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#define AUDIO_RING_CAPACITY 64
+// Headroom for a handful of voices at full gain before the clamp
+#define AUDIO_MASTER_GAIN 0.35f
+// How far ahead of the speaker ALSA is kept, in microseconds
+#define AUDIO_LATENCY_US 30000
+#define MARCH_BEATS 4
+
+// The mixer's samples, one per game sound but four for the march, which
+// walks down four bass notes as in the arcade game
+enum AudioSample: uint8_t
+{
+    SAMPLE_SHOT,
+    SAMPLE_EXPLOSION,
+    SAMPLE_PLAYER_HIT,
+    SAMPLE_MARCH,
+    NUM_SAMPLES = SAMPLE_MARCH + MARCH_BEATS
+};
+
+enum AudioCommandType: uint8_t
+{
+    AUDIO_TRIGGER,
+    // Silences every voice playing the sample
+    AUDIO_STOP
+};
+
+struct AudioCommand
+{
+    AudioCommandType type;
+    AudioSample sample;
+    float gain;
+};
+
+struct Voice
+{
+    const float* samples;
+    size_t length;
+    size_t position;
+    float gain;
+    // Trigger count when it started, the smallest is stolen first
+    uint64_t started;
+    AudioSample sample;
+};
+
+static const char* sample_names[NUM_SAMPLES] = {
+    "shot", "explosion", "player_hit", "march0", "march1", "march2", "march3"
+};
+
+struct AudioMixer
+{
+    // Padded with silence to a multiple of four samples. 'synthesized'
+    // ones are the mixer's own, the rest point into a sound bank.
+    const float* samples[NUM_SAMPLES];
+    size_t lengths[NUM_SAMPLES];
+    bool synthesized[NUM_SAMPLES];
+
+    // Audio thread only; 'samples' is 0 in an idle voice
+    Voice voices[AUDIO_VOICES];
+    uint64_t triggers;
+    alignas(16) float period[AUDIO_PERIOD];
+
+    // head is only written by the mixer and tail by the frame loop
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    AudioCommand commands[AUDIO_RING_CAPACITY];
+    // Frame loop only
+    size_t dropped;
+    size_t march_beat;
+};
+
+/*
+################################################
+##                 SOUND BANK                 ##
+################################################
+*/
+
+static bool validate_sound_bank(const SoundBank& bank)
+{
+    if(bank.size < sizeof(SoundBankHeader)) return false;
+
+    const SoundBankHeader* header = (const SoundBankHeader*)bank.data;
+    if(header->magic != SOUND_BANK_MAGIC || header->version != SOUND_BANK_VERSION) return false;
+    if(header->num_entries > (bank.size - sizeof(SoundBankHeader)) / sizeof(SoundBankEntry)) return false;
+
+    const SoundBankEntry* entries = (const SoundBankEntry*)(bank.data + sizeof(SoundBankHeader));
+    for(size_t ei = 0; ei < header->num_entries; ++ei)
+    {
+        const SoundBankEntry& entry = entries[ei];
+        if(memchr(entry.name, '\0', SOUND_BANK_NAME_LENGTH) == 0) return false;
+        if(entry.num_samples == 0 || entry.num_samples % (SOUND_BANK_ALIGNMENT / sizeof(float))) return false;
+        if(entry.offset % SOUND_BANK_ALIGNMENT || entry.offset > bank.size) return false;
+        if(entry.num_samples > (bank.size - entry.offset) / sizeof(float)) return false;
+    }
+    return true;
+}
+
+bool open_sound_bank(SoundBank* bank, const char* path)
+{
+    *bank = SoundBank{};
+    if(!map_file(path, &bank->data, &bank->size))
+    {
+        fprintf(stderr, "Could not read sound bank '%s'.\n", path);
+        return false;
+    }
+
+    if(!validate_sound_bank(*bank))
+    {
+        fprintf(stderr, "'%s' is not a valid sound bank.\n", path);
+        close_sound_bank(bank);
+        return false;
+    }
+    // Samples are stored at the rate they are mixed at, never resampled here
+    uint32_t rate = ((const SoundBankHeader*)bank->data)->sample_rate;
+    if(rate != AUDIO_RATE)
+    {
+        fprintf(stderr, "Sound bank '%s' is at %u Hz, not %d.\n", path, rate, AUDIO_RATE);
+        close_sound_bank(bank);
+        return false;
+    }
+
+    bank->entries = (const SoundBankEntry*)(bank->data + sizeof(SoundBankHeader));
+    bank->num_entries = ((const SoundBankHeader*)bank->data)->num_entries;
+    return true;
+}
+
+void close_sound_bank(SoundBank* bank)
+{
+    if(!bank->data) return;
+    unmap_file(bank->data, bank->size);
+    *bank = SoundBank{};
+}
+
+static const SoundBankEntry* find_sound_bank_entry(const SoundBank& bank, const char* name)
+{
+    for(size_t ei = 0; ei < bank.num_entries; ++ei)
+    {
+        if(!strncmp(bank.entries[ei].name, name, SOUND_BANK_NAME_LENGTH)) return &bank.entries[ei];
+    }
+    return 0;
+}
+
+/*
+################################################
+##                  SYNTHESIS                 ##
+################################################
+*/
+
+static float* allocate_sample(AudioMixer* mixer, AudioSample sample, float seconds)
+{
+    size_t length = (size_t)(seconds * AUDIO_RATE);
+    size_t padded = (length + 3) & ~(size_t)3;
+    float* samples = new float[padded]();
+    mixer->samples[sample] = samples;
+    mixer->lengths[sample] = padded;
+    mixer->synthesized[sample] = true;
+    return samples;
+}
+
+static float square(float phase)
+{
+    return phase - floorf(phase) < 0.5f ? 1.0f : -1.0f;
+}
+
+// A square wave sliding down from 'from' to 'to' Hz
+static void synthesize_sweep(AudioMixer* mixer, AudioSample sample, float seconds, float from, float to)
+{
+    float* out = allocate_sample(mixer, sample, seconds);
+    size_t length = (size_t)(seconds * AUDIO_RATE);
+    float phase = 0.0f;
+    for(size_t i = 0; i < length; ++i)
+    {
+        float t = (float)i / (float)length;
+        phase += (from + (to - from) * t) / AUDIO_RATE;
+        out[i] = square(phase) * (1.0f - t);
+    }
+}
+
+// Noise held for 'hold' samples at a time, darker the longer the hold
+static void synthesize_noise(AudioMixer* mixer, AudioSample sample, float seconds, size_t hold)
+{
+    float* out = allocate_sample(mixer, sample, seconds);
+    size_t length = (size_t)(seconds * AUDIO_RATE);
+    uint32_t seed = 0x2545f491u;
+    float value = 0.0f;
+    for(size_t i = 0; i < length; ++i)
+    {
+        if(i % hold == 0)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            value = (float)(seed >> 8) / (float)(1u << 23) - 1.0f;
+        }
+        float fade = 1.0f - (float)i / (float)length;
+        out[i] = value * fade * fade;
+    }
+}
+
+// A short bass note with a click-free release
+static void synthesize_note(AudioMixer* mixer, AudioSample sample, float seconds, float frequency)
+{
+    float* out = allocate_sample(mixer, sample, seconds);
+    size_t length = (size_t)(seconds * AUDIO_RATE);
+    size_t release = length / 4;
+    for(size_t i = 0; i < length; ++i)
+    {
+        float level = i + release < length ? 1.0f : (float)(length - i) / (float)release;
+        out[i] = square((float)i * frequency / AUDIO_RATE) * level;
+    }
+}
+
+AudioMixer* create_audio_mixer(const SoundBank* bank)
+{
+    AudioMixer* mixer = new AudioMixer{};
+    mixer->head = 0;
+    mixer->tail = 0;
+    size_t from_bank = 0;
+    for(size_t si = 0; bank && si < NUM_SAMPLES; ++si)
+    {
+        const SoundBankEntry* entry = find_sound_bank_entry(*bank, sample_names[si]);
+        if(!entry) continue;
+        mixer->samples[si] = (const float*)(bank->data + entry->offset);
+        mixer->lengths[si] = entry->num_samples;
+        ++from_bank;
+    }
+    if(bank) printf("Sound bank: %zu of %d sounds\n", from_bank, (int)NUM_SAMPLES);
+
+    if(!mixer->samples[SAMPLE_SHOT]) synthesize_sweep(mixer, SAMPLE_SHOT, 0.12f, 1400.0f, 300.0f);
+    if(!mixer->samples[SAMPLE_EXPLOSION]) synthesize_noise(mixer, SAMPLE_EXPLOSION, 0.3f, 6);
+    if(!mixer->samples[SAMPLE_PLAYER_HIT]) synthesize_noise(mixer, SAMPLE_PLAYER_HIT, 0.8f, 24);
+    static const float march_notes[MARCH_BEATS] = {98.0f, 87.3f, 77.8f, 73.4f};
+    for(size_t bi = 0; bi < MARCH_BEATS; ++bi)
+    {
+        AudioSample sample = (AudioSample)(SAMPLE_MARCH + bi);
+        if(!mixer->samples[sample]) synthesize_note(mixer, sample, 0.09f, march_notes[bi]);
+    }
+    return mixer;
+}
+
+void destroy_audio_mixer(AudioMixer* mixer)
+{
+    for(size_t si = 0; si < NUM_SAMPLES; ++si)
+    {
+        if(mixer->synthesized[si]) delete[] mixer->samples[si];
+    }
+    if(mixer->dropped) fprintf(stderr, "Audio dropped %zu commands.\n", mixer->dropped);
+    delete mixer;
+}
+
+/*
+################################################
+##                  COMMANDS                  ##
+################################################
+*/
+
+static void send_command(AudioMixer* mixer, const AudioCommand& command)
+{
+    size_t tail = mixer->tail.load(std::memory_order_relaxed);
+    if(tail - mixer->head.load(std::memory_order_acquire) == AUDIO_RING_CAPACITY)
+    {
+        ++mixer->dropped;
+        return;
+    }
+    mixer->commands[tail % AUDIO_RING_CAPACITY] = command;
+    mixer->tail.store(tail + 1, std::memory_order_release);
+}
+
+void play_game_sounds(AudioMixer* mixer, uint32_t sounds)
+{
+    static const float gains[NUM_GAME_SOUNDS] = {0.5f, 0.7f, 0.9f, 0.8f};
+    for(size_t gi = 0; gi < NUM_GAME_SOUNDS; ++gi)
+    {
+        if(!(sounds & (1u << gi))) continue;
+        AudioSample sample = (AudioSample)gi;
+        if(gi == GAME_SOUND_MARCH)
+        {
+            size_t last = (mixer->march_beat + MARCH_BEATS - 1) % MARCH_BEATS;
+            send_command(mixer, AudioCommand{AUDIO_STOP, (AudioSample)(SAMPLE_MARCH + last), 0.0f});
+            sample = (AudioSample)(SAMPLE_MARCH + mixer->march_beat);
+            mixer->march_beat = (mixer->march_beat + 1) % MARCH_BEATS;
+        }
+        send_command(mixer, AudioCommand{AUDIO_TRIGGER, sample, gains[gi]});
+    }
+}
+
+// A free voice, or the one that has played longest
+static void trigger_voice(AudioMixer* mixer, AudioSample sample, float gain)
+{
+    Voice* voice = &mixer->voices[0];
+    for(size_t vi = 0; vi < AUDIO_VOICES; ++vi)
+    {
+        Voice* candidate = &mixer->voices[vi];
+        if(!candidate->samples)
+        {
+            voice = candidate;
+            break;
+        }
+        if(candidate->started < voice->started) voice = candidate;
+    }
+    *voice = Voice{mixer->samples[sample], mixer->lengths[sample], 0, gain, mixer->triggers++, sample};
+}
+
+static void apply_commands(AudioMixer* mixer)
+{
+    size_t head = mixer->head.load(std::memory_order_relaxed);
+    size_t tail = mixer->tail.load(std::memory_order_acquire);
+    for(; head != tail; ++head)
+    {
+        const AudioCommand& command = mixer->commands[head % AUDIO_RING_CAPACITY];
+        if(command.type == AUDIO_TRIGGER) trigger_voice(mixer, command.sample, command.gain);
+        else
+        {
+            for(size_t vi = 0; vi < AUDIO_VOICES; ++vi)
+            {
+                if(mixer->voices[vi].sample == command.sample) mixer->voices[vi].samples = 0;
+            }
+        }
+    }
+    mixer->head.store(head, std::memory_order_release);
+}
+
+/*
+################################################
+##                   MIXING                   ##
+################################################
+*/
+
+// period[i] += gain * samples[i] for 'count' samples, a multiple of four;
+// voices are padded so the last block reads silence
+static void accumulate_voice(float* period, const float* samples, float gain, size_t count)
+{
+#if defined(HAVE_X86_SIMD)
+    __m128 g = _mm_set1_ps(gain);
+    for(size_t i = 0; i < count; i += 4)
+    {
+        __m128 sum = _mm_add_ps(_mm_load_ps(period + i), _mm_mul_ps(g, _mm_loadu_ps(samples + i)));
+        _mm_store_ps(period + i, sum);
+    }
+#elif defined(HAVE_NEON_SIMD)
+    for(size_t i = 0; i < count; i += 4)
+    {
+        vst1q_f32(period + i, vmlaq_n_f32(vld1q_f32(period + i), vld1q_f32(samples + i), gain));
+    }
+#else
+    for(size_t i = 0; i < count; ++i) period[i] += gain * samples[i];
+#endif
+}
+
+// Clamps the period to full scale and packs it to 16 bits
+static void pack_period(int16_t* out, const float* period, size_t count)
+{
+    size_t i = 0;
+#if defined(HAVE_X86_SIMD)
+    __m128 scale = _mm_set1_ps(32767.0f * AUDIO_MASTER_GAIN);
+    for(; i + 8 <= count; i += 8)
+    {
+        // cvtps rounds and packs saturates, so only the overflow of the
+        // float to int conversion needs the clamp
+        __m128 lo = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(period + i), scale), _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f));
+        __m128 hi = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(period + i + 4), scale), _mm_set1_ps(-32768.0f)), _mm_set1_ps(32767.0f));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+#elif defined(HAVE_NEON_SIMD)
+    for(; i + 8 <= count; i += 8)
+    {
+        int32x4_t lo = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(period + i), 32767.0f * AUDIO_MASTER_GAIN));
+        int32x4_t hi = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(period + i + 4), 32767.0f * AUDIO_MASTER_GAIN));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        float value = period[i] * 32767.0f * AUDIO_MASTER_GAIN;
+        out[i] = (int16_t)(value > 32767.0f ? 32767.0f : value < -32768.0f ? -32768.0f : value);
+    }
+}
+
+void mix_audio(AudioMixer* mixer, int16_t* out, size_t frames)
+{
+    apply_commands(mixer);
+    while(frames)
+    {
+        size_t count = frames < AUDIO_PERIOD ? frames : AUDIO_PERIOD;
+        size_t blocks = (count + 3) & ~(size_t)3;
+        memset(mixer->period, 0, blocks * sizeof(float));
+        for(size_t vi = 0; vi < AUDIO_VOICES; ++vi)
+        {
+            Voice& voice = mixer->voices[vi];
+            if(!voice.samples) continue;
+            size_t left = voice.length - voice.position;
+            size_t n = left < blocks ? left : blocks;
+            accumulate_voice(mixer->period, voice.samples + voice.position, voice.gain, n);
+            voice.position += n;
+            if(voice.position == voice.length) voice.samples = 0;
+        }
+        pack_period(out, mixer->period, count);
+        out += count;
+        frames -= count;
+    }
+}
+
+/*
+################################################
+##                   OUTPUT                   ##
+################################################
+*/
+
+#ifdef SPACE_INVADERS_ALSA
+
+struct AudioOutput
+{
+    snd_pcm_t* pcm;
+    AudioMixer* mixer;
+    std::thread thread;
+    std::atomic<bool> quit;
+};
+
+static void audio_thread_main(AudioOutput* output)
+{
+    TRACE_THREAD("audio");
+    enter_thread_role(THREAD_AUDIO);
+    int16_t period[AUDIO_PERIOD];
+    while(!output->quit.load(std::memory_order_acquire))
+    {
+        mix_audio(output->mixer, period, AUDIO_PERIOD);
+        snd_pcm_sframes_t written = snd_pcm_writei(output->pcm, period, AUDIO_PERIOD);
+        // An underrun restarts the stream, the period is lost
+        if(written < 0 && snd_pcm_recover(output->pcm, (int)written, 1) < 0) return;
+    }
+}
+
+AudioOutput* start_audio_output(AudioMixer* mixer)
+{
+    snd_pcm_t* pcm = 0;
+    int error = snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
+    if(error >= 0)
+    {
+        error = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED, 1, AUDIO_RATE, 1, AUDIO_LATENCY_US);
+    }
+    if(error < 0)
+    {
+        fprintf(stderr, "No sound: %s\n", snd_strerror(error));
+        if(pcm) snd_pcm_close(pcm);
+        return 0;
+    }
+
+    AudioOutput* output = new AudioOutput{};
+    output->pcm = pcm;
+    output->mixer = mixer;
+    output->quit = false;
+    output->thread = std::thread(audio_thread_main, output);
+    return output;
+}
+
+void stop_audio_output(AudioOutput* output)
+{
+    output->quit.store(true, std::memory_order_release);
+    output->thread.join();
+    snd_pcm_drop(output->pcm);
+    snd_pcm_close(output->pcm);
+    delete output;
+}
+
+#else
+
+struct AudioOutput {};
+
+AudioOutput* start_audio_output(AudioMixer*)
+{
+    return 0;
+}
+
+void stop_audio_output(AudioOutput* output) { delete output; }
+
+#endif
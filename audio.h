@@ -0,0 +1,98 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+/*
+    Sound. The mixer runs on the audio thread and the game only reaches
+    it through a ring of commands, trigger a sound or stop it, with the
+    frame loop as the one producer and the mixer as the one consumer. The
+    mixer takes whatever has arrived at the start of each period; neither
+    side ever waits on the other, and a full ring drops the command.
+
+    Voices are AUDIO_VOICES fixed slots, and a trigger with all of them
+    busy takes over the one playing longest, so a stress scene costs no
+    more to mix than a quiet one. The sounds are synthesized into float
+    samples when the mixer is created. Mixing a period then takes no lock
+    and allocates nothing: every playing voice is multiplied into a float
+    period, then the period is clamped and packed to 16 bits, SSE2 or NEON
+    four samples at a time.
+
+    The output is ALSA's default device, written one period at a time by a
+    thread blocked in snd_pcm_writei(), which is the callback thread here.
+    Only built with ALSA; start_audio_output() returns 0 anywhere else
+    and the game is silent.
+
+    Sounds can also come from a sound bank built by pack_sounds: a header,
+    an index of named entries and every sound's samples, decoded,
+    resampled to AUDIO_RATE and stored as the float samples the mixer
+    reads. The bank is mapped like a sprite atlas and voices play slices
+    of it in place, so nothing is decoded or copied at startup or on the
+    audio thread. A sound the bank lacks is synthesized as before.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+#define AUDIO_RATE 48000
+#define AUDIO_VOICES 16
+// Frames mixed at a time, about 5 ms
+#define AUDIO_PERIOD 256
+
+#define SOUND_BANK_MAGIC 0x42444e53u // "SNDB"
+#define SOUND_BANK_VERSION 1
+#define SOUND_BANK_NAME_LENGTH 16
+// Sample data starts on this boundary, and every entry is a whole
+// number of these, padded with silence, so the mixer reads aligned
+// blocks of four floats
+#define SOUND_BANK_ALIGNMENT 16
+
+struct SoundBankHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t sample_rate;
+};
+
+struct SoundBankEntry
+{
+    char name[SOUND_BANK_NAME_LENGTH];
+    uint32_t num_samples;
+    uint32_t reserved;
+    uint64_t offset;
+};
+
+struct SoundBank
+{
+    const uint8_t* data;
+    size_t size;
+    const SoundBankEntry* entries;
+    size_t num_entries;
+};
+
+bool open_sound_bank(SoundBank* bank, const char* path);
+void close_sound_bank(SoundBank* bank);
+
+struct AudioMixer;
+
+// Plays what 'bank' has of "shot", "explosion", "player_hit" and
+// "march0" to "march3" from it, which must stay open as long as the
+// mixer does. 'bank' may be 0.
+AudioMixer* create_audio_mixer(const SoundBank* bank);
+void destroy_audio_mixer(AudioMixer* mixer);
+
+// Frame loop only. 'sounds' holds GAME_SOUND_ bits, see GameState::sounds.
+// Each march beat cuts the one before short, the march speeds up to
+// beats closer together than a note lasts.
+void play_game_sounds(AudioMixer* mixer, uint32_t sounds);
+
+// Audio thread only. Applies the commands that have arrived, then mixes
+// 'frames' mono samples into 'out'.
+void mix_audio(AudioMixer* mixer, int16_t* out, size_t frames);
+
+struct AudioOutput;
+
+// Mixes 'mixer' into the default device until stopped. 0 without a device.
+AudioOutput* start_audio_output(AudioMixer* mixer);
+void stop_audio_output(AudioOutput* output);
+
+#endif
@@ -0,0 +1,808 @@
+/*
+    Microbenchmarks for the CPU rasterizer, the collision kernels and the
+    state saves rollback is built on. The benchmarks link the same engine
+    library as the game, so each one calls the exact functions a frame
+    does. Every kernel runs at each buffer size and entity count, the
+    simulation ones once, --repetitions times, each until it has taken
+    --min-time, and reports the mean time per call with its 95%
+    confidence interval and the work done per nanosecond.
+
+    --json writes every repetition as a report, --baseline compares the
+    run with a stored one and --compare compares two stored reports,
+    which may also come from the game's --bench-json. Either comparison
+    exits with 2 when any series regressed by more than --threshold.
+
+        SpaceInvadersBench [--events] [--filter NAME] [--min-time SECONDS] [--repetitions N]
+                           [--json PATH] [--baseline PATH] [--threshold PERCENT]
+        SpaceInvadersBench --compare BASELINE CURRENT [--threshold PERCENT]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include "runtime.h"
+
+#define BENCH_NUM_SIZES 3
+#define BENCH_NUM_COUNTS 3
+#define BENCH_MAX_COUNT 256
+
+struct BenchSize
+{
+    size_t width, height;
+};
+
+// The design resolution and its 2x and 4x integer scales
+static const BenchSize bench_sizes[BENCH_NUM_SIZES] = {
+    {DESIGN_WIDTH, DESIGN_HEIGHT}, {2 * DESIGN_WIDTH, 2 * DESIGN_HEIGHT}, {4 * DESIGN_WIDTH, 4 * DESIGN_HEIGHT}
+};
+static const size_t bench_counts[BENCH_NUM_COUNTS] = {1, 16, BENCH_MAX_COUNT};
+
+struct BenchContext
+{
+    Buffer buffer;
+    GameState state;
+    // Precomputed positions, so the timed loops don't draw random numbers
+    size_t x[BENCH_MAX_COUNT], y[BENCH_MAX_COUNT];
+    size_t count;
+    Archetype shots;
+    SavedState saved;
+    ScaledSpriteCache scaled_cache;
+    SpriteStamp stamp;
+    char text[BENCH_MAX_COUNT + 1];
+    Font font;
+    uint8_t glyphs[BENCH_MAX_COUNT];
+    FrameHistogram histogram;
+};
+
+struct Benchmark
+{
+    const char* name;
+    // What the last column counts
+    const char* unit;
+    // Sets the context up for one size and count, returning units per call
+    double (*setup)(BenchContext* context);
+    void (*run)(BenchContext* context);
+    // Simulation only, run once at the design size and a count of one
+    bool simulation;
+};
+
+static uint32_t bench_random(uint32_t* seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return *seed >> 8;
+}
+
+static void place_entities(BenchContext* context, size_t width, size_t height)
+{
+    uint32_t seed = 1;
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        context->x[i] = bench_random(&seed) % (context->buffer.width - width + 1);
+        context->y[i] = bench_random(&seed) % (context->buffer.height - height + 1);
+    }
+}
+
+static const Color bench_color = {0xFF00FF00u, 0};
+
+/* Rasterizer */
+
+static double setup_clear(BenchContext* context)
+{
+    return (double)(context->buffer.width * context->buffer.height);
+}
+
+static void run_clear(BenchContext* context)
+{
+    clear_buffer(&context->buffer, bench_color);
+    context->buffer.num_dirty = 0;
+}
+
+static double setup_sprites(BenchContext* context)
+{
+    place_entities(context, alien_sprite.width, alien_sprite.height);
+    return (double)(context->count * alien_sprite.width * alien_sprite.height);
+}
+
+static void run_sprites(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_sprite_buffer(&context->buffer, alien_sprite, context->x[i], context->y[i], bench_color);
+    }
+    context->buffer.num_dirty = 0;
+}
+
+// The alien one column narrower, a size with no fixed-size kernel, to
+// time the generic loop against the specialized one above
+static const Sprite generic_sprite = {alien_sprite.width - 1, alien_sprite.height, alien_sprite.row_bits, alien_sprite.rows};
+
+static double setup_generic_sprites(BenchContext* context)
+{
+    place_entities(context, generic_sprite.width, generic_sprite.height);
+    return (double)(context->count * generic_sprite.width * generic_sprite.height);
+}
+
+static void run_generic_sprites(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_sprite_buffer(&context->buffer, generic_sprite, context->x[i], context->y[i], bench_color);
+    }
+    context->buffer.num_dirty = 0;
+}
+
+// The alien faded halfway into what is under it, through the blend kernel
+static void run_blended_sprites(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_sprite_blended(&context->buffer, alien_sprite, context->x[i], context->y[i], bench_color, BLEND_ALPHA, 128);
+    }
+    context->buffer.num_dirty = 0;
+}
+
+static double setup_stamps(BenchContext* context)
+{
+    make_sprite_stamp(&context->stamp, context->buffer, alien_sprite, bench_color);
+    return setup_sprites(context);
+}
+
+static void run_stamps(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_stamp_buffer(&context->buffer, context->stamp, context->x[i], context->y[i]);
+    }
+    context->buffer.num_dirty = 0;
+}
+
+// The title screen's scale
+#define BENCH_SPRITE_SCALE 2
+
+static double setup_scaled(BenchContext* context)
+{
+    place_entities(context, alien_sprite.width * BENCH_SPRITE_SCALE, alien_sprite.height * BENCH_SPRITE_SCALE);
+    return (double)(context->count * alien_sprite.width * alien_sprite.height * BENCH_SPRITE_SCALE * BENCH_SPRITE_SCALE);
+}
+
+static void run_scaled(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_sprite_scaled(&context->buffer, alien_sprite, context->x[i], context->y[i], BENCH_SPRITE_SCALE, bench_color);
+    }
+    context->buffer.num_dirty = 0;
+}
+
+// The title at the scale the title screen draws it, from the cache
+#define BENCH_TITLE_SCALE 3
+
+static double setup_title(BenchContext* context)
+{
+    const Sprite& title = builtin_title_sprite;
+    if(title.width * BENCH_TITLE_SCALE > context->buffer.width) return 0.0;
+    place_entities(context, title.width * BENCH_TITLE_SCALE, title.height * BENCH_TITLE_SCALE);
+    return (double)(context->count * title.width * title.height * BENCH_TITLE_SCALE * BENCH_TITLE_SCALE);
+}
+
+static void run_title(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_sprite_scaled_cached(
+            &context->buffer, &context->scaled_cache, builtin_title_sprite,
+            context->x[i], context->y[i], BENCH_TITLE_SCALE, bench_color
+        );
+    }
+    context->buffer.num_dirty = 0;
+}
+
+// 'count' glyphs, wrapped into lines that fit the buffer
+#define BENCH_TEXT_LINE 32
+
+static double setup_text(BenchContext* context)
+{
+    const char* alphabet = "SCORE 0123456789 CREDIT HI-SCORE ";
+    for(size_t i = 0; i < context->count; ++i) context->text[i] = alphabet[i % strlen(alphabet)];
+    context->text[context->count] = '\0';
+    set_font_sheet(&context->font, builtin_text_spritesheet);
+    return (double)(context->count * builtin_text_spritesheet.width * builtin_text_spritesheet.height);
+}
+
+static void run_text(BenchContext* context)
+{
+    const Sprite& sheet = context->font.sheet;
+    for(size_t i = 0; i < context->count; i += BENCH_TEXT_LINE)
+    {
+        size_t line = i / BENCH_TEXT_LINE;
+        draw_text_buffer(
+            &context->buffer, context->font, context->text + i,
+            4 + (line % 2) * (sheet.width + 1), 4 + line * (sheet.height + 2), bench_color, BENCH_TEXT_LINE
+        );
+    }
+    context->buffer.num_dirty = 0;
+}
+
+// 'count' bytes of a message page, in English or with the accents of a
+// localized one, whole characters only
+static double setup_decode(BenchContext* context, const char* alphabet)
+{
+    size_t length = strlen(alphabet);
+    size_t bytes = 0;
+    for(size_t offset = 0; bytes < context->count;)
+    {
+        size_t start = offset;
+        decode_utf8(alphabet, length, &offset);
+        if(bytes + offset - start > context->count) break;
+        memcpy(context->text + bytes, alphabet + start, offset - start);
+        bytes += offset - start;
+        if(offset == length) offset = 0;
+    }
+    context->text[bytes] = '\0';
+    set_font_sheet(&context->font, builtin_text_spritesheet);
+    return (double)bytes;
+}
+
+static double setup_decode_ascii(BenchContext* context)
+{
+    return setup_decode(context, "THE INVADERS ARE BACK. SHOOT THEM ALL? ");
+}
+
+static double setup_decode_latin1(BenchContext* context)
+{
+    return setup_decode(context, "Les envahisseurs sont de retour. \xC3\x80 vos canons, \xC3\xA9liminez-les! ");
+}
+
+static void run_decode(BenchContext* context)
+{
+    size_t length = strlen(context->text);
+    size_t offset = 0;
+    decode_glyphs(context->text, length, &offset, context->glyphs, BENCH_MAX_COUNT);
+}
+
+// 'count' seven digit numbers
+#define BENCH_NUMBER 1234567
+#define BENCH_NUMBER_DIGITS 7
+
+static double setup_numbers(BenchContext* context)
+{
+    Sprite digits = sprite_frame(builtin_text_spritesheet, code_point_glyph('0'));
+    place_entities(context, BENCH_NUMBER_DIGITS * (digits.width + 1), digits.height);
+    return (double)(context->count * BENCH_NUMBER_DIGITS * digits.width * digits.height);
+}
+
+static void run_numbers(BenchContext* context)
+{
+    Sprite digits = sprite_frame(builtin_text_spritesheet, code_point_glyph('0'));
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        draw_number_buffer(&context->buffer, digits, BENCH_NUMBER + i, context->x[i], context->y[i], bench_color);
+    }
+    context->buffer.num_dirty = 0;
+}
+
+/* Collision */
+
+static size_t bench_sink;
+
+// Every entity against every other, so most pairs miss like in play
+static double setup_overlap(BenchContext* context)
+{
+    place_entities(context, alien_sprite.width, alien_sprite.height);
+    return (double)(context->count * context->count);
+}
+
+static void run_overlap(BenchContext* context)
+{
+    size_t hits = 0;
+    for(size_t a = 0; a < context->count; ++a)
+    {
+        for(size_t b = 0; b < context->count; ++b)
+        {
+            hits += sprite_overlap_check(
+                alien_sprite, context->x[a], context->y[a], alien_sprite, context->x[b], context->y[b]
+            );
+        }
+    }
+    bench_sink += hits;
+}
+
+// 'count' player shots one tick below the formation, spread over its
+// columns. The aliens can't die, so every call sees the same formation.
+// No units when the screen is too short to keep 'count' in flight.
+static double setup_formation(BenchContext* context)
+{
+    GameState* state = &context->state;
+    destroy_game_state(state);
+    init_game_state(state, context->buffer.width, context->buffer.height);
+    Game& game = state->game;
+    for(size_t ai = 0; ai < game.num_aliens; ++ai) game.aliens.hp[ai] = INT32_MAX;
+
+    Archetype& shots = game.projectiles[PROJECTILE_PLAYER];
+    if(context->count > shots.capacity) return 0.0;
+    shots.count = 0;
+    uint32_t seed = 1;
+    for(size_t i = 0; i < context->count; ++i)
+    {
+        size_t x = state->layout_x + FORMATION_LEFT + bench_random(&seed) % (FORMATION_COLUMNS * FORMATION_PITCH_X);
+        size_t y = state->layout_y + FORMATION_BOTTOM - PROJECTILE_SPEED + bench_random(&seed) % (FORMATION_ROWS * FORMATION_PITCH_Y);
+        spawn_projectile(&shots, x, y);
+    }
+    copy_archetype(&context->shots, shots);
+    step_player_shots(state);
+    return (double)context->count;
+}
+
+static void run_formation(BenchContext* context)
+{
+    Archetype& shots = context->state.game.projectiles[PROJECTILE_PLAYER];
+    copy_archetype(&shots, context->shots);
+    step_player_shots(&context->state);
+    bench_sink += shots.count;
+}
+
+// 16 shots per count, so the largest moves 4096, a screen of stress shots.
+// They sit mid-screen and turn back every call, so none is ever culled.
+static double setup_move(BenchContext* context)
+{
+    Archetype& shots = context->shots;
+    destroy_archetype(&shots);
+    size_t count = 16 * context->count;
+    init_archetype(&shots, PROJECTILE_COMPONENTS, &projectile_sprite, count);
+    shots.velocity = to_fixed(PROJECTILE_SPEED);
+    uint32_t seed = 1;
+    for(size_t i = 0; i < count; ++i)
+    {
+        spawn_projectile(&shots, bench_random(&seed) % DESIGN_WIDTH, DESIGN_HEIGHT / 4 + bench_random(&seed) % (DESIGN_HEIGHT / 2));
+    }
+    return (double)count;
+}
+
+static void run_move(BenchContext* context)
+{
+    Archetype& shots = context->shots;
+    move_entities(&shots, 0, to_fixed(DESIGN_HEIGHT));
+    shots.velocity = -shots.velocity;
+    bench_sink += shots.culled[0];
+}
+
+/* Rollback */
+
+#define BENCH_ROLLBACK_WARMUP 180
+
+static GameInput rollback_bench_input(uint64_t tick)
+{
+    return GameInput{(tick / 45) % 2 ? 1 : -1, tick % 9 == 0};
+}
+
+// A fresh game some way into its first wave, shots in flight, saved
+static double setup_saved_state(BenchContext* context)
+{
+    GameState* state = &context->state;
+    destroy_game_state(state);
+    init_game_state(state, DESIGN_WIDTH, DESIGN_HEIGHT);
+    for(size_t ti = 0; ti < BENCH_ROLLBACK_WARMUP; ++ti) step_game(state, rollback_bench_input(state->tick), SIM_DT);
+    destroy_saved_state(&context->saved);
+    init_saved_state(&context->saved, *state);
+    return (double)save_game_state(&context->saved, *state);
+}
+
+static void run_save_state(BenchContext* context)
+{
+    bench_sink += save_game_state(&context->saved, context->state);
+}
+
+static void run_restore_state(BenchContext* context)
+{
+    restore_game_state(&context->state, context->saved);
+    bench_sink += context->state.tick;
+}
+
+// What the profiler adds per phase and frame, values spread over octaves
+static double setup_histogram(BenchContext* context)
+{
+    place_entities(context, alien_sprite.width, alien_sprite.height);
+    return (double)context->count;
+}
+
+static void run_histogram(BenchContext* context)
+{
+    for(size_t i = 0; i < context->count; ++i) record_histogram(&context->histogram, (double)(context->x[i] * context->y[i] + 1) * 1e-7);
+    bench_sink += context->histogram.count;
+}
+
+// What a desync check costs every tick, per byte of the block it covers
+static double setup_state_hash(BenchContext* context)
+{
+    setup_saved_state(context);
+    return (double)context->state.block.size;
+}
+
+static void run_state_hash(BenchContext* context)
+{
+    bench_sink += game_state_hash(context->state);
+}
+
+// What the autoplay bot thinks about each tick, mid-wave
+static double setup_autoplay(BenchContext* context)
+{
+    setup_saved_state(context);
+    return 1.0;
+}
+
+static void run_autoplay(BenchContext* context)
+{
+    AutoplayBot bot;
+    init_autoplay_bot(&bot, CHOICE_YES);
+    AutoplayDecision decision = decide_autoplay(bot, context->state);
+    bench_sink += (size_t)decision.move + decision.fire;
+}
+
+static double setup_resimulate(BenchContext* context)
+{
+    setup_saved_state(context);
+    return ROLLBACK_MAX_TICKS;
+}
+
+// The worst a rollback does within a frame: restore, then step again
+// every tick it keeps a save for
+static void run_resimulate(BenchContext* context)
+{
+    GameState* state = &context->state;
+    restore_game_state(state, context->saved);
+    for(size_t ti = 0; ti < ROLLBACK_MAX_TICKS; ++ti) step_game(state, rollback_bench_input(state->tick), SIM_DT);
+    bench_sink += state->score;
+}
+
+static const Benchmark benchmarks[] = {
+    {"clear_buffer", "pixels", setup_clear, run_clear},
+    {"draw_sprite_buffer", "pixels", setup_sprites, run_sprites},
+    {"draw_sprite_generic", "pixels", setup_generic_sprites, run_generic_sprites},
+    {"draw_sprite_blended", "pixels", setup_sprites, run_blended_sprites},
+    {"draw_stamp_buffer", "pixels", setup_stamps, run_stamps},
+    {"draw_sprite_scaled", "pixels", setup_scaled, run_scaled},
+    {"draw_sprite_scaled_cached", "pixels", setup_title, run_title},
+    {"draw_text_buffer", "pixels", setup_text, run_text},
+    {"decode_glyphs_ascii", "bytes", setup_decode_ascii, run_decode},
+    {"decode_glyphs_latin1", "bytes", setup_decode_latin1, run_decode},
+    {"draw_number_buffer", "pixels", setup_numbers, run_numbers},
+    {"sprite_overlap_check", "pairs", setup_overlap, run_overlap},
+    {"player_shots_vs_formation", "shots", setup_formation, run_formation},
+    {"move_projectiles", "shots", setup_move, run_move},
+    {"save_game_state", "bytes", setup_saved_state, run_save_state, true},
+    {"restore_game_state", "bytes", setup_saved_state, run_restore_state, true},
+    {"rollback_resimulate", "ticks", setup_resimulate, run_resimulate, true},
+    {"game_state_hash", "bytes", setup_state_hash, run_state_hash, true},
+    {"record_histogram", "values", setup_histogram, run_histogram},
+    {"autoplay_decision", "decisions", setup_autoplay, run_autoplay, true},
+};
+
+// Doubles the number of calls until a batch takes 'min_time', after one
+// untimed warm-up call
+static double time_benchmark(const Benchmark& benchmark, BenchContext* context, double min_time)
+{
+    benchmark.run(context);
+    for(size_t calls = 1;; calls *= 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < calls; ++i) benchmark.run(context);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(seconds >= min_time) return seconds * 1e9 / (double)calls;
+    }
+}
+
+/*
+    Event pump costs, run with --events instead of the kernels. Every GLFW
+    platform built in and able to initialize here gets a hidden window,
+    then each way of pumping is timed on it: a poll and the adaptive pump
+    with nothing pending, a wait with a zero timeout and a wake through an
+    empty event. On X11 the poll and the adaptive pump are timed once more
+    with a burst of property changes queued on the connection before each
+    call, untimed, so only the dispatch is counted.
+*/
+
+#define EVENT_BENCH_BURST 16
+
+struct EventContext
+{
+    GLFWwindow* window;
+    EventPump pump;
+    uint32_t serial;
+};
+
+struct EventBenchmark
+{
+    const char* name;
+    // Untimed, before every call
+    void (*prepare)(EventContext* context);
+    void (*run)(EventContext* context);
+};
+
+static void run_poll(EventContext* context) { glfwPollEvents(); }
+static void run_adaptive_pump(EventContext* context) { pump_events(&context->pump); }
+static void run_wait_timeout(EventContext* context) { glfwWaitEventsTimeout(0.0); }
+
+static void run_posted_wait(EventContext* context)
+{
+    glfwPostEmptyEvent();
+    glfwWaitEvents();
+}
+
+// Each title change is a few PropertyNotify events for GLFW's window
+static void queue_title_changes(EventContext* context)
+{
+    for(size_t i = 0; i < EVENT_BENCH_BURST; ++i)
+    {
+        glfwSetWindowTitle(context->window, ++context->serial & 1 ? "Space Invaders" : "Space Invaders ");
+    }
+    sync_x11_events();
+}
+
+static const EventBenchmark idle_event_benchmarks[] = {
+    {"poll_idle", 0, run_poll},
+    {"pump_adaptive_idle", 0, run_adaptive_pump},
+    {"wait_timeout_zero", 0, run_wait_timeout},
+    {"post_and_wait", 0, run_posted_wait},
+};
+
+static const EventBenchmark queued_event_benchmarks[] = {
+    {"poll_queued", queue_title_changes, run_poll},
+    {"pump_adaptive_queued", queue_title_changes, run_adaptive_pump},
+};
+
+static double time_event_benchmark(const EventBenchmark& benchmark, EventContext* context, double min_time)
+{
+    if(!benchmark.prepare)
+    {
+        benchmark.run(context);
+        for(size_t calls = 1;; calls *= 2)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < calls; ++i) benchmark.run(context);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if(seconds >= min_time) return seconds * 1e9 / (double)calls;
+        }
+    }
+    // Prepared calls are timed one at a time, leaving the preparation out
+    double seconds = 0.0;
+    size_t calls = 0;
+    while(seconds < min_time)
+    {
+        benchmark.prepare(context);
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run(context);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++calls;
+    }
+    return seconds * 1e9 / (double)calls;
+}
+
+static void run_event_benchmarks(
+    const EventBenchmark* benchmarks, size_t num_benchmarks, EventContext* context, const char* platform,
+    const char* filter, double min_time, size_t repetitions, BenchReport* report
+)
+{
+    for(size_t bi = 0; bi < num_benchmarks; ++bi)
+    {
+        const EventBenchmark& benchmark = benchmarks[bi];
+        if(filter && !strstr(benchmark.name, filter)) continue;
+        char name[BENCH_NAME_LENGTH];
+        snprintf(name, sizeof(name), "event/%s/%s", platform, benchmark.name);
+        for(size_t ri = 0; ri < repetitions; ++ri)
+        {
+            add_bench_sample(report, name, "ns", time_event_benchmark(benchmark, context, min_time));
+        }
+        SeriesStats stats = series_stats(report->series[report->num_series - 1]);
+        printf("%-26s %10s %12.1f %9.1f\n", benchmark.name, platform, stats.mean, stats.ci95);
+    }
+}
+
+struct EventPlatform
+{
+    int platform;
+    const char* name;
+};
+
+static const EventPlatform event_platforms[] = {
+    {GLFW_PLATFORM_X11, "x11"}, {GLFW_PLATFORM_WAYLAND, "wayland"}, {GLFW_PLATFORM_WIN32, "win32"},
+    {GLFW_PLATFORM_COCOA, "cocoa"}, {GLFW_PLATFORM_NULL, "null"},
+};
+
+static void bench_event_pumps(const char* filter, double min_time, size_t repetitions, BenchReport* report)
+{
+    printf("%-26s %10s %12s %9s\n", "benchmark", "platform", "ns/op", "+-95%");
+    for(const EventPlatform& platform: event_platforms)
+    {
+        if(!glfwPlatformSupported(platform.platform)) continue;
+        glfwInitHint(GLFW_PLATFORM, platform.platform);
+        if(!glfwInit())
+        {
+            printf("%-26s %10s\n", "(unavailable)", platform.name);
+            continue;
+        }
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        EventContext context = {};
+        context.window = glfwCreateWindow(DESIGN_WIDTH, DESIGN_HEIGHT, "Space Invaders", 0, 0);
+        if(context.window)
+        {
+            init_event_pump(&context.pump, PUMP_ADAPTIVE);
+            run_event_benchmarks(
+                idle_event_benchmarks, sizeof(idle_event_benchmarks) / sizeof(idle_event_benchmarks[0]), &context,
+                platform.name, filter, min_time, repetitions, report
+            );
+            if(platform.platform == GLFW_PLATFORM_X11)
+            {
+                run_event_benchmarks(
+                    queued_event_benchmarks, sizeof(queued_event_benchmarks) / sizeof(queued_event_benchmarks[0]),
+                    &context, platform.name, filter, min_time, repetitions, report
+                );
+            }
+            glfwDestroyWindow(context.window);
+        }
+        glfwTerminate();
+    }
+}
+
+#define BENCH_DEFAULT_REPETITIONS 5
+
+static int compare_report_files(const char* baseline_path, const char* current_path, double threshold)
+{
+    BenchReport baseline = {}, current = {};
+    bool loaded = read_bench_report(&baseline, baseline_path) && read_bench_report(&current, current_path);
+    size_t regressions = loaded ? compare_bench_reports(baseline, current, threshold) : 0;
+    destroy_bench_report(&baseline);
+    destroy_bench_report(&current);
+    if(!loaded) return 1;
+    return regressions ? 2 : 0;
+}
+
+// Writes and compares the run's report as asked, then destroys it
+static int finish_bench_report(BenchReport* report, const char* json_path, const char* baseline_path, double threshold, int status)
+{
+    if(json_path && !write_bench_report(*report, json_path)) status = 1;
+    if(baseline_path)
+    {
+        BenchReport baseline = {};
+        if(!read_bench_report(&baseline, baseline_path)) status = 1;
+        else if(compare_bench_reports(baseline, *report, threshold)) status = 2;
+        destroy_bench_report(&baseline);
+    }
+    destroy_bench_report(report);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = 0;
+    double min_time = 0.05;
+    size_t repetitions = BENCH_DEFAULT_REPETITIONS;
+    const char* json_path = 0;
+    const char* baseline_path = 0;
+    const char* compare_paths[2] = {0, 0};
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    bool events = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "--filter") && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--min-time") && i + 1 < argc)
+        {
+            min_time = atof(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--repetitions") && i + 1 < argc)
+        {
+            repetitions = (size_t)strtoul(argv[++i], 0, 10);
+            if(!repetitions) repetitions = 1;
+            if(repetitions > BENCH_MAX_SAMPLES) repetitions = BENCH_MAX_SAMPLES;
+        }
+        else if(!strcmp(argv[i], "--json") && i + 1 < argc)
+        {
+            json_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--baseline") && i + 1 < argc)
+        {
+            baseline_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--threshold") && i + 1 < argc)
+        {
+            threshold = atof(argv[++i]) / 100.0;
+        }
+        else if(!strcmp(argv[i], "--events"))
+        {
+            events = true;
+        }
+        else if(!strcmp(argv[i], "--compare") && i + 2 < argc)
+        {
+            compare_paths[0] = argv[++i];
+            compare_paths[1] = argv[++i];
+        }
+        else
+        {
+            fprintf(
+                stderr,
+                "Usage: %s [--events] [--filter NAME] [--min-time SECONDS] [--repetitions N]\n"
+                "       [--json PATH] [--baseline PATH] [--threshold PERCENT]\n"
+                "   or: %s --compare BASELINE CURRENT [--threshold PERCENT]\n", argv[0], argv[0]
+            );
+            return 1;
+        }
+    }
+    if(compare_paths[0]) return compare_report_files(compare_paths[0], compare_paths[1], threshold);
+
+    BenchReport report;
+    init_bench_report(&report, "SpaceInvadersBench");
+    if(events)
+    {
+        bench_event_pumps(filter, min_time, repetitions, &report);
+        return finish_bench_report(&report, json_path, baseline_path, threshold, 0);
+    }
+
+    init_fill_kernels();
+    init_overlap_kernels();
+    init_move_kernels();
+    init_particle_kernels();
+    init_blend_kernels();
+    printf(
+        "Clear kernel: %s, overlap kernel: %s, move kernel: %s, blend kernel: %s\n",
+        fill_kernel_name, overlap_kernel_name, move_kernel_name, blend_kernel_name
+    );
+
+    set_bench_environment(&report, "fill_kernel", fill_kernel_name);
+    set_bench_environment(&report, "overlap_kernel", overlap_kernel_name);
+    set_bench_environment(&report, "move_kernel", move_kernel_name);
+    set_bench_environment(&report, "blend_kernel", blend_kernel_name);
+
+    const BenchSize& largest = bench_sizes[BENCH_NUM_SIZES - 1];
+    BenchContext* context = new BenchContext{};
+    context->buffer.format = PIXEL_RGBA8888;
+    context->buffer.data = new uint32_t[largest.width * largest.height];
+    init_game_state(&context->state, DESIGN_WIDTH, DESIGN_HEIGHT);
+    init_saved_state(&context->saved, context->state);
+
+    printf("%-26s %10s %6s %12s %9s %12s\n", "benchmark", "buffer", "count", "ns/op", "+-95%", "per ns");
+    for(const Benchmark& benchmark: benchmarks)
+    {
+        if(filter && !strstr(benchmark.name, filter)) continue;
+        for(const BenchSize& size: bench_sizes)
+        {
+            context->buffer.width = size.width;
+            context->buffer.height = size.height;
+            clear_buffer(&context->buffer, Color{0, 0});
+            for(size_t count: bench_counts)
+            {
+                // A clear doesn't depend on the entity count
+                if(benchmark.run == run_clear && count != 1) continue;
+                if(benchmark.simulation && (count != 1 || &size != bench_sizes)) continue;
+                context->count = count;
+                double units = benchmark.setup(context);
+                if(units == 0.0) continue;
+                char dimensions[32], name[BENCH_NAME_LENGTH];
+                snprintf(dimensions, sizeof(dimensions), "%zux%zu", size.width, size.height);
+                snprintf(name, sizeof(name), "kernel/%s/%s/%zu", benchmark.name, dimensions, count);
+                for(size_t ri = 0; ri < repetitions; ++ri)
+                {
+                    add_bench_sample(&report, name, "ns", time_benchmark(benchmark, context, min_time));
+                }
+
+                SeriesStats stats = series_stats(report.series[report.num_series - 1]);
+                printf(
+                    "%-26s %10s %6zu %12.1f %9.1f %8.3f %s\n", benchmark.name, dimensions, count,
+                    stats.mean, stats.ci95, units / stats.mean, benchmark.unit
+                );
+            }
+        }
+    }
+
+    destroy_game_state(&context->state);
+    destroy_archetype(&context->shots);
+    destroy_saved_state(&context->saved);
+    destroy_scaled_sprite_cache(&context->scaled_cache);
+    delete[] context->buffer.data;
+    delete context;
+
+    return finish_bench_report(&report, json_path, baseline_path, threshold, bench_sink == SIZE_MAX);
+}
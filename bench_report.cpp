@@ -0,0 +1,381 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <thread>
+#include "bench_report.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+static void copy_string(char* dest, size_t size, const char* src)
+{
+    snprintf(dest, size, "%s", src);
+}
+
+void set_bench_environment(BenchReport* report, const char* key, const char* value)
+{
+    BenchEnvironment* entry = 0;
+    for(size_t ei = 0; ei < report->num_environment; ++ei)
+    {
+        if(!strcmp(report->environment[ei].key, key)) entry = &report->environment[ei];
+    }
+    if(!entry)
+    {
+        if(report->num_environment == BENCH_MAX_ENVIRONMENT) return;
+        entry = &report->environment[report->num_environment++];
+        copy_string(entry->key, sizeof(entry->key), key);
+    }
+    copy_string(entry->value, sizeof(entry->value), value);
+}
+
+const char* bench_environment(const BenchReport& report, const char* key)
+{
+    for(size_t ei = 0; ei < report.num_environment; ++ei)
+    {
+        if(!strcmp(report.environment[ei].key, key)) return report.environment[ei].value;
+    }
+    return "";
+}
+
+static void read_cpu_model(char* model, size_t size)
+{
+    copy_string(model, size, "unknown");
+#if defined(__linux__)
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    if(!file) return;
+    char line[256];
+    while(fgets(line, sizeof(line), file))
+    {
+        if(strncmp(line, "model name", 10)) continue;
+        const char* value = strchr(line, ':');
+        if(!value) break;
+        value += strspn(value + 1, " \t") + 1;
+        copy_string(model, size, value);
+        model[strcspn(model, "\n")] = '\0';
+        break;
+    }
+    fclose(file);
+#endif
+}
+
+void init_bench_report(BenchReport* report, const char* program)
+{
+    report->num_environment = 0;
+    report->series = new BenchSeries[BENCH_MAX_SERIES];
+    report->num_series = 0;
+
+    char value[BENCH_VALUE_LENGTH];
+    set_bench_environment(report, "program", program);
+#if defined(__clang__)
+    snprintf(value, sizeof(value), "clang %s", __clang_version__);
+#elif defined(__GNUC__)
+    snprintf(value, sizeof(value), "gcc %s", __VERSION__);
+#elif defined(_MSC_VER)
+    snprintf(value, sizeof(value), "msvc %d", _MSC_VER);
+#else
+    copy_string(value, sizeof(value), "unknown");
+#endif
+    set_bench_environment(report, "compiler", value);
+#if defined(__OPTIMIZE__) || defined(NDEBUG)
+    set_bench_environment(report, "optimized", "yes");
+#else
+    set_bench_environment(report, "optimized", "no");
+#endif
+    read_cpu_model(value, sizeof(value));
+    set_bench_environment(report, "cpu", value);
+    snprintf(value, sizeof(value), "%u", std::thread::hardware_concurrency());
+    set_bench_environment(report, "hardware_threads", value);
+#if defined(_WIN32)
+    set_bench_environment(report, "os", "windows");
+#elif defined(__APPLE__)
+    set_bench_environment(report, "os", "macos");
+#elif defined(__linux__)
+    set_bench_environment(report, "os", "linux");
+#else
+    set_bench_environment(report, "os", "unknown");
+#endif
+#if !defined(_WIN32)
+    if(!gethostname(value, sizeof(value)))
+    {
+        value[sizeof(value) - 1] = '\0';
+        set_bench_environment(report, "host", value);
+    }
+#endif
+    time_t now = time(0);
+    strftime(value, sizeof(value), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    set_bench_environment(report, "time", value);
+}
+
+void destroy_bench_report(BenchReport* report)
+{
+    delete[] report->series;
+    *report = BenchReport{};
+}
+
+void add_bench_sample(BenchReport* report, const char* name, const char* unit, double value)
+{
+    BenchSeries* series = 0;
+    for(size_t si = 0; si < report->num_series; ++si)
+    {
+        if(!strcmp(report->series[si].name, name)) series = &report->series[si];
+    }
+    if(!series)
+    {
+        if(report->num_series == BENCH_MAX_SERIES) return;
+        series = &report->series[report->num_series++];
+        copy_string(series->name, sizeof(series->name), name);
+        copy_string(series->unit, sizeof(series->unit), unit);
+        series->num_samples = 0;
+    }
+    if(series->num_samples < BENCH_MAX_SAMPLES) series->samples[series->num_samples++] = value;
+}
+
+// Two-sided 95% critical values of Student's t for 1 to 30 degrees of freedom
+static const double t_critical[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+// Beyond the table the value falls off like 1/df towards the normal's 1.96
+static double t_critical_95(double df)
+{
+    if(df < 1.0) return t_critical[0];
+    if(df <= 30.0) return t_critical[(size_t)df - 1];
+    return 1.96 + (t_critical[29] - 1.96) * 30.0 / df;
+}
+
+SeriesStats series_stats(const BenchSeries& series)
+{
+    SeriesStats stats = {};
+    size_t n = series.num_samples;
+    if(!n) return stats;
+    for(size_t i = 0; i < n; ++i) stats.mean += series.samples[i];
+    stats.mean /= (double)n;
+    if(n < 2) return stats;
+    double squares = 0.0;
+    for(size_t i = 0; i < n; ++i) squares += (series.samples[i] - stats.mean) * (series.samples[i] - stats.mean);
+    stats.stddev = sqrt(squares / (double)(n - 1));
+    stats.ci95 = t_critical_95((double)(n - 1)) * stats.stddev / sqrt((double)n);
+    return stats;
+}
+
+/*
+################################################
+##                   FILES                    ##
+################################################
+*/
+
+static void write_json_string(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for(; *text; ++text)
+    {
+        if(*text == '"' || *text == '\\') fputc('\\', file);
+        fputc(*text, file);
+    }
+    fputc('"', file);
+}
+
+bool write_bench_report(const BenchReport& report, const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if(!file)
+    {
+        fprintf(stderr, "Couldn't write benchmark results to %s.\n", path);
+        return false;
+    }
+
+    fprintf(file, "{\n\"environment\": {");
+    for(size_t ei = 0; ei < report.num_environment; ++ei)
+    {
+        if(ei) fprintf(file, ", ");
+        write_json_string(file, report.environment[ei].key);
+        fprintf(file, ": ");
+        write_json_string(file, report.environment[ei].value);
+    }
+    fprintf(file, "},\n\"results\": [\n");
+    for(size_t si = 0; si < report.num_series; ++si)
+    {
+        const BenchSeries& series = report.series[si];
+        SeriesStats stats = series_stats(series);
+        fprintf(file, "{\"name\": ");
+        write_json_string(file, series.name);
+        fprintf(file, ", \"unit\": ");
+        write_json_string(file, series.unit);
+        fprintf(file, ", \"mean\": %.6g, \"ci95\": %.6g, \"samples\": [", stats.mean, stats.ci95);
+        for(size_t i = 0; i < series.num_samples; ++i) fprintf(file, "%s%.6g", i ? ", " : "", series.samples[i]);
+        fprintf(file, "]}%s\n", si + 1 < report.num_series ? "," : "");
+    }
+    fprintf(file, "]\n}\n");
+
+    bool written = !ferror(file);
+    if(fclose(file)) written = false;
+    if(!written) fprintf(stderr, "Couldn't write benchmark results to %s.\n", path);
+    return written;
+}
+
+// Reads the string starting at the opening quote 'text' points to into
+// 'dest', returning the position after the closing quote
+static const char* read_json_string(const char* text, char* dest, size_t size)
+{
+    size_t length = 0;
+    for(++text; *text && *text != '"'; ++text)
+    {
+        if(*text == '\\' && text[1]) ++text;
+        if(length + 1 < size) dest[length++] = *text;
+    }
+    if(size) dest[length] = '\0';
+    return *text ? text + 1 : text;
+}
+
+static const char* find_json_string(const char* line, const char* key, char* dest, size_t size)
+{
+    const char* at = strstr(line, key);
+    if(!at) return 0;
+    at = strchr(at + strlen(key), '"');
+    return at ? read_json_string(at, dest, size) : 0;
+}
+
+static void read_environment_line(BenchReport* report, const char* line)
+{
+    const char* at = strchr(line, '{');
+    while(at && (at = strchr(at, '"')))
+    {
+        char key[32], value[BENCH_VALUE_LENGTH];
+        at = read_json_string(at, key, sizeof(key));
+        at = strchr(at, '"');
+        if(!at) break;
+        at = read_json_string(at, value, sizeof(value));
+        set_bench_environment(report, key, value);
+    }
+}
+
+bool read_bench_report(BenchReport* report, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(!file)
+    {
+        fprintf(stderr, "Couldn't open benchmark results %s.\n", path);
+        return false;
+    }
+
+    report->num_environment = 0;
+    report->series = new BenchSeries[BENCH_MAX_SERIES];
+    report->num_series = 0;
+
+    // Long enough for a full series of samples
+    char line[BENCH_MAX_SAMPLES * 24 + 512];
+    while(fgets(line, sizeof(line), file))
+    {
+        if(!strncmp(line, "\"environment\"", 13))
+        {
+            read_environment_line(report, line);
+            continue;
+        }
+        char name[BENCH_NAME_LENGTH], unit[16];
+        if(!find_json_string(line, "\"name\":", name, sizeof(name))) continue;
+        if(!find_json_string(line, "\"unit\":", unit, sizeof(unit))) continue;
+        const char* at = strstr(line, "\"samples\":");
+        if(!at || !(at = strchr(at, '['))) continue;
+        for(++at;;)
+        {
+            char* end;
+            double value = strtod(at, &end);
+            if(end == at) break;
+            add_bench_sample(report, name, unit, value);
+            at = end + strspn(end, ", ");
+        }
+    }
+    fclose(file);
+
+    if(!report->num_series)
+    {
+        fprintf(stderr, "%s holds no benchmark results.\n", path);
+        return false;
+    }
+    return true;
+}
+
+/*
+################################################
+##                 COMPARISON                 ##
+################################################
+*/
+
+size_t compare_bench_reports(const BenchReport& baseline, const BenchReport& current, double threshold)
+{
+    static const char* const checked_keys[] = {"compiler", "optimized", "cpu", "hardware_threads"};
+    for(const char* key: checked_keys)
+    {
+        const char* before = bench_environment(baseline, key);
+        const char* after = bench_environment(current, key);
+        if(strcmp(before, after)) printf("Environment differs: %s was \"%s\", now \"%s\"\n", key, before, after);
+    }
+
+    printf("%-44s %15s %15s %8s %18s\n", "series", "baseline", "current", "change", "95% CI");
+    size_t regressions = 0, improvements = 0, unmatched = 0;
+    for(size_t si = 0; si < current.num_series; ++si)
+    {
+        const BenchSeries& after = current.series[si];
+        const BenchSeries* before = 0;
+        for(size_t bi = 0; bi < baseline.num_series; ++bi)
+        {
+            if(!strcmp(baseline.series[bi].name, after.name)) before = &baseline.series[bi];
+        }
+        if(!before || !before->num_samples || !after.num_samples)
+        {
+            ++unmatched;
+            continue;
+        }
+
+        // Welch's t-test, which doesn't assume the runs are equally noisy
+        SeriesStats a = series_stats(*before), b = series_stats(after);
+        double va = before->num_samples > 1 ? a.stddev * a.stddev / before->num_samples : 0.0;
+        double vb = after.num_samples > 1 ? b.stddev * b.stddev / after.num_samples : 0.0;
+        double se = sqrt(va + vb);
+        double df = 1.0;
+        if(va + vb > 0.0)
+        {
+            double denominator = 0.0;
+            if(before->num_samples > 1) denominator += va * va / (before->num_samples - 1);
+            if(after.num_samples > 1) denominator += vb * vb / (after.num_samples - 1);
+            if(denominator > 0.0) df = (va + vb) * (va + vb) / denominator;
+        }
+        double diff = b.mean - a.mean;
+        double half = t_critical_95(df) * se;
+        double change = a.mean > 0.0 ? diff / a.mean : 0.0;
+
+        // A single sample on either side can't be significant
+        bool measured = before->num_samples > 1 && after.num_samples > 1;
+        const char* verdict = "";
+        if(measured && diff - half > 0.0 && change > threshold)
+        {
+            verdict = "REGRESSION";
+            ++regressions;
+        }
+        else if(measured && diff + half < 0.0 && -change > threshold)
+        {
+            verdict = "improved";
+            ++improvements;
+        }
+
+        char interval[32];
+        snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]",
+            a.mean > 0.0 ? (diff - half) / a.mean * 100.0 : 0.0, a.mean > 0.0 ? (diff + half) / a.mean * 100.0 : 0.0);
+        printf(
+            "%-44s %12.2f %-2s %12.2f %-2s %+7.1f%% %18s %s\n", after.name, a.mean, before->unit, b.mean, after.unit,
+            change * 100.0, interval, verdict
+        );
+    }
+
+    printf(
+        "%zu regressions, %zu improvements beyond %.1f%% at 95%% confidence", regressions, improvements, threshold * 100.0
+    );
+    if(unmatched) printf(", %zu series without a baseline", unmatched);
+    printf("\n");
+    return regressions;
+}
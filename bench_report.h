@@ -0,0 +1,71 @@
+#ifndef BENCH_REPORT_H
+#define BENCH_REPORT_H
+
+/*
+    Machine-readable benchmark results. A report is a list of named series,
+    each holding repeated measurements of one kernel or frame phase, along
+    with the environment it ran in: compiler, optimization, CPU, thread
+    count, host and time, plus whatever the program adds, like the kernels
+    it dispatched to. Reports are written as JSON with one series per
+    line, which is also the only layout read_bench_report() understands.
+
+    compare_bench_reports() matches series by name and tests each for a
+    change in its mean with Welch's t-test: a series regressed when the
+    95% confidence interval of the difference lies wholly above zero and
+    the mean rose by more than the threshold.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+#define BENCH_MAX_SERIES 256
+#define BENCH_MAX_SAMPLES 64
+#define BENCH_MAX_ENVIRONMENT 16
+#define BENCH_NAME_LENGTH 64
+#define BENCH_VALUE_LENGTH 128
+#define BENCH_DEFAULT_THRESHOLD 0.05
+
+struct BenchSeries
+{
+    char name[BENCH_NAME_LENGTH];
+    // Lower is better for every unit a report holds
+    char unit[16];
+    size_t num_samples;
+    double samples[BENCH_MAX_SAMPLES];
+};
+
+struct BenchEnvironment
+{
+    char key[32];
+    char value[BENCH_VALUE_LENGTH];
+};
+
+struct BenchReport
+{
+    BenchEnvironment environment[BENCH_MAX_ENVIRONMENT];
+    size_t num_environment;
+    BenchSeries* series;
+    size_t num_series;
+};
+
+struct SeriesStats
+{
+    double mean, stddev, ci95;
+};
+
+// Fills in the environment of the calling process
+void init_bench_report(BenchReport* report, const char* program);
+void destroy_bench_report(BenchReport* report);
+void set_bench_environment(BenchReport* report, const char* key, const char* value);
+const char* bench_environment(const BenchReport& report, const char* key);
+// Samples past BENCH_MAX_SAMPLES, and series past BENCH_MAX_SERIES, are dropped
+void add_bench_sample(BenchReport* report, const char* name, const char* unit, double value);
+SeriesStats series_stats(const BenchSeries& series);
+
+bool write_bench_report(const BenchReport& report, const char* path);
+bool read_bench_report(BenchReport* report, const char* path);
+
+// Prints every matched series and returns how many regressed
+size_t compare_bench_reports(const BenchReport& baseline, const BenchReport& current, double threshold);
+
+#endif
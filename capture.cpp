@@ -0,0 +1,785 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include "capture.h"
+#include "threads.h"
+#include "trace.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#if defined(_WIN32)
+#define STREAM_USE_POSIX 0
+#else
+#define STREAM_USE_POSIX 1
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#define STREAM_USE_VMSPLICE 1
+#else
+#define STREAM_USE_VMSPLICE 0
+#endif
+
+#define CAPTURE_MAX_WORKERS 16
+#define CAPTURE_MAX_PATH 1024
+
+struct FrameCapture
+{
+    const char* pattern;
+    FILE* raw;
+    size_t width, height, frame_bytes;
+
+    // Frame f is filled into slot f % num_slots
+    size_t num_slots;
+    uint8_t* pixels;
+    bool* busy;
+
+    size_t num_workers;
+    std::thread workers[CAPTURE_MAX_WORKERS];
+    std::mutex mutex;
+    std::condition_variable queued, freed;
+    // Frames handed over, and the next one a worker takes
+    size_t num_frames, next_frame;
+    bool quit;
+
+    size_t failed;
+    double wait_seconds;
+};
+
+bool write_png_image(const char* path, size_t width, size_t height, const uint8_t* pixels)
+{
+    return stbi_write_png(path, (int)width, (int)height, 4, pixels, (int)width * 4) != 0;
+}
+
+static bool write_capture_frame(FrameCapture* capture, size_t frame, const uint8_t* pixels)
+{
+    if(capture->raw) return fwrite(pixels, 1, capture->frame_bytes, capture->raw) == capture->frame_bytes;
+
+    char path[CAPTURE_MAX_PATH];
+    snprintf(path, sizeof(path), capture->pattern, (int)frame);
+    return write_png_image(path, capture->width, capture->height, pixels);
+}
+
+static void capture_worker(FrameCapture* capture)
+{
+    TRACE_THREAD("capture");
+    enter_thread_role(THREAD_BACKGROUND);
+    std::unique_lock<std::mutex> lock(capture->mutex);
+    for(;;)
+    {
+        while(!capture->quit && capture->next_frame == capture->num_frames) capture->queued.wait(lock);
+        if(capture->next_frame == capture->num_frames) break;
+
+        size_t frame = capture->next_frame++;
+        size_t slot = frame % capture->num_slots;
+        lock.unlock();
+
+        bool written;
+        {
+            TRACE_SCOPE("write frame");
+            written = write_capture_frame(capture, frame, capture->pixels + slot * capture->frame_bytes);
+        }
+
+        lock.lock();
+        if(!written && !capture->failed++) fprintf(stderr, "Could not write capture frame %zu.\n", frame);
+        capture->busy[slot] = false;
+        capture->freed.notify_one();
+    }
+}
+
+FrameCapture* open_frame_capture(const char* target, size_t width, size_t height, size_t num_workers)
+{
+    FILE* raw = 0;
+    if(!strchr(target, '%'))
+    {
+        raw = fopen(target, "wb");
+        if(!raw) return 0;
+        // Order matters in a stream
+        num_workers = 1;
+    }
+    if(num_workers < 1) num_workers = 1;
+    if(num_workers > CAPTURE_MAX_WORKERS) num_workers = CAPTURE_MAX_WORKERS;
+
+    FrameCapture* capture = new FrameCapture;
+    capture->pattern = target;
+    capture->raw = raw;
+    capture->width = width;
+    capture->height = height;
+    capture->frame_bytes = width * height * 4;
+
+    // Enough for every worker to hold one while the game fills the next
+    capture->num_slots = 2 * num_workers;
+    capture->pixels = new uint8_t[capture->num_slots * capture->frame_bytes];
+    capture->busy = new bool[capture->num_slots]();
+
+    capture->num_frames = capture->next_frame = 0;
+    capture->quit = false;
+    capture->failed = 0;
+    capture->wait_seconds = 0.0;
+    capture->num_workers = num_workers;
+    for(size_t wi = 0; wi < num_workers; ++wi)
+    {
+        capture->workers[wi] = std::thread(capture_worker, capture);
+    }
+    return capture;
+}
+
+uint8_t* begin_capture_frame(FrameCapture* capture)
+{
+    size_t slot = capture->num_frames % capture->num_slots;
+    std::unique_lock<std::mutex> lock(capture->mutex);
+    if(capture->busy[slot])
+    {
+        auto start = std::chrono::steady_clock::now();
+        while(capture->busy[slot]) capture->freed.wait(lock);
+        capture->wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return capture->pixels + slot * capture->frame_bytes;
+}
+
+void end_capture_frame(FrameCapture* capture)
+{
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        capture->busy[capture->num_frames % capture->num_slots] = true;
+        ++capture->num_frames;
+    }
+    capture->queued.notify_one();
+}
+
+CaptureStats close_frame_capture(FrameCapture* capture)
+{
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        capture->quit = true;
+    }
+    capture->queued.notify_all();
+    for(size_t wi = 0; wi < capture->num_workers; ++wi)
+    {
+        capture->workers[wi].join();
+    }
+
+    if(capture->raw && fclose(capture->raw) != 0) ++capture->failed;
+
+    CaptureStats stats = {capture->num_frames, capture->failed, capture->wait_seconds};
+    delete[] capture->pixels;
+    delete[] capture->busy;
+    delete capture;
+    return stats;
+}
+
+#define STREAM_IOV_BATCH 256
+#define STREAM_MAX_TARGET 256
+// How often the writer retries a target that isn't listening yet
+#define STREAM_RETRY_MS 100
+
+// Open addressing from colors to palette indices, twice the palette
+#define DELTA_PALETTE_SLOTS 512
+
+struct FrameStream
+{
+    char target[STREAM_MAX_TARGET];
+    size_t width, height, pixel_bytes, row_bytes;
+    StreamEncoding encoding;
+    std::thread writer;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    // Read by the game thread without waiting on the writer
+    std::atomic<bool> ready, busy;
+    bool quit;
+    const uint8_t* top;
+    ptrdiff_t stride;
+
+    int fd;
+    bool spliced;
+    size_t frames, dropped;
+    bool failed;
+    uint64_t bytes, raw_bytes;
+
+    // Delta encoder, the writer's alone: the last frame sent top-down and
+    // its palette indices, the rows that changed and what they encode to
+    uint8_t* previous;
+    uint8_t* indices;
+    uint8_t* next_indices;
+    uint8_t* xored;
+    uint8_t* rows;
+    uint16_t* changed;
+    bool indexed;
+    uint32_t palette[DELTA_MAX_PALETTE];
+    uint16_t palette_slots[DELTA_PALETTE_SLOTS];
+    size_t palette_size, palette_sent;
+};
+
+#if STREAM_USE_POSIX
+static void sleep_milliseconds(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static bool stream_quitting(FrameStream* stream)
+{
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    return stream->quit;
+}
+
+static int connect_stream_socket(const char* address)
+{
+    char host[STREAM_MAX_TARGET];
+    const char* colon = strrchr(address, ':');
+    if(!colon || (size_t)(colon - address) >= sizeof(host)) return -1;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = 0;
+    if(getaddrinfo(host, colon + 1, &hints, &found) != 0) return -1;
+
+    int fd = -1;
+    for(addrinfo* ai = found; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+// Keeps trying until the consumer is there, without holding up the game.
+// A FIFO opened for writing with no reader is ENXIO under O_NONBLOCK.
+static int open_stream_target(FrameStream* stream)
+{
+    for(;;)
+    {
+        int fd;
+        if(!strncmp(stream->target, "tcp:", 4)) fd = connect_stream_socket(stream->target + 4);
+        else
+        {
+            fd = open(stream->target, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+            if(fd < 0 && errno != ENXIO) return -1;
+            if(fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        }
+        if(fd >= 0) return fd;
+        if(stream_quitting(stream)) return -1;
+        sleep_milliseconds(STREAM_RETRY_MS);
+    }
+}
+
+// Sends every byte of 'iov', resuming after partial writes
+static bool write_stream_iov(FrameStream* stream, iovec* iov, size_t count)
+{
+    while(count)
+    {
+#if STREAM_USE_VMSPLICE
+        ssize_t written = stream->spliced ? vmsplice(stream->fd, iov, count, 0) : writev(stream->fd, iov, (int)count);
+#else
+        ssize_t written = writev(stream->fd, iov, (int)count);
+#endif
+        if(written < 0)
+        {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        while(count && (size_t)written >= iov->iov_len)
+        {
+            written -= (ssize_t)iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if(count)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+
+static bool write_stream_frame(FrameStream* stream, const uint8_t* top, ptrdiff_t stride)
+{
+    iovec iov[STREAM_IOV_BATCH];
+    for(size_t y0 = 0; y0 < stream->height; y0 += STREAM_IOV_BATCH)
+    {
+        size_t count = stream->height - y0 < STREAM_IOV_BATCH ? stream->height - y0 : STREAM_IOV_BATCH;
+        for(size_t yi = 0; yi < count; ++yi)
+        {
+            iov[yi].iov_base = (void*)(top + (ptrdiff_t)(y0 + yi) * stride);
+            iov[yi].iov_len = stream->row_bytes;
+        }
+        if(!write_stream_iov(stream, iov, count)) return false;
+    }
+
+    // Spliced pages are still the caller's until the reader has them
+    int queued = 0;
+    while(stream->spliced && ioctl(stream->fd, FIONREAD, &queued) == 0 && queued > 0 && !stream_quitting(stream))
+    {
+        sleep_milliseconds(1);
+    }
+    stream->bytes += stream->height * stream->row_bytes;
+    return true;
+}
+
+// The palette index of each pixel of 'row', adding colors it hasn't
+// seen; false once a color finds the palette full
+static bool index_delta_row(FrameStream* stream, const uint8_t* row, uint8_t* out)
+{
+    uint32_t last_color = stream->palette[0];
+    uint8_t last_index = 0;
+    for(size_t xi = 0; xi < stream->width; ++xi)
+    {
+        uint32_t color = 0;
+        memcpy(&color, row + xi * stream->pixel_bytes, stream->pixel_bytes);
+        // Runs of one color are the common case
+        if(color == last_color)
+        {
+            out[xi] = last_index;
+            continue;
+        }
+
+        size_t slot = (color * 2654435761u) >> 23;
+        for(;; slot = (slot + 1) & (DELTA_PALETTE_SLOTS - 1))
+        {
+            uint16_t entry = stream->palette_slots[slot];
+            if(entry && stream->palette[entry - 1] == color)
+            {
+                last_index = (uint8_t)(entry - 1);
+                break;
+            }
+            if(entry) continue;
+            if(stream->palette_size == DELTA_MAX_PALETTE) return false;
+            stream->palette[stream->palette_size] = color;
+            stream->palette_slots[slot] = (uint16_t)++stream->palette_size;
+            last_index = (uint8_t)(stream->palette_size - 1);
+            break;
+        }
+        last_color = color;
+        out[xi] = last_index;
+    }
+    return true;
+}
+
+static bool delta_unit_zero(const uint8_t* unit, size_t unit_bytes)
+{
+    for(size_t bi = 0; bi < unit_bytes; ++bi)
+    {
+        if(unit[bi]) return false;
+    }
+    return true;
+}
+
+// Skip and literal tokens for a row of XORed units. Skips after the last
+// literal say nothing and are left off.
+static size_t encode_delta_runs(const uint8_t* xored, size_t units, size_t unit_bytes, uint8_t* out)
+{
+    size_t length = 0, end = 0;
+    for(size_t ui = 0; ui < units;)
+    {
+        bool zero = delta_unit_zero(xored + ui * unit_bytes, unit_bytes);
+        size_t run = 1;
+        while(ui + run < units && run < DELTA_MAX_RUN && delta_unit_zero(xored + (ui + run) * unit_bytes, unit_bytes) == zero) ++run;
+
+        if(zero) out[length++] = (uint8_t)(run - 1);
+        else
+        {
+            out[length++] = (uint8_t)(DELTA_TOKEN_LITERAL + run - 1);
+            memcpy(out + length, xored + ui * unit_bytes, run * unit_bytes);
+            length += run * unit_bytes;
+            end = length;
+        }
+        ui += run;
+    }
+    return end;
+}
+
+// Encodes every row that differs from the last frame sent into
+// stream->rows, leaving that frame as it is until the send succeeds;
+// false when the palette ran out partway
+static bool encode_delta_rows(FrameStream* stream, const uint8_t* top, ptrdiff_t stride, DeltaFrameHeader* header, size_t* length)
+{
+    size_t unit_bytes = stream->indexed ? 1 : stream->pixel_bytes;
+    header->rows = 0;
+    *length = 0;
+    for(size_t y = 0; y < stream->height; ++y)
+    {
+        const uint8_t* row = top + (ptrdiff_t)y * stride;
+        const uint8_t* old = stream->previous + y * stream->row_bytes;
+        if(!memcmp(row, old, stream->row_bytes)) continue;
+
+        const uint8_t* units = row;
+        if(stream->indexed)
+        {
+            uint8_t* next = stream->next_indices + y * stream->width;
+            if(!index_delta_row(stream, row, next)) return false;
+            units = next;
+            old = stream->indices + y * stream->width;
+        }
+        for(size_t bi = 0; bi < stream->width * unit_bytes; ++bi) stream->xored[bi] = units[bi] ^ old[bi];
+
+        uint8_t* out = stream->rows + *length;
+        uint16_t fields[2] = {(uint16_t)y, (uint16_t)encode_delta_runs(stream->xored, stream->width, unit_bytes, out + sizeof(fields))};
+        memcpy(out, fields, sizeof(fields));
+        *length += sizeof(fields) + fields[1];
+        stream->changed[header->rows++] = (uint16_t)y;
+    }
+    return true;
+}
+
+static bool write_delta_frame(FrameStream* stream, const uint8_t* top, ptrdiff_t stride)
+{
+    DeltaFrameHeader header = {};
+    size_t length = 0;
+    if(stream->indexed && !encode_delta_rows(stream, top, stride, &header, &length))
+    {
+        // Too many colors for indices: full-color deltas from here on
+        stream->indexed = false;
+        printf("Frame stream to '%s' has over %d colors, sending full-color deltas\n", stream->target, DELTA_MAX_PALETTE);
+    }
+    if(!stream->indexed) encode_delta_rows(stream, top, stride, &header, &length);
+
+    header.flags = stream->indexed ? DELTA_FRAME_INDEXED : 0;
+    header.palette_added = stream->indexed ? (uint16_t)(stream->palette_size - stream->palette_sent) : 0;
+    size_t palette_bytes = header.palette_added * sizeof(uint32_t);
+    header.size = (uint32_t)(sizeof(header) - sizeof(header.size) + palette_bytes + length);
+
+    iovec iov[3] = {
+        {&header, sizeof(header)},
+        {stream->palette + stream->palette_sent, palette_bytes},
+        {stream->rows, length},
+    };
+    if(!write_stream_iov(stream, iov, 3)) return false;
+
+    for(size_t ri = 0; ri < header.rows; ++ri)
+    {
+        size_t y = stream->changed[ri];
+        memcpy(stream->previous + y * stream->row_bytes, top + (ptrdiff_t)y * stride, stream->row_bytes);
+        if(stream->indexed) memcpy(stream->indices + y * stream->width, stream->next_indices + y * stream->width, stream->width);
+    }
+    if(stream->indexed) stream->palette_sent = stream->palette_size;
+    stream->bytes += sizeof(header) + palette_bytes + length;
+    return true;
+}
+
+static bool start_delta_stream(FrameStream* stream)
+{
+    DeltaStreamHeader header = {
+        DELTA_STREAM_MAGIC, DELTA_STREAM_VERSION, (uint16_t)stream->width, (uint16_t)stream->height, (uint8_t)stream->pixel_bytes, 0
+    };
+    iovec iov = {&header, sizeof(header)};
+    stream->bytes += sizeof(header);
+    return write_stream_iov(stream, &iov, 1);
+}
+
+static void stream_writer(FrameStream* stream)
+{
+    TRACE_THREAD("stream");
+    enter_thread_role(THREAD_BACKGROUND);
+    int fd = open_stream_target(stream);
+    if(fd >= 0)
+    {
+        struct stat info;
+        // Deltas are encoded into arrays the writer reuses, so they are copied
+        stream->spliced = STREAM_USE_VMSPLICE && stream->encoding == STREAM_RAW && fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+#if defined(__linux__)
+        // Room for a whole frame, so a splice rarely waits on the reader
+        if(stream->spliced) fcntl(fd, F_SETPIPE_SZ, (int)(stream->height * stream->row_bytes));
+#endif
+    }
+
+    stream->fd = fd;
+    if(fd >= 0 && stream->encoding != STREAM_RAW && !start_delta_stream(stream))
+    {
+        close(fd);
+        fd = stream->fd = -1;
+    }
+
+    std::unique_lock<std::mutex> lock(stream->mutex);
+    stream->failed = fd < 0 && !stream->quit;
+    stream->ready = fd >= 0;
+    for(;;)
+    {
+        while(!stream->quit && !stream->busy) stream->wake.wait(lock);
+        if(stream->quit) break;
+        const uint8_t* top = stream->top;
+        ptrdiff_t stride = stream->stride;
+        lock.unlock();
+
+        bool written;
+        {
+            TRACE_SCOPE("send frame");
+            written = stream->encoding == STREAM_RAW ? write_stream_frame(stream, top, stride) : write_delta_frame(stream, top, stride);
+        }
+
+        lock.lock();
+        if(written)
+        {
+            ++stream->frames;
+            stream->raw_bytes += stream->height * stream->row_bytes;
+        }
+        else
+        {
+            // The consumer went away; everything after is dropped
+            fprintf(stderr, "Frame stream to '%s' failed.\n", stream->target);
+            stream->failed = true;
+            stream->ready = false;
+        }
+        stream->busy = false;
+    }
+    if(fd >= 0) close(fd);
+}
+#endif
+
+const char* stream_encoding_name(StreamEncoding encoding)
+{
+    switch(encoding)
+    {
+        case STREAM_RAW: return "raw";
+        case STREAM_DELTA: return "delta";
+        case STREAM_DELTA_PALETTE: return "palette";
+        default: break;
+    }
+    return "unknown";
+}
+
+FrameStream* open_frame_stream(const char* target, size_t width, size_t height, size_t pixel_bytes, StreamEncoding encoding)
+{
+#if STREAM_USE_POSIX
+    if(strlen(target) >= STREAM_MAX_TARGET) return 0;
+    // A row's tokens and the frame's rows are counted in 16 bits
+    bool delta = encoding != STREAM_RAW;
+    if(delta && (width * pixel_bytes + (width + DELTA_MAX_RUN - 1) / DELTA_MAX_RUN > UINT16_MAX || height > UINT16_MAX)) return 0;
+    // A consumer that quits must fail the write, not kill the game
+    signal(SIGPIPE, SIG_IGN);
+
+    FrameStream* stream = new FrameStream;
+    strcpy(stream->target, target);
+    stream->width = width;
+    stream->height = height;
+    stream->pixel_bytes = pixel_bytes;
+    stream->row_bytes = width * pixel_bytes;
+    stream->encoding = encoding;
+    stream->ready = false;
+    stream->busy = false;
+    stream->quit = false;
+    stream->top = 0;
+    stream->stride = 0;
+    stream->fd = -1;
+    stream->spliced = false;
+    stream->frames = stream->dropped = 0;
+    stream->failed = false;
+    stream->bytes = stream->raw_bytes = 0;
+
+    size_t frame_bytes = height * stream->row_bytes;
+    stream->previous = delta ? new uint8_t[frame_bytes]() : 0;
+    stream->indices = delta ? new uint8_t[width * height]() : 0;
+    stream->next_indices = delta ? new uint8_t[width * height] : 0;
+    stream->xored = delta ? new uint8_t[stream->row_bytes] : 0;
+    size_t row_tokens = stream->row_bytes + (width + DELTA_MAX_RUN - 1) / DELTA_MAX_RUN;
+    stream->rows = delta ? new uint8_t[height * (2 * sizeof(uint16_t) + row_tokens)] : 0;
+    stream->changed = delta ? new uint16_t[height] : 0;
+    stream->indexed = encoding == STREAM_DELTA_PALETTE;
+    // Index 0 is the color of the zeros both ends start from
+    memset(stream->palette, 0, sizeof(stream->palette));
+    memset(stream->palette_slots, 0, sizeof(stream->palette_slots));
+    stream->palette_slots[0] = 1;
+    stream->palette_size = stream->palette_sent = 1;
+    stream->writer = std::thread(stream_writer, stream);
+    return stream;
+#else
+    fprintf(stderr, "Frame streams need POSIX pipes and sockets.\n");
+    return 0;
+#endif
+}
+
+bool stream_frame(FrameStream* stream, const uint8_t* top, ptrdiff_t stride)
+{
+    if(!stream->ready.load(std::memory_order_acquire) || stream->busy.load(std::memory_order_acquire))
+    {
+        ++stream->dropped;
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->top = top;
+        stream->stride = stride;
+        stream->busy = true;
+    }
+    stream->wake.notify_one();
+    return true;
+}
+
+bool frame_stream_idle(FrameStream* stream)
+{
+    return !stream->busy.load(std::memory_order_acquire);
+}
+
+StreamStats close_frame_stream(FrameStream* stream)
+{
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->quit = true;
+    }
+    stream->wake.notify_one();
+    stream->writer.join();
+
+    StreamStats stats = {stream->frames, stream->dropped, stream->failed, stream->spliced, stream->bytes, stream->raw_bytes};
+    delete[] stream->previous;
+    delete[] stream->indices;
+    delete[] stream->next_indices;
+    delete[] stream->xored;
+    delete[] stream->rows;
+    delete[] stream->changed;
+    delete stream;
+    return stats;
+}
+
+#define SCREENSHOT_MAX_PATH 256
+
+struct ScreenshotWriter
+{
+    char prefix[SCREENSHOT_MAX_PATH];
+    std::thread writer;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> busy;
+    bool quit;
+    const uint8_t* top;
+    ptrdiff_t stride;
+    size_t width, height;
+
+    // The writer's own copy, grown to the largest screenshot yet
+    uint8_t* pixels;
+    size_t capacity;
+    size_t saved;
+};
+
+static bool save_screenshot(ScreenshotWriter* writer, const uint8_t* top, ptrdiff_t stride, size_t width, size_t height)
+{
+    size_t row_bytes = width * 4;
+    if(row_bytes * height > writer->capacity)
+    {
+        delete[] writer->pixels;
+        writer->capacity = row_bytes * height;
+        writer->pixels = new uint8_t[writer->capacity];
+    }
+    for(size_t y = 0; y < height; ++y)
+    {
+        uint8_t* row = writer->pixels + y * row_bytes;
+        memcpy(row, top + (ptrdiff_t)y * stride, row_bytes);
+        // The default framebuffer's alpha is whatever blending left there
+        for(size_t x = 3; x < row_bytes; x += 4) row[x] = 255;
+    }
+
+    time_t now = time(0);
+    char stamp[32];
+    // The prefix and the stamp, the room their terminators took going to
+    // the dashes, then the widest count and the extension
+    char path[SCREENSHOT_MAX_PATH + sizeof(stamp) + 20 + sizeof(".png")];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(path, sizeof(path), "%s-%s-%zu.png", writer->prefix, stamp, writer->saved + 1);
+    if(!stbi_write_png(path, (int)width, (int)height, 4, writer->pixels, (int)row_bytes))
+    {
+        fprintf(stderr, "Could not write screenshot '%s'.\n", path);
+        return false;
+    }
+    printf("Saved screenshot '%s'\n", path);
+    return true;
+}
+
+static void screenshot_writer(ScreenshotWriter* writer)
+{
+    TRACE_THREAD("screenshot");
+    enter_thread_role(THREAD_BACKGROUND);
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    for(;;)
+    {
+        while(!writer->quit && !writer->busy) writer->wake.wait(lock);
+        if(!writer->busy) break;
+        const uint8_t* top = writer->top;
+        ptrdiff_t stride = writer->stride;
+        size_t width = writer->width, height = writer->height;
+        lock.unlock();
+
+        bool saved;
+        {
+            TRACE_SCOPE("write screenshot");
+            saved = save_screenshot(writer, top, stride, width, height);
+        }
+
+        lock.lock();
+        if(saved) ++writer->saved;
+        writer->busy = false;
+    }
+}
+
+ScreenshotWriter* open_screenshot_writer(const char* prefix)
+{
+    if(strlen(prefix) >= SCREENSHOT_MAX_PATH) return 0;
+
+    ScreenshotWriter* writer = new ScreenshotWriter;
+    strcpy(writer->prefix, prefix);
+    writer->busy = false;
+    writer->quit = false;
+    writer->top = 0;
+    writer->stride = 0;
+    writer->width = writer->height = 0;
+    writer->pixels = 0;
+    writer->capacity = 0;
+    writer->saved = 0;
+    writer->writer = std::thread(screenshot_writer, writer);
+    return writer;
+}
+
+bool write_screenshot(ScreenshotWriter* writer, const uint8_t* top, ptrdiff_t stride, size_t width, size_t height)
+{
+    if(writer->busy.load(std::memory_order_acquire)) return false;
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->top = top;
+        writer->stride = stride;
+        writer->width = width;
+        writer->height = height;
+        writer->busy = true;
+    }
+    writer->wake.notify_one();
+    return true;
+}
+
+bool screenshot_writer_idle(ScreenshotWriter* writer)
+{
+    return !writer->busy.load(std::memory_order_acquire);
+}
+
+size_t close_screenshot_writer(ScreenshotWriter* writer)
+{
+    {
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->quit = true;
+    }
+    writer->wake.notify_one();
+    writer->writer.join();
+
+    size_t saved = writer->saved;
+    delete[] writer->pixels;
+    delete writer;
+    return saved;
+}
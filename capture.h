@@ -0,0 +1,156 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/*
+    Frame capture. Frames are handed over as top-down R,G,B,A bytes and
+    written by worker threads, either as a numbered PNG sequence through
+    the stb_image_write GLFW vendors or back to back as raw video into one
+    file or named pipe, which ffmpeg reads with -f rawvideo -pix_fmt rgba.
+    PNG frames are encoded in parallel; raw frames keep their order and
+    are written by a single worker.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+struct FrameCapture;
+
+struct CaptureStats
+{
+    size_t frames, failed;
+    // Time the game thread spent waiting for a free slot
+    double wait_seconds;
+};
+
+// A 'target' with a printf conversion, like "frames/%05d.png", names the
+// PNG files; anything else is opened as the raw stream. Returns 0 when
+// the raw target can't be opened.
+FrameCapture* open_frame_capture(const char* target, size_t width, size_t height, size_t num_workers);
+
+// width * height * 4 bytes to fill with the next frame. Blocks while
+// every slot is still queued or being written.
+uint8_t* begin_capture_frame(FrameCapture* capture);
+void end_capture_frame(FrameCapture* capture);
+
+// Writes out every queued frame and frees the capture
+CaptureStats close_frame_capture(FrameCapture* capture);
+
+// One top-down R,G,B,A image, written on the calling thread
+bool write_png_image(const char* path, size_t width, size_t height, const uint8_t* pixels);
+
+/*
+    Frame streams. A live sink for rawvideo consumers such as ffmpeg: the
+    caller's own pixels are handed to a writer thread, which opens the
+    target itself and sends the rows top-down in one gather call per
+    batch, vmsplice() into a pipe on Linux and writev() otherwise, so no
+    frame is copied in user space. A frame handed over before the last
+    one is out is dropped instead of blocking.
+
+    For remote viewing over thin links the writer can send deltas
+    instead. It keeps a copy of the last frame it sent. Only rows that
+    differ from it go out, each XORed against its old contents and
+    run-length encoded: unchanged pixels XOR to zero and collapse into
+    skip tokens, so a frame where a few hundred pixels moved costs a few
+    hundred bytes. The palette encoding first maps pixels to indices
+    into a palette of up to 256 colors. New colors are sent with the
+    frame that first uses them, so changed pixels cost a byte each. A
+    frame with a 257th color switches the stream to full-color deltas
+    for good. stream_viewer decodes either one back to rawvideo.
+*/
+struct FrameStream;
+
+enum StreamEncoding: uint8_t
+{
+    STREAM_RAW = 0,
+    STREAM_DELTA = 1,
+    STREAM_DELTA_PALETTE = 2,
+    NUM_STREAM_ENCODINGS
+};
+
+/*
+    The delta stream, little-endian: a DeltaStreamHeader, then each frame
+    as a DeltaFrameHeader, 'palette_added' 32-bit colors to append to the
+    palette, and 'rows' changed rows. Each row is a 16-bit y counted from
+    the top, a 16-bit byte count and its tokens. A token below
+    DELTA_TOKEN_LITERAL skips token + 1 unchanged units; any other is
+    followed by token - DELTA_TOKEN_LITERAL + 1 units to XOR in. Units
+    are pixels, or indices into the palette in frames with
+    DELTA_FRAME_INDEXED. Both ends start from a frame of zeros and a
+    palette holding only 0.
+*/
+#define DELTA_STREAM_MAGIC 0x46444953u // "SIDF"
+#define DELTA_STREAM_VERSION 1
+#define DELTA_FRAME_INDEXED 1
+#define DELTA_TOKEN_LITERAL 0x80
+#define DELTA_MAX_RUN 128
+#define DELTA_MAX_PALETTE 256
+
+struct DeltaStreamHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t width, height;
+    uint8_t pixel_bytes;
+    uint8_t reserved;
+};
+static_assert(sizeof(DeltaStreamHeader) == 12, "sent as bytes");
+
+struct DeltaFrameHeader
+{
+    // Bytes of the frame after this field
+    uint32_t size;
+    uint16_t rows;
+    uint16_t palette_added;
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+static_assert(sizeof(DeltaFrameHeader) == 12, "sent as bytes");
+
+struct StreamStats
+{
+    size_t frames, dropped;
+    bool failed;
+    // Whether the pages went to a pipe by reference
+    bool spliced;
+    // What was sent, and what the same frames take as raw video
+    uint64_t bytes, raw_bytes;
+};
+
+const char* stream_encoding_name(StreamEncoding encoding);
+
+// 'target' is a file or named pipe path, or tcp:HOST:PORT. Returns 0 when
+// rows are too wide for the delta encodings.
+FrameStream* open_frame_stream(const char* target, size_t width, size_t height, size_t pixel_bytes, StreamEncoding encoding = STREAM_RAW);
+
+// Queues 'height' rows starting at 'top', 'stride' bytes apart (negative
+// for bottom-up storage). The pixels must stay untouched until
+// frame_stream_idle(); returns false, counting a drop, while the last
+// frame is still being written or the target isn't open yet.
+bool stream_frame(FrameStream* stream, const uint8_t* top, ptrdiff_t stride);
+bool frame_stream_idle(FrameStream* stream);
+
+StreamStats close_frame_stream(FrameStream* stream);
+
+/*
+    Screenshots. The caller reads a frame back however it can and hands
+    over a pointer to it; a writer thread copies the rows top-down with
+    opaque alpha into a buffer of its own and encodes that as a PNG named
+    after the time it was taken, so the hand-over costs the game thread
+    nothing. One screenshot is written at a time.
+*/
+struct ScreenshotWriter;
+
+// Files are named PREFIX-YYYYMMDD-HHMMSS-N.png
+ScreenshotWriter* open_screenshot_writer(const char* prefix);
+
+// Queues 'height' rows of 'width' R,G,B,A pixels starting at 'top',
+// 'stride' bytes apart (negative for bottom-up storage). The pixels must
+// stay untouched until screenshot_writer_idle(); returns false while the
+// last screenshot is still being written.
+bool write_screenshot(ScreenshotWriter* writer, const uint8_t* top, ptrdiff_t stride, size_t width, size_t height);
+bool screenshot_writer_idle(ScreenshotWriter* writer);
+
+// Finishes the screenshot being written; returns how many were saved
+size_t close_screenshot_writer(ScreenshotWriter* writer);
+
+#endif
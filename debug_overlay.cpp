@@ -0,0 +1,520 @@
+#include <cstdio>
+#include <cstring>
+#include "debug_overlay.h"
+#include "runtime.h"
+#include "alloc_stats.h"
+
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_STANDARD_IO
+#define NK_INCLUDE_STANDARD_VARARGS
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+#define NK_IMPLEMENTATION
+#include <nuklear.h>
+
+#define DEBUG_OVERLAY_FONT_HEIGHT 13.0f
+#define DEBUG_OVERLAY_COMMANDS (64 * 1024)
+// Texture unit the font is bound to, clear of the present and text ones
+#define DEBUG_OVERLAY_TEXTURE_UNIT 4
+
+struct DebugOverlayVertex
+{
+    float position[2];
+    float uv[2];
+    nk_byte color[4];
+};
+
+struct DebugOverlay
+{
+    GLFWwindow* window;
+    bool shown;
+
+    nk_context context;
+    nk_font_atlas atlas;
+    nk_draw_null_texture null_texture;
+    nk_convert_config config;
+    void* memory;
+
+    // Converted by each shown update, uploaded and drawn by the next draw
+    nk_buffer commands, vertices, elements;
+    void* command_memory;
+    DebugOverlayVertex* vertex_memory;
+    nk_draw_index* element_memory;
+    size_t num_vertices, num_elements;
+
+    GLuint program;
+    GLint projection_location, font_location;
+    GLuint vao, vbo, ebo;
+    GLuint font_texture;
+
+    // Nuklear lays out in window coordinates, GL draws in framebuffer pixels
+    int window_width, window_height;
+    int framebuffer_width, framebuffer_height;
+};
+
+/*
+################################################
+##                  BACKEND                   ##
+################################################
+*/
+
+const char* debug_overlay_vertex_shader =
+    "\n"
+    GLSL_HEADER
+    "\n"
+    "layout(location = 0) in vec2 position;\n"
+    "layout(location = 1) in vec2 uv;\n"
+    "layout(location = 2) in vec4 color;\n"
+    "uniform mat4 projection;\n"
+    "\n"
+    "out vec2 frag_uv;\n"
+    "out vec4 frag_color;\n"
+    "\n"
+    "void main(void){\n"
+    "    frag_uv = uv;\n"
+    "    frag_color = color;\n"
+    "    gl_Position = projection * vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+const char* debug_overlay_fragment_shader =
+    "\n"
+    GLSL_HEADER
+    "\n"
+    "uniform sampler2D font;\n"
+    "in vec2 frag_uv;\n"
+    "in vec4 frag_color;\n"
+    "\n"
+    "out vec4 outColor;\n"
+    "\n"
+    "void main(void){\n"
+    "    outColor = frag_color * texture(font, frag_uv);\n"
+    "}\n";
+
+// The font atlas is the only thing Nuklear allocates, once at startup
+static void* debug_overlay_alloc(nk_handle, void* old, nk_size size)
+{
+    (void)old;
+    return counted_malloc(size, ALLOC_PRESENT);
+}
+
+static void debug_overlay_free(nk_handle, void* block)
+{
+    counted_free(block);
+}
+
+static bool init_debug_overlay_gl(DebugOverlay* overlay, ShaderCache* cache)
+{
+    overlay->program = create_program(debug_overlay_vertex_shader, debug_overlay_fragment_shader, cache);
+    if(!overlay->program) return false;
+    overlay->projection_location = glGetUniformLocation(overlay->program, "projection");
+    overlay->font_location = glGetUniformLocation(overlay->program, "font");
+
+    GLint previous;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glGenVertexArrays(1, &overlay->vao);
+    glGenBuffers(1, &overlay->vbo);
+    glGenBuffers(1, &overlay->ebo);
+    glBindVertexArray(overlay->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->vbo);
+    glBufferData(GL_ARRAY_BUFFER, DEBUG_OVERLAY_MAX_VERTICES * sizeof(DebugOverlayVertex), 0, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, overlay->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, DEBUG_OVERLAY_MAX_ELEMENTS * sizeof(nk_draw_index), 0, GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(DebugOverlayVertex), (const void*)offsetof(DebugOverlayVertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(DebugOverlayVertex), (const void*)offsetof(DebugOverlayVertex, uv));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(DebugOverlayVertex), (const void*)offsetof(DebugOverlayVertex, color));
+
+    // The element buffer binding is part of the VAO, so it stays bound
+    glBindVertexArray((GLuint)previous);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+static void bake_debug_overlay_font(DebugOverlay* overlay)
+{
+    nk_allocator allocator;
+    allocator.userdata.ptr = 0;
+    allocator.alloc = debug_overlay_alloc;
+    allocator.free = debug_overlay_free;
+
+    nk_font_atlas_init(&overlay->atlas, &allocator);
+    nk_font_atlas_begin(&overlay->atlas);
+    nk_font* font = nk_font_atlas_add_default(&overlay->atlas, DEBUG_OVERLAY_FONT_HEIGHT, 0);
+    int width, height;
+    const void* pixels = nk_font_atlas_bake(&overlay->atlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+
+    GLint previous;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+    glGenTextures(1, &overlay->font_texture);
+    glBindTexture(GL_TEXTURE_2D, overlay->font_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D, (GLuint)previous);
+
+    nk_font_atlas_end(&overlay->atlas, nk_handle_id((int)overlay->font_texture), &overlay->null_texture);
+    nk_font_atlas_cleanup(&overlay->atlas);
+    nk_init_fixed(&overlay->context, overlay->memory, DEBUG_OVERLAY_MEMORY, &font->handle);
+}
+
+DebugOverlay* create_debug_overlay(GLFWwindow* window, ShaderCache* cache)
+{
+    ALLOC_SCOPE(ALLOC_PRESENT);
+    DebugOverlay* overlay = new DebugOverlay();
+    overlay->window = window;
+    if(!init_debug_overlay_gl(overlay, cache))
+    {
+        delete overlay;
+        return 0;
+    }
+
+    overlay->memory = new uint8_t[DEBUG_OVERLAY_MEMORY];
+    overlay->command_memory = new uint8_t[DEBUG_OVERLAY_COMMANDS];
+    overlay->vertex_memory = new DebugOverlayVertex[DEBUG_OVERLAY_MAX_VERTICES];
+    overlay->element_memory = new nk_draw_index[DEBUG_OVERLAY_MAX_ELEMENTS];
+    bake_debug_overlay_font(overlay);
+
+    static const nk_draw_vertex_layout_element layout[] = {
+        {NK_VERTEX_POSITION, NK_FORMAT_FLOAT, offsetof(DebugOverlayVertex, position)},
+        {NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, offsetof(DebugOverlayVertex, uv)},
+        {NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, offsetof(DebugOverlayVertex, color)},
+        {NK_VERTEX_LAYOUT_END}
+    };
+    nk_convert_config& config = overlay->config;
+    memset(&config, 0, sizeof(config));
+    config.vertex_layout = layout;
+    config.vertex_size = sizeof(DebugOverlayVertex);
+    config.vertex_alignment = NK_ALIGNOF(DebugOverlayVertex);
+    config.null = overlay->null_texture;
+    config.circle_segment_count = 22;
+    config.curve_segment_count = 22;
+    config.arc_segment_count = 22;
+    config.global_alpha = 1.0f;
+    config.shape_AA = NK_ANTI_ALIASING_ON;
+    config.line_AA = NK_ANTI_ALIASING_ON;
+    return overlay;
+}
+
+void destroy_debug_overlay(DebugOverlay* overlay)
+{
+    if(!overlay) return;
+    nk_free(&overlay->context);
+    nk_font_atlas_clear(&overlay->atlas);
+    glDeleteTextures(1, &overlay->font_texture);
+    glDeleteBuffers(1, &overlay->vbo);
+    glDeleteBuffers(1, &overlay->ebo);
+    glDeleteVertexArrays(1, &overlay->vao);
+    glDeleteProgram(overlay->program);
+    delete[] (uint8_t*)overlay->memory;
+    delete[] (uint8_t*)overlay->command_memory;
+    delete[] overlay->vertex_memory;
+    delete[] overlay->element_memory;
+    delete overlay;
+}
+
+void draw_debug_overlay(DebugOverlay* overlay)
+{
+    if(!overlay->shown || !overlay->num_elements) return;
+
+    GLint program, previous_vao, previous_texture, viewport[4];
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vao);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glViewport(0, 0, overlay->framebuffer_width, overlay->framebuffer_height);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_SCISSOR_TEST);
+
+    float width = (float)overlay->window_width, height = (float)overlay->window_height;
+    const GLfloat projection[16] = {
+        2.0f / width, 0.0f, 0.0f, 0.0f,
+        0.0f, -2.0f / height, 0.0f, 0.0f,
+        0.0f, 0.0f, -1.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f, 1.0f
+    };
+    glUseProgram(overlay->program);
+    glUniformMatrix4fv(overlay->projection_location, 1, GL_FALSE, projection);
+    glUniform1i(overlay->font_location, DEBUG_OVERLAY_TEXTURE_UNIT);
+    glActiveTexture(GL_TEXTURE0 + DEBUG_OVERLAY_TEXTURE_UNIT);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+
+    glBindVertexArray(overlay->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, overlay->num_vertices * sizeof(DebugOverlayVertex), overlay->vertex_memory);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, overlay->num_elements * sizeof(nk_draw_index), overlay->element_memory);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Clip rectangles are in window coordinates from the top
+    float scale_x = overlay->framebuffer_width / width, scale_y = overlay->framebuffer_height / height;
+    const nk_draw_command* command;
+    const nk_draw_index* offset = 0;
+    nk_draw_foreach(command, &overlay->context, &overlay->commands)
+    {
+        if(!command->elem_count) continue;
+        glBindTexture(GL_TEXTURE_2D, (GLuint)command->texture.id);
+        glScissor(
+            (GLint)(command->clip_rect.x * scale_x),
+            (GLint)((height - (command->clip_rect.y + command->clip_rect.h)) * scale_y),
+            (GLint)(command->clip_rect.w * scale_x),
+            (GLint)(command->clip_rect.h * scale_y)
+        );
+        glDrawElements(GL_TRIANGLES, (GLsizei)command->elem_count, sizeof(nk_draw_index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, offset);
+        offset += command->elem_count;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, (GLuint)previous_texture);
+    glActiveTexture(GL_TEXTURE0);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+    glUseProgram((GLuint)program);
+    glBindVertexArray((GLuint)previous_vao);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+/*
+################################################
+##                   WINDOW                   ##
+################################################
+*/
+
+static void build_phase_graphs(nk_context* context, const FrameProfiler& profiler)
+{
+    // Over the whole run, for the rare hitches the ring has long lost
+    HistogramSummary work = summarize_histogram(profiler.work_histogram, 0);
+    HistogramSummary present = summarize_histogram(profiler.present_histogram, 0);
+    nk_layout_row_dynamic(context, 16, 1);
+    nk_labelf(context, NK_TEXT_LEFT, "work     p99 %6.0f  p99.9 %6.0f  max %6.0f us", work.p99 * 1e6, work.p999 * 1e6, work.max * 1e6);
+    nk_labelf(context, NK_TEXT_LEFT, "present  p99 %6.0f  p99.9 %6.0f  max %6.0f us", present.p99 * 1e6, present.p999 * 1e6, present.max * 1e6);
+    nk_layout_row_dynamic(context, 22, 1);
+    if(nk_button_label(context, "Print histograms (F6)")) print_frame_histograms(profiler);
+
+    size_t n = profiler.num_frames;
+    size_t first = n < PROFILE_FRAMES ? 0 : profiler.current;
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        PhaseStats stats = phase_stats(profiler, (FramePhase)pi);
+        nk_layout_row_dynamic(context, 16, 1);
+        nk_labelf(context, NK_TEXT_LEFT, "%-10s avg %6.0f  p99 %6.0f us", phase_names[pi], stats.avg * 1e6f, stats.p99 * 1e6f);
+
+        // Scaled to the p99 so one spike doesn't flatten the rest
+        float top = stats.p99 * 1.25e6f;
+        nk_layout_row_dynamic(context, 28, 1);
+        if(n && top > 0.0f && nk_chart_begin(context, NK_CHART_LINES, (int)n, 0.0f, top))
+        {
+            for(size_t i = 0; i < n; ++i) nk_chart_push(context, profiler.samples[pi][(first + i) % PROFILE_FRAMES] * 1e6f);
+            nk_chart_end(context);
+        }
+    }
+
+    // GPU time lags a few frames behind, so only its average is shown
+    if(!profiler.gpu) return;
+    nk_layout_row_dynamic(context, 16, 1);
+    for(size_t gi = 0; gi < NUM_GPU_PHASES; ++gi)
+    {
+        nk_labelf(context, NK_TEXT_LEFT, "gpu %-6s avg %6.0f us", gpu_phase_names[gi], profiler.gpu->shown[gi]);
+    }
+}
+
+static void build_counters(nk_context* context, const DebugOverlaySources& sources)
+{
+    const FrameProfiler& profiler = *sources.profiler;
+    nk_layout_row_dynamic(context, 16, 1);
+    nk_labelf(context, NK_TEXT_LEFT, "%.1f fps, %zu frames profiled", sources.pacer->fps, profiler.total_frames);
+
+    // Per frame over the last window, as the profiler overlay shows them
+    if(profiler.counters)
+    {
+        for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+        {
+            const uint64_t* window = profiler.counter_shown[pi];
+            double ipc = window[PERF_CYCLES] ? (double)window[PERF_INSTRUCTIONS] / window[PERF_CYCLES] : 0.0;
+            nk_labelf(
+                context, NK_TEXT_LEFT, "%-10s IPC %.2f  LLC %llu  br %llu", phase_names[pi], ipc,
+                (unsigned long long)(window[PERF_LLC_MISSES] / COUNTER_WINDOW_FRAMES),
+                (unsigned long long)(window[PERF_BRANCH_MISSES] / COUNTER_WINDOW_FRAMES)
+            );
+        }
+    }
+    else nk_label(context, "No hardware counters, see --counters", NK_TEXT_LEFT);
+
+    AllocCounts counts;
+    read_alloc_counts(&counts);
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti)
+    {
+        nk_labelf(
+            context, NK_TEXT_LEFT, "alloc %-10s %llu, %llu KiB", alloc_tag_names[ti],
+            (unsigned long long)counts.allocations[ti], (unsigned long long)(counts.bytes[ti] / 1024)
+        );
+    }
+}
+
+static void build_pool_row(nk_context* context, const char* name, size_t count, size_t capacity, size_t high_water, size_t dropped)
+{
+    nk_layout_row_dynamic(context, 16, 1);
+    nk_labelf(context, NK_TEXT_LEFT, "%-12s %zu of %zu, high %zu, dropped %zu", name, count, capacity, high_water, dropped);
+    nk_layout_row_dynamic(context, 10, 1);
+    nk_prog(context, count, capacity, nk_false);
+}
+
+static void build_pools(nk_context* context, const DebugOverlaySources& sources)
+{
+    const GameState& state = *sources.state;
+    const ParticleSystem& particles = *sources.particles;
+    build_pool_row(context, "effects", state.effects.count, EFFECT_CAPACITY, state.effects.count, state.effects.dropped);
+    build_pool_row(context, "particles", particles.count, particles.capacity, particles.high_water, particles.dropped);
+
+    static const char* owner_names[NUM_PROJECTILE_OWNERS] = {"shots", "bombs"};
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        const Archetype& projectiles = state.game.projectiles[oi];
+        build_pool_row(context, owner_names[oi], projectiles.count, projectiles.capacity, projectiles.high_water, 0);
+    }
+}
+
+static void build_toggles(nk_context* context, const DebugOverlaySources& sources)
+{
+    FramePacer* pacer = sources.pacer;
+    Presenter* presenter = sources.presenter;
+
+    static const char* pacing_names[NUM_PACING_MODES] = {"vsync", "adaptive", "uncapped", "fixed", "vrr"};
+    nk_layout_row_dynamic(context, 22, 2);
+    nk_label(context, "Pacing", NK_TEXT_LEFT);
+    int pacing = nk_combo(context, pacing_names, NUM_PACING_MODES, pacer->mode, 20, nk_vec2(160, 120));
+    if(pacing != pacer->mode) set_pacing_mode(pacer, (PacingMode)pacing);
+
+    static const char* scale_names[] = {"stretch", "aspect", "integer"};
+    nk_label(context, "Scale", NK_TEXT_LEFT);
+    int scale = nk_combo(context, scale_names, 3, presenter->mode, 20, nk_vec2(160, 100));
+    if(scale != presenter->mode)
+    {
+        presenter->mode = (ScaleMode)scale;
+        update_present_viewport(presenter, framebuffer_width, framebuffer_height);
+    }
+
+    // Applied between frames by the loop, like F4 and F5
+    RenderVariants* variants = sources.variants;
+    if(variants->switch_raster)
+    {
+        static const char* raster_names[NUM_RASTER_PATHS] = {"stamped", "simd", "scalar"};
+        nk_label(context, "Raster (F4)", NK_TEXT_LEFT);
+        int raster = nk_combo(context, raster_names, NUM_RASTER_PATHS, sources.renderer->raster_path, 20, nk_vec2(160, 100));
+        if(raster != sources.renderer->raster_path) request_raster_path(variants, (RasterPath)raster);
+    }
+    if(variants->switch_upload)
+    {
+        static const char* upload_names[NUM_UPLOAD_MODES] = {"direct", "pbo", "persistent"};
+        nk_label(context, "Upload (F5)", NK_TEXT_LEFT);
+        int upload = nk_combo(context, upload_names, NUM_UPLOAD_MODES, sources.uploader->mode, 20, nk_vec2(160, 100));
+        if(upload != sources.uploader->mode) request_upload_mode(variants, (UploadMode)upload);
+    }
+
+    nk_layout_row_dynamic(context, 22, 1);
+    int profiler = sources.show_profiler->load();
+    if(nk_checkbox_label(context, "Profiler overlay (F3)", &profiler)) sources.show_profiler->store(profiler != 0);
+    // Read back before the overlay is drawn, so it isn't in the picture
+    if(presenter->screenshots && nk_button_label(context, "Screenshot (F12)")) request_screenshot(presenter->screenshots);
+}
+
+static void build_variants(nk_context* context, const RenderVariants& variants)
+{
+    nk_layout_row_dynamic(context, 16, 1);
+    nk_label(context, "raster    upload      frames   draw  upload us", NK_TEXT_LEFT);
+    for(size_t ri = 0; ri < NUM_RASTER_PATHS; ++ri)
+    {
+        for(size_t ui = 0; ui < NUM_UPLOAD_MODES; ++ui)
+        {
+            const VariantStats& stats = variants.stats[ri][ui];
+            if(!stats.frames) continue;
+            nk_labelf(
+                context, NK_TEXT_LEFT, "%-9s %-10s %7zu %6.0f %6.0f", raster_path_name((RasterPath)ri), upload_mode_name((UploadMode)ui),
+                stats.frames, stats.draw / stats.frames * 1e6, stats.upload / stats.frames * 1e6
+            );
+        }
+    }
+    if(variants.check_pending) nk_label(context, "Check pending, waits for F3 to close", NK_TEXT_LEFT);
+    else if(variants.checks)
+    {
+        nk_labelf(
+            context, NK_TEXT_LEFT, "Last check: %s, %zu pixels off scalar", raster_path_name(variants.last_checked), variants.last_mismatch
+        );
+    }
+}
+
+void update_debug_overlay(DebugOverlay* overlay, bool shown, const DebugOverlaySources& sources)
+{
+    overlay->shown = shown;
+    if(!shown) return;
+
+    nk_context* context = &overlay->context;
+    // Drops what the last shown frame drew
+    nk_clear(context);
+    glfwGetWindowSize(overlay->window, &overlay->window_width, &overlay->window_height);
+    glfwGetFramebufferSize(overlay->window, &overlay->framebuffer_width, &overlay->framebuffer_height);
+    if(overlay->window_width <= 0 || overlay->window_height <= 0)
+    {
+        overlay->num_elements = 0;
+        return;
+    }
+
+    // Polled rather than fed by callbacks, so nothing reaches Nuklear while hidden
+    double mouse_x, mouse_y;
+    glfwGetCursorPos(overlay->window, &mouse_x, &mouse_y);
+    int x = (int)mouse_x, y = (int)mouse_y;
+    nk_input_begin(context);
+    nk_input_motion(context, x, y);
+    nk_input_button(context, NK_BUTTON_LEFT, x, y, glfwGetMouseButton(overlay->window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS);
+    nk_input_button(context, NK_BUTTON_RIGHT, x, y, glfwGetMouseButton(overlay->window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS);
+    nk_input_end(context);
+
+    nk_flags flags = NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE;
+    if(nk_begin(context, "Debug (F2)", nk_rect(10, 10, 380, 560), flags))
+    {
+        if(nk_tree_push(context, NK_TREE_TAB, "Frame phases", NK_MAXIMIZED))
+        {
+            build_phase_graphs(context, *sources.profiler);
+            nk_tree_pop(context);
+        }
+        if(nk_tree_push(context, NK_TREE_TAB, "Counters", NK_MINIMIZED))
+        {
+            build_counters(context, sources);
+            nk_tree_pop(context);
+        }
+        if(nk_tree_push(context, NK_TREE_TAB, "Pools", NK_MAXIMIZED))
+        {
+            build_pools(context, sources);
+            nk_tree_pop(context);
+        }
+        if(nk_tree_push(context, NK_TREE_TAB, "Toggles", NK_MAXIMIZED))
+        {
+            build_toggles(context, sources);
+            nk_tree_pop(context);
+        }
+        if(nk_tree_push(context, NK_TREE_TAB, "Render variants", NK_MINIMIZED))
+        {
+            build_variants(context, *sources.variants);
+            nk_tree_pop(context);
+        }
+    }
+    nk_end(context);
+
+    // Converted into the fixed blocks; the draw uploads exactly what was used
+    nk_buffer_init_fixed(&overlay->commands, overlay->command_memory, DEBUG_OVERLAY_COMMANDS);
+    nk_buffer_init_fixed(&overlay->vertices, overlay->vertex_memory, DEBUG_OVERLAY_MAX_VERTICES * sizeof(DebugOverlayVertex));
+    nk_buffer_init_fixed(&overlay->elements, overlay->element_memory, DEBUG_OVERLAY_MAX_ELEMENTS * sizeof(nk_draw_index));
+    if(nk_convert(context, &overlay->commands, &overlay->vertices, &overlay->elements, &overlay->config) != NK_CONVERT_SUCCESS)
+    {
+        // A window too big for the blocks is skipped rather than half drawn
+        overlay->num_vertices = overlay->num_elements = 0;
+    }
+    else
+    {
+        overlay->num_vertices = overlay->vertices.allocated / sizeof(DebugOverlayVertex);
+        overlay->num_elements = overlay->elements.allocated / sizeof(nk_draw_index);
+    }
+}
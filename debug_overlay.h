@@ -0,0 +1,58 @@
+#ifndef DEBUG_OVERLAY_H
+#define DEBUG_OVERLAY_H
+
+/*
+    Debug overlay. A Nuklear window over the presented frame on the GL
+    paths, with a graph of every frame phase, the hardware and allocation
+    counters, how full the effect, particle and projectile pools are, the
+    pacing, scale mode and profiler toggles, and the render variants with
+    their timings.
+
+    Hidden, it costs a flag test a frame: no input is fed to Nuklear, no
+    layout runs and nothing is converted or uploaded. Shown, the context
+    and its command, vertex and element buffers live in fixed blocks
+    allocated with the overlay, so even then frames allocate nothing; only
+    the font is baked once from Nuklear's default font at startup. The
+    vertices are drawn by a GL 3.3 core backend of our own, in window
+    coordinates over the whole framebuffer, clipped by scissor rectangles.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include "runtime.h"
+
+// Sized for the full window with every section open
+#define DEBUG_OVERLAY_MEMORY (256 * 1024)
+#define DEBUG_OVERLAY_MAX_VERTICES 32768
+#define DEBUG_OVERLAY_MAX_ELEMENTS 98304
+
+// What the overlay reads and toggles
+struct DebugOverlaySources
+{
+    const FrameProfiler* profiler;
+    const GameState* state;
+    const ParticleSystem* particles;
+    FramePacer* pacer;
+    Presenter* presenter;
+    std::atomic<bool>* show_profiler;
+    RenderVariants* variants;
+    const FrameRenderer* renderer;
+    const PixelUploader* uploader;
+};
+
+struct DebugOverlay;
+
+// 0 when the program doesn't link, with 'window' the one it draws over
+DebugOverlay* create_debug_overlay(GLFWwindow* window, ShaderCache* cache);
+void destroy_debug_overlay(DebugOverlay* overlay);
+
+// Frame loop, before the frame is swapped. Builds the window from
+// 'sources' and the mouse when 'shown', and does nothing else otherwise.
+void update_debug_overlay(DebugOverlay* overlay, bool shown, const DebugOverlaySources& sources);
+// Draws what the last update built, if it was shown, over the whole
+// framebuffer of the current context. The caller's program, VAO,
+// viewport and texture bindings are put back.
+void draw_debug_overlay(DebugOverlay* overlay);
+
+#endif
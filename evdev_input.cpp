@@ -0,0 +1,294 @@
+#include <cstdio>
+#include <cstdlib>
+#include "evdev_input.h"
+#include "runtime.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define EVDEV_MAX_DEVICES 16
+#define EVDEV_MAX_NODES 64
+#define EVDEV_QUEUE_CAPACITY 256
+
+struct EvdevKey
+{
+    double time;
+    int key;
+    int action;
+};
+
+struct EvdevInput
+{
+    std::thread thread;
+    bool grab;
+    // Written to stop the thread
+    int wake_fd;
+    int inotify_fd;
+
+    // Only touched by the thread once it runs; 'nodes' are the N of the
+    // /dev/input/eventN each device was opened from
+    int devices[EVDEV_MAX_DEVICES];
+    int nodes[EVDEV_MAX_DEVICES];
+    size_t num_devices;
+
+    // head is only written by the frame loop and tail by the thread
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    size_t dropped;
+    EvdevKey keys[EVDEV_QUEUE_CAPACITY];
+
+    std::mutex mutex;
+    std::condition_variable arrived;
+};
+
+// The keys key_callback() knows, plus the MAME layout arcade encoders
+// ship with: 1 starts, left control fires
+static int glfw_key(int code)
+{
+    switch(code)
+    {
+        case KEY_LEFT:     return GLFW_KEY_LEFT;
+        case KEY_RIGHT:    return GLFW_KEY_RIGHT;
+        case KEY_SPACE:
+        case KEY_LEFTCTRL: return GLFW_KEY_SPACE;
+        case KEY_ENTER:
+        case KEY_KPENTER:
+        case KEY_1:        return GLFW_KEY_ENTER;
+        case KEY_ESC:      return GLFW_KEY_ESCAPE;
+        case KEY_P:        return GLFW_KEY_P;
+        case KEY_F2:       return GLFW_KEY_F2;
+        case KEY_F3:       return GLFW_KEY_F3;
+        case KEY_F4:       return GLFW_KEY_F4;
+        case KEY_F5:       return GLFW_KEY_F5;
+        case KEY_F6:       return GLFW_KEY_F6;
+        case KEY_F9:       return GLFW_KEY_F9;
+        case KEY_F12:      return GLFW_KEY_F12;
+        default: break;
+    }
+    return GLFW_KEY_UNKNOWN;
+}
+
+static bool has_key(const uint8_t* keys, int key)
+{
+    return keys[key / 8] & (1 << (key % 8));
+}
+
+static double monotonic_seconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Keeps the node if it has the keys the game is played with
+static void open_device(EvdevInput* evdev, int node)
+{
+    if(evdev->num_devices == EVDEV_MAX_DEVICES) return;
+    for(size_t i = 0; i < evdev->num_devices; ++i)
+    {
+        if(evdev->nodes[i] == node) return;
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/input/event%d", node);
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0) return;
+
+    uint8_t keys[KEY_MAX / 8 + 1] = {};
+    if(ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0 ||
+       !(has_key(keys, KEY_SPACE) || has_key(keys, KEY_LEFTCTRL)))
+    {
+        close(fd);
+        return;
+    }
+    // Timestamps on the clock glfwGetTime() runs on, not the wall clock
+    int clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+    if(evdev->grab) ioctl(fd, EVIOCGRAB, 1);
+    evdev->devices[evdev->num_devices] = fd;
+    evdev->nodes[evdev->num_devices] = node;
+    ++evdev->num_devices;
+}
+
+static void close_device(EvdevInput* evdev, size_t index)
+{
+    close(evdev->devices[index]);
+    --evdev->num_devices;
+    evdev->devices[index] = evdev->devices[evdev->num_devices];
+    evdev->nodes[index] = evdev->nodes[evdev->num_devices];
+}
+
+static void push_key(EvdevInput* evdev, const EvdevKey& key)
+{
+    size_t tail = evdev->tail.load(std::memory_order_relaxed);
+    if(tail - evdev->head.load(std::memory_order_acquire) == EVDEV_QUEUE_CAPACITY)
+    {
+        ++evdev->dropped;
+        return;
+    }
+    evdev->keys[tail % EVDEV_QUEUE_CAPACITY] = key;
+    evdev->tail.store(tail + 1, std::memory_order_release);
+}
+
+// False once the device is gone
+static bool read_device(EvdevInput* evdev, int fd)
+{
+    input_event events[32];
+    ssize_t bytes;
+    bool pushed = false;
+    while((bytes = read(fd, events, sizeof(events))) > 0)
+    {
+        // Both clocks are read together, so the offset between them holds
+        // to well under a millisecond
+        double offset = glfwGetTime() - monotonic_seconds();
+        for(size_t i = 0; i < (size_t)bytes / sizeof(input_event); ++i)
+        {
+            const input_event& event = events[i];
+            if(event.type != EV_KEY) continue;
+            int key = glfw_key(event.code);
+            if(key == GLFW_KEY_UNKNOWN) continue;
+
+            double time = (double)event.input_event_sec + (double)event.input_event_usec * 1e-6 + offset;
+            int action = event.value == 0 ? GLFW_RELEASE : event.value == 2 ? GLFW_REPEAT : GLFW_PRESS;
+            push_key(evdev, EvdevKey{time, key, action});
+            pushed = true;
+        }
+    }
+    if(pushed)
+    {
+        // The lock only orders this against wait_evdev_input()'s check
+        { std::lock_guard<std::mutex> lock(evdev->mutex); }
+        evdev->arrived.notify_one();
+        glfwPostEmptyEvent();
+    }
+    return bytes == 0 || errno == EAGAIN;
+}
+
+static void read_hotplug(EvdevInput* evdev)
+{
+    alignas(inotify_event) char buffer[16384];
+    ssize_t bytes = read(evdev->inotify_fd, buffer, sizeof(buffer));
+    for(ssize_t offset = 0; offset < bytes;)
+    {
+        const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        // IN_ATTRIB follows IN_CREATE once udev has set the permissions
+        if((event->mask & (IN_CREATE | IN_ATTRIB)) && event->len && !strncmp(event->name, "event", 5))
+        {
+            open_device(evdev, atoi(event->name + 5));
+        }
+        offset += sizeof(inotify_event) + event->len;
+    }
+}
+
+static void evdev_thread_main(EvdevInput* evdev)
+{
+    enter_thread_role(THREAD_INPUT);
+    for(;;)
+    {
+        pollfd fds[EVDEV_MAX_DEVICES + 2];
+        fds[0] = {evdev->wake_fd, POLLIN, 0};
+        fds[1] = {evdev->inotify_fd, POLLIN, 0};
+        for(size_t i = 0; i < evdev->num_devices; ++i) fds[i + 2] = {evdev->devices[i], POLLIN, 0};
+        size_t num_devices = evdev->num_devices;
+        if(poll(fds, num_devices + 2, -1) < 0 && errno != EINTR) return;
+
+        if(fds[0].revents) return;
+        for(size_t i = num_devices; i-- > 0;)
+        {
+            if(!fds[i + 2].revents) continue;
+            if((fds[i + 2].revents & (POLLERR | POLLHUP)) || !read_device(evdev, evdev->devices[i])) close_device(evdev, i);
+        }
+        if(fds[1].revents) read_hotplug(evdev);
+    }
+}
+
+EvdevInput* start_evdev_input(bool grab)
+{
+    EvdevInput* evdev = new EvdevInput{};
+    evdev->grab = grab;
+    evdev->head = 0;
+    evdev->tail = 0;
+    evdev->wake_fd = eventfd(0, EFD_CLOEXEC);
+    evdev->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(evdev->wake_fd < 0 || evdev->inotify_fd < 0)
+    {
+        fprintf(stderr, "Could not set up evdev input.\n");
+        stop_evdev_input(evdev);
+        return 0;
+    }
+    inotify_add_watch(evdev->inotify_fd, "/dev/input", IN_CREATE | IN_ATTRIB);
+
+    for(int node = 0; node < EVDEV_MAX_NODES; ++node) open_device(evdev, node);
+    printf("Evdev input: %zu keyboard%s\n", evdev->num_devices, evdev->num_devices == 1 ? "" : "s");
+    if(!evdev->num_devices) fprintf(stderr, "No readable keyboard yet, is the user in the input group?\n");
+
+    evdev->thread = std::thread(evdev_thread_main, evdev);
+    return evdev;
+}
+
+void stop_evdev_input(EvdevInput* evdev)
+{
+    if(evdev->thread.joinable())
+    {
+        uint64_t one = 1;
+        if(write(evdev->wake_fd, &one, sizeof(one)) < 0) perror("evdev wake");
+        evdev->thread.join();
+    }
+    for(size_t i = 0; i < evdev->num_devices; ++i)
+    {
+        if(evdev->grab) ioctl(evdev->devices[i], EVIOCGRAB, 0);
+        close(evdev->devices[i]);
+    }
+    if(evdev->inotify_fd >= 0) close(evdev->inotify_fd);
+    if(evdev->wake_fd >= 0) close(evdev->wake_fd);
+    if(evdev->dropped) fprintf(stderr, "Evdev input dropped %zu keys.\n", evdev->dropped);
+    delete evdev;
+}
+
+void pump_evdev_input(EvdevInput* evdev)
+{
+    size_t head = evdev->head.load(std::memory_order_relaxed);
+    size_t tail = evdev->tail.load(std::memory_order_acquire);
+    for(; head != tail; ++head)
+    {
+        const EvdevKey& key = evdev->keys[head % EVDEV_QUEUE_CAPACITY];
+        handle_key(key.key, key.action, key.time);
+    }
+    evdev->head.store(head, std::memory_order_release);
+}
+
+void wait_evdev_input(EvdevInput* evdev, double timeout)
+{
+    std::unique_lock<std::mutex> lock(evdev->mutex);
+    auto ready = [evdev]
+    {
+        return evdev->head.load(std::memory_order_relaxed) != evdev->tail.load(std::memory_order_acquire);
+    };
+    if(timeout < 0.0) evdev->arrived.wait(lock, ready);
+    else evdev->arrived.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+}
+
+#else
+
+struct EvdevInput {};
+
+EvdevInput* start_evdev_input(bool)
+{
+    fprintf(stderr, "Evdev input is Linux only.\n");
+    return 0;
+}
+
+void stop_evdev_input(EvdevInput* evdev) { delete evdev; }
+void pump_evdev_input(EvdevInput*) {}
+void wait_evdev_input(EvdevInput*, double) {}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef EVDEV_INPUT_H
+#define EVDEV_INPUT_H
+
+/*
+    Raw evdev keyboard input for cabinets. A thread of its own blocks in
+    poll() on every /dev/input/event* node with game keys, plus an inotify
+    watch on /dev/input for keyboards plugged in later, the way GLFW finds
+    joysticks. Key events keep the kernel's CLOCK_MONOTONIC timestamp,
+    moved onto glfwGetTime()'s clock, and wait in a single-producer,
+    single-consumer ring of their own. No display server sits in between.
+
+    The frame loop moves them on when it pumps events: gameplay keys into
+    the input queue with their kernel time, the rest through handle_key().
+    The input queue keeps its one producer that way, and the ticks drain
+    it right after the pump all the same. While evdev runs, GLFW's own key
+    events are ignored, they would be the same presses again. Linux only;
+    start_evdev_input() returns 0 anywhere else.
+*/
+
+#include <cstddef>
+
+struct EvdevInput;
+
+// 'grab' keeps the keys from reaching anything else, like the console
+// under a KMS kiosk
+EvdevInput* start_evdev_input(bool grab);
+void stop_evdev_input(EvdevInput* evdev);
+
+// Hands everything read so far to the game, on the frame loop's thread
+void pump_evdev_input(EvdevInput* evdev);
+
+// Blocks until a key arrives or 'timeout' seconds pass, negative to wait
+// for good. For the idle wait where GLFW has no events to wait on.
+void wait_evdev_input(EvdevInput* evdev, double timeout);
+
+#endif
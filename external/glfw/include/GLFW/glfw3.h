@@ -5991,6 +5991,38 @@ GLFWAPI const char* glfwGetClipboardString(GLFWwindow* window);
  */
 GLFWAPI double glfwGetTime(void);
 
+/*! @brief Returns the GLFW time of the key event being reported.
+ *
+ *  This function returns when the key event currently being reported to the
+ *  [key callback](@ref input_key) happened, in seconds on the same clock as
+ *  @ref glfwGetTime.  Called outside the key callback it returns the time of
+ *  the last key event.
+ *
+ *  Where the platform stamps key events, the time is taken from that stamp,
+ *  so it does not depend on how late the events are processed.  Events
+ *  without a usable stamp report the time they were processed at.
+ *
+ *  @return The time of the key event, in seconds, or zero if an
+ *  [error](@ref error_handling) occurred.
+ *
+ *  @errors Possible errors include @ref GLFW_NOT_INITIALIZED.
+ *
+ *  @remark @x11 @wayland Key events are stamped in milliseconds, on the
+ *  monotonic clock for any local X server and most compositors.  Stamps from
+ *  another clock, like a remote X server's, are ignored.
+ *
+ *  @remark @win32 Key events are stamped by `GetMessageTime`, with the
+ *  resolution of the system tick.
+ *
+ *  @thread_safety This function must only be called from the main thread.
+ *
+ *  @sa @ref time
+ *  @sa @ref glfwGetTime
+ *
+ *  @ingroup input
+ */
+GLFWAPI double glfwGetKeyEventTime(void);
+
 /*! @brief Sets the GLFW time.
  *
  *  This function sets the current GLFW time, in seconds.  The value must be
@@ -267,6 +267,19 @@ static GLFWbool parseMapping(_GLFWmapping* mapping, const char* string)
 //////                         GLFW event API                       //////
 //////////////////////////////////////////////////////////////////////////
 
+// Notifies shared code how many milliseconds ago, by the platform's event
+// stamps, the key event reported next happened
+//
+void _glfwInputKeyEventAge(uint32_t age)
+{
+    // A stamp this old is from another clock, like a remote X server's
+    if (age > _GLFW_KEY_EVENT_MAX_AGE)
+        age = 0;
+
+    _glfw.keyEvent.time = glfwGetTime() - age / 1000.0;
+    _glfw.keyEvent.stamped = GLFW_TRUE;
+}
+
 // Notifies shared code of a physical key event
 //
 void _glfwInputKey(_GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -277,6 +290,10 @@ void _glfwInputKey(_GLFWwindow* window, int key, int scancode, int action, int m
     assert(action == GLFW_PRESS || action == GLFW_RELEASE);
     assert(mods == (mods & GLFW_MOD_MASK));
 
+    if (!_glfw.keyEvent.stamped)
+        _glfw.keyEvent.time = glfwGetTime();
+    _glfw.keyEvent.stamped = GLFW_FALSE;
+
     if (key >= 0 && key <= GLFW_KEY_LAST)
     {
         GLFWbool repeated = GLFW_FALSE;
@@ -1477,6 +1494,12 @@ GLFWAPI double glfwGetTime(void)
         _glfwPlatformGetTimerFrequency();
 }
 
+GLFWAPI double glfwGetKeyEventTime(void)
+{
+    _GLFW_REQUIRE_INIT_OR_RETURN(0.0);
+    return _glfw.keyEvent.time;
+}
+
 GLFWAPI void glfwSetTime(double time)
 {
     _GLFW_REQUIRE_INIT();
@@ -58,6 +58,9 @@
 
 #define _GLFW_MESSAGE_SIZE      1024
 
+// Key event stamps older than this many milliseconds are not trusted
+#define _GLFW_KEY_EVENT_MAX_AGE 10000
+
 typedef int GLFWbool;
 typedef void (*GLFWproc)(void);
 
@@ -790,6 +793,12 @@ struct _GLFWlibrary
         GLFW_PLATFORM_LIBRARY_TIMER_STATE
     } timer;
 
+    struct {
+        double          time;
+        // Set by _glfwInputKeyEventAge for the next _glfwInputKey
+        GLFWbool        stamped;
+    } keyEvent;
+
     struct {
         EGLenum         platform;
         EGLDisplay      display;
@@ -917,6 +926,7 @@ void _glfwInputWindowDamage(_GLFWwindow* window);
 void _glfwInputWindowCloseRequest(_GLFWwindow* window);
 void _glfwInputWindowMonitor(_GLFWwindow* window, _GLFWmonitor* monitor);
 
+void _glfwInputKeyEventAge(uint32_t age);
 void _glfwInputKey(_GLFWwindow* window,
                    int key, int scancode, int action, int mods);
 void _glfwInputChar(_GLFWwindow* window,
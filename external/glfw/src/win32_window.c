@@ -779,6 +779,9 @@ static LRESULT CALLBACK windowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
                 break;
             }
 
+            // Both are tick counts, so the difference survives wrap-around
+            _glfwInputKeyEventAge((uint32_t) (GetTickCount() - (DWORD) GetMessageTime()));
+
             if (action == GLFW_RELEASE && wParam == VK_SHIFT)
             {
                 // HACK: Release both Shift keys on Shift up event, as when both
@@ -40,6 +40,7 @@
 #include <sys/mman.h>
 #include <sys/timerfd.h>
 #include <poll.h>
+#include <time.h>
 #include <linux/input-event-codes.h>
 
 #include "wayland-client-protocol.h"
@@ -1801,6 +1802,11 @@ static void keyboardHandleKey(void* userData,
 
     timerfd_settime(_glfw.wl.keyRepeatTimerfd, 0, &timer, NULL);
 
+    // Compositors stamp key events with the monotonic clock in practice,
+    // though the protocol leaves the base undefined
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    _glfwInputKeyEventAge((uint32_t) now.tv_sec * 1000 + (uint32_t) (now.tv_nsec / 1000000) - time);
     _glfwInputKey(window, key, scancode, action, _glfw.wl.xkb.modifiers);
 
     if (action == GLFW_PRESS)
@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 #include <assert.h>
 
 // Action for EWMH client messages
@@ -211,6 +212,17 @@ static Bool isSelPropNewValueNotify(Display* display, XEvent* event, XPointer po
            event->xproperty.atom == notification->xselection.property;
 }
 
+// Returns how many milliseconds ago the server stamped an event, assuming
+// the server's clock is the local monotonic one, as it is for Xorg
+//
+static uint32_t getEventAge(Time time)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    const uint32_t now = (uint32_t) ts.tv_sec * 1000 + (uint32_t) (ts.tv_nsec / 1000000);
+    return now - (uint32_t) time;
+}
+
 // Translates an X event modifier state mask
 //
 static int translateState(int state)
@@ -1246,6 +1258,8 @@ static void processEvent(XEvent *event)
             const int mods = translateState(event->xkey.state);
             const int plain = !(mods & (GLFW_MOD_CONTROL | GLFW_MOD_ALT));
 
+            _glfwInputKeyEventAge(getEventAge(event->xkey.time));
+
             if (window->x11.ic)
             {
                 // HACK: Do not report the key press events duplicated by XIM
@@ -1349,6 +1363,7 @@ static void processEvent(XEvent *event)
                 }
             }
 
+            _glfwInputKeyEventAge(getEventAge(event->xkey.time));
             _glfwInputKey(window, key, keycode, GLFW_RELEASE, mods);
             return;
         }
@@ -0,0 +1,117 @@
+#include <cstring>
+#include "font.h"
+
+#define N GLYPH_NONE
+const uint8_t ascii_glyphs[128] = {
+    N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,
+    N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,  N,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+    64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79,
+    80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, N
+};
+#undef N
+
+void set_font_sheet(Font* font, const Sprite& sheet)
+{
+    font->sheet = sheet;
+    for(size_t gi = 0; gi < FONT_NUM_GLYPHS; ++gi)
+    {
+        uint64_t ink = 0;
+        for(size_t yi = 0; yi < sheet.height; ++yi) ink |= sprite_row(sheet, gi * sheet.height + yi);
+
+        GlyphMetrics& metrics = font->metrics[gi];
+        if(!ink)
+        {
+            metrics.left = 0;
+            metrics.advance = FONT_SPACE_ADVANCE;
+            continue;
+        }
+        unsigned left = count_trailing_zeros(ink);
+        metrics.left = (uint8_t)left;
+        metrics.advance = (uint8_t)(highest_set_bit(ink) - left + 2);
+    }
+}
+
+uint32_t decode_utf8(const char* text, size_t length, size_t* offset)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text) + *offset;
+    size_t available = length - *offset;
+    uint8_t lead = bytes[0];
+
+    if(lead < 0x80)
+    {
+        *offset += 1;
+        return lead;
+    }
+    size_t size = 0;
+    if((lead & 0xE0) == 0xC0) size = 2;
+    else if((lead & 0xF0) == 0xE0) size = 3;
+    else if((lead & 0xF8) == 0xF0) size = 4;
+    // The shortest code point each length may encode
+    static const uint32_t smallest[5] = {0, 0, 0x80, 0x800, 0x10000};
+
+    uint32_t code_point = lead & (0x7F >> size);
+    bool valid = size && size <= available;
+    for(size_t bi = 1; valid && bi < size; ++bi)
+    {
+        valid = (bytes[bi] & 0xC0) == 0x80;
+        code_point = code_point << 6 | (bytes[bi] & 0x3F);
+    }
+    // Overlong forms, surrogates and what lies past U+10FFFF are malformed too
+    if(valid && (code_point < smallest[size] || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point < 0xE000))) valid = false;
+    if(!valid)
+    {
+        *offset += 1;
+        return UTF8_REPLACEMENT;
+    }
+    *offset += size;
+    return code_point;
+}
+
+size_t decode_glyphs(const char* text, size_t length, size_t* offset, uint8_t* glyphs, size_t max_glyphs)
+{
+    size_t count = 0;
+    size_t i = *offset;
+    while(i < length && count < max_glyphs)
+    {
+        if(length - i >= 8 && max_glyphs - count >= 8)
+        {
+            uint64_t word;
+            memcpy(&word, text + i, sizeof(word));
+            if(!(word & 0x8080808080808080ull))
+            {
+                // Every frame is stored and only those that exist are
+                // counted, so the eight bytes don't branch
+                for(size_t bi = 0; bi < 8; ++bi)
+                {
+                    uint8_t glyph = ascii_glyphs[(uint8_t)text[i + bi]];
+                    glyphs[count] = glyph;
+                    count += glyph != GLYPH_NONE;
+                }
+                i += 8;
+                continue;
+            }
+        }
+
+        uint8_t glyph;
+        if((uint8_t)text[i] < 0x80) glyph = ascii_glyphs[(uint8_t)text[i++]];
+        else glyph = code_point_glyph(decode_utf8(text, length, &i));
+        if(glyph != GLYPH_NONE) glyphs[count++] = glyph;
+    }
+    *offset = i;
+    return count;
+}
+
+size_t layout_glyphs(const Font& font, const uint8_t* glyphs, size_t count, uint16_t* pens)
+{
+    size_t pen = 0;
+    for(size_t gi = 0; gi < count; ++gi)
+    {
+        pens[gi] = (uint16_t)pen;
+        pen += font.metrics[glyphs[gi]].advance;
+    }
+    return pen;
+}
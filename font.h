@@ -0,0 +1,68 @@
+#ifndef FONT_H
+#define FONT_H
+
+/*
+    Fonts. A font sheet holds FONT_NUM_GLYPHS 5x7 frames: printable ASCII
+    from ' ' to '~', then Latin-1 from U+00A0 to U+00FF, so a code point
+    finds its frame with a subtraction. Text is UTF-8; control characters,
+    code points past U+00FF and malformed sequences draw nothing, as
+    characters off the sheet always did.
+
+    decode_glyphs() takes eight bytes at a time while none of them has its
+    top bit set, one load and one mask, and maps them through a table of
+    the ASCII frames; only a byte at or above 0x80 falls back to decoding
+    a sequence. ASCII strings never leave the fast path.
+
+    Glyphs are proportional. When a sheet is set, the ink columns of each
+    glyph are measured once into its GlyphMetrics: it is drawn 'left'
+    columns left of the pen, so its ink starts at the pen, and moves the
+    pen on by 'advance', the ink's width and a column of space. Glyphs
+    without ink, the spaces, advance FONT_SPACE_ADVANCE. Laying out a run
+    is then a table lookup per glyph.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "game.h"
+
+#define FONT_SPACE_ADVANCE 4
+// What malformed UTF-8 decodes to; the font has no glyph for it
+#define UTF8_REPLACEMENT 0xFFFD
+
+struct GlyphMetrics
+{
+    uint8_t left;
+    uint8_t advance;
+};
+
+struct Font
+{
+    Sprite sheet;
+    GlyphMetrics metrics[FONT_NUM_GLYPHS];
+};
+
+// Frame of each ASCII byte, GLYPH_NONE for control characters
+extern const uint8_t ascii_glyphs[128];
+
+inline uint8_t code_point_glyph(uint32_t code_point)
+{
+    if(code_point < 128) return ascii_glyphs[code_point];
+    if(code_point - FONT_LATIN1_FIRST < FONT_LATIN1_GLYPHS) return (uint8_t)(FONT_ASCII_GLYPHS + code_point - FONT_LATIN1_FIRST);
+    return GLYPH_NONE;
+}
+
+// Points 'font' at 'sheet', FONT_NUM_GLYPHS frames tall, and measures it
+void set_font_sheet(Font* font, const Sprite& sheet);
+
+// The code point at text[*offset], moving *offset past its sequence, or
+// past one byte and UTF8_REPLACEMENT when it is malformed
+uint32_t decode_utf8(const char* text, size_t length, size_t* offset);
+// Frames of the characters from text[*offset] on, at most 'max_glyphs'
+// and leaving out those without one. *offset moves past what was decoded,
+// to 'length' unless the glyphs ran out first.
+size_t decode_glyphs(const char* text, size_t length, size_t* offset, uint8_t* glyphs, size_t max_glyphs);
+// Where each glyph's ink starts, relative to the first pen position;
+// returns how far the run moves the pen
+size_t layout_glyphs(const Font& font, const uint8_t* glyphs, size_t count, uint16_t* pens);
+
+#endif
@@ -0,0 +1,2334 @@
+#include <cstdio>
+#include <cstring>
+#include "game.h"
+#include "font.h"
+#include "pages.h"
+
+#if defined(HAVE_X86_SIMD)
+bool cpu_has_avx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if(!osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+/*
+################################################
+##                  ARENAS                    ##
+################################################
+*/
+
+static ArenaBlock* new_arena_block(size_t size)
+{
+    // alloc_pages() aligns for any fundamental type, the header keeps that
+    ArenaBlock* block = (ArenaBlock*)alloc_pages(sizeof(ArenaBlock) + size);
+    block->next = 0;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void init_arena(Arena* arena, size_t block_size)
+{
+    arena->block_size = block_size;
+    arena->blocks = new_arena_block(block_size);
+    arena->used = 0;
+    arena->high_water = 0;
+}
+
+static void free_arena_blocks(ArenaBlock* block)
+{
+    while(block)
+    {
+        ArenaBlock* next = block->next;
+        free_pages(block);
+        block = next;
+    }
+}
+
+void destroy_arena(Arena* arena)
+{
+    free_arena_blocks(arena->blocks);
+    *arena = Arena{};
+}
+
+void* arena_alloc(Arena* arena, size_t size, size_t align)
+{
+    // Aligned by address, as blocks only start at alloc_pages()'s
+    // alignment and a GameState asks for a cache line
+    ArenaBlock* block = arena->blocks;
+    uintptr_t base = (uintptr_t)(block + 1);
+    size_t offset = (size_t)(((base + block->used + align - 1) & ~(uintptr_t)(align - 1)) - base);
+    if(offset + size > block->size)
+    {
+        // Oversized requests get a block of their own
+        size_t wanted = size + align - 1;
+        ArenaBlock* fresh = new_arena_block(wanted > arena->block_size ? wanted : arena->block_size);
+        fresh->next = block;
+        arena->blocks = block = fresh;
+        base = (uintptr_t)(block + 1);
+        offset = (size_t)(((base + align - 1) & ~(uintptr_t)(align - 1)) - base);
+    }
+
+    uint8_t* data = (uint8_t*)base + offset;
+    block->used = offset + size;
+    arena->used += size;
+    if(arena->used > arena->high_water) arena->high_water = arena->used;
+
+    memset(data, 0, size);
+    return data;
+}
+
+/*
+################################################
+##              ENTITY STORAGE                ##
+################################################
+*/
+
+static const size_t component_sizes[NUM_COMPONENTS] = {sizeof(int16_t), sizeof(Fixed), sizeof(Fixed)};
+
+void init_archetype(Archetype* archetype, ComponentMask components, const Sprite* sprite, size_t capacity)
+{
+    *archetype = Archetype{};
+    archetype->components = components;
+    archetype->sprite = sprite;
+    archetype->capacity = capacity ? capacity : 1;
+    for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+    {
+        if(components & COMPONENT_BIT(ci)) archetype->columns[ci] = new uint8_t[archetype->capacity * component_sizes[ci]];
+    }
+    archetype->culled = new uint64_t[(archetype->capacity + 63) / 64]();
+}
+
+void destroy_archetype(Archetype* archetype)
+{
+    for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+    {
+        delete[] static_cast<uint8_t*>(archetype->columns[ci]);
+        archetype->columns[ci] = 0;
+    }
+    delete[] archetype->culled;
+    archetype->culled = 0;
+    archetype->count = 0;
+}
+
+static void grow_archetype(Archetype* archetype, size_t capacity)
+{
+    for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+    {
+        if(!archetype->columns[ci]) continue;
+        uint8_t* column = new uint8_t[capacity * component_sizes[ci]];
+        memcpy(column, archetype->columns[ci], archetype->count * component_sizes[ci]);
+        delete[] static_cast<uint8_t*>(archetype->columns[ci]);
+        archetype->columns[ci] = column;
+    }
+    // The bits only live from a move to the pass after it
+    delete[] archetype->culled;
+    archetype->culled = new uint64_t[(capacity + 63) / 64]();
+    archetype->capacity = capacity;
+}
+
+void copy_archetype(Archetype* dst, const Archetype& src)
+{
+    if(dst->components != src.components)
+    {
+        destroy_archetype(dst);
+        init_archetype(dst, src.components, src.sprite, src.capacity);
+    }
+    dst->count = 0;
+    size_t count = src.count;
+    if(count > dst->capacity)
+    {
+        if(dst->fixed) count = dst->capacity;
+        else grow_archetype(dst, src.capacity);
+    }
+
+    for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+    {
+        if(src.columns[ci]) memcpy(dst->columns[ci], src.columns[ci], count * component_sizes[ci]);
+    }
+    dst->sprite = src.sprite;
+    dst->velocity = src.velocity;
+    dst->count = count;
+    dst->high_water = src.high_water;
+}
+
+// A full archetype doubles rather than dropping the entity, unless its
+// columns are fixed in a state block
+size_t spawn_entity(Archetype* archetype)
+{
+    if(archetype->count == archetype->capacity)
+    {
+        if(archetype->fixed) return SIZE_MAX;
+        grow_archetype(archetype, 2 * archetype->capacity);
+    }
+
+    size_t row = archetype->count++;
+    for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+    {
+        if(archetype->columns[ci]) memset(static_cast<uint8_t*>(archetype->columns[ci]) + row * component_sizes[ci], 0, component_sizes[ci]);
+    }
+    if(archetype->count > archetype->high_water) archetype->high_water = archetype->count;
+    return row;
+}
+
+// Swap-remove: the last entity moves into 'row', which the caller then
+// visits again
+void remove_entity(Archetype* archetype, size_t row)
+{
+    size_t last = --archetype->count;
+    if(row == last) return;
+    for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+    {
+        if(!archetype->columns[ci]) continue;
+        uint8_t* column = static_cast<uint8_t*>(archetype->columns[ci]);
+        memcpy(column + row * component_sizes[ci], column + last * component_sizes[ci], component_sizes[ci]);
+    }
+    uint64_t* word = &archetype->culled[row / 64];
+    *word = (*word & ~(1ull << (row % 64))) | (uint64_t)entity_culled(*archetype, last) << (row % 64);
+}
+
+// The fixed-point sums wrap rather than overflow, as the vector lanes do
+static inline Fixed step_fixed(Fixed y, Fixed velocity)
+{
+    return (Fixed)((uint32_t)y + (uint32_t)velocity);
+}
+
+void move_rows_scalar(Fixed* y, Fixed* prev_y, uint64_t* culled, size_t count, Fixed velocity, Fixed min_y, Fixed max_y)
+{
+    for(size_t base = 0; base < count; base += 64)
+    {
+        size_t end = count - base < 64 ? count : base + 64;
+        uint64_t bits = 0;
+        for(size_t ei = base; ei < end; ++ei)
+        {
+            prev_y[ei] = y[ei];
+            y[ei] = step_fixed(y[ei], velocity);
+            bits |= (uint64_t)(y[ei] < min_y || y[ei] >= max_y) << (ei - base);
+        }
+        culled[base / 64] = bits;
+    }
+}
+
+#if defined(HAVE_X86_SIMD)
+void move_rows_sse2(Fixed* y, Fixed* prev_y, uint64_t* culled, size_t count, Fixed velocity, Fixed min_y, Fixed max_y)
+{
+    __m128i step = _mm_set1_epi32(velocity);
+    __m128i low = _mm_set1_epi32(min_y), high = _mm_set1_epi32(max_y);
+    for(size_t base = 0; base < count; base += 64)
+    {
+        size_t end = count - base < 64 ? count : base + 64;
+        uint64_t bits = 0;
+        size_t ei = base;
+        for(; ei + 4 <= end; ei += 4)
+        {
+            __m128i from = _mm_loadu_si128((const __m128i*)(y + ei));
+            __m128i to = _mm_add_epi32(from, step);
+            _mm_storeu_si128((__m128i*)(prev_y + ei), from);
+            _mm_storeu_si128((__m128i*)(y + ei), to);
+            // Below min_y, or not below max_y
+            __m128i out = _mm_or_si128(_mm_cmplt_epi32(to, low), _mm_cmpeq_epi32(_mm_cmplt_epi32(to, high), _mm_setzero_si128()));
+            bits |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(out)) << (ei - base);
+        }
+        for(; ei < end; ++ei)
+        {
+            prev_y[ei] = y[ei];
+            y[ei] = step_fixed(y[ei], velocity);
+            bits |= (uint64_t)(y[ei] < min_y || y[ei] >= max_y) << (ei - base);
+        }
+        culled[base / 64] = bits;
+    }
+}
+
+TARGET_AVX2 void move_rows_avx2(Fixed* y, Fixed* prev_y, uint64_t* culled, size_t count, Fixed velocity, Fixed min_y, Fixed max_y)
+{
+    __m256i step = _mm256_set1_epi32(velocity);
+    __m256i low = _mm256_set1_epi32(min_y), high = _mm256_set1_epi32(max_y);
+    for(size_t base = 0; base < count; base += 64)
+    {
+        size_t end = count - base < 64 ? count : base + 64;
+        uint64_t bits = 0;
+        size_t ei = base;
+        for(; ei + 8 <= end; ei += 8)
+        {
+            __m256i from = _mm256_loadu_si256((const __m256i*)(y + ei));
+            __m256i to = _mm256_add_epi32(from, step);
+            _mm256_storeu_si256((__m256i*)(prev_y + ei), from);
+            _mm256_storeu_si256((__m256i*)(y + ei), to);
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(low, to), _mm256_xor_si256(_mm256_cmpgt_epi32(high, to), _mm256_set1_epi32(-1)));
+            bits |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(out)) << (ei - base);
+        }
+        for(; ei < end; ++ei)
+        {
+            prev_y[ei] = y[ei];
+            y[ei] = step_fixed(y[ei], velocity);
+            bits |= (uint64_t)(y[ei] < min_y || y[ei] >= max_y) << (ei - base);
+        }
+        culled[base / 64] = bits;
+    }
+}
+#endif
+
+#if defined(HAVE_NEON_SIMD)
+void move_rows_neon(Fixed* y, Fixed* prev_y, uint64_t* culled, size_t count, Fixed velocity, Fixed min_y, Fixed max_y)
+{
+    const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    uint32x4_t lanes = vld1q_u32(lane_bits);
+    int32x4_t step = vdupq_n_s32(velocity);
+    int32x4_t low = vdupq_n_s32(min_y), high = vdupq_n_s32(max_y);
+    for(size_t base = 0; base < count; base += 64)
+    {
+        size_t end = count - base < 64 ? count : base + 64;
+        uint64_t bits = 0;
+        size_t ei = base;
+        for(; ei + 4 <= end; ei += 4)
+        {
+            int32x4_t from = vld1q_s32(y + ei);
+            int32x4_t to = vaddq_s32(from, step);
+            vst1q_s32(prev_y + ei, from);
+            vst1q_s32(y + ei, to);
+            uint32x4_t out = vandq_u32(vorrq_u32(vcltq_s32(to, low), vcgeq_s32(to, high)), lanes);
+            uint32x2_t pair = vorr_u32(vget_low_u32(out), vget_high_u32(out));
+            bits |= (uint64_t)(vget_lane_u32(pair, 0) | vget_lane_u32(pair, 1)) << (ei - base);
+        }
+        for(; ei < end; ++ei)
+        {
+            prev_y[ei] = y[ei];
+            y[ei] = step_fixed(y[ei], velocity);
+            bits |= (uint64_t)(y[ei] < min_y || y[ei] >= max_y) << (ei - base);
+        }
+        culled[base / 64] = bits;
+    }
+}
+#endif
+
+void (*move_rows)(Fixed* y, Fixed* prev_y, uint64_t* culled, size_t count, Fixed velocity, Fixed min_y, Fixed max_y) = move_rows_scalar;
+const char* move_kernel_name = "scalar";
+
+void init_move_kernels()
+{
+#if defined(HAVE_X86_SIMD)
+    move_rows = move_rows_sse2;
+    move_kernel_name = "sse2";
+    if(cpu_has_avx2())
+    {
+        move_rows = move_rows_avx2;
+        move_kernel_name = "avx2";
+    }
+#elif defined(HAVE_NEON_SIMD)
+    move_rows = move_rows_neon;
+    move_kernel_name = "neon";
+#endif
+}
+
+void move_entities(Archetype* archetype, Fixed min_y, Fixed max_y)
+{
+    Fixed* y = archetype_column<Fixed>(*archetype, COMPONENT_Y);
+    Fixed* prev_y = archetype_column<Fixed>(*archetype, COMPONENT_PREV_Y);
+    move_rows(y, prev_y, archetype->culled, archetype->count, archetype->velocity, min_y, max_y);
+}
+
+size_t spawn_projectile(Archetype* projectiles, size_t x, size_t y)
+{
+    size_t row = spawn_entity(projectiles);
+    if(row == SIZE_MAX) return row;
+    archetype_column<int16_t>(*projectiles, COMPONENT_X)[row] = (int16_t)x;
+    archetype_column<Fixed>(*projectiles, COMPONENT_Y)[row] = to_fixed(y);
+    archetype_column<Fixed>(*projectiles, COMPONENT_PREV_Y)[row] = to_fixed(y);
+    return row;
+}
+
+void print_projectile_stats(const Game& game)
+{
+    static const char* owner_names[NUM_PROJECTILE_OWNERS] = {"player", "enemy"};
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        const Archetype& projectiles = game.projectiles[oi];
+        printf("Projectiles (%s): high water %zu, capacity %zu\n", owner_names[oi], projectiles.high_water, projectiles.capacity);
+    }
+}
+
+void init_alien_arrays(AlienArrays* aliens, Arena* arena, size_t count)
+{
+    aliens->x = arena_array<Fixed>(arena, count);
+    aliens->y = arena_array<Fixed>(arena, count);
+    aliens->type = arena_array<uint8_t>(arena, count);
+    aliens->hp = arena_array<int>(arena, count);
+    aliens->num_words = (count + 63) / 64;
+    aliens->live = arena_array<uint64_t>(arena, aliens->num_words);
+    aliens->num_live = 0;
+}
+
+void copy_alien_arrays(AlienArrays* dst, const AlienArrays& src, size_t count)
+{
+    memcpy(dst->x, src.x, count * sizeof(Fixed));
+    memcpy(dst->y, src.y, count * sizeof(Fixed));
+    memcpy(dst->type, src.type, count * sizeof(uint8_t));
+    memcpy(dst->hp, src.hp, count * sizeof(int));
+    memcpy(dst->live, src.live, src.num_words * sizeof(uint64_t));
+    dst->num_live = src.num_live;
+}
+
+// Rebuild the live set from the alien types
+void reset_alien_live_set(AlienArrays* aliens, size_t count)
+{
+    memset(aliens->live, 0, aliens->num_words * sizeof(uint64_t));
+    aliens->num_live = 0;
+    for(size_t ai = 0; ai < count; ++ai)
+    {
+        if(aliens->type[ai] == ALIEN_DEAD) continue;
+        aliens->live[ai / 64] |= 1ull << (ai % 64);
+        ++aliens->num_live;
+    }
+}
+
+void kill_alien(AlienArrays* aliens, size_t ai)
+{
+    if(!alien_is_live(*aliens, ai)) return;
+
+    aliens->type[ai] = ALIEN_DEAD;
+    aliens->live[ai / 64] &= ~(1ull << (ai % 64));
+    --aliens->num_live;
+}
+
+/*
+################################################
+##                 COLLISION                  ##
+################################################
+*/
+
+bool sprite_overlap_check(
+    const Sprite& sp_a, size_t x_a, size_t y_a,
+    const Sprite& sp_b, size_t x_b, size_t y_b
+)
+{
+    if(x_a < x_b + sp_b.width && x_a + sp_a.width > x_b &&
+       y_a < y_b + sp_b.height && y_a + sp_a.height > y_b)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+// Exact test: boxes first, then the overlapping rows of both masks are
+// shifted to a common left edge and ANDed
+bool sprite_pixel_overlap_check(
+    const Sprite& sp_a, size_t x_a, size_t y_a,
+    const Sprite& sp_b, size_t x_b, size_t y_b
+)
+{
+    if(!sprite_overlap_check(sp_a, x_a, y_a, sp_b, x_b, y_b)) return false;
+
+    // Within the overlap the offset is below either width, so at most 63
+    size_t shift_a = x_a > x_b ? x_a - x_b : 0;
+    size_t shift_b = x_b > x_a ? x_b - x_a : 0;
+    size_t y0 = y_a > y_b ? y_a : y_b;
+    size_t y1 = y_a + sp_a.height < y_b + sp_b.height ? y_a + sp_a.height : y_b + sp_b.height;
+    for(size_t y = y0; y < y1; ++y)
+    {
+        uint64_t row_a = sprite_row(sp_a, y - y_a) << shift_a;
+        uint64_t row_b = sprite_row(sp_b, y - y_b) << shift_b;
+        if(row_a & row_b) return true;
+    }
+
+    return false;
+}
+
+// Distance travelled from y_from at first contact, or SWEEP_MISS
+size_t sprite_sweep_distance(
+    const Sprite& mover, size_t x, size_t y_from, size_t y_to,
+    const Sprite& target, size_t x_t, size_t y_t
+)
+{
+    size_t lo = y_from < y_to ? y_from : y_to;
+    size_t hi = y_from < y_to ? y_to : y_from;
+    if(x >= x_t + target.width || x + mover.width <= x_t) return SWEEP_MISS;
+    if(lo >= y_t + target.height || hi + mover.height <= y_t) return SWEEP_MISS;
+
+    size_t first = y_t + 1 > mover.height && y_t + 1 - mover.height > lo ? y_t + 1 - mover.height : lo;
+    size_t last = y_t + target.height - 1 < hi ? y_t + target.height - 1 : hi;
+    if(y_to >= y_from)
+    {
+        for(size_t y = first; y <= last; ++y)
+        {
+            if(sprite_pixel_overlap_check(mover, x, y, target, x_t, y_t)) return y - y_from;
+        }
+    }
+    else
+    {
+        for(size_t y = last + 1; y-- > first;)
+        {
+            if(sprite_pixel_overlap_check(mover, x, y, target, x_t, y_t)) return y_from - y;
+        }
+    }
+
+    return SWEEP_MISS;
+}
+
+void init_spatial_grid(
+    SpatialGrid* grid, ptrdiff_t origin_x, ptrdiff_t origin_y,
+    size_t cell_width, size_t cell_height, size_t columns, size_t rows, size_t max_items
+)
+{
+    grid->origin_x = origin_x;
+    grid->origin_y = origin_y;
+    grid->cell_width = cell_width;
+    grid->cell_height = cell_height;
+    grid->columns = columns;
+    grid->rows = rows;
+    grid->max_items = max_items < GRID_NONE ? max_items : GRID_NONE - 1;
+    grid->max_entries = 4 * grid->max_items < GRID_NONE ? 4 * grid->max_items : GRID_NONE - 1;
+    grid->num_entries = 0;
+    grid->query = 0;
+}
+
+void clear_spatial_grid(SpatialGrid* grid)
+{
+    memset(grid->cells, 0xFF, grid->columns * grid->rows * sizeof(uint16_t));
+    grid->num_entries = 0;
+}
+
+inline size_t grid_cell(ptrdiff_t v, ptrdiff_t origin, size_t size, size_t count)
+{
+    if(v < origin) return 0;
+    size_t cell = (size_t)(v - origin) / size;
+    return cell < count ? cell : count - 1;
+}
+
+// False once the grid is out of entries; the item is then only partly linked
+bool insert_spatial_grid(SpatialGrid* grid, size_t item, ptrdiff_t x, ptrdiff_t y, size_t width, size_t height)
+{
+    if(item >= grid->max_items || !width || !height) return false;
+
+    size_t c0 = grid_cell(x, grid->origin_x, grid->cell_width, grid->columns);
+    size_t c1 = grid_cell(x + (ptrdiff_t)width - 1, grid->origin_x, grid->cell_width, grid->columns);
+    size_t r0 = grid_cell(y, grid->origin_y, grid->cell_height, grid->rows);
+    size_t r1 = grid_cell(y + (ptrdiff_t)height - 1, grid->origin_y, grid->cell_height, grid->rows);
+    for(size_t r = r0; r <= r1; ++r)
+    {
+        for(size_t c = c0; c <= c1; ++c)
+        {
+            if(grid->num_entries == grid->max_entries) return false;
+
+            uint16_t& head = grid->cells[r * grid->columns + c];
+            GridEntry& entry = grid->entries[grid->num_entries];
+            entry.item = (uint16_t)item;
+            entry.next = head;
+            head = (uint16_t)grid->num_entries++;
+        }
+    }
+    return true;
+}
+
+// Collects into grid->results every item sharing a cell with the box. These
+// are candidates only, callers still run their exact test.
+size_t query_spatial_grid(SpatialGrid* grid, ptrdiff_t x, ptrdiff_t y, size_t width, size_t height)
+{
+    if(!width || !height) return 0;
+
+    if(++grid->query == 0)
+    {
+        memset(grid->stamps, 0, grid->max_items * sizeof(uint32_t));
+        grid->query = 1;
+    }
+
+    size_t num_results = 0;
+    size_t c0 = grid_cell(x, grid->origin_x, grid->cell_width, grid->columns);
+    size_t c1 = grid_cell(x + (ptrdiff_t)width - 1, grid->origin_x, grid->cell_width, grid->columns);
+    size_t r0 = grid_cell(y, grid->origin_y, grid->cell_height, grid->rows);
+    size_t r1 = grid_cell(y + (ptrdiff_t)height - 1, grid->origin_y, grid->cell_height, grid->rows);
+    for(size_t r = r0; r <= r1; ++r)
+    {
+        for(size_t c = c0; c <= c1; ++c)
+        {
+            for(uint16_t ei = grid->cells[r * grid->columns + c]; ei != GRID_NONE; ei = grid->entries[ei].next)
+            {
+                uint16_t item = grid->entries[ei].item;
+                if(grid->stamps[item] == grid->query) continue;
+
+                grid->stamps[item] = grid->query;
+                grid->results[num_results++] = item;
+            }
+        }
+    }
+    return num_results;
+}
+
+uint32_t overlap_mask_scalar(const AlienArrays& aliens, const uint16_t* items, size_t count, const OverlapRange& range)
+{
+    uint32_t mask = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        Fixed x = aliens.x[items[i]], y = aliens.y[items[i]];
+        if(x > range.min_x && x < range.max_x && y > range.min_y && y < range.max_y) mask |= 1u << i;
+    }
+    return mask;
+}
+
+#if defined(HAVE_X86_SIMD)
+uint32_t overlap_mask_sse2(const AlienArrays& aliens, const uint16_t* items, size_t count, const OverlapRange& range)
+{
+    // Unused lanes read alien 0 and are masked off at the end
+    uint16_t lanes[ALIEN_BATCH] = {};
+    memcpy(lanes, items, count * sizeof(uint16_t));
+
+    __m128i min_x = _mm_set1_epi32(range.min_x), max_x = _mm_set1_epi32(range.max_x);
+    __m128i min_y = _mm_set1_epi32(range.min_y), max_y = _mm_set1_epi32(range.max_y);
+    uint32_t mask = 0;
+    for(size_t i = 0; i < ALIEN_BATCH; i += 4)
+    {
+        const uint16_t* l = lanes + i;
+        __m128i x = _mm_setr_epi32(aliens.x[l[0]], aliens.x[l[1]], aliens.x[l[2]], aliens.x[l[3]]);
+        __m128i y = _mm_setr_epi32(aliens.y[l[0]], aliens.y[l[1]], aliens.y[l[2]], aliens.y[l[3]]);
+        __m128i in = _mm_and_si128(
+            _mm_and_si128(_mm_cmpgt_epi32(x, min_x), _mm_cmplt_epi32(x, max_x)),
+            _mm_and_si128(_mm_cmpgt_epi32(y, min_y), _mm_cmplt_epi32(y, max_y))
+        );
+        mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(in)) << i;
+    }
+    return mask & ((1u << count) - 1);
+}
+
+TARGET_AVX2 uint32_t overlap_mask_avx2(const AlienArrays& aliens, const uint16_t* items, size_t count, const OverlapRange& range)
+{
+    uint16_t lanes[ALIEN_BATCH] = {};
+    memcpy(lanes, items, count * sizeof(uint16_t));
+
+    __m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)lanes));
+    __m256i x = _mm256_i32gather_epi32((const int*)aliens.x, index, 4);
+    __m256i y = _mm256_i32gather_epi32((const int*)aliens.y, index, 4);
+    // No less-than on AVX2, so the bounds go on the left of it
+    __m256i in = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpgt_epi32(x, _mm256_set1_epi32(range.min_x)), _mm256_cmpgt_epi32(_mm256_set1_epi32(range.max_x), x)),
+        _mm256_and_si256(_mm256_cmpgt_epi32(y, _mm256_set1_epi32(range.min_y)), _mm256_cmpgt_epi32(_mm256_set1_epi32(range.max_y), y))
+    );
+    return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(in)) & ((1u << count) - 1);
+}
+#endif
+
+#if defined(HAVE_NEON_SIMD)
+uint32_t overlap_mask_neon(const AlienArrays& aliens, const uint16_t* items, size_t count, const OverlapRange& range)
+{
+    Fixed xs[ALIEN_BATCH] = {}, ys[ALIEN_BATCH] = {};
+    for(size_t i = 0; i < count; ++i)
+    {
+        xs[i] = aliens.x[items[i]];
+        ys[i] = aliens.y[items[i]];
+    }
+
+    const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    uint32x4_t bits = vld1q_u32(lane_bits);
+    uint32_t mask = 0;
+    for(size_t i = 0; i < ALIEN_BATCH; i += 4)
+    {
+        int32x4_t x = vld1q_s32(xs + i), y = vld1q_s32(ys + i);
+        uint32x4_t in = vandq_u32(
+            vandq_u32(vcgtq_s32(x, vdupq_n_s32(range.min_x)), vcltq_s32(x, vdupq_n_s32(range.max_x))),
+            vandq_u32(vcgtq_s32(y, vdupq_n_s32(range.min_y)), vcltq_s32(y, vdupq_n_s32(range.max_y)))
+        );
+        uint32x4_t lanes = vandq_u32(in, bits);
+        uint32x2_t pair = vorr_u32(vget_low_u32(lanes), vget_high_u32(lanes));
+        mask |= (vget_lane_u32(pair, 0) | vget_lane_u32(pair, 1)) << i;
+    }
+    return mask & ((1u << count) - 1);
+}
+#endif
+
+uint32_t (*overlap_mask)(const AlienArrays& aliens, const uint16_t* items, size_t count, const OverlapRange& range) = overlap_mask_scalar;
+const char* overlap_kernel_name = "scalar";
+
+void init_overlap_kernels()
+{
+#if defined(HAVE_X86_SIMD)
+    overlap_mask = overlap_mask_sse2;
+    overlap_kernel_name = "sse2";
+    if(cpu_has_avx2())
+    {
+        overlap_mask = overlap_mask_avx2;
+        overlap_kernel_name = "avx2";
+    }
+#elif defined(HAVE_NEON_SIMD)
+    overlap_mask = overlap_mask_neon;
+    overlap_kernel_name = "neon";
+#endif
+}
+
+/*
+################################################
+##                STATE BLOCK                 ##
+################################################
+*/
+
+// Offsets into a block, or only its size while 'base' is null
+struct StateLayout
+{
+    uint8_t* base;
+    size_t size;
+};
+
+static void* layout_bytes(StateLayout* layout, size_t size, size_t align)
+{
+    size_t offset = (layout->size + align - 1) & ~(align - 1);
+    layout->size = offset + size;
+    return layout->base ? layout->base + offset : 0;
+}
+
+template<typename T>
+static T* layout_array(StateLayout* layout, size_t count)
+{
+    return static_cast<T*>(layout_bytes(layout, count * sizeof(T), alignof(T)));
+}
+
+// Points every array at its place in the block, from the sizes the state
+// already holds, so the same sizes always give the same layout
+static void lay_out_state_block(GameState* state, StateLayout* layout)
+{
+    Game& game = state->game;
+    AlienArrays& aliens = game.aliens;
+    aliens.num_words = (game.num_aliens + 63) / 64;
+    aliens.x = layout_array<Fixed>(layout, game.num_aliens);
+    aliens.y = layout_array<Fixed>(layout, game.num_aliens);
+    aliens.type = layout_array<uint8_t>(layout, game.num_aliens);
+    aliens.hp = layout_array<int>(layout, game.num_aliens);
+    aliens.live = layout_array<uint64_t>(layout, aliens.num_words);
+
+    FormationMarch& march = state->march;
+    march.column_live = layout_array<uint16_t>(layout, march.num_columns);
+    march.row_live = layout_array<uint16_t>(layout, march.num_rows);
+    march.column_bottom = layout_array<uint16_t>(layout, march.num_columns);
+
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        Archetype& projectiles = game.projectiles[oi];
+        for(size_t ci = 0; ci < NUM_COMPONENTS; ++ci)
+        {
+            if(!(projectiles.components & COMPONENT_BIT(ci))) continue;
+            projectiles.columns[ci] = layout_bytes(layout, projectiles.capacity * component_sizes[ci], alignof(size_t));
+        }
+        projectiles.culled = layout_array<uint64_t>(layout, (projectiles.capacity + 63) / 64);
+    }
+    state->hits = layout_array<HitEvent>(layout, game.projectiles[PROJECTILE_PLAYER].capacity);
+}
+
+// A shot a tick leaves the screen within height / PROJECTILE_SPEED ticks,
+// on top of which stress keeps its own in flight; bullet hell sets the
+// aliens' count outright
+static void allocate_state_block(GameState* state)
+{
+    Game& game = state->game;
+    game.projectiles[PROJECTILE_PLAYER].capacity = game.height / PROJECTILE_SPEED + 1 + state->stress_shots;
+    game.projectiles[PROJECTILE_ENEMY].capacity = state->bullet_hell ? state->bullet_hell : ENEMY_MAX_SHOTS;
+
+    StateLayout layout = {};
+    lay_out_state_block(state, &layout);
+    free_pages(state->block.data);
+    state->block.data = (uint8_t*)alloc_pages(layout.size);
+    state->block.size = layout.size;
+
+    layout = StateLayout{state->block.data, 0};
+    lay_out_state_block(state, &layout);
+}
+
+void copy_game_state(GameState* dst, uint8_t* block, const GameState& src)
+{
+    *dst = src;
+    memcpy(block, src.block.data, src.block.size);
+    dst->block.data = block;
+    StateLayout layout = {block, 0};
+    lay_out_state_block(dst, &layout);
+}
+
+/*
+################################################
+##                 GAME STATE                 ##
+################################################
+*/
+
+// A full pool drops the new effect; the ones on screen finish first
+void spawn_effect(EffectPool* pool, EffectKind kind, Fixed x, Fixed y)
+{
+    if(pool->count == EFFECT_CAPACITY)
+    {
+        ++pool->dropped;
+        return;
+    }
+    pool->items[pool->count++] = Effect{x, y, effect_lifetimes[kind], kind};
+    ++pool->spawned;
+}
+
+// Age every effect and compact the survivors in place, keeping their order
+void update_effects(EffectPool* pool, double dt)
+{
+    size_t live = 0;
+    for(size_t ei = 0; ei < pool->count; ++ei)
+    {
+        Effect effect = pool->items[ei];
+        effect.remaining -= (float)dt;
+        if(effect.remaining > 0.0f) pool->items[live++] = effect;
+    }
+    pool->count = live;
+}
+
+// Move each clock on and publish the frame it lands on
+void advance_animations(SpriteAnimation* animations, size_t count, double dt)
+{
+    for(size_t i = 0; i < count; ++i)
+    {
+        SpriteAnimation& animation = animations[i];
+        float length = animation.num_frames * animation.frame_duration;
+        animation.time += (float)dt;
+        if(animation.time >= length)
+        {
+            if(animation.loop) animation.time -= length;
+            else animation.time = 0;
+        }
+
+        size_t frame = (size_t)(animation.time / animation.frame_duration);
+        animation.current_frame = frame < animation.num_frames ? frame : 0;
+        animation.current = animation.frames[animation.current_frame];
+    }
+}
+
+// Stress formations span the buffer's width above the player, with the
+// rows squeezed together once they no longer fit at the formation's pitch
+static size_t stress_columns(const GameState& state)
+{
+    size_t columns = (state.game.width - 20 - state.alien_box_width) / FORMATION_PITCH_X + 1;
+    return columns < state.stress_aliens ? columns : state.stress_aliens;
+}
+
+static void lay_out_stress_formation(GameState* state)
+{
+    Game& game = state->game;
+    size_t count = state->stress_aliens;
+    Fixed bottom = to_fixed(state->layout_y + FORMATION_BOTTOM);
+    Fixed height = to_fixed(game.height - 24 - state->alien_box_height) - bottom;
+
+    size_t columns = stress_columns(*state);
+    size_t rows = (count + columns - 1) / columns;
+    Fixed pitch_y = rows > 1 && height / (Fixed)(rows - 1) < to_fixed(FORMATION_PITCH_Y) ? height / (Fixed)(rows - 1) : to_fixed(FORMATION_PITCH_Y);
+
+    FormationMarch& march = state->march;
+    march.num_columns = columns;
+    march.num_rows = rows;
+    march.column_x = to_fixed(10);
+    march.row_y = bottom;
+    march.pitch_x = to_fixed(FORMATION_PITCH_X);
+    march.pitch_y = pitch_y;
+    for(size_t ai = 0; ai < count; ++ai)
+    {
+        game.aliens.x[ai] = to_fixed(10 + ai % columns * FORMATION_PITCH_X);
+        game.aliens.y[ai] = bottom + (Fixed)(ai / columns) * pitch_y;
+        // Mixed types, so kills trickle in instead of a row at a time
+        game.aliens.type[ai] = (uint8_t)(ALIEN_CRAB + ai * 7 % (NUM_ALIEN_TYPES - 1));
+        game.aliens.hp[ai] = alien_types[game.aliens.type[ai]].hp;
+    }
+}
+
+/*
+################################################
+##               FORMATION MARCH              ##
+################################################
+*/
+
+// Steps come faster as the wave thins out, linearly in the live count
+size_t march_period(const FormationMarch& march, size_t num_live)
+{
+    if(march.num_start <= 1) return MARCH_FASTEST_TICKS;
+    return MARCH_FASTEST_TICKS + (MARCH_SLOWEST_TICKS - MARCH_FASTEST_TICKS) * (num_live - 1) / (march.num_start - 1);
+}
+
+// Counts the freshly laid out wave, the only pass over every alien
+static void start_march(GameState* state)
+{
+    FormationMarch& march = state->march;
+    const AlienArrays& aliens = state->game.aliens;
+    memset(march.column_live, 0, march.num_columns * sizeof(uint16_t));
+    memset(march.row_live, 0, march.num_rows * sizeof(uint16_t));
+    for(size_t ci = 0; ci < march.num_columns; ++ci) march.column_bottom[ci] = ROW_NONE;
+    // In index order, so the first alien met in a column is its lowest
+    for(size_t w = 0; w < aliens.num_words; ++w)
+    {
+        for(uint64_t bits = aliens.live[w]; bits; bits &= bits - 1)
+        {
+            size_t ai = w * 64 + count_trailing_zeros(bits);
+            size_t column = ai % march.num_columns, row = ai / march.num_columns;
+            ++march.column_live[column];
+            ++march.row_live[row];
+            if(march.column_bottom[column] == ROW_NONE) march.column_bottom[column] = (uint16_t)row;
+        }
+    }
+
+    march.first_column = 0;
+    march.last_column = march.num_columns - 1;
+    while(march.first_column < march.last_column && !march.column_live[march.first_column]) ++march.first_column;
+    while(march.last_column > march.first_column && !march.column_live[march.last_column]) --march.last_column;
+    march.first_row = 0;
+    while(march.first_row + 1 < march.num_rows && !march.row_live[march.first_row]) ++march.first_row;
+
+    march.offset_x = 0;
+    march.offset_y = 0;
+    march.dir = 1;
+    march.num_start = aliens.num_live;
+    march.ticks_left = march_period(march, aliens.num_live);
+}
+
+// Called after kill_alien(), so 'ai' no longer counts as live
+void march_remove_alien(FormationMarch* march, const AlienArrays& aliens, size_t ai)
+{
+    size_t column = ai % march->num_columns, row = ai / march->num_columns;
+    if(march->column_bottom[column] == row)
+    {
+        size_t above = row + 1;
+        while(above < march->num_rows && !alien_is_live(aliens, above * march->num_columns + column)) ++above;
+        march->column_bottom[column] = above < march->num_rows ? (uint16_t)above : ROW_NONE;
+    }
+    if(!--march->column_live[column])
+    {
+        while(march->first_column < march->last_column && !march->column_live[march->first_column]) ++march->first_column;
+        while(march->last_column > march->first_column && !march->column_live[march->last_column]) --march->last_column;
+    }
+    if(!--march->row_live[row])
+    {
+        while(march->first_row + 1 < march->num_rows && !march->row_live[march->first_row]) ++march->first_row;
+    }
+}
+
+// One step sideways, or at an edge a drop and a turn. The formation
+// stops dropping just above the player.
+void step_march(GameState* state)
+{
+    FormationMarch& march = state->march;
+    const Game& game = state->game;
+    if(!game.aliens.num_live || --march.ticks_left) return;
+    march.ticks_left = march_period(march, game.aliens.num_live);
+
+    Fixed left = march.column_x + (Fixed)march.first_column * march.pitch_x + march.offset_x;
+    Fixed right = march.column_x + (Fixed)march.last_column * march.pitch_x + to_fixed(state->alien_box_width) + march.offset_x;
+    Fixed step = to_fixed(march.dir * MARCH_STEP_X);
+    if(left + step < to_fixed(MARCH_MARGIN) || right + step > to_fixed(game.width - MARCH_MARGIN))
+    {
+        Fixed bottom = march.row_y + (Fixed)march.first_row * march.pitch_y + march.offset_y;
+        Fixed floor = game.player.y + to_fixed(player_sprite.height + MARCH_DROP_Y);
+        if(bottom - to_fixed(MARCH_DROP_Y) >= floor) march.offset_y -= to_fixed(MARCH_DROP_Y);
+        march.dir = -march.dir;
+    }
+    else march.offset_x += step;
+    ++state->formation_version;
+    state->sounds |= 1u << GAME_SOUND_MARCH;
+}
+
+// Looks both ways within the live range
+size_t nearest_firing_column(const FormationMarch& march, size_t column)
+{
+    if(column < march.first_column) column = march.first_column;
+    if(column > march.last_column) column = march.last_column;
+    for(size_t distance = 0;; ++distance)
+    {
+        if(column + distance <= march.last_column && march.column_bottom[column + distance] != ROW_NONE)
+        {
+            return column + distance;
+        }
+        if(column >= march.first_column + distance && march.column_bottom[column - distance] != ROW_NONE)
+        {
+            return column - distance;
+        }
+    }
+}
+
+// Bottom of the formation's lowest live row, where bullet hell fires from
+static size_t bullet_hell_top(const GameState& state)
+{
+    const FormationMarch& march = state.march;
+    Fixed bottom = march.row_y + (Fixed)march.first_row * march.pitch_y + march.offset_y;
+    return bottom > to_fixed(projectile_sprite.height) ? (size_t)fixed_pixels(bottom) - projectile_sprite.height : 0;
+}
+
+static void fire_bullet_pattern(GameState* state)
+{
+    Game& game = state->game;
+    const FormationMarch& march = state->march;
+    Archetype& enemy_shots = game.projectiles[PROJECTILE_ENEMY];
+    if(!game.aliens.num_live) return;
+
+    size_t fall_ticks = (size_t)(to_fixed(bullet_hell_top(*state)) / -enemy_shots.velocity) + 1;
+    size_t burst = state->bullet_hell / fall_ticks + 1;
+    for(size_t si = 0; si < burst && enemy_shots.count < state->bullet_hell; ++si)
+    {
+        size_t column = nearest_firing_column(march, (state->tick * burst + si) % march.num_columns);
+        size_t ai = march.column_bottom[column] * march.num_columns + column;
+        size_t phase = (state->tick + si * 7) % (2 * BULLET_HELL_SPREAD);
+        ptrdiff_t offset = (ptrdiff_t)(phase < BULLET_HELL_SPREAD ? phase : 2 * BULLET_HELL_SPREAD - phase) - BULLET_HELL_SPREAD / 2;
+        ptrdiff_t x = fixed_pixels(game.aliens.x[ai] + march.offset_x) + (ptrdiff_t)state->alien_box_width / 2 + offset;
+        if(x < 0) x = 0;
+        if(x >= (ptrdiff_t)game.width) x = (ptrdiff_t)game.width - 1;
+        spawn_projectile(&enemy_shots, (size_t)x, (size_t)fixed_pixels(game.aliens.y[ai] + march.offset_y) - projectile_sprite.height);
+    }
+}
+
+// Spreads the whole count over the fall, at scattered columns
+static void seed_bullet_hell(GameState* state)
+{
+    Game& game = state->game;
+    Archetype& enemy_shots = game.projectiles[PROJECTILE_ENEMY];
+    size_t top = bullet_hell_top(*state);
+    enemy_shots.count = 0;
+    for(size_t si = 0; si < state->bullet_hell; ++si)
+    {
+        spawn_projectile(&enemy_shots, 10 + (size_t)(si * 2654435761ull % (game.width - 20)), top * si / state->bullet_hell);
+    }
+}
+
+void step_enemy_fire(GameState* state)
+{
+    if(state->bullet_hell)
+    {
+        fire_bullet_pattern(state);
+        return;
+    }
+
+    Game& game = state->game;
+    const FormationMarch& march = state->march;
+    Archetype& enemy_shots = game.projectiles[PROJECTILE_ENEMY];
+    if(!game.aliens.num_live || state->tick % ENEMY_FIRE_TICKS || enemy_shots.count >= ENEMY_MAX_SHOTS) return;
+
+    size_t column;
+    if(state->tick / ENEMY_FIRE_TICKS % 2)
+    {
+        Fixed player_center = game.player.x + to_fixed(player_sprite.width) / 2;
+        Fixed home = player_center - march.offset_x - march.column_x;
+        column = home > 0 ? (size_t)(home / march.pitch_x) : 0;
+    }
+    else column = (size_t)(state->tick * 2654435761ull % march.num_columns);
+    column = nearest_firing_column(march, column);
+
+    size_t ai = march.column_bottom[column] * march.num_columns + column;
+    spawn_projectile(
+        &enemy_shots, (size_t)fixed_pixels(game.aliens.x[ai] + march.offset_x) + state->alien_box_width / 2,
+        (size_t)fixed_pixels(game.aliens.y[ai] + march.offset_y) - projectile_sprite.height
+    );
+}
+
+// Rebuild every bunker whole, the stress formation plays without them
+void reset_shields(GameState* state)
+{
+    state->num_shields = state->stress_aliens ? 0 : SHIELD_COUNT;
+    for(size_t si = 0; si < state->num_shields; ++si)
+    {
+        Shield& shield = state->shields[si];
+        shield.x = state->layout_x + SHIELD_LEFT + si * SHIELD_PITCH;
+        shield.y = state->layout_y + SHIELD_BOTTOM;
+        memcpy(shield.rows, sprite_block.shield.rows, sizeof(shield.rows));
+    }
+    ++state->shield_version;
+}
+
+// Clear the erosion mask centred on column 'cx' and row 'cy' of a bunker,
+// one shifted AND-NOT per row it covers
+static void erode_shield(Shield* shield, ptrdiff_t cx, ptrdiff_t cy)
+{
+    ptrdiff_t height = (ptrdiff_t)shield_erosion_sprite.height;
+    ptrdiff_t left = cx - (ptrdiff_t)shield_erosion_sprite.width / 2;
+    ptrdiff_t bottom = cy + height / 2 - (height - 1);
+    for(size_t yi = 0; yi < shield_erosion_sprite.height; ++yi)
+    {
+        ptrdiff_t row = bottom + (ptrdiff_t)yi;
+        if(row < 0 || row >= SHIELD_HEIGHT) continue;
+
+        uint64_t mask = sprite_row(shield_erosion_sprite, yi);
+        mask = left >= 0 ? mask << left : mask >> -left;
+        shield->rows[row] &= ~(uint32_t)mask;
+    }
+}
+
+// Erodes the first bunker pixel a shot meets along this tick's path and
+// returns true, or returns false if the path is clear of them
+bool hit_shields(GameState* state, size_t x, size_t prev_y, size_t y, int velocity)
+{
+    size_t hit_shield = SIZE_MAX;
+    size_t hit_distance = SWEEP_MISS;
+    for(size_t si = 0; si < state->num_shields; ++si)
+    {
+        const Shield& shield = state->shields[si];
+        size_t distance = sprite_sweep_distance(
+            projectile_sprite, x, prev_y, y, shield_sprite(shield), shield.x, shield.y
+        );
+        if(distance < hit_distance)
+        {
+            hit_distance = distance;
+            hit_shield = si;
+        }
+    }
+    if(hit_shield == SIZE_MAX) return false;
+
+    // The shot's leading pixel at the hit, in the bunker's rows
+    Shield& shield = state->shields[hit_shield];
+    size_t lead = velocity > 0 ? prev_y + hit_distance + projectile_sprite.height - 1 : prev_y - hit_distance;
+    ptrdiff_t cx = (ptrdiff_t)(x + projectile_sprite.width / 2) - (ptrdiff_t)shield.x;
+    ptrdiff_t cy = (ptrdiff_t)lead - (ptrdiff_t)shield.y;
+    erode_shield(&shield, cx, cy);
+    ++state->shield_version;
+    return true;
+}
+
+static uint64_t next_wave_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void add_formation_cell(Formation* formation, size_t xi, size_t yi, AlienType type)
+{
+    size_t slot = formation->count++;
+    formation->cell[slot] = (uint8_t)(yi * FORMATION_COLUMNS + xi);
+    formation->type[slot] = type;
+    formation->dx[slot] = to_fixed(FORMATION_PITCH_X * xi + FORMATION_LEFT);
+    formation->dy[slot] = to_fixed(FORMATION_PITCH_Y * yi + FORMATION_BOTTOM);
+}
+
+void generate_formation(Formation* formation, size_t wave)
+{
+    *formation = Formation{};
+    uint64_t random = WAVE_SEED ^ wave;
+    size_t level = wave > NUM_WAVES ? wave - NUM_WAVES : 0;
+    // Out of 16, how likely each mirrored pair of cells is to be filled
+    uint64_t fill = 8 + (level < WAVE_RAMP ? level : WAVE_RAMP - 1);
+
+    for(size_t yi = 0; yi < FORMATION_ROWS; ++yi)
+    {
+        AlienType type = yi < FORMATION_ROWS / 3 ? ALIEN_OCTOPUS : yi < 2 * FORMATION_ROWS / 3 ? ALIEN_CRAB : ALIEN_SQUID;
+        if(next_wave_random(&random) % 4 == 0) type = type == ALIEN_OCTOPUS ? ALIEN_CRAB : ALIEN_SQUID;
+
+        for(size_t xi = 0; xi < FORMATION_COLUMNS / 2; ++xi)
+        {
+            if(next_wave_random(&random) % 16 >= fill) continue;
+            add_formation_cell(formation, xi, yi, type);
+            add_formation_cell(formation, FORMATION_COLUMNS - 1 - xi, yi, type);
+        }
+    }
+    if(!formation->count) add_formation_cell(formation, FORMATION_COLUMNS / 2, 0, ALIEN_OCTOPUS);
+}
+
+const Formation& wave_formation(size_t wave, Formation* generated)
+{
+    if(wave < NUM_WAVES) return formation_waves[wave];
+    generate_formation(generated, wave);
+    return *generated;
+}
+
+// Clears the arrays and places the formation's aliens at their home cells.
+// Empty cells are zeroed too, so a layout never depends on what the arrays
+// held before and a wave laid out anywhere hashes the same.
+void lay_out_formation(AlienArrays* aliens, size_t num_aliens, const Formation& formation, size_t layout_x, size_t layout_y)
+{
+    memset(aliens->x, 0, num_aliens * sizeof(Fixed));
+    memset(aliens->y, 0, num_aliens * sizeof(Fixed));
+    memset(aliens->hp, 0, num_aliens * sizeof(int));
+    memset(aliens->type, ALIEN_DEAD, num_aliens);
+    for(size_t slot = 0; slot < formation.count; ++slot)
+    {
+        size_t index = formation.cell[slot];
+        aliens->x[index] = to_fixed(layout_x) + formation.dx[slot];
+        aliens->y[index] = to_fixed(layout_y) + formation.dy[slot];
+        aliens->type[index] = formation.type[slot];
+        aliens->hp[index] = alien_types[formation.type[slot]].hp;
+    }
+    reset_alien_live_set(aliens, num_aliens);
+}
+
+// Everything a wave starts with besides its aliens
+static void start_wave(GameState* state)
+{
+    if(!state->stress_aliens)
+    {
+        FormationMarch& march = state->march;
+        march.num_columns = FORMATION_COLUMNS;
+        march.num_rows = FORMATION_ROWS;
+        march.column_x = to_fixed(state->layout_x + FORMATION_LEFT);
+        march.row_y = to_fixed(state->layout_y + FORMATION_BOTTOM);
+        march.pitch_x = to_fixed(FORMATION_PITCH_X);
+        march.pitch_y = to_fixed(FORMATION_PITCH_Y);
+    }
+    start_march(state);
+    reset_shields(state);
+
+    ++state->formation_version;
+}
+
+// Lay the selected wave out and clear what the previous one left behind
+void reset_formation(GameState* state)
+{
+    Game& game = state->game;
+    if(state->stress_aliens)
+    {
+        memset(game.aliens.type, ALIEN_DEAD, game.num_aliens);
+        lay_out_stress_formation(state);
+        reset_alien_live_set(&game.aliens, game.num_aliens);
+    }
+    else
+    {
+        Formation generated;
+        lay_out_formation(&game.aliens, game.num_aliens, wave_formation(state->wave, &generated), state->layout_x, state->layout_y);
+    }
+    start_wave(state);
+}
+
+void init_prepared_wave(PreparedWave* prepared, GameState* state)
+{
+    prepared->wave = SIZE_MAX;
+    init_alien_arrays(&prepared->aliens, &state->level, FORMATION_CELLS);
+}
+
+void prepare_wave(PreparedWave* prepared, size_t wave, size_t layout_x, size_t layout_y)
+{
+    Formation generated;
+    lay_out_formation(&prepared->aliens, FORMATION_CELLS, wave_formation(wave, &generated), layout_x, layout_y);
+    prepared->wave = wave;
+}
+
+void start_prepared_wave(GameState* state, PreparedWave* prepared)
+{
+    copy_alien_arrays(&state->game.aliens, prepared->aliens, FORMATION_CELLS);
+    state->wave = prepared->wave;
+    prepared->wave = SIZE_MAX;
+    start_wave(state);
+}
+
+// Scatters shots over the width by a multiplicative hash of 'seed'
+static void aim_stress_shot(GameState* state, size_t y, uint64_t seed)
+{
+    size_t span = state->game.width - 20 - projectile_sprite.width;
+    spawn_projectile(&state->game.projectiles[PROJECTILE_PLAYER], 10 + (size_t)(seed * 2654435761ull % span), y);
+}
+
+// Swap the formation for a generated one of 'num_aliens' and keep
+// 'num_shots' player shots in flight from now on
+void configure_stress(GameState* state, size_t num_aliens, size_t num_shots)
+{
+    Game& game = state->game;
+    if(num_aliens < 1) num_aliens = 1;
+    if(num_aliens > STRESS_MAX_ALIENS) num_aliens = STRESS_MAX_ALIENS;
+    state->stress_aliens = num_aliens;
+    state->stress_shots = num_shots;
+
+    // Every array is sized anew, so the block is laid out again
+    game.num_aliens = num_aliens;
+    size_t columns = stress_columns(*state);
+    state->march.num_columns = columns;
+    state->march.num_rows = (num_aliens + columns - 1) / columns;
+    allocate_state_block(state);
+    reset_formation(state);
+
+    // The first shots are spread over the height, later ones leave the player
+    size_t start = (size_t)fixed_pixels(game.player.y) + player_sprite.height;
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi) game.projectiles[oi].count = 0;
+    for(size_t si = 0; si < num_shots; ++si)
+    {
+        aim_stress_shot(state, start + si * (game.height - start) / num_shots, si);
+    }
+    if(state->bullet_hell) seed_bullet_hell(state);
+}
+
+void configure_bullet_hell(GameState* state, size_t num_shots)
+{
+    Game& game = state->game;
+    state->bullet_hell = num_shots;
+    game.projectiles[PROJECTILE_ENEMY].velocity = num_shots ? -BULLET_HELL_SPEED : -to_fixed(PROJECTILE_SPEED);
+    allocate_state_block(state);
+    reset_formation(state);
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi) game.projectiles[oi].count = 0;
+    seed_bullet_hell(state);
+}
+
+void compile_text_page(TextPage* page, Arena* arena)
+{
+    page->compiled = arena_array<TextLine>(arena, page->num_lines);
+    for(size_t li = 0; li < page->num_lines; ++li)
+    {
+        TextLine& line = page->compiled[li];
+        line.text = page->lines[li];
+        size_t bytes = strlen(line.text);
+        // No more characters than bytes
+        line.glyphs = arena_array<uint8_t>(arena, bytes);
+        line.bytes_before = arena_array<uint16_t>(arena, bytes + 1);
+
+        size_t count = 0;
+        for(size_t offset = 0; offset < bytes; ++count)
+        {
+            line.bytes_before[count] = (uint16_t)offset;
+            line.glyphs[count] = code_point_glyph(decode_utf8(line.text, bytes, &offset));
+        }
+        line.bytes_before[count] = (uint16_t)bytes;
+        line.length = count;
+    }
+}
+
+void init_game_state(GameState* state, size_t width, size_t height)
+{
+    *state = GameState{};
+    init_arena(&state->level, LEVEL_ARENA_BLOCK);
+    state->layout_x = (width - DESIGN_WIDTH) / 2;
+    state->layout_y = (height - DESIGN_HEIGHT) / 2;
+    state->running = true;
+    state->still_alive = true;
+
+    Game& game = state->game;
+    game.width = width;
+    game.height = height;
+    game.num_aliens = FORMATION_CELLS;
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        Archetype& projectiles = game.projectiles[oi];
+        projectiles.components = PROJECTILE_COMPONENTS;
+        projectiles.sprite = &projectile_sprite;
+        projectiles.fixed = true;
+    }
+    game.projectiles[PROJECTILE_PLAYER].velocity = to_fixed(PROJECTILE_SPEED);
+    game.projectiles[PROJECTILE_ENEMY].velocity = -to_fixed(PROJECTILE_SPEED);
+
+    game.player.x = to_fixed(game.width / 2 - player_sprite.width / 2);
+    game.player.y = to_fixed(32);
+    game.player.prev_x = game.player.x;
+    game.player.life = 3;
+    state->player_speed = to_fixed(60) / SIM_TICK_RATE;
+
+    for(size_t ti = ALIEN_CRAB; ti < NUM_ALIEN_TYPES; ++ti)
+    {
+        const AlienTypeInfo& info = alien_types[ti];
+        SpriteAnimation* animation = &state->animations[info.animation];
+        animation->loop = true;
+        animation->num_frames = info.num_frames;
+        animation->frame_duration = 0.5f;
+        animation->time = 0.0f;
+        animation->frames = info.frames;
+
+        if(info.box_width > state->alien_box_width) state->alien_box_width = info.box_width;
+        if(info.box_height > state->alien_box_height) state->alien_box_height = info.box_height;
+    }
+    advance_animations(state->animations, NUM_ANIMATIONS, 0.0);
+    state->march.num_columns = FORMATION_COLUMNS;
+    state->march.num_rows = FORMATION_ROWS;
+    allocate_state_block(state);
+
+    reset_formation(state);
+
+    TextAnimation* msg_animation = &state->msg_animation;
+    msg_animation->current_page = 0;
+    msg_animation->current_line = 0;
+    msg_animation->chars_visible = 0;
+    msg_animation->animation_complete = false;
+    init_script_runner(&state->scripts);
+    start_script(&state->scripts, SCRIPT_STORY);
+
+    // --- CHOICE VARIABLES ---
+    state->choice_phase = false;
+    state->yes_alien.x = to_fixed(state->layout_x + 60); state->yes_alien.y = to_fixed(state->layout_y + 80); state->yes_alien.type = ALIEN_CRAB;
+    state->no_alien.x = to_fixed(state->layout_x + 130); state->no_alien.y = to_fixed(state->layout_y + 80); state->no_alien.type = ALIEN_CRAB;
+
+    msg_animation->num_pages = NUM_PAGES;
+    msg_animation->pages = arena_array<TextPage>(&state->level, NUM_PAGES);
+
+    // How the story moves on from each page, one row per page
+    static const PageFlow story_flow[NUM_PAGES] = {
+        {PAGE_NEXT,      1, 0, 13.0f},  // intro
+        {PAGE_CHOICE,    2, 3, 13.0f},  // the question, YES goes to 2 and NO to 3
+        {PAGE_HOLD,      0, 0, 13.0f},  // YES, stays up indefinitely
+        {PAGE_TERMINATE, 0, 0, 10.0f},  // NO, quits after display_time
+    };
+    for(size_t pi = 0; pi < NUM_PAGES; ++pi)
+    {
+        msg_animation->pages[pi].flow = story_flow[pi];
+    }
+    msg_animation->type_speed = story_flow[0].type_speed;
+
+    /*
+    ################################################
+    ##                PAGE SETUP                 ##
+    ################################################
+    */
+
+    // --- SETUP PAGE X ---
+    // State number of lines: 
+    // msg_animation->pages[X].num_lines = NUM_LINES_IN_THIS_PAGE;
+    // msg_animation->pages[X].lines = arena_array<const char*>(&state->level, NUM_LINES_IN_THIS_PAGE);
+    
+    // Insert your lines: 
+    // msg_animation->pages[X].lines[0] = <INSERT LINE HERE>; (up to 32 characters per line)
+    // msg_animation->pages[X].lines[1] = <INSERT LINE HERE>;
+    // etc.
+
+    for(size_t pi = 0; pi < msg_animation->num_pages; ++pi)
+    {
+        compile_text_page(&msg_animation->pages[pi], &state->level);
+    }
+}
+
+void destroy_game_state(GameState* state)
+{
+    destroy_arena(&state->level);
+    free_pages(state->block.data);
+    state->block = StateBlock{};
+}
+
+void enter_page(TextAnimation* msg_animation, size_t page)
+{
+    msg_animation->current_page = page;
+    msg_animation->current_line = 0;
+    msg_animation->chars_visible = 0;
+    msg_animation->type_speed = msg_animation->pages[page].flow.type_speed;
+}
+
+void init_script_runner(ScriptRunner* runner)
+{
+    *runner = ScriptRunner{};
+    for(size_t si = 0; si < MAX_SCRIPTS; ++si) runner->slots[si].next = (uint8_t)(si + 1 < MAX_SCRIPTS ? si + 1 : SCRIPT_NONE);
+    runner->free_head = 0;
+    runner->timed_head = SCRIPT_NONE;
+    for(size_t ei = 0; ei < NUM_SCRIPT_EVENTS; ++ei) runner->event_heads[ei] = SCRIPT_NONE;
+    runner->ready_head = runner->ready_tail = SCRIPT_NONE;
+}
+
+static void ready_script(ScriptRunner* runner, uint8_t si)
+{
+    runner->slots[si].wait = SCRIPT_READY;
+    runner->slots[si].next = SCRIPT_NONE;
+    if(runner->ready_tail == SCRIPT_NONE) runner->ready_head = si;
+    else runner->slots[runner->ready_tail].next = si;
+    runner->ready_tail = si;
+}
+
+bool start_script(ScriptRunner* runner, ScriptId id)
+{
+    uint8_t si = runner->free_head;
+    if(si == SCRIPT_NONE) return false;
+    runner->free_head = runner->slots[si].next;
+    runner->slots[si] = Script{};
+    runner->slots[si].id = id;
+    ready_script(runner, si);
+    return true;
+}
+
+void signal_script(ScriptRunner* runner, ScriptEvent event, uint8_t value)
+{
+    uint8_t si = runner->event_heads[event];
+    runner->event_heads[event] = SCRIPT_NONE;
+    while(si != SCRIPT_NONE)
+    {
+        uint8_t next = runner->slots[si].next;
+        runner->slots[si].value = value;
+        ready_script(runner, si);
+        si = next;
+    }
+}
+
+// Files a script that just returned under what it waits for
+static void file_script(ScriptRunner* runner, uint8_t si, double dt)
+{
+    Script& script = runner->slots[si];
+    switch(script.wait)
+    {
+        case SCRIPT_SECONDS:
+        {
+            // The tick a timer adding up dt would first reach 'seconds' on
+            double ticks = (double)script.seconds / dt - 1e-6;
+            script.wake_tick = runner->clock + (ticks > 1.0 ? (uint64_t)ticks + 1 : 1);
+            uint8_t* link = &runner->timed_head;
+            while(*link != SCRIPT_NONE && runner->slots[*link].wake_tick <= script.wake_tick) link = &runner->slots[*link].next;
+            script.next = *link;
+            *link = si;
+            break;
+        }
+        case SCRIPT_EVENT:
+            script.next = runner->event_heads[script.event];
+            runner->event_heads[script.event] = si;
+            break;
+        case SCRIPT_DONE:
+            script.next = runner->free_head;
+            runner->free_head = si;
+            break;
+        default:
+            ready_script(runner, si);
+            break;
+    }
+}
+
+static void run_story(GameState* state, Script* script);
+
+static void (*const script_functions[NUM_SCRIPTS])(GameState*, Script*) = {
+    run_story,
+};
+
+// Resumes the ready list as it stands, anything readied on the way waits
+// for the next call
+static void resume_ready_scripts(GameState* state, double dt)
+{
+    ScriptRunner* runner = &state->scripts;
+    uint8_t si = runner->ready_head;
+    runner->ready_head = runner->ready_tail = SCRIPT_NONE;
+    while(si != SCRIPT_NONE)
+    {
+        uint8_t next = runner->slots[si].next;
+        Script* script = &runner->slots[si];
+        script_functions[script->id](state, script);
+        file_script(runner, si, dt);
+        si = next;
+    }
+}
+
+void run_scripts(GameState* state, double dt)
+{
+    ScriptRunner* runner = &state->scripts;
+    // Scripts started or signalled since the last run go on as of the
+    // tick that readied them, so their waits count from there
+    resume_ready_scripts(state, dt);
+
+    ++runner->clock;
+    while(runner->timed_head != SCRIPT_NONE && runner->slots[runner->timed_head].wake_tick <= runner->clock)
+    {
+        uint8_t si = runner->timed_head;
+        runner->timed_head = runner->slots[si].next;
+        ready_script(runner, si);
+    }
+    resume_ready_scripts(state, dt);
+}
+
+static bool page_typed_out(const TextAnimation& msg_animation)
+{
+    const TextPage& page = msg_animation.pages[msg_animation.current_page];
+    return msg_animation.current_line == page.num_lines - 1 &&
+           msg_animation.chars_visible > page.compiled[msg_animation.current_line].length;
+}
+
+static const PageFlow& current_flow(const TextAnimation& msg_animation)
+{
+    return msg_animation.pages[msg_animation.current_page].flow;
+}
+
+// Types each page out, then carries out its PageFlow
+static void run_story(GameState* state, Script* script)
+{
+    TextAnimation* msg_animation = &state->msg_animation;
+    SCRIPT_BEGIN(script);
+    for(;;)
+    {
+        // A page left empty in init_game_state() ends the story there
+        if(!msg_animation->pages[msg_animation->current_page].num_lines) break;
+
+        while(!page_typed_out(*msg_animation))
+        {
+            SCRIPT_WAIT_SECONDS(script, 1.0f / msg_animation->type_speed);
+            msg_animation->chars_visible++;
+            const TextPage& page = msg_animation->pages[msg_animation->current_page];
+            if(msg_animation->chars_visible > page.compiled[msg_animation->current_line].length && msg_animation->current_line < page.num_lines - 1)
+            {
+                msg_animation->current_line++;
+                msg_animation->chars_visible = 0;
+            }
+        }
+
+        if(current_flow(*msg_animation).end == PAGE_HOLD) SCRIPT_EXIT(script);
+        if(current_flow(*msg_animation).end == PAGE_CHOICE)
+        {
+            state->choice_phase = true;
+            SCRIPT_WAIT_EVENT(script, SCRIPT_EVENT_TARGET_HIT);
+            state->choice_phase = false;
+            enter_page(msg_animation, script->value == CHOICE_YES ? current_flow(*msg_animation).next : current_flow(*msg_animation).next_no);
+            continue;
+        }
+
+        SCRIPT_WAIT_SECONDS(script, msg_animation->pages[msg_animation->current_page].display_time);
+        // A reload may have lengthened the page meanwhile
+        if(!page_typed_out(*msg_animation)) continue;
+
+        if(current_flow(*msg_animation).end == PAGE_TERMINATE)
+        {
+            state->running = false;
+            SCRIPT_EXIT(script);
+        }
+        if(current_flow(*msg_animation).end == PAGE_NEXT && current_flow(*msg_animation).next < msg_animation->num_pages)
+        {
+            enter_page(msg_animation, current_flow(*msg_animation).next);
+            continue;
+        }
+        break;
+    }
+    msg_animation->animation_complete = true;
+    SCRIPT_END(script);
+}
+
+// The player's shots against the YES/NO targets of a choice page; the
+// nearer target along a shot's path wins, YES on a tie
+void step_choice(GameState* state, const Sprite& target_sprite)
+{
+    Archetype& player_shots = state->game.projectiles[PROJECTILE_PLAYER];
+    const int16_t* shot_x = archetype_column<int16_t>(player_shots, COMPONENT_X);
+    const Fixed* shot_y = archetype_column<Fixed>(player_shots, COMPONENT_Y);
+    const Fixed* prev_y = archetype_column<Fixed>(player_shots, COMPONENT_PREV_Y);
+
+    for(size_t bi = 0; bi < player_shots.count; ++bi)
+    {
+        size_t x = (size_t)shot_x[bi], y = (size_t)fixed_pixels(shot_y[bi]), from_y = (size_t)fixed_pixels(prev_y[bi]);
+        size_t distance_yes = sprite_sweep_distance(projectile_sprite, x, from_y, y, target_sprite, (size_t)fixed_pixels(state->yes_alien.x), (size_t)fixed_pixels(state->yes_alien.y));
+        size_t distance_no = sprite_sweep_distance(projectile_sprite, x, from_y, y, target_sprite, (size_t)fixed_pixels(state->no_alien.x), (size_t)fixed_pixels(state->no_alien.y));
+        if(distance_yes == SWEEP_MISS && distance_no == SWEEP_MISS) continue;
+
+        state->choice_phase = false;
+        signal_script(&state->scripts, SCRIPT_EVENT_TARGET_HIT, distance_yes <= distance_no ? CHOICE_YES : CHOICE_NO);
+        remove_entity(&player_shots, bi);
+        return;
+    }
+}
+
+// The passes over a tick's hit events. kill_alien() is what sets a type
+// dead, so it gets the alien back as the shots found it.
+static void remove_hit_aliens(GameState* state)
+{
+    Game& game = state->game;
+    for(size_t hi = 0; hi < state->num_hits; ++hi)
+    {
+        const HitEvent& hit = state->hits[hi];
+        if(!hit.killed) continue;
+        game.aliens.type[hit.alien] = hit.type;
+        kill_alien(&game.aliens, hit.alien);
+        march_remove_alien(&state->march, game.aliens, hit.alien);
+        ++state->formation_version;
+    }
+}
+
+static void score_hits(GameState* state)
+{
+    state->shots_hit += state->num_hits;
+    for(size_t hi = 0; hi < state->num_hits; ++hi)
+    {
+        const HitEvent& hit = state->hits[hi];
+        if(hit.killed) state->score += alien_types[hit.type].score;
+    }
+}
+
+static void spawn_hit_effects(GameState* state)
+{
+    const AlienArrays& aliens = state->game.aliens;
+    const FormationMarch& march = state->march;
+    for(size_t hi = 0; hi < state->num_hits; ++hi)
+    {
+        const HitEvent& hit = state->hits[hi];
+        if(!hit.killed) continue;
+        const AlienTypeInfo& info = alien_types[hit.type];
+        spawn_effect(
+            &state->effects, EFFECT_ALIEN_DEATH,
+            aliens.x[hit.alien] + march.offset_x - to_fixed((alien_death_sprite.width - info.box_width) / 2),
+            aliens.y[hit.alien] + march.offset_y
+        );
+    }
+}
+
+static void sound_hits(GameState* state)
+{
+    for(size_t hi = 0; hi < state->num_hits; ++hi)
+    {
+        if(state->hits[hi].killed) state->sounds |= 1u << GAME_SOUND_ALIEN_DEATH;
+    }
+}
+
+static void apply_hit_events(GameState* state)
+{
+    remove_hit_aliens(state);
+    score_hits(state);
+    spawn_hit_effects(state);
+    sound_hits(state);
+    state->num_hits = 0;
+}
+
+// The first and last of 'count' formation lines 'pitch' apart from
+// 'origin' whose 'size' wide boxes can overlap [from, to), false when
+// none can. The layout is exact in fixed point, so the ends need no
+// slack for rounding.
+static bool formation_span(Fixed origin, Fixed pitch, size_t size, size_t count, Fixed from, Fixed to, size_t* first, size_t* last)
+{
+    Fixed lo = from - origin - to_fixed(size), hi = to - origin;
+    if(hi < 0 || lo >= (int64_t)count * pitch) return false;
+    *first = lo > 0 ? (size_t)(lo / pitch) : 0;
+    *last = (size_t)(hi / pitch) < count - 1 ? (size_t)(hi / pitch) : count - 1;
+    return true;
+}
+
+// One player shot's path this tick, as pixels and as the range of alien
+// corners in the formation's frame, and the alien it met first so far
+struct ShotSweep
+{
+    size_t x, from_y, y;
+    OverlapRange range;
+    size_t hit_alien, hit_distance;
+};
+
+// The box test on up to ALIEN_BATCH candidates, then the exact sweep on
+// those it lets through
+static void sweep_alien_batch(const GameState& state, const Sprite* const* type_sprites, const uint16_t* candidates, size_t count, ShotSweep* sweep)
+{
+    const AlienArrays& aliens = state.game.aliens;
+    const FormationMarch& march = state.march;
+    for(uint32_t hits = overlap_mask(aliens, candidates, count, sweep->range); hits; hits &= hits - 1)
+    {
+        size_t ai = candidates[count_trailing_zeros(hits)];
+        size_t distance = sprite_sweep_distance(
+            projectile_sprite, sweep->x, sweep->from_y, sweep->y, *type_sprites[aliens.type[ai]],
+            (size_t)fixed_pixels(aliens.x[ai] + march.offset_x), (size_t)fixed_pixels(aliens.y[ai] + march.offset_y)
+        );
+        if(distance < sweep->hit_distance)
+        {
+            sweep->hit_distance = distance;
+            sweep->hit_alien = ai;
+        }
+    }
+}
+
+// Moves the player's shots and resolves their hits on the formation
+void step_player_shots(GameState* state)
+{
+    Game& game = state->game;
+    FormationMarch& march = state->march;
+
+    // Each type's current frame, for the exact tests
+    const Sprite* type_sprites[NUM_ALIEN_TYPES];
+    for(size_t ti = 0; ti < NUM_ALIEN_TYPES; ++ti) type_sprites[ti] = state->animations[alien_types[ti].animation].current;
+
+    Archetype& player_shots = game.projectiles[PROJECTILE_PLAYER];
+    move_entities(&player_shots, to_fixed(projectile_sprite.height), to_fixed(game.height));
+    const int16_t* shot_x = archetype_column<int16_t>(player_shots, COMPONENT_X);
+    const Fixed* shot_y = archetype_column<Fixed>(player_shots, COMPONENT_Y);
+    const Fixed* prev_y = archetype_column<Fixed>(player_shots, COMPONENT_PREV_Y);
+    for (size_t bi = 0; bi < player_shots.count;)
+    {
+        if(entity_culled(player_shots, bi))
+        {
+            remove_entity(&player_shots, bi);
+            continue;
+        }
+        size_t x = (size_t)shot_x[bi], y = (size_t)fixed_pixels(shot_y[bi]), from_y = (size_t)fixed_pixels(prev_y[bi]);
+
+        // Shields sit below the formation, so they stop a shot first
+        if(hit_shields(state, x, from_y, y, player_shots.velocity))
+        {
+            remove_entity(&player_shots, bi);
+            continue;
+        }
+
+        // Everything below tests the path covered this tick
+        size_t sweep_y = from_y < y ? from_y : y;
+        size_t sweep_height = projectile_sprite.height + (y - sweep_y) + (from_y - sweep_y);
+
+        // The alien arrays hold home positions, so the path is moved into
+        // the formation's frame instead of the other way round
+        Fixed home_x = to_fixed(x) - march.offset_x, home_y = to_fixed(sweep_y) - march.offset_y;
+        ShotSweep sweep = {
+            x, from_y, y,
+            overlap_range(home_x, home_y, projectile_sprite.width, sweep_height, state->alien_box_width, state->alien_box_height),
+            SIZE_MAX, SWEEP_MISS
+        };
+
+        // The aliens whose boxes the path can cross are read off the
+        // march's columns and rows. Shots only rise, so in each column
+        // the path is taken from its lowest live alien up: nothing below
+        // it is left to hit.
+        size_t first_column, last_column, first_row, last_row;
+        if(formation_span(march.column_x, march.pitch_x, state->alien_box_width, march.num_columns, home_x, home_x + to_fixed(projectile_sprite.width), &first_column, &last_column) &&
+           formation_span(march.row_y, march.pitch_y, state->alien_box_height, march.num_rows, home_y, home_y + to_fixed(sweep_height), &first_row, &last_row))
+        {
+            if(first_column < march.first_column) first_column = march.first_column;
+            if(last_column > march.last_column) last_column = march.last_column;
+            uint16_t candidates[ALIEN_BATCH];
+            size_t num_candidates = 0;
+            for(size_t column = first_column; column <= last_column; ++column)
+            {
+                size_t bottom = march.column_bottom[column];
+                if(bottom == ROW_NONE) continue;
+                for(size_t row = first_row > bottom ? first_row : bottom; row <= last_row; ++row)
+                {
+                    size_t ai = row * march.num_columns + column;
+                    if(ai >= game.num_aliens) break;
+                    // Killed by an earlier shot of this tick
+                    if(!alien_is_live(game.aliens, ai) || game.aliens.type[ai] == ALIEN_DEAD) continue;
+
+                    candidates[num_candidates++] = (uint16_t)ai;
+                    if(num_candidates < ALIEN_BATCH) continue;
+                    sweep_alien_batch(*state, type_sprites, candidates, num_candidates, &sweep);
+                    num_candidates = 0;
+                }
+            }
+            if(num_candidates) sweep_alien_batch(*state, type_sprites, candidates, num_candidates, &sweep);
+        }
+        size_t hit_alien = sweep.hit_alien;
+
+        if(hit_alien != SIZE_MAX)
+        {
+            size_t ai = hit_alien;
+            HitEvent hit = {(uint16_t)ai, game.aliens.type[ai], game.aliens.hp[ai] <= 1};
+            if(hit.killed) game.aliens.type[ai] = ALIEN_DEAD;
+            else --game.aliens.hp[ai];
+            state->hits[state->num_hits++] = hit;
+
+            remove_entity(&player_shots, bi);
+            continue;
+        }
+
+        ++bi;
+    }
+
+    apply_hit_events(state);
+}
+
+// Moves the aliens' shots, which fall towards the player through the
+// shields above it
+void step_enemy_shots(GameState* state)
+{
+    Game& game = state->game;
+    Archetype& enemy_shots = game.projectiles[PROJECTILE_ENEMY];
+    move_entities(&enemy_shots, 0, to_fixed(game.height));
+    const int16_t* shot_x = archetype_column<int16_t>(enemy_shots, COMPONENT_X);
+    const Fixed* shot_y = archetype_column<Fixed>(enemy_shots, COMPONENT_Y);
+    const Fixed* prev_y = archetype_column<Fixed>(enemy_shots, COMPONENT_PREV_Y);
+
+    // Everything these shots can hit lies in one band at the bottom, and
+    // they all fall, so a shot whose path this tick ends above the band
+    // is left alone. Under bullet hell that is nearly all of them.
+    size_t band_top = (size_t)fixed_pixels(game.player.y) + player_sprite.height;
+    for(size_t si = 0; si < state->num_shields; ++si)
+    {
+        size_t top = state->shields[si].y + SHIELD_HEIGHT;
+        if(top > band_top) band_top = top;
+    }
+
+    for (size_t bi = 0; bi < enemy_shots.count;)
+    {
+        if (entity_culled(enemy_shots, bi))
+        {
+            remove_entity(&enemy_shots, bi);
+            continue;
+        }
+        size_t x = (size_t)shot_x[bi], y = (size_t)fixed_pixels(shot_y[bi]), from_y = (size_t)fixed_pixels(prev_y[bi]);
+        if (y >= band_top)
+        {
+            ++bi;
+            continue;
+        }
+
+        if (hit_shields(state, x, from_y, y, enemy_shots.velocity))
+        {
+            remove_entity(&enemy_shots, bi);
+            continue;
+        }
+
+        if (sprite_sweep_distance(projectile_sprite, x, from_y, y, player_sprite, (size_t)fixed_pixels(game.player.x), (size_t)fixed_pixels(game.player.y)) != SWEEP_MISS)
+        {
+            if (game.player.life) --game.player.life;
+            state->sounds |= 1u << GAME_SOUND_PLAYER_HIT;
+            spawn_effect(
+                &state->effects, EFFECT_PLAYER_HIT,
+                game.player.x - (to_fixed(alien_death_sprite.width) - to_fixed(player_sprite.width)) / 2, game.player.y
+            );
+            remove_entity(&enemy_shots, bi);
+            continue;
+        }
+        ++bi;
+    }
+}
+
+// Advance one tick. Projectiles move PROJECTILE_SPEED pixels per call, so
+// callers step at the fixed SIM_DT.
+void step_game(GameState* state, const GameInput& input, double dt)
+{
+    Game& game = state->game;
+
+    ++state->tick;
+    game.player.prev_x = game.player.x;
+
+
+    state->still_alive = game.aliens.num_live != 0;
+    update_effects(&state->effects, dt);
+
+    if (!state->still_alive)
+    {
+        state->score = 143;
+        run_scripts(state, dt);
+    }
+
+    advance_animations(state->animations, NUM_ANIMATIONS, dt);
+    step_march(state);
+    step_player_shots(state);
+
+    // Only a choice page has targets to shoot at, both of the same type
+    if(state->choice_phase) step_choice(state, *state->animations[alien_types[state->yes_alien.type].animation].current);
+
+    step_enemy_fire(state);
+    step_enemy_shots(state);
+
+
+    int player_move_dir = 2 * input.move_dir;
+
+    if (player_move_dir != 0)
+    {
+        Fixed step = player_move_dir * state->player_speed;
+        if(game.player.x + to_fixed(player_sprite.width) + step >= to_fixed(game.width - 10))
+        {
+            game.player.x = to_fixed(game.width - player_sprite.width - player_move_dir - 10);
+            player_move_dir *= -1;
+        }
+        else if(game.player.x + step <= to_fixed(10))
+        {
+            game.player.x = to_fixed(10);
+            player_move_dir *= -1;
+        }
+        else game.player.x += step;
+    }
+
+    if(input.fire)
+    {
+        size_t x = (size_t)fixed_pixels(game.player.x) + (size_t)player_sprite.width / 2;
+        size_t y = (size_t)fixed_pixels(game.player.y) + (size_t)player_sprite.height;
+        spawn_projectile(&game.projectiles[PROJECTILE_PLAYER], x, y);
+        spawn_effect(&state->effects, EFFECT_MUZZLE_FLASH, to_fixed(x - 1), to_fixed(y));
+        state->sounds |= 1u << GAME_SOUND_SHOT;
+        ++state->shots_fired;
+    }
+
+    const Archetype& player_shots = game.projectiles[PROJECTILE_PLAYER];
+    while(player_shots.count < state->stress_shots)
+    {
+        uint64_t seed = state->tick * state->stress_shots + player_shots.count;
+        aim_stress_shot(state, (size_t)fixed_pixels(game.player.y) + player_sprite.height, seed);
+    }
+}
+
+// Chases a live alien picked from the seed and fires from under it; the
+// seed staggers the targets so no two games play alike
+GameInput bot_input(const GameState& state, size_t seed)
+{
+    const AlienArrays& aliens = state.game.aliens;
+    GameInput input = {0, false};
+    if(!aliens.num_live) return input;
+
+    size_t start = (seed * 31 + state.tick / 240) % state.game.num_aliens;
+    size_t target = start;
+    while(!alien_is_live(aliens, target)) target = (target + 1) % state.game.num_aliens;
+
+    Fixed aim = aliens.x[target] + state.march.offset_x + to_fixed(state.alien_box_width) / 2 - to_fixed(player_sprite.width) / 2;
+    if(state.game.player.x + FIXED_ONE < aim) input.move_dir = 1;
+    else if(state.game.player.x > aim + FIXED_ONE) input.move_dir = -1;
+    input.fire = !input.move_dir && state.tick % (7 + seed % 5) == 0;
+    return input;
+}
+
+/*
+################################################
+##                SAVED STATES                ##
+################################################
+*/
+
+void init_saved_state(SavedState* saved, const GameState& state)
+{
+    *saved = SavedState{};
+    saved->capacity = state.block.size;
+    saved->block = (uint8_t*)alloc_pages(saved->capacity);
+}
+
+void destroy_saved_state(SavedState* saved)
+{
+    free_pages(saved->block);
+    *saved = SavedState{};
+}
+
+size_t save_game_state(SavedState* saved, const GameState& state)
+{
+    if(state.block.size > saved->capacity)
+    {
+        free_pages(saved->block);
+        saved->capacity = state.block.size;
+        saved->block = (uint8_t*)alloc_pages(saved->capacity);
+    }
+    copy_game_state(&saved->state, saved->block, state);
+    return sizeof(GameState) + state.block.size;
+}
+
+void restore_game_state(GameState* state, const SavedState& saved)
+{
+    Arena level = state->level;
+    StateBlock block = state->block;
+    if(block.size != saved.state.block.size)
+    {
+        free_pages(block.data);
+        block.data = (uint8_t*)alloc_pages(saved.state.block.size);
+    }
+    copy_game_state(state, block.data, saved.state);
+    state->level = level;
+}
+
+bool load_game_state(GameState* state, const GameState& image, const uint8_t* block)
+{
+    if(image.block.size != state->block.size || image.game.num_aliens != state->game.num_aliens) return false;
+
+    GameState live = *state;
+    GameState source = image;
+    source.block.data = const_cast<uint8_t*>(block);
+    copy_game_state(state, live.block.data, source);
+    state->level = live.level;
+    state->msg_animation.pages = live.msg_animation.pages;
+    for(size_t ni = 0; ni < NUM_ANIMATIONS; ++ni)
+    {
+        SpriteAnimation& animation = state->animations[ni];
+        animation.frames = live.animations[ni].frames;
+        animation.current = animation.current_frame < animation.num_frames ? animation.frames[animation.current_frame] : live.animations[ni].current;
+    }
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi) state->game.projectiles[oi].sprite = live.game.projectiles[oi].sprite;
+    return true;
+}
+
+inline uint64_t checksum_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// True once ticks without input stop changing anything that is drawn: the
+// formation is cleared, nothing is in flight and the story has either
+// finished or is holding a fully typed page
+bool game_is_idle(const GameState& state)
+{
+    if(state.game.aliens.num_live || state.effects.count) return false;
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        if(state.game.projectiles[oi].count) return false;
+    }
+
+    const TextAnimation& msg_animation = state.msg_animation;
+    if(msg_animation.animation_complete) return true;
+
+    const TextPage& page = msg_animation.pages[msg_animation.current_page];
+    if(page.flow.end != PAGE_HOLD || !page.num_lines) return false;
+    return msg_animation.current_line == page.num_lines - 1 &&
+           msg_animation.chars_visible > page.compiled[msg_animation.current_line].length;
+}
+
+// FNV-1a over everything step_game() reads or writes, for comparing runs
+uint64_t game_state_checksum(const GameState& state)
+{
+    const Game& game = state.game;
+    uint64_t hash = 14695981039346656037ull;
+    hash = checksum_bytes(hash, &state.tick, sizeof(state.tick));
+    hash = checksum_bytes(hash, &state.score, sizeof(state.score));
+    for(size_t ni = 0; ni < NUM_ANIMATIONS; ++ni)
+    {
+        hash = checksum_bytes(hash, &state.animations[ni].time, sizeof(float));
+    }
+    hash = checksum_bytes(hash, &game.player.x, sizeof(Fixed));
+    hash = checksum_bytes(hash, &game.player.life, sizeof(size_t));
+    hash = checksum_bytes(hash, game.aliens.x, game.num_aliens * sizeof(Fixed));
+    hash = checksum_bytes(hash, game.aliens.y, game.num_aliens * sizeof(Fixed));
+    hash = checksum_bytes(hash, game.aliens.type, game.num_aliens * sizeof(uint8_t));
+    hash = checksum_bytes(hash, game.aliens.hp, game.num_aliens * sizeof(int));
+    const FormationMarch& march = state.march;
+    hash = checksum_bytes(hash, &march.offset_x, sizeof(Fixed));
+    hash = checksum_bytes(hash, &march.offset_y, sizeof(Fixed));
+    hash = checksum_bytes(hash, &march.dir, sizeof(int));
+    hash = checksum_bytes(hash, &march.ticks_left, sizeof(size_t));
+    // Top row first, the order recorded checksums were taken in
+    for(size_t si = 0; si < state.num_shields; ++si)
+    {
+        for(size_t yi = SHIELD_HEIGHT; yi-- > 0;)
+        {
+            hash = checksum_bytes(hash, &state.shields[si].rows[yi], sizeof(uint32_t));
+        }
+    }
+    hash = checksum_bytes(hash, &state.effects.count, sizeof(size_t));
+    for(size_t ei = 0; ei < state.effects.count; ++ei)
+    {
+        const Effect& effect = state.effects.items[ei];
+        hash = checksum_bytes(hash, &effect.x, sizeof(Fixed));
+        hash = checksum_bytes(hash, &effect.y, sizeof(Fixed));
+        hash = checksum_bytes(hash, &effect.remaining, sizeof(float));
+        hash = checksum_bytes(hash, &effect.kind, sizeof(EffectKind));
+    }
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        const Archetype& projectiles = game.projectiles[oi];
+        const int16_t* shot_x = archetype_column<int16_t>(projectiles, COMPONENT_X);
+        const Fixed* shot_y = archetype_column<Fixed>(projectiles, COMPONENT_Y);
+        const Fixed* prev_y = archetype_column<Fixed>(projectiles, COMPONENT_PREV_Y);
+        hash = checksum_bytes(hash, &projectiles.count, sizeof(size_t));
+        // Widened to the whole pixels and per-shot speed the columns held
+        // before they were packed, so recorded checksums still match
+        int velocity = (int)fixed_pixels(projectiles.velocity);
+        for(size_t bi = 0; bi < projectiles.count; ++bi)
+        {
+            size_t row[3] = {(size_t)shot_x[bi], (size_t)fixed_pixels(shot_y[bi]), (size_t)fixed_pixels(prev_y[bi])};
+            hash = checksum_bytes(hash, row, sizeof(row));
+            hash = checksum_bytes(hash, &velocity, sizeof(int));
+        }
+    }
+
+    const TextAnimation& msg = state.msg_animation;
+    size_t story[4] = {msg.current_page, msg.current_line, msg.chars_visible, (size_t)msg.animation_complete};
+    hash = checksum_bytes(hash, story, sizeof(story));
+    // Ticks until each script wakes from a timed wait, in the 8 bytes the
+    // story's two timers took, so runs without a story keep their checksums
+    const ScriptRunner& scripts = state.scripts;
+    uint64_t waits = 0;
+    for(uint8_t si = scripts.timed_head; si != SCRIPT_NONE; si = scripts.slots[si].next)
+    {
+        waits = waits * 31 + (scripts.slots[si].wake_tick - scripts.clock);
+    }
+    hash = checksum_bytes(hash, &waits, sizeof(waits));
+    hash = checksum_bytes(hash, &state.choice_phase, sizeof(bool));
+    return hash;
+}
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME64_3 0x165667B19E3779F9ull
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ull
+
+inline uint64_t rotate_left(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t load_u64(const uint8_t* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t load_u32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    return rotate_left(acc, 31) * XXH_PRIME64_1;
+}
+
+inline uint64_t xxh64_merge(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// XXH64 of little-endian bytes: four lanes over 32-byte stripes, then the tail
+static uint64_t hash_xxh64(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const uint8_t* end = p + size;
+    uint64_t hash;
+    if(size >= 32)
+    {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        for(; p + 32 <= end; p += 32)
+        {
+            v1 = xxh64_round(v1, load_u64(p));
+            v2 = xxh64_round(v2, load_u64(p + 8));
+            v3 = xxh64_round(v3, load_u64(p + 16));
+            v4 = xxh64_round(v4, load_u64(p + 24));
+        }
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = xxh64_merge(hash, v1);
+        hash = xxh64_merge(hash, v2);
+        hash = xxh64_merge(hash, v3);
+        hash = xxh64_merge(hash, v4);
+    }
+    else hash = seed + XXH_PRIME64_5;
+
+    hash += size;
+    for(; p + 8 <= end; p += 8) hash = rotate_left(hash ^ xxh64_round(0, load_u64(p)), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    if(p + 4 <= end)
+    {
+        hash = rotate_left(hash ^ (load_u32(p) * XXH_PRIME64_1), 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for(; p < end; ++p) hash = rotate_left(hash ^ (*p * XXH_PRIME64_5), 11) * XXH_PRIME64_1;
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Every scalar outside the block, with room to spare
+#define STATE_HASH_MAX_WORDS \
+    (96 + 3 * NUM_ANIMATIONS + 4 * EFFECT_CAPACITY + 8 * MAX_SCRIPTS + NUM_SCRIPT_EVENTS + \
+     (2 + SHIELD_HEIGHT) * SHIELD_COUNT + 4 * NUM_PROJECTILE_OWNERS)
+
+struct StateHashWords
+{
+    uint64_t words[STATE_HASH_MAX_WORDS];
+    size_t count;
+};
+
+inline void hash_word(StateHashWords* words, uint64_t value)
+{
+    words->words[words->count++] = value;
+}
+
+inline void hash_float(StateHashWords* words, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    words->words[words->count++] = bits;
+}
+
+static void hash_alien(StateHashWords* words, const Alien& alien)
+{
+    hash_word(words, (uint64_t)(int64_t)alien.x);
+    hash_word(words, (uint64_t)(int64_t)alien.y);
+    hash_word(words, alien.type);
+    hash_word(words, (uint64_t)(int64_t)alien.hp);
+}
+
+uint64_t game_state_hash(const GameState& state)
+{
+    StateHashWords words;
+    words.count = 0;
+
+    const Game& game = state.game;
+    hash_word(&words, state.tick);
+    hash_word(&words, game.width);
+    hash_word(&words, game.height);
+    hash_word(&words, game.num_aliens);
+    hash_word(&words, game.aliens.num_words);
+    hash_word(&words, game.aliens.num_live);
+    hash_word(&words, (uint64_t)(int64_t)game.player.x);
+    hash_word(&words, (uint64_t)(int64_t)game.player.y);
+    hash_word(&words, (uint64_t)(int64_t)game.player.prev_x);
+    hash_word(&words, game.player.life);
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        const Archetype& projectiles = game.projectiles[oi];
+        hash_word(&words, projectiles.components);
+        hash_word(&words, (uint64_t)(int64_t)projectiles.velocity);
+        hash_word(&words, projectiles.count);
+        hash_word(&words, projectiles.capacity);
+        hash_word(&words, projectiles.high_water);
+    }
+    hash_word(&words, state.layout_x);
+    hash_word(&words, state.layout_y);
+
+    for(size_t ni = 0; ni < NUM_ANIMATIONS; ++ni)
+    {
+        const SpriteAnimation& animation = state.animations[ni];
+        hash_word(&words, animation.num_frames);
+        hash_float(&words, animation.time);
+        hash_word(&words, animation.current_frame);
+    }
+    const EffectPool& effects = state.effects;
+    hash_word(&words, effects.count);
+    hash_word(&words, effects.dropped);
+    hash_word(&words, effects.spawned);
+    for(size_t ei = 0; ei < effects.count; ++ei)
+    {
+        const Effect& effect = effects.items[ei];
+        hash_word(&words, (uint64_t)(int64_t)effect.x);
+        hash_word(&words, (uint64_t)(int64_t)effect.y);
+        hash_float(&words, effect.remaining);
+        hash_word(&words, effect.kind);
+    }
+    hash_word(&words, (uint64_t)(int64_t)state.player_speed);
+    hash_word(&words, state.score);
+    hash_word(&words, state.still_alive);
+
+    const TextAnimation& msg = state.msg_animation;
+    hash_word(&words, msg.current_page);
+    hash_word(&words, msg.current_line);
+    hash_word(&words, msg.chars_visible);
+    hash_float(&words, msg.type_speed);
+    hash_word(&words, msg.animation_complete);
+    const ScriptRunner& scripts = state.scripts;
+    for(size_t si = 0; si < MAX_SCRIPTS; ++si)
+    {
+        const Script& script = scripts.slots[si];
+        hash_word(&words, script.id);
+        hash_word(&words, script.wait);
+        hash_word(&words, script.resume);
+        hash_word(&words, script.event);
+        hash_word(&words, script.value);
+        hash_word(&words, script.next);
+        hash_float(&words, script.seconds);
+        hash_word(&words, script.wake_tick);
+    }
+    hash_word(&words, scripts.free_head);
+    hash_word(&words, scripts.timed_head);
+    for(size_t ei = 0; ei < NUM_SCRIPT_EVENTS; ++ei) hash_word(&words, scripts.event_heads[ei]);
+    hash_word(&words, scripts.ready_head);
+    hash_word(&words, scripts.ready_tail);
+    hash_word(&words, scripts.clock);
+    hash_word(&words, state.choice_phase);
+    hash_alien(&words, state.yes_alien);
+    hash_alien(&words, state.no_alien);
+
+    hash_word(&words, state.wave);
+    const FormationMarch& march = state.march;
+    hash_word(&words, (uint64_t)(int64_t)march.offset_x);
+    hash_word(&words, (uint64_t)(int64_t)march.offset_y);
+    hash_word(&words, (uint64_t)(int64_t)march.dir);
+    hash_word(&words, march.ticks_left);
+    hash_word(&words, march.num_start);
+    hash_word(&words, march.num_columns);
+    hash_word(&words, march.num_rows);
+    hash_word(&words, march.first_column);
+    hash_word(&words, march.last_column);
+    hash_word(&words, march.first_row);
+    hash_word(&words, (uint64_t)(int64_t)march.column_x);
+    hash_word(&words, (uint64_t)(int64_t)march.row_y);
+    hash_word(&words, (uint64_t)(int64_t)march.pitch_x);
+    hash_word(&words, (uint64_t)(int64_t)march.pitch_y);
+
+    hash_word(&words, state.alien_box_width);
+    hash_word(&words, state.alien_box_height);
+    hash_word(&words, state.formation_version);
+
+    hash_word(&words, state.num_shields);
+    for(size_t si = 0; si < state.num_shields; ++si)
+    {
+        const Shield& shield = state.shields[si];
+        hash_word(&words, shield.x);
+        hash_word(&words, shield.y);
+        for(size_t yi = 0; yi < SHIELD_HEIGHT; ++yi) hash_word(&words, shield.rows[yi]);
+    }
+    hash_word(&words, state.shield_version);
+    hash_word(&words, state.running);
+    hash_word(&words, state.stress_aliens);
+    hash_word(&words, state.stress_shots);
+    hash_word(&words, state.bullet_hell);
+
+    // The block is zeroed when allocated and only ever written as whole
+    // values, so its bytes, unused capacity included, are the same
+    // wherever the same ticks ran
+    uint64_t seed = hash_xxh64(words.words, words.count * sizeof(uint64_t), 0);
+    return hash_xxh64(state.block.data, state.block.size, seed);
+}
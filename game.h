@@ -0,0 +1,1276 @@
+#ifndef GAME_H
+#define GAME_H
+
+/*
+    Simulation core. Everything that decides how a game plays out lives
+    here, with no window, GL or clock behind it: step_game() advances a
+    GameState by one tick from explicit inputs, so the same inputs from the
+    same state always give a bit-identical state.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define HAVE_X86_SIMD 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#define TARGET_AVX2_FLATTEN
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+// An AVX2 kernel built on a generic template: the template, and the AVX2
+// code it calls back into, are inlined into the kernel
+#define TARGET_AVX2_FLATTEN __attribute__((target("avx2"), flatten))
+#endif
+
+bool cpu_has_avx2();
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_SIMD 1
+#endif
+
+inline unsigned count_trailing_zeros(uint64_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctzll(v);
+#endif
+}
+
+// Index of the top set bit, 'v' nonzero
+inline unsigned highest_set_bit(uint64_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return (unsigned)index;
+#else
+    return 63u - (unsigned)__builtin_clzll(v);
+#endif
+}
+
+// 1bpp sprite: each row is a packed mask, bit xi = pixel xi. Rows are
+// stored bottom row first, the order of the buffer they are drawn into.
+// A view, 16 bytes, into rows that live elsewhere: the sprite block, an
+// atlas file or a reload of one.
+struct Sprite
+{
+    uint16_t width, height;
+    uint8_t row_bits;
+    const void* rows;
+};
+
+template<size_t W>
+using SpriteRow = typename std::conditional<W <= 16, uint16_t,
+                  typename std::conditional<W <= 32, uint32_t, uint64_t>::type>::type;
+
+template<size_t W, size_t H>
+struct PackedSprite
+{
+    SpriteRow<W> rows[H];
+};
+
+// Art is authored top row first; each frame of FH rows is stored flipped
+template<size_t W, size_t H, size_t FH = H>
+constexpr PackedSprite<W, H> pack_sprite(const char (&art)[W * H + 1])
+{
+    static_assert(W <= 64, "sprite rows are at most 64 pixels wide");
+    static_assert(H % FH == 0, "a sheet holds whole frames");
+    PackedSprite<W, H> packed{};
+    for(size_t yi = 0; yi < H; ++yi)
+    {
+        size_t row = yi - yi % FH + (FH - 1 - yi % FH);
+        for(size_t xi = 0; xi < W; ++xi)
+        {
+            if(art[yi * W + xi] == '@') packed.rows[row] |= SpriteRow<W>(1) << xi;
+        }
+    }
+    return packed;
+}
+
+// A view of the packed rows, starting 'first_frame' frames into a sheet
+template<size_t W, size_t H>
+constexpr Sprite make_sprite(const PackedSprite<W, H>& packed, size_t frame_height = H, size_t first_frame = 0)
+{
+    return Sprite{(uint16_t)W, (uint16_t)frame_height, (uint8_t)(sizeof(SpriteRow<W>) * 8), packed.rows + first_frame * frame_height};
+}
+
+inline uint64_t sprite_row(const Sprite& sprite, size_t yi)
+{
+    switch(sprite.row_bits)
+    {
+        case 16: return static_cast<const uint16_t*>(sprite.rows)[yi];
+        case 32: return static_cast<const uint32_t*>(sprite.rows)[yi];
+        default: return static_cast<const uint64_t*>(sprite.rows)[yi];
+    }
+}
+
+/*
+################################################
+##                SPRITE DATA                 ##
+################################################
+*/
+
+inline constexpr auto alien_rows = pack_sprite<11, 8>(
+    "..@.....@.."
+    "...@...@..."
+    "..@@@@@@@.."
+    ".@@.@@@.@@."
+    "@@@@@@@@@@@"
+    "@.@@@@@@@.@"
+    "@.@.....@.@"
+    "...@@.@@..."
+);
+
+inline constexpr auto alien_rows1 = pack_sprite<11, 8>(
+    "..@.....@.."
+    "@..@...@..@"
+    "@.@@@@@@@.@"
+    "@@@.@@@.@@@"
+    "@@@@@@@@@@@"
+    ".@@@@@@@@@."
+    "..@.....@.."
+    ".@.......@."
+);
+
+inline constexpr auto squid_rows = pack_sprite<8, 8>(
+    "...@@..."
+    "..@@@@.."
+    ".@@@@@@."
+    "@@.@@.@@"
+    "@@@@@@@@"
+    "..@..@.."
+    ".@.@@.@."
+    "@.@..@.@"
+);
+
+inline constexpr auto squid_rows1 = pack_sprite<8, 8>(
+    "...@@..."
+    "..@@@@.."
+    ".@@@@@@."
+    "@@.@@.@@"
+    "@@@@@@@@"
+    ".@.@@.@."
+    "@......@"
+    ".@....@."
+);
+
+inline constexpr auto octopus_rows = pack_sprite<12, 8>(
+    "....@@@@...."
+    ".@@@@@@@@@@."
+    "@@@@@@@@@@@@"
+    "@@@..@@..@@@"
+    "@@@@@@@@@@@@"
+    "...@@..@@..."
+    "..@@.@@.@@.."
+    "@@........@@"
+);
+
+inline constexpr auto octopus_rows1 = pack_sprite<12, 8>(
+    "....@@@@...."
+    ".@@@@@@@@@@."
+    "@@@@@@@@@@@@"
+    "@@@..@@..@@@"
+    "@@@@@@@@@@@@"
+    "..@@@..@@@.."
+    ".@@..@@..@@."
+    "..@@....@@.."
+);
+
+inline constexpr auto alien_death_rows = pack_sprite<13, 7>(
+    ".@..@...@..@."
+    "..@..@.@..@.."
+    "...@.....@..."
+    "@@.........@@"
+    "...@.....@..."
+    "..@..@.@..@.."
+    ".@..@...@..@."
+);
+
+inline constexpr auto player_rows = pack_sprite<11, 7>(
+    ".....@....."
+    "....@@@...."
+    "....@@@...."
+    ".@@@@@@@@@."
+    "@@@@@@@@@@@"
+    "@@@@@@@@@@@"
+    "@@@@@@@@@@@"
+);
+
+inline constexpr auto projectile_rows = pack_sprite<1, 3>(
+    "@"
+    "@"
+    "@"
+);
+
+inline constexpr auto muzzle_flash_rows = pack_sprite<3, 2>(
+    "@.@"
+    ".@."
+);
+
+inline constexpr auto shield_rows = pack_sprite<22, 16>(
+    "....@@@@@@@@@@@@@@...."
+    "...@@@@@@@@@@@@@@@@..."
+    "..@@@@@@@@@@@@@@@@@@.."
+    ".@@@@@@@@@@@@@@@@@@@@."
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@@@@@@@@@@@@@@@@"
+    "@@@@@@@........@@@@@@@"
+    "@@@@@@..........@@@@@@"
+    "@@@@@............@@@@@"
+    "@@@@@............@@@@@"
+);
+
+// What a hit takes out of a shield, centred on the impact
+inline constexpr auto shield_erosion_rows = pack_sprite<8, 6>(
+    "@..@..@."
+    "..@@@@.."
+    ".@@@@@@."
+    ".@@@@@@@"
+    "..@@@@@."
+    "@.@..@.@"
+);
+
+// Glyphs of the font sheet, see font.h
+#define FONT_ASCII_FIRST 0x20
+#define FONT_ASCII_GLYPHS 95
+#define FONT_LATIN1_FIRST 0xA0
+#define FONT_LATIN1_GLYPHS 96
+#define FONT_NUM_GLYPHS (FONT_ASCII_GLYPHS + FONT_LATIN1_GLYPHS)
+
+/*
+    Sprite block. Every built-in sprite's rows, the renderer's title,
+    particle and font included, are copied at compile time into one
+    cache-line aligned block, ordered by how often a frame reads them:
+    shots and particles, drawn by the hundred, then the aliens, the player
+    and the effects, which all fit in the first few lines, then the font,
+    whose glyph runs are cached, and last the art only read when a wave or
+    the title is set up. The art tables above are only constants the block
+    is built from, so nothing else of them reaches the binary. The block
+    is defined in sprites.cpp, next to the renderer's art.
+*/
+struct alignas(64) SpriteBlock
+{
+    PackedSprite<1, 3> projectile;
+    PackedSprite<1, 1> particle;
+    PackedSprite<11, 8> alien, alien1;
+    PackedSprite<8, 8> squid, squid1;
+    PackedSprite<12, 8> octopus, octopus1;
+    PackedSprite<11, 7> player;
+    PackedSprite<3, 2> muzzle_flash;
+    PackedSprite<13, 7> alien_death;
+    PackedSprite<8, 6> shield_erosion;
+    PackedSprite<5, FONT_NUM_GLYPHS * 7> font;
+    PackedSprite<64, 16> title;
+    PackedSprite<22, 16> shield;
+};
+
+extern const SpriteBlock sprite_block;
+
+inline constexpr Sprite alien_sprite = make_sprite(sprite_block.alien);
+inline constexpr Sprite alien_sprite1 = make_sprite(sprite_block.alien1);
+inline constexpr Sprite squid_sprite = make_sprite(sprite_block.squid);
+inline constexpr Sprite squid_sprite1 = make_sprite(sprite_block.squid1);
+inline constexpr Sprite octopus_sprite = make_sprite(sprite_block.octopus);
+inline constexpr Sprite octopus_sprite1 = make_sprite(sprite_block.octopus1);
+inline constexpr Sprite alien_death_sprite = make_sprite(sprite_block.alien_death);
+inline constexpr Sprite player_sprite = make_sprite(sprite_block.player);
+inline constexpr Sprite muzzle_flash_sprite = make_sprite(sprite_block.muzzle_flash);
+inline constexpr Sprite projectile_sprite = make_sprite(sprite_block.projectile);
+inline constexpr Sprite shield_erosion_sprite = make_sprite(sprite_block.shield_erosion);
+inline constexpr const Sprite* crab_frames[] = {&alien_sprite, &alien_sprite1};
+inline constexpr const Sprite* squid_frames[] = {&squid_sprite, &squid_sprite1};
+inline constexpr const Sprite* octopus_frames[] = {&octopus_sprite, &octopus_sprite1};
+
+/*
+    Bump allocator for memory that lives exactly as long as something
+    else, like a level. Allocations are zeroed and never freed one by one:
+    destroy_arena() releases them all at once. Blocks are chained rather
+    than grown, so pointers stay valid.
+*/
+#define LEVEL_ARENA_BLOCK 16384
+
+struct ArenaBlock
+{
+    ArenaBlock* next;
+    size_t size, used;
+};
+
+struct Arena
+{
+    ArenaBlock* blocks;
+    size_t block_size;
+    size_t used, high_water;
+};
+
+void init_arena(Arena* arena, size_t block_size);
+void destroy_arena(Arena* arena);
+void* arena_alloc(Arena* arena, size_t size, size_t align);
+
+template<typename T>
+T* arena_array(Arena* arena, size_t count)
+{
+    return count ? static_cast<T*>(arena_alloc(arena, count * sizeof(T), alignof(T))) : 0;
+}
+
+struct SpriteAnimation
+{
+    bool loop;
+    size_t num_frames;
+    float frame_duration;
+    float time;
+    const Sprite* const* frames;
+
+    // Published by advance_animations(), so draw and collision only read them
+    size_t current_frame;
+    const Sprite* current;
+};
+
+// A character the font has no frame for, see font.h
+#define GLYPH_NONE 0xFF
+
+// A story line decoded once at setup, so neither the typing effect nor
+// the HUD decodes the UTF-8 again. 'length' counts characters, which the
+// typing effect reveals one at a time; glyphs[i] is character i's frame
+// of the font and the first n characters end at text[bytes_before[n]].
+struct TextLine
+{
+    const char* text;
+    size_t length;
+    uint8_t* glyphs;
+    uint16_t* bytes_before;
+};
+
+// What a page does once its last line is typed out. PAGE_NEXT,
+// PAGE_COMPLETE and PAGE_TERMINATE wait display_time first.
+enum PageEnd: uint8_t
+{
+    PAGE_NEXT,       // go on to 'next'
+    PAGE_HOLD,       // stay on screen
+    PAGE_CHOICE,     // wait for a shot at YES ('next') or NO ('next_no')
+    PAGE_COMPLETE,   // hide the story and leave the game running
+    PAGE_TERMINATE   // end the game
+};
+
+struct PageFlow
+{
+    PageEnd end;
+    uint8_t next, next_no;
+    float type_speed;
+};
+
+struct TextPage
+{
+    size_t num_lines;
+    const char** lines;
+    float display_time;
+    TextLine* compiled;
+    PageFlow flow;
+};
+
+struct TextAnimation
+{
+    size_t current_page;
+    size_t current_line;
+    size_t chars_visible;
+    float type_speed;
+    bool animation_complete;
+    
+    size_t num_pages;
+    TextPage* pages;  
+};
+
+/*
+    Scripts: timed sequences such as the story written as straight-line
+    code that waits, rather than as a state machine of timers. A script
+    is a function resumed where it last waited, the protothread way: the
+    SCRIPT_ macros turn its body into a switch on Script::resume, so a
+    local does not live across a wait and whatever must is kept in the
+    Script or the state. A running script is then a few plain bytes in
+    the GameState, copied, saved and rolled back with the rest of it,
+    which the heap frames of C++20 coroutines could not be.
+
+    The runner resumes only the scripts whose wait is over. One waiting
+    on time is filed in a list sorted by the tick it wakes on, one
+    waiting on an event in that event's list, and a tick takes the due
+    front of the first plus whatever signal_script() made ready since.
+    A waiting script costs nothing. Script clocks only run while the
+    runner does, so the story pauses while a wave is up.
+*/
+enum ScriptId: uint8_t
+{
+    SCRIPT_STORY,
+    NUM_SCRIPTS
+};
+
+enum ScriptEvent: uint8_t
+{
+    // A shot hit a choice target, the value is CHOICE_YES or CHOICE_NO
+    SCRIPT_EVENT_TARGET_HIT,
+    NUM_SCRIPT_EVENTS
+};
+
+enum ScriptWait: uint8_t
+{
+    SCRIPT_READY,
+    SCRIPT_SECONDS,
+    SCRIPT_EVENT,
+    SCRIPT_DONE
+};
+
+#define CHOICE_YES 0
+#define CHOICE_NO 1
+#define MAX_SCRIPTS 8
+#define SCRIPT_NONE 0xFF
+
+struct Script
+{
+    ScriptId id;
+    ScriptWait wait;
+    // The __LINE__ of the wait to go on from, 0 to start over
+    uint16_t resume;
+    ScriptEvent event;
+    // Set by the event that woke the script
+    uint8_t value;
+    // Next script in the list it waits in
+    uint8_t next;
+    float seconds;
+    uint64_t wake_tick;
+};
+
+struct ScriptRunner
+{
+    // Pooled script frames, unused ones chained from 'free_head'
+    Script slots[MAX_SCRIPTS];
+    uint8_t free_head;
+    uint8_t timed_head;
+    uint8_t event_heads[NUM_SCRIPT_EVENTS];
+    uint8_t ready_head, ready_tail;
+    // Ticks the runner has run
+    uint64_t clock;
+};
+
+#define SCRIPT_BEGIN(script) switch((script)->resume) { case 0:
+#define SCRIPT_WAIT_SECONDS(script, secs) \
+    do { (script)->wait = SCRIPT_SECONDS; (script)->seconds = (secs); (script)->resume = __LINE__; return; case __LINE__:; } while(0)
+#define SCRIPT_WAIT_EVENT(script, ev) \
+    do { (script)->wait = SCRIPT_EVENT; (script)->event = (ev); (script)->resume = __LINE__; return; case __LINE__:; } while(0)
+#define SCRIPT_EXIT(script) do { (script)->wait = SCRIPT_DONE; return; } while(0)
+#define SCRIPT_END(script) } (script)->wait = SCRIPT_DONE
+
+/*
+    Fixed point. Every position and velocity the simulation keeps is in
+    16.16 fixed-point pixels, so a tick is integer adds, multiplies by
+    whole counts, compares and shifts, which give the same bits on every
+    CPU and under every compiler flag: nothing for an FMA to contract,
+    no excess precision, no reassociation. Replays, rollback and
+    spectating between x86 and ARM machines rely on that. Floats are
+    made from positions only for drawing. Timers, like animation frames
+    and effect lifetimes, stay float seconds: a constant subtracted or
+    added once a tick rounds alike everywhere.
+*/
+// Holds any buffer size below 32768 pixels
+typedef int32_t Fixed;
+#define FIXED_SHIFT 16
+#define FIXED_ONE (Fixed(1) << FIXED_SHIFT)
+
+inline constexpr Fixed to_fixed(ptrdiff_t pixels)
+{
+    return (Fixed)((uint32_t)pixels << FIXED_SHIFT);
+}
+
+// Whole pixels, rounded down
+inline constexpr ptrdiff_t fixed_pixels(Fixed value)
+{
+    return value >> FIXED_SHIFT;
+}
+
+// Only for drawing and other output, never fed back into the simulation
+inline float fixed_float(Fixed value)
+{
+    return (float)value / (float)FIXED_ONE;
+}
+
+struct Alien
+{
+    Fixed x, y;
+    uint8_t type;
+    int hp;
+};
+
+struct Player
+{
+    Fixed x, y;
+    Fixed prev_x;
+    size_t life;
+};
+
+/*
+    Archetype storage. Entities of one kind share a set of components and
+    live in an Archetype that keeps each component in a contiguous column
+    of its own, row i of every column belonging to entity i. Systems walk
+    only the columns they read, as dense arrays, so a kind that gains a
+    component costs nothing to the systems that ignore it. Rows stay
+    packed: removing an entity moves the last one into its row, which the
+    caller then visits again. Columns double when full rather than drop
+    an entity, and keep their own storage, except in a fixed archetype:
+    its columns are laid out in a GameState's block at a capacity the
+    game can't exceed, and a full one drops the newcomer.
+
+    Columns are as narrow as the screen allows: x in whole pixels as
+    int16_t and y in 16.16 fixed point, so a shot takes 10 bytes and a
+    kind can move at sub-pixel speeds. Everything of one kind moves alike,
+    so the velocity is the archetype's rather than a column.
+
+    The formation is the one kind whose rows never move; AlienArrays is the
+    same column layout with a live set in place of packed rows.
+*/
+enum ComponentId: uint8_t
+{
+    // Left edge in pixels
+    COMPONENT_X,
+    // Bottom edge in fixed-point pixels
+    COMPONENT_Y,
+    // y before this tick's move, for swept tests and interpolation
+    COMPONENT_PREV_Y,
+    NUM_COMPONENTS
+};
+
+typedef uint32_t ComponentMask;
+#define COMPONENT_BIT(id) (ComponentMask(1) << (id))
+
+struct Archetype
+{
+    ComponentMask components;
+    // Shared by every entity of the kind, which is what render lists draw
+    const Sprite* sprite;
+    // Fixed-point pixels per tick along y, for every entity of the kind
+    Fixed velocity;
+    size_t count, capacity;
+    size_t high_water;
+    bool fixed;
+    void* columns[NUM_COMPONENTS];
+    // One bit a row, set by the last move for each row it left out of
+    // bounds; removing an entity moves its bit with it
+    uint64_t* culled;
+};
+
+template<typename T>
+inline T* archetype_column(const Archetype& archetype, ComponentId id)
+{
+    return static_cast<T*>(archetype.columns[id]);
+}
+
+// Projectiles are one archetype per owner, so each collision pass only
+// walks the shots that can hit its targets
+enum ProjectileOwner
+{
+    PROJECTILE_PLAYER,
+    PROJECTILE_ENEMY,
+    NUM_PROJECTILE_OWNERS
+};
+
+#define PROJECTILE_COMPONENTS \
+    (COMPONENT_BIT(COMPONENT_X) | COMPONENT_BIT(COMPONENT_Y) | COMPONENT_BIT(COMPONENT_PREV_Y))
+
+enum AlienType: uint8_t
+{
+    ALIEN_DEAD    = 0,
+    ALIEN_CRAB    = 1,
+    ALIEN_SQUID   = 2,
+    ALIEN_OCTOPUS = 3,
+    NUM_ALIEN_TYPES
+};
+
+// Every sprite animation, one per alien type
+enum AnimationSlot
+{
+    ANIMATION_CRAB,
+    ANIMATION_SQUID,
+    ANIMATION_OCTOPUS,
+    NUM_ANIMATIONS
+};
+
+/*
+    Alien types. What every alien of a type shares is one row of
+    alien_types, indexed by the type byte, so an alien itself stays a
+    position, a type and its hit points, and the draw and collision loops
+    look the type up instead of branching on it. The hitbox covers every
+    frame of the type's animation. The ALIEN_DEAD row is never drawn or
+    hit; it only keeps any type byte a valid index.
+*/
+struct AlienTypeInfo
+{
+    AnimationSlot animation;
+    const Sprite* const* frames;
+    uint8_t num_frames;
+    uint8_t hp;
+    uint16_t score;
+    uint8_t box_width, box_height;
+};
+
+template<size_t N>
+constexpr AlienTypeInfo alien_type_info(AnimationSlot animation, const Sprite* const (&frames)[N], uint8_t hp, uint16_t score)
+{
+    AlienTypeInfo info{animation, frames, (uint8_t)N, hp, score, 0, 0};
+    for(size_t fi = 0; fi < N; ++fi)
+    {
+        if(frames[fi]->width > info.box_width) info.box_width = (uint8_t)frames[fi]->width;
+        if(frames[fi]->height > info.box_height) info.box_height = (uint8_t)frames[fi]->height;
+    }
+    return info;
+}
+
+inline constexpr AlienTypeInfo alien_types[NUM_ALIEN_TYPES] = {
+    alien_type_info(ANIMATION_CRAB, crab_frames, 0, 0),
+    alien_type_info(ANIMATION_CRAB, crab_frames, 2, 20),
+    alien_type_info(ANIMATION_SQUID, squid_frames, 3, 30),
+    alien_type_info(ANIMATION_OCTOPUS, octopus_frames, 1, 10),
+};
+
+/*
+    Formations are authored as cell art, top row first: '.' leaves a cell
+    empty and 'C', 'S' or 'O' places a crab, squid or octopus. The art
+    is expanded at compile time into the list of occupied cells, so laying
+    a wave out is a straight copy.
+*/
+#define FORMATION_COLUMNS 12
+#define FORMATION_ROWS 6
+#define FORMATION_CELLS (FORMATION_COLUMNS * FORMATION_ROWS)
+#define FORMATION_PITCH_X 16
+#define FORMATION_PITCH_Y 17
+// Bottom-left cell, relative to the design area
+#define FORMATION_LEFT 20
+#define FORMATION_BOTTOM 102
+
+constexpr AlienType formation_alien(char c)
+{
+    return c == 'C' ? ALIEN_CRAB : c == 'S' ? ALIEN_SQUID : c == 'O' ? ALIEN_OCTOPUS : ALIEN_DEAD;
+}
+
+struct Formation
+{
+    size_t count;
+    uint8_t cell[FORMATION_CELLS];
+    uint8_t type[FORMATION_CELLS];
+    Fixed dx[FORMATION_CELLS], dy[FORMATION_CELLS];
+};
+
+constexpr Formation pack_formation(const char (&art)[FORMATION_CELLS + 1])
+{
+    Formation formation{};
+    for(size_t yi = 0; yi < FORMATION_ROWS; ++yi)
+    {
+        for(size_t xi = 0; xi < FORMATION_COLUMNS; ++xi)
+        {
+            AlienType type = formation_alien(art[(FORMATION_ROWS - 1 - yi) * FORMATION_COLUMNS + xi]);
+            if(type == ALIEN_DEAD) continue;
+
+            size_t slot = formation.count++;
+            formation.cell[slot] = (uint8_t)(yi * FORMATION_COLUMNS + xi);
+            formation.type[slot] = type;
+            formation.dx[slot] = to_fixed(FORMATION_PITCH_X * xi + FORMATION_LEFT);
+            formation.dy[slot] = to_fixed(FORMATION_PITCH_Y * yi + FORMATION_BOTTOM);
+        }
+    }
+    return formation;
+}
+
+inline constexpr Formation formation_waves[] = {
+    pack_formation(
+        "CC..C.C..C.C"
+        "CC.CCCCC.C.C"
+        "CC.CCCCC.C.C"
+        "CC.CCCCC.C.C"
+        "CC..CCC..C.C"
+        "CC...C...CCC"
+    ),
+    pack_formation(
+        "SSSSSSSSSSSS"
+        "SSSSSSSSSSSS"
+        "CCCCCCCCCCCC"
+        "CCCCCCCCCCCC"
+        "OOOOOOOOOOOO"
+        "OOOOOOOOOOOO"
+    ),
+    pack_formation(
+        "C.C.C.C.C.C."
+        ".C.C.C.C.C.C"
+        "C.C.C.C.C.C."
+        ".C.C.C.C.C.C"
+        "C.C.C.C.C.C."
+        ".C.C.C.C.C.C"
+    ),
+};
+#define NUM_WAVES (sizeof(formation_waves) / sizeof(formation_waves[0]))
+
+/*
+    Past the authored waves, formations are generated from the wave number
+    and WAVE_SEED alone, so every game, replay and simulation meets the
+    same ones. Rows are octopuses at the bottom, crabs in the middle and
+    squids on top, each row sometimes promoted to the next tougher type,
+    and filled with a pattern mirrored about the middle that grows denser
+    over the first WAVE_RAMP generated waves.
+*/
+#define WAVE_SEED 0x5eed1e55c0ffee00ull
+#define WAVE_RAMP 8
+
+void generate_formation(Formation* formation, size_t wave);
+// The authored formation of 'wave', or one generated into 'generated'
+const Formation& wave_formation(size_t wave, Formation* generated);
+
+/*
+    Stress formations stand in for the authored waves to find where the
+    collision and drawing costs fall over. Any number of aliens is laid
+    out as a generated grid, squeezed vertically until it fits above the
+    player, and a fixed number of player shots is kept in flight. Rows
+    squeezed closer than an alien's box overlap, so a shot's path crosses
+    more of them, but it still only looks at its own column.
+*/
+#define STRESS_MAX_ALIENS (GRID_NONE / 4)
+
+// The screen layout is authored for the original cabinet resolution;
+// larger logical buffers center it and keep edge content at the edges
+#define DESIGN_WIDTH 224
+#define DESIGN_HEIGHT 256
+
+#define PROJECTILE_SPEED 2
+
+// The simulation advances in fixed ticks, however often frames are drawn
+#define SIM_TICK_RATE 60
+#define SIM_DT (1.0 / SIM_TICK_RATE)
+#define NUM_PAGES 4
+
+/*
+    Short-lived effects live in one fixed pool. Lifetimes are in seconds
+    of simulation time, and expired effects are compacted away, so the
+    live ones stay contiguous.
+*/
+#define EFFECT_CAPACITY 64
+
+enum EffectKind: uint8_t
+{
+    EFFECT_ALIEN_DEATH,
+    EFFECT_PLAYER_HIT,
+    EFFECT_MUZZLE_FLASH,
+    NUM_EFFECT_KINDS
+};
+
+inline constexpr const Sprite* effect_sprites[NUM_EFFECT_KINDS] = {
+    &alien_death_sprite, &alien_death_sprite, &muzzle_flash_sprite
+};
+inline constexpr float effect_lifetimes[NUM_EFFECT_KINDS] = {
+    10.0f / SIM_TICK_RATE, 0.25f, 2.0f / SIM_TICK_RATE
+};
+
+struct Effect
+{
+    Fixed x, y;
+    float remaining;
+    EffectKind kind;
+};
+
+struct EffectPool
+{
+    size_t count;
+    size_t dropped;
+    // Every effect ever spawned. New effects are appended, so the ones an
+    // observer hasn't seen yet are always the last of the pool.
+    uint64_t spawned;
+    Effect items[EFFECT_CAPACITY];
+};
+
+// The formation is kept as parallel arrays, so collision only touches
+// positions and never pulls in type or hp
+#define ALIEN_BATCH 8
+
+struct AlienArrays
+{
+    Fixed* x;
+    Fixed* y;
+    uint8_t* type;
+    int* hp;
+
+    // One bit per live alien, cleared at the kill, so scans only visit the
+    // living and the end of a wave is a counter check
+    uint64_t* live;
+    size_t num_words;
+    size_t num_live;
+};
+
+/*
+    Formation march. The block steps MARCH_STEP_X sideways, and at an edge
+    drops MARCH_DROP_Y and turns, every few ticks: MARCH_SLOWEST_TICKS with
+    the wave intact, down to MARCH_FASTEST_TICKS for its last alien. Aliens
+    keep their home positions in AlienArrays and the march is one offset
+    added to all of them, so a step moves nothing but the offset. The
+    edges come from live counts per column and per row, kept with the
+    outermost non-empty column and lowest non-empty row as kills empty
+    them; those indexes only ever move inwards during a wave, so both a
+    step and a kill cost O(1) however large the formation is. Aliens are
+    laid out row-major from the bottom row up, so alien ai sits in column
+    ai % num_columns and row ai / num_columns.
+
+    Return fire comes from the lowest live alien of a column. Each column
+    keeps that alien's row, moved up past the dead at the kill, so picking
+    a shooter reads one entry. Every ENEMY_FIRE_TICKS one shot is fired,
+    at most ENEMY_MAX_SHOTS in flight, alternately from the column above
+    the player and from one picked by the tick; an empty pick goes to the
+    nearest column that still has aliens.
+
+    Player shots use the same entry. A shot only rises, so the first alien
+    it can meet is the lowest live one of the columns under its path; the
+    aliens its path crosses in a tick are read off by column and row from
+    the march's home grid, starting at that row, and a march step moves
+    them all at once through the offset. Each shot then costs the few
+    aliens its path actually reaches, with nothing rebuilt when one dies.
+*/
+#define MARCH_STEP_X 2
+#define MARCH_DROP_Y 8
+#define MARCH_MARGIN 10
+#define MARCH_SLOWEST_TICKS 48
+#define MARCH_FASTEST_TICKS 2
+#define ENEMY_FIRE_TICKS 40
+#define ENEMY_MAX_SHOTS 3
+#define ROW_NONE UINT16_MAX
+
+/*
+    Bullet hell, a torture test of every shot path at once. Instead of one
+    shot every ENEMY_FIRE_TICKS the formation keeps up to the state's
+    bullet_hell shots in flight, falling at a sub-pixel BULLET_HELL_SPEED.
+    Each tick the lowest aliens of the columns fire in turn, as many shots
+    as keep the count level over a fall from the lowest row, each offset
+    from its alien along a triangle wave that drifts with the tick, so the
+    curtain weaves. A configured state starts with its shots already
+    spread over the fall, so the count holds from the first tick.
+*/
+#define BULLET_HELL_SHOTS 12288
+// Fixed-point pixels per tick
+#define BULLET_HELL_SPEED (to_fixed(3) / 4)
+#define BULLET_HELL_SPREAD 24
+
+struct FormationMarch
+{
+    Fixed offset_x, offset_y;
+    int dir;
+    size_t ticks_left, num_start;
+
+    uint16_t* column_live;
+    uint16_t* row_live;
+    // Row of each column's lowest live alien, ROW_NONE once it is empty
+    uint16_t* column_bottom;
+    size_t num_columns, num_rows;
+    size_t first_column, last_column, first_row;
+    // Home position of column 0 and row 0, and the distance between them
+    Fixed column_x, row_y;
+    Fixed pitch_x, pitch_y;
+};
+
+/*
+    Shields. Each bunker is a SHIELD_WIDTH x SHIELD_HEIGHT bitmap, one
+    packed word per row with the bottom row first, which is also the layout
+    of a Sprite: hits on a bunker use the same swept pixel test as every
+    other target. A hit erodes it by shield_erosion_sprite, shifted to the
+    impact and cleared from each row it covers with one AND-NOT, and bumps
+    shield_version. Renderers keep the rows they last drew and compare
+    against them, so only rows a hit changed are rasterized again.
+*/
+#define SHIELD_COUNT 4
+#define SHIELD_WIDTH 22
+#define SHIELD_HEIGHT 16
+#define SHIELD_PITCH 45
+// Leftmost shield's bottom-left corner, relative to the design area
+#define SHIELD_LEFT 33
+#define SHIELD_BOTTOM 52
+
+struct Shield
+{
+    size_t x, y;
+    uint32_t rows[SHIELD_HEIGHT];
+};
+
+inline Sprite shield_sprite(const Shield& shield)
+{
+    return Sprite{SHIELD_WIDTH, SHIELD_HEIGHT, 32, shield.rows};
+}
+
+// In the order a tick visits them; the size is only read at the edges
+struct Game
+{
+    Player player;
+    AlienArrays aliens;
+    size_t num_aliens;
+    Archetype projectiles[NUM_PROJECTILE_OWNERS];
+    size_t width, height;
+};
+
+void init_archetype(Archetype* archetype, ComponentMask components, const Sprite* sprite, size_t capacity);
+void destroy_archetype(Archetype* archetype);
+// Makes 'dst' hold the same entities, growing its columns if it must
+void copy_archetype(Archetype* dst, const Archetype& src);
+// The new entity's row, with every component zeroed; SIZE_MAX when a
+// fixed archetype is full
+size_t spawn_entity(Archetype* archetype);
+void remove_entity(Archetype* archetype, size_t row);
+
+/*
+    Movement kernels. The movement system steps every row of an archetype
+    along y by the kind's velocity in one pass over the y and prev_y
+    columns, and sets the culled bit of each row that ends outside
+    [min_y, max_y); a shot that wraps past the top of the fixed-point
+    range ends negative and is culled all the same. The SIMD kernels move
+    and test four or eight rows at a time and set the same bits as the
+    scalar one. The collision pass that follows drops a culled row when it
+    reaches it, with the same swap-remove as a hit, so survivors are
+    compacted in the order recorded checksums were taken in.
+*/
+extern void (*move_rows)(Fixed* y, Fixed* prev_y, uint64_t* culled, size_t count, Fixed velocity, Fixed min_y, Fixed max_y);
+extern const char* move_kernel_name;
+void init_move_kernels();
+
+// Needs the y and prev_y columns
+void move_entities(Archetype* archetype, Fixed min_y, Fixed max_y);
+
+inline bool entity_culled(const Archetype& archetype, size_t row)
+{
+    return (archetype.culled[row / 64] >> (row % 64)) & 1;
+}
+
+// Moves at the archetype's velocity
+size_t spawn_projectile(Archetype* projectiles, size_t x, size_t y);
+void print_projectile_stats(const Game& game);
+
+void init_alien_arrays(AlienArrays* aliens, Arena* arena, size_t count);
+void copy_alien_arrays(AlienArrays* dst, const AlienArrays& src, size_t count);
+void reset_alien_live_set(AlienArrays* aliens, size_t count);
+void kill_alien(AlienArrays* aliens, size_t ai);
+
+inline bool alien_is_live(const AlienArrays& aliens, size_t ai)
+{
+    return (aliens.live[ai / 64] >> (ai % 64)) & 1;
+}
+
+
+bool sprite_overlap_check(
+    const Sprite& sp_a, size_t x_a, size_t y_a,
+    const Sprite& sp_b, size_t x_b, size_t y_b
+);
+bool sprite_pixel_overlap_check(
+    const Sprite& sp_a, size_t x_a, size_t y_a,
+    const Sprite& sp_b, size_t x_b, size_t y_b
+);
+
+/*
+    Swept test for a sprite moving straight up or down between ticks. The
+    box around the whole path rejects misses; otherwise only the positions
+    whose box touches the target get the exact test, in travel order, so
+    fast movers cannot step over a target between ticks.
+*/
+#define SWEEP_MISS SIZE_MAX
+
+size_t sprite_sweep_distance(
+    const Sprite& mover, size_t x, size_t y_from, size_t y_to,
+    const Sprite& target, size_t x_t, size_t y_t
+);
+
+/*
+    Uniform grid over axis-aligned boxes. An item is linked into every cell
+    its box touches, so a query only visits items near its own box. Boxes
+    are clamped to the grid edges, which keeps lookups exact for items that
+    stray outside it. Anything no larger than a cell touches at most four.
+    The formation has no need of it, its aliens sit on the march's columns
+    and rows; it is for boxes that move freely.
+*/
+#define GRID_NONE UINT16_MAX
+
+struct GridEntry
+{
+    uint16_t item;
+    uint16_t next;
+};
+
+struct SpatialGrid
+{
+    ptrdiff_t origin_x, origin_y;
+    size_t cell_width, cell_height;
+    size_t columns, rows;
+    size_t max_items;
+    uint16_t* cells;
+    GridEntry* entries;
+    size_t num_entries, max_entries;
+
+    // Items seen by the current query, so one spanning cells is reported once
+    uint32_t* stamps;
+    uint32_t query;
+    uint16_t* results;
+};
+
+// Sets the grid's geometry; the owner lays out its arrays
+void init_spatial_grid(
+    SpatialGrid* grid, ptrdiff_t origin_x, ptrdiff_t origin_y,
+    size_t cell_width, size_t cell_height, size_t columns, size_t rows, size_t max_items
+);
+void clear_spatial_grid(SpatialGrid* grid);
+bool insert_spatial_grid(SpatialGrid* grid, size_t item, ptrdiff_t x, ptrdiff_t y, size_t width, size_t height);
+size_t query_spatial_grid(SpatialGrid* grid, ptrdiff_t x, ptrdiff_t y, size_t width, size_t height);
+
+/*
+    Batched overlap kernels. One query box is tested against up to
+    ALIEN_BATCH aliens picked by index, reading only their positions, and
+    bit i of the result is set when item i overlaps. The box is given as the
+    open range an alien's corner must fall in, so each lane is four integer
+    compares, and every kernel finds the same hits.
+*/
+struct OverlapRange
+{
+    Fixed min_x, max_x;
+    Fixed min_y, max_y;
+};
+
+// The range of alien corners whose width x height box overlaps the query box
+inline OverlapRange overlap_range(Fixed x, Fixed y, size_t width, size_t height, size_t alien_width, size_t alien_height)
+{
+    return OverlapRange{x - to_fixed(alien_width), x + to_fixed(width), y - to_fixed(alien_height), y + to_fixed(height)};
+}
+
+extern uint32_t (*overlap_mask)(const AlienArrays& aliens, const uint16_t* items, size_t count, const OverlapRange& range);
+extern const char* overlap_kernel_name;
+void init_overlap_kernels();
+
+/*
+    Hit events. The player-shot pass only finds hits: for each it records
+    the alien, its type and whether the hit killed it into the tick's
+    event buffer, and changes no more of the alien than later shots of
+    the same tick must see, a hit point less or its type set dead, so a
+    second shot passes through an alien the first one killed. Everything
+    else a hit sets off is a pass of its own over the buffer, in the
+    order the hits were found: the live set and the march's counts, then
+    the score, the death effects and the sound. A shot hits at most once,
+    so the buffer holds as many events as the player can have shots.
+*/
+struct HitEvent
+{
+    uint16_t alien;
+    uint8_t type;
+    bool killed;
+};
+
+/*
+################################################
+##                 GAME STATE                 ##
+################################################
+*/
+
+/*
+    State block. Every array a tick reads or writes lives in one
+    contiguous allocation the state owns: the formation arrays, the march
+    counts and the projectile columns. Shots get a fixed
+    capacity play can't fill, as one is fired a tick at most and each
+    leaves the screen within height / PROJECTILE_SPEED ticks. Everything
+    else a tick touches is held inline and GameState is trivially
+    copyable, so the struct and its block are the whole simulation:
+    copy_game_state() copies both with two memcpys, then points the
+    copy's arrays into its own block. Story pages and prepared waves are
+    only read, and stay in the level arena the copies share.
+
+    The struct itself is laid out hot to cold. Each group a tick steps
+    through starts a cache line of its own, in the order step_game()
+    visits them: the player, shots and counters, the effects, the
+    animations, the march and the shields. A tick during a wave pulls in
+    those lines and none of the story, the scripts or the arena and block
+    headers, which come after them all.
+*/
+struct StateBlock
+{
+    uint8_t* data;
+    size_t size;
+};
+
+// What the player does during one tick
+struct GameInput
+{
+    int move_dir;
+    bool fire;
+};
+
+enum GameSound: uint8_t
+{
+    GAME_SOUND_SHOT,
+    GAME_SOUND_ALIEN_DEATH,
+    GAME_SOUND_PLAYER_HIT,
+    GAME_SOUND_MARCH,
+    NUM_GAME_SOUNDS
+};
+
+struct GameState
+{
+    // What every tick reads first, in the order step_game() gets to it
+    alignas(64) uint64_t tick;
+    Game game;
+    bool still_alive;
+    // Cleared when the story ends the game
+    bool running;
+    // GAME_SOUND_ bits of what stepping set off, for the frame loop to
+    // play and clear. Not part of the checksum.
+    uint32_t sounds;
+    size_t score;
+    // Pixels a tick at full tilt
+    Fixed player_speed;
+    // Player shots fired and those that hit an alien, for the score log.
+    // Not part of the checksum.
+    size_t shots_fired, shots_hit;
+    // Generated formation size and shots kept in flight, 0 for the real game
+    size_t stress_aliens, stress_shots;
+    // Alien shots kept in flight by bullet hell, 0 for the real game
+    size_t bullet_hell;
+
+    // Only the live effects at the front of the pool are touched
+    alignas(64) EffectPool effects;
+
+    // Every sprite animation, advanced together once per tick
+    alignas(64) SpriteAnimation animations[NUM_ANIMATIONS];
+
+    alignas(64) FormationMarch march;
+    // One box covers every type's hitbox
+    size_t alien_box_width, alien_box_height;
+    // Bumped whenever the formation changes, so renderers know to redraw it
+    uint32_t formation_version;
+    // This tick's hits on the formation, in the order they were found
+    HitEvent* hits;
+    size_t num_hits;
+
+    // The stress formation fills the screen and plays without shields
+    alignas(64) Shield shields[SHIELD_COUNT];
+    size_t num_shields;
+    uint32_t shield_version;
+
+    // Cold: the story, which only runs between waves, and what setup and
+    // ownership need
+    alignas(64) TextAnimation msg_animation;
+    ScriptRunner scripts;
+    // The YES/NO targets of the choice page
+    bool choice_phase;
+    Alien yes_alien, no_alien;
+    // Index into formation_waves[] of the wave reset_formation() lays out
+    size_t wave;
+    size_t layout_x, layout_y;
+    // Owns the story pages and prepared waves, released together with the
+    // block by destroy_game_state()
+    Arena level;
+    StateBlock block;
+};
+static_assert(std::is_trivially_copyable<GameState>::value, "a state and its block are copied as bytes");
+
+void spawn_effect(EffectPool* pool, EffectKind kind, Fixed x, Fixed y);
+void update_effects(EffectPool* pool, double dt);
+void advance_animations(SpriteAnimation* animations, size_t count, double dt);
+void compile_text_page(TextPage* page, Arena* arena);
+void init_script_runner(ScriptRunner* runner);
+// False when every slot is taken
+bool start_script(ScriptRunner* runner, ScriptId id);
+// Readies every script waiting on 'event', to resume on the next run
+void signal_script(ScriptRunner* runner, ScriptEvent event, uint8_t value);
+// Advances the script clock a tick of 'dt' and resumes what is due
+void run_scripts(GameState* state, double dt);
+void init_game_state(GameState* state, size_t width, size_t height);
+void destroy_game_state(GameState* state);
+// 'block' holds src.block.size bytes; the copy shares src's level arena
+void copy_game_state(GameState* dst, uint8_t* block, const GameState& src);
+void reset_formation(GameState* state);
+void lay_out_formation(AlienArrays* aliens, size_t num_aliens, const Formation& formation, size_t layout_x, size_t layout_y);
+void configure_stress(GameState* state, size_t num_aliens, size_t num_shots);
+// Resizes the aliens' shot columns, so like configure_stress() it lays
+// the block out again; 0 goes back to the real game's fire
+void configure_bullet_hell(GameState* state, size_t num_shots);
+
+/*
+    A wave laid out ahead of time into arrays of its own, exactly as
+    reset_formation() would lay it out in place. Starting it copies those
+    arrays into the state's block, a few hundred bytes, so nothing is
+    laid out or allocated at the transition. Only the
+    authored formation size can be prepared, stress formations cannot.
+*/
+struct PreparedWave
+{
+    size_t wave;
+    AlienArrays aliens;
+};
+
+void init_prepared_wave(PreparedWave* prepared, GameState* state);
+// Touches nothing but 'prepared', so it may run on another thread
+void prepare_wave(PreparedWave* prepared, size_t wave, size_t layout_x, size_t layout_y);
+void start_prepared_wave(GameState* state, PreparedWave* prepared);
+/*
+    Saved states, for rolling the simulation back: a copy of the state
+    into a block of the saved state's own, and back again into the live
+    block on restore, keeping the live level arena. Neither allocates
+    unless configure_stress() changed the block's size in between.
+*/
+struct SavedState
+{
+    GameState state;
+    uint8_t* block;
+    size_t capacity;
+};
+
+void init_saved_state(SavedState* saved, const GameState& state);
+void destroy_saved_state(SavedState* saved);
+// Returns the bytes copied
+size_t save_game_state(SavedState* saved, const GameState& state);
+void restore_game_state(GameState* state, const SavedState& saved);
+// Restores a state saved by another run of the program, whose pointers
+// mean nothing here: 'state' has to have been set up by init_game_state()
+// at the same size, and keeps its arena, its block and the sprites and
+// story pages it points at, taking everything else from 'image' and
+// 'block'. False when the image doesn't fit 'state'.
+bool load_game_state(GameState* state, const GameState& image, const uint8_t* block);
+
+void march_remove_alien(FormationMarch* march, const AlienArrays& aliens, size_t ai);
+void step_march(GameState* state);
+// Ticks between steps with 'num_live' aliens left
+size_t march_period(const FormationMarch& march, size_t num_live);
+// The nearest column to 'column' that still has a live alien; the
+// formation must have one
+size_t nearest_firing_column(const FormationMarch& march, size_t column);
+void step_enemy_fire(GameState* state);
+void reset_shields(GameState* state);
+bool hit_shields(GameState* state, size_t x, size_t prev_y, size_t y, int velocity);
+void step_player_shots(GameState* state);
+void step_enemy_shots(GameState* state);
+void step_game(GameState* state, const GameInput& input, double dt);
+// What a bot does this tick; the seed picks which aliens it goes after
+GameInput bot_input(const GameState& state, size_t seed);
+bool game_is_idle(const GameState& state);
+uint64_t game_state_checksum(const GameState& state);
+
+/*
+    Per-tick state hash, to pinpoint the tick two runs part ways at. It
+    is XXH64 over the state block, every array the simulation steps, in
+    one pass, seeded with the scalars that sit beside the block in the
+    GameState. Those are gathered as 64-bit words, so neither padding nor
+    pointers reach the hash: a state hashes the same in every run of the
+    same build, after a restore or a keyframe load. Unlike the checksum,
+    which only covers what is drawn and is compared once at the end, it
+    covers everything a tick reads, in well under a microsecond.
+*/
+uint64_t game_state_hash(const GameState& state);
+
+
+#endif
@@ -0,0 +1,128 @@
+#include <cstdio>
+#include <cstring>
+#include "gl_loader.h"
+
+#define GL_LOADER_DEFINE(type, name) type glad_##name = 0;
+GL_LOADER_FUNCTIONS(GL_LOADER_DEFINE)
+#undef GL_LOADER_DEFINE
+
+PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary = 0;
+PFNGLPROGRAMBINARYPROC glad_glProgramBinary = 0;
+PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri = 0;
+PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute = 0;
+PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture = 0;
+PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier = 0;
+PFNGLGETINTERNALFORMATIVPROC glad_glGetInternalformativ = 0;
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage = 0;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = 0;
+// Declared by the glad header, which covers 3.3
+PFNGLGENQUERIESPROC glad_glGenQueries = 0;
+PFNGLDELETEQUERIESPROC glad_glDeleteQueries = 0;
+PFNGLBEGINQUERYPROC glad_glBeginQuery = 0;
+PFNGLENDQUERYPROC glad_glEndQuery = 0;
+PFNGLQUERYCOUNTERPROC glad_glQueryCounter = 0;
+PFNGLGETQUERYOBJECTIVPROC glad_glGetQueryObjectiv = 0;
+PFNGLGETQUERYOBJECTUI64VPROC glad_glGetQueryObjectui64v = 0;
+PFNGLGETINTEGER64VPROC glad_glGetInteger64v = 0;
+
+GLCaps gl_caps = {};
+
+// Only called for the handful of extensions that stand in for a core version
+static bool has_gl_extension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(GLint i = 0; i < count; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if(extension && !strcmp(extension, name)) return true;
+    }
+    return false;
+}
+
+bool load_gl(GLADloadfunc load)
+{
+    gl_caps = GLCaps{};
+
+#define GL_LOADER_RESOLVE(type, name) \
+    glad_##name = (type)load(#name); \
+    if(!glad_##name) \
+    { \
+        fprintf(stderr, "Missing GL entry point %s.\n", #name); \
+        return false; \
+    } \
+    ++gl_caps.num_functions;
+    GL_LOADER_FUNCTIONS(GL_LOADER_RESOLVE)
+#undef GL_LOADER_RESOLVE
+
+    glGetIntegerv(GL_MAJOR_VERSION, &gl_caps.major);
+    glGetIntegerv(GL_MINOR_VERSION, &gl_caps.minor);
+    int version = gl_caps.major * 10 + gl_caps.minor;
+    if(version < 33)
+    {
+        fprintf(stderr, "OpenGL %d.%d is older than 3.3.\n", gl_caps.major, gl_caps.minor);
+        return false;
+    }
+
+    // Resolved only when the version or extension promises them
+    if(version >= 41 || has_gl_extension("GL_ARB_get_program_binary"))
+    {
+        glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+        glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+        glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+        gl_caps.program_binary = glad_glGetProgramBinary && glad_glProgramBinary && glad_glProgramParameteri;
+        gl_caps.num_functions += gl_caps.program_binary ? 3 : 0;
+    }
+    if(version >= 43 || has_gl_extension("GL_ARB_internalformat_query2"))
+    {
+        glad_glGetInternalformativ = (PFNGLGETINTERNALFORMATIVPROC)load("glGetInternalformativ");
+        gl_caps.internalformat_query = glad_glGetInternalformativ != 0;
+        gl_caps.num_functions += gl_caps.internalformat_query;
+    }
+    if(version >= 43)
+    {
+        glad_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)load("glDispatchCompute");
+        glad_glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)load("glBindImageTexture");
+        glad_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)load("glMemoryBarrier");
+        gl_caps.compute = glad_glDispatchCompute && glad_glBindImageTexture && glad_glMemoryBarrier;
+        gl_caps.num_functions += gl_caps.compute ? 3 : 0;
+    }
+    if(version >= 44 || has_gl_extension("GL_ARB_buffer_storage"))
+    {
+        glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+        gl_caps.buffer_storage = glad_glBufferStorage != 0;
+        gl_caps.num_functions += gl_caps.buffer_storage;
+    }
+    if(has_gl_extension("GL_KHR_parallel_shader_compile"))
+    {
+        glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+        gl_caps.parallel_shader_compile = true;
+    }
+    else if(has_gl_extension("GL_ARB_parallel_shader_compile"))
+    {
+        glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+        gl_caps.parallel_shader_compile = true;
+    }
+    if(glad_glMaxShaderCompilerThreadsKHR)
+    {
+        // As many threads as the driver likes; some start with none
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+        ++gl_caps.num_functions;
+    }
+    gl_caps.rgb565 = version >= 41 || has_gl_extension("GL_ARB_ES2_compatibility");
+#ifndef SPACE_INVADERS_GLES
+    // Core in desktop 3.3; ES only has them as EXT_disjoint_timer_query
+    glad_glGenQueries = (PFNGLGENQUERIESPROC)load("glGenQueries");
+    glad_glDeleteQueries = (PFNGLDELETEQUERIESPROC)load("glDeleteQueries");
+    glad_glBeginQuery = (PFNGLBEGINQUERYPROC)load("glBeginQuery");
+    glad_glEndQuery = (PFNGLENDQUERYPROC)load("glEndQuery");
+    glad_glQueryCounter = (PFNGLQUERYCOUNTERPROC)load("glQueryCounter");
+    glad_glGetQueryObjectiv = (PFNGLGETQUERYOBJECTIVPROC)load("glGetQueryObjectiv");
+    glad_glGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)load("glGetQueryObjectui64v");
+    glad_glGetInteger64v = (PFNGLGETINTEGER64VPROC)load("glGetInteger64v");
+    gl_caps.timer_query = glad_glGenQueries && glad_glDeleteQueries && glad_glBeginQuery && glad_glEndQuery &&
+        glad_glQueryCounter && glad_glGetQueryObjectiv && glad_glGetQueryObjectui64v && glad_glGetInteger64v;
+    gl_caps.num_functions += gl_caps.timer_query ? 8 : 0;
+#endif
+    return true;
+}
@@ -0,0 +1,267 @@
+#include <thread>
+#include "jobs.h"
+#include "threads.h"
+#include "trace.h"
+
+/*
+################################################
+##                WORKER POOL                 ##
+################################################
+*/
+
+// Idle workers look this many times before they sleep
+#define JOB_SPIN_ROUNDS 32
+
+// What a counter's waiting list becomes once it has reached zero
+static Job jobs_done;
+
+static thread_local const ThreadPool* job_thread_pool = 0;
+static thread_local size_t job_thread_index = 0;
+
+// Threads outside the pool submit as thread 0
+static size_t job_thread(const ThreadPool* pool)
+{
+    return job_thread_pool == pool ? job_thread_index : 0;
+}
+
+static Job* allocate_job(ThreadPool* pool, size_t thread)
+{
+    JobDeque& deque = pool->deques[thread];
+    return &deque.ring[deque.ring_next++ % JOB_RING_CAPACITY];
+}
+
+// Owner only. False when the deque is full.
+static bool push_deque(JobDeque* deque, Job* job)
+{
+    int64_t bottom = deque->bottom.load(std::memory_order_relaxed);
+    int64_t top = deque->top.load(std::memory_order_acquire);
+    if(bottom - top >= JOB_DEQUE_CAPACITY) return false;
+    deque->jobs[bottom % JOB_DEQUE_CAPACITY].store(job, std::memory_order_relaxed);
+    deque->bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+// Owner only, newest first
+static Job* pop_deque(JobDeque* deque)
+{
+    int64_t bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+    deque->bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = deque->top.load(std::memory_order_relaxed);
+    if(top > bottom)
+    {
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    Job* job = deque->jobs[bottom % JOB_DEQUE_CAPACITY].load(std::memory_order_relaxed);
+    if(top == bottom)
+    {
+        // The last job, which a thief may be taking too
+        if(!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) job = 0;
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+// Any thread, oldest first. 0 when empty or another thread won the race.
+static Job* steal_deque(JobDeque* deque)
+{
+    int64_t top = deque->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = deque->bottom.load(std::memory_order_acquire);
+    if(top >= bottom) return 0;
+
+    Job* job = deque->jobs[top % JOB_DEQUE_CAPACITY].load(std::memory_order_relaxed);
+    if(!deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return 0;
+    return job;
+}
+
+static void execute_job(ThreadPool* pool, size_t thread, Job* job);
+
+static void push_job(ThreadPool* pool, size_t thread, Job* job)
+{
+    if(!push_deque(&pool->deques[thread], job))
+    {
+        execute_job(pool, thread, job);
+        return;
+    }
+    // Pairs with the sleeping worker's check of 'pushes'
+    pool->pushes.fetch_add(1);
+    if(pool->sleeping.load())
+    {
+        { std::lock_guard<std::mutex> lock(pool->mutex); }
+        pool->wake.notify_one();
+    }
+}
+
+static Job* find_job(ThreadPool* pool, size_t thread)
+{
+    if(Job* job = pop_deque(&pool->deques[thread])) return job;
+    size_t num_threads = pool->num_workers + 1;
+    for(size_t i = 1; i < num_threads; ++i)
+    {
+        if(Job* job = steal_deque(&pool->deques[(thread + i) % num_threads])) return job;
+    }
+    return 0;
+}
+
+static void finish_job(ThreadPool* pool, size_t thread, JobCounter* counter)
+{
+    if(counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    // The last access to the counter, a waiter may free it right after
+    Job* waiting = counter->waiting.exchange(&jobs_done, std::memory_order_acq_rel);
+    while(waiting)
+    {
+        Job* next = waiting->next;
+        push_job(pool, thread, waiting);
+        waiting = next;
+    }
+}
+
+static void execute_job(ThreadPool* pool, size_t thread, Job* job)
+{
+    // The upper half of a range goes to the deque for idle threads to
+    // steal, until one task is left to run here
+    while(job->count > 1)
+    {
+        size_t half = job->count / 2;
+        Job* upper = allocate_job(pool, thread);
+        *upper = *job;
+        upper->task = job->task + half;
+        upper->count = job->count - half;
+        upper->next = 0;
+        job->done->pending.fetch_add(1, std::memory_order_relaxed);
+        job->count = half;
+        push_job(pool, thread, upper);
+    }
+
+    {
+        TRACE_SCOPE("job");
+        job->run(job->context, job->task);
+    }
+    if(job->done) finish_job(pool, thread, job->done);
+}
+
+static void job_worker(ThreadPool* pool, size_t thread)
+{
+    TRACE_THREAD("worker");
+    enter_thread_role(THREAD_WORKER);
+    job_thread_pool = pool;
+    job_thread_index = thread;
+    while(!pool->quit.load(std::memory_order_acquire))
+    {
+        uint64_t seen = pool->pushes.load();
+        Job* job = 0;
+        for(size_t round = 0; !job && round < JOB_SPIN_ROUNDS; ++round)
+        {
+            job = find_job(pool, thread);
+            if(!job) std::this_thread::yield();
+        }
+        if(job)
+        {
+            execute_job(pool, thread, job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->sleeping.fetch_add(1);
+        while(!pool->quit.load() && pool->pushes.load() == seen) pool->wake.wait(lock);
+        pool->sleeping.fetch_sub(1);
+    }
+}
+
+// 'num_threads' counts the calling thread, 0 means one per core
+void init_thread_pool(ThreadPool* pool, size_t num_threads)
+{
+    if(num_threads == 0) num_threads = std::thread::hardware_concurrency();
+    if(num_threads == 0) num_threads = 1;
+
+    pool->num_workers = num_threads - 1;
+    pool->deques = new JobDeque[num_threads];
+    for(size_t i = 0; i < num_threads; ++i)
+    {
+        pool->deques[i].top = 0;
+        pool->deques[i].bottom = 0;
+        pool->deques[i].ring_next = 0;
+    }
+    pool->pushes = 0;
+    pool->sleeping = 0;
+    pool->quit = false;
+
+    pool->workers = pool->num_workers ? new std::thread[pool->num_workers] : 0;
+    for(size_t i = 0; i < pool->num_workers; ++i)
+    {
+        pool->workers[i] = std::thread(job_worker, pool, i + 1);
+    }
+}
+
+void destroy_thread_pool(ThreadPool* pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+
+    for(size_t i = 0; i < pool->num_workers; ++i)
+    {
+        pool->workers[i].join();
+    }
+    delete[] pool->workers;
+    delete[] pool->deques;
+    pool->workers = 0;
+    pool->deques = 0;
+    pool->num_workers = 0;
+}
+
+void init_job_counter(JobCounter* counter, size_t pending)
+{
+    counter->pending = pending;
+    counter->waiting = pending ? 0 : &jobs_done;
+}
+
+void submit_job(ThreadPool* pool, void (*run)(void*, size_t), void* context, size_t task, JobCounter* done, JobCounter* after)
+{
+    size_t thread = job_thread(pool);
+    Job* job = allocate_job(pool, thread);
+    *job = Job{run, context, task, 1, done, 0};
+    if(after)
+    {
+        Job* head = after->waiting.load(std::memory_order_acquire);
+        while(head != &jobs_done)
+        {
+            job->next = head;
+            if(after->waiting.compare_exchange_weak(head, job, std::memory_order_acq_rel, std::memory_order_acquire)) return;
+        }
+        job->next = 0;
+    }
+    push_job(pool, thread, job);
+}
+
+void wait_for_jobs(ThreadPool* pool, JobCounter* counter)
+{
+    size_t thread = job_thread(pool);
+    while(counter->waiting.load(std::memory_order_acquire) != &jobs_done)
+    {
+        if(Job* job = find_job(pool, thread)) execute_job(pool, thread, job);
+        else std::this_thread::yield();
+    }
+}
+
+void run_parallel(ThreadPool* pool, void (*job)(void*, size_t), void* context, size_t num_tasks)
+{
+    if(!pool || pool->num_workers == 0 || num_tasks < 2)
+    {
+        for(size_t task = 0; task < num_tasks; ++task) job(context, task);
+        return;
+    }
+
+    JobCounter counter;
+    init_job_counter(&counter, 1);
+    size_t thread = job_thread(pool);
+    Job* range = allocate_job(pool, thread);
+    *range = Job{job, context, 0, num_tasks, &counter, 0};
+    push_job(pool, thread, range);
+    wait_for_jobs(pool, &counter);
+}
@@ -0,0 +1,93 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+/*
+    Job system. Every thread of the pool, the one that created it counted
+    as thread 0, owns a Chase-Lev deque of jobs: it pushes and pops at the
+    bottom without locking, while threads that run dry steal from the top
+    of the others' with a compare-and-swap. A job counts down a JobCounter
+    when it is done, and may be held back until another counter reaches
+    zero, which is all the dependencies there are. Waiting for a counter
+    runs jobs meanwhile instead of blocking, so the waiting thread is one
+    more worker. Workers with nothing to steal sleep until the next push.
+
+    run_parallel() is a parallel for on top: it pushes one job for the
+    whole range, and whoever runs a range of more than one task pushes its
+    upper half for someone to steal and goes on with the lower. Jobs are
+    submitted from thread 0 and from jobs, never from two outside threads
+    of the same pool at once.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define JOB_DEQUE_CAPACITY 1024
+// Jobs each thread allocates from a ring; one is reused once this many
+// later ones were allocated, long after it ran
+#define JOB_RING_CAPACITY 4096
+
+struct JobCounter;
+
+struct Job
+{
+    void (*run)(void* context, size_t task);
+    void* context;
+    // Tasks [task, task + count) of a run_parallel() range
+    size_t task, count;
+    JobCounter* done;
+    // Next job held back by the same counter
+    Job* next;
+};
+
+struct JobCounter
+{
+    std::atomic<size_t> pending;
+    // Jobs held back until 'pending' is zero, pushed by the job that
+    // brings it there, which then leaves a marker that it is done with
+    // the counter
+    std::atomic<Job*> waiting;
+};
+
+struct JobDeque
+{
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+    std::atomic<Job*> jobs[JOB_DEQUE_CAPACITY];
+
+    Job ring[JOB_RING_CAPACITY];
+    size_t ring_next;
+};
+
+struct ThreadPool
+{
+    size_t num_workers;
+    std::thread* workers;
+    // One per thread, thread 0's first
+    JobDeque* deques;
+
+    // Bumped by every push; workers only sleep if it held still while
+    // they looked for work
+    std::atomic<uint64_t> pushes;
+    std::atomic<size_t> sleeping;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> quit;
+};
+
+void init_thread_pool(ThreadPool* pool, size_t num_threads);
+void destroy_thread_pool(ThreadPool* pool);
+void run_parallel(ThreadPool* pool, void (*job)(void*, size_t), void* context, size_t num_tasks);
+
+// 'counter' starts at the number of jobs that will count it down
+void init_job_counter(JobCounter* counter, size_t pending);
+// Runs job(context, task) once 'after' is zero, or right away for 0,
+// then counts 'done' down if given
+void submit_job(ThreadPool* pool, void (*job)(void*, size_t), void* context, size_t task, JobCounter* done, JobCounter* after);
+// Runs jobs until 'counter' is zero
+void wait_for_jobs(ThreadPool* pool, JobCounter* counter);
+
+#endif
@@ -0,0 +1,321 @@
+#include <cstdio>
+#include <cstring>
+#include "kms_present.h"
+
+#ifdef SPACE_INVADERS_KMS
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#define KMS_BUFFERS 2
+#define KMS_MAX_CARDS 4
+// A flip the driver never completes, say after a VT switch, stops
+// blocking the game after this long
+#define KMS_FLIP_TIMEOUT_MS 100
+
+struct KmsBuffer
+{
+    uint32_t handle, pitch, fb;
+    size_t size;
+    uint8_t* pixels;
+};
+
+struct KmsPresenter
+{
+    int fd;
+    uint32_t connector, crtc;
+    drmModeModeInfo mode;
+    // What the CRTC showed before, put back on exit
+    drmModeCrtc* saved_crtc;
+
+    KmsBuffer buffers[KMS_BUFFERS];
+    size_t back;
+    bool flip_pending;
+    bool async_flips;
+    bool vsync;
+
+    uint32_t width, height;
+    uint32_t scale, left, top;
+    // Rectangles the front buffer got that the back one still lacks
+    Rect staged[2 * BUFFER_MAX_DIRTY];
+    size_t num_staged;
+    // The back buffer was copied into since the last flip
+    bool copied;
+    // Buffers still to get the whole frame, they start out black
+    size_t blank_buffers;
+};
+
+static void flip_done(int, unsigned int, unsigned int, unsigned int, void* data)
+{
+    static_cast<KmsPresenter*>(data)->flip_pending = false;
+}
+
+static void wait_for_flip(KmsPresenter* kms)
+{
+    drmEventContext events = {};
+    events.version = 2;
+    events.page_flip_handler = flip_done;
+    while(kms->flip_pending)
+    {
+        pollfd fd = {kms->fd, POLLIN, 0};
+        if(poll(&fd, 1, KMS_FLIP_TIMEOUT_MS) <= 0 || drmHandleEvent(kms->fd, &events) != 0)
+        {
+            kms->flip_pending = false;
+        }
+    }
+}
+
+static bool create_dumb_buffer(KmsPresenter* kms, KmsBuffer* buffer)
+{
+    drm_mode_create_dumb create = {};
+    create.width = kms->mode.hdisplay;
+    create.height = kms->mode.vdisplay;
+    create.bpp = 32;
+    if(drmIoctl(kms->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) return false;
+    buffer->handle = create.handle;
+    buffer->pitch = create.pitch;
+    buffer->size = create.size;
+
+    if(drmModeAddFB(kms->fd, create.width, create.height, 24, 32, create.pitch, create.handle, &buffer->fb)) return false;
+
+    drm_mode_map_dumb map = {};
+    map.handle = create.handle;
+    if(drmIoctl(kms->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) return false;
+    void* pixels = mmap(0, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, kms->fd, (off_t)map.offset);
+    if(pixels == MAP_FAILED) return false;
+    buffer->pixels = static_cast<uint8_t*>(pixels);
+    // Black borders around the centered frame
+    memset(buffer->pixels, 0, buffer->size);
+    return true;
+}
+
+static void destroy_dumb_buffer(KmsPresenter* kms, KmsBuffer* buffer)
+{
+    if(buffer->pixels) munmap(buffer->pixels, buffer->size);
+    if(buffer->fb) drmModeRmFB(kms->fd, buffer->fb);
+    if(buffer->handle)
+    {
+        drm_mode_destroy_dumb destroy = {};
+        destroy.handle = buffer->handle;
+        drmIoctl(kms->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+}
+
+// The first connected connector, its preferred mode and a CRTC one of
+// its encoders can drive
+static bool pick_output(KmsPresenter* kms)
+{
+    drmModeRes* resources = drmModeGetResources(kms->fd);
+    if(!resources) return false;
+
+    bool found = false;
+    for(int ci = 0; ci < resources->count_connectors && !found; ++ci)
+    {
+        drmModeConnector* connector = drmModeGetConnector(kms->fd, resources->connectors[ci]);
+        if(!connector) continue;
+        if(connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+        {
+            kms->mode = connector->modes[0];
+            for(int mi = 0; mi < connector->count_modes; ++mi)
+            {
+                if(connector->modes[mi].type & DRM_MODE_TYPE_PREFERRED)
+                {
+                    kms->mode = connector->modes[mi];
+                    break;
+                }
+            }
+            for(int ei = 0; ei < connector->count_encoders && !found; ++ei)
+            {
+                drmModeEncoder* encoder = drmModeGetEncoder(kms->fd, connector->encoders[ei]);
+                if(!encoder) continue;
+                for(int ri = 0; ri < resources->count_crtcs && !found; ++ri)
+                {
+                    if(!(encoder->possible_crtcs & (1u << ri))) continue;
+                    kms->connector = connector->connector_id;
+                    kms->crtc = resources->crtcs[ri];
+                    found = true;
+                }
+                drmModeFreeEncoder(encoder);
+            }
+        }
+        drmModeFreeConnector(connector);
+    }
+    drmModeFreeResources(resources);
+    return found;
+}
+
+static bool open_card(KmsPresenter* kms)
+{
+    for(int card = 0; card < KMS_MAX_CARDS; ++card)
+    {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/dri/card%d", card);
+        kms->fd = open(path, O_RDWR | O_CLOEXEC);
+        if(kms->fd < 0) continue;
+
+        uint64_t dumb = 0;
+        if(drmGetCap(kms->fd, DRM_CAP_DUMB_BUFFER, &dumb) == 0 && dumb && pick_output(kms))
+        {
+            printf("KMS: %s, %ux%u@%u\n", path, kms->mode.hdisplay, kms->mode.vdisplay, kms->mode.vrefresh);
+            return true;
+        }
+        close(kms->fd);
+        kms->fd = -1;
+    }
+    return false;
+}
+
+KmsPresenter* create_kms_presenter(uint32_t width, uint32_t height)
+{
+    KmsPresenter* kms = new KmsPresenter{};
+    kms->fd = -1;
+    kms->width = width;
+    kms->height = height;
+    if(!open_card(kms))
+    {
+        fprintf(stderr, "No DRM card drives a connected screen.\n");
+        destroy_kms_presenter(kms);
+        return 0;
+    }
+
+    kms->scale = kms->mode.hdisplay / width < kms->mode.vdisplay / height ?
+                 kms->mode.hdisplay / width : kms->mode.vdisplay / height;
+    if(!kms->scale)
+    {
+        fprintf(stderr, "The %ux%u buffer does not fit the screen.\n", width, height);
+        destroy_kms_presenter(kms);
+        return 0;
+    }
+    kms->left = (kms->mode.hdisplay - width * kms->scale) / 2;
+    kms->top = (kms->mode.vdisplay - height * kms->scale) / 2;
+
+    for(size_t i = 0; i < KMS_BUFFERS; ++i)
+    {
+        if(!create_dumb_buffer(kms, &kms->buffers[i]))
+        {
+            fprintf(stderr, "Could not create KMS dumb buffers.\n");
+            destroy_kms_presenter(kms);
+            return 0;
+        }
+    }
+
+    kms->saved_crtc = drmModeGetCrtc(kms->fd, kms->crtc);
+    if(drmModeSetCrtc(kms->fd, kms->crtc, kms->buffers[0].fb, 0, 0, &kms->connector, 1, &kms->mode))
+    {
+        fprintf(stderr, "Could not set the mode: %s. Is a display server running?\n", strerror(errno));
+        destroy_kms_presenter(kms);
+        return 0;
+    }
+    kms->back = 1;
+    kms->blank_buffers = KMS_BUFFERS;
+
+    uint64_t async = 0;
+    kms->async_flips = drmGetCap(kms->fd, DRM_CAP_ASYNC_PAGE_FLIP, &async) == 0 && async;
+    kms->vsync = true;
+    return kms;
+}
+
+void destroy_kms_presenter(KmsPresenter* kms)
+{
+    if(kms->fd >= 0)
+    {
+        wait_for_flip(kms);
+        if(kms->saved_crtc)
+        {
+            drmModeCrtc* crtc = kms->saved_crtc;
+            drmModeSetCrtc(kms->fd, crtc->crtc_id, crtc->buffer_id, crtc->x, crtc->y, &kms->connector, 1, &crtc->mode);
+            drmModeFreeCrtc(crtc);
+        }
+        for(size_t i = 0; i < KMS_BUFFERS; ++i) destroy_dumb_buffer(kms, &kms->buffers[i]);
+        close(kms->fd);
+    }
+    delete kms;
+}
+
+void set_kms_vsync(KmsPresenter* kms, bool vsync)
+{
+    if(!vsync && !kms->async_flips) fprintf(stderr, "The driver has no async flips, KMS keeps flipping on vblank.\n");
+    kms->vsync = vsync;
+}
+
+// Scales 'r' up into the back buffer, top row first
+static void copy_rect_to_screen(KmsPresenter* kms, const Buffer& buffer, const Rect& r)
+{
+    const KmsBuffer& back = kms->buffers[kms->back];
+    const uint32_t* pixels = reinterpret_cast<const uint32_t*>(buffer_pixels(buffer));
+    size_t row_bytes = r.width * kms->scale * 4;
+    for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+    {
+        size_t screen_y = kms->top + (kms->height - 1 - yi) * kms->scale;
+        uint8_t* first = back.pixels + screen_y * back.pitch + (kms->left + r.x * kms->scale) * 4;
+        uint32_t* out = reinterpret_cast<uint32_t*>(first);
+        const uint32_t* in = pixels + yi * kms->width + r.x;
+        for(size_t xi = 0; xi < r.width; ++xi)
+        {
+            for(uint32_t s = 0; s < kms->scale; ++s) *out++ = in[xi];
+        }
+        for(uint32_t s = 1; s < kms->scale; ++s) memcpy(first + s * back.pitch, first, row_bytes);
+    }
+}
+
+void copy_kms_rects(KmsPresenter* kms, const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    wait_for_flip(kms);
+    if(kms->blank_buffers)
+    {
+        Rect whole = {0, 0, kms->width, kms->height};
+        copy_rect_to_screen(kms, buffer, whole);
+        --kms->blank_buffers;
+    }
+    // The Buffer is current, so copying what the front buffer got last
+    // time from it brings the back buffer level too
+    for(size_t i = 0; i < kms->num_staged; ++i) copy_rect_to_screen(kms, buffer, kms->staged[i]);
+    for(size_t i = 0; i < num_rects; ++i) copy_rect_to_screen(kms, buffer, rects[i]);
+
+    memcpy(kms->staged, rects, num_rects * sizeof(Rect));
+    kms->num_staged = num_rects;
+    kms->copied = true;
+}
+
+void present_kms_frame(KmsPresenter* kms)
+{
+    if(!kms->copied) return;
+    uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+    if(!kms->vsync && kms->async_flips) flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+    if(drmModePageFlip(kms->fd, kms->crtc, kms->buffers[kms->back].fb, flags, kms))
+    {
+        // Nothing went on screen, the back buffer stays the one to draw
+        fprintf(stderr, "KMS page flip failed: %s\n", strerror(errno));
+        return;
+    }
+    kms->flip_pending = true;
+    kms->copied = false;
+    kms->back = (kms->back + 1) % KMS_BUFFERS;
+}
+
+void finish_kms_frames(KmsPresenter* kms)
+{
+    wait_for_flip(kms);
+}
+
+#else
+
+struct KmsPresenter {};
+
+KmsPresenter* create_kms_presenter(uint32_t, uint32_t)
+{
+    fprintf(stderr, "Built without libdrm, KMS is unavailable.\n");
+    return 0;
+}
+
+void destroy_kms_presenter(KmsPresenter* kms) { delete kms; }
+void set_kms_vsync(KmsPresenter*, bool) {}
+void copy_kms_rects(KmsPresenter*, const Buffer&, const Rect*, size_t) {}
+void present_kms_frame(KmsPresenter*) {}
+void finish_kms_frames(KmsPresenter*) {}
+
+#endif
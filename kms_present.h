@@ -0,0 +1,44 @@
+#ifndef KMS_PRESENT_H
+#define KMS_PRESENT_H
+
+/*
+    DRM/KMS kiosk backend for cabinets that boot into the game with no
+    display server. It takes the first connector with a screen attached,
+    sets its preferred mode and scans out one of two dumb buffers, page
+    flipping between them on vblank. Frames are integer-scaled and
+    centered on the CPU: each changed rectangle is copied into the buffer
+    drawn into next, flipped to rows top first, along with the ones the
+    frame before changed, which that buffer missed while on screen.
+
+    GLFW runs its null platform meanwhile, so keys come from
+    evdev_input.h. Only built with libdrm; create_kms_presenter() returns
+    0 anywhere else.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "render.h"
+
+struct KmsPresenter;
+
+// Needs DRM master, so no display server may be running. Pixels are
+// PIXEL_BGRA8888_REV, which is DRM_FORMAT_XRGB8888. Returns 0 when no
+// card drives a screen at least 'width' x 'height'.
+KmsPresenter* create_kms_presenter(uint32_t width, uint32_t height);
+// Restores whatever the CRTC showed before
+void destroy_kms_presenter(KmsPresenter* kms);
+
+// Off, flips are asynchronous where the driver can and may tear
+void set_kms_vsync(KmsPresenter* kms, bool vsync);
+
+// Waits until the last flip is done, then copies 'rects' of 'buffer'
+// into the buffer that goes on screen next
+void copy_kms_rects(KmsPresenter* kms, const Buffer& buffer, const Rect* rects, size_t num_rects);
+
+// Flips to the buffer copied into, if anything was
+void present_kms_frame(KmsPresenter* kms);
+
+// Blocks until the last flip is done
+void finish_kms_frames(KmsPresenter* kms);
+
+#endif
@@ -1,1017 +1,2197 @@
+#include <cerrno>
 #include <cstdio>
-#include <cstdint>
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
-
-bool game_start = false;
-bool game_running = false;
-bool fire_pressed = false;
-bool still_alive = true;
-int move_dir = 0;
-
-struct Buffer
-{
-    size_t width, height;
-    uint32_t* data;
-};
-
-struct Sprite
-{
-    size_t width, height;
-    uint8_t* data;
-};
-
-struct SpriteAnimation
-{
-    bool loop;
-    size_t num_frames;
-    float frame_duration;
-    float time;
-    Sprite** frames;
-};
-
-struct TextPage
-{
-    size_t num_lines;
-    const char** lines;
-    float display_time;
-};
-
-struct TextAnimation
-{
-    float type_timer;
-    float page_timer;
-    size_t current_page;
-    size_t current_line;
-    size_t chars_visible;
-    float type_speed;
-    bool animation_complete;
-    
-    size_t num_pages;
-    TextPage* pages;  
-};
-
-struct Alien
-{
-    float x, y;
-    uint8_t type;
-    int hp;
-};
-
-struct Player
-{
-    float x, y;
-    size_t life;
-};
-
-struct Projectile
-{
-    size_t x, y;
-    int dir;
-};
-
-enum AlienType: uint8_t
-{
-    ALIEN_DEAD = 0,
-    ALIEN_1    = 1
-};
-
-#define GAME_MAX_PROJECTILES 128
-#define NUM_PAGES 4
-
-struct Game
-{
-    size_t width, height;
-    size_t num_aliens;
-    size_t num_projectiles;
-    Alien* aliens;
-    Player player;
-    Projectile projectiles[GAME_MAX_PROJECTILES];
-};
-
-void error_callback(int error, const char* description)
-{
-    fprintf(stderr, "Error: %s\n", description);
-}
-
-void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "runtime.h"
+#include "evdev_input.h"
+#include "assets.h"
+#include "audio.h"
+#include "debug_overlay.h"
+#include "scores.h"
+
+int main(int argc, char** argv)
 {
-    switch(key)
+    begin_startup_profile(&startup_profile);
+    TRACE_THREAD("game");
+
+    size_t buffer_width = DESIGN_WIDTH;
+    size_t buffer_height = DESIGN_HEIGHT;
+
+    UploadMode upload_mode = UPLOAD_PBO;
+    bool use_gpu_renderer = false;
+    bool use_compute_renderer = false;
+    bool use_text_overlay = false;
+    RasterPath raster_path = RASTER_STAMPED;
+    bool use_indexed = false;
+    ScaleMode scale_mode = SCALE_ASPECT;
+    CrtQuality crt_quality = CRT_OFF;
+    bool negotiate_format = true;
+    PixelFormat pixel_format = PIXEL_RGBA8888;
+#ifdef __EMSCRIPTEN__
+    // Pages band the rasterizer over a Web Worker per core unless told otherwise
+    size_t num_threads = 0;
+#else
+    size_t num_threads = 1;
+#endif
+    PacingMode pacing_mode = PACING_VSYNC;
+    PowerProfile power_profile = POWER_PERFORMANCE;
+    QualityLevel quality_level = QUALITY_FULL;
+    bool quality_auto = true;
+    size_t bench_frames = 0;
+    const char* bench_json_path = 0;
+    bool pgo_train = false;
+    bool autoplay = false;
+    double soak_hours = 0.0;
+    const char* metrics_address = 0;
+    const char* metrics_path = 0;
+    double metrics_interval = METRICS_DEFAULT_INTERVAL;
+    const char* scores_path = 0;
+    bool use_counters = false;
+    bool alloc_stats = false;
+    AllocTelemetry alloc_telemetry = {};
+    // Bytes, 0 for no budget
+    size_t memory_budget = 0;
+    TraceRequest trace_request = {TRACE_DEFAULT_PATH, TRACE_HOTKEY_FRAMES, 0};
+    size_t trace_frames = 0;
+    bool stress = false;
+    size_t bullet_hell = 0;
+    StressSweep sweep;
+    init_stress_sweep(&sweep);
+    size_t sim_games = 0;
+    size_t sim_ticks = BATCH_DEFAULT_TICKS;
+    size_t start_wave = 0;
+    bool endless = false;
+    size_t rollback_delay = 0;
+    // 0 leaves fixed pacing at 60 and VRR pacing just under the refresh
+    double pacing_fps = 0.0;
+    const char* atlas_path = 0;
+    const char* pages_path = 0;
+    bool watch_assets = false;
+    bool mute = false;
+    const char* sounds_path = 0;
+    const char* shader_cache_path = SHADER_CACHE_PATH;
+    bool measure_latency = false;
+    bool conform = false;
+    // 0 leaves the queue to the driver
+    size_t frames_in_flight = 0;
+    bool late_input = false;
+    EventPumpMode pump_mode = PUMP_ALWAYS;
+    EventLoopMode event_loop = EVENT_LOOP_SLEEP;
+    bool use_render_thread = false;
+    bool use_vulkan = false;
+    bool use_wayland = false;
+    bool use_x11 = false;
+    bool use_kms = false;
+    bool use_terminal = false;
+    bool use_evdev = false;
+    bool use_upload_thread = false;
+    size_t upload_frames = 1;
+    size_t num_spectators = 0;
+    int fullscreen_monitor = -1;
+    bool cabinet_threads = false;
+    ThreadPolicy thread_overrides = {};
+    int display_width = 0, display_height = 0;
+    unsigned long serve_port = 0;
+    const char* spectate_address = 0;
+    const char* record_path = 0;
+    const char* replay_path = 0;
+    uint64_t seek_tick = 0;
+    size_t keyframe_ticks = REPLAY_KEYFRAME_TICKS;
+    size_t flight_seconds = FLIGHT_DEFAULT_SECONDS;
+    const char* flight_path = FLIGHT_DUMP_PATH;
+    const char* capture_path = 0;
+    const char* stream_path = 0;
+    StreamEncoding stream_encoding = STREAM_RAW;
+    bool replay_fast = false;
+    for(int i = 1; i < argc; ++i)
     {
-        case GLFW_KEY_ESCAPE:
-            if (action == GLFW_PRESS) game_running = false;
-            break;
-        case GLFW_KEY_RIGHT:
-            if (game_start)
+        if(!strcmp(argv[i], "--upload") && i + 1 < argc)
+        {
+            const char* mode = argv[++i];
+            if(!strcmp(mode, "direct")) upload_mode = UPLOAD_DIRECT;
+            else if(!strcmp(mode, "pbo")) upload_mode = UPLOAD_PBO;
+            else if(!strcmp(mode, "persistent")) upload_mode = UPLOAD_PERSISTENT;
+            else fprintf(stderr, "Unknown upload mode '%s'.\n", mode);
+        }
+        else if(!strcmp(argv[i], "--renderer") && i + 1 < argc)
+        {
+            const char* renderer = argv[++i];
+            if(!strcmp(renderer, "gpu")) use_gpu_renderer = true;
+            else if(!strcmp(renderer, "compute")) use_gpu_renderer = use_compute_renderer = true;
+            else if(strcmp(renderer, "cpu")) fprintf(stderr, "Unknown renderer '%s'.\n", renderer);
+        }
+        else if(!strcmp(argv[i], "--raster") && i + 1 < argc)
+        {
+            const char* path = argv[++i];
+            if(!strcmp(path, "simd")) raster_path = RASTER_SIMD;
+            else if(!strcmp(path, "scalar")) raster_path = RASTER_SCALAR;
+            else if(strcmp(path, "stamped")) fprintf(stderr, "Unknown raster path '%s'.\n", path);
+        }
+        else if(!strcmp(argv[i], "--text") && i + 1 < argc)
+        {
+            const char* text = argv[++i];
+            if(!strcmp(text, "gpu")) use_text_overlay = true;
+            else if(!strcmp(text, "cpu")) use_text_overlay = false;
+            else fprintf(stderr, "Unknown text renderer '%s'.\n", text);
+        }
+        else if(!strcmp(argv[i], "--scale") && i + 1 < argc)
+        {
+            const char* scale = argv[++i];
+            if(!strcmp(scale, "stretch")) scale_mode = SCALE_STRETCH;
+            else if(!strcmp(scale, "aspect")) scale_mode = SCALE_ASPECT;
+            else if(!strcmp(scale, "integer")) scale_mode = SCALE_INTEGER;
+            else fprintf(stderr, "Unknown scale mode '%s'.\n", scale);
+        }
+        else if(!strcmp(argv[i], "--crt") && i + 1 < argc)
+        {
+            const char* crt = argv[++i];
+            if(!strcmp(crt, "off")) crt_quality = CRT_OFF;
+            else if(!strcmp(crt, "low")) crt_quality = CRT_LOW;
+            else if(!strcmp(crt, "medium")) crt_quality = CRT_MEDIUM;
+            else if(!strcmp(crt, "high")) crt_quality = CRT_HIGH;
+            else fprintf(stderr, "Unknown CRT quality '%s'.\n", crt);
+        }
+        else if(!strcmp(argv[i], "--format") && i + 1 < argc)
+        {
+            const char* format = argv[++i];
+            negotiate_format = false;
+            if(!strcmp(format, "auto")) negotiate_format = true;
+            else if(!strcmp(format, "rgba8888")) pixel_format = PIXEL_RGBA8888;
+            else if(!strcmp(format, "bgra8888_rev")) pixel_format = PIXEL_BGRA8888_REV;
+            else if(!strcmp(format, "rgba8888_rev")) pixel_format = PIXEL_RGBA8888_REV;
+            else if(!strcmp(format, "rgb565")) pixel_format = PIXEL_RGB565;
+            else
             {
-                if (action == GLFW_PRESS) move_dir += 1;
-                else if (action == GLFW_RELEASE) move_dir -= 1;
+                fprintf(stderr, "Unknown pixel format '%s'.\n", format);
+                negotiate_format = true;
             }
-            break;
-        case GLFW_KEY_LEFT:
-            if (game_start)
+        }
+        else if(!strcmp(argv[i], "--pacing") && i + 1 < argc)
+        {
+            const char* pacing = argv[++i];
+            if(!strcmp(pacing, "vsync")) pacing_mode = PACING_VSYNC;
+            else if(!strcmp(pacing, "adaptive")) pacing_mode = PACING_ADAPTIVE;
+            else if(!strcmp(pacing, "uncapped")) pacing_mode = PACING_UNCAPPED;
+            else if(!strcmp(pacing, "fixed")) pacing_mode = PACING_FIXED;
+            else if(!strcmp(pacing, "vrr")) pacing_mode = PACING_VRR;
+            else fprintf(stderr, "Unknown pacing mode '%s'.\n", pacing);
+        }
+        else if(!strcmp(argv[i], "--power") && i + 1 < argc)
+        {
+            const char* power = argv[++i];
+            if(!strcmp(power, "performance")) power_profile = POWER_PERFORMANCE;
+            else if(!strcmp(power, "balanced")) power_profile = POWER_BALANCED;
+            else if(!strcmp(power, "battery")) power_profile = POWER_BATTERY;
+            else fprintf(stderr, "Unknown power profile '%s'.\n", power);
+        }
+        else if(!strcmp(argv[i], "--quality") && i + 1 < argc)
+        {
+            const char* quality = argv[++i];
+            quality_auto = !strcmp(quality, "auto");
+            if(quality_auto || !strcmp(quality, "full")) quality_level = QUALITY_FULL;
+            else if(!strcmp(quality, "reduced")) quality_level = QUALITY_REDUCED;
+            else if(!strcmp(quality, "low")) quality_level = QUALITY_LOW;
+            else if(!strcmp(quality, "minimal")) quality_level = QUALITY_MINIMAL;
+            else fprintf(stderr, "Unknown quality level '%s'.\n", quality);
+        }
+        else if(!strcmp(argv[i], "--fps") && i + 1 < argc)
+        {
+            pacing_fps = strtod(argv[++i], 0);
+        }
+        else if(!strcmp(argv[i], "--bench") && i + 1 < argc)
+        {
+            bench_frames = (size_t)strtoul(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--pgo-train"))
+        {
+            pgo_train = true;
+        }
+        else if(!strcmp(argv[i], "--autoplay"))
+        {
+            autoplay = true;
+        }
+        else if(!strcmp(argv[i], "--soak") && i + 1 < argc)
+        {
+            soak_hours = strtod(argv[++i], 0);
+        }
+        else if(!strcmp(argv[i], "--bench-json") && i + 1 < argc)
+        {
+            bench_json_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--stress"))
+        {
+            stress = true;
+        }
+        else if(!strcmp(argv[i], "--stress-aliens") && i + 1 < argc)
+        {
+            const char* counts = argv[++i];
+            size_t num_aliens = parse_stress_counts(counts, sweep.aliens);
+            if(num_aliens) sweep.num_aliens = num_aliens;
+            else fprintf(stderr, "Unknown alien counts '%s', expected up to %d numbers like 72,1000.\n", counts, STRESS_MAX_STEPS);
+            stress = true;
+        }
+        else if(!strcmp(argv[i], "--stress-shots") && i + 1 < argc)
+        {
+            const char* counts = argv[++i];
+            size_t num_shots = parse_stress_counts(counts, sweep.shots);
+            if(num_shots) sweep.num_shots = num_shots;
+            else fprintf(stderr, "Unknown shot counts '%s', expected up to %d numbers like 128,4096.\n", counts, STRESS_MAX_STEPS);
+            stress = true;
+        }
+        else if(!strcmp(argv[i], "--bullet-hell") && i + 1 < argc)
+        {
+            bullet_hell = (size_t)strtoul(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--simulate") && i + 1 < argc)
+        {
+            sim_games = (size_t)strtoul(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--ticks") && i + 1 < argc)
+        {
+            sim_ticks = (size_t)strtoul(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--wave") && i + 1 < argc)
+        {
+            // Waves past the authored ones are generated
+            start_wave = (size_t)strtoul(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--endless"))
+        {
+            endless = true;
+        }
+        else if(!strcmp(argv[i], "--rollback") && i + 1 < argc)
+        {
+            rollback_delay = (size_t)strtoul(argv[++i], 0, 10);
+            if(rollback_delay >= ROLLBACK_MAX_TICKS)
             {
-                if (action == GLFW_PRESS) move_dir -= 1;
-                else if (action == GLFW_RELEASE) move_dir += 1;
+                fprintf(stderr, "Inputs can arrive at most %d ticks late.\n", ROLLBACK_MAX_TICKS - 1);
+                rollback_delay = ROLLBACK_MAX_TICKS - 1;
             }
-            break;
-        case GLFW_KEY_SPACE:
-            if (game_start)
-                if (action == GLFW_PRESS) fire_pressed = true;
-            break;
-        case GLFW_KEY_ENTER:
-            if (action == GLFW_RELEASE) game_start = true;
-            break;
-        default:
-            break;
+        }
+        else if(!strcmp(argv[i], "--atlas") && i + 1 < argc)
+        {
+            atlas_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--pages") && i + 1 < argc)
+        {
+            pages_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--watch"))
+        {
+            watch_assets = true;
+        }
+        else if(!strcmp(argv[i], "--mute"))
+        {
+            mute = true;
+        }
+        else if(!strcmp(argv[i], "--sounds") && i + 1 < argc)
+        {
+            sounds_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--startup-profile") && i + 1 < argc)
+        {
+            startup_profile.json_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--shader-cache") && i + 1 < argc)
+        {
+            const char* path = argv[++i];
+            shader_cache_path = strcmp(path, "off") ? path : 0;
+        }
+        else if(!strcmp(argv[i], "--record") && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--conform"))
+        {
+            conform = true;
+        }
+        else if(!strcmp(argv[i], "--capture") && i + 1 < argc)
+        {
+            capture_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--stream") && i + 1 < argc)
+        {
+            stream_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--stream-encoding") && i + 1 < argc)
+        {
+            const char* encoding = argv[++i];
+            if(!strcmp(encoding, "raw")) stream_encoding = STREAM_RAW;
+            else if(!strcmp(encoding, "delta")) stream_encoding = STREAM_DELTA;
+            else if(!strcmp(encoding, "palette")) stream_encoding = STREAM_DELTA_PALETTE;
+            else fprintf(stderr, "Unknown stream encoding '%s'.\n", encoding);
+        }
+        else if(!strcmp(argv[i], "--replay") && i + 1 < argc)
+        {
+            replay_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--replay-fast"))
+        {
+            replay_fast = true;
+        }
+        else if(!strcmp(argv[i], "--seek") && i + 1 < argc)
+        {
+            seek_tick = strtoull(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--keyframe-ticks") && i + 1 < argc)
+        {
+            keyframe_ticks = (size_t)strtoul(argv[++i], 0, 10);
+            if(keyframe_ticks > UINT32_MAX) keyframe_ticks = UINT32_MAX;
+        }
+        else if(!strcmp(argv[i], "--flight-recorder") && i + 1 < argc)
+        {
+            flight_seconds = (size_t)strtoul(argv[++i], 0, 10);
+            if(flight_seconds > FLIGHT_MAX_SECONDS) flight_seconds = FLIGHT_MAX_SECONDS;
+        }
+        else if(!strcmp(argv[i], "--flight-dump") && i + 1 < argc)
+        {
+            flight_path = argv[++i];
+            if(strlen(flight_path) >= FLIGHT_MAX_PATH)
+            {
+                fprintf(stderr, "Flight dump paths are at most %d characters, keeping '%s'.\n", FLIGHT_MAX_PATH - 1, FLIGHT_DUMP_PATH);
+                flight_path = FLIGHT_DUMP_PATH;
+            }
+        }
+        else if(!strcmp(argv[i], "--trace") && i + 1 < argc)
+        {
+            trace_frames = (size_t)strtoul(argv[++i], 0, 10);
+            if(!TRACE_ENABLED) fprintf(stderr, "Built with SPACE_INVADERS_NO_TRACE, ignoring --trace.\n");
+            else if(trace_frames) trace_request.frames = trace_frames;
+        }
+        else if(!strcmp(argv[i], "--trace-file") && i + 1 < argc)
+        {
+            trace_request.path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--counters"))
+        {
+            use_counters = true;
+        }
+        else if(!strcmp(argv[i], "--alloc-stats"))
+        {
+            alloc_stats = true;
+        }
+        else if(!strcmp(argv[i], "--no-alloc"))
+        {
+            alloc_stats = true;
+            alloc_telemetry.guard = true;
+        }
+        else if(!strcmp(argv[i], "--memory-budget") && i + 1 < argc)
+        {
+            // Anything but a positive count of kibibytes would quietly
+            // turn the budget off
+            const char* text = argv[++i];
+            char* end = 0;
+            errno = 0;
+            unsigned long kb = strtoul(text, &end, 10);
+            if(*text < '0' || *text > '9' || *end || errno || !kb || kb > SIZE_MAX / 1024)
+            {
+                fprintf(stderr, "--memory-budget takes a positive number of kibibytes, not '%s'.\n", text);
+                return -1;
+            }
+            memory_budget = (size_t)kb * 1024;
+        }
+        else if(!strcmp(argv[i], "--huge-pages"))
+        {
+            set_huge_pages(true);
+        }
+        else if(!strcmp(argv[i], "--latency"))
+        {
+            measure_latency = true;
+        }
+        else if(!strcmp(argv[i], "--frames-in-flight") && i + 1 < argc)
+        {
+            frames_in_flight = (size_t)strtoul(argv[++i], 0, 10);
+            if(frames_in_flight < 1 || frames_in_flight > FRAMES_IN_FLIGHT_MAX)
+            {
+                fprintf(stderr, "Frames in flight must be 1 to %d, leaving them to the driver.\n", FRAMES_IN_FLIGHT_MAX);
+                frames_in_flight = 0;
+            }
+        }
+        else if(!strcmp(argv[i], "--low-latency"))
+        {
+            frames_in_flight = 1;
+            late_input = true;
+        }
+        else if(!strcmp(argv[i], "--event-pump") && i + 1 < argc)
+        {
+            const char* pump = argv[++i];
+            if(!strcmp(pump, "always")) pump_mode = PUMP_ALWAYS;
+            else if(!strcmp(pump, "adaptive")) pump_mode = PUMP_ADAPTIVE;
+            else fprintf(stderr, "Unknown event pump '%s'.\n", pump);
+        }
+        else if(!strcmp(argv[i], "--event-loop") && i + 1 < argc)
+        {
+            const char* loop = argv[++i];
+            if(!strcmp(loop, "sleep")) event_loop = EVENT_LOOP_SLEEP;
+            else if(!strcmp(loop, "reactor")) event_loop = EVENT_LOOP_REACTOR;
+            else fprintf(stderr, "Unknown event loop '%s'.\n", loop);
+        }
+        else if(!strcmp(argv[i], "--input") && i + 1 < argc)
+        {
+            const char* input = argv[++i];
+            if(!strcmp(input, "evdev")) use_evdev = true;
+            else if(strcmp(input, "glfw")) fprintf(stderr, "Unknown input backend '%s'.\n", input);
+        }
+        else if(!strcmp(argv[i], "--present") && i + 1 < argc)
+        {
+            const char* present = argv[++i];
+            if(!strcmp(present, "vulkan")) use_vulkan = true;
+            else if(!strcmp(present, "wayland")) use_wayland = true;
+            else if(!strcmp(present, "x11")) use_x11 = true;
+            else if(!strcmp(present, "kms")) use_kms = true;
+            else if(!strcmp(present, "terminal")) use_terminal = true;
+            else if(strcmp(present, "gl")) fprintf(stderr, "Unknown present backend '%s'.\n", present);
+        }
+        else if(!strcmp(argv[i], "--render-thread"))
+        {
+            use_render_thread = true;
+        }
+        else if(!strcmp(argv[i], "--upload-thread"))
+        {
+            use_upload_thread = true;
+        }
+        else if(!strcmp(argv[i], "--upload-frames") && i + 1 < argc)
+        {
+            size_t frames = (size_t)strtoul(argv[++i], 0, 10);
+            if(frames == 1 || frames == UPLOAD_CPU_FRAMES) upload_frames = frames;
+            else fprintf(stderr, "--upload-frames takes 1 or %d.\n", UPLOAD_CPU_FRAMES);
+        }
+        else if(!strcmp(argv[i], "--indexed"))
+        {
+            use_indexed = true;
+        }
+        else if(!strcmp(argv[i], "--spectators") && i + 1 < argc)
+        {
+            num_spectators = (size_t)strtoul(argv[++i], 0, 10);
+            if(num_spectators > SPECTATOR_MAX_WINDOWS)
+            {
+                fprintf(stderr, "At most %d spectator windows.\n", SPECTATOR_MAX_WINDOWS);
+                num_spectators = SPECTATOR_MAX_WINDOWS;
+            }
+        }
+        else if(!strcmp(argv[i], "--fullscreen") && i + 1 < argc)
+        {
+            fullscreen_monitor = (int)strtol(argv[++i], 0, 10);
+        }
+        else if(!strcmp(argv[i], "--display-mode") && i + 1 < argc)
+        {
+            const char* display_mode = argv[++i];
+            if(sscanf(display_mode, "%dx%d", &display_width, &display_height) != 2)
+            {
+                fprintf(stderr, "Unknown display mode '%s', expected WIDTHxHEIGHT.\n", display_mode);
+                display_width = display_height = 0;
+            }
+        }
+        else if(!strcmp(argv[i], "--thread-policy") && i + 1 < argc)
+        {
+            const char* policy = argv[++i];
+            if(!strcmp(policy, "off")) cabinet_threads = false;
+            else if(!strcmp(policy, "cabinet")) cabinet_threads = true;
+            else fprintf(stderr, "Unknown thread policy '%s'.\n", policy);
+        }
+        else if(!strcmp(argv[i], "--pin") && i + 1 < argc)
+        {
+            parse_thread_pin(&thread_overrides, argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--priority") && i + 1 < argc)
+        {
+            parse_thread_priority(&thread_overrides, argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--metrics") && i + 1 < argc)
+        {
+            metrics_address = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--metrics-file") && i + 1 < argc)
+        {
+            metrics_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--metrics-interval") && i + 1 < argc)
+        {
+            metrics_interval = strtod(argv[++i], 0);
+        }
+        else if(!strcmp(argv[i], "--scores") && i + 1 < argc)
+        {
+            scores_path = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--serve-spectators") && i + 1 < argc)
+        {
+            serve_port = strtoul(argv[++i], 0, 10);
+            if(!serve_port || serve_port > 65535)
+            {
+                fprintf(stderr, "Unknown port '%s', not serving spectators.\n", argv[i]);
+                serve_port = 0;
+            }
+        }
+        else if(!strcmp(argv[i], "--spectate") && i + 1 < argc)
+        {
+            spectate_address = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--resolution") && i + 1 < argc)
+        {
+            const char* resolution = argv[++i];
+            if(sscanf(resolution, "%zux%zu", &buffer_width, &buffer_height) != 2)
+            {
+                fprintf(stderr, "Unknown resolution '%s', expected WIDTHxHEIGHT.\n", resolution);
+                buffer_width = DESIGN_WIDTH;
+                buffer_height = DESIGN_HEIGHT;
+            }
+        }
+        else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+        {
+            num_threads = (size_t)strtoul(argv[++i], 0, 10);
+        }
     }
-}
 
-uint32_t rgb_to_uint32(uint8_t r, uint8_t g, uint8_t b)
-{
-    return (r << 24) | (g << 16) | (b << 8) | 255;
-}
+    // Stress formations replace whatever a recording or training would play
+    if(stress && (replay_path || pgo_train))
+    {
+        fprintf(stderr, "Stress sweeps play the benchmark's input, ignoring --replay and --pgo-train.\n");
+        replay_path = 0;
+        pgo_train = false;
+    }
 
-void validate_shader(GLuint shader, const char* file = 0)
-{
-    static const unsigned int BUFFER_SIZE = 512;
-    char buffer[BUFFER_SIZE];
-    GLsizei length = 0;
-    glGetShaderInfoLog(shader, BUFFER_SIZE, &length, buffer);
+    // Soak tests play endless waves with the bot, for as long as they run
+    if(soak_hours > 0.0)
+    {
+        if(replay_path || pgo_train || stress || spectate_address)
+        {
+            fprintf(stderr, "Soak tests play endless waves themselves, ignoring --replay, --pgo-train, --stress and --spectate.\n");
+            replay_path = spectate_address = 0;
+            pgo_train = stress = false;
+        }
+        autoplay = endless = true;
+    }
 
-    if (length > 0)
+    // Spectators draw someone else's game, from that game's size and wave
+    SpectateClient* spectate_client = 0;
+    if(spectate_address)
     {
-        printf("Shader %d(%s) compile error: %s\n",
-            shader, (file ? file : ""), buffer);
+        if(replay_path || record_path || pgo_train || stress || serve_port || endless)
+        {
+            fprintf(stderr, "Spectators only watch, ignoring --replay, --record, --pgo-train, --stress, --serve-spectators and --endless.\n");
+            replay_path = record_path = 0;
+            pgo_train = stress = endless = autoplay = false;
+            serve_port = 0;
+        }
+        SpectateSnapshot first;
+        spectate_client = connect_spectate_client(spectate_address, &first);
+        if(!spectate_client)
+        {
+            fprintf(stderr, "No game answered at '%s'.\n", spectate_address);
+            return -1;
+        }
+        buffer_width = first.width;
+        buffer_height = first.height;
+        start_wave = first.wave;
     }
-}
 
-bool validate_program(GLuint program)
-{
-    static const GLsizei BUFFER_SIZE = 512;
-    GLchar buffer[BUFFER_SIZE];
-    GLsizei length = 0;
-    glGetProgramInfoLog(program, BUFFER_SIZE, &length, buffer);
+    // Recordings and snapshots carry neither the pattern nor its shots
+    if(bullet_hell && (replay_path || record_path || spectate_address || serve_port))
+    {
+        fprintf(stderr, "Bullet hell can't be recorded, replayed or spectated, ignoring --bullet-hell.\n");
+        bullet_hell = 0;
+    }
 
-    if(length > 0)
+    // A replay starts from what its recording started from
+    InputReplay* replay = 0;
+    if(replay_path && autoplay)
     {
-        printf("Program %d link error: %s\n", program, buffer);
-        return false;
+        fprintf(stderr, "Replays play their recorded input, ignoring --autoplay.\n");
+        autoplay = false;
+    }
+    if(replay_path)
+    {
+        replay = new InputReplay;
+        if(!read_input_recording(replay, replay_path))
+        {
+            delete replay;
+            return -1;
+        }
+        buffer_width = replay->header.width;
+        buffer_height = replay->header.height;
+        start_wave = replay->header.wave;
+        endless = (replay->header.flags & REPLAY_ENDLESS) != 0;
     }
 
-    return true; 
-}
+    if(buffer_width < DESIGN_WIDTH || buffer_height < DESIGN_HEIGHT || buffer_width > 32767 || buffer_height > 32767)
+    {
+        fprintf(stderr, "Resolution %zux%zu out of range, using %dx%d.\n", buffer_width, buffer_height, DESIGN_WIDTH, DESIGN_HEIGHT);
+        buffer_width = DESIGN_WIDTH;
+        buffer_height = DESIGN_HEIGHT;
+    }
 
-void draw_sprite_buffer(
-    Buffer* buffer, const Sprite& sprite, size_t x, size_t y, uint32_t color
-){
-    for(size_t xi = 0; xi < sprite.width; ++xi)
+    // A recording keeps the resolution it was made at
+    if(memory_budget && (buffer_width != DESIGN_WIDTH || buffer_height != DESIGN_HEIGHT))
     {
-        for(size_t yi = 0; yi < sprite.height; ++yi)
+        if(replay) fprintf(stderr, "The recording was made at %zux%zu, keeping it under --memory-budget.\n", buffer_width, buffer_height);
+        else
         {
-            size_t sy = sprite.height - 1 + y - yi;
-            size_t sx = x + xi;
-            if(sprite.data[yi * sprite.width + xi] &&
-               sy < buffer->height && sx < buffer->width) 
-            {
-                buffer->data[sy * buffer->width + sx] = color;
-            }
+            fprintf(stderr, "A memory budget runs at %dx%d, ignoring --resolution.\n", DESIGN_WIDTH, DESIGN_HEIGHT);
+            buffer_width = DESIGN_WIDTH;
+            buffer_height = DESIGN_HEIGHT;
         }
     }
-}
+    if(memory_budget)
+    {
+        alloc_stats = true;
+        alloc_telemetry.guard = true;
+    }
 
-void clear_buffer(Buffer* buffer, uint32_t color)
-{
-    for (size_t i = 0; i < buffer->width * buffer-> height; ++i)
+    // Offset of the centered design area inside the logical buffer
+    const size_t layout_x = (buffer_width - DESIGN_WIDTH) / 2;
+    const size_t layout_y = (buffer_height - DESIGN_HEIGHT) / 2;
+
+    // Training runs are benchmarks that end with the game instead
+    if(pgo_train && !bench_frames) bench_frames = PGO_TRAIN_MAX_FRAMES;
+    if(stress && !bench_frames) bench_frames = STRESS_FRAMES;
+    // Benchmarks run on the null platform without a GL context; only the
+    // simulation and the software rasterizer are measured
+    bool headless = bench_frames > 0;
+    if(headless && use_gpu_renderer)
     {
-        buffer->data[i] = color;
+        fprintf(stderr, "The GPU renderer needs a GL context, benchmarking the CPU renderer.\n");
+        use_gpu_renderer = false;
     }
-}
+    if(headless) negotiate_format = false;
+    if(conform && !headless)
+    {
+        fprintf(stderr, "Conformance runs are headless, ignoring --conform without --bench.\n");
+        conform = false;
+    }
+    if(headless && measure_latency)
+    {
+        fprintf(stderr, "Benchmarks have no key presses or swaps, ignoring --latency.\n");
+        measure_latency = false;
+    }
+    if(headless && use_render_thread)
+    {
+        fprintf(stderr, "Benchmarks step one tick a frame on one thread, ignoring --render-thread.\n");
+        use_render_thread = false;
+    }
+    if(use_render_thread && soak_hours > 0.0)
+    {
+        fprintf(stderr, "Soak tests sample GL objects on the thread that swaps, ignoring --render-thread.\n");
+        use_render_thread = false;
+    }
+    if(use_render_thread && spectate_client)
+    {
+        fprintf(stderr, "Spectators apply snapshots as they arrive, ignoring --render-thread.\n");
+        use_render_thread = false;
+    }
+    if(use_render_thread && replay_fast)
+    {
+        fprintf(stderr, "The render thread ticks in real time, ignoring --replay-fast.\n");
+        replay_fast = false;
+    }
+    if(event_loop == EVENT_LOOP_REACTOR && (headless || use_render_thread))
+    {
+        fprintf(stderr, "The reactor waits in the frame loop's own sleeps, ignoring --event-loop reactor.\n");
+        event_loop = EVENT_LOOP_SLEEP;
+    }
+    if(watch_assets && (headless || use_render_thread))
+    {
+        fprintf(stderr, "Hot reload swaps assets in between the frame loop's frames, ignoring --watch.\n");
+        watch_assets = false;
+    }
+#ifdef __EMSCRIPTEN__
+    // A page's WebGL2 context belongs to its main thread and can't be
+    // shared, and WebGL2 has no texture swizzles to read palettes with
+    if(use_render_thread || use_upload_thread || use_indexed || num_spectators)
+    {
+        fprintf(stderr, "Browsers draw on one unshared WebGL2 context, ignoring --render-thread, --upload-thread, --indexed and --spectators.\n");
+        use_render_thread = use_upload_thread = use_indexed = false;
+        num_spectators = 0;
+    }
+    if(event_loop == EVENT_LOOP_REACTOR)
+    {
+        fprintf(stderr, "A page can't block its main thread, ignoring --event-loop reactor.\n");
+        event_loop = EVENT_LOOP_SLEEP;
+    }
+#endif
 
-void draw_text_buffer(
-    Buffer* buffer,
-    const Sprite& text_spritesheet,
-    const char* text,
-    size_t x, 
-    size_t y,
-    uint32_t color,
-    size_t limit = 9999)
-{
-    size_t xp = x;
-    size_t stride = text_spritesheet.width * text_spritesheet.height;
-    Sprite sprite = text_spritesheet;
-    size_t count = 0;
+    if(use_indexed && use_gpu_renderer)
+    {
+        fprintf(stderr, "The GPU renderer draws full color, ignoring --indexed.\n");
+        use_indexed = false;
+    }
+    if(!headless && capture_path)
+    {
+        fprintf(stderr, "Captures render headless as fast as possible, add --bench N.\n");
+        capture_path = 0;
+    }
+    if(headless && num_spectators)
+    {
+        fprintf(stderr, "Benchmarks present nothing, ignoring --spectators.\n");
+        num_spectators = 0;
+    }
+    if(headless && use_text_overlay)
+    {
+        fprintf(stderr, "Benchmarks present nothing, ignoring --text gpu.\n");
+        use_text_overlay = false;
+    }
+    if(headless && (use_vulkan || use_wayland || use_x11 || use_kms || use_terminal))
+    {
+        fprintf(stderr, "Benchmarks present nothing, ignoring --present %s.\n",
+                use_vulkan ? "vulkan" : use_wayland ? "wayland" : use_x11 ? "x11" : use_kms ? "kms" : "terminal");
+        use_vulkan = use_wayland = use_x11 = use_kms = use_terminal = false;
+    }
+    // Vulkan, wl_shm, MIT-SHM, KMS and the terminal present the CPU buffer
+    // as is, without any GL context
+    if(use_vulkan || use_wayland || use_x11 || use_kms || use_terminal)
+    {
+        if(use_gpu_renderer) fprintf(stderr, "The GPU renderer draws with GL, ignoring --renderer gpu.\n");
+        if(use_indexed)
+        {
+            fprintf(stderr, "%s presents full color, ignoring --indexed.\n",
+                    use_vulkan ? "Vulkan" : use_wayland ? "wl_shm" : use_x11 ? "MIT-SHM" : use_kms ? "KMS" : "The terminal");
+        }
+        if(use_render_thread) fprintf(stderr, "The render thread owns a GL context, ignoring --render-thread.\n");
+        if(use_upload_thread) fprintf(stderr, "The upload thread shares a GL context, ignoring --upload-thread.\n");
+        if(use_text_overlay) fprintf(stderr, "The text overlay draws with GL, ignoring --text gpu.\n");
+        if(num_spectators) fprintf(stderr, "Spectators share a GL context, ignoring --spectators.\n");
+        use_gpu_renderer = use_indexed = use_render_thread = use_upload_thread = use_text_overlay = false;
+        num_spectators = 0;
+        negotiate_format = false;
+    }
+#ifndef __EMSCRIPTEN__
+    // Wherever the CPU buffer is resolved through a palette
+    if(memory_budget && !use_gpu_renderer && !use_vulkan && !use_wayland && !use_x11 && !use_kms && !use_terminal) use_indexed = true;
+#endif
+    // Every thread started from here on takes its place from the policy
+    ThreadPolicy thread_policy = {};
+    if(cabinet_threads) cabinet_thread_policy(&thread_policy, std::thread::hardware_concurrency(), use_render_thread);
+    merge_thread_policy(&thread_policy, thread_overrides);
+    if(!thread_policy_empty(thread_policy))
+    {
+        set_thread_policy(thread_policy);
+        enter_thread_role(THREAD_GAME);
+    }
 
-    for(const char* charp = text; *charp != '\0' && count < limit; ++charp, ++count)
+    // Batch runs need neither a window nor the renderer
+    if(sim_games)
     {
-        char character = *charp - 32;
-        if(character < 0 || character >= 65) continue;
+        run_simulation_batch(sim_games, sim_ticks, start_wave, num_threads);
+        print_thread_policy();
+        return 0;
+    }
 
-        sprite.data = text_spritesheet.data + character * stride;
-        draw_sprite_buffer(buffer, sprite, xp, y, color);
-        xp += sprite.width + 1;
+    // Sprites, pages, the formation and the sounds load alongside the
+    // window and the GL setup, see StartupAssets
+    GameState state;
+    StartupAssets startup_assets;
+    start_startup_assets(&startup_assets, &state, buffer_width, buffer_height, start_wave, atlas_path, pages_path, sounds_path, !headless && !mute);
+
+    // A budgeted game is set up and measured before anything is opened,
+    // so one that doesn't fit leaves nothing to tear down. Unless it is
+    // palette indices, the buffer counts as 32-bit: no format a presenter
+    // or the upload probe can settle on is wider
+    size_t particle_capacity = PARTICLE_CAPACITY;
+    if(memory_budget)
+    {
+        finish_startup_assets(&startup_assets, &startup_profile);
+        configure_game_state(&state, replay, pgo_train, bullet_hell, stress ? &sweep : 0, seek_tick);
+        MemoryFootprint footprint;
+        measure_memory_footprint(&footprint, memory_budget, state, buffer_width, buffer_height, use_indexed ? PIXEL_INDEXED8 : PIXEL_RGBA8888);
+        particle_capacity = budget_particle_capacity(&footprint);
+        if(!print_memory_footprint(footprint)) return 1;
     }
-}
 
-void draw_number_buffer(
-    Buffer* buffer,
-    const Sprite& number_spritesheet, size_t number,
-    size_t x, size_t y,
-    uint32_t color)
-{
-    uint8_t digits[64];
-    size_t num_digits = 0;
+    /*
+    ################################################
+    ##           PACKAGE INITIALIZATION           ##
+    ################################################
+    */
 
-    size_t current_number = number;
-    do
+    // GLFW Initialization
+    glfwSetErrorCallback(error_callback);
+
+    // The kiosk scans out without a display server, GLFW then only keeps
+    // time on its null platform; without a screen it presents through GL
+    KmsPresenter* kms = 0;
+    if(use_kms)
+    {
+        kms = create_kms_presenter((uint32_t)buffer_width, (uint32_t)buffer_height);
+        if(!kms) fprintf(stderr, "Presenting through GL instead.\n");
+    }
+    // So does the terminal, which is all an SSH session has to show on
+    TerminalPresenter* terminal = 0;
+    if(use_terminal)
     {
-        digits[num_digits++] = current_number % 10;
-        current_number = current_number / 10;
+        terminal = create_terminal_presenter((uint32_t)buffer_width, (uint32_t)buffer_height);
+        if(!terminal) fprintf(stderr, "Presenting through GL instead.\n");
+        else
+        {
+            if(pacing_mode != PACING_UNCAPPED) pacing_mode = PACING_FIXED;
+            if(pacing_fps <= 0.0) pacing_fps = TERMINAL_DEFAULT_FPS;
+        }
     }
-    while(current_number > 0);
 
-    size_t xp = x;
-    size_t stride = number_spritesheet.width * number_spritesheet.height;
-    Sprite sprite = number_spritesheet;
-    for(size_t i = 0; i < num_digits; ++i)
+    if(headless || kms || terminal) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    mark_startup_phase(&startup_profile, STARTUP_OPTIONS);
+    install_glfw_allocator();
+    if (!glfwInit())
     {
-        uint8_t digit = digits[num_digits - i - 1];
-        sprite.data = number_spritesheet.data + digit * stride;
-        draw_sprite_buffer(buffer, sprite, xp, y, color);   
-        xp += sprite.width + 1;
+        finish_startup_assets(&startup_assets, &startup_profile);
+        return -1;
     }
-}
+    mark_startup_phase(&startup_profile, STARTUP_GLFW_INIT);
+    EventPump event_pump;
+    init_event_pump(&event_pump, pump_mode);
 
-void draw_sprite_scaled(
-    Buffer* buffer, const Sprite& sprite, 
-    size_t x, size_t y, 
-    size_t scale, uint32_t color)
-{
-    for(size_t xi = 0; xi < sprite.width; ++xi)
+    if(headless || use_vulkan || use_wayland || use_x11 || kms || terminal)
+    {
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        // The wl_shm presenter scales the surface with a viewport of its own
+        if(use_wayland) glfwWindowHint(GLFW_SCALE_FRAMEBUFFER, GLFW_FALSE);
+    }
+    else
+    {
+        set_gl_window_hints();
+    }
+
+    // Screens of their own have no monitor to take over
+    FullscreenMode fullscreen = {};
+    if(fullscreen_monitor >= 0 && !headless && !kms && !terminal &&
+       !choose_fullscreen_mode(&fullscreen, fullscreen_monitor, display_width, display_height))
+    {
+        fprintf(stderr, "Opening a window instead.\n");
+    }
+    GLFWwindow* window = create_game_window(fullscreen);
+    
+    if (!window)
+    {
+        glfwTerminate();
+        finish_startup_assets(&startup_assets, &startup_profile);
+        return -1;
+    }
+
+    // Without a usable device or compositor the window is made again with
+    // a GL context
+    VulkanPresenter* vulkan = 0;
+    WaylandPresenter* wayland = 0;
+    X11Presenter* x11 = 0;
+    if(use_vulkan || use_wayland || use_x11)
     {
-        for(size_t yi = 0; yi < sprite.height; ++yi)
+        if(use_vulkan) vulkan = create_vulkan_presenter(window, (uint32_t)buffer_width, (uint32_t)buffer_height, true, VULKAN_PRESENT_FIFO);
+        else if(use_wayland) wayland = create_wayland_presenter(window, (uint32_t)buffer_width, (uint32_t)buffer_height);
+        else x11 = create_x11_presenter(window, (uint32_t)buffer_width, (uint32_t)buffer_height);
+        if(!vulkan && !wayland && !x11)
         {
-            if(sprite.data[yi * sprite.width + xi])
+            fprintf(stderr, "Presenting through GL instead.\n");
+            glfwDestroyWindow(window);
+            glfwDefaultWindowHints();
+            set_gl_window_hints();
+            window = create_game_window(fullscreen);
+            if(!window)
             {
-                // Draw a rectangle of size 'scale' for each pixel
-                for(size_t sx = 0; sx < scale; ++sx)
-                {
-                    for(size_t sy = 0; sy < scale; ++sy)
-                    {
-                        size_t px = x + (xi * scale) + sx;
-                        // Flip Y axis to match your coordinate system
-                        size_t py = y + ((sprite.height - 1 - yi) * scale) + sy;
-
-                        if(px < buffer->width && py < buffer->height)
-                        {
-                            buffer->data[py * buffer->width + px] = color;
-                        }
-                    }
-                }
+                glfwTerminate();
+                finish_startup_assets(&startup_assets, &startup_profile);
+                return -1;
             }
         }
     }
-}
+    bool use_gl = !headless && !vulkan && !wayland && !x11 && !kms && !terminal;
+    printf(
+        "Present backend: %s\n",
+        headless ? "none" : vulkan ? "vulkan" : wayland ? "wayland" : x11 ? "x11" : kms ? "kms" : terminal ? "terminal" : GL_PRESENT_NAME
+    );
+    print_fullscreen(window, fullscreen);
+    mark_startup_phase(&startup_profile, STARTUP_WINDOW);
 
-bool sprite_overlap_check(
-    const Sprite& sp_a, size_t x_a, size_t y_a,
-    const Sprite& sp_b, size_t x_b, size_t y_b
-)
-{
-    if(x_a < x_b + sp_b.width && x_a + sp_a.width > x_b &&
-       y_a < y_b + sp_b.height && y_a + sp_a.height > y_b)
+    if(use_gl)
     {
-        return true;
+        glfwMakeContextCurrent(window);
+
+#ifndef SPACE_INVADERS_GLES
+        double load_start = glfwGetTime();
+        if(!load_gl(glfwGetProcAddress))
+        {
+            fprintf(stderr, "Error loading OpenGL.\n");
+            glfwTerminate();
+            finish_startup_assets(&startup_assets, &startup_profile);
+            return -1;
+        }
+        printf("GL loader: %zu entry points in %.3f ms\n", gl_caps.num_functions, (glfwGetTime() - load_start) * 1000.0);
+#endif
+
+        // OpenGL Initialization
+        int glVersion[2] = {-1, 1};
+        glGetIntegerv(GL_MAJOR_VERSION, &glVersion[0]);
+        glGetIntegerv(GL_MINOR_VERSION, &glVersion[1]);
+        printf("Using %s: %d.%d\n", GL_API_NAME, glVersion[0], glVersion[1]);
     }
+    mark_startup_phase(&startup_profile, STARTUP_GL_LOADER);
+
+    init_fill_kernels();
+    printf("Clear kernel: %s\n", fill_kernel_name);
+    init_overlap_kernels();
+    printf("Overlap kernel: %s\n", overlap_kernel_name);
+    init_move_kernels();
+    printf("Move kernel: %s\n", move_kernel_name);
+    init_particle_kernels();
+    printf("Particle kernel: %s\n", particle_kernel_name);
+    init_blend_kernels();
+    printf("Blend kernel: %s\n", blend_kernel_name);
+
+    FramePacer pacer = {};
+    if(!headless)
+    {
+        if(use_gl) glClearColor(0.0, 0.0, 0.0, 1.0);
+        init_frame_pacer(&pacer, window, pacing_mode, pacing_fps, vulkan, wayland, x11, kms, terminal);
+        pacer.late_input = late_input;
+        printf("Power profile: %s\n", power_profile_name(power_profile));
+        printf("Quality: %s\n", quality_auto ? "auto" : quality_level_name(quality_level));
+    }
+    glfwSetKeyCallback(window, key_callback);
+    // The kiosk has no other keys; it grabs them off the console
+    EvdevInput* evdev = 0;
+    if(!headless && (use_evdev || kms))
+    {
+        evdev = start_evdev_input(kms != 0);
+        keys_from_evdev = evdev != 0;
+    }
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
 
-    return false;
-}
+    // Pads plugged in before startup never get a connect event
+    glfwSetJoystickCallback(joystick_callback);
+    for(int jid = 0; jid < GAMEPAD_SLOTS; ++jid)
+    {
+        if(glfwJoystickPresent(jid)) joystick_callback(jid, GLFW_CONNECTED);
+    }
 
-int main()
-{
-    const size_t buffer_width = 224;
-    const size_t buffer_height = 256;
     /*
     ################################################
-    ##           PACKAGE INITIALIZATION           ##
+    ##                BUFFER SETUP                ##
     ################################################
     */
 
-    // GLFW Initialization
-    glfwSetErrorCallback(error_callback);
-
-    if (!glfwInit()) return -1;
+    Palette palette;
+    init_palette(&palette);
+
+    // The GPU backend packs instance colors as RGBA8888 itself
+    if(use_indexed) pixel_format = PIXEL_INDEXED8;
+    else if(use_gpu_renderer) pixel_format = PIXEL_RGBA8888;
+    // B,G,R,A bytes, which VK_FORMAT_B8G8R8A8_UNORM copies as they are
+    // and WL_SHM_FORMAT_XRGB8888, a 24-bit TrueColor XImage and
+    // DRM_FORMAT_XRGB8888 read as they are
+    else if(vulkan || wayland || x11 || kms || terminal) pixel_format = PIXEL_BGRA8888_REV;
+#ifdef SPACE_INVADERS_GLES
+    // The one 32-bit layout GLES uploads as it is; RGB565 uploads as is too
+    else if(use_gl && pixel_format != PIXEL_RGB565) pixel_format = PIXEL_RGBA8888_REV;
+#endif
+    else if(negotiate_format)
+    {
+        printf("Probing upload formats:\n");
+        pixel_format = negotiate_pixel_format(buffer_width, buffer_height);
+    }
+    printf("Pixel format: %s\n", pixel_format_name(pixel_format));
 
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    const Color* color_table = color_tables[pixel_format];
 
-    GLFWwindow* window = glfwCreateWindow(640, 480, "Space Invaders", NULL, NULL);
+    Buffer buffer;
+    buffer.width = buffer_width;
+    buffer.height = buffer_height;
+    buffer.format = pixel_format;
+    buffer.data = 0;
+    buffer.indices = 0;
+    buffer.data16 = 0;
+    set_buffer_pixels(&buffer, (uint8_t*)alloc_pages(buffer_width * buffer_height * buffer_pixel_size(buffer)));
+    buffer.palette = &palette;
+    buffer.num_dirty = 0;
+    buffer.num_prev_dirty = 0;
+    buffer.gpu = 0;
+    buffer.draw_list = 0;
+    buffer.text_overlay = 0;
+    buffer.text_list = 0;
+
+    GLuint fullscreen_triangle_vao = 0;
+    GLuint shader_id = 0;
+    // The CRT program while it still compiles behind the plain blit
+    ProgramBuild crt_build = {};
+    ProgramBuild* crt_upgrade = 0;
+    GLuint buffer_texture = 0;
+    TextOverlay* text_overlay = 0;
+    PixelUploader uploader = {};
+    GpuTimers* gpu_timers = 0;
+    ScreenshotReadback* screenshots = 0;
+    UploadThread* upload_thread = 0;
+    GpuSpriteRenderer* gpu_renderer = 0;
+    DebugOverlay* debug_overlay = 0;
+    ShaderCache shader_cache = {};
+    mark_startup_phase(&startup_profile, STARTUP_BUFFERS);
+    if(use_gl)
+    {
+        open_shader_cache(&shader_cache, shader_cache_path);
+
+        // Shaders
+        const char* vertex_shader =
+            "\n"
+            GLSL_HEADER
+            "\n"
+            GLSL_NOPERSPECTIVE "out vec2 TexCoord;\n"
+            "\n"
+            "void main(void){\n"
+            "\n"
+            "    TexCoord.x = (gl_VertexID == 2)? 2.0: 0.0;\n"
+            "    TexCoord.y = (gl_VertexID == 1)? 2.0: 0.0;\n"
+            "    \n"
+            "    gl_Position = vec4(2.0 * TexCoord - 1.0, 0.0, 1.0);\n"
+            "}\n";
+
+        const char* fragment_shader =
+            "\n"
+            GLSL_HEADER
+            "\n"
+            "uniform sampler2D buffer;\n"
+            GLSL_NOPERSPECTIVE "in vec2 TexCoord;\n"
+            "\n"
+            "out vec3 outColor;\n"
+            "\n"
+            "void main(void){\n"
+            "    outColor = texture(buffer, TexCoord).rgb;\n"
+            "}\n";
+
+        const char* palette_fragment_shader =
+            "\n"
+            GLSL_HEADER
+            "\n"
+            "uniform sampler2D buffer;\n"
+            "uniform sampler2D palette;\n"
+            GLSL_NOPERSPECTIVE "in vec2 TexCoord;\n"
+            "\n"
+            "out vec3 outColor;\n"
+            "\n"
+            "void main(void){\n"
+            "    float index = texture(buffer, TexCoord).r;\n"
+            "    outColor = texelFetch(palette, ivec2(int(index * 255.0 + 0.5), 0), 0).rgb;\n"
+            "}\n";
     
-    if (!window)
+        glGenVertexArrays(1, &fullscreen_triangle_vao);
+
+        const char* present_shader = use_indexed ? palette_fragment_shader : fragment_shader;
+        static char crt_shader[CRT_SHADER_MAX];
+        if(crt_quality != CRT_OFF)
+        {
+            // With parallel compiles it builds beside the other programs,
+            // and the first frames go through the plain blit until it links
+            build_crt_shader(crt_shader, sizeof(crt_shader), crt_quality, use_indexed);
+            const GLenum stages[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+            const char* sources[] = {vertex_shader, crt_shader};
+            start_program_build(&crt_build, stages, sources, 2, &shader_cache);
+            if(crt_build.state == BUILD_LINKED || !gl_caps.parallel_shader_compile)
+            {
+                shader_id = finish_program_build(&crt_build);
+                if(!shader_id) fprintf(stderr, "The CRT shader failed, presenting without it.\n");
+            }
+            else crt_upgrade = &crt_build;
+        }
+        if(!shader_id) shader_id = create_program(vertex_shader, present_shader, &shader_cache);
+
+        if(!shader_id)
+        {
+            if(crt_upgrade) cancel_program_build(crt_upgrade);
+            fprintf(stderr, "Error while validating shader.\n");
+            glfwTerminate();
+            glDeleteVertexArrays(1, &fullscreen_triangle_vao);
+            free_pages(buffer_pixels(buffer));
+            finish_startup_assets(&startup_assets, &startup_profile);
+            return -1;
+        }
+        mark_startup_phase(&startup_profile, STARTUP_SHADERS);
+
+        // Texture
+        glGenTextures(1, &buffer_texture);
+
+        glBindTexture(GL_TEXTURE_2D, buffer_texture);
+        glTexImage2D(
+            GL_TEXTURE_2D, 0, buffer_gl_internal_format(buffer),
+            buffer.width, buffer.height, 0,
+            buffer_gl_format(buffer), buffer_gl_type(buffer), 0
+        );
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        UploadMode active_upload_mode = init_uploader(&uploader, &buffer, upload_mode);
+        printf("Upload mode: %s\n", upload_mode_name(active_upload_mode));
+
+        gpu_timers = new GpuTimers;
+        if(init_gpu_timers(gpu_timers)) uploader.gpu_timers = gpu_timers;
+        else
+        {
+            delete gpu_timers;
+            gpu_timers = 0;
+        }
+        printf("GPU timers: %s\n", gpu_timers ? "on" : "off");
+
+        screenshots = new ScreenshotReadback;
+        if(!init_screenshot_readback(screenshots, "screenshot"))
+        {
+            delete screenshots;
+            screenshots = 0;
+        }
+
+        if(use_gpu_renderer)
+        {
+            gpu_renderer = new GpuSpriteRenderer;
+            if(init_gpu_renderer(gpu_renderer, buffer_texture, buffer.width, buffer.height, use_compute_renderer, &shader_cache))
+            {
+                buffer.gpu = gpu_renderer;
+            }
+            else
+            {
+                delete gpu_renderer;
+                gpu_renderer = 0;
+            }
+        }
+        printf("Renderer: %s\n", gpu_renderer ? gpu_renderer->compute ? "compute" : "gpu" : "cpu");
+
+        if(use_text_overlay)
+        {
+            text_overlay = new TextOverlay;
+            if(!init_text_overlay(text_overlay, buffer.width, buffer.height, &shader_cache))
+            {
+                fprintf(stderr, "The text shader failed, rasterizing text.\n");
+                delete text_overlay;
+                text_overlay = 0;
+            }
+        }
+        printf("Text: %s\n", text_overlay ? "gpu" : "cpu");
+
+        // Built on the thread that swaps, so not beside a render thread
+        if(!use_render_thread)
+        {
+            debug_overlay = create_debug_overlay(window, &shader_cache);
+            if(!debug_overlay) fprintf(stderr, "The debug overlay shader failed, F2 does nothing.\n");
+        }
+
+        if(use_upload_thread && gpu_renderer)
+        {
+            fprintf(stderr, "The GPU renderer uploads no pixels, ignoring --upload-thread.\n");
+        }
+        else if(use_upload_thread)
+        {
+            if(upload_frames > 1 && active_upload_mode == UPLOAD_PERSISTENT)
+            {
+                fprintf(stderr, "Persistent uploads draw into the mapped buffer, ignoring --upload-frames.\n");
+                upload_frames = 1;
+            }
+            upload_thread = new UploadThread;
+            if(start_upload_thread(upload_thread, window, &uploader, &buffer, buffer_texture, upload_frames))
+            {
+                printf("Upload thread: on, %zu framebuffer%s\n", upload_frames, upload_frames > 1 ? "s" : "");
+            }
+            else
+            {
+                fprintf(stderr, "Could not create a shared context, uploading on the main thread.\n");
+                delete upload_thread;
+                upload_thread = 0;
+            }
+        }
+
+        glUseProgram(shader_id);
+
+        GLint location = glGetUniformLocation(shader_id, "buffer");
+        glUniform1i(location, 0);
+
+        if(use_indexed)
+        {
+            glGenTextures(1, &palette.texture);
+            glActiveTexture(GL_TEXTURE2);
+            // A 256x1 2D texture, GLES has no 1D ones
+            glBindTexture(GL_TEXTURE_2D, palette.texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PALETTE_MAX_COLORS, 1, 0, pixel_gl_format(PIXEL_RGBA8888), pixel_gl_type(PIXEL_RGBA8888), 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            set_palette_swizzle();
+            glUniform1i(glGetUniformLocation(shader_id, "palette"), 2);
+        }
+
+        glDisable(GL_DEPTH_TEST);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(fullscreen_triangle_vao);
+
+        if(shader_cache.enabled)
+        {
+            printf("Shader cache: %zu of %zu programs from '%s'\n", shader_cache.hits, shader_cache.hits + shader_cache.misses, shader_cache.path);
+        }
+        else printf("Shader cache: off\n");
+        // The CRT program is stored once it links, so the file waits for it
+        if(!crt_upgrade) close_shader_cache(&shader_cache);
+    }
+    else if(vulkan)
     {
-        glfwTerminate();
-        return -1;
+        // Like persistent mapping: the rasterizer draws into the staging buffer
+        uploader.vulkan = vulkan;
+        uploader.cpu_data = buffer_pixels(buffer);
+        set_buffer_pixels(&buffer, vulkan_staging_pixels(vulkan));
+        printf("Upload mode: vulkan staging\n");
+    }
+    else if(wayland)
+    {
+        // The rasterizer draws straight into the wl_shm buffers
+        uploader.wayland = wayland;
+        uploader.cpu_data = buffer_pixels(buffer);
+        bind_wayland_buffer(wayland, &buffer);
+        printf("Upload mode: wl_shm\n");
+    }
+    else if(x11)
+    {
+        // Changed rectangles are copied into the shared XImage, flipped
+        uploader.x11 = x11;
+        printf("Upload mode: MIT-SHM\n");
+    }
+    else if(kms)
+    {
+        // And into the dumb buffer that goes on screen next, scaled up
+        uploader.kms = kms;
+        printf("Upload mode: KMS dumb buffers\n");
+    }
+    else if(terminal)
+    {
+        // And boxed down into character cells
+        uploader.terminal = terminal;
+        printf("Upload mode: terminal cells\n");
+    }
+    select_frame_pipeline(&uploader, vulkan ? PRESENT_VULKAN : wayland ? PRESENT_WAYLAND : x11 ? PRESENT_X11 :
+        kms ? PRESENT_KMS : terminal ? PRESENT_TERMINAL : PRESENT_GL);
+
+    // Mapped and indexed buffers have no second array to draw into
+    StreamedBuffer streamed = {};
+    if(stream_path && (buffer.gpu || use_indexed || uploader.cpu_data))
+    {
+        fprintf(stderr, "Streams need the CPU renderer drawing into its own full-color buffer, ignoring --stream.\n");
+    }
+    else if(stream_path)
+    {
+        FrameStream* stream = open_frame_stream(stream_path, buffer.width, buffer.height, buffer_pixel_size(buffer), stream_encoding);
+        if(stream)
+        {
+            init_streamed_buffer(&streamed, &buffer, stream);
+            uploader.stream = &streamed;
+            const char* encoding = stream_encoding == STREAM_RAW ? "rawvideo" : stream_encoding_name(stream_encoding);
+            printf("Streaming %zux%zu %s %s to '%s'\n", buffer.width, buffer.height, stream_pixel_format(buffer.format), encoding, stream_path);
+        }
+        else fprintf(stderr, "Could not stream to '%s'.\n", stream_path);
     }
-
-    glfwMakeContextCurrent(window);
-
-    // GLEW Initialization
-    GLenum err = glewInit();
-
-    if(err != GLEW_OK)
+    mark_startup_phase(&startup_profile, STARTUP_TEXTURES);
+
+    Presenter presenter;
+    presenter.mode = scale_mode;
+    presenter.source_width = buffer.width;
+    presenter.source_height = buffer.height;
+    presenter.text = text_overlay;
+    presenter.text_vao = text_overlay ? text_overlay->vao : 0;
+    presenter.debug = debug_overlay;
+    presenter.screenshots = screenshots;
+    FrameFences frame_fences;
+    init_frame_fences(&frame_fences, use_gl ? frames_in_flight : 0);
+    presenter.in_flight = &frame_fences;
+    presenter.program = shader_id;
+    presenter.upgrade = crt_upgrade;
+    presenter.spectators = 0;
+    presenter.num_spectators = 0;
+    int initial_width, initial_height;
+    glfwGetFramebufferSize(window, &initial_width, &initial_height);
+    framebuffer_size_callback(window, initial_width, initial_height);
+    printf("Scale mode: %s\n", scale_mode_name(scale_mode));
+    if(use_gl) printf("CRT pass: %s\n", crt_quality_name(crt_quality));
+    else if(crt_quality != CRT_OFF) fprintf(stderr, "The CRT pass is a GL shader, ignoring --crt.\n");
+    if(use_gl && frames_in_flight) printf("Frames in flight: %zu, late input %s\n", frames_in_flight, late_input ? "on" : "off");
+    else if(use_gl) printf("Frames in flight: driver, late input %s\n", late_input ? "on" : "off");
+    else if(frames_in_flight && !headless) fprintf(stderr, "Frames in flight are capped with GL fences, ignoring --frames-in-flight.\n");
+
+    SpectatorWindow spectators[SPECTATOR_MAX_WINDOWS];
+    if(use_gl && num_spectators)
     {
-        fprintf(stderr, "Error initializing GLEW.\n");
-        glfwTerminate();
-        return -1;
+        int num_monitors = 0;
+        GLFWmonitor** monitors = glfwGetMonitors(&num_monitors);
+        for(size_t si = 0; si < num_spectators; ++si)
+        {
+            // Every monitor but the game's own
+            int game_monitor = fullscreen.monitor ? fullscreen_monitor : 0;
+            int mi = (int)si + ((int)si >= game_monitor ? 1 : 0);
+            GLFWmonitor* monitor = mi < num_monitors ? monitors[mi] : 0;
+            SpectatorWindow* spectator = &spectators[presenter.num_spectators];
+            if(!open_spectator(spectator, window, monitor, presenter, shader_id, buffer_texture, palette.texture))
+            {
+                fprintf(stderr, "Could not open spectator window %zu.\n", si + 1);
+                continue;
+            }
+            ++presenter.num_spectators;
+            printf("Spectator %zu: %s\n", si + 1, monitor ? glfwGetMonitorName(monitor) : "windowed");
+        }
+        if(presenter.num_spectators) presenter.spectators = spectators;
     }
 
-    // OpenGL Initialization
-    int glVersion[2] = {-1, 1};
-    glGetIntegerv(GL_MAJOR_VERSION, &glVersion[0]);
-    glGetIntegerv(GL_MINOR_VERSION, &glVersion[1]);
-    printf("Using OpenGL: %d.%d\n", glVersion[0], glVersion[1]);
-
-    glClearColor(1.0, 0.0, 0.0, 1.0);
-    
-    glfwSwapInterval(1);
-    glfwSetKeyCallback(window, key_callback);
-
     /*
     ################################################
-    ##                BUFFER SETUP                ##
+    ##                  SPRITES                   ##
     ################################################
     */
 
-    Buffer buffer;
-    buffer.width = buffer_width;
-    buffer.height = buffer_height;
-    buffer.data = new uint32_t[buffer_width * buffer_height];
-
-    // Shaders
-    const char* vertex_shader =
-        "\n"
-        "#version 330\n"
-        "\n"
-        "noperspective out vec2 TexCoord;\n"
-        "\n"
-        "void main(void){\n"
-        "\n"
-        "    TexCoord.x = (gl_VertexID == 2)? 2.0: 0.0;\n"
-        "    TexCoord.y = (gl_VertexID == 1)? 2.0: 0.0;\n"
-        "    \n"
-        "    gl_Position = vec4(2.0 * TexCoord - 1.0, 0.0, 1.0);\n"
-        "}\n";
-
-    const char* fragment_shader =
-        "\n"
-        "#version 330\n"
-        "\n"
-        "uniform sampler2D buffer;\n"
-        "noperspective in vec2 TexCoord;\n"
-        "\n"
-        "out vec3 outColor;\n"
-        "\n"
-        "void main(void){\n"
-        "    outColor = texture(buffer, TexCoord).rgb;\n"
-        "}\n";
-    
-    GLuint fullscreen_triangle_vao;
-    glGenVertexArrays(1, &fullscreen_triangle_vao);
+    finish_startup_assets(&startup_assets, &startup_profile);
+    Sprite title_sprite = startup_assets.title_sprite;
+    Sprite particle_sprite = startup_assets.particle_sprite;
+    Sprite text_spritesheet = startup_assets.text_spritesheet;
 
-    GLuint shader_id = glCreateProgram();
-    // Vertex Shader
+    // The game core collides against its own sprites, so only art that is
+    // just drawn can come from an atlas. The file stays mapped until exit
+    AtlasFile atlas = startup_assets.atlas;
+    if(atlas.data)
     {
-        GLuint shader_vp = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(shader_vp, 1, &vertex_shader, 0);
-        glCompileShader(shader_vp);
-        validate_shader(shader_vp, vertex_shader);
-        glAttachShader(shader_id, shader_vp);
-
-        glDeleteShader(shader_vp);
+        printf("Sprite atlas: %zu of %zu sprites from '%s'\n", startup_assets.atlas_applied, atlas.num_entries, atlas_path);
     }
 
-    // Fragment Shader
-    {
-        GLuint shader_fp = glCreateShader(GL_FRAGMENT_SHADER);
-
-        glShaderSource(shader_fp, 1, &fragment_shader, 0);
-        glCompileShader(shader_fp);
-        validate_shader(shader_fp, fragment_shader);
-        glAttachShader(shader_id, shader_fp);
+    // The digits are glyphs 16 to 25 of the font
+    Sprite number_spritesheet = sprite_frame(text_spritesheet, code_point_glyph('0'));
 
-        glDeleteShader(shader_fp);
+    if(gpu_renderer)
+    {
+        gpu_atlas_add(gpu_renderer, alien_sprite, alien_sprite.height);
+        gpu_atlas_add(gpu_renderer, alien_sprite1, alien_sprite1.height);
+        gpu_atlas_add(gpu_renderer, squid_sprite, squid_sprite.height);
+        gpu_atlas_add(gpu_renderer, squid_sprite1, squid_sprite1.height);
+        gpu_atlas_add(gpu_renderer, octopus_sprite, octopus_sprite.height);
+        gpu_atlas_add(gpu_renderer, octopus_sprite1, octopus_sprite1.height);
+        gpu_atlas_add(gpu_renderer, alien_death_sprite, alien_death_sprite.height);
+        gpu_atlas_add(gpu_renderer, player_sprite, player_sprite.height);
+        gpu_atlas_add(gpu_renderer, projectile_sprite, projectile_sprite.height);
+        gpu_atlas_add(gpu_renderer, muzzle_flash_sprite, muzzle_flash_sprite.height);
+        gpu_atlas_add(gpu_renderer, particle_sprite, particle_sprite.height);
+        gpu_atlas_add(gpu_renderer, title_sprite, title_sprite.height);
+        gpu_atlas_add(gpu_renderer, text_spritesheet, FONT_NUM_GLYPHS * text_spritesheet.height);
+        gpu_build_atlas(gpu_renderer);
+        glBindTexture(GL_TEXTURE_2D, buffer_texture);
     }
-
-    glLinkProgram(shader_id);
-
-    if(!validate_program(shader_id))
+    if(text_overlay)
     {
-        fprintf(stderr, "Error while validating shader.\n");
-        glfwTerminate();
-        glDeleteVertexArrays(1, &fullscreen_triangle_vao);
-        delete[] buffer.data;
-        return -1;
+        set_text_overlay_font(text_overlay, text_spritesheet, FONT_NUM_GLYPHS);
+        attach_text_overlay(&buffer, text_overlay);
     }
 
-    // Texture
-    GLuint buffer_texture;
-    glGenTextures(1, &buffer_texture);
-
-    glBindTexture(GL_TEXTURE_2D, buffer_texture);
-    glTexImage2D(
-        GL_TEXTURE_2D, 0, GL_RGB8,
-        buffer.width, buffer.height, 0,
-        GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, buffer.data
-    );
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    glUseProgram(shader_id);
-
-    GLint location = glGetUniformLocation(shader_id, "buffer");
-    glUniform1i(location, 0);
-
-    glDisable(GL_DEPTH_TEST);
-    glActiveTexture(GL_TEXTURE0);
-    glBindVertexArray(fullscreen_triangle_vao);
+    TextCache* text_cache = new TextCache();
+    NumberWidget* profiler_widgets = new NumberWidget[PROFILER_WIDGETS]();
+    FrameProfiler* profiler = new FrameProfiler();
+    profiler->gpu = gpu_timers;
+    PerfCounters* counters = 0;
+    if(use_counters)
+    {
+        counters = new PerfCounters;
+        if(open_perf_counters(counters))
+        {
+            profiler->counters = counters;
+            printf("Hardware counters: %zu of %d\n", counters->num_open, NUM_PERF_COUNTERS);
+        }
+    }
+    ScaledSpriteCache* scaled_cache = new ScaledSpriteCache();
+    mark_startup_phase(&startup_profile, STARTUP_SPRITES);
 
     /*
     ################################################
-    ##                  SPRITES                   ##
+    ##               GAME SETTINGS                ##
     ################################################
     */
 
-    Sprite alien_sprite;
-    alien_sprite.width = 11;
-    alien_sprite.height = 8;
-    alien_sprite.data = new uint8_t[11 * 8]
-    {
-        0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
-        0,0,0,1,0,0,0,1,0,0,0, // ...@...@...
-        0,0,1,1,1,1,1,1,1,0,0, // ..@@@@@@@..
-        0,1,1,0,1,1,1,0,1,1,0, // .@@.@@@.@@.
-        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-        1,0,1,1,1,1,1,1,1,0,1, // @.@@@@@@@.@
-        1,0,1,0,0,0,0,0,1,0,1, // @.@.....@.@
-        0,0,0,1,1,0,1,1,0,0,0  // ...@@.@@...
-    };
-
-    Sprite alien_sprite1;
-    alien_sprite1.width = 11;
-    alien_sprite1.height = 8;
-    alien_sprite1.data = new uint8_t[88]
-    {
-        0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
-        1,0,0,1,0,0,0,1,0,0,1, // @..@...@..@
-        1,0,1,1,1,1,1,1,1,0,1, // @.@@@@@@@.@
-        1,1,1,0,1,1,1,0,1,1,1, // @@@.@@@.@@@
-        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-        0,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@.
-        0,0,1,0,0,0,0,0,1,0,0, // ..@.....@..
-        0,1,0,0,0,0,0,0,0,1,0  // .@.......@.
-    };
-
-    Sprite alien_death_sprite;
-    alien_death_sprite.width = 13;
-    alien_death_sprite.height = 7;
-    alien_death_sprite.data = new uint8_t[91]
-    {
-        0,1,0,0,1,0,0,0,1,0,0,1,0, // .@..@...@..@.
-        0,0,1,0,0,1,0,1,0,0,1,0,0, // ..@..@.@..@..
-        0,0,0,1,0,0,0,0,0,1,0,0,0, // ...@.....@...
-        1,1,0,0,0,0,0,0,0,0,0,1,1, // @@.........@@
-        0,0,0,1,0,0,0,0,0,1,0,0,0, // ...@.....@...
-        0,0,1,0,0,1,0,1,0,0,1,0,0, // ..@..@.@..@..
-        0,1,0,0,1,0,0,0,1,0,0,1,0  // .@..@...@..@.
-    };
-
-    Sprite player_sprite;
-    player_sprite.width = 11;
-    player_sprite.height = 7;
-    player_sprite.data = new uint8_t[77]
-    {
-        0,0,0,0,0,1,0,0,0,0,0, // .....@.....
-        0,0,0,0,1,1,1,0,0,0,0, // ....@@@....
-        0,0,0,0,1,1,1,0,0,0,0, // ....@@@....
-        0,1,1,1,1,1,1,1,1,1,0, // .@@@@@@@@@.
-        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-        1,1,1,1,1,1,1,1,1,1,1, // @@@@@@@@@@@
-    };
-
-    Sprite projectile_sprite;
-    projectile_sprite.width = 1;
-    projectile_sprite.height = 3;
-    projectile_sprite.data = new uint8_t[3]
-    {
-        1, // @
-        1, // @
-        1  // @
-    };
-
-    Sprite title_sprite;
-    title_sprite.width = 64;
-    title_sprite.height = 16;
-    title_sprite.data = new uint8_t[64 * 16]
-    {
-        // ROW 1: S P A C E
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,1,1,1,0,0,1,1,1,1,0,0,0,1,1,1,0,0,0,1,1,1,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,1,1,1,0,1,1,0,1,1,0,1,1,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,1,1,1,0,0,1,1,1,1,0,0,1,1,1,1,1,0,1,1,0,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,1,1,0,0,0,0,1,1,0,1,1,0,1,1,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,1,1,0,1,1,0,1,1,0,0,0,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,1,1,1,0,0,1,1,0,0,0,0,1,1,0,1,1,0,0,1,1,1,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        // ROW 2: I N V A D E R S
-        0,0,1,1,1,1,0,1,1,0,0,1,1,0,1,1,0,1,1,0,0,1,1,1,0,0,1,1,1,1,0,0,1,1,1,1,1,0,1,1,1,1,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,1,1,0,0,1,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,0,1,0,1,1,0,1,1,0,1,1,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,1,1,0,0,1,1,1,1,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,0,0,0,1,1,0,1,1,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,1,1,0,0,1,1,0,1,1,1,0,1,1,0,1,1,0,1,1,1,1,1,0,1,1,0,1,1,0,1,1,1,0,0,0,1,1,1,1,0,0,0,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,1,1,0,0,1,1,0,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1,0,0,1,0,1,1,1,1,0,0,1,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,1,1,1,1,0,1,1,0,0,1,1,0,0,1,1,1,0,0,1,1,0,1,1,0,1,1,1,1,0,0,1,1,1,1,1,0,1,1,0,1,1,0,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-    };
-
-    Sprite text_spritesheet;
-    text_spritesheet.width = 5;
-    text_spritesheet.height = 7;
-    text_spritesheet.data = new uint8_t[65 * 35]
-    {
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,0,1,0,0,
-        0,1,0,1,0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,1,0,1,0,0,1,0,1,0,1,1,1,1,1,0,1,0,1,0,1,1,1,1,1,0,1,0,1,0,0,1,0,1,0,
-        0,0,1,0,0,0,1,1,1,0,1,0,1,0,0,0,1,1,1,0,0,0,1,0,1,0,1,1,1,0,0,0,1,0,0,
-        1,1,0,1,0,1,1,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,1,1,0,1,0,1,1,
-        0,1,1,0,0,1,0,0,1,0,1,0,0,1,0,0,1,1,0,0,1,0,0,1,0,1,0,0,0,1,0,1,1,1,1,
-        0,0,0,1,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,
-        1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,
-        0,0,1,0,0,1,0,1,0,1,0,1,1,1,0,0,0,1,0,0,0,1,1,1,0,1,0,1,0,1,0,0,1,0,0,
-        0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,1,1,1,1,1,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,
-        0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,
-
-        0,1,1,1,0,1,0,0,0,1,1,0,0,1,1,1,0,1,0,1,1,1,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        0,0,1,0,0,0,1,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,1,1,0,
-        0,1,1,1,0,1,0,0,0,1,0,0,0,0,1,0,0,1,1,0,0,1,0,0,0,1,0,0,0,0,1,1,1,1,1,
-        1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,1,0,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        0,0,0,1,0,0,0,1,1,0,0,1,0,1,0,1,0,0,1,0,1,1,1,1,1,0,0,0,1,0,0,0,0,1,0,
-        1,1,1,1,1,1,0,0,0,0,1,1,1,1,0,0,0,0,0,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,0,1,1,1,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-
-        0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,1,0,0,
-        0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,
-        0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,
-        1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,
-        0,1,1,1,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,0,0,0,0,0,1,0,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,1,0,1,1,1,0,1,1,1,0,1,0,0,1,0,0,0,1,0,1,1,1,0,
-
-        0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,1,1,0,0,0,1,1,0,0,0,1,
-        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,0,1,1,1,0,
-        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,
-        1,1,1,1,1,1,0,0,0,0,1,0,0,0,0,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,1,1,1,1,
-        1,1,1,1,1,1,0,0,0,0,1,0,0,0,0,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,1,0,1,1,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,1,1,1,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,
-        0,1,1,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,1,1,1,0,
-        0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        1,0,0,0,1,1,0,0,1,0,1,0,1,0,0,1,1,0,0,0,1,0,1,0,0,1,0,0,1,0,1,0,0,0,1,
-        1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,1,1,1,1,
-        1,0,0,0,1,1,1,0,1,1,1,0,1,0,1,1,0,1,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,
-        1,0,0,0,1,1,0,0,0,1,1,1,0,0,1,1,0,1,0,1,1,0,0,1,1,1,0,0,0,1,1,0,0,0,1,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,1,0,1,1,0,0,1,1,0,1,1,1,1,
-        1,1,1,1,0,1,0,0,0,1,1,0,0,0,1,1,1,1,1,0,1,0,1,0,0,1,0,0,1,0,1,0,0,0,1,
-        0,1,1,1,0,1,0,0,0,1,1,0,0,0,0,0,1,1,1,0,1,0,0,0,1,0,0,0,0,1,0,1,1,1,0,
-        1,1,1,1,1,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,
-        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,1,1,0,
-        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,
-        1,0,0,0,1,1,0,0,0,1,1,0,0,0,1,1,0,1,0,1,1,0,1,0,1,1,1,0,1,1,1,0,0,0,1,
-        1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,1,0,0,0,1,
-        1,0,0,0,1,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,
-        1,1,1,1,1,0,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,1,0,0,0,0,1,1,1,1,1,
-
-        0,0,0,1,1,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,1,
-        0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,0,1,0,0,0,0,1,0,
-        1,1,0,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1,0,0,1,1,0,0,0,
-        0,0,1,0,0,0,1,0,1,0,1,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-        0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,
-        0,0,1,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
-    };
-
-    Sprite number_spritesheet = text_spritesheet;
-    number_spritesheet.data += 16 * 35;
-
-    SpriteAnimation* alien_animation = new SpriteAnimation;
-
-    alien_animation->loop = true;
-    alien_animation->num_frames = 2;
-    alien_animation->frame_duration = 0.5f;
-    alien_animation->time = 0.0f;
-
-    alien_animation->frames = new Sprite*[2];
-    alien_animation->frames[0] = &alien_sprite;
-    alien_animation->frames[1] = &alien_sprite1;
-
-    float player_speed = 60.0f;
-
-    TextAnimation* msg_animation = new TextAnimation;
-    msg_animation->type_timer = 0.0f;
-    msg_animation->page_timer = 0.0f;
-    msg_animation->current_page = 0;
-    msg_animation->current_line = 0;
-    msg_animation->chars_visible = 0;
-    msg_animation->type_speed = 13.0f;
-    msg_animation->animation_complete = false;
-
-    // --- CHOICE VARIABLES ---
-    bool choice_phase = false;
-    Alien yes_alien;
-    yes_alien.x = 60; yes_alien.y = 80; yes_alien.type = ALIEN_1;
-    Alien no_alien;
-    no_alien.x = 130; no_alien.y = 80; no_alien.type = ALIEN_1;
-
-    msg_animation->num_pages = NUM_PAGES;
-    msg_animation->pages = new TextPage[NUM_PAGES]; 
+    // The formation, story pages and everything else the simulation owns
+    // are set up in game.cpp, by now on the startup assets thread
+    StoryPages* story = startup_assets.story;
+    if(!memory_budget) configure_game_state(&state, replay, pgo_train, bullet_hell, stress ? &sweep : 0, seek_tick);
 
-    /*
-    ################################################
-    ##                PAGE SETUP                 ##
-    ################################################
-    */
+    // Particles get what the budget leaves
+    ParticleSystem particles;
+    init_particle_system(&particles, particle_capacity);
+    // Benchmarks keep the effects they were asked for, whatever the machine
+    QualityGovernor quality;
+    init_quality_governor(&quality, quality_level, quality_auto && !headless, &particles);
+    mark_startup_phase(&startup_profile, STARTUP_FORMATION);
 
-    // --- SETUP PAGE X ---
-    // State number of lines: 
-    // msg_animation->pages[X].num_lines = NUM_LINES_IN_THIS_PAGE;
-    // msg_animation->pages[X].lines = new const char*[NUM_LINES_IN_THIS_PAGE];
-    
-    // Insert your lines: 
-    // msg_animation->pages[X].lines[0] = <INSERT LINE HERE>; (up to 32 characters per line)
-    // msg_animation->pages[X].lines[1] = <INSERT LINE HERE>;
-    // etc.
+    Game& game = state.game;
 
     /*
     ################################################
-    ##               GAME SETTINGS                ##
+    ##                 GAME LOOP                  ##
     ################################################
     */
 
-    Game game;
-    game.width = buffer_width;
-    game.height = buffer_height;
-    game.num_aliens = 72;
-    game.num_projectiles = 0;
-    game.aliens = new Alien[game.num_aliens]();
-
-    game.player.x = 112 - 5;
-    game.player.y = 32;     
-    game.player.life = 3;
+    const Color& clear_color = color_table[COLOR_BACKGROUND];
+    clear_buffer(&buffer, clear_color);
 
-    int alien_rows = 6;
-    int alien_cols = 12;
+    // The title needs its own layer alone, the game's are filled in
+    // behind it
+    Layer title_layer = {};
+    Layer layers[NUM_LAYERS] = {};
+    LayerLoader layer_loader = {};
+    if(!buffer.gpu)
+    {
+        init_layer(&title_layer, buffer, clear_color);
+        Color layer_clears[NUM_LAYERS];
+        layer_clears[LAYER_BACKGROUND] = clear_color;
+        for(size_t li = LAYER_FORMATION; li < NUM_LAYERS; ++li) layer_clears[li] = layer_transparent;
+        start_layer_loader(&layer_loader, layers, layer_clears, NUM_LAYERS, buffer);
+        if(text_overlay)
+        {
+            attach_text_overlay(&title_layer.buffer, text_overlay);
+            for(size_t li = 0; li < NUM_LAYERS; ++li) attach_text_overlay(&layers[li].buffer, text_overlay);
+        }
+    }
 
-    for (size_t yi = 0; yi < alien_rows; ++yi)
+    // With more than one thread, layers are rasterized in bands
+    ThreadPool* thread_pool = 0;
+    DrawList* draw_lists = 0;
+    if(!buffer.gpu && num_threads != 1)
     {
-        for (size_t xi = 0; xi < alien_cols; ++xi)
-        {   
-            int index = yi * alien_cols + xi;
+        thread_pool = new ThreadPool;
+        init_thread_pool(thread_pool, num_threads);
+        printf("Raster threads: %zu\n", thread_pool->num_workers + 1);
 
-            if ((xi == 3 && yi == 0) || (xi == 3 && yi == 1) || (xi == 3 && yi == 5) ||
-            (xi == 4 && yi == 0) || (xi == 5 && yi == 5) || (xi == 6 && yi == 0) || 
-            (xi == 7 && yi == 0) || (xi == 7 && yi == 1) || (xi == 10 && yi == 2) || 
-            (xi == 10 && yi == 3) || (xi == 10 && yi == 4) || (xi == 10 && yi == 5) || 
-            (xi == 10 && yi == 1) || (xi == 7 && yi == 5) || (xi == 2) || (xi == 8))
-                continue;
-            
-            game.aliens[index].x = 16 * xi + 20;
-            game.aliens[index].y = 17 * yi + 102;
-            game.aliens[index].type = ALIEN_1;
-            game.aliens[index].hp = 2;
+        draw_lists = new DrawList[NUM_LAYERS + 1];
+        for(size_t li = 0; li <= NUM_LAYERS; ++li)
+        {
+            draw_lists[li].pool = thread_pool;
+            draw_lists[li].num_commands = 0;
+        }
+        title_layer.buffer.draw_list = &draw_lists[NUM_LAYERS];
+        for(size_t li = 0; li < NUM_LAYERS; ++li)
+        {
+            layers[li].buffer.draw_list = &draw_lists[li];
         }
     }
 
-    uint8_t* death_counters = new uint8_t[game.num_aliens];
-    for(size_t i = 0; i < game.num_aliens; ++i)
+    FrameRenderer renderer = {};
+    renderer.buffer = &buffer;
+    renderer.layers = layers;
+    renderer.title_layer = &title_layer;
+    renderer.text_cache = text_cache;
+    renderer.scaled_cache = scaled_cache;
+    renderer.profiler_widgets = profiler_widgets;
+    renderer.profiler = profiler;
+    renderer.particles = &particles;
+    renderer.thread_pool = thread_pool;
+    renderer.color_table = color_table;
+    renderer.title_sprite = title_sprite;
+    renderer.particle_sprite = particle_sprite;
+    set_font_sheet(&renderer.font, text_spritesheet);
+    renderer.number_spritesheet = number_spritesheet;
+    renderer.layout_x = layout_x;
+    renderer.layout_y = layout_y;
+    renderer.formation_version = state.formation_version;
+    renderer.layer_loader = &layer_loader;
+    if(!gpu_renderer)
     {
-        death_counters[i] = 10;
+        set_raster_path(&renderer, raster_path);
+        printf("Raster path: %s\n", raster_path_name(raster_path));
     }
 
-    /*
-    ################################################
-    ##                 GAME LOOP                  ##
-    ################################################
-    */
+    // The GPU renderer has one path of its own, and the render thread
+    // draws on its own. Uploads switch only where the buffer is this
+    // thread's to move: not beside an upload thread, nor while a stream
+    // alternates its pixels
+    RenderVariants variants;
+    init_render_variants(&variants, buffer, !headless && !gpu_renderer && !use_render_thread, use_gl && !gpu_renderer && !use_render_thread && !upload_thread && !uploader.stream);
+
+    DebugOverlaySources overlay_sources = {profiler, &state, &particles, &pacer, &presenter, &show_profiler, &variants, &renderer, &uploader};
+
+    // The GPU atlas is built once, so there only the pages reload
+    AssetWatcher* asset_watcher = watch_assets ? start_asset_watcher(gpu_renderer ? 0 : atlas_path, pages_path) : 0;
+
+    // Headless runs play nothing, the sounds would come faster than time
+    AudioMixer* audio = 0;
+    AudioOutput* audio_output = 0;
+    // Voices play straight out of the mapping, so it stays until exit
+    SoundBank sound_bank = startup_assets.sound_bank;
+    if(startup_assets.mixer)
+    {
+        audio = startup_assets.mixer;
+        audio_output = start_audio_output(audio);
+        if(!audio_output)
+        {
+            destroy_audio_mixer(audio);
+            audio = 0;
+        }
+    }
 
-    uint32_t clear_color = rgb_to_uint32(255, 192, 203);
-    
     game_running = true;
-    int player_move_dir = 1;
+    if(trace_frames && TRACE_ENABLED)
+    {
+        start_trace();
+        trace_request.remaining = trace_frames;
+        printf("Tracing %zu frames\n", trace_frames);
+    }
     double last_time = glfwGetTime();
+    double sim_accumulator = 0.0;
+    // Benchmarks and fast replays step a tick a frame and never owe any;
+    // a spectator's ticks come off the network
+    FrameScheduler scheduler;
+    init_frame_scheduler(&scheduler, !headless && !spectate_client);
+    InputLatch input_latch = {};
+    LatencyMeter* latency = measure_latency ? new LatencyMeter() : 0;
 
-    size_t score = 0;
     size_t credits = 0; 
 
-    while (!glfwWindowShouldClose(window) && game_running)
+    // The benchmark replays waves of the starting formation, and so do
+    // recordings made from it
+    size_t bench_frame = 0, bench_waves = 0;
+    double bench_start = glfwGetTime();
+    // Training clears its one wave and goes on to the story, and starts
+    // from the title screen unless a recording drives it
+    bool respawn_waves = replay ? (replay->header.flags & REPLAY_RESPAWN) != 0 : headless && !pgo_train && !endless && !spectate_client;
+    WavePrefetcher* wave_prefetcher = 0;
+    if(endless && !stress && !respawn_waves)
     {
-        /*
-        ### DISPLAY CURRENT FRAME
-        */ 
-        clear_buffer(&buffer, clear_color);
-
-        double current_time = glfwGetTime();
-        double dt = current_time - last_time;
-        last_time = current_time;
-
-        if (!game_start)
+        wave_prefetcher = new WavePrefetcher;
+        start_wave_prefetcher(wave_prefetcher, &state);
+        printf("Endless waves: on\n");
+    }
+    // Prefetched waves swap arrays a saved state can't follow
+    RollbackSession* rollback = 0;
+    if(rollback_delay && (wave_prefetcher || stress || spectate_client))
+    {
+        fprintf(stderr, "Rollback replays plain waves of a game it simulates, ignoring --rollback.\n");
+    }
+    else if(rollback_delay)
+    {
+        rollback = new RollbackSession;
+        init_rollback_session(rollback, state, rollback_delay, respawn_waves);
+        printf("Rollback: inputs arrive %zu ticks late\n", rollback_delay);
+    }
+    uint32_t replay_flags = (respawn_waves ? REPLAY_RESPAWN : 0) | (wave_prefetcher ? REPLAY_ENDLESS : 0);
+    // Replays and spectators play what is already recorded, rolled back
+    // states run ahead of their input, stress and bullet hell resize the
+    // state, and a memory budget has no room for the history
+    FlightRecorder* flight = 0;
+    if(flight_seconds && !replay && !spectate_client && !rollback && !stress && !bullet_hell && !memory_budget)
+    {
+        flight = new FlightRecorder;
+        init_flight_recorder(flight, state, flight_seconds, buffer_width, buffer_height, replay_flags, flight_path);
+        if(install_flight_recorder(flight))
         {
-            draw_sprite_scaled(&buffer, title_sprite, 35, 130, 3, rgb_to_uint32(128, 0, 0));
-            draw_text_buffer(&buffer, text_spritesheet, "PRESS ENTER TO START", 50, 110, rgb_to_uint32(128, 0, 0));
-            draw_text_buffer(&buffer, text_spritesheet, "SPACE - SHOOT", 10, 7, rgb_to_uint32(128, 0, 0));
-            draw_text_buffer(&buffer, text_spritesheet, "<- -> - MOVE", 145, 7, rgb_to_uint32(128, 0, 0));
-
-            glTexSubImage2D(
-                GL_TEXTURE_2D, 0, 0, 0,
-                buffer.width, buffer.height,
-                GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
-                buffer.data
-            );
-
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glfwSwapBuffers(window);
+            size_t bytes = flight->capacity * (sizeof(uint8_t) + sizeof(uint64_t) + sizeof(ReplayRun)) + flight->num_snapshots * flight->stride;
+            printf("Flight recorder: the last %zu s in %.0f KB, dumped to '%s' on a crash or SIGUSR1\n", flight_seconds, bytes / 1024.0, flight_path);
+        }
+        else
+        {
+            destroy_flight_recorder(flight);
+            delete flight;
+            flight = 0;
+        }
+    }
+    SpectateServer* spectate_server = 0;
+    if(serve_port && stress)
+    {
+        fprintf(stderr, "Stress formations can't be spectated, ignoring --serve-spectators.\n");
+    }
+    else if(serve_port)
+    {
+        spectate_server = open_spectate_server((uint16_t)serve_port);
+        if(spectate_server) printf("Serving spectators on UDP port %lu\n", serve_port);
+        else fprintf(stderr, "Could not listen for spectators on UDP port %lu.\n", serve_port);
+    }
+    Reactor* reactor = 0;
+    if(event_loop == EVENT_LOOP_REACTOR)
+    {
+        reactor = new Reactor;
+        if(open_event_loop(reactor, spectate_client, spectate_server))
+        {
+            pacer.reactor = reactor;
+            printf("Event loop: %s", reactor_backend_name(*reactor));
+            for(size_t si = 0; si < reactor->num_sources; ++si) printf("%s %s", si ? "," : " on", reactor->sources[si].name);
+            printf("\n");
         }
-
         else
         {
-            still_alive = false;
+            delete reactor;
+            reactor = 0;
+        }
+    }
+    MetricsExporter* metrics = 0;
+    if(metrics_address || metrics_path)
+    {
+        metrics = start_metrics_exporter(metrics_address, metrics_path, metrics_interval);
+        if(metrics) printf("Exporting metrics every %.0f seconds\n", metrics_interval > 0.0 ? metrics_interval : METRICS_DEFAULT_INTERVAL);
+    }
+    // Watched and replayed runs aren't this cabinet's own
+    ScoreLog* score_log = scores_path && !spectate_client && !replay ? open_score_log(scores_path) : 0;
+    if(spectate_client)
+    {
+        game_start = true;
+        printf("Spectating '%s' at %zux%zu\n", spectate_address, buffer.width, buffer.height);
+    }
+    AutoplayBot bot;
+    init_autoplay_bot(&bot, CHOICE_YES);
+    PgoTraining training = {};
+    training.held = INPUT_FIRE;
+    training.bot = autoplay ? &bot : 0;
+    if(autoplay && !pgo_train)
+    {
+        game_start = true;
+        printf("Autoplay: on\n");
+    }
+    SoakTest* soak = 0;
+    if(soak_hours > 0.0)
+    {
+        soak = new SoakTest;
+        init_soak_test(soak, soak_hours, last_time);
+        printf("Soak: %.2f hours, sampled every %.0f seconds\n", soak_hours, SOAK_SAMPLE_SECONDS);
+    }
+    FrameCapture* capture = 0;
+    if(stress)
+    {
+        game_start = true;
+        printf(
+            "Sweeping %zu alien and %zu shot counts, %zu frames each at %zux%zu\n",
+            sweep.num_aliens, sweep.num_shots, bench_frames, buffer.width, buffer.height
+        );
+    }
+    else if(pgo_train)
+    {
+        printf("Training %s at %zux%zu\n", replay ? "on the recording" : "a scripted session", buffer.width, buffer.height);
+    }
+    else if(headless)
+    {
+        game_start = true;
+        printf("Benchmarking %zu frames at %zux%zu\n", bench_frames, buffer.width, buffer.height);
+        // Nothing swaps headless, so the startup profile never prints it
+        if(huge_pages_enabled()) print_page_stats();
+    }
+    BenchRecorder* bench_recorder = 0;
+    if(bench_json_path && headless && !stress && !pgo_train)
+    {
+        bench_recorder = new BenchRecorder;
+        init_bench_recorder(bench_recorder, bench_frames, bench_start);
+        char value[BENCH_VALUE_LENGTH];
+        snprintf(value, sizeof(value), "%zux%zu", buffer.width, buffer.height);
+        set_bench_environment(&bench_recorder->report, "resolution", value);
+        set_bench_environment(&bench_recorder->report, "input", replay ? replay_path : autoplay ? "autoplay" : "scripted");
+        set_bench_environment(&bench_recorder->report, "fill_kernel", fill_kernel_name);
+        set_bench_environment(&bench_recorder->report, "raster_path", raster_path_name(renderer.raster_path));
+        snprintf(value, sizeof(value), "%zu", num_threads);
+        set_bench_environment(&bench_recorder->report, "threads", value);
+        describe_thread_policy(value, sizeof(value));
+        set_bench_environment(&bench_recorder->report, "thread_policy", value);
+        set_bench_environment(&bench_recorder->report, "flight_recorder", flight ? "on" : "off");
+        snprintf(value, sizeof(value), "%zu", memory_budget / 1024);
+        set_bench_environment(&bench_recorder->report, "memory_budget_kb", value);
+    }
+    else if(bench_json_path)
+    {
+        fprintf(stderr, "--bench-json reports plain --bench runs, ignoring it.\n");
+    }
+    if(capture_path)
+    {
+        size_t capture_workers = num_threads ? num_threads : std::thread::hardware_concurrency();
+        capture = open_frame_capture(capture_path, buffer.width, buffer.height, capture_workers);
+        if(capture) printf("Capturing frames to '%s'\n", capture_path);
+        else fprintf(stderr, "Could not open '%s' for capture.\n", capture_path);
+    }
+    ConformanceCheck* conformance = 0;
+    if(conform)
+    {
+        conformance = new ConformanceCheck;
+        init_conformance_check(conformance, buffer);
+        printf("Checking every frame against the scalar reference\n");
+    }
+    if(replay)
+    {
+        game_start = true;
+        printf("Replaying %llu ticks from '%s'\n", (unsigned long long)replay->header.num_ticks, replay_path);
+    }
 
-            draw_text_buffer(&buffer, text_spritesheet, "SCORE", 4, game.height - text_spritesheet.height - 7, rgb_to_uint32(128, 0, 0));
-            draw_number_buffer(&buffer, number_spritesheet, score, 4 + 2 * number_spritesheet.width, game.height - 2 * number_spritesheet.height - 12, rgb_to_uint32(128, 0, 0));
+    InputReplay* recording = 0;
+    if(record_path)
+    {
+        recording = new InputReplay;
+        // A rolled back state runs ahead on predicted input
+        if(rollback)
+        {
+            printf("Recording without keyframes or tick hashes, the rolled back state runs ahead of the input\n");
+            keyframe_ticks = 0;
+        }
+        init_input_recording(recording, buffer_width, buffer_height, start_wave, replay_flags, keyframe_ticks, !rollback);
+    }
 
-            for (size_t ai = 0; ai < game.num_aliens; ++ai)
+    // The main thread keeps pumping events and stepping the simulation
+    // while the render thread draws the snapshots it publishes
+    RenderThread* render_thread = 0;
+    if(use_render_thread)
+    {
+        SnapshotExchange* exchange = new SnapshotExchange;
+        init_snapshot_exchange(exchange, state);
+        pacer.defer_title = true;
+
+        render_thread = new RenderThread;
+        render_thread->renderer = &renderer;
+        render_thread->exchange = exchange;
+        render_thread->window = window;
+        render_thread->uploader = &uploader;
+        render_thread->presenter = &presenter;
+        render_thread->pacer = &pacer;
+        render_thread->latency = latency;
+        render_thread->trace = &trace_request;
+        render_thread->power = power_profile;
+        render_thread->quality = &quality;
+        render_thread->metrics = metrics;
+        render_thread->running = true;
+        render_thread->animating = false;
+        glfwMakeContextCurrent(0);
+        render_thread->thread = std::thread(render_thread_main, render_thread);
+        printf("Render thread: on\n");
+
+        bool published_start = false, idle = false;
+        while(!glfwWindowShouldClose(window) && game_running)
+        {
+            if(replay && replay_finished(*replay))
             {
-                if(!death_counters[ai]) continue;
-
-                const Alien& alien = game.aliens[ai];
-                if (alien.type == ALIEN_DEAD && death_counters[ai])
-                {
-                    draw_sprite_buffer(&buffer, alien_death_sprite, (size_t)alien.x, (size_t)alien.y, rgb_to_uint32(128, 0, 0));
-                    --death_counters[ai];
-                }
-                else
-                {
-                    size_t current_frame = (size_t)(alien_animation->time / alien_animation->frame_duration);
-                    if(current_frame >= alien_animation->num_frames) current_frame = 0;
-                    const Sprite& sprite = *alien_animation->frames[current_frame];
-                    draw_sprite_buffer(&buffer, sprite, (size_t)alien.x, (size_t)alien.y, rgb_to_uint32(128, 0, 0));
-                    still_alive = true;
-                }           
+                if(rollback) settle_rollback(rollback, &state);
+                print_replay_results(*replay, game_state_checksum(state));
+                break;
             }
-
-            if (!still_alive)
+            if(respawn_waves && !rollback && !game.aliens.num_live) reset_formation(&state);
+            begin_alloc_frame(&alloc_telemetry);
+
+            // Sleep in the event wait until the next tick is due
+            double wait = SIM_DT - sim_accumulator;
+            if(idle) wait_idle_events(gamepads);
+            else glfwWaitEventsTimeout(wait > 0.0 ? wait : 0.0);
+            if(evdev) pump_evdev_input(evdev);
+            poll_gamepads(&gamepads, &input_queue);
+            if(autoplay && game_start) autoplay_input(&bot, &input_queue, state, last_time);
+
+            double current_time = glfwGetTime();
+            double dt = current_time - last_time;
+            last_time = current_time;
+
+            bool started = game_start;
+            size_t ticks = 0;
+            if(started)
             {
-                score = 143;
-                if (!msg_animation->animation_complete) {
-                    TextPage& page = msg_animation->pages[msg_animation->current_page];
-                    size_t line_len = 0;
-                    const char* ptr = page.lines[msg_animation->current_line];
-                    while(*ptr != '\0') { line_len++; ptr++; }
-
-                    if (msg_animation->current_line == page.num_lines - 1 && msg_animation->chars_visible > line_len) {
-                        if (msg_animation->current_page == 1) {
-                            choice_phase = true;
-                        } 
-                        else {
-                            msg_animation->page_timer += (float)dt;
-                            if (msg_animation->page_timer >= page.display_time) {
-                                
-                                if (msg_animation->current_page == 2) {
-                                    // game sits idle here with printed lines indefinitely
-                                }
-                                else if (msg_animation->current_page == 3) {
-                                    game_running = false;
-                                }
-                                else if (msg_animation->current_page < msg_animation->num_pages - 1) {
-                                    msg_animation->current_page++;
-                                    msg_animation->current_line = 0;
-                                    msg_animation->chars_visible = 0;
-                                    msg_animation->page_timer = 0.0f;
-                                } else {
-                                    msg_animation->animation_complete = true;
-                                }
-                            }
-                        }
-                    } 
-                    else {
-
-                        msg_animation->type_timer += (float)dt;
-                        
-                        if (msg_animation->type_timer >= 1.0f / msg_animation->type_speed) {
-                            msg_animation->chars_visible++;
-                            msg_animation->type_timer = 0.0f;
-
-                            if (msg_animation->chars_visible > line_len) {
-                                if (msg_animation->current_line < page.num_lines - 1) {
-                                    msg_animation->current_line++;
-                                    msg_animation->chars_visible = 0;
-                                }
-                            }
-                        }
-                    }
+                // This loop only waits out ticks, drawing is the render thread's
+                schedule_frame(&scheduler, &sim_accumulator, dt, SIM_DT, idle);
+                ticks = run_ticks(&state, &sim_accumulator, current_time, &input_latch, replay, recording, flight, wave_prefetcher, rollback);
+                if(!state.running) game_running = false;
+                if(audio) play_game_sounds(audio, state.sounds);
+                state.sounds = 0;
+                if(spectate_server && ticks) broadcast_spectate_snapshot(spectate_server, state, current_time);
+            }
+            if(ticks || started != published_start)
+            {
+                GameSnapshot* snapshot = capture_snapshot(exchange, state);
+                snapshot->tick_time = current_time - sim_accumulator;
+                snapshot->game_start = started;
+                snapshot->has_press = input_latch.has_press;
+                snapshot->press_time = input_latch.press_time;
+                snapshot->idle = game_is_idle(state) && input_is_idle(input_latch);
+                input_latch.has_press = false;
+                publish_snapshot(exchange);
+                published_start = started;
+            }
+            flush_pacer_title(&pacer);
 
-                    size_t start_y = 200;
-                    for(size_t i = 0; i <= msg_animation->current_line; ++i) {
-                        size_t limit = (i == msg_animation->current_line) ? msg_animation->chars_visible : 9999;
-                        draw_text_buffer(&buffer, text_spritesheet, page.lines[i], 20, start_y, rgb_to_uint32(128, 0, 0), limit);
-                        start_y -= 12; 
-                    }
+            // Anything woke an idle render thread may have to redraw
+            wake_render_thread(exchange);
+            idle = !replay && !autoplay && (!started || (game_is_idle(state) && input_is_idle(input_latch) &&
+                   !render_thread->animating.load(std::memory_order_acquire)));
+            end_alloc_frame(&alloc_telemetry);
+        }
 
-                    if (choice_phase) {
-                        draw_text_buffer(&buffer, text_spritesheet, "YES", yes_alien.x + 15, yes_alien.y, rgb_to_uint32(0, 100, 0));
-                        draw_text_buffer(&buffer, text_spritesheet, "NO", no_alien.x + 15, no_alien.y, rgb_to_uint32(139, 0, 0));
-                        
-                        size_t current_frame = (size_t)(alien_animation->time / alien_animation->frame_duration);
-                        if(current_frame >= alien_animation->num_frames) current_frame = 0;
-                        const Sprite& sprite = *alien_animation->frames[current_frame];
-                        
-                        draw_sprite_buffer(&buffer, sprite, (size_t)yes_alien.x, (size_t)yes_alien.y, rgb_to_uint32(0, 100, 0));
-                        draw_sprite_buffer(&buffer, sprite, (size_t)no_alien.x, (size_t)no_alien.y, rgb_to_uint32(139, 0, 0));
-                    }
-                }
-            }
+        render_thread->running = false;
+        wake_render_thread(exchange);
+        render_thread->thread.join();
+        glfwMakeContextCurrent(window);
+        destroy_snapshot_exchange(exchange);
+        delete exchange;
+    }
 
-            alien_animation->time += (float)dt;
-            if(alien_animation->time >= alien_animation->num_frames * alien_animation->frame_duration)
+    bool idle = false;
+    while (!render_thread && !glfwWindowShouldClose(window) && game_running)
+    {
+        if(replay && replay_finished(*replay))
+        {
+            if(headless) bench_frames = bench_frame;
+            else
             {
-                if(alien_animation->loop) 
-                {
-                    alien_animation->time -= alien_animation->num_frames * alien_animation->frame_duration;
-                }
-                else
-                {
-                    alien_animation->time = 0;
-                    delete alien_animation;
-                    alien_animation = nullptr;
-                }
+                if(rollback) settle_rollback(rollback, &state);
+                print_replay_results(*replay, game_state_checksum(state));
+                break;
             }
-
-            for (size_t bi = 0; bi < game.num_projectiles; ++bi)
+        }
+        if(headless)
+        {
+            // Each pair of the sweep gets a fresh formation and profile
+            if(stress && bench_frame == bench_frames)
             {
-                const Projectile& projectile = game.projectiles[bi];
-                const Sprite& sprite = projectile_sprite;
-                draw_sprite_buffer(&buffer, sprite, projectile.x, projectile.y, rgb_to_uint32(128, 0, 0));
+                print_stress_row(sweep, *profiler, bench_frame, glfwGetTime() - bench_start);
+                if(++sweep.current == sweep.num_aliens * sweep.num_shots) break;
+                start_stress_run(sweep, &state);
+                reset_frame_profiler(profiler);
+                bench_frame = 0;
+                bench_start = glfwGetTime();
             }
+            if(bench_recorder)
+            {
+                record_bench_block(bench_recorder, *profiler, bench_frame, glfwGetTime(), bench_frame == bench_frames);
+            }
+            if(bench_frame == bench_frames)
+            {
+                // Endless waves move on by themselves, the wave number counts them
+                if(rollback) settle_rollback(rollback, &state);
+                size_t waves = wave_prefetcher ? state.wave - start_wave : bench_waves + (rollback ? rollback->respawns : 0);
+                print_bench_results(*profiler, bench_frame, glfwGetTime() - bench_start, waves, state.score);
+                print_frame_histograms(*profiler);
+                print_projectile_stats(game);
+                printf("Particles: high water %zu of %zu, dropped %zu\n", particles.high_water, particles.capacity, particles.dropped);
+                printf("State checksum: %016llx\n", (unsigned long long)game_state_checksum(state));
+                if(replay && replay_finished(*replay)) print_replay_results(*replay, game_state_checksum(state));
+                break;
+            }
+            if(pgo_train && !replay) pgo_train_input(&training, &input_queue, state, bench_frame, last_time);
+            else if(autoplay && !replay) autoplay_input(&bot, &input_queue, state, last_time);
+            else if(!replay) bench_input(&input_queue, bench_frame, last_time);
+            ++bench_frame;
+        }
+        if(respawn_waves && !rollback && !game.aliens.num_live)
+        {
+            reset_formation(&state);
+            ++bench_waves;
+        }
 
-            draw_sprite_buffer(&buffer, player_sprite, (size_t)game.player.x, (size_t)game.player.y, rgb_to_uint32(128, 0, 0));
-
-            /*
-            ### PROCESS MOVEMENT FOR NEXT FRAME
-            */ 
-
-            glTexSubImage2D(
-                GL_TEXTURE_2D, 0, 0, 0,
-                buffer.width, buffer.height,
-                GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
-                buffer.data
-            );
+        step_trace_request(&trace_request);
+        begin_alloc_frame(&alloc_telemetry);
 
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glfwSwapBuffers(window);
+        /*
+        ### DISPLAY CURRENT FRAME
+        */ 
+        wait_frames_in_flight(&frame_fences);
+        wait_for_upload(&uploader);
+        if(!idle) wait_input_sampling(&pacer);
+
+        // Events are pumped as late as possible, after pacing and the upload
+        // fence have blocked, so the ticks below see the newest input. The
+        // null platform the kiosk runs on has none to wait on but evdev's.
+        // The terminal never idles, nothing but its pacing would wake it.
+        if(kms)
+        {
+            if(idle && evdev) wait_evdev_input(evdev, -1.0);
+        }
+        else if(idle) wait_idle_events(gamepads);
+        else pump_events(&event_pump);
+        if(terminal && terminal_interrupted(terminal)) glfwSetWindowShouldClose(window, GLFW_TRUE);
+        if(evdev) pump_evdev_input(evdev);
+        poll_gamepads(&gamepads, &input_queue);
+        if(autoplay && game_start && !headless) autoplay_input(&bot, &input_queue, state, last_time);
+        if(pacing_cycle_pressed.exchange(false)) cycle_pacing_mode(&pacer);
+        if(screenshot_pressed.exchange(false) && screenshots) request_screenshot(screenshots);
+        if(histogram_key_pressed.exchange(false)) print_frame_histograms(*profiler);
+        apply_render_variants(&variants, &renderer, &uploader);
+        if(framebuffer_resized.exchange(false))
+        {
+            update_present_viewport(&presenter, framebuffer_width, framebuffer_height);
+        }
+        // Shown, it changes every frame, so every frame is swapped
+        bool overlay_shown = debug_overlay && show_debug_overlay;
+        if(debug_overlay) update_debug_overlay(debug_overlay, overlay_shown, overlay_sources);
+        if(asset_watcher) apply_asset_reloads(asset_watcher, &atlas, gpu_renderer ? 0 : &renderer, &story, &state);
+        if(buffer.gpu) clear_buffer_dirty(&buffer, clear_color);
+
+        // Benchmarks run on a virtual clock, which also stamps their input.
+        // Windowed frames advance to when they should reach the screen.
+        double current_time = headless ? last_time + BENCH_DT : predict_present(&pacer);
+        // Fast replays, like benchmarks, step one tick a frame
+        double dt = headless || (replay && replay_fast) ? BENCH_DT : current_time - last_time;
+        last_time = current_time;
 
-            for (size_t bi = 0; bi < game.num_projectiles;)
+        if (!game_start && headless)
+        {
+            draw_title_screen(&renderer);
+            if(capture) capture_buffer(capture, buffer);
+            retire_dirty_rects(&buffer);
+            if(uploader.stream) stream_buffer(uploader.stream, &buffer);
+        }
+        else if (!game_start)
+        {
+            // Unchanged frames are neither uploaded nor swapped
+            bool changed = draw_title_screen(&renderer) && submit_frame(&uploader, &buffer);
+            if(window_damaged.exchange(false) || changed || overlay_shown)
             {
-                game.projectiles[bi].y += game.projectiles[bi].dir;
-                if (game.projectiles[bi].y >= game.height || 
-                    game.projectiles[bi].y < projectile_sprite.height)
-                {
-                    game.projectiles[bi] = game.projectiles[game.num_projectiles - 1];
-                    --game.num_projectiles;
-                    continue;
-                }
+                swap_frame(presenter, window, &uploader);
+                pace_frame(&pacer);
+            }
+            else pace_skipped_frame(&pacer);
+            idle = !headless && !replay && !terminal;
+        }
 
-                if (choice_phase) {
-                    bool overlap_yes = sprite_overlap_check(projectile_sprite, game.projectiles[bi].x, game.projectiles[bi].y, alien_sprite, (size_t)yes_alien.x, (size_t)yes_alien.y);
-                    bool overlap_no = sprite_overlap_check(projectile_sprite, game.projectiles[bi].x, game.projectiles[bi].y, alien_sprite, (size_t)no_alien.x, (size_t)no_alien.y);
-                    
-                    if (overlap_yes) 
-                    {
-                        choice_phase = false;
-                        msg_animation->current_page = 2; // Move to the "YES" page
-                        msg_animation->current_line = 0;
-                        msg_animation->chars_visible = 0;
-                        msg_animation->page_timer = 0.0f;
-                        
-                        game.projectiles[bi] = game.projectiles[game.num_projectiles - 1];
-                        --game.num_projectiles;
-                        continue;
-                    } 
-                    else if (overlap_no) 
-                    {
-                        choice_phase = false;
-                        msg_animation->current_page = 3; // Move to the "NO" page
-                        msg_animation->current_line = 0;
-                        msg_animation->chars_visible = 0;
-                        msg_animation->page_timer = 0.0f;
-                        msg_animation->type_speed = 10.0f;
-                        
-                        game.projectiles[bi] = game.projectiles[game.num_projectiles - 1];
-                        --game.num_projectiles;
-                        continue;
-                    }
-                }
+        else
+        {
+            begin_profile_frame(profiler);
 
-                bool projectile_active = true;
-                for(size_t ai = 0; ai < game.num_aliens; ++ai)
-                {
-                    const Alien& alien = game.aliens[ai];
-                    if(alien.type == ALIEN_DEAD) continue;
-
-                    const SpriteAnimation& animation = alien_animation[alien.type - 1];
-                    size_t current_frame = (size_t)(alien_animation->time / alien_animation->frame_duration);
-                    const Sprite& alien_sprite = *animation.frames[current_frame];
-                    bool overlap = sprite_overlap_check(
-                        projectile_sprite, game.projectiles[bi].x, game.projectiles[bi].y,
-                        alien_sprite, (size_t)alien.x, (size_t)alien.y
-                    );
-                    if(overlap)
-                    {
-                        if (game.aliens[ai].hp <= 1)
-                        {
-                            game.aliens[ai].type = ALIEN_DEAD;
-                            game.aliens[ai].x -= (alien_death_sprite.width - alien_sprite.width)/2;
-                            score += 10;
-                        }
-                        else
-                        {   
-                            --game.aliens[ai].hp;
-                        }
-
-                        game.projectiles[bi] = game.projectiles[game.num_projectiles - 1];
-                        --game.num_projectiles;
-
-                        projectile_active = false;
-                        break;
-                    }
-                }
+            /*
+            ### ADVANCE THE SIMULATION
+            */
+            // Whole ticks are taken out of the elapsed time; what is left
+            // over places this frame between the last two ticks. Frames
+            // that fell behind are skipped until the ticks catch up.
+            bool skip = schedule_frame(&scheduler, &sim_accumulator, dt, frame_budget(pacer), idle);
+            size_t ticks = spectate_client ? poll_spectate_client(spectate_client, &state, current_time)
+                                           : run_ticks(&state, &sim_accumulator, current_time, &input_latch, replay, recording, flight, wave_prefetcher, rollback);
+            if(!state.running) game_running = false;
+            if(audio) play_game_sounds(audio, state.sounds);
+            state.sounds = 0;
+            if(spectate_server && ticks) broadcast_spectate_snapshot(spectate_server, state, current_time);
+            end_phase(profiler, PHASE_COLLISION);
+
+            update_particles(&particles, thread_pool, (float)(ticks * SIM_DT), game.width, game.height);
+            spawn_new_debris(&particles, state.effects);
+            end_phase(profiler, PHASE_PARTICLES);
 
-                ++bi;
+            /*
+            ### DRAW INTERPOLATED FRAME
+            */
+            if(!skip)
+            {
+                if(conformance) begin_conformance_frame(conformance, &renderer);
+                draw_game_frame(&renderer, state, sim_accumulator / SIM_DT, latency && input_latch.has_press);
+                check_raster_path(&variants, &renderer, state, sim_accumulator / SIM_DT, latency && input_latch.has_press);
+                if(conformance) check_conformance_frame(conformance, &renderer, state, sim_accumulator / SIM_DT, false);
             }
-
-            player_move_dir = 2 * move_dir;
-
-            if (player_move_dir != 0)
+            govern_frame_rate(&pacer, power_profile, classify_scene(state));
+            // Neither swapped nor paced, the next frame starts right away
+            if(skip) mark_present(profiler, false);
+            else if(!headless)
             {
-                if(game.player.x + player_sprite.width + (player_move_dir * player_speed * dt) >= game.width - 10)
+                bool changed = submit_frame(&uploader, &buffer);
+                end_phase(profiler, PHASE_UPLOAD);
+
+                if(window_damaged.exchange(false) || changed || overlay_shown)
                 {
-                    game.player.x = game.width - player_sprite.width - player_move_dir - 10;
-                    player_move_dir *= -1;
+                    swap_frame(presenter, window, &uploader);
+                    mark_present(profiler, true);
+                    if(latency)
+                    {
+                        // Block until the swap has gone through, as inputlag's glFinish option does
+                        finish_frame(&uploader);
+                        if(input_latch.has_press) record_latency(latency, glfwGetTime() - input_latch.press_time);
+                    }
+                    input_latch.has_press = false;
+                    pace_frame(&pacer);
                 }
-                else if(game.player.x + (player_move_dir * player_speed * dt) <= 10)
+                else
                 {
-                    game.player.x = 10;
-                    player_move_dir *= -1;
+                    mark_present(profiler, false);
+                    pace_skipped_frame(&pacer);
                 }
-                else game.player.x += player_move_dir * player_speed * dt;
+                end_phase(profiler, PHASE_SWAP);
             }
-
-            if(fire_pressed && game.num_projectiles < GAME_MAX_PROJECTILES)
+            else
             {
-                game.projectiles[game.num_projectiles].x = (size_t)game.player.x + (size_t)player_sprite.width / 2;
-                game.projectiles[game.num_projectiles].y = (size_t)game.player.y + (size_t)player_sprite.height;
-                game.projectiles[game.num_projectiles].dir = 2;
-                ++game.num_projectiles;
+                if(capture) capture_buffer(capture, buffer);
+                // The next frame erases what this one drew
+                retire_dirty_rects(&buffer);
+                if(uploader.stream) stream_buffer(uploader.stream, &buffer);
+                end_phase(profiler, PHASE_UPLOAD);
             }
-            fire_pressed = false;
+            if(!headless && !skip) record_variant_frame(&variants, renderer, uploader.mode, *profiler);
+            end_profile_frame(profiler);
+            if(!headless && !skip) govern_quality(&quality, &particles, profiler->last_work, frame_budget(pacer));
+            if(!headless && !skip) record_input_lead(&pacer, profiler->last_work);
+            idle = !headless && !replay && !terminal && !spectate_client && !autoplay && game_is_idle(state) && !particles.count && input_is_idle(input_latch);
+        }
+        end_alloc_frame(&alloc_telemetry);
+        if(metrics && game_start) publish_metrics(metrics, *profiler, particles, state, &scheduler);
+        if(soak)
+        {
+            record_soak_frame(soak);
+            if(soak_sample_due(*soak, last_time)) take_soak_sample(soak, last_time, use_gl ? count_gl_objects() : 0);
+            if(soak_finished(*soak, last_time)) game_running = false;
         }
-
-        glfwPollEvents();
     }
-
-    delete[] alien_death_sprite.data;
-
-    for(size_t i = 0; i < 3; ++i)
+    // What the game prints from here on goes below the frame
+    if(terminal) close_terminal_view(terminal);
+
+    finish_trace_request(&trace_request);
+    if(pgo_train) print_pgo_training(training, bench_frame);
+    if(autoplay) printf("Autoplay: %zu shots fired\n", bot.shots);
+    if(metrics) stop_metrics_exporter(metrics);
+    if(score_log)
+    {
+        if(game_start) record_run(score_log, state);
+        close_score_log(score_log);
+    }
+    bool soak_passed = true;
+    if(soak)
+    {
+        soak_passed = print_soak_report(*soak);
+        destroy_soak_test(soak);
+        delete soak;
+    }
+    bool conform_passed = true;
+    if(conformance)
+    {
+        conform_passed = print_conformance(*conformance);
+        destroy_conformance_check(conformance);
+        delete conformance;
+    }
+    if(alloc_stats) print_alloc_telemetry(alloc_telemetry);
+    if(bench_recorder)
+    {
+        write_bench_report(bench_recorder->report, bench_json_path);
+        destroy_bench_report(&bench_recorder->report);
+        delete bench_recorder;
+    }
+    if(!headless && profiler->total_frames) print_frame_histograms(*profiler);
+    if(!headless) print_frame_scheduler(scheduler);
+    if(!headless) print_vrr_pacing(pacer);
+    print_frame_fences(frame_fences);
+    print_event_pump(event_pump);
+    if(reactor) print_reactor_stats(*reactor, "Event loop");
+    print_thread_policy();
+    if(terminal) print_terminal_stats(terminal);
+    print_quality_governor(quality);
+    print_render_variants(variants);
+    destroy_render_variants(&variants);
+    if(latency)
+    {
+        print_latency_results(*latency);
+        delete latency;
+    }
+    if(uploader.stream)
+    {
+        StreamStats stats = destroy_streamed_buffer(&streamed, &buffer);
+        uploader.stream = 0;
+        printf(
+            "Streamed %zu frames%s, dropped %zu%s\n", stats.frames, stats.spliced ? " by vmsplice" : "",
+            stats.dropped, stats.failed ? ", the consumer went away" : ""
+        );
+        if(stream_encoding != STREAM_RAW && stats.raw_bytes)
+        {
+            printf("Sent %.1f KB of deltas, %.2f%% of raw video\n", stats.bytes / 1024.0, 100.0 * stats.bytes / stats.raw_bytes);
+        }
+    }
+    if(capture)
+    {
+        CaptureStats stats = close_frame_capture(capture);
+        printf("Captured %zu frames, %zu failed, %.1f ms waiting for the writers\n", stats.frames, stats.failed, stats.wait_seconds * 1000.0);
+    }
+    delete render_thread;
+    if(rollback)
+    {
+        settle_rollback(rollback, &state);
+        print_rollback_stats(*rollback);
+        destroy_rollback_session(rollback);
+        delete rollback;
+    }
+    if(recording)
+    {
+        write_input_recording(recording, record_path, game_state_checksum(state));
+        destroy_input_replay(recording);
+        delete recording;
+    }
+    if(replay)
+    {
+        destroy_input_replay(replay);
+        delete replay;
+    }
+    if(flight)
+    {
+        uninstall_flight_recorder();
+        destroy_flight_recorder(flight);
+        delete flight;
+    }
+    if(reactor)
+    {
+        close_reactor(reactor);
+        delete reactor;
+    }
+    if(spectate_server)
+    {
+        print_spectate_stats("Served", close_spectate_server(spectate_server));
+    }
+    if(spectate_client)
+    {
+        print_spectate_stats("Spectated", close_spectate_client(spectate_client));
+    }
+    if(wave_prefetcher)
+    {
+        stop_wave_prefetcher(wave_prefetcher);
+        delete wave_prefetcher;
+    }
+    destroy_game_state(&state);
+    destroy_particle_system(&particles);
+    if(upload_thread)
+    {
+        stop_upload_thread(upload_thread);
+        delete upload_thread;
+    }
+    destroy_uploader(&uploader, &buffer);
+    if(evdev) stop_evdev_input(evdev);
+    if(asset_watcher) stop_asset_watcher(asset_watcher);
+    if(audio_output) stop_audio_output(audio_output);
+    if(audio) destroy_audio_mixer(audio);
+    close_sound_bank(&sound_bank);
+    if(gpu_timers)
+    {
+        print_gpu_timers(*gpu_timers);
+        destroy_gpu_timers(gpu_timers);
+        delete gpu_timers;
+    }
+    if(gpu_renderer)
+    {
+        destroy_gpu_renderer(gpu_renderer);
+        delete gpu_renderer;
+    }
+    for(size_t si = 0; si < presenter.num_spectators; ++si)
+    {
+        close_spectator(&spectators[si]);
+    }
+    if(screenshots)
+    {
+        destroy_screenshot_readback(screenshots);
+        delete screenshots;
+    }
+    destroy_debug_overlay(debug_overlay);
+    if(text_overlay)
+    {
+        destroy_text_overlay(text_overlay);
+        delete text_overlay;
+    }
+    if(palette.texture) glDeleteTextures(1, &palette.texture);
+    destroy_frame_fences(&frame_fences);
+    if(crt_upgrade)
+    {
+        cancel_program_build(crt_upgrade);
+        close_shader_cache(&shader_cache);
+    }
+    free_pages(buffer_pixels(buffer));
+    if(thread_pool)
+    {
+        destroy_thread_pool(thread_pool);
+        delete thread_pool;
+        delete[] draw_lists;
+    }
+    finish_layer_loader(&layer_loader);
+    destroy_layer(&title_layer);
+    for(size_t li = 0; li < NUM_LAYERS; ++li)
+    {
+        destroy_layer(&layers[li]);
+    }
+    destroy_render_list(&renderer.render_list);
+    delete text_cache;
+    delete[] profiler_widgets;
+    delete profiler;
+    if(counters)
     {
-        delete[] alien_animation[i].frames;
+        close_perf_counters(counters);
+        delete counters;
     }
-    delete[] buffer.data;
-    delete[] game.aliens;
+    destroy_scaled_sprite_cache(scaled_cache);
+    delete scaled_cache;
+    close_atlas_file(&atlas);
+    free_story_pages(story);
 
     glfwDestroyWindow(window);
     glfwTerminate();
 
-    return 0;
-}
\ No newline at end of file
+    return soak_passed && conform_passed ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "metrics.h"
+#include "alloc_stats.h"
+#include "runtime.h"
+
+#if defined(_WIN32)
+#define METRICS_USE_POSIX 0
+#else
+#define METRICS_USE_POSIX 1
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define METRICS_FRESH 4u
+#define METRICS_INDEX 3u
+#define METRICS_MAX_NAME 128
+#define METRICS_MAX_PATH 256
+
+struct MetricsExporter
+{
+    // Frame loop side: what the last snapshot was taken against
+    double next_publish, last_publish;
+    uint64_t last_frames;
+    double last_upload;
+    FrameHistogram mark_work, mark_present;
+    uint32_t back;
+
+    MetricsSnapshot slots[3];
+    std::atomic<uint32_t> middle;
+
+    // Exporter side
+    uint32_t front;
+    bool has_snapshot;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    double interval;
+    int fd;
+    char prefix[METRICS_MAX_NAME];
+    const char* path;
+    char temp_path[METRICS_MAX_PATH + 8];
+    char packet[METRICS_PACKET_BYTES];
+    char text[METRICS_TEXT_BYTES];
+    size_t sent, failed;
+};
+
+struct Metric
+{
+    const char* name;
+    double value;
+};
+
+/*
+################################################
+##                 FRAME LOOP                 ##
+################################################
+*/
+
+void publish_metrics(MetricsExporter* exporter, const FrameProfiler& profiler, const ParticleSystem& particles, const GameState& state, const FrameScheduler* scheduler)
+{
+    double now = glfwGetTime();
+    if(now < exporter->next_publish) return;
+    exporter->next_publish = now + METRICS_PUBLISH_SECONDS;
+
+    MetricsSnapshot& snapshot = exporter->slots[exporter->back];
+    uint64_t frames = profiler.total_frames - exporter->last_frames;
+    double elapsed = now - exporter->last_publish;
+    snapshot.frames = profiler.total_frames;
+    snapshot.fps = elapsed > 0.0 ? frames / elapsed : 0.0;
+
+    HistogramSummary work = summarize_histogram(profiler.work_histogram, &exporter->mark_work);
+    HistogramSummary present = summarize_histogram(profiler.present_histogram, &exporter->mark_present);
+    snapshot.work_p50 = work.p50;
+    snapshot.work_p99 = work.p99;
+    snapshot.work_max = work.max;
+    snapshot.present_p50 = present.p50;
+    snapshot.present_p99 = present.p99;
+    snapshot.present_max = present.max;
+    snapshot.upload_avg = frames ? (profiler.totals[PHASE_UPLOAD] - exporter->last_upload) / frames : 0.0;
+
+    snapshot.particles = particles.count;
+    snapshot.particle_capacity = particles.capacity;
+    const Archetype& player_shots = state.game.projectiles[PROJECTILE_PLAYER];
+    const Archetype& enemy_shots = state.game.projectiles[PROJECTILE_ENEMY];
+    snapshot.player_shots = player_shots.count;
+    snapshot.player_shot_capacity = player_shots.capacity;
+    snapshot.enemy_shots = enemy_shots.count;
+    snapshot.enemy_shot_capacity = enemy_shots.capacity;
+    snapshot.wave = state.wave;
+    snapshot.score = state.score;
+    snapshot.frames_overloaded = scheduler ? scheduler->overloaded : 0;
+    snapshot.frames_skipped = scheduler ? scheduler->skipped : 0;
+    snapshot.sim_debt = scheduler ? scheduler->debt : 0.0;
+    snapshot.sim_dropped = scheduler ? scheduler->dropped : 0.0;
+
+    exporter->back = exporter->middle.exchange(exporter->back | METRICS_FRESH, std::memory_order_acq_rel) & METRICS_INDEX;
+    exporter->last_publish = now;
+    exporter->last_frames = profiler.total_frames;
+    exporter->last_upload = profiler.totals[PHASE_UPLOAD];
+    exporter->mark_work = profiler.work_histogram;
+    exporter->mark_present = profiler.present_histogram;
+}
+
+/*
+################################################
+##                  EXPORTER                  ##
+################################################
+*/
+
+static size_t collect_metrics(const MetricsSnapshot& snapshot, Metric* metrics)
+{
+    AllocCounts counts;
+    read_alloc_counts(&counts);
+    uint64_t allocations = 0;
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti) allocations += counts.allocations[ti];
+
+    size_t n = 0;
+    metrics[n++] = {"frames", (double)snapshot.frames};
+    metrics[n++] = {"fps", snapshot.fps};
+    metrics[n++] = {"frame_work_p50_ms", snapshot.work_p50 * 1e3};
+    metrics[n++] = {"frame_work_p99_ms", snapshot.work_p99 * 1e3};
+    metrics[n++] = {"frame_work_max_ms", snapshot.work_max * 1e3};
+    metrics[n++] = {"present_interval_p50_ms", snapshot.present_p50 * 1e3};
+    metrics[n++] = {"present_interval_p99_ms", snapshot.present_p99 * 1e3};
+    metrics[n++] = {"present_interval_max_ms", snapshot.present_max * 1e3};
+    metrics[n++] = {"upload_avg_ms", snapshot.upload_avg * 1e3};
+    metrics[n++] = {"particles", (double)snapshot.particles};
+    metrics[n++] = {"particle_capacity", (double)snapshot.particle_capacity};
+    metrics[n++] = {"player_shots", (double)snapshot.player_shots};
+    metrics[n++] = {"player_shot_capacity", (double)snapshot.player_shot_capacity};
+    metrics[n++] = {"enemy_shots", (double)snapshot.enemy_shots};
+    metrics[n++] = {"enemy_shot_capacity", (double)snapshot.enemy_shot_capacity};
+    metrics[n++] = {"wave", (double)snapshot.wave};
+    metrics[n++] = {"score", (double)snapshot.score};
+    metrics[n++] = {"frames_overloaded", (double)snapshot.frames_overloaded};
+    metrics[n++] = {"frames_skipped", (double)snapshot.frames_skipped};
+    metrics[n++] = {"sim_debt_ms", snapshot.sim_debt * 1e3};
+    metrics[n++] = {"sim_dropped_seconds", snapshot.sim_dropped};
+    metrics[n++] = {"rss_bytes", (double)read_resident_bytes()};
+    metrics[n++] = {"allocations", (double)allocations};
+    metrics[n++] = {"live_heap_blocks", (double)(allocations - counts.frees)};
+    return n;
+}
+
+#define METRICS_MAX_METRICS 32
+
+// StatsD gauges, or Prometheus text with 'prometheus'. Lines that don't
+// fit are left off rather than split.
+static size_t format_metrics(char* out, size_t capacity, const Metric* metrics, size_t count, const char* prefix, bool prometheus)
+{
+    size_t length = 0;
+    for(size_t mi = 0; mi < count; ++mi)
+    {
+        const char* name = metrics[mi].name;
+        double value = metrics[mi].value;
+        int written = prometheus ? snprintf(out + length, capacity - length, "# TYPE %s_%s gauge\n%s_%s %.9g\n", prefix, name, prefix, name, value)
+                                 : snprintf(out + length, capacity - length, "%s.%s:%.6g|g\n", prefix, name, value);
+        if(written < 0 || (size_t)written >= capacity - length) break;
+        length += (size_t)written;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+static bool write_prometheus_file(MetricsExporter* exporter, size_t length)
+{
+    FILE* file = fopen(exporter->temp_path, "wb");
+    if(!file) return false;
+    bool ok = fwrite(exporter->text, 1, length, file) == length;
+    if(fclose(file) != 0) ok = false;
+#if defined(_WIN32)
+    if(ok) remove(exporter->path);
+#endif
+    if(ok && rename(exporter->temp_path, exporter->path) != 0) ok = false;
+    if(!ok) remove(exporter->temp_path);
+    return ok;
+}
+
+static void export_metrics(MetricsExporter* exporter)
+{
+    if(exporter->middle.load(std::memory_order_acquire) & METRICS_FRESH)
+    {
+        exporter->front = exporter->middle.exchange(exporter->front, std::memory_order_acq_rel) & METRICS_INDEX;
+        exporter->has_snapshot = true;
+    }
+    if(!exporter->has_snapshot) return;
+
+    Metric metrics[METRICS_MAX_METRICS];
+    size_t count = collect_metrics(exporter->slots[exporter->front], metrics);
+    bool ok = true;
+#if METRICS_USE_POSIX
+    if(exporter->fd >= 0)
+    {
+        size_t length = format_metrics(exporter->packet, sizeof(exporter->packet), metrics, count, exporter->prefix, false);
+        if(send(exporter->fd, exporter->packet, length, 0) != (ssize_t)length) ok = false;
+    }
+#endif
+    if(exporter->path)
+    {
+        size_t length = format_metrics(exporter->text, sizeof(exporter->text), metrics, count, METRICS_PREFIX, true);
+        if(!write_prometheus_file(exporter, length)) ok = false;
+    }
+    if(ok) ++exporter->sent;
+    else ++exporter->failed;
+}
+
+static void metrics_thread_main(MetricsExporter* exporter)
+{
+    enter_thread_role(THREAD_BACKGROUND);
+    std::unique_lock<std::mutex> lock(exporter->mutex);
+    while(!exporter->stopping)
+    {
+        exporter->wake.wait_for(lock, std::chrono::duration<double>(exporter->interval), [exporter] { return exporter->stopping; });
+        lock.unlock();
+        export_metrics(exporter);
+        lock.lock();
+    }
+}
+
+#if METRICS_USE_POSIX
+static int connect_metrics_socket(const char* address)
+{
+    char host[METRICS_MAX_NAME];
+    const char* colon = strrchr(address, ':');
+    if(!colon || (size_t)(colon - address) >= sizeof(host)) return -1;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* found = 0;
+    if(getaddrinfo(host, colon + 1, &hints, &found) != 0) return -1;
+
+    int fd = -1;
+    for(addrinfo* ai = found; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+#endif
+
+// METRICS_PREFIX.HOST, with the host's dots made underscores so StatsD
+// doesn't take them for more levels
+static void set_metrics_prefix(MetricsExporter* exporter)
+{
+    char host[64] = "unknown";
+#if METRICS_USE_POSIX
+    if(gethostname(host, sizeof(host)) != 0) strcpy(host, "unknown");
+    host[sizeof(host) - 1] = '\0';
+#endif
+    for(char* c = host; *c; ++c) if(*c == '.' || *c == ':' || *c == ' ') *c = '_';
+    snprintf(exporter->prefix, sizeof(exporter->prefix), "%s.%s", METRICS_PREFIX, host);
+}
+
+MetricsExporter* start_metrics_exporter(const char* statsd_address, const char* prometheus_path, double interval)
+{
+    int fd = -1;
+    if(statsd_address)
+    {
+#if METRICS_USE_POSIX
+        fd = connect_metrics_socket(statsd_address);
+        if(fd < 0) fprintf(stderr, "Could not resolve StatsD address '%s'.\n", statsd_address);
+#else
+        fprintf(stderr, "StatsD metrics need POSIX sockets.\n");
+#endif
+    }
+    if(prometheus_path && strlen(prometheus_path) >= METRICS_MAX_PATH)
+    {
+        fprintf(stderr, "Metrics path '%s' is too long.\n", prometheus_path);
+        prometheus_path = 0;
+    }
+    if(fd < 0 && !prometheus_path) return 0;
+
+    MetricsExporter* exporter = new MetricsExporter;
+    exporter->next_publish = exporter->last_publish = glfwGetTime();
+    exporter->last_frames = 0;
+    exporter->last_upload = 0.0;
+    memset(&exporter->mark_work, 0, sizeof(exporter->mark_work));
+    memset(&exporter->mark_present, 0, sizeof(exporter->mark_present));
+    memset(exporter->slots, 0, sizeof(exporter->slots));
+    exporter->back = 0;
+    exporter->middle = 1;
+    exporter->front = 2;
+    exporter->has_snapshot = false;
+    exporter->stopping = false;
+    exporter->interval = interval > 0.0 ? interval : METRICS_DEFAULT_INTERVAL;
+    exporter->fd = fd;
+    set_metrics_prefix(exporter);
+    exporter->path = prometheus_path;
+    if(prometheus_path) snprintf(exporter->temp_path, sizeof(exporter->temp_path), "%s.tmp", prometheus_path);
+    exporter->sent = exporter->failed = 0;
+    exporter->thread = std::thread(metrics_thread_main, exporter);
+    return exporter;
+}
+
+void stop_metrics_exporter(MetricsExporter* exporter)
+{
+    {
+        std::lock_guard<std::mutex> lock(exporter->mutex);
+        exporter->stopping = true;
+    }
+    exporter->wake.notify_one();
+    exporter->thread.join();
+    // The thread's last pass took the newest snapshot before it stopped
+    printf("Metrics: %zu exports, %zu failed\n", exporter->sent, exporter->failed);
+#if METRICS_USE_POSIX
+    if(exporter->fd >= 0) close(exporter->fd);
+#endif
+    delete exporter;
+}
@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*
+    Fleet metrics. Once every METRICS_PUBLISH_SECONDS the frame loop
+    fills a MetricsSnapshot from what it already keeps: frames, frame rate,
+    the work and present-interval percentiles and average upload time of
+    the frames since the last one, pool occupancy, wave and score, and
+    the frame scheduler's overload counters. It is handed over through
+    three slots the way the render thread gets game snapshots, so filling
+    one is a few copies, a walk over two histograms and an atomic
+    exchange: the frame loop never locks, waits or allocates for it.
+
+    An exporter thread wakes every --metrics-interval seconds, takes the
+    newest snapshot, adds the resident set and allocation counters, which
+    it reads itself, and ships them as StatsD gauges in one UDP datagram
+    to --metrics HOST:PORT, named METRICS_PREFIX.HOST.name so a fleet's
+    cabinets stay apart, and as Prometheus text exposition to
+    --metrics-file PATH, written aside and renamed over it for
+    node_exporter's textfile collector. A send that fails is counted and
+    the next interval tries again.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include "render.h"
+
+#define METRICS_PUBLISH_SECONDS 1.0
+#define METRICS_DEFAULT_INTERVAL 10.0
+#define METRICS_PREFIX "space_invaders"
+// One datagram, under the usual Ethernet MTU
+#define METRICS_PACKET_BYTES 1400
+#define METRICS_TEXT_BYTES 4096
+
+struct MetricsSnapshot
+{
+    uint64_t frames;
+    double fps;
+    // Seconds, over the frames since the last snapshot
+    double work_p50, work_p99, work_max;
+    double present_p50, present_p99, present_max;
+    double upload_avg;
+    size_t particles, particle_capacity;
+    size_t player_shots, player_shot_capacity;
+    size_t enemy_shots, enemy_shot_capacity;
+    size_t wave, score;
+    // Frame scheduler counters, 0 without one
+    uint64_t frames_overloaded, frames_skipped;
+    double sim_debt, sim_dropped;
+};
+
+struct MetricsExporter;
+struct FrameScheduler;
+
+// 0 when neither destination can be opened. 'statsd_address' or
+// 'prometheus_path' may be 0, not both.
+MetricsExporter* start_metrics_exporter(const char* statsd_address, const char* prometheus_path, double interval);
+// Frame loop, every frame; does nothing until a snapshot is due.
+// 'scheduler' is 0 on the render thread, which doesn't own it.
+void publish_metrics(MetricsExporter* exporter, const FrameProfiler& profiler, const ParticleSystem& particles, const GameState& state, const FrameScheduler* scheduler);
+// Sends a last snapshot and prints how many went out
+void stop_metrics_exporter(MetricsExporter* exporter);
+
+#endif
@@ -0,0 +1,215 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "atlas.h"
+
+/*
+    Packs ASCII-art sprite sheets into a sprite atlas:
+
+        pack_atlas OUTPUT.atlas INPUT.txt...
+
+    Each sheet starts with a line 'sprite NAME WIDTH HEIGHT [FRAMES]' and is
+    followed by FRAMES * HEIGHT rows of exactly WIDTH characters, '@' for a
+    set pixel and anything else for an empty one. Lines starting with '#'
+    and blank lines between sheets are ignored.
+*/
+
+#define PACK_MAX_ENTRIES 256
+#define PACK_MAX_LINE 256
+
+struct Packer
+{
+    AtlasFileEntry entries[PACK_MAX_ENTRIES];
+    size_t num_entries;
+    // Row data, offsets relative to its start until the index size is known
+    uint8_t* rows;
+    size_t rows_size, rows_capacity;
+};
+
+static void reserve_rows(Packer* packer, size_t size)
+{
+    if(size <= packer->rows_capacity) return;
+
+    size_t capacity = packer->rows_capacity ? packer->rows_capacity : 4096;
+    while(capacity < size) capacity *= 2;
+    uint8_t* rows = new uint8_t[capacity]();
+    if(packer->rows_size) memcpy(rows, packer->rows, packer->rows_size);
+    delete[] packer->rows;
+    packer->rows = rows;
+    packer->rows_capacity = capacity;
+}
+
+// Strips the line ending, returns the remaining length
+static size_t trim_line(char* line)
+{
+    size_t length = strlen(line);
+    while(length && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+    return length;
+}
+
+static bool pack_sheet(Packer* packer, FILE* file, const char* path, size_t* line_number, const char* header)
+{
+    char name[PACK_MAX_LINE];
+    unsigned width = 0, height = 0, frames = 1;
+    int fields = sscanf(header, "sprite %255s %u %u %u", name, &width, &height, &frames);
+    if(fields < 3)
+    {
+        fprintf(stderr, "%s:%zu: expected 'sprite NAME WIDTH HEIGHT [FRAMES]'.\n", path, *line_number);
+        return false;
+    }
+    if(strlen(name) >= ATLAS_NAME_LENGTH)
+    {
+        fprintf(stderr, "%s:%zu: sprite name '%s' is longer than %d characters.\n", path, *line_number, name, ATLAS_NAME_LENGTH - 1);
+        return false;
+    }
+    if(width == 0 || width > 64 || height == 0 || frames == 0)
+    {
+        fprintf(stderr, "%s:%zu: sprite '%s' must be 1 to 64 pixels wide with at least one row and frame.\n", path, *line_number, name);
+        return false;
+    }
+    for(size_t ei = 0; ei < packer->num_entries; ++ei)
+    {
+        if(!strcmp(packer->entries[ei].name, name))
+        {
+            fprintf(stderr, "%s:%zu: sprite '%s' is defined twice.\n", path, *line_number, name);
+            return false;
+        }
+    }
+    if(packer->num_entries == PACK_MAX_ENTRIES)
+    {
+        fprintf(stderr, "%s:%zu: more than %d sprites.\n", path, *line_number, PACK_MAX_ENTRIES);
+        return false;
+    }
+
+    AtlasFileEntry& entry = packer->entries[packer->num_entries];
+    entry = AtlasFileEntry{};
+    strcpy(entry.name, name);
+    entry.width = width;
+    entry.frame_height = height;
+    entry.num_frames = frames;
+    entry.row_bits = atlas_row_bits(width);
+    entry.offset = packer->rows_size;
+
+    size_t row_bytes = entry.row_bits / 8;
+    size_t num_rows = (size_t)height * frames;
+    reserve_rows(packer, packer->rows_size + num_rows * row_bytes + ATLAS_ALIGNMENT);
+
+    char line[PACK_MAX_LINE];
+    for(size_t yi = 0; yi < num_rows; ++yi)
+    {
+        ++*line_number;
+        if(!fgets(line, sizeof(line), file) || trim_line(line) != width)
+        {
+            fprintf(stderr, "%s:%zu: sprite '%s' row %zu is not %u characters wide.\n", path, *line_number, name, yi, width);
+            return false;
+        }
+
+        uint64_t row = 0;
+        for(size_t xi = 0; xi < width; ++xi)
+        {
+            if(line[xi] == '@') row |= (uint64_t)1 << xi;
+        }
+        // Rows of row_bits in host byte order, each frame bottom row first,
+        // the layout sprite_row() reads
+        size_t frame_row = yi - yi % height + (height - 1 - yi % height);
+        uint8_t* dst = packer->rows + packer->rows_size + frame_row * row_bytes;
+        uint16_t row16 = (uint16_t)row;
+        uint32_t row32 = (uint32_t)row;
+        if(row_bytes == 2) memcpy(dst, &row16, 2);
+        else if(row_bytes == 4) memcpy(dst, &row32, 4);
+        else memcpy(dst, &row, 8);
+    }
+
+    packer->rows_size += num_rows * row_bytes;
+    packer->rows_size = (packer->rows_size + ATLAS_ALIGNMENT - 1) / ATLAS_ALIGNMENT * ATLAS_ALIGNMENT;
+    ++packer->num_entries;
+    return true;
+}
+
+static bool pack_file(Packer* packer, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if(!file)
+    {
+        fprintf(stderr, "Could not open '%s'.\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    char line[PACK_MAX_LINE];
+    size_t line_number = 0;
+    while(ok && fgets(line, sizeof(line), file))
+    {
+        ++line_number;
+        if(!trim_line(line) || line[0] == '#') continue;
+        ok = pack_sheet(packer, file, path, &line_number, line);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// Written next to 'path' and renamed over it, so a game mapping the old
+// atlas, or hot reloading it, never sees a half-written file
+static bool write_atlas(const Packer& packer, const char* path)
+{
+    char temp_path[PACK_MAX_LINE + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not create '%s'.\n", temp_path);
+        return false;
+    }
+
+    AtlasFileHeader header = {ATLAS_MAGIC, ATLAS_VERSION, (uint32_t)packer.num_entries, 0};
+    size_t index_size = sizeof(AtlasFileHeader) + packer.num_entries * sizeof(AtlasFileEntry);
+    size_t data_offset = (index_size + ATLAS_ALIGNMENT - 1) / ATLAS_ALIGNMENT * ATLAS_ALIGNMENT;
+
+    AtlasFileEntry entries[PACK_MAX_ENTRIES];
+    for(size_t ei = 0; ei < packer.num_entries; ++ei)
+    {
+        entries[ei] = packer.entries[ei];
+        entries[ei].offset += data_offset;
+    }
+
+    const uint8_t padding[ATLAS_ALIGNMENT] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(entries, sizeof(AtlasFileEntry), packer.num_entries, file) == packer.num_entries &&
+              fwrite(padding, 1, data_offset - index_size, file) == data_offset - index_size &&
+              fwrite(packer.rows, 1, packer.rows_size, file) == packer.rows_size;
+    if(fclose(file) != 0) ok = false;
+#if defined(_WIN32)
+    // rename() does not replace an existing file there
+    if(ok) remove(path);
+#endif
+    if(ok && rename(temp_path, path) != 0) ok = false;
+    if(!ok)
+    {
+        fprintf(stderr, "Could not write '%s'.\n", path);
+        remove(temp_path);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: %s OUTPUT.atlas INPUT.txt...\n", argv[0]);
+        return 1;
+    }
+
+    Packer* packer = new Packer();
+    bool ok = true;
+    for(int i = 2; ok && i < argc; ++i)
+    {
+        ok = pack_file(packer, argv[i]);
+    }
+    if(ok) ok = write_atlas(*packer, argv[1]);
+    if(ok) printf("Packed %zu sprites into '%s', %zu bytes of rows.\n", packer->num_entries, argv[1], packer->rows_size);
+
+    delete[] packer->rows;
+    delete packer;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "audio.h"
+
+/*
+    Packs WAV files into a sound bank for --sounds:
+
+        pack_sounds OUTPUT.sounds NAME=INPUT.wav...
+
+    NAME is the sound it plays, see create_audio_mixer(). PCM of 8, 16, 24
+    or 32 bits and 32-bit float are read, channels are mixed down to mono
+    and other rates are resampled linearly to AUDIO_RATE, so the game only
+    ever maps the result.
+*/
+
+#define PACK_MAX_ENTRIES 64
+#define PACK_MAX_PATH 256
+
+struct Packer
+{
+    SoundBankEntry entries[PACK_MAX_ENTRIES];
+    size_t num_entries;
+    // Sample data, offsets relative to its start until the index size is known
+    float* samples;
+    size_t num_samples, capacity;
+};
+
+static void reserve_samples(Packer* packer, size_t count)
+{
+    if(count <= packer->capacity) return;
+
+    size_t capacity = packer->capacity ? packer->capacity : 65536;
+    while(capacity < count) capacity *= 2;
+    float* samples = new float[capacity]();
+    if(packer->num_samples) memcpy(samples, packer->samples, packer->num_samples * sizeof(float));
+    delete[] packer->samples;
+    packer->samples = samples;
+    packer->capacity = capacity;
+}
+
+static uint32_t read_u32(const uint8_t* p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+static uint16_t read_u16(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+
+// One sample of 'bits' at 'p' as -1 to 1
+static float decode_sample(const uint8_t* p, uint16_t format, uint16_t bits)
+{
+    if(format == 3)
+    {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    switch(bits)
+    {
+        case 8:  return ((float)p[0] - 128.0f) / 128.0f;
+        case 16: return (float)(int16_t)read_u16(p) / 32768.0f;
+        case 24: return (float)((int32_t)(read_u32(p) << 8) >> 8) / 8388608.0f;
+        default: return (float)(int32_t)read_u32(p) / 2147483648.0f;
+    }
+}
+
+static uint8_t* read_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = length > 0 ? new uint8_t[length] : 0;
+    if(data && fread(data, 1, (size_t)length, file) != (size_t)length)
+    {
+        delete[] data;
+        data = 0;
+    }
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+static bool pack_wav(Packer* packer, const char* name, const char* path)
+{
+    if(strlen(name) >= SOUND_BANK_NAME_LENGTH)
+    {
+        fprintf(stderr, "Sound name '%s' is longer than %d characters.\n", name, SOUND_BANK_NAME_LENGTH - 1);
+        return false;
+    }
+    for(size_t ei = 0; ei < packer->num_entries; ++ei)
+    {
+        if(!strcmp(packer->entries[ei].name, name))
+        {
+            fprintf(stderr, "Sound '%s' is given twice.\n", name);
+            return false;
+        }
+    }
+    if(packer->num_entries == PACK_MAX_ENTRIES)
+    {
+        fprintf(stderr, "More than %d sounds.\n", PACK_MAX_ENTRIES);
+        return false;
+    }
+
+    size_t size;
+    uint8_t* data = read_file(path, &size);
+    if(!data)
+    {
+        fprintf(stderr, "Could not read '%s'.\n", path);
+        return false;
+    }
+    if(size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+    {
+        fprintf(stderr, "'%s' is not a WAV file.\n", path);
+        delete[] data;
+        return false;
+    }
+
+    // The chunks the sound needs, anything else is skipped
+    uint16_t format = 0, channels = 0, bits = 0;
+    uint32_t rate = 0;
+    const uint8_t* pcm = 0;
+    size_t pcm_size = 0;
+    for(size_t offset = 12; offset + 8 <= size;)
+    {
+        uint32_t chunk_size = read_u32(data + offset + 4);
+        const uint8_t* chunk = data + offset + 8;
+        if(chunk_size > size - offset - 8) chunk_size = (uint32_t)(size - offset - 8);
+        if(!memcmp(data + offset, "fmt ", 4) && chunk_size >= 16)
+        {
+            format = read_u16(chunk);
+            channels = read_u16(chunk + 2);
+            rate = read_u32(chunk + 4);
+            bits = read_u16(chunk + 14);
+            // WAVE_FORMAT_EXTENSIBLE keeps the real format in its subformat
+            if(format == 0xFFFE && chunk_size >= 26) format = read_u16(chunk + 24);
+        }
+        else if(!memcmp(data + offset, "data", 4))
+        {
+            pcm = chunk;
+            pcm_size = chunk_size;
+        }
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    bool pcm_ok = format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+    bool float_ok = format == 3 && bits == 32;
+    if(!pcm || !channels || !rate || !(pcm_ok || float_ok))
+    {
+        fprintf(stderr, "'%s' is not PCM or float WAV data.\n", path);
+        delete[] data;
+        return false;
+    }
+
+    size_t frame_bytes = (size_t)channels * (bits / 8);
+    size_t num_frames = pcm_size / frame_bytes;
+    size_t length = (size_t)((double)num_frames * AUDIO_RATE / rate);
+    size_t block = SOUND_BANK_ALIGNMENT / sizeof(float);
+    size_t padded = (length + block - 1) / block * block;
+    if(!num_frames || !padded)
+    {
+        fprintf(stderr, "'%s' holds no samples.\n", path);
+        delete[] data;
+        return false;
+    }
+    reserve_samples(packer, packer->num_samples + padded);
+
+    float* out = packer->samples + packer->num_samples;
+    for(size_t i = 0; i < length; ++i)
+    {
+        double source = (double)i * rate / AUDIO_RATE;
+        size_t frame = (size_t)source;
+        float t = (float)(source - (double)frame);
+        size_t next = frame + 1 < num_frames ? frame + 1 : frame;
+        float a = 0.0f, b = 0.0f;
+        for(uint16_t ci = 0; ci < channels; ++ci)
+        {
+            a += decode_sample(pcm + frame * frame_bytes + ci * (bits / 8), format, bits);
+            b += decode_sample(pcm + next * frame_bytes + ci * (bits / 8), format, bits);
+        }
+        out[i] = (a + (b - a) * t) / channels;
+    }
+    delete[] data;
+
+    SoundBankEntry& entry = packer->entries[packer->num_entries++];
+    entry = SoundBankEntry{};
+    strcpy(entry.name, name);
+    entry.num_samples = (uint32_t)padded;
+    entry.offset = packer->num_samples * sizeof(float);
+    packer->num_samples += padded;
+    return true;
+}
+
+// Written next to 'path' and renamed over it, as pack_atlas does
+static bool write_bank(const Packer& packer, const char* path)
+{
+    char temp_path[PACK_MAX_PATH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not create '%s'.\n", temp_path);
+        return false;
+    }
+
+    SoundBankHeader header = {SOUND_BANK_MAGIC, SOUND_BANK_VERSION, (uint32_t)packer.num_entries, AUDIO_RATE};
+    size_t index_size = sizeof(SoundBankHeader) + packer.num_entries * sizeof(SoundBankEntry);
+    size_t data_offset = (index_size + SOUND_BANK_ALIGNMENT - 1) / SOUND_BANK_ALIGNMENT * SOUND_BANK_ALIGNMENT;
+
+    SoundBankEntry entries[PACK_MAX_ENTRIES];
+    for(size_t ei = 0; ei < packer.num_entries; ++ei)
+    {
+        entries[ei] = packer.entries[ei];
+        entries[ei].offset += data_offset;
+    }
+
+    const uint8_t padding[SOUND_BANK_ALIGNMENT] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(entries, sizeof(SoundBankEntry), packer.num_entries, file) == packer.num_entries &&
+              fwrite(padding, 1, data_offset - index_size, file) == data_offset - index_size &&
+              fwrite(packer.samples, sizeof(float), packer.num_samples, file) == packer.num_samples;
+    if(fclose(file) != 0) ok = false;
+#if defined(_WIN32)
+    if(ok) remove(path);
+#endif
+    if(ok && rename(temp_path, path) != 0) ok = false;
+    if(!ok)
+    {
+        fprintf(stderr, "Could not write '%s'.\n", path);
+        remove(temp_path);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: %s OUTPUT.sounds NAME=INPUT.wav...\n", argv[0]);
+        return 1;
+    }
+
+    Packer* packer = new Packer();
+    bool ok = true;
+    for(int i = 2; ok && i < argc; ++i)
+    {
+        char name[PACK_MAX_PATH];
+        const char* equals = strchr(argv[i], '=');
+        if(!equals || equals == argv[i] || (size_t)(equals - argv[i]) >= sizeof(name))
+        {
+            fprintf(stderr, "Expected NAME=INPUT.wav, not '%s'.\n", argv[i]);
+            ok = false;
+            break;
+        }
+        memcpy(name, argv[i], equals - argv[i]);
+        name[equals - argv[i]] = '\0';
+        ok = pack_wav(packer, name, equals + 1);
+    }
+    if(ok) ok = write_bank(*packer, argv[1]);
+    if(ok) printf("Packed %zu sounds into '%s', %.2f seconds of samples.\n", packer->num_entries, argv[1], (double)packer->num_samples / AUDIO_RATE);
+
+    delete[] packer->samples;
+    delete packer;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include "pages.h"
+
+#if defined(_WIN32)
+#define PAGES_USE_POSIX 0
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#define PAGES_USE_POSIX 1
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Keeps the data after it on a cache line of its own
+#define PAGES_HEADER 64
+
+struct PageHeader
+{
+    // Bytes mapped from the header on, or allocated with new[]
+    size_t mapped;
+    PageKind kind;
+};
+
+static_assert(sizeof(PageHeader) <= PAGES_HEADER, "page header outgrew its cache line");
+
+const char* page_kind_names[NUM_PAGE_KINDS] = {"heap", "hugetlb", "advised"};
+
+static std::atomic<bool> huge_pages;
+static std::atomic<uint64_t> page_blocks[NUM_PAGE_KINDS];
+static std::atomic<uint64_t> page_bytes[NUM_PAGE_KINDS];
+static std::atomic<uint64_t> page_fallbacks;
+
+static size_t round_pages(size_t size, size_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+#if PAGES_USE_POSIX
+static uint8_t* map_huge_pages(size_t mapped, PageKind* kind)
+{
+#if defined(MAP_HUGETLB)
+    void* data = mmap(0, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(data != MAP_FAILED)
+    {
+        *kind = PAGES_HUGETLB;
+        return (uint8_t*)data;
+    }
+#endif
+#if defined(MADV_HUGEPAGE)
+    // Transparent huge pages only back 2 MiB aligned ranges, so map a
+    // page more and trim either end to the boundary
+    void* over = mmap(0, mapped + PAGES_HUGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(over == MAP_FAILED) return 0;
+    uint8_t* start = (uint8_t*)over;
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)start + PAGES_HUGE_SIZE - 1) & ~(uintptr_t)(PAGES_HUGE_SIZE - 1));
+    if(aligned > start) munmap(start, (size_t)(aligned - start));
+    size_t tail = (size_t)(start + mapped + PAGES_HUGE_SIZE - (aligned + mapped));
+    if(tail) munmap(aligned + mapped, tail);
+    if(madvise(aligned, mapped, MADV_HUGEPAGE) != 0)
+    {
+        // Transparent huge pages are compiled out or switched off
+        munmap(aligned, mapped);
+        return 0;
+    }
+    *kind = PAGES_ADVISED;
+    return aligned;
+#else
+    return 0;
+#endif
+}
+#else
+static uint8_t* map_huge_pages(size_t mapped, PageKind* kind)
+{
+    static std::atomic<int> privilege{-1};
+    int held = privilege.load(std::memory_order_relaxed);
+    if(held < 0)
+    {
+        // Granting the right isn't enough, the token must have it enabled
+        held = 0;
+        HANDLE token;
+        if(OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+        {
+            TOKEN_PRIVILEGES privileges = {};
+            privileges.PrivilegeCount = 1;
+            privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            if(LookupPrivilegeValueA(0, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                AdjustTokenPrivileges(token, FALSE, &privileges, 0, 0, 0) && GetLastError() == ERROR_SUCCESS)
+            {
+                held = 1;
+            }
+            CloseHandle(token);
+        }
+        privilege.store(held, std::memory_order_relaxed);
+    }
+    size_t large = GetLargePageMinimum();
+    if(!held || !large || mapped % large) return 0;
+    void* data = VirtualAlloc(0, mapped, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if(!data) return 0;
+    *kind = PAGES_HUGETLB;
+    return (uint8_t*)data;
+}
+#endif
+
+void set_huge_pages(bool enabled)
+{
+    huge_pages.store(enabled, std::memory_order_relaxed);
+}
+
+bool huge_pages_enabled()
+{
+    return huge_pages.load(std::memory_order_relaxed);
+}
+
+void* alloc_pages(size_t size)
+{
+    PageKind kind = PAGES_HEAP;
+    uint8_t* base = 0;
+    size_t mapped = PAGES_HEADER + size;
+    if(huge_pages_enabled() && size >= PAGES_MIN_HUGE)
+    {
+        // Mapped pages come zeroed from the kernel
+        size_t huge = round_pages(mapped, PAGES_HUGE_SIZE);
+        base = map_huge_pages(huge, &kind);
+        if(base) mapped = huge;
+        else page_fallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(!base)
+    {
+        base = new uint8_t[mapped];
+        memset(base + PAGES_HEADER, 0, size);
+    }
+
+    PageHeader* header = (PageHeader*)base;
+    header->mapped = mapped;
+    header->kind = kind;
+    page_blocks[kind].fetch_add(1, std::memory_order_relaxed);
+    page_bytes[kind].fetch_add(mapped, std::memory_order_relaxed);
+    return base + PAGES_HEADER;
+}
+
+void free_pages(void* data)
+{
+    if(!data) return;
+    uint8_t* base = (uint8_t*)data - PAGES_HEADER;
+    PageHeader header = *(PageHeader*)base;
+    page_blocks[header.kind].fetch_sub(1, std::memory_order_relaxed);
+    page_bytes[header.kind].fetch_sub(header.mapped, std::memory_order_relaxed);
+    if(header.kind == PAGES_HEAP)
+    {
+        delete[] base;
+        return;
+    }
+#if PAGES_USE_POSIX
+    munmap(base, header.mapped);
+#else
+    VirtualFree(base, 0, MEM_RELEASE);
+#endif
+}
+
+// The AnonHugePages line of the process's memory rollup, in kB
+static uint64_t read_huge_resident()
+{
+#if defined(__linux__)
+    int file = open("/proc/self/smaps_rollup", O_RDONLY);
+    if(file < 0) return 0;
+    char text[4096];
+    ssize_t length = read(file, text, sizeof(text) - 1);
+    close(file);
+    if(length <= 0) return 0;
+    text[length] = '\0';
+    const char* line = strstr(text, "AnonHugePages:");
+    return line ? strtoull(line + strlen("AnonHugePages:"), 0, 10) * 1024 : 0;
+#else
+    return 0;
+#endif
+}
+
+void read_page_stats(PageStats* stats)
+{
+    for(size_t ki = 0; ki < NUM_PAGE_KINDS; ++ki)
+    {
+        stats->blocks[ki] = page_blocks[ki].load(std::memory_order_relaxed);
+        stats->bytes[ki] = page_bytes[ki].load(std::memory_order_relaxed);
+    }
+    stats->fallbacks = page_fallbacks.load(std::memory_order_relaxed);
+    stats->huge_resident = read_huge_resident();
+}
+
+void print_page_stats()
+{
+    PageStats stats;
+    read_page_stats(&stats);
+    printf("Pages: huge pages %s", huge_pages_enabled() ? "on" : "off");
+    for(size_t ki = 0; ki < NUM_PAGE_KINDS; ++ki)
+    {
+        printf(", %llu %s (%.1f MiB)", (unsigned long long)stats.blocks[ki], page_kind_names[ki], stats.bytes[ki] / 1048576.0);
+    }
+    printf(", %llu fell back, %.1f MiB resident in huge pages\n", (unsigned long long)stats.fallbacks, stats.huge_resident / 1048576.0);
+}
@@ -0,0 +1,66 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+/*
+    Page allocator for the big, long-lived blocks: frame buffers, arena
+    blocks and the simulation's state block. With huge pages switched on,
+    a request of at least PAGES_MIN_HUGE bytes is mapped in 2 MiB pages,
+    so a buffer or a state block the simulation walks every tick costs a
+    handful of TLB entries instead of hundreds. Linux first asks for
+    reserved pages with MAP_HUGETLB, then for a 2 MiB aligned mapping with
+    madvise(MADV_HUGEPAGE) that transparent huge pages back when they
+    can; Windows asks for large pages, which needs the "Lock pages in
+    memory" right. Whatever is refused, and every smaller request, falls
+    back to operator new[]. Memory comes back zeroed and aligned for any
+    fundamental type either way.
+
+    Each block is preceded by a header holding how it was allocated, so
+    free_pages() takes nothing but the pointer. The counts of each kind
+    are kept for the startup profile.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+#define PAGES_HUGE_SIZE ((size_t)2 << 20)
+// Smaller requests would waste most of a huge page
+#define PAGES_MIN_HUGE ((size_t)1 << 20)
+
+enum PageKind: uint8_t
+{
+    PAGES_HEAP      = 0,
+    // Reserved huge pages, or large pages on Windows
+    PAGES_HUGETLB   = 1,
+    // Advised for transparent huge pages, which the kernel may or may not
+    // have backed yet
+    PAGES_ADVISED   = 2,
+    NUM_PAGE_KINDS
+};
+
+extern const char* page_kind_names[NUM_PAGE_KINDS];
+
+// Totals of the blocks live right now, and of the huge page requests that
+// fell back to the heap since startup
+struct PageStats
+{
+    uint64_t blocks[NUM_PAGE_KINDS];
+    uint64_t bytes[NUM_PAGE_KINDS];
+    uint64_t fallbacks;
+    // Anonymous memory the kernel backs with huge pages, 0 where it isn't
+    // read (Linux only)
+    uint64_t huge_resident;
+};
+
+// Off by default; set before the blocks that should use it are allocated
+void set_huge_pages(bool enabled);
+bool huge_pages_enabled();
+
+void* alloc_pages(size_t size);
+// Takes 0 like delete[] does
+void free_pages(void* data);
+
+void read_page_stats(PageStats* stats);
+// One line: whether huge pages are on and the live blocks of each kind
+void print_page_stats();
+
+#endif
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstring>
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* perf_counter_names[NUM_PERF_COUNTERS] = {"cycles", "instructions", "LLC misses", "branch misses"};
+
+#if defined(__linux__)
+static const struct
+{
+    uint32_t type;
+    uint64_t config;
+} perf_counter_events[NUM_PERF_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int open_perf_event(PerfCounter counter, int group_fd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_counter_events[counter].type;
+    attr.config = perf_counter_events[counter].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // The leader starts the whole group once everything is in it
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool open_perf_counters(PerfCounters* counters)
+{
+    counters->num_open = 0;
+    for(size_t ci = 0; ci < NUM_PERF_COUNTERS; ++ci) counters->fds[ci] = -1;
+
+    int leader = open_perf_event(PERF_CYCLES, -1);
+    if(leader < 0)
+    {
+        fprintf(stderr, "perf_event_open: %s, counting nothing.\n", strerror(errno));
+        return false;
+    }
+    counters->fds[PERF_CYCLES] = leader;
+    counters->slots[PERF_CYCLES] = counters->num_open++;
+    for(size_t ci = 1; ci < NUM_PERF_COUNTERS; ++ci)
+    {
+        int fd = open_perf_event((PerfCounter)ci, leader);
+        if(fd < 0)
+        {
+            fprintf(stderr, "No %s counter: %s.\n", perf_counter_names[ci], strerror(errno));
+            continue;
+        }
+        counters->fds[ci] = fd;
+        counters->slots[ci] = counters->num_open++;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+bool read_perf_counters(const PerfCounters& counters, uint64_t* values)
+{
+    // PERF_FORMAT_GROUP: the number of counters, then one value each
+    uint64_t group[1 + NUM_PERF_COUNTERS];
+    if(!counters.num_open) return false;
+    ssize_t size = read(counters.fds[PERF_CYCLES], group, sizeof(group));
+    if(size < (ssize_t)((1 + counters.num_open) * sizeof(uint64_t))) return false;
+
+    for(size_t ci = 0; ci < NUM_PERF_COUNTERS; ++ci)
+    {
+        values[ci] = counters.fds[ci] >= 0 ? group[1 + counters.slots[ci]] : 0;
+    }
+    return true;
+}
+
+void close_perf_counters(PerfCounters* counters)
+{
+    // Members first, so the leader goes last
+    for(size_t ci = NUM_PERF_COUNTERS; ci-- > 0;)
+    {
+        if(counters->fds[ci] >= 0) close(counters->fds[ci]);
+        counters->fds[ci] = -1;
+    }
+    counters->num_open = 0;
+}
+#else
+bool open_perf_counters(PerfCounters* counters)
+{
+    counters->num_open = 0;
+    for(size_t ci = 0; ci < NUM_PERF_COUNTERS; ++ci) counters->fds[ci] = -1;
+    fprintf(stderr, "Hardware counters need Linux perf events, counting nothing.\n");
+    return false;
+}
+
+bool read_perf_counters(const PerfCounters& counters, uint64_t* values)
+{
+    memset(values, 0, NUM_PERF_COUNTERS * sizeof(uint64_t));
+    return false;
+}
+
+void close_perf_counters(PerfCounters* counters)
+{
+    counters->num_open = 0;
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+/*
+    Hardware performance counters. On Linux, perf_event_open() opens
+    cycles, instructions, last-level cache misses and branch misses as one
+    group counting the calling thread only, so one read() returns all of
+    them from the same instant. A counter the CPU or hypervisor does not
+    offer reads as zero; without perf events at all, or when
+    perf_event_paranoid forbids them, opening fails and nothing is counted.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+enum PerfCounter: uint8_t
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_COUNTERS
+};
+
+extern const char* perf_counter_names[NUM_PERF_COUNTERS];
+
+struct PerfCounters
+{
+    // -1 for counters that could not be opened; the first is the group leader
+    int fds[NUM_PERF_COUNTERS];
+    // Position of each open counter in a group read
+    size_t slots[NUM_PERF_COUNTERS];
+    size_t num_open;
+};
+
+// Prints why when the counters can't be opened
+bool open_perf_counters(PerfCounters* counters);
+// Running totals since opening, zero for counters that aren't open
+bool read_perf_counters(const PerfCounters& counters, uint64_t* values);
+void close_perf_counters(PerfCounters* counters);
+
+#endif
@@ -0,0 +1,3080 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "present.h"
+#include "runtime.h"
+#include "debug_overlay.h"
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+
+// Hands the page's main thread back to the browser until its next
+// animation frame. Asyncify saves the frame loop's stack and resumes it
+// from the requestAnimationFrame callback, so the loop stays a loop and
+// the browser composites what the last swap drew in between.
+EM_ASYNC_JS(void, wait_animation_frame, (), {
+    await new Promise(resolve => requestAnimationFrame(resolve));
+});
+#endif
+
+/*
+################################################
+##                SHADER CACHE                ##
+################################################
+*/
+
+#define SHADER_CACHE_MAGIC 0x48534750u // "PGSH"
+#define SHADER_CACHE_VERSION 1
+#define SHADER_CACHE_MAX_BINARY (4 << 20)
+
+struct ShaderCacheHeader
+{
+    uint32_t magic, version;
+    // Hash of the driver strings the binaries were built by
+    uint64_t driver;
+    uint32_t num_programs, reserved;
+};
+
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hash_gl_string(uint64_t hash, GLenum name)
+{
+    const char* text = (const char*)glGetString(name);
+    return text ? hash_bytes(hash, text, strlen(text) + 1) : hash;
+}
+
+bool program_binaries_supported()
+{
+#ifdef SPACE_INVADERS_GLES
+    bool supported = true;
+#else
+    bool supported = gl_caps.program_binary;
+#endif
+    // Drivers may offer the calls with no format to save in
+    GLint num_formats = 0;
+    if(supported) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    return num_formats > 0;
+}
+
+// A missing, stale or damaged file just starts an empty cache
+void open_shader_cache(ShaderCache* cache, const char* path)
+{
+    *cache = ShaderCache{};
+    cache->path = path;
+    cache->enabled = path && program_binaries_supported();
+    if(!cache->enabled) return;
+
+    uint64_t driver = 14695981039346656037ull;
+    driver = hash_gl_string(driver, GL_VENDOR);
+    driver = hash_gl_string(driver, GL_RENDERER);
+    driver = hash_gl_string(driver, GL_VERSION);
+    cache->driver = driver;
+
+    FILE* file = fopen(path, "rb");
+    if(!file) return;
+
+    ShaderCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              header.magic == SHADER_CACHE_MAGIC && header.version == SHADER_CACHE_VERSION &&
+              header.driver == driver && header.num_programs <= SHADER_CACHE_MAX_PROGRAMS;
+    for(uint32_t pi = 0; ok && pi < header.num_programs; ++pi)
+    {
+        CachedProgram& program = cache->programs[cache->num_programs];
+        ok = fread(&program.entry, sizeof(ShaderCacheEntry), 1, file) == 1 &&
+             program.entry.size > 0 && program.entry.size <= SHADER_CACHE_MAX_BINARY;
+        if(!ok) break;
+
+        program.binary = new uint8_t[program.entry.size];
+        ok = fread(program.binary, 1, program.entry.size, file) == program.entry.size;
+        if(!ok) delete[] program.binary;
+        else ++cache->num_programs;
+    }
+    fclose(file);
+
+    if(!ok)
+    {
+        for(size_t pi = 0; pi < cache->num_programs; ++pi) delete[] cache->programs[pi].binary;
+        cache->num_programs = 0;
+    }
+}
+
+CachedProgram* find_cached_program(ShaderCache* cache, uint64_t key)
+{
+    for(size_t pi = 0; pi < cache->num_programs; ++pi)
+    {
+        if(cache->programs[pi].entry.key == key) return &cache->programs[pi];
+    }
+    return 0;
+}
+
+// 0 when there is no binary for 'key' or the driver refuses it
+GLuint load_cached_program(ShaderCache* cache, uint64_t key)
+{
+    CachedProgram* cached = find_cached_program(cache, key);
+    if(!cached) return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, cached->entry.format, cached->binary, (GLsizei)cached->entry.size);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    cached->used = true;
+    return program;
+}
+
+void store_program_binary(ShaderCache* cache, uint64_t key, GLuint program)
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if(size <= 0 || size > SHADER_CACHE_MAX_BINARY) return;
+
+    CachedProgram* cached = find_cached_program(cache, key);
+    if(!cached)
+    {
+        // Make room by dropping a program nothing asked for this run
+        if(cache->num_programs == SHADER_CACHE_MAX_PROGRAMS)
+        {
+            for(size_t pi = 0; pi < cache->num_programs && !cached; ++pi)
+            {
+                if(!cache->programs[pi].used) cached = &cache->programs[pi];
+            }
+            if(!cached) return;
+            delete[] cached->binary;
+        }
+        else cached = &cache->programs[cache->num_programs++];
+    }
+    else delete[] cached->binary;
+
+    GLenum format = 0;
+    GLsizei length = 0;
+    cached->binary = new uint8_t[size];
+    glGetProgramBinary(program, size, &length, &format, cached->binary);
+    cached->entry = ShaderCacheEntry{key, format, (uint32_t)length};
+    cached->used = true;
+    cache->dirty = true;
+}
+
+// Saves the cache if anything compiled this run, then frees the binaries
+void close_shader_cache(ShaderCache* cache)
+{
+    if(cache->enabled && cache->dirty)
+    {
+        FILE* file = fopen(cache->path, "wb");
+        bool ok = file != 0;
+        ShaderCacheHeader header = {SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, cache->driver, (uint32_t)cache->num_programs, 0};
+        if(ok) ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        for(size_t pi = 0; ok && pi < cache->num_programs; ++pi)
+        {
+            const CachedProgram& program = cache->programs[pi];
+            ok = fwrite(&program.entry, sizeof(ShaderCacheEntry), 1, file) == 1 &&
+                 fwrite(program.binary, 1, program.entry.size, file) == program.entry.size;
+        }
+        if(file && fclose(file) != 0) ok = false;
+        if(!ok) fprintf(stderr, "Could not write the shader cache '%s'.\n", cache->path);
+    }
+
+    for(size_t pi = 0; pi < cache->num_programs; ++pi) delete[] cache->programs[pi].binary;
+    cache->num_programs = 0;
+}
+
+void validate_shader(GLuint shader, const char* file = 0)
+{
+    static const unsigned int BUFFER_SIZE = 512;
+    char buffer[BUFFER_SIZE];
+    GLsizei length = 0;
+    glGetShaderInfoLog(shader, BUFFER_SIZE, &length, buffer);
+
+    if (length > 0)
+    {
+        printf("Shader %d(%s) compile error: %s\n",
+            shader, (file ? file : ""), buffer);
+    }
+}
+
+bool validate_program(GLuint program)
+{
+    static const GLsizei BUFFER_SIZE = 512;
+    GLchar buffer[BUFFER_SIZE];
+    GLsizei length = 0;
+    glGetProgramInfoLog(program, BUFFER_SIZE, &length, buffer);
+
+    if(length > 0)
+    {
+        printf("Program %d link error: %s\n", program, buffer);
+        return false;
+    }
+
+    return true; 
+}
+
+// Compile and link one shader per stage, or load the binary 'cache' holds
+// for these sources. Nothing here waits on the driver.
+void start_program_build(ProgramBuild* build, const GLenum* stages, const char* const* sources, size_t num_stages, ShaderCache* cache)
+{
+    build->key = 14695981039346656037ull;
+    for(size_t si = 0; si < num_stages; ++si) build->key = hash_bytes(build->key, sources[si], strlen(sources[si]) + 1);
+    build->num_stages = 0;
+    build->cache = cache && cache->enabled ? cache : 0;
+    build->state = BUILD_PENDING;
+    build->start_time = glfwGetTime();
+    if(build->cache)
+    {
+        build->program = load_cached_program(cache, build->key);
+        if(build->program)
+        {
+            ++cache->hits;
+            build->state = BUILD_LINKED;
+            return;
+        }
+        ++cache->misses;
+    }
+
+    build->program = glCreateProgram();
+    if(build->cache) glProgramParameteri(build->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    // The shaders stay alive until finished, for their logs
+    for(size_t si = 0; si < num_stages; ++si)
+    {
+        GLuint shader = glCreateShader(stages[si]);
+        glShaderSource(shader, 1, &sources[si], 0);
+        glCompileShader(shader);
+        glAttachShader(build->program, shader);
+        build->shaders[build->num_stages++] = shader;
+    }
+    glLinkProgram(build->program);
+}
+
+bool program_build_done(const ProgramBuild& build)
+{
+    if(build.state != BUILD_PENDING || !gl_caps.parallel_shader_compile) return true;
+    GLint done = GL_FALSE;
+    glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+    return done == GL_TRUE;
+}
+
+GLuint finish_program_build(ProgramBuild* build)
+{
+    if(build->state != BUILD_PENDING) return build->state == BUILD_LINKED ? build->program : 0;
+
+    for(size_t si = 0; si < build->num_stages; ++si)
+    {
+        validate_shader(build->shaders[si]);
+        glDetachShader(build->program, build->shaders[si]);
+        glDeleteShader(build->shaders[si]);
+    }
+    build->num_stages = 0;
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(build->program, GL_LINK_STATUS, &linked);
+    if(!validate_program(build->program) || linked != GL_TRUE)
+    {
+        glDeleteProgram(build->program);
+        build->program = 0;
+        build->state = BUILD_FAILED;
+        return 0;
+    }
+    if(build->cache) store_program_binary(build->cache, build->key, build->program);
+    build->state = BUILD_LINKED;
+    return build->program;
+}
+
+void cancel_program_build(ProgramBuild* build)
+{
+    if(build->state != BUILD_PENDING) return;
+    for(size_t si = 0; si < build->num_stages; ++si) glDeleteShader(build->shaders[si]);
+    build->num_stages = 0;
+    glDeleteProgram(build->program);
+    build->program = 0;
+    build->state = BUILD_FAILED;
+}
+
+GLuint link_program(const GLenum* stages, const char* const* sources, size_t num_stages, ShaderCache* cache)
+{
+    ProgramBuild build;
+    start_program_build(&build, stages, sources, num_stages, cache);
+    return finish_program_build(&build);
+}
+
+GLuint create_program(const char* vertex_source, const char* fragment_source, ShaderCache* cache)
+{
+    const GLenum stages[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    const char* sources[] = {vertex_source, fragment_source};
+    return link_program(stages, sources, 2, cache);
+}
+
+#ifdef SPACE_INVADERS_GLES
+// The 0xRRGGBBAA palette words are A,B,G,R bytes in memory
+void set_palette_swizzle()
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_ALPHA);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_BLUE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_GREEN);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_RED);
+}
+#else
+#endif
+
+const char* pixel_format_name(PixelFormat format)
+{
+    switch(format)
+    {
+        case PIXEL_RGBA8888:     return "rgba8888";
+        case PIXEL_INDEXED8:     return "indexed8";
+        case PIXEL_BGRA8888_REV: return "bgra8888_rev";
+        case PIXEL_RGBA8888_REV: return "rgba8888_rev";
+        case PIXEL_RGB565:       return "rgb565";
+        default: break;
+    }
+    return "unknown";
+}
+
+#ifndef GL_RGB565
+#define GL_RGB565 0x8D62
+#endif
+
+GLenum buffer_gl_internal_format(const Buffer& buffer)
+{
+    switch(buffer.format)
+    {
+        case PIXEL_INDEXED8: return GL_R8;
+#ifdef SPACE_INVADERS_GLES
+        case PIXEL_RGB565: return GL_RGB565;
+#else
+        case PIXEL_RGB565:
+            return gl_caps.rgb565 ? GL_RGB565 : GL_RGB8;
+#endif
+        default: return GL_RGBA8;
+    }
+}
+
+/*
+################################################
+##                  UPLOADS                   ##
+################################################
+*/
+
+#define FORMAT_TRIAL_UPLOADS 8
+
+PixelFormat negotiate_pixel_format(size_t width, size_t height)
+{
+    const PixelFormat candidates[] = {PIXEL_BGRA8888_REV, PIXEL_RGBA8888_REV, PIXEL_RGBA8888};
+    const size_t num_candidates = sizeof(candidates) / sizeof(candidates[0]);
+
+    PixelFormat preferred = PIXEL_RGBA8888;
+    bool have_preferred = false;
+#ifndef SPACE_INVADERS_GLES
+    if(gl_caps.internalformat_query)
+    {
+        GLint format = 0, type = 0;
+        glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_TEXTURE_IMAGE_FORMAT, 1, &format);
+        glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_TEXTURE_IMAGE_TYPE, 1, &type);
+        for(size_t ci = 0; ci < num_candidates; ++ci)
+        {
+            if((GLint)pixel_gl_format(candidates[ci]) == format && (GLint)pixel_gl_type(candidates[ci]) == type)
+            {
+                preferred = candidates[ci];
+                have_preferred = true;
+            }
+        }
+    }
+#endif
+
+    uint32_t* pixels = new uint32_t[width * height]();
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (GLsizei)width, (GLsizei)height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    double times[num_candidates];
+    PixelFormat fastest = candidates[0];
+    double fastest_time = 0.0;
+    for(size_t ci = 0; ci < num_candidates; ++ci)
+    {
+        GLenum format = pixel_gl_format(candidates[ci]), type = pixel_gl_type(candidates[ci]);
+
+        // One untimed upload absorbs any first-use setup in the driver
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)width, (GLsizei)height, format, type, pixels);
+        glFinish();
+
+        double start = glfwGetTime();
+        for(size_t i = 0; i < FORMAT_TRIAL_UPLOADS; ++i)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)width, (GLsizei)height, format, type, pixels);
+        }
+        glFinish();
+        times[ci] = (glfwGetTime() - start) / FORMAT_TRIAL_UPLOADS;
+
+        if(ci == 0 || times[ci] < fastest_time)
+        {
+            fastest = candidates[ci];
+            fastest_time = times[ci];
+        }
+    }
+
+    glDeleteTextures(1, &texture);
+    delete[] pixels;
+
+    PixelFormat chosen = fastest;
+    for(size_t ci = 0; ci < num_candidates; ++ci)
+    {
+        if(have_preferred && candidates[ci] == preferred && times[ci] <= fastest_time * 1.1) chosen = preferred;
+        printf("  %-13s %.3f ms%s\n", pixel_format_name(candidates[ci]), times[ci] * 1000.0,
+            have_preferred && candidates[ci] == preferred ? " (driver preferred)" : "");
+    }
+    return chosen;
+}
+
+const char* upload_mode_name(UploadMode mode)
+{
+    switch(mode)
+    {
+        case UPLOAD_PBO:        return "pbo";
+        case UPLOAD_PERSISTENT: return "persistent";
+        default:                return "direct";
+    }
+}
+
+bool init_persistent_upload(PixelUploader* uploader, Buffer* buffer)
+{
+#ifdef SPACE_INVADERS_GLES
+    // Persistent mapping is an extension on GLES 3.0, PBOs are core
+    (void)uploader; (void)buffer;
+    return false;
+#else
+    if(!gl_caps.buffer_storage) return false;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, uploader->pbos);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[0]);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, uploader->size, 0, flags);
+    uint8_t* mapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, uploader->size, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if(!mapped)
+    {
+        glDeleteBuffers(1, uploader->pbos);
+        uploader->pbos[0] = 0;
+        return false;
+    }
+
+    memcpy(mapped, buffer_pixels(*buffer), uploader->size);
+    uploader->cpu_data = buffer_pixels(*buffer);
+    set_buffer_pixels(buffer, mapped);
+    return true;
+#endif
+}
+
+bool init_pbo_upload(PixelUploader* uploader)
+{
+    // PBOs and fences are core in both GL 3.3 and GLES 3.0
+    glGenBuffers(UPLOAD_PBO_COUNT, uploader->pbos);
+    for(size_t i = 0; i < UPLOAD_PBO_COUNT; ++i)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, uploader->size, 0, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return true;
+}
+
+// Set up the requested mode, falling back persistent -> pbo -> direct
+// when the driver lacks support. Returns the mode actually in use.
+UploadMode init_uploader(PixelUploader* uploader, Buffer* buffer, UploadMode mode)
+{
+    uploader->mode = UPLOAD_DIRECT;
+    uploader->current = 0;
+    uploader->size = buffer->width * buffer->height * buffer_pixel_size(*buffer);
+    uploader->cpu_data = 0;
+    uploader->thread = 0;
+    uploader->frame_hash = 0;
+    uploader->vulkan = 0;
+    uploader->num_vulkan_rects = 0;
+    uploader->wayland = 0;
+    uploader->num_wayland_rects = 0;
+    uploader->x11 = 0;
+    uploader->kms = 0;
+    uploader->terminal = 0;
+    select_frame_pipeline(uploader, PRESENT_GL);
+    for(size_t i = 0; i < UPLOAD_PBO_COUNT; ++i)
+    {
+        uploader->pbos[i] = 0;
+        uploader->fences[i] = 0;
+    }
+
+    if(mode == UPLOAD_PERSISTENT)
+    {
+        if(init_persistent_upload(uploader, buffer))
+        {
+            uploader->mode = UPLOAD_PERSISTENT;
+            return uploader->mode;
+        }
+        mode = UPLOAD_PBO;
+    }
+
+    if(mode == UPLOAD_PBO && init_pbo_upload(uploader)) uploader->mode = UPLOAD_PBO;
+    return uploader->mode;
+}
+
+void destroy_uploader(PixelUploader* uploader, Buffer* buffer)
+{
+    if(uploader->vulkan)
+    {
+        set_buffer_pixels(buffer, uploader->cpu_data);
+        destroy_vulkan_presenter(uploader->vulkan);
+        uploader->vulkan = 0;
+        return;
+    }
+    if(uploader->wayland)
+    {
+        set_buffer_pixels(buffer, uploader->cpu_data);
+        destroy_wayland_presenter(uploader->wayland);
+        uploader->wayland = 0;
+        return;
+    }
+    if(uploader->x11)
+    {
+        destroy_x11_presenter(uploader->x11);
+        uploader->x11 = 0;
+        return;
+    }
+    if(uploader->kms)
+    {
+        destroy_kms_presenter(uploader->kms);
+        uploader->kms = 0;
+        return;
+    }
+    if(uploader->terminal)
+    {
+        destroy_terminal_presenter(uploader->terminal);
+        uploader->terminal = 0;
+        return;
+    }
+
+    for(size_t i = 0; i < UPLOAD_PBO_COUNT; ++i)
+    {
+        if(uploader->fences[i]) glDeleteSync(uploader->fences[i]);
+        uploader->fences[i] = 0;
+    }
+
+    if(uploader->mode == UPLOAD_PERSISTENT)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[0]);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, uploader->pbos);
+        set_buffer_pixels(buffer, uploader->cpu_data);
+    }
+    else if(uploader->mode == UPLOAD_PBO)
+    {
+        glDeleteBuffers(UPLOAD_PBO_COUNT, uploader->pbos);
+    }
+    uploader->mode = UPLOAD_DIRECT;
+}
+
+UploadMode switch_upload_mode(PixelUploader* uploader, Buffer* buffer, UploadMode mode)
+{
+    // The buffer was last drawn in the mapping, and only damage is
+    // redrawn, so its pixels go back before it is unmapped
+    wait_for_upload(uploader);
+    if(uploader->mode == UPLOAD_PERSISTENT) memcpy(uploader->cpu_data, buffer_pixels(*buffer), uploader->size);
+    glFinish();
+
+    // init_uploader() starts over on everything but these
+    StreamedBuffer* stream = uploader->stream;
+    GpuTimers* gpu_timers = uploader->gpu_timers;
+    destroy_uploader(uploader, buffer);
+    UploadMode chosen = init_uploader(uploader, buffer, mode);
+    uploader->stream = stream;
+    uploader->gpu_timers = gpu_timers;
+    return chosen;
+}
+
+// In persistent mode the rasterizer writes into memory the GPU may still
+// be copying from, so wait for the last upload before drawing.
+static void wait_for_gl_upload(PixelUploader* uploader)
+{
+    if(uploader->mode != UPLOAD_PERSISTENT || !uploader->fences[0]) return;
+
+    glClientWaitSync(uploader->fences[0], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync(uploader->fences[0]);
+    uploader->fences[0] = 0;
+}
+
+template<PresentBackend Backend>
+static void wait_backend_upload(PixelUploader* uploader)
+{
+    if constexpr(Backend == PRESENT_VULKAN) wait_for_vulkan_upload(uploader->vulkan);
+    else if constexpr(Backend == PRESENT_WAYLAND) wait_for_wayland_buffer(uploader->wayland);
+    else if constexpr(Backend == PRESENT_GL) wait_for_gl_upload(uploader);
+}
+
+void wait_for_upload(PixelUploader* uploader)
+{
+    uploader->pipeline->wait(uploader);
+}
+
+// Upload rectangles from 'base', a client pointer or an offset into the
+// bound unpack buffer
+void upload_rects_from(const Buffer& buffer, const uint8_t* base, const Rect* rects, size_t num_rects)
+{
+    size_t pixel_size = buffer_pixel_size(buffer);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)buffer.width);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        const Rect& r = rects[i];
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, (GLint)r.x, (GLint)r.y,
+            (GLsizei)r.width, (GLsizei)r.height,
+            buffer_gl_format(buffer), buffer_gl_type(buffer),
+            base + (r.y * buffer.width + r.x) * pixel_size
+        );
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+// The rasterizer already wrote into the mapped buffer: no CPU copy
+void upload_rects_persistent(PixelUploader* uploader, const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[0]);
+    upload_rects_from(buffer, 0, rects, num_rects);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    uploader->fences[0] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Copy the rectangles into the next PBO in the ring and source the texture
+// update from it, so the driver copies asynchronously. Returns false when
+// the slot cannot be mapped and the caller should upload directly.
+bool upload_rects_pbo(PixelUploader* uploader, const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    size_t slot = uploader->current;
+    if(uploader->fences[slot])
+    {
+        // The GPU normally finished with this slot frames ago
+        glClientWaitSync(uploader->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(uploader->fences[slot]);
+        uploader->fences[slot] = 0;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[slot]);
+    uint8_t* mapped = (uint8_t*)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, 0, uploader->size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+    );
+    if(!mapped)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+
+    size_t pixel_size = buffer_pixel_size(buffer);
+    const uint8_t* pixels = buffer_pixels(buffer);
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        const Rect& r = rects[i];
+        for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+        {
+            size_t offset = (yi * buffer.width + r.x) * pixel_size;
+            memcpy(mapped + offset, pixels + offset, r.width * pixel_size);
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    upload_rects_from(buffer, 0, rects, num_rects);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    uploader->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    uploader->current = (slot + 1) % UPLOAD_PBO_COUNT;
+    return true;
+}
+
+void upload_rects_direct(const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    upload_rects_from(buffer, buffer_pixels(buffer), rects, num_rects);
+}
+
+// The pixels changed since the last upload: this frame's draws plus the
+// previous frame's, which the partial clear has just erased
+size_t gather_upload_rects(const Buffer& buffer, Rect* rects)
+{
+    size_t num_rects = 0;
+    for(size_t i = 0; i < buffer.num_prev_dirty; ++i) rects[num_rects++] = buffer.prev_dirty[i];
+    for(size_t i = 0; i < buffer.num_dirty; ++i) rects[num_rects++] = buffer.dirty[i];
+    return merge_rects(rects, num_rects);
+}
+
+// This frame's draws become the ones the next partial clear erases
+void retire_dirty_rects(Buffer* buffer)
+{
+    memcpy(buffer->prev_dirty, buffer->dirty, buffer->num_dirty * sizeof(Rect));
+    buffer->num_prev_dirty = buffer->num_dirty;
+    buffer->num_dirty = 0;
+}
+
+// Hash of the rectangles an upload would send and the pixels in them,
+// eight bytes at a time
+uint64_t hash_upload_rects(const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t pixel_size = buffer_pixel_size(buffer);
+    const uint8_t* pixels = buffer_pixels(buffer);
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        const Rect& r = rects[i];
+        hash = (hash ^ (r.x | (uint64_t)r.y << 16 | (uint64_t)r.width << 32 | (uint64_t)r.height << 48)) * prime;
+        size_t row_size = r.width * pixel_size;
+        for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+        {
+            const uint8_t* row = pixels + (yi * buffer.width + r.x) * pixel_size;
+            size_t xi = 0;
+            for(; xi + 8 <= row_size; xi += 8)
+            {
+                uint64_t word;
+                memcpy(&word, row + xi, 8);
+                hash = (hash ^ word) * prime;
+            }
+            for(; xi < row_size; ++xi) hash = (hash ^ row[xi]) * prime;
+        }
+    }
+    return hash;
+}
+
+// A frame is unchanged when the rectangles it would upload are the ones
+// the last frame uploaded and hold the same pixels: everything else was
+// left alone, so the texture already matches the buffer
+bool frame_changed(PixelUploader* uploader, const Buffer& buffer)
+{
+    Rect rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_rects = gather_upload_rects(buffer, rects);
+    uint64_t hash = hash_upload_rects(buffer, rects, num_rects);
+    bool changed = hash != uploader->frame_hash;
+    uploader->frame_hash = hash;
+    return changed;
+}
+
+void upload_buffer(PixelUploader* uploader, Buffer* buffer)
+{
+    Rect rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_rects = gather_upload_rects(*buffer, rects);
+
+    if(uploader->mode == UPLOAD_PERSISTENT)
+    {
+        upload_rects_persistent(uploader, *buffer, rects, num_rects);
+    }
+    else if(uploader->mode != UPLOAD_PBO || !upload_rects_pbo(uploader, *buffer, rects, num_rects))
+    {
+        upload_rects_direct(*buffer, rects, num_rects);
+    }
+    retire_dirty_rects(buffer);
+}
+
+/*
+################################################
+##               UPLOAD THREAD                ##
+################################################
+*/
+
+void upload_thread_main(UploadThread* upload)
+{
+    TRACE_THREAD("upload");
+    enter_thread_role(THREAD_UPLOAD);
+    set_alloc_tag(ALLOC_PRESENT);
+    glfwMakeContextCurrent(upload->window);
+    glBindTexture(GL_TEXTURE_2D, upload->texture);
+
+    std::unique_lock<std::mutex> lock(upload->mutex);
+    for(;;)
+    {
+        while(!upload->quit && !upload->pending) upload->wake.wait(lock);
+        if(upload->quit) break;
+        Buffer* source = upload->buffer;
+        if(upload->num_frames > 1)
+        {
+            // The texture is free once the last frame has been presented
+            {
+                TRACE_SCOPE("upload wait present");
+                while(!upload->quit && !upload->presented) upload->wake.wait(lock);
+            }
+            if(upload->quit) break;
+            glWaitSync(upload->presented, 0, GL_TIMEOUT_IGNORED);
+            glDeleteSync(upload->presented);
+            upload->presented = 0;
+            source = &upload->frame;
+        }
+        lock.unlock();
+
+        GLsync done;
+        {
+            TRACE_SCOPE("upload");
+            upload_buffer(upload->uploader, source);
+            done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // Other contexts can only wait on a fence that has been flushed
+            glFlush();
+        }
+
+        lock.lock();
+        upload->done = done;
+        upload->pending = false;
+        upload->finished.notify_one();
+    }
+    lock.unlock();
+    glfwMakeContextCurrent(0);
+}
+
+// 'window' is the main window, whose context must be current
+bool start_upload_thread(UploadThread* upload, GLFWwindow* window, PixelUploader* uploader, Buffer* buffer, GLuint texture, size_t num_frames)
+{
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    upload->window = glfwCreateWindow(1, 1, "Space Invaders upload", NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if(!upload->window) return false;
+
+    upload->uploader = uploader;
+    upload->buffer = buffer;
+    upload->texture = texture;
+    upload->pending = false;
+    upload->quit = false;
+    upload->done = 0;
+
+    upload->num_frames = num_frames;
+    upload->back = 0;
+    upload->frames[0] = buffer_pixels(*buffer);
+    size_t size = buffer->width * buffer->height * buffer_pixel_size(*buffer);
+    for(size_t i = 1; i < num_frames; ++i)
+    {
+        upload->frames[i] = (uint8_t*)alloc_pages(size);
+        memcpy(upload->frames[i], upload->frames[0], size);
+    }
+    upload->presented = 0;
+    upload->awaiting_present = false;
+    upload->in_flight = false;
+
+    upload->thread = std::thread(upload_thread_main, upload);
+    uploader->thread = upload;
+    return true;
+}
+
+void stop_upload_thread(UploadThread* upload)
+{
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        upload->quit = true;
+    }
+    upload->wake.notify_one();
+    upload->thread.join();
+
+    if(upload->done) glDeleteSync(upload->done);
+    upload->done = 0;
+    if(upload->presented) glDeleteSync(upload->presented);
+    upload->presented = 0;
+    upload->uploader->thread = 0;
+
+    Buffer* buffer = upload->buffer;
+    if(upload->back) memcpy(upload->frames[0], upload->frames[upload->back], buffer->width * buffer->height * buffer_pixel_size(*buffer));
+    set_buffer_pixels(buffer, upload->frames[0]);
+    for(size_t i = 1; i < upload->num_frames; ++i) free_pages(upload->frames[i]);
+    upload->num_frames = 1;
+    upload->back = 0;
+    glfwDestroyWindow(upload->window);
+    upload->window = 0;
+}
+
+// Hands the frame to the upload thread and queues a wait for it on the
+// GPU. The CPU only waits for the upload to be issued, after which the
+// buffer may be drawn into again.
+void upload_buffer_on_thread(UploadThread* upload)
+{
+    std::unique_lock<std::mutex> lock(upload->mutex);
+    upload->pending = true;
+    upload->wake.notify_one();
+    while(upload->pending) upload->finished.wait(lock);
+
+    glWaitSync(upload->done, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(upload->done);
+    upload->done = 0;
+}
+
+// Rotation: the present that the handed-over frame's upload waits for has
+// been issued
+void release_upload_texture(UploadThread* upload)
+{
+    if(!upload->awaiting_present) return;
+    GLsync presented = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        upload->presented = presented;
+        upload->awaiting_present = false;
+    }
+    upload->wake.notify_one();
+}
+
+// Rotation: wait for the frame handed over last to be issued and queue a
+// wait for its pixels before the present. True when there was one, which
+// the screen has yet to show.
+bool collect_upload(UploadThread* upload)
+{
+    // A frame that was never swapped is not on screen to wait for
+    release_upload_texture(upload);
+
+    std::unique_lock<std::mutex> lock(upload->mutex);
+    {
+        TRACE_SCOPE("upload wait");
+        while(upload->pending) upload->finished.wait(lock);
+    }
+    if(upload->done)
+    {
+        glWaitSync(upload->done, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(upload->done);
+        upload->done = 0;
+    }
+
+    bool collected = upload->in_flight;
+    upload->in_flight = false;
+    return collected;
+}
+
+// Rotation: hand the frame to the thread, which uploads it after the next
+// present, and draw on into the other framebuffer, caught up with the
+// rectangles this frame changed
+void hand_over_frame(UploadThread* upload, Buffer* buffer)
+{
+    collect_upload(upload);
+
+    Rect rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_rects = gather_upload_rects(*buffer, rects);
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        upload->frame = *buffer;
+        upload->pending = true;
+        upload->awaiting_present = true;
+        upload->in_flight = true;
+    }
+    upload->wake.notify_one();
+
+    TRACE_SCOPE("frame catch-up");
+    const uint8_t* front = upload->frames[upload->back];
+    upload->back = (upload->back + 1) % upload->num_frames;
+    uint8_t* back = upload->frames[upload->back];
+    size_t pixel_size = buffer_pixel_size(*buffer);
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        const Rect& r = rects[i];
+        for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+        {
+            size_t offset = (yi * buffer->width + r.x) * pixel_size;
+            memcpy(back + offset, front + offset, r.width * pixel_size);
+        }
+    }
+    set_buffer_pixels(buffer, back);
+    retire_dirty_rects(buffer);
+}
+
+/*
+    GPU sprite backend. Instances are drawn into the native-resolution
+    framebuffer texture; the fragment shader reproduces the CPU blitter's
+    clipping, so both paths produce the same pixels. Atlas rows are sprite
+    rows, bottom row first like the framebuffer's.
+*/
+const char* sprite_vertex_shader =
+    "\n"
+    GLSL_HEADER
+    "\n"
+    "layout(location = 0) in ivec2 inst_pos;\n"
+    "layout(location = 1) in ivec4 inst_sprite;\n"
+    "layout(location = 2) in uint inst_color;\n"
+    "uniform vec2 buffer_size;\n"
+    "\n"
+    "flat out ivec4 sprite;\n"
+    "flat out ivec2 origin;\n"
+    "flat out vec3 color;\n"
+    "\n"
+    "void main(void){\n"
+    "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    vec2 size = vec2(inst_sprite.yz * inst_sprite.w);\n"
+    "    vec2 pos = (vec2(inst_pos) + corner * size) / buffer_size;\n"
+    "    gl_Position = vec4(2.0 * pos - 1.0, 0.0, 1.0);\n"
+    "\n"
+    "    sprite = inst_sprite;\n"
+    "    origin = inst_pos;\n"
+    "    color = vec3((inst_color >> 24) & 255u, (inst_color >> 16) & 255u, (inst_color >> 8) & 255u) / 255.0;\n"
+    "}\n";
+
+const char* sprite_fragment_shader =
+    "\n"
+    GLSL_HEADER
+    "\n"
+    "uniform sampler2D atlas;\n"
+    "flat in ivec4 sprite;\n"
+    "flat in ivec2 origin;\n"
+    "flat in vec3 color;\n"
+    "\n"
+    "out vec3 outColor;\n"
+    "\n"
+    "void main(void){\n"
+    "    ivec2 local = (ivec2(gl_FragCoord.xy) - origin) / sprite.w;\n"
+    "    int row = sprite.x + local.y;\n"
+    "    if(texelFetch(atlas, ivec2(local.x, row), 0).r < 0.5) discard;\n"
+    "    outColor = color;\n"
+    "}\n";
+
+/*
+################################################
+##                GPU SPRITES                 ##
+################################################
+*/
+
+#define GPU_COMPUTE_TILE 16
+
+const char* sprite_compute_shader =
+    "\n"
+    "#version 430\n"
+    "\n"
+    "layout(local_size_x = 16, local_size_y = 16) in;\n"
+    "layout(rgba8, binding = 0) writeonly uniform image2D target;\n"
+    "layout(std430, binding = 0) readonly buffer Entities { uvec4 entities[]; };\n"
+    "layout(std430, binding = 1) readonly buffer Atlas { uvec2 atlas_rows[]; };\n"
+    "uniform int num_entities;\n"
+    "\n"
+    "shared uint bin[256];\n"
+    "shared uint bin_count;\n"
+    "\n"
+    "// x, y, atlas_y, width, height, scale as in SpriteInstance\n"
+    "ivec2 entity_pos(uvec4 e){ return ivec2(bitfieldExtract(int(e.x), 0, 16), bitfieldExtract(int(e.x), 16, 16)); }\n"
+    "ivec2 entity_size(uvec4 e){ return ivec2(bitfieldExtract(int(e.y), 16, 16), bitfieldExtract(int(e.z), 0, 16)); }\n"
+    "int entity_scale(uvec4 e){ return bitfieldExtract(int(e.z), 16, 16); }\n"
+    "\n"
+    "void main(void){\n"
+    "    ivec2 tile = ivec2(gl_WorkGroupID.xy) * 16;\n"
+    "    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    int best = -1;\n"
+    "    uint color = 0u;\n"
+    "\n"
+    "    for(int first = 0; first < num_entities; first += 256){\n"
+    "        if(gl_LocalInvocationIndex == 0u) bin_count = 0u;\n"
+    "        barrier();\n"
+    "\n"
+    "        int ei = first + int(gl_LocalInvocationIndex);\n"
+    "        if(ei < num_entities){\n"
+    "            uvec4 e = entities[ei];\n"
+    "            ivec2 pos = entity_pos(e);\n"
+    "            ivec2 end = pos + entity_size(e) * entity_scale(e);\n"
+    "            if(all(lessThan(pos, tile + 16)) && all(greaterThan(end, tile))) bin[atomicAdd(bin_count, 1u)] = uint(ei);\n"
+    "        }\n"
+    "        barrier();\n"
+    "\n"
+    "        for(uint bi = 0u; bi < bin_count; ++bi){\n"
+    "            int index = int(bin[bi]);\n"
+    "            if(index < best) continue;\n"
+    "            uvec4 e = entities[index];\n"
+    "            ivec2 local = pixel - entity_pos(e);\n"
+    "            ivec2 size = entity_size(e);\n"
+    "            if(local.x < 0 || local.y < 0) continue;\n"
+    "            local /= entity_scale(e);\n"
+    "            if(local.x >= size.x || local.y >= size.y) continue;\n"
+    "\n"
+    "            uvec2 bits = atlas_rows[bitfieldExtract(int(e.y), 0, 16) + local.y];\n"
+    "            uint word = local.x < 32 ? bits.x : bits.y;\n"
+    "            if(((word >> uint(local.x & 31)) & 1u) == 0u) continue;\n"
+    "            best = index;\n"
+    "            color = e.w;\n"
+    "        }\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    if(best >= 0 && all(lessThan(pixel, imageSize(target)))){\n"
+    "        vec3 rgb = vec3((color >> 24) & 255u, (color >> 16) & 255u, (color >> 8) & 255u) / 255.0;\n"
+    "        imageStore(target, pixel, vec4(rgb, 1.0));\n"
+    "    }\n"
+    "}\n";
+
+bool gpu_compute_supported()
+{
+#ifdef SPACE_INVADERS_GLES
+    // Compute shaders need GLES 3.1
+    return false;
+#else
+    return gl_caps.compute;
+#endif
+}
+
+// Register a sprite (or a whole vertically stacked sheet) with the atlas
+void gpu_atlas_add(GpuSpriteRenderer* gpu, const Sprite& sprite, size_t num_rows)
+{
+    if(gpu->num_atlas_entries == GPU_MAX_ATLAS_SPRITES) return;
+
+    AtlasEntry& entry = gpu->atlas[gpu->num_atlas_entries++];
+    entry.rows = sprite.rows;
+    entry.num_rows = num_rows;
+    entry.row_bytes = sprite.row_bits / 8;
+    entry.atlas_y = gpu->atlas_rows;
+    gpu->atlas_rows += num_rows;
+}
+
+// Expand the registered sprites into the atlas texture, 64 texels per row
+void gpu_build_atlas(GpuSpriteRenderer* gpu)
+{
+    uint8_t* texels = new uint8_t[64 * gpu->atlas_rows]();
+    for(size_t ei = 0; ei < gpu->num_atlas_entries; ++ei)
+    {
+        const AtlasEntry& entry = gpu->atlas[ei];
+        Sprite sheet{64, (uint16_t)entry.num_rows, (uint8_t)(entry.row_bytes * 8), entry.rows};
+        for(size_t yi = 0; yi < entry.num_rows; ++yi)
+        {
+            uint64_t mask = sprite_row(sheet, yi);
+            for(size_t xi = 0; xi < 64; ++xi)
+            {
+                texels[(entry.atlas_y + yi) * 64 + xi] = ((mask >> xi) & 1) ? 255 : 0;
+            }
+        }
+    }
+
+    glGenTextures(1, &gpu->atlas_texture);
+    glBindTexture(GL_TEXTURE_2D, gpu->atlas_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 64, (GLsizei)gpu->atlas_rows, 0, GL_RED, GL_UNSIGNED_BYTE, texels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    delete[] texels;
+
+#ifndef SPACE_INVADERS_GLES
+    // The compute backend reads each row as its two 32-bit halves
+    if(gpu->compute)
+    {
+        uint32_t* rows = new uint32_t[2 * gpu->atlas_rows]();
+        for(size_t ei = 0; ei < gpu->num_atlas_entries; ++ei)
+        {
+            const AtlasEntry& entry = gpu->atlas[ei];
+            Sprite sheet{64, (uint16_t)entry.num_rows, (uint8_t)(entry.row_bytes * 8), entry.rows};
+            for(size_t yi = 0; yi < entry.num_rows; ++yi)
+            {
+                uint64_t mask = sprite_row(sheet, yi);
+                rows[2 * (entry.atlas_y + yi)] = (uint32_t)mask;
+                rows[2 * (entry.atlas_y + yi) + 1] = (uint32_t)(mask >> 32);
+            }
+        }
+        glGenBuffers(1, &gpu->atlas_ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->atlas_ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * gpu->atlas_rows * sizeof(uint32_t), rows, GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        delete[] rows;
+    }
+#endif
+}
+#ifndef SPACE_INVADERS_GLES
+bool init_gpu_compute(GpuSpriteRenderer* gpu, ShaderCache* cache)
+{
+    const GLenum stages[] = {GL_COMPUTE_SHADER};
+    const char* sources[] = {sprite_compute_shader};
+    gpu->compute_program = link_program(stages, sources, 1, cache);
+    if(!gpu->compute_program) return false;
+    gpu->num_entities_location = glGetUniformLocation(gpu->compute_program, "num_entities");
+
+    glGenBuffers(1, &gpu->entity_ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->entity_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(gpu->instances), 0, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+}
+
+// Only the compact instance list crosses the bus, whatever the sprites cover
+void dispatch_gpu_compute(GpuSpriteRenderer* gpu)
+{
+    glUseProgram(gpu->compute_program);
+    glUniform1i(gpu->num_entities_location, (GLint)gpu->num_instances);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu->entity_ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(gpu->instances), 0, GL_STREAM_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpu->num_instances * sizeof(SpriteInstance), gpu->instances);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu->entity_ssbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpu->atlas_ssbo);
+    glBindImageTexture(0, gpu->target_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+
+    GLuint groups_x = (GLuint)((gpu->width + GPU_COMPUTE_TILE - 1) / GPU_COMPUTE_TILE);
+    GLuint groups_y = (GLuint)((gpu->height + GPU_COMPUTE_TILE - 1) / GPU_COMPUTE_TILE);
+    glDispatchCompute(groups_x, groups_y, 1);
+    // Later clears, dispatches and the present pass all see the stores
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+}
+#else
+bool init_gpu_compute(GpuSpriteRenderer*, ShaderCache*) { return false; }
+void dispatch_gpu_compute(GpuSpriteRenderer*) {}
+#endif
+
+// With 'compute' set the instances are rasterized by sprite_compute_shader
+// when the context can run it, and drawn as quads otherwise
+bool init_gpu_renderer(GpuSpriteRenderer* gpu, GLuint target_texture, size_t width, size_t height, bool compute, ShaderCache* cache)
+{
+    gpu->width = width;
+    gpu->height = height;
+    gpu->num_atlas_entries = 0;
+    gpu->atlas_rows = 0;
+    gpu->clear_pending = false;
+    gpu->clear_color = 0;
+    gpu->num_instances = 0;
+    gpu->atlas_texture = 0;
+    gpu->compute = false;
+    gpu->compute_program = gpu->entity_ssbo = gpu->atlas_ssbo = 0;
+    gpu->target_texture = target_texture;
+
+    gpu->program = create_program(sprite_vertex_shader, sprite_fragment_shader, cache);
+    if(!gpu->program) return false;
+    gpu->buffer_size_location = glGetUniformLocation(gpu->program, "buffer_size");
+
+    glGenFramebuffers(1, &gpu->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, gpu->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target_texture, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if(!complete)
+    {
+        glDeleteFramebuffers(1, &gpu->fbo);
+        glDeleteProgram(gpu->program);
+        return false;
+    }
+
+    glGenVertexArrays(1, &gpu->vao);
+    glGenBuffers(1, &gpu->instance_vbo);
+    glBindVertexArray(gpu->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, gpu->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(gpu->instances), 0, GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 2, GL_SHORT, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, x));
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 4, GL_SHORT, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, atlas_y));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(SpriteInstance), (const void*)offsetof(SpriteInstance, color));
+    glVertexAttribDivisor(2, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    if(compute && !gpu_compute_supported())
+    {
+        fprintf(stderr, "Compute shaders need OpenGL 4.3, drawing instanced quads.\n");
+    }
+    else if(compute)
+    {
+        gpu->compute = init_gpu_compute(gpu, cache);
+        if(!gpu->compute) fprintf(stderr, "The sprite compute shader failed, drawing instanced quads.\n");
+    }
+    return true;
+}
+
+void destroy_gpu_renderer(GpuSpriteRenderer* gpu)
+{
+    if(gpu->compute)
+    {
+        glDeleteBuffers(1, &gpu->entity_ssbo);
+        glDeleteBuffers(1, &gpu->atlas_ssbo);
+        glDeleteProgram(gpu->compute_program);
+    }
+    glDeleteBuffers(1, &gpu->instance_vbo);
+    glDeleteVertexArrays(1, &gpu->vao);
+    glDeleteFramebuffers(1, &gpu->fbo);
+    glDeleteTextures(1, &gpu->atlas_texture);
+    glDeleteProgram(gpu->program);
+}
+
+// Draw the recorded instances into the framebuffer texture, restoring
+// the present program, VAO and viewport afterwards
+void flush_gpu_renderer(GpuSpriteRenderer* gpu)
+{
+    GLint viewport[4], program, vao;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, gpu->fbo);
+    glViewport(0, 0, (GLsizei)gpu->width, (GLsizei)gpu->height);
+
+    if(gpu->clear_pending)
+    {
+        uint32_t c = gpu->clear_color;
+        glClearColor(((c >> 24) & 255) / 255.0f, ((c >> 16) & 255) / 255.0f, ((c >> 8) & 255) / 255.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        gpu->clear_pending = false;
+    }
+
+    if(gpu->num_instances && gpu->compute)
+    {
+        dispatch_gpu_compute(gpu);
+        gpu->num_instances = 0;
+    }
+    else if(gpu->num_instances)
+    {
+        glUseProgram(gpu->program);
+        glUniform2f(gpu->buffer_size_location, (float)gpu->width, (float)gpu->height);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gpu->atlas_texture);
+        glUniform1i(glGetUniformLocation(gpu->program, "atlas"), 1);
+
+        glBindVertexArray(gpu->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, gpu->instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(gpu->instances), 0, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, gpu->num_instances * sizeof(SpriteInstance), gpu->instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)gpu->num_instances);
+        glActiveTexture(GL_TEXTURE0);
+        gpu->num_instances = 0;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glUseProgram((GLuint)program);
+    glBindVertexArray((GLuint)vao);
+}
+
+void gpu_batch_sprite(GpuSpriteRenderer* gpu, const Sprite& sprite, size_t x, size_t y, size_t scale, uint32_t color)
+{
+    const AtlasEntry* entry = 0;
+    for(size_t ei = 0; ei < gpu->num_atlas_entries; ++ei)
+    {
+        const AtlasEntry& e = gpu->atlas[ei];
+        const uint8_t* base = static_cast<const uint8_t*>(e.rows);
+        const uint8_t* rows = static_cast<const uint8_t*>(sprite.rows);
+        if(rows >= base && rows < base + e.num_rows * e.row_bytes)
+        {
+            entry = &e;
+            break;
+        }
+    }
+    if(!entry) return;
+
+    if(gpu->num_instances == GPU_MAX_INSTANCES) flush_gpu_renderer(gpu);
+
+    size_t first_row = (size_t)(static_cast<const uint8_t*>(sprite.rows) - static_cast<const uint8_t*>(entry->rows)) / entry->row_bytes;
+    SpriteInstance& instance = gpu->instances[gpu->num_instances++];
+    instance.x = (int16_t)(ptrdiff_t)x;
+    instance.y = (int16_t)(ptrdiff_t)y;
+    instance.atlas_y = (int16_t)(entry->atlas_y + first_row);
+    instance.width = (int16_t)sprite.width;
+    instance.height = (int16_t)sprite.height;
+    instance.scale = (int16_t)scale;
+    instance.color = color;
+}
+
+/*
+################################################
+##                TEXT OVERLAY                ##
+################################################
+*/
+
+const char* text_vertex_shader =
+    "\n"
+    GLSL_HEADER
+    "\n"
+    "layout(location = 0) in ivec2 inst_pos;\n"
+    "layout(location = 1) in uint inst_glyph;\n"
+    "layout(location = 2) in uint inst_color;\n"
+    "uniform vec2 buffer_size;\n"
+    "uniform ivec2 glyph_size;\n"
+    "\n"
+    GLSL_NOPERSPECTIVE "out vec2 local;\n"
+    "flat out int glyph;\n"
+    "flat out vec3 color;\n"
+    "\n"
+    "void main(void){\n"
+    "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "    local = corner * vec2(glyph_size);\n"
+    "    vec2 pos = (vec2(inst_pos) + local) / buffer_size;\n"
+    "    gl_Position = vec4(2.0 * pos - 1.0, 0.0, 1.0);\n"
+    "\n"
+    "    glyph = int(inst_glyph);\n"
+    "    color = vec3((inst_color >> 24) & 255u, (inst_color >> 16) & 255u, (inst_color >> 8) & 255u) / 255.0;\n"
+    "}\n";
+
+// Buffer and sheet rows both count up, as in sprite_fragment_shader
+const char* text_fragment_shader =
+    "\n"
+    GLSL_HEADER
+    "\n"
+    "uniform sampler2D font;\n"
+    "uniform ivec2 glyph_size;\n"
+    GLSL_NOPERSPECTIVE "in vec2 local;\n"
+    "flat in int glyph;\n"
+    "flat in vec3 color;\n"
+    "\n"
+    "out vec4 outColor;\n"
+    "\n"
+    "void main(void){\n"
+    "    ivec2 texel = min(ivec2(local), glyph_size - 1);\n"
+    "    int row = glyph * glyph_size.y + texel.y;\n"
+    "    if(texelFetch(font, ivec2(texel.x, row), 0).r < 0.5) discard;\n"
+    "    outColor = vec4(color, 1.0);\n"
+    "}\n";
+
+// Vertex arrays aren't shared between contexts, so every context that
+// draws the overlay makes its own over the shared instance buffer
+GLuint create_text_overlay_vao(const TextOverlay& overlay)
+{
+    GLint previous;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay.instance_vbo);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 2, GL_SHORT, sizeof(GlyphInstance), (const void*)offsetof(GlyphInstance, x));
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_SHORT, sizeof(GlyphInstance), (const void*)offsetof(GlyphInstance, glyph));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(GlyphInstance), (const void*)offsetof(GlyphInstance, color));
+    glVertexAttribDivisor(2, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray((GLuint)previous);
+    return vao;
+}
+
+// The font is uploaded by set_text_overlay_font() once the sprites are known
+bool init_text_overlay(TextOverlay* overlay, size_t width, size_t height, ShaderCache* cache)
+{
+    overlay->width = width;
+    overlay->height = height;
+    overlay->font_rows = 0;
+    overlay->num_glyphs = overlay->glyph_width = overlay->glyph_height = overlay->glyph_bytes = 0;
+    overlay->font_texture = 0;
+    overlay->num_lists = 0;
+    overlay->shown = 0;
+    overlay->version = 1;
+    overlay->submitted_version = overlay->uploaded_version = 0;
+    overlay->num_uploaded = 0;
+
+    overlay->program = create_program(text_vertex_shader, text_fragment_shader, cache);
+    if(!overlay->program) return false;
+    overlay->buffer_size_location = glGetUniformLocation(overlay->program, "buffer_size");
+    overlay->glyph_size_location = glGetUniformLocation(overlay->program, "glyph_size");
+
+    glGenBuffers(1, &overlay->instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(overlay->lists[0].glyphs) * TEXT_OVERLAY_MAX_LISTS, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    overlay->vao = create_text_overlay_vao(*overlay);
+    return true;
+}
+
+// 'font' holds 'num_glyphs' frames stacked one under the other
+void set_text_overlay_font(TextOverlay* overlay, const Sprite& font, size_t num_glyphs)
+{
+    overlay->font_rows = font.rows;
+    overlay->num_glyphs = num_glyphs;
+    overlay->glyph_width = font.width;
+    overlay->glyph_height = font.height;
+    overlay->glyph_bytes = font.height * font.row_bits / 8;
+
+    size_t rows = num_glyphs * font.height;
+    uint8_t* texels = new uint8_t[font.width * rows];
+    for(size_t yi = 0; yi < rows; ++yi)
+    {
+        uint64_t mask = sprite_row(font, yi);
+        for(size_t xi = 0; xi < font.width; ++xi)
+        {
+            texels[yi * font.width + xi] = ((mask >> xi) & 1) ? 255 : 0;
+        }
+    }
+
+    GLint texture;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    // Called again, as a reloaded font does, the texture is respecified
+    if(!overlay->font_texture) glGenTextures(1, &overlay->font_texture);
+    glBindTexture(GL_TEXTURE_2D, overlay->font_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, (GLsizei)font.width, (GLsizei)rows, 0, GL_RED, GL_UNSIGNED_BYTE, texels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, (GLuint)texture);
+    delete[] texels;
+}
+
+void destroy_text_overlay(TextOverlay* overlay)
+{
+    glDeleteBuffers(1, &overlay->instance_vbo);
+    glDeleteVertexArrays(1, &overlay->vao);
+    glDeleteTextures(1, &overlay->font_texture);
+    glDeleteProgram(overlay->program);
+}
+
+// Gives 'buffer' the next list. The GPU renderer's frame shows its own
+// list from the start; CPU layers are shown by compositing them.
+bool attach_text_overlay(Buffer* buffer, TextOverlay* overlay)
+{
+    if(overlay->num_lists == TEXT_OVERLAY_MAX_LISTS) return false;
+    buffer->text_overlay = overlay;
+    buffer->text_list = overlay->num_lists++;
+    overlay->lists[buffer->text_list].num_glyphs = 0;
+    if(buffer->gpu) overlay->shown |= 1u << buffer->text_list;
+    return true;
+}
+
+void show_text_lists(TextOverlay* overlay, uint32_t shown)
+{
+    if(overlay->shown == shown) return;
+    overlay->shown = shown;
+    ++overlay->version;
+}
+
+void reset_text_list(Buffer* buffer)
+{
+    if(!buffer->text_overlay) return;
+    GlyphList& list = buffer->text_overlay->lists[buffer->text_list];
+    if(!list.num_glyphs) return;
+    list.num_glyphs = 0;
+    ++buffer->text_overlay->version;
+}
+
+// First glyph of the overlay font 'sheet' starts at, or false when the
+// sheet isn't part of it and has to be rasterized
+bool text_overlay_glyph_base(const Buffer& buffer, const Sprite& sheet, size_t* base)
+{
+    const TextOverlay* overlay = buffer.text_overlay;
+    if(!overlay || sheet.width != overlay->glyph_width || sheet.height != overlay->glyph_height) return false;
+
+    const uint8_t* font = static_cast<const uint8_t*>(overlay->font_rows);
+    const uint8_t* rows = static_cast<const uint8_t*>(sheet.rows);
+    if(rows < font || rows >= font + overlay->num_glyphs * overlay->glyph_bytes) return false;
+    if((size_t)(rows - font) % overlay->glyph_bytes) return false;
+    *base = (size_t)(rows - font) / overlay->glyph_bytes;
+    return true;
+}
+
+// Indexed buffers take the palette's current color, full-color ones the
+// RGBA8888 entry of the same game color
+uint32_t text_overlay_color(const Buffer& buffer, Color color)
+{
+    if(buffer.format == PIXEL_INDEXED8) return buffer.palette->colors[color.index];
+    return color_tables[PIXEL_RGBA8888][color.index].rgba;
+}
+
+// Glyphs past the list's capacity are dropped
+void add_overlay_glyph(Buffer* buffer, size_t glyph, size_t x, size_t y, uint32_t color)
+{
+    TextOverlay* overlay = buffer->text_overlay;
+    GlyphList& list = overlay->lists[buffer->text_list];
+    if(list.num_glyphs == TEXT_OVERLAY_LIST_GLYPHS) return;
+
+    GlyphInstance& instance = list.glyphs[list.num_glyphs++];
+    instance.x = (int16_t)(ptrdiff_t)x;
+    instance.y = (int16_t)(ptrdiff_t)y;
+    instance.glyph = (uint16_t)glyph;
+    instance.reserved = 0;
+    instance.color = color;
+    ++overlay->version;
+}
+
+// Upload the shown lists if they changed and draw them into the current
+// viewport, which maps the whole buffer, through 'vao' from the current
+// context. The caller's program and VAO are put back.
+void draw_text_overlay(TextOverlay* overlay, GLuint vao)
+{
+    if(overlay->uploaded_version != overlay->version)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, overlay->instance_vbo);
+        size_t count = 0;
+        for(size_t li = 0; li < overlay->num_lists; ++li)
+        {
+            const GlyphList& list = overlay->lists[li];
+            if(!(overlay->shown & (1u << li)) || !list.num_glyphs) continue;
+            glBufferSubData(GL_ARRAY_BUFFER, count * sizeof(GlyphInstance), list.num_glyphs * sizeof(GlyphInstance), list.glyphs);
+            count += list.num_glyphs;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        overlay->num_uploaded = count;
+        overlay->uploaded_version = overlay->version;
+    }
+    if(!overlay->num_uploaded) return;
+
+    GLint program, previous;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+
+    glUseProgram(overlay->program);
+    glUniform2f(overlay->buffer_size_location, (float)overlay->width, (float)overlay->height);
+    glUniform2i(overlay->glyph_size_location, (GLint)overlay->glyph_width, (GLint)overlay->glyph_height);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, overlay->font_texture);
+    glUniform1i(glGetUniformLocation(overlay->program, "font"), 3);
+
+    glBindVertexArray(vao);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)overlay->num_uploaded);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUseProgram((GLuint)program);
+    glBindVertexArray((GLuint)previous);
+}
+
+/*
+################################################
+##                 GPU TIMERS                 ##
+################################################
+*/
+
+bool init_gpu_timers(GpuTimers* timers)
+{
+    *timers = GpuTimers{};
+    if(!gl_caps.timer_query) return false;
+    glGenQueries(GPU_TIMER_LATENCY * NUM_GPU_PHASES, &timers->elapsed[0][0]);
+    glGenQueries(GPU_TIMER_LATENCY * NUM_GPU_PHASES, &timers->stamps[0][0]);
+    timers->trace_track = TRACE_ENABLED ? open_trace_track("gpu") : -1;
+    return true;
+}
+
+void destroy_gpu_timers(GpuTimers* timers)
+{
+    glDeleteQueries(GPU_TIMER_LATENCY * NUM_GPU_PHASES, &timers->elapsed[0][0]);
+    glDeleteQueries(GPU_TIMER_LATENCY * NUM_GPU_PHASES, &timers->stamps[0][0]);
+}
+
+// The offset between the clocks drifts slowly, and reading GL's clock
+// can cost a round trip to the driver, so it is only measured while a
+// trace records and once a window
+static void calibrate_gpu_clock(GpuTimers* timers)
+{
+    GLint64 gl_now = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gl_now);
+    timers->clock_offset = trace_now() - (int64_t)gl_now;
+}
+
+// Collects the results of the frame GPU_TIMER_LATENCY frames back, whose
+// queries this frame reuses
+static void collect_gpu_slot(GpuTimers* timers, size_t slot)
+{
+    bool tracing = TRACE_ENABLED && trace_recording.load(std::memory_order_relaxed);
+    for(size_t gi = 0; gi < NUM_GPU_PHASES; ++gi)
+    {
+        if(!timers->issued[slot][gi]) continue;
+        timers->issued[slot][gi] = false;
+
+        // The timestamp ends last, so both are ready once it is
+        GLint available = 0;
+        glGetQueryObjectiv(timers->stamps[slot][gi], GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available)
+        {
+            ++timers->dropped;
+            continue;
+        }
+        GLuint64 elapsed = 0, stamp = 0;
+        glGetQueryObjectui64v(timers->elapsed[slot][gi], GL_QUERY_RESULT, &elapsed);
+        glGetQueryObjectui64v(timers->stamps[slot][gi], GL_QUERY_RESULT, &stamp);
+
+        timers->window_ns[gi] += elapsed;
+        ++timers->window_samples[gi];
+        timers->total_ns[gi] += elapsed;
+        ++timers->total_samples[gi];
+        if(tracing)
+        {
+            int64_t end_ns = (int64_t)stamp + timers->clock_offset;
+            record_track_event(timers->trace_track, gpu_phase_names[gi], end_ns - (int64_t)elapsed, end_ns);
+        }
+    }
+}
+
+void begin_gpu_frame(GpuTimers* timers)
+{
+    if(!timers) return;
+    if(timers->window_frames == 0 && TRACE_ENABLED && trace_recording.load(std::memory_order_relaxed))
+    {
+        calibrate_gpu_clock(timers);
+    }
+    timers->slot = (timers->slot + 1) % GPU_TIMER_LATENCY;
+    collect_gpu_slot(timers, timers->slot);
+
+    if(++timers->window_frames == COUNTER_WINDOW_FRAMES)
+    {
+        for(size_t gi = 0; gi < NUM_GPU_PHASES; ++gi)
+        {
+            size_t samples = timers->window_samples[gi];
+            timers->shown[gi] = samples ? (float)(timers->window_ns[gi] / 1e3 / samples) : 0.0f;
+            timers->window_ns[gi] = 0;
+            timers->window_samples[gi] = 0;
+        }
+        timers->window_frames = 0;
+    }
+}
+
+void begin_gpu_phase(GpuTimers* timers, GpuPhase phase)
+{
+    if(timers) glBeginQuery(GL_TIME_ELAPSED, timers->elapsed[timers->slot][phase]);
+}
+
+void end_gpu_phase(GpuTimers* timers, GpuPhase phase)
+{
+    if(!timers) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    glQueryCounter(timers->stamps[timers->slot][phase], GL_TIMESTAMP);
+    timers->issued[timers->slot][phase] = true;
+}
+
+void print_gpu_timers(const GpuTimers& timers)
+{
+    printf("GPU time:");
+    for(size_t gi = 0; gi < NUM_GPU_PHASES; ++gi)
+    {
+        size_t samples = timers.total_samples[gi];
+        printf(" %s %.1f us", gpu_phase_names[gi], samples ? timers.total_ns[gi] / 1e3 / samples : 0.0);
+    }
+    printf(", %zu results dropped unread\n", timers.dropped);
+}
+
+/*
+################################################
+##                SCREENSHOTS                 ##
+################################################
+*/
+
+bool init_screenshot_readback(ScreenshotReadback* screenshots, const char* prefix)
+{
+    screenshots->writer = open_screenshot_writer(prefix);
+    if(!screenshots->writer) return false;
+    screenshots->requested = false;
+    screenshots->stage = SCREENSHOT_IDLE;
+    // Storage comes with the first screenshot
+    glGenBuffers(1, &screenshots->pbo);
+    screenshots->capacity = 0;
+    screenshots->width = screenshots->height = 0;
+    screenshots->fence = 0;
+    return true;
+}
+
+void destroy_screenshot_readback(ScreenshotReadback* screenshots)
+{
+    // The writer finishes with the mapping first
+    size_t saved = close_screenshot_writer(screenshots->writer);
+    if(screenshots->stage == SCREENSHOT_MAPPED)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshots->pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if(screenshots->fence) glDeleteSync(screenshots->fence);
+    glDeleteBuffers(1, &screenshots->pbo);
+    if(saved) printf("Screenshots saved: %zu\n", saved);
+}
+
+void request_screenshot(ScreenshotReadback* screenshots)
+{
+    screenshots->requested.store(true, std::memory_order_release);
+    // Even an idle window has to present a frame to read back
+    window_damaged = true;
+}
+
+void update_screenshot_readback(ScreenshotReadback* screenshots)
+{
+    if(screenshots->stage == SCREENSHOT_READING)
+    {
+        GLenum status = glClientWaitSync(screenshots->fence, 0, 0);
+        if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+        {
+            TRACE_SCOPE("map screenshot");
+            glDeleteSync(screenshots->fence);
+            screenshots->fence = 0;
+            size_t row_bytes = (size_t)screenshots->width * 4;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshots->pbo);
+            const uint8_t* mapped = (const uint8_t*)glMapBufferRange(
+                GL_PIXEL_PACK_BUFFER, 0, row_bytes * screenshots->height, GL_MAP_READ_BIT
+            );
+            if(mapped)
+            {
+                // GL's rows run bottom-up; the writer is idle, nothing else hands it work
+                write_screenshot(
+                    screenshots->writer, mapped + row_bytes * (screenshots->height - 1), -(ptrdiff_t)row_bytes,
+                    (size_t)screenshots->width, (size_t)screenshots->height
+                );
+                screenshots->stage = SCREENSHOT_MAPPED;
+            }
+            else
+            {
+                fprintf(stderr, "Could not map the screenshot readback.\n");
+                screenshots->stage = SCREENSHOT_IDLE;
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+    else if(screenshots->stage == SCREENSHOT_MAPPED && screenshot_writer_idle(screenshots->writer))
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshots->pbo);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        screenshots->stage = SCREENSHOT_IDLE;
+    }
+
+    if(screenshots->stage == SCREENSHOT_IDLE && screenshots->requested.exchange(false, std::memory_order_acquire))
+    {
+        TRACE_SCOPE("read back screenshot");
+        int width = framebuffer_width, height = framebuffer_height;
+        size_t size = (size_t)width * height * 4;
+        if(size)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, screenshots->pbo);
+            if(size > screenshots->capacity)
+            {
+                glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+                screenshots->capacity = size;
+            }
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            screenshots->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            screenshots->width = width;
+            screenshots->height = height;
+            screenshots->stage = SCREENSHOT_READING;
+        }
+    }
+
+    if(screenshots->stage != SCREENSHOT_IDLE) window_damaged = true;
+}
+
+/*
+################################################
+##               PRESENT STAGE                ##
+################################################
+*/
+
+size_t count_gl_objects()
+{
+    size_t count = 0;
+    for(GLuint name = 1; name <= GL_OBJECT_PROBE_NAMES; ++name)
+    {
+        count += glIsBuffer(name) + glIsFramebuffer(name) + glIsProgram(name) +
+                 glIsShader(name) + glIsTexture(name) + glIsVertexArray(name);
+    }
+    return count;
+}
+
+const char* scale_mode_name(ScaleMode mode)
+{
+    switch(mode)
+    {
+        case SCALE_STRETCH: return "stretch";
+        case SCALE_ASPECT: return "aspect";
+        case SCALE_INTEGER: return "integer";
+    }
+    return "unknown";
+}
+
+// Integer scaling falls back to aspect-correct when the window is smaller
+// than the buffer
+void update_present_viewport(Presenter* presenter, int framebuffer_width, int framebuffer_height)
+{
+    double sw = (double)presenter->source_width, sh = (double)presenter->source_height;
+    double scale_x = framebuffer_width / sw, scale_y = framebuffer_height / sh;
+    double scale = scale_x < scale_y ? scale_x : scale_y;
+
+    int width = framebuffer_width, height = framebuffer_height;
+    if(presenter->mode == SCALE_INTEGER && scale >= 1.0)
+    {
+        width = (int)(sw * (int)scale);
+        height = (int)(sh * (int)scale);
+    }
+    else if(presenter->mode != SCALE_STRETCH)
+    {
+        width = (int)(sw * scale + 0.5);
+        height = (int)(sh * scale + 0.5);
+    }
+
+    presenter->viewport[0] = (framebuffer_width - width) / 2;
+    presenter->viewport[1] = (framebuffer_height - height) / 2;
+    presenter->viewport[2] = width;
+    presenter->viewport[3] = height;
+}
+
+const char* crt_quality_name(CrtQuality quality)
+{
+    switch(quality)
+    {
+        case CRT_OFF: return "off";
+        case CRT_LOW: return "low";
+        case CRT_MEDIUM: return "medium";
+        case CRT_HIGH: return "high";
+    }
+    return "unknown";
+}
+
+static const char* crt_shader_body =
+    "uniform sampler2D buffer;\n"
+    "uniform sampler2D palette;\n"
+    GLSL_NOPERSPECTIVE "in vec2 TexCoord;\n"
+    "\n"
+    "out vec3 outColor;\n"
+    "\n"
+    "vec3 fetch(vec2 uv){\n"
+    "#if CRT_PALETTE\n"
+    "    float index = texture(buffer, uv).r;\n"
+    "    return texelFetch(palette, ivec2(int(index * 255.0 + 0.5), 0), 0).rgb;\n"
+    "#else\n"
+    "    return texture(buffer, uv).rgb;\n"
+    "#endif\n"
+    "}\n"
+    "\n"
+    "void main(void){\n"
+    "    vec2 size = vec2(textureSize(buffer, 0));\n"
+    "    vec2 uv = TexCoord;\n"
+    "#if CRT_QUALITY >= 2\n"
+    "    // Barrel: points move out with the square of their distance from\n"
+    "    // the center, and what falls off the tube is black\n"
+    "    vec2 centered = uv * 2.0 - 1.0;\n"
+    "    vec2 bend = centered.yx / vec2(6.0, 5.0);\n"
+    "    uv = (centered + centered * bend * bend) * 0.5 + 0.5;\n"
+    "    if(any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)))){\n"
+    "        outColor = vec3(0.0);\n"
+    "        return;\n"
+    "    }\n"
+    "#endif\n"
+    "    vec3 color = fetch(uv);\n"
+    "#if CRT_QUALITY >= 3\n"
+    "    vec2 texel = 1.0 / size;\n"
+    "    vec3 glow = fetch(uv + vec2(texel.x, 0.0)) + fetch(uv - vec2(texel.x, 0.0)) +\n"
+    "                fetch(uv + vec2(0.0, texel.y)) + fetch(uv - vec2(0.0, texel.y));\n"
+    "    color += 0.2 * max(glow * 0.25 - color * 0.5, vec3(0.0));\n"
+    "#endif\n"
+    "    // Full in the middle of a source row, 35% darker at its edges\n"
+    "    float phase = fract(uv.y * size.y) - 0.5;\n"
+    "    color *= 1.0 - 1.4 * phase * phase;\n"
+    "    int column = int(gl_FragCoord.x) % 3;\n"
+    "    color *= column == 0 ? vec3(1.1, 0.9, 0.9) : column == 1 ? vec3(0.9, 1.1, 0.9) : vec3(0.9, 0.9, 1.1);\n"
+    "#if CRT_QUALITY >= 2\n"
+    "    color *= pow(16.0 * uv.x * uv.y * (1.0 - uv.x) * (1.0 - uv.y), 0.2);\n"
+    "#endif\n"
+    "    outColor = color;\n"
+    "}\n";
+
+void build_crt_shader(char* source, size_t size, CrtQuality quality, bool indexed)
+{
+    snprintf(
+        source, size, "\n" GLSL_HEADER "#define CRT_QUALITY %d\n#define CRT_PALETTE %d\n\n%s",
+        (int)quality, indexed ? 1 : 0, crt_shader_body
+    );
+}
+
+// Swaps in the upgrade once its build is done, pointing its samplers at
+// the units the blit program uses. A failed one leaves the blit in place.
+static void poll_present_upgrade(const Presenter& presenter)
+{
+    ProgramBuild* upgrade = presenter.upgrade;
+    if(upgrade->state != BUILD_PENDING || !program_build_done(*upgrade)) return;
+    GLuint program = finish_program_build(upgrade);
+    if(!program)
+    {
+        fprintf(stderr, "The present shader failed, keeping the plain one.\n");
+        return;
+    }
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "buffer"), 0);
+    glUniform1i(glGetUniformLocation(program, "palette"), 2);
+    printf("Present shader: ready after %.1f ms\n", (glfwGetTime() - upgrade->start_time) * 1000.0);
+}
+
+void present_frame(const Presenter& presenter)
+{
+    bool upgraded = presenter.upgrade && presenter.upgrade->state == BUILD_LINKED;
+    glUseProgram(upgraded ? presenter.upgrade->program : presenter.program);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glViewport(presenter.viewport[0], presenter.viewport[1], presenter.viewport[2], presenter.viewport[3]);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    if(presenter.text) draw_text_overlay(presenter.text, presenter.text_vao);
+}
+
+/*
+################################################
+##                 FULLSCREEN                 ##
+################################################
+*/
+
+const char* scanout_bypass_name(ScanoutBypass bypass)
+{
+    static const char* names[NUM_SCANOUT_BYPASS] = {"windowed", "requested", "direct"};
+    return names[bypass];
+}
+
+static int mode_depth(const GLFWvidmode& mode)
+{
+    return mode.redBits + mode.greenBits + mode.blueBits;
+}
+
+// The highest refresh rate at 'width' x 'height', then the deepest color
+static const GLFWvidmode* best_video_mode(const GLFWvidmode* modes, int num_modes, int width, int height)
+{
+    const GLFWvidmode* best = 0;
+    for(int mi = 0; mi < num_modes; ++mi)
+    {
+        const GLFWvidmode& mode = modes[mi];
+        if(mode.width != width || mode.height != height) continue;
+        if(!best || mode.refreshRate > best->refreshRate ||
+           (mode.refreshRate == best->refreshRate && mode_depth(mode) > mode_depth(*best))) best = &mode;
+    }
+    return best;
+}
+
+bool choose_fullscreen_mode(FullscreenMode* fullscreen, int index, int width, int height)
+{
+    int num_monitors = 0;
+    GLFWmonitor** monitors = glfwGetMonitors(&num_monitors);
+    if(index < 0 || index >= num_monitors)
+    {
+        fprintf(stderr, "There is no monitor %d, %d connected.\n", index, num_monitors);
+        return false;
+    }
+    GLFWmonitor* monitor = monitors[index];
+    const GLFWvidmode* current = glfwGetVideoMode(monitor);
+
+    int num_modes = 0;
+    const GLFWvidmode* modes = glfwGetVideoModes(monitor, &num_modes);
+    const GLFWvidmode* best = width && height ? best_video_mode(modes, num_modes, width, height) : 0;
+    if(!best && width && height) fprintf(stderr, "%s has no %dx%d mode, staying at its current size.\n", glfwGetMonitorName(monitor), width, height);
+    if(!best && current) best = best_video_mode(modes, num_modes, current->width, current->height);
+    if(!best) best = current;
+    if(!best)
+    {
+        fprintf(stderr, "%s lists no video modes.\n", glfwGetMonitorName(monitor));
+        return false;
+    }
+
+    fullscreen->monitor = monitor;
+    fullscreen->mode = *best;
+    return true;
+}
+
+GLFWwindow* create_game_window(const FullscreenMode& fullscreen)
+{
+    if(!fullscreen.monitor) return glfwCreateWindow(640, 480, "Space Invaders", NULL, NULL);
+
+    const GLFWvidmode& mode = fullscreen.mode;
+    glfwWindowHint(GLFW_REFRESH_RATE, mode.refreshRate);
+    glfwWindowHint(GLFW_RED_BITS, mode.redBits);
+    glfwWindowHint(GLFW_GREEN_BITS, mode.greenBits);
+    glfwWindowHint(GLFW_BLUE_BITS, mode.blueBits);
+    GLFWwindow* window = glfwCreateWindow(mode.width, mode.height, "Space Invaders", fullscreen.monitor, NULL);
+    glfwWindowHint(GLFW_REFRESH_RATE, GLFW_DONT_CARE);
+    glfwWindowHint(GLFW_RED_BITS, 8);
+    glfwWindowHint(GLFW_GREEN_BITS, 8);
+    glfwWindowHint(GLFW_BLUE_BITS, 8);
+    return window;
+}
+
+ScanoutBypass query_scanout_bypass(GLFWwindow* window)
+{
+    if(!glfwGetWindowMonitor(window)) return BYPASS_WINDOWED;
+
+    bool compositor = true;
+    if(glfwGetPlatform() == GLFW_PLATFORM_X11 && x11_compositor_running(&compositor) && !compositor) return BYPASS_DIRECT;
+    return BYPASS_REQUESTED;
+}
+
+void print_fullscreen(GLFWwindow* window, const FullscreenMode& fullscreen)
+{
+    if(!fullscreen.monitor) return;
+
+    const GLFWvidmode& asked = fullscreen.mode;
+    const GLFWvidmode* mode = glfwGetVideoMode(fullscreen.monitor);
+    bool applied = mode && mode->width == asked.width && mode->height == asked.height && mode->refreshRate == asked.refreshRate;
+    printf(
+        "Fullscreen: %s at %dx%d %d Hz%s, scanout bypass %s\n",
+        glfwGetMonitorName(fullscreen.monitor), mode ? mode->width : 0, mode ? mode->height : 0, mode ? mode->refreshRate : 0,
+        applied ? "" : " (the mode asked for did not take)", scanout_bypass_name(query_scanout_bypass(window))
+    );
+}
+
+/*
+################################################
+##                 SPECTATORS                 ##
+################################################
+*/
+
+void spectator_size_callback(GLFWwindow* window, int width, int height)
+{
+    SpectatorWindow* spectator = (SpectatorWindow*)glfwGetWindowUserPointer(window);
+    spectator->width = width;
+    spectator->height = height;
+    spectator->resized = true;
+}
+
+// Closing a spectator only hides it, the game carries on
+void spectator_close_callback(GLFWwindow* window)
+{
+    SpectatorWindow* spectator = (SpectatorWindow*)glfwGetWindowUserPointer(window);
+    spectator->closed = true;
+    glfwHideWindow(window);
+}
+
+// Called on the main thread with the main context current, after the
+// textures 'presenter' draws from exist. 'monitor' may be null.
+bool open_spectator(
+    SpectatorWindow* spectator, GLFWwindow* main_window, GLFWmonitor* monitor, const Presenter& presenter,
+    GLuint program, GLuint buffer_texture, GLuint palette_texture)
+{
+    int width = 640, height = 480;
+    if(monitor)
+    {
+        const GLFWvidmode* mode = glfwGetVideoMode(monitor);
+        width = mode->width;
+        height = mode->height;
+    }
+    // A fullscreen audience screen must stay up while the operator plays
+    glfwWindowHint(GLFW_AUTO_ICONIFY, GLFW_FALSE);
+    glfwWindowHint(GLFW_FOCUS_ON_SHOW, GLFW_FALSE);
+    spectator->window = glfwCreateWindow(width, height, "Space Invaders spectator", monitor, main_window);
+    glfwWindowHint(GLFW_AUTO_ICONIFY, GLFW_TRUE);
+    glfwWindowHint(GLFW_FOCUS_ON_SHOW, GLFW_TRUE);
+    if(!spectator->window) return false;
+
+    spectator->closed = false;
+    spectator->resized = false;
+    glfwSetWindowUserPointer(spectator->window, spectator);
+    glfwSetFramebufferSizeCallback(spectator->window, spectator_size_callback);
+    glfwSetWindowCloseCallback(spectator->window, spectator_close_callback);
+
+    // Bindings are per context, uniforms belong to the shared program
+    glfwMakeContextCurrent(spectator->window);
+    glfwSwapInterval(0);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(program);
+    if(palette_texture)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, palette_texture);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, buffer_texture);
+    glGenVertexArrays(1, &spectator->vao);
+    glBindVertexArray(spectator->vao);
+
+    spectator->view = presenter;
+    spectator->view.text_vao = presenter.text ? create_text_overlay_vao(*presenter.text) : 0;
+    spectator->view.spectators = 0;
+    spectator->view.num_spectators = 0;
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(spectator->window, &framebuffer_width, &framebuffer_height);
+    update_present_viewport(&spectator->view, framebuffer_width, framebuffer_height);
+
+    glfwMakeContextCurrent(main_window);
+    return true;
+}
+
+void close_spectator(SpectatorWindow* spectator)
+{
+    glfwDestroyWindow(spectator->window);
+    spectator->window = 0;
+}
+
+// Mirrors what the main context just drew. Its fence orders the
+// spectators' reads after the frame's upload or GPU render, whichever
+// context did it.
+void present_spectators(const Presenter& presenter, GLFWwindow* main_window)
+{
+    GLsync frame = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    for(size_t si = 0; si < presenter.num_spectators; ++si)
+    {
+        SpectatorWindow* spectator = &presenter.spectators[si];
+        if(spectator->closed) continue;
+
+        glfwMakeContextCurrent(spectator->window);
+        if(spectator->resized.exchange(false))
+        {
+            update_present_viewport(&spectator->view, spectator->width, spectator->height);
+        }
+        glWaitSync(frame, 0, GL_TIMEOUT_IGNORED);
+        present_frame(spectator->view);
+        glfwSwapBuffers(spectator->window);
+    }
+
+    glfwMakeContextCurrent(main_window);
+    glDeleteSync(frame);
+}
+
+// Draw the submitted frame into the window and swap, through GL or the
+// backend's own presenter
+template<PresentBackend Backend>
+static void swap_backend_frame(const Presenter& presenter, GLFWwindow* window, PixelUploader* uploader)
+{
+    ALLOC_SCOPE(ALLOC_PRESENT);
+    if constexpr(Backend == PRESENT_VULKAN)
+    {
+        present_vulkan_frame(
+            uploader->vulkan, uploader->vulkan_rects, uploader->num_vulkan_rects,
+            presenter.viewport, framebuffer_width, framebuffer_height
+        );
+        uploader->num_vulkan_rects = 0;
+    }
+    else if constexpr(Backend == PRESENT_WAYLAND)
+    {
+        present_wayland_frame(uploader->wayland, uploader->wayland_rects, uploader->num_wayland_rects);
+        uploader->num_wayland_rects = 0;
+    }
+    else if constexpr(Backend == PRESENT_X11) present_x11_frame(uploader->x11);
+    else if constexpr(Backend == PRESENT_KMS) present_kms_frame(uploader->kms);
+    else if constexpr(Backend == PRESENT_TERMINAL) present_terminal_frame(uploader->terminal);
+    else
+    {
+        if(presenter.upgrade) poll_present_upgrade(presenter);
+        begin_gpu_phase(uploader->gpu_timers, GPU_PRESENT);
+        present_frame(presenter);
+        if(presenter.screenshots) update_screenshot_readback(presenter.screenshots);
+        if(presenter.debug) draw_debug_overlay(presenter.debug);
+        end_gpu_phase(uploader->gpu_timers, GPU_PRESENT);
+        // Spectators sample the texture after the swap
+        if(uploader->thread && !presenter.num_spectators) release_upload_texture(uploader->thread);
+        glfwSwapBuffers(window);
+        if(presenter.in_flight) fence_presented_frame(presenter.in_flight);
+        if(presenter.num_spectators) present_spectators(presenter, window);
+        if(uploader->thread && presenter.num_spectators) release_upload_texture(uploader->thread);
+    }
+    finish_startup_profile(&startup_profile);
+}
+
+void swap_frame(const Presenter& presenter, GLFWwindow* window, PixelUploader* uploader)
+{
+    uploader->pipeline->swap(presenter, window, uploader);
+}
+
+// Block until the last swap has gone through
+template<PresentBackend Backend>
+static void finish_backend_frames(PixelUploader* uploader)
+{
+    if constexpr(Backend == PRESENT_VULKAN) finish_vulkan_frames(uploader->vulkan);
+    else if constexpr(Backend == PRESENT_WAYLAND) finish_wayland_frames(uploader->wayland);
+    else if constexpr(Backend == PRESENT_X11) finish_x11_frames(uploader->x11);
+    else if constexpr(Backend == PRESENT_KMS) finish_kms_frames(uploader->kms);
+    else if constexpr(Backend == PRESENT_TERMINAL) finish_terminal_frames(uploader->terminal);
+    else glFinish();
+}
+
+void finish_frame(PixelUploader* uploader)
+{
+    uploader->pipeline->finish(uploader);
+}
+
+/*
+################################################
+##              FRAMES IN FLIGHT              ##
+################################################
+*/
+
+void init_frame_fences(FrameFences* fences, size_t max_frames)
+{
+    *fences = FrameFences{};
+    fences->max_frames = max_frames < FRAMES_IN_FLIGHT_MAX ? max_frames : FRAMES_IN_FLIGHT_MAX;
+}
+
+void destroy_frame_fences(FrameFences* fences)
+{
+    for(size_t fi = 0; fi < FRAMES_IN_FLIGHT_MAX; ++fi)
+    {
+        if(fences->fences[fi]) glDeleteSync(fences->fences[fi]);
+        fences->fences[fi] = 0;
+    }
+}
+
+// The slot 'next' is the oldest swap, the one the next wait is for
+void fence_presented_frame(FrameFences* fences)
+{
+    if(!fences->max_frames) return;
+    GLsync* slot = &fences->fences[fences->next];
+    if(*slot) glDeleteSync(*slot);
+    *slot = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    fences->next = (fences->next + 1) % fences->max_frames;
+}
+
+void wait_frames_in_flight(FrameFences* fences)
+{
+    if(!fences->max_frames) return;
+    GLsync* slot = &fences->fences[fences->next];
+    if(!*slot) return;
+    // The flush makes sure the fence gets to the GPU at all
+    if(glClientWaitSync(*slot, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+    {
+        double start = glfwGetTime();
+        glClientWaitSync(*slot, 0, 1000000000);
+        fences->waited += glfwGetTime() - start;
+        ++fences->waits;
+    }
+    glDeleteSync(*slot);
+    *slot = 0;
+}
+
+void print_frame_fences(const FrameFences& fences)
+{
+    if(!fences.max_frames) return;
+    printf(
+        "Frames in flight: at most %zu, %zu waits blocked, %.3f ms on average\n", fences.max_frames, fences.waits,
+        fences.waits ? fences.waited * 1000.0 / fences.waits : 0.0
+    );
+}
+
+/*
+################################################
+##                FRAME PACING                ##
+################################################
+*/
+
+// How hard a swap's error pulls the clock's phase and its period; the
+// period moves far slower, so jitter averages out of it
+#define FRAME_CLOCK_PHASE_GAIN 0.1
+#define FRAME_CLOCK_PERIOD_GAIN 0.01
+// Swaps further off the predicted vblank than this share of a period,
+// or more than this many periods after the last, resync the phase
+#define FRAME_CLOCK_OUTLIER 0.25
+#define FRAME_CLOCK_MAX_MISSED 4.0
+// Sleeps never start more than this much early
+#define FRAME_CLOCK_MAX_OVERSLEEP 0.002
+
+static void init_frame_clock(FrameClock* clock, double refresh_interval)
+{
+    clock->period = refresh_interval;
+    clock->vblank = 0.0;
+    clock->swaps = 0;
+    clock->resyncs = 0;
+    clock->oversleep = 0.0;
+    clock->last_prediction = 0.0;
+}
+
+// Call with the time a swap that blocked on vsync returned
+static void observe_swap(FrameClock* clock, double now, double refresh_interval)
+{
+    if(!clock->swaps++)
+    {
+        clock->vblank = now;
+        return;
+    }
+    double elapsed = now - clock->vblank;
+    double periods = floor(elapsed / clock->period + 0.5);
+    double error = elapsed - periods * clock->period;
+    if(periods < 1.0 || periods > FRAME_CLOCK_MAX_MISSED || fabs(error) > clock->period * FRAME_CLOCK_OUTLIER)
+    {
+        clock->vblank = now;
+        ++clock->resyncs;
+        return;
+    }
+    clock->vblank += periods * clock->period + FRAME_CLOCK_PHASE_GAIN * error;
+    clock->period += FRAME_CLOCK_PERIOD_GAIN * error / periods;
+
+    // A period drifting off the monitor's rate means a missed swap was
+    // read as a vblank, start over from the rate
+    if(clock->period < refresh_interval * 0.5 || clock->period > refresh_interval * 2.0)
+    {
+        clock->period = refresh_interval;
+        clock->vblank = now;
+        ++clock->resyncs;
+    }
+}
+
+// The first predicted vblank after 'now'
+static double next_vblank(const FrameClock& clock, double now)
+{
+    if(!clock.swaps) return now + clock.period;
+    double periods = ceil((now - clock.vblank) / clock.period);
+    return clock.vblank + (periods > 1.0 ? periods : 1.0) * clock.period;
+}
+
+// Sleeps until 'deadline', starting early by how late the last sleeps woke.
+// With a reactor it waits there, serving its sources until then.
+static void sleep_until_time(FrameClock* clock, Reactor* reactor, double deadline)
+{
+    double wake = deadline - clock->oversleep;
+    double remaining = wake - glfwGetTime();
+    if(remaining <= 0.0) return;
+    if(reactor)
+    {
+        run_reactor_until(reactor, reactor_now() + remaining);
+    }
+    else
+    {
+#ifdef __EMSCRIPTEN__
+        // Sleeping on the page's main thread would spin and stall the page
+        emscripten_sleep((unsigned)(remaining * 1000.0));
+#else
+        std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+#endif
+    }
+
+    double late = glfwGetTime() - wake;
+    clock->oversleep += 0.1 * (late - clock->oversleep);
+    if(clock->oversleep < 0.0) clock->oversleep = 0.0;
+    if(clock->oversleep > FRAME_CLOCK_MAX_OVERSLEEP) clock->oversleep = FRAME_CLOCK_MAX_OVERSLEEP;
+}
+
+const char* pacing_mode_name(PacingMode mode)
+{
+    switch(mode)
+    {
+        case PACING_VSYNC:    return "vsync";
+        case PACING_ADAPTIVE: return "adaptive";
+        case PACING_UNCAPPED: return "uncapped";
+        case PACING_FIXED:    return "fixed";
+        case PACING_VRR:      return "vrr";
+        default: break;
+    }
+    return "unknown";
+}
+
+void set_pacing_mode(FramePacer* pacer, PacingMode mode)
+{
+    if(mode == PACING_ADAPTIVE && !pacer->adaptive_supported)
+    {
+        fprintf(stderr, "Adaptive vsync is not supported, using vsync.\n");
+        mode = PACING_VSYNC;
+    }
+
+    pacer->mode = mode;
+    if(pacer->vulkan)
+    {
+        // Mailbox never blocks or tears, fixed pacing then sleeps as usual
+        switch(mode)
+        {
+            case PACING_VSYNC:    set_vulkan_present_mode(pacer->vulkan, VULKAN_PRESENT_FIFO); break;
+            case PACING_ADAPTIVE:
+            case PACING_VRR:      set_vulkan_present_mode(pacer->vulkan, VULKAN_PRESENT_FIFO_RELAXED); break;
+            default:              set_vulkan_present_mode(pacer->vulkan, VULKAN_PRESENT_MAILBOX); break;
+        }
+    }
+    // Frame callbacks have no adaptive variant
+    else if(pacer->wayland) set_wayland_vsync(pacer->wayland, mode == PACING_VSYNC);
+    // Nor do Present notifies
+    else if(pacer->x11) set_x11_vsync(pacer->x11, mode == PACING_VSYNC);
+    // Async flips tear like adaptive vsync would, but always
+    else if(pacer->kms) set_kms_vsync(pacer->kms, mode == PACING_VSYNC);
+    // The terminal has no vblank, only the deadline paces it
+    else if(pacer->terminal) {}
+    else switch(mode)
+    {
+        case PACING_VSYNC:    glfwSwapInterval(1); break;
+        case PACING_ADAPTIVE: glfwSwapInterval(-1); break;
+        case PACING_VRR:      glfwSwapInterval(pacer->adaptive_supported ? -1 : 1); break;
+        default:              glfwSwapInterval(0); break;
+    }
+
+    pacer->deadline = glfwGetTime() + (mode == PACING_VRR ? pacer->vrr_interval : pacer->interval);
+    pacer->last_swap = 0.0;
+    for(size_t li = 0; li < NUM_VRR_LANDINGS; ++li) pacer->vrr_landings[li] = 0;
+    pacer->frames = 0;
+    pacer->stats_start = glfwGetTime();
+    printf("Pacing: %s\n", pacing_mode_name(mode));
+}
+
+// 'vulkan' paces through its present mode, 'wayland' through frame
+// callbacks, 'x11' through Present notifies, 'kms' through page flips,
+// 'terminal' through nothing but fixed pacing, otherwise the GL swap
+// interval
+void init_frame_pacer(FramePacer* pacer, GLFWwindow* window, PacingMode mode, double fps, VulkanPresenter* vulkan, WaylandPresenter* wayland, X11Presenter* x11, KmsPresenter* kms, TerminalPresenter* terminal)
+{
+    pacer->window = window;
+    pacer->vulkan = vulkan;
+    pacer->wayland = wayland;
+    pacer->x11 = x11;
+    pacer->kms = kms;
+    pacer->terminal = terminal;
+    // Vulkan falls back to FIFO itself when FIFO_RELAXED is missing
+    pacer->adaptive_supported = vulkan || (!wayland && !x11 && !kms && !terminal &&
+        (glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+         glfwExtensionSupported("GLX_EXT_swap_control_tear")));
+    pacer->interval = 1.0 / (fps > 0.0 ? fps : 60.0);
+    pacer->fps = 0.0;
+
+    // A fullscreen window runs at its own monitor's rate
+    GLFWmonitor* monitor = glfwGetWindowMonitor(window);
+    if(!monitor) monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode* video_mode = monitor ? glfwGetVideoMode(monitor) : 0;
+    pacer->refresh_interval = 1.0 / (video_mode && video_mode->refreshRate > 0 ? video_mode->refreshRate : 60);
+    pacer->last_frame = glfwGetTime();
+    pacer->cap_interval = 0.0;
+    // Never above the cap, however high --fps asks
+    pacer->vrr_interval = pacer->refresh_interval / FRAME_VRR_CAP;
+    if(fps > 0.0 && 1.0 / fps > pacer->vrr_interval) pacer->vrr_interval = 1.0 / fps;
+    init_frame_clock(&pacer->clock, pacer->refresh_interval);
+    set_pacing_mode(pacer, mode);
+}
+
+void cycle_pacing_mode(FramePacer* pacer)
+{
+    PacingMode next = (PacingMode)((pacer->mode + 1) % NUM_PACING_MODES);
+    if(next == PACING_ADAPTIVE && !pacer->adaptive_supported) next = PACING_UNCAPPED;
+    set_pacing_mode(pacer, next);
+}
+
+static void pace(FramePacer* pacer)
+{
+    if(pacer->mode == PACING_FIXED || pacer->mode == PACING_VRR)
+    {
+        double interval = pacer->mode == PACING_VRR ? pacer->vrr_interval : pacer->interval;
+        sleep_until_time(&pacer->clock, pacer->reactor, pacer->deadline);
+
+        // A frame that ran long restarts the schedule instead of bursting
+        pacer->deadline += interval;
+        if(pacer->deadline < glfwGetTime()) pacer->deadline = glfwGetTime() + interval;
+    }
+    if(pacer->cap_interval > 0.0) sleep_until_time(&pacer->clock, pacer->reactor, pacer->last_frame + pacer->cap_interval);
+
+    ++pacer->frames;
+    double elapsed = glfwGetTime() - pacer->stats_start;
+    if(elapsed >= 1.0)
+    {
+        pacer->fps = pacer->frames / elapsed;
+        pacer->frames = 0;
+        pacer->stats_start += elapsed;
+
+        if(!pacer->title_pending.load(std::memory_order_acquire))
+        {
+            snprintf(pacer->title, sizeof(pacer->title), "Space Invaders - %s %.1f fps", pacing_mode_name(pacer->mode), pacer->fps);
+            if(pacer->defer_title) pacer->title_pending.store(true, std::memory_order_release);
+            else glfwSetWindowTitle(pacer->window, pacer->title);
+        }
+    }
+    pacer->last_frame = glfwGetTime();
+}
+
+// Sorts the interval since the last swap by where it landed. Intervals
+// count as at the cap or on the grid within half the gap between the cap
+// and the refresh multiple nearest it.
+static void observe_vrr_swap(FramePacer* pacer, double now)
+{
+    double interval = now - pacer->last_swap;
+    bool first = pacer->last_swap == 0.0;
+    pacer->last_swap = now;
+    // Skipped frames and stalls say nothing about the display
+    if(first || interval > pacer->vrr_interval * FRAME_CLOCK_MAX_MISSED) return;
+
+    double refresh = pacer->refresh_interval;
+    double tolerance = fabs(pacer->vrr_interval - floor(pacer->vrr_interval / refresh + 0.5) * refresh) * 0.5;
+    double refreshes = floor(interval / refresh + 0.5);
+    VrrLanding landing = VRR_OFF_GRID;
+    if(fabs(interval - pacer->vrr_interval) < tolerance) landing = VRR_AT_CAP;
+    else if(refreshes >= 1.0 && fabs(interval - refreshes * refresh) < tolerance) landing = VRR_ON_REFRESH;
+    ++pacer->vrr_landings[landing];
+}
+
+// Call right after swapping buffers
+void pace_frame(FramePacer* pacer)
+{
+#ifdef __EMSCRIPTEN__
+    // The browser presents once it has control back, at its own vsync
+    wait_animation_frame();
+#endif
+    // Only swaps that wait for vsync say where the vblanks are
+    if(pacer->mode == PACING_VSYNC || pacer->mode == PACING_ADAPTIVE)
+    {
+        observe_swap(&pacer->clock, glfwGetTime(), pacer->refresh_interval);
+    }
+    else if(pacer->mode == PACING_VRR) observe_vrr_swap(pacer, glfwGetTime());
+    pace(pacer);
+}
+
+// Call instead of swapping when a frame is left unpresented, so vsync
+// still holds the loop to the refresh rate
+void pace_skipped_frame(FramePacer* pacer)
+{
+#ifdef __EMSCRIPTEN__
+    // Nothing was drawn, but the page still needs its thread back
+    wait_animation_frame();
+#else
+    if(pacer->mode == PACING_VSYNC || pacer->mode == PACING_ADAPTIVE)
+    {
+        // Past half a period after the last frame, so a sleep that woke
+        // just short of a vblank does not wait for that one again
+        double after = pacer->last_frame + pacer->clock.period * 0.5;
+        double now = glfwGetTime();
+        sleep_until_time(&pacer->clock, pacer->reactor, next_vblank(pacer->clock, now > after ? now : after));
+    }
+#endif
+    pace(pacer);
+}
+
+void wait_input_sampling(FramePacer* pacer)
+{
+    if(!pacer->late_input || !pacer->clock.swaps) return;
+    if(pacer->mode != PACING_VSYNC && pacer->mode != PACING_ADAPTIVE) return;
+    double now = glfwGetTime();
+    double sample = next_vblank(pacer->clock, now) - pacer->input_lead - LATE_INPUT_MARGIN;
+    if(sample > now) sleep_until_time(&pacer->clock, pacer->reactor, sample);
+}
+
+void record_input_lead(FramePacer* pacer, double work)
+{
+    if(work > pacer->input_lead) pacer->input_lead = work;
+    else pacer->input_lead += LATE_INPUT_DECAY * (work - pacer->input_lead);
+}
+
+double predict_present(FramePacer* pacer)
+{
+    double now = glfwGetTime();
+    double present = now;
+    // Vsync holds the swap to the next vblank; fixed frames go out right
+    // after the deadline the loop last woke at, which unlike the wake
+    // itself is evenly spaced
+    if(pacer->mode == PACING_VSYNC || pacer->mode == PACING_ADAPTIVE) present = next_vblank(pacer->clock, now);
+    else if(pacer->mode == PACING_FIXED) present = pacer->deadline - pacer->interval;
+    // The limiter holds the swap, not the display
+    else if(pacer->mode == PACING_VRR) present = pacer->deadline - pacer->vrr_interval;
+
+    if(present < pacer->clock.last_prediction) present = pacer->clock.last_prediction;
+    pacer->clock.last_prediction = present;
+    return present;
+}
+
+void print_vrr_pacing(const FramePacer& pacer)
+{
+    size_t total = 0;
+    for(size_t li = 0; li < NUM_VRR_LANDINGS; ++li) total += pacer.vrr_landings[li];
+    if(!total) return;
+    printf(
+        "VRR pacing: %.1f Hz cap on a %.1f Hz display, %zu presents, %.1f%% at the cap, %.1f%% on the refresh grid, %.1f%% off it\n",
+        1.0 / pacer.vrr_interval, 1.0 / pacer.refresh_interval, total,
+        pacer.vrr_landings[VRR_AT_CAP] * 100.0 / total,
+        pacer.vrr_landings[VRR_ON_REFRESH] * 100.0 / total,
+        pacer.vrr_landings[VRR_OFF_GRID] * 100.0 / total
+    );
+}
+
+/*
+################################################
+##               POWER GOVERNOR               ##
+################################################
+*/
+
+// Presentation rate caps in Hz, 0 for none
+const double power_rate_caps[NUM_POWER_PROFILES][NUM_SCENE_ACTIVITIES] = {
+    {0.0, 0.0},     // performance
+    {0.0, 30.0},    // balanced
+    {30.0, 15.0},   // battery
+};
+
+const char* power_profile_name(PowerProfile profile)
+{
+    switch(profile)
+    {
+        case POWER_PERFORMANCE: return "performance";
+        case POWER_BALANCED:    return "balanced";
+        case POWER_BATTERY:     return "battery";
+        default: break;
+    }
+    return "unknown";
+}
+
+// Story pages only type a character every few ticks
+SceneActivity classify_scene(const GameState& state)
+{
+    bool story = !state.still_alive && !state.msg_animation.animation_complete;
+    return story ? SCENE_TEXT : SCENE_PLAY;
+}
+
+void govern_frame_rate(FramePacer* pacer, PowerProfile profile, SceneActivity scene)
+{
+    double cap = power_rate_caps[profile][scene];
+    pacer->cap_interval = cap > 0.0 ? 1.0 / cap : 0.0;
+}
+
+// Sets a title pace_frame() handed over from the render thread
+void flush_pacer_title(FramePacer* pacer)
+{
+    if(!pacer->title_pending.load(std::memory_order_acquire)) return;
+    glfwSetWindowTitle(pacer->window, pacer->title);
+    pacer->title_pending.store(false, std::memory_order_release);
+}
+
+/*
+################################################
+##             QUALITY GOVERNOR               ##
+################################################
+*/
+
+struct QualitySettings
+{
+    size_t particles_per_pixel;
+    float particle_life;
+};
+
+const QualitySettings quality_settings[NUM_QUALITY_LEVELS] = {
+    {2, 1.0f},  // full
+    {1, 1.0f},  // reduced
+    {1, 0.5f},  // low
+    {0, 0.0f},  // minimal
+};
+
+const char* quality_level_name(QualityLevel level)
+{
+    switch(level)
+    {
+        case QUALITY_FULL:    return "full";
+        case QUALITY_REDUCED: return "reduced";
+        case QUALITY_LOW:     return "low";
+        case QUALITY_MINIMAL: return "minimal";
+        default: break;
+    }
+    return "unknown";
+}
+
+// Debris already in flight keeps the life it was thrown with
+static void apply_quality(ParticleSystem* particles, QualityLevel level)
+{
+    particles->per_pixel = quality_settings[level].particles_per_pixel;
+    particles->life_scale = quality_settings[level].particle_life;
+}
+
+void init_quality_governor(QualityGovernor* governor, QualityLevel level, bool automatic, ParticleSystem* particles)
+{
+    *governor = QualityGovernor{};
+    governor->automatic = automatic;
+    governor->level = level;
+    apply_quality(particles, level);
+}
+
+void govern_quality(QualityGovernor* governor, ParticleSystem* particles, double work, double budget)
+{
+    ++governor->frames_at[governor->level];
+    if(!governor->automatic || budget <= 0.0) return;
+
+    governor->window_work += work;
+    if(++governor->window_frames < QUALITY_WINDOW) return;
+    double load = governor->window_work / governor->window_frames / budget;
+    governor->window_work = 0.0;
+    governor->window_frames = 0;
+
+    QualityLevel level = governor->level;
+    if(load > QUALITY_HIGH_WATER)
+    {
+        governor->quiet_windows = 0;
+        if(level + 1 < NUM_QUALITY_LEVELS)
+        {
+            level = (QualityLevel)(level + 1);
+            ++governor->steps_down;
+        }
+    }
+    else if(load < QUALITY_LOW_WATER)
+    {
+        if(++governor->quiet_windows >= QUALITY_HOLD_WINDOWS && level > QUALITY_FULL)
+        {
+            level = (QualityLevel)(level - 1);
+            ++governor->steps_up;
+            governor->quiet_windows = 0;
+        }
+    }
+    else governor->quiet_windows = 0;
+
+    if(level == governor->level) return;
+    governor->level = level;
+    apply_quality(particles, level);
+}
+
+void print_quality_governor(const QualityGovernor& governor)
+{
+    uint64_t frames = 0;
+    for(size_t li = 0; li < NUM_QUALITY_LEVELS; ++li) frames += governor.frames_at[li];
+    if(!governor.automatic || !frames) return;
+
+    printf("Quality: ended %s, %zu steps down and %zu up; frames at", quality_level_name(governor.level), governor.steps_down, governor.steps_up);
+    for(size_t li = 0; li < NUM_QUALITY_LEVELS; ++li)
+    {
+        printf("%s %s %.1f%%", li ? "," : "", quality_level_name((QualityLevel)li), 100.0 * governor.frames_at[li] / frames);
+    }
+    printf("\n");
+}
+
+/*
+################################################
+##              FRAME STREAMING               ##
+################################################
+*/
+
+// rawvideo pix_fmt names for the bytes of each layout in memory, RGB565
+// as the little-endian hosts the game streams from store it
+const char* stream_pixel_format(PixelFormat format)
+{
+    switch(format)
+    {
+        case PIXEL_RGBA8888: return "abgr";
+        case PIXEL_BGRA8888_REV: return "bgra";
+        case PIXEL_RGBA8888_REV: return "rgba";
+        case PIXEL_RGB565: return "rgb565le";
+        default: break;
+    }
+    return "unknown";
+}
+
+// Buffers that draw through a mapping or in palette indices can't stream
+void init_streamed_buffer(StreamedBuffer* streamed, Buffer* buffer, FrameStream* stream)
+{
+    streamed->stream = stream;
+    streamed->pixels[0] = buffer_pixels(*buffer);
+    streamed->pixels[1] = (uint8_t*)alloc_pages(buffer->width * buffer->height * buffer_pixel_size(*buffer));
+    memcpy(streamed->pixels[1], streamed->pixels[0], buffer->width * buffer->height * buffer_pixel_size(*buffer));
+    streamed->current = 0;
+    streamed->num_stale = 0;
+}
+
+// Hands the buffer back its own array
+StreamStats destroy_streamed_buffer(StreamedBuffer* streamed, Buffer* buffer)
+{
+    StreamStats stats = close_frame_stream(streamed->stream);
+    if(streamed->current)
+    {
+        memcpy(streamed->pixels[0], streamed->pixels[1], buffer->width * buffer->height * buffer_pixel_size(*buffer));
+    }
+    set_buffer_pixels(buffer, streamed->pixels[0]);
+    free_pages(streamed->pixels[1]);
+    return stats;
+}
+
+void add_stale_rect(StreamedBuffer* streamed, const Rect& rect)
+{
+    if(streamed->num_stale == BUFFER_MAX_DIRTY)
+    {
+        Rect bounds = rect;
+        for(size_t i = 0; i < streamed->num_stale; ++i) bounds = rect_union(bounds, streamed->stale[i]);
+        streamed->stale[0] = bounds;
+        streamed->num_stale = 1;
+        return;
+    }
+    streamed->stale[streamed->num_stale++] = rect;
+}
+
+// Called once the frame's rectangles have been retired, so prev_dirty
+// holds everything it drew
+void stream_buffer(StreamedBuffer* streamed, Buffer* buffer)
+{
+    for(size_t i = 0; i < buffer->num_prev_dirty; ++i) add_stale_rect(streamed, buffer->prev_dirty[i]);
+
+    size_t pixel_size = buffer_pixel_size(*buffer);
+    size_t stride = buffer->width * pixel_size;
+    uint8_t* frame = buffer_pixels(*buffer);
+    // Rows are stored bottom-up and sent top-down
+    if(!stream_frame(streamed->stream, frame + (buffer->height - 1) * stride, -(ptrdiff_t)stride)) return;
+
+    // The writer was idle, so it is done with the other array
+    uint8_t* next = streamed->pixels[1 - streamed->current];
+    for(size_t ri = 0; ri < streamed->num_stale; ++ri)
+    {
+        const Rect& r = streamed->stale[ri];
+        for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+        {
+            memcpy(next + yi * stride + r.x * pixel_size, frame + yi * stride + r.x * pixel_size, r.width * pixel_size);
+        }
+    }
+    streamed->num_stale = 0;
+    streamed->current = 1 - streamed->current;
+    set_buffer_pixels(buffer, next);
+}
+
+// Get this frame's pixels into buffer_texture with whichever backend is active
+// The rasterizer drew straight into the staging buffer, so only the
+// rectangles to copy out of it are noted for swap_frame()
+void stage_vulkan_rects(PixelUploader* uploader, Buffer* buffer)
+{
+    Rect rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_rects = gather_upload_rects(*buffer, rects);
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        const Rect& r = rects[i];
+        uploader->vulkan_rects[i] = VulkanRect{(uint32_t)r.x, (uint32_t)r.y, (uint32_t)r.width, (uint32_t)r.height};
+    }
+    uploader->num_vulkan_rects = num_rects;
+    retire_dirty_rects(buffer);
+}
+
+// Copies the changed rectangles into a presenter that takes them as they are
+template<typename Target, void (*copy_rects)(Target*, const Buffer&, const Rect*, size_t)>
+static void copy_presenter_rects(Target* target, Buffer* buffer)
+{
+    Rect rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_rects = gather_upload_rects(*buffer, rects);
+    copy_rects(target, *buffer, rects, num_rects);
+    retire_dirty_rects(buffer);
+}
+
+// Returns false when the CPU buffer holds the same pixels as last frame,
+// in which case nothing was uploaded and the frame need not be presented.
+// Only GL draws with the GPU renderer, uploads on a thread, has timer
+// queries, an overlay or a palette.
+template<PresentBackend Backend>
+static bool submit_backend_frame(PixelUploader* uploader, Buffer* buffer)
+{
+    ALLOC_SCOPE(ALLOC_PRESENT);
+    bool changed = true;
+    if constexpr(Backend == PRESENT_GL)
+    {
+        begin_gpu_frame(uploader->gpu_timers);
+        if(buffer->gpu)
+        {
+            begin_gpu_phase(uploader->gpu_timers, GPU_SPRITES);
+            flush_gpu_renderer(buffer->gpu);
+            end_gpu_phase(uploader->gpu_timers, GPU_SPRITES);
+        }
+        else if(!frame_changed(uploader, *buffer))
+        {
+            retire_dirty_rects(buffer);
+            // A frame still in flight has yet to reach the screen
+            changed = uploader->thread && uploader->thread->num_frames > 1 && collect_upload(uploader->thread);
+        }
+        // Queries belong to one context, so the upload thread's go untimed
+        else if(uploader->thread && uploader->thread->num_frames > 1) hand_over_frame(uploader->thread, buffer);
+        else if(uploader->thread) upload_buffer_on_thread(uploader->thread);
+        else
+        {
+            begin_gpu_phase(uploader->gpu_timers, GPU_UPLOAD);
+            upload_buffer(uploader, buffer);
+            end_gpu_phase(uploader->gpu_timers, GPU_UPLOAD);
+        }
+
+        // Overlay text changes without touching a pixel
+        TextOverlay* overlay = buffer->text_overlay;
+        if(overlay && overlay->submitted_version != overlay->version)
+        {
+            changed = true;
+            overlay->submitted_version = overlay->version;
+        }
+    }
+    else if(!frame_changed(uploader, *buffer))
+    {
+        retire_dirty_rects(buffer);
+        changed = false;
+    }
+    else if constexpr(Backend == PRESENT_VULKAN) stage_vulkan_rects(uploader, buffer);
+    else if constexpr(Backend == PRESENT_WAYLAND)
+    {
+        uploader->num_wayland_rects = gather_upload_rects(*buffer, uploader->wayland_rects);
+        retire_dirty_rects(buffer);
+    }
+    else if constexpr(Backend == PRESENT_X11) copy_presenter_rects<X11Presenter, copy_x11_rects>(uploader->x11, buffer);
+    else if constexpr(Backend == PRESENT_KMS) copy_presenter_rects<KmsPresenter, copy_kms_rects>(uploader->kms, buffer);
+    else if constexpr(Backend == PRESENT_TERMINAL) copy_presenter_rects<TerminalPresenter, copy_terminal_rects>(uploader->terminal, buffer);
+
+    if(uploader->stream) stream_buffer(uploader->stream, buffer);
+
+    if constexpr(Backend == PRESENT_GL)
+    {
+        if(buffer->format == PIXEL_INDEXED8 && buffer->palette->dirty)
+        {
+            changed = true;
+            Palette* palette = buffer->palette;
+            glActiveTexture(GL_TEXTURE2);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, (GLsizei)palette->num_colors, 1, pixel_gl_format(PIXEL_RGBA8888), pixel_gl_type(PIXEL_RGBA8888), palette->colors);
+            glActiveTexture(GL_TEXTURE0);
+            palette->dirty = false;
+        }
+    }
+    return changed;
+}
+
+bool submit_frame(PixelUploader* uploader, Buffer* buffer)
+{
+    return uploader->pipeline->submit(uploader, buffer);
+}
+
+/*
+################################################
+##               FRAME PIPELINES              ##
+################################################
+*/
+
+const char* present_backend_names[NUM_PRESENT_BACKENDS] =
+{
+    "gl", "vulkan", "wayland", "x11", "kms", "terminal"
+};
+
+template<PresentBackend Backend>
+static constexpr FramePipeline make_frame_pipeline()
+{
+    return FramePipeline{
+        Backend, wait_backend_upload<Backend>, submit_backend_frame<Backend>, swap_backend_frame<Backend>, finish_backend_frames<Backend>
+    };
+}
+
+const FramePipeline frame_pipelines[NUM_PRESENT_BACKENDS] =
+{
+    make_frame_pipeline<PRESENT_GL>(),
+    make_frame_pipeline<PRESENT_VULKAN>(),
+    make_frame_pipeline<PRESENT_WAYLAND>(),
+    make_frame_pipeline<PRESENT_X11>(),
+    make_frame_pipeline<PRESENT_KMS>(),
+    make_frame_pipeline<PRESENT_TERMINAL>(),
+};
+
+void select_frame_pipeline(PixelUploader* uploader, PresentBackend backend)
+{
+    uploader->pipeline = &frame_pipelines[backend];
+}
+
+// The frame as top-down R,G,B,A bytes, the row order image files and
+// video encoders expect
+void copy_buffer_rgba(const Buffer& buffer, uint8_t* out)
+{
+    for(size_t yi = 0; yi < buffer.height; ++yi)
+    {
+        size_t row = (buffer.height - 1 - yi) * buffer.width;
+        uint8_t* dst = out + yi * buffer.width * 4;
+        if(buffer.format == PIXEL_RGBA8888_REV)
+        {
+            // Already R,G,B,A in memory
+            memcpy(dst, buffer.data + row, buffer.width * 4);
+            continue;
+        }
+        for(size_t xi = 0; xi < buffer.width; ++xi, dst += 4)
+        {
+            uint32_t value;
+            if(buffer.format == PIXEL_INDEXED8) value = buffer.palette->colors[buffer.indices[row + xi]];
+            else if(buffer.format == PIXEL_RGB565)
+            {
+                // Widened with the high bits repeated, so white stays white
+                uint32_t p = buffer.data16[row + xi];
+                uint32_t r = p >> 11, g = (p >> 5) & 63, b = p & 31;
+                value = ((r << 3 | r >> 2) << 24) | ((g << 2 | g >> 4) << 16) | ((b << 3 | b >> 2) << 8);
+            }
+            else value = buffer.data[row + xi];
+
+            if(buffer.format == PIXEL_BGRA8888_REV) value = (value << 8) | (value >> 24);
+            dst[0] = (uint8_t)(value >> 24);
+            dst[1] = (uint8_t)(value >> 16);
+            dst[2] = (uint8_t)(value >> 8);
+            dst[3] = 255;
+        }
+    }
+}
+
+void capture_buffer(FrameCapture* capture, const Buffer& buffer)
+{
+    copy_buffer_rgba(buffer, begin_capture_frame(capture));
+    end_capture_frame(capture);
+}
+
+// A 3.3 core context, what the present shaders are written for
+void set_gl_window_hints()
+{
+#ifdef SPACE_INVADERS_GLES
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_ES_API);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+#else
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+}
@@ -0,0 +1,944 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+/*
+    GL present backends. Shader programs and their binary cache, the
+    upload paths that get a CPU buffer into the frame texture, the GPU and
+    compute sprite renderers, the text overlay, spectator windows, frame
+    pacing and the frame sinks that stream or capture what is presented.
+    The Vulkan, wl_shm, MIT-SHM, KMS and terminal backends live in
+    vulkan_present.h, wayland_present.h, x11_present.h, kms_present.h and
+    terminal_present.h.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "render.h"
+#include "vulkan_present.h"
+#include "wayland_present.h"
+#include "x11_present.h"
+#include "kms_present.h"
+#include "terminal_present.h"
+#include "capture.h"
+#include "reactor.h"
+
+// What the GL paths are built against; GLSL ES has no noperspective qualifier
+#ifdef SPACE_INVADERS_GLES
+#define GL_API_NAME "OpenGL ES"
+#define GL_PRESENT_NAME "gles"
+#define GLSL_HEADER "#version 300 es\nprecision highp float;\nprecision highp int;\n"
+#define GLSL_NOPERSPECTIVE ""
+#else
+#define GL_API_NAME "OpenGL"
+#define GL_PRESENT_NAME "gl"
+#define GLSL_HEADER "#version 330\n"
+#define GLSL_NOPERSPECTIVE "noperspective "
+#endif
+
+#define GPU_MAX_INSTANCES 4096
+#define GPU_MAX_ATLAS_SPRITES 16
+
+// Per-instance data for the GPU sprite backend
+struct SpriteInstance
+{
+    int16_t x, y;
+    int16_t atlas_y, width, height, scale;
+    uint32_t color;
+};
+
+struct AtlasEntry
+{
+    const void* rows;
+    size_t num_rows;
+    size_t row_bytes;
+    size_t atlas_y;
+};
+
+// All sprites live in one R8 atlas; draws are recorded as instances and
+// rendered into the framebuffer texture through an FBO. The compute
+// backend rasterizes the same instances from a 1bpp copy of the atlas.
+struct GpuSpriteRenderer
+{
+    GLuint program, vao, instance_vbo, atlas_texture, fbo;
+    GLint buffer_size_location;
+    size_t width, height;
+
+    bool compute;
+    GLuint compute_program, entity_ssbo, atlas_ssbo, target_texture;
+    GLint num_entities_location;
+
+    size_t num_atlas_entries;
+    size_t atlas_rows;
+    AtlasEntry atlas[GPU_MAX_ATLAS_SPRITES];
+
+    bool clear_pending;
+    uint32_t clear_color;
+    size_t num_instances;
+    SpriteInstance instances[GPU_MAX_INSTANCES];
+};
+
+#define TEXT_OVERLAY_MAX_LISTS 8
+#define TEXT_OVERLAY_LIST_GLYPHS 1024
+
+// Per-instance data for the text overlay, colors always RGBA8888
+struct GlyphInstance
+{
+    int16_t x, y;
+    uint16_t glyph, reserved;
+    uint32_t color;
+};
+
+struct GlyphList
+{
+    size_t num_glyphs;
+    GlyphInstance glyphs[TEXT_OVERLAY_LIST_GLYPHS];
+};
+
+// Text drawn as instanced glyph quads over the presented frame. Every
+// buffer attached to the overlay records into its own list, so a layer's
+// text lives exactly as long as its pixels, and the lists 'shown' holds
+// are the ones the last composite put on screen.
+struct TextOverlay
+{
+    GLuint program, vao, instance_vbo, font_texture;
+    GLint buffer_size_location, glyph_size_location;
+    size_t width, height;
+
+    // The font sheet the glyph indices refer to
+    const void* font_rows;
+    size_t num_glyphs, glyph_width, glyph_height, glyph_bytes;
+
+    size_t num_lists;
+    uint32_t shown;
+    GlyphList lists[TEXT_OVERLAY_MAX_LISTS];
+
+    // Bumped on every change; submit_frame and the upload compare theirs
+    uint64_t version, submitted_version, uploaded_version;
+    size_t num_uploaded;
+};
+
+#define UPLOAD_PBO_COUNT 3
+
+enum UploadMode: uint8_t
+{
+    UPLOAD_DIRECT     = 0,
+    UPLOAD_PBO        = 1,
+    UPLOAD_PERSISTENT = 2,
+    NUM_UPLOAD_MODES
+};
+
+// UPLOAD_PBO: ring of pixel unpack buffers, each slot's fence guards its reuse.
+// UPLOAD_PERSISTENT: Buffer::data lives in one persistently mapped buffer.
+// With an upload thread, that thread's context does the transfers.
+// With a Vulkan presenter, Buffer::data is its staging buffer and no GL
+// is involved at all; with a Wayland one, it is the wl_shm buffer drawn
+// into next.
+struct UploadThread;
+struct StreamedBuffer;
+
+struct FramePipeline;
+
+struct PixelUploader
+{
+    UploadMode mode;
+    size_t current;
+    size_t size;
+    GLuint pbos[UPLOAD_PBO_COUNT];
+    GLsync fences[UPLOAD_PBO_COUNT];
+    uint8_t* cpu_data;
+    UploadThread* thread;
+    // hash_upload_rects() of the last frame, see frame_changed()
+    uint64_t frame_hash;
+
+    VulkanPresenter* vulkan;
+    // Submitted rectangles, copied into the source image on the swap
+    VulkanRect vulkan_rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_vulkan_rects;
+
+    WaylandPresenter* wayland;
+    // Submitted rectangles, the damage of the next commit
+    Rect wayland_rects[2 * BUFFER_MAX_DIRTY];
+    size_t num_wayland_rects;
+
+    // Submitted rectangles go straight into its shared image
+    X11Presenter* x11;
+    // And into its dumb buffer
+    KmsPresenter* kms;
+    // Or sampled into its character cells
+    TerminalPresenter* terminal;
+
+    // Every submitted frame is also offered to this stream when set
+    StreamedBuffer* stream;
+    // Set when the GL context offers timer queries
+    GpuTimers* gpu_timers;
+    // What submit, swap, wait and finish go through, see FramePipeline
+    const FramePipeline* pipeline;
+};
+
+/*
+    Program binary cache. Linked programs are saved with glGetProgramBinary
+    and handed back to glProgramBinary on the next launch, so startup skips
+    the compile however many shaders there are. The whole file is dropped
+    when the GL vendor, renderer or version string changes, and a binary
+    the driver still rejects is compiled from source again and replaced.
+*/
+#define SHADER_CACHE_MAX_PROGRAMS 8
+#define SHADER_CACHE_PATH "space_invaders.shaders"
+
+// Followed by 'size' bytes of binary
+struct ShaderCacheEntry
+{
+    // Hash of the vertex and fragment source
+    uint64_t key;
+    uint32_t format, size;
+};
+
+struct CachedProgram
+{
+    ShaderCacheEntry entry;
+    uint8_t* binary;
+    // Loaded or stored this run, so not replaced when the cache is full
+    bool used;
+};
+
+struct ShaderCache
+{
+    const char* path;
+    bool enabled, dirty;
+    uint64_t driver;
+    size_t num_programs;
+    size_t hits, misses;
+    CachedProgram programs[SHADER_CACHE_MAX_PROGRAMS];
+};
+
+void open_shader_cache(ShaderCache* cache, const char* path);
+void close_shader_cache(ShaderCache* cache);
+GLuint create_program(const char* vertex_source, const char* fragment_source, ShaderCache* cache);
+
+/*
+    Program builds that don't block. start_program_build() only issues the
+    compiles and the link, and asks nothing back: any status or log query
+    waits for the driver, so with GL_KHR_parallel_shader_compile several
+    builds started together run on its threads side by side.
+    program_build_done() polls GL_COMPLETION_STATUS_KHR, which never waits,
+    and finish_program_build() reads the logs and the link status once it
+    says so. Without the extension a build reports done at once and
+    finishing it waits like create_program() does.
+*/
+#define PROGRAM_BUILD_MAX_STAGES 2
+
+enum ProgramBuildState
+{
+    BUILD_PENDING,
+    BUILD_LINKED,
+    BUILD_FAILED
+};
+
+struct ProgramBuild
+{
+    GLuint program;
+    GLuint shaders[PROGRAM_BUILD_MAX_STAGES];
+    size_t num_stages;
+    uint64_t key;
+    // Stored in once linked; must outlive the build
+    ShaderCache* cache;
+    ProgramBuildState state;
+    double start_time;
+};
+
+void start_program_build(ProgramBuild* build, const GLenum* stages, const char* const* sources, size_t num_stages, ShaderCache* cache);
+bool program_build_done(const ProgramBuild& build);
+// Returns the program, or 0 when it failed to compile or link
+GLuint finish_program_build(ProgramBuild* build);
+// Deletes the program too when the build hasn't been finished
+void cancel_program_build(ProgramBuild* build);
+
+#ifdef SPACE_INVADERS_GLES
+// GLES uploads bytes only, so GL_RGBA8 takes R,G,B,A; RGB565 is the one
+// packed type it has
+inline GLenum pixel_gl_format(PixelFormat format)
+{
+    return format == PIXEL_INDEXED8 ? GL_RED : format == PIXEL_RGB565 ? GL_RGB : GL_RGBA;
+}
+
+inline GLenum pixel_gl_type(PixelFormat format)
+{
+    return format == PIXEL_RGB565 ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_BYTE;
+}
+
+void set_palette_swizzle();
+#else
+inline GLenum pixel_gl_format(PixelFormat format)
+{
+    switch(format)
+    {
+        case PIXEL_INDEXED8: return GL_RED;
+        case PIXEL_BGRA8888_REV: return GL_BGRA;
+        case PIXEL_RGB565: return GL_RGB;
+        default: return GL_RGBA;
+    }
+}
+
+inline GLenum pixel_gl_type(PixelFormat format)
+{
+    switch(format)
+    {
+        case PIXEL_INDEXED8: return GL_UNSIGNED_BYTE;
+        case PIXEL_RGBA8888: return GL_UNSIGNED_INT_8_8_8_8;
+        case PIXEL_RGB565: return GL_UNSIGNED_SHORT_5_6_5;
+        default: return GL_UNSIGNED_INT_8_8_8_8_REV;
+    }
+}
+
+// GL_UNSIGNED_INT_8_8_8_8 already reads the palette words in order
+inline void set_palette_swizzle() {}
+#endif
+
+inline GLenum buffer_gl_format(const Buffer& buffer)
+{
+    return pixel_gl_format(buffer.format);
+}
+
+inline GLenum buffer_gl_type(const Buffer& buffer)
+{
+    return pixel_gl_type(buffer.format);
+}
+
+// Sized format of the texture a buffer uploads into. RGB565 stays 16-bit
+// where the context has GL_RGB565, every GLES 3 and desktop 4.1 or
+// ARB_ES2_compatibility, and widens to GL_RGB8 elsewhere.
+GLenum buffer_gl_internal_format(const Buffer& buffer);
+
+const char* pixel_format_name(PixelFormat format);
+
+/*
+    Pick the 32-bit layout the driver uploads into GL_RGBA8 fastest. The
+    driver's preferred format/type is asked for first when it can be
+    queried, then every candidate is timed with a few full uploads. The
+    preferred one wins unless another is clearly faster.
+*/
+
+PixelFormat negotiate_pixel_format(size_t width, size_t height);
+const char* upload_mode_name(UploadMode mode);
+UploadMode init_uploader(PixelUploader* uploader, Buffer* buffer, UploadMode mode);
+void destroy_uploader(PixelUploader* uploader, Buffer* buffer);
+// Between frames on the GL path without an upload thread. The texture
+// keeps the last frame, and the pixels move to wherever the new mode
+// wants them. Returns the mode in use, as init_uploader() does.
+UploadMode switch_upload_mode(PixelUploader* uploader, Buffer* buffer, UploadMode mode);
+void wait_for_upload(PixelUploader* uploader);
+void retire_dirty_rects(Buffer* buffer);
+
+/*
+    Upload thread. With --upload-thread a hidden window's context, sharing
+    objects with the main one as in GLFW's examples/sharing.c, does every
+    pixel transfer on its own thread, leaving the main context to draw and
+    swap. Each upload ends with a fence the drawing context waits on
+    before sampling the texture.
+
+    With a single framebuffer the renderer waits for each upload to be
+    issued before it draws again. With UPLOAD_CPU_FRAMES in rotation it
+    hands the frame over and draws the next one into the other buffer,
+    first copying in the rectangles the handed-over frame changed, so the
+    two always agree once a frame is submitted. The upload then overlaps
+    the next frame's rasterization, and the frame on screen is the one
+    before: submit_frame() waits for the previous upload, and its fence,
+    before the present samples the texture. The other way round, the
+    upload thread waits on a fence the swap leaves behind the present, so
+    it never writes the texture while the last frame is still read.
+*/
+#define UPLOAD_CPU_FRAMES 2
+
+struct UploadThread
+{
+    GLFWwindow* window;
+    PixelUploader* uploader;
+    Buffer* buffer;
+    GLuint texture;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    bool pending;
+    bool quit;
+    // Signalled once the GPU has the last upload's pixels
+    GLsync done;
+
+    // Rotation only: the framebuffers, the one drawn into, and the frame
+    // being uploaded from the other
+    size_t num_frames, back;
+    uint8_t* frames[UPLOAD_CPU_FRAMES];
+    Buffer frame;
+    // Set by the swap after a hand-over, the present the upload waits for
+    GLsync presented;
+    bool awaiting_present;
+    // A frame went to the thread since submit_frame() last waited on one
+    bool in_flight;
+};
+
+// 'num_frames' is 1 or UPLOAD_CPU_FRAMES; the extra framebuffers are
+// allocated here and 'buffer' draws into whichever is the back one
+bool start_upload_thread(UploadThread* upload, GLFWwindow* window, PixelUploader* uploader, Buffer* buffer, GLuint texture, size_t num_frames);
+// Leaves 'buffer' on its own framebuffer, holding the last frame drawn
+void stop_upload_thread(UploadThread* upload);
+
+/*
+    Compute backend, GL 4.3. Each 16x16 tile walks the instance list 256
+    entries at a time, bins the ones that touch it in shared memory and
+    then has every pixel test only those. A pixel keeps the highest
+    covering instance, which is the one the instanced draw would have left
+    on top, so the two backends produce the same pixels.
+*/
+
+void gpu_atlas_add(GpuSpriteRenderer* gpu, const Sprite& sprite, size_t num_rows);
+void gpu_build_atlas(GpuSpriteRenderer* gpu);
+
+bool init_gpu_renderer(GpuSpriteRenderer* gpu, GLuint target_texture, size_t width, size_t height, bool compute, ShaderCache* cache);
+void destroy_gpu_renderer(GpuSpriteRenderer* gpu);
+void gpu_batch_sprite(GpuSpriteRenderer* gpu, const Sprite& sprite, size_t x, size_t y, size_t scale, uint32_t color);
+
+/*
+    Text overlay. The font sheet is uploaded once as an R8 texture, one
+    glyph under the other, and strings become one instance per glyph with
+    the string's color. The lists are drawn in buffer coordinates straight
+    over the presented frame, so the same overlay works above the CPU and
+    the GPU renderer and text costs no rasterizing or texture upload.
+*/
+
+bool init_text_overlay(TextOverlay* overlay, size_t width, size_t height, ShaderCache* cache);
+void set_text_overlay_font(TextOverlay* overlay, const Sprite& font, size_t num_glyphs);
+void destroy_text_overlay(TextOverlay* overlay);
+bool attach_text_overlay(Buffer* buffer, TextOverlay* overlay);
+
+inline uint32_t text_list_bit(const Buffer& buffer)
+{
+    return buffer.text_overlay ? 1u << buffer.text_list : 0;
+}
+
+void show_text_lists(TextOverlay* overlay, uint32_t shown);
+void reset_text_list(Buffer* buffer);
+bool text_overlay_glyph_base(const Buffer& buffer, const Sprite& sheet, size_t* base);
+uint32_t text_overlay_color(const Buffer& buffer, Color color);
+void add_overlay_glyph(Buffer* buffer, size_t glyph, size_t x, size_t y, uint32_t color);
+
+/*
+    Present stage. The native-resolution texture is scaled to the window on
+    the GPU; the viewport is recomputed whenever the framebuffer is resized
+    and the area around it is cleared to black.
+*/
+enum ScaleMode: uint8_t
+{
+    SCALE_STRETCH = 0,
+    SCALE_ASPECT  = 1,
+    SCALE_INTEGER = 2
+};
+
+/*
+    CRT pass. An optional curved-tube look for cabinets, computed in the
+    present stage's fragment shader as it samples the buffer texture, so
+    the CPU keeps rasterizing at native resolution and the effect costs
+    GPU time only, which grows with the window and not with the game. Each
+    tier adds to the one below: CRT_LOW darkens the edges of every source
+    row into scanlines and tints each third window column toward one
+    primary like an aperture grille, CRT_MEDIUM bends the picture into a
+    barrel and shades its corners, and CRT_HIGH lets the four neighbors of
+    every texel bleed into it as bloom. Text drawn by the text overlay
+    goes on top of the pass, flat.
+*/
+#define CRT_SHADER_MAX 4096
+
+enum CrtQuality: uint8_t
+{
+    CRT_OFF     = 0,
+    CRT_LOW     = 1,
+    CRT_MEDIUM  = 2,
+    CRT_HIGH    = 3
+};
+
+const char* crt_quality_name(CrtQuality quality);
+// The present fragment shader for 'quality', into 'source' of 'size'
+// bytes; 'indexed' looks colors up in the palette like the plain one
+void build_crt_shader(char* source, size_t size, CrtQuality quality, bool indexed);
+
+struct SpectatorWindow;
+struct DebugOverlay;
+struct ScreenshotReadback;
+struct FrameFences;
+
+struct Presenter
+{
+    ScaleMode mode;
+    size_t source_width, source_height;
+    GLint viewport[4];
+    // Drawn over the frame when set, through a VAO of this context
+    TextOverlay* text;
+    GLuint text_vao;
+    // Drawn over the whole main window after the frame, only on the GL path
+    DebugOverlay* debug;
+    // Reads the frame back before the swap when a screenshot is asked for
+    ScreenshotReadback* screenshots;
+    // Fenced after each swap when frames in flight are capped
+    FrameFences* in_flight;
+
+    // The fullscreen program, until 'upgrade' links and takes over. Bound
+    // each frame, as every window's context has its own binding.
+    GLuint program;
+    ProgramBuild* upgrade;
+
+    // Extra windows mirroring the main one after each swap
+    SpectatorWindow* spectators;
+    size_t num_spectators;
+};
+
+const char* scale_mode_name(ScaleMode mode);
+void update_present_viewport(Presenter* presenter, int framebuffer_width, int framebuffer_height);
+
+/*
+    Exclusive fullscreen. The game window goes fullscreen on one monitor
+    in the video mode glfwGetVideoModes() lists with the highest refresh
+    rate at the asked resolution, the current one's by default, and the
+    deepest color among those. A fullscreen window the size of the mode
+    is what compositors unredirect and scan out straight from the game's
+    buffers, sparing a composition pass and the frame of latency it adds.
+    GLFW sets _NET_WM_BYPASS_COMPOSITOR on X11 to ask for it.
+
+    Whether that actually happens is the compositor's call, which no
+    windowing API reports. What is known is reported: the mode the
+    monitor ended up in, and direct when no compositor runs at all, as
+    on X11 without a _NET_WM_CM_Sn owner. With a compositor, or on any
+    other platform, the bypass is only requested.
+*/
+enum ScanoutBypass: uint8_t
+{
+    BYPASS_WINDOWED,
+    BYPASS_REQUESTED,
+    BYPASS_DIRECT,
+    NUM_SCANOUT_BYPASS
+};
+
+struct FullscreenMode
+{
+    // 0 for a window
+    GLFWmonitor* monitor;
+    GLFWvidmode mode;
+};
+
+const char* scanout_bypass_name(ScanoutBypass bypass);
+// Monitor 'index' of glfwGetMonitors(), 0 being the primary, and its best
+// mode at 'width' x 'height', or at the current mode's size where those
+// are 0 or no mode has them. False, having said why, without the monitor.
+bool choose_fullscreen_mode(FullscreenMode* fullscreen, int index, int width, int height);
+// Fullscreen in 'fullscreen's mode, or a 640x480 window without a monitor.
+// Takes whatever other hints are set.
+GLFWwindow* create_game_window(const FullscreenMode& fullscreen);
+ScanoutBypass query_scanout_bypass(GLFWwindow* window);
+// One line: the monitor, the mode it is in and the bypass
+void print_fullscreen(GLFWwindow* window, const FullscreenMode& fullscreen);
+
+/*
+    Spectator windows. Each one has its own context sharing objects with
+    the main one, so it samples the very texture the main window shows:
+    every extra screen costs one fullscreen draw and a swap, and nothing
+    is rasterized or uploaded again. Window i goes fullscreen on the i-th
+    of the monitors the game isn't on, like GLFW's tests/monitors.c lists
+    them, and opens as a window otherwise. Only the main window waits for vsync.
+*/
+#define SPECTATOR_MAX_WINDOWS 4
+
+struct SpectatorWindow
+{
+    GLFWwindow* window;
+    GLuint vao;
+    // Its own viewport and overlay VAO, sources shared with the main one
+    Presenter view;
+
+    // Set by the window's callbacks on the main thread
+    std::atomic<bool> resized, closed;
+    std::atomic<int> width, height;
+};
+
+bool open_spectator(
+    SpectatorWindow* spectator, GLFWwindow* main_window, GLFWmonitor* monitor, const Presenter& presenter,
+    GLuint program, GLuint buffer_texture, GLuint palette_texture);
+void close_spectator(SpectatorWindow* spectator);
+bool init_gpu_timers(GpuTimers* timers);
+void destroy_gpu_timers(GpuTimers* timers);
+// Each takes a null 'timers' and does nothing
+void begin_gpu_frame(GpuTimers* timers);
+void begin_gpu_phase(GpuTimers* timers, GpuPhase phase);
+void end_gpu_phase(GpuTimers* timers, GpuPhase phase);
+void print_gpu_timers(const GpuTimers& timers);
+
+/*
+    Screenshots of the presented frame, GL path only. A request reads the
+    back buffer into a pixel pack buffer right after the frame is drawn,
+    with a fence behind it, so glReadPixels only queues a copy on the GPU
+    and the CPU waits for nothing. Later swaps poll the fence, map the
+    buffer once it has signalled and hand the mapping to the screenshot
+    writer, which flips and encodes it on its own thread; the buffer is
+    unmapped when the writer is done. A request made meanwhile waits its
+    turn, and swaps keep coming until the screenshot is through.
+*/
+enum ScreenshotStage: uint8_t
+{
+    SCREENSHOT_IDLE    = 0,
+    SCREENSHOT_READING = 1,
+    SCREENSHOT_MAPPED  = 2
+};
+
+struct ScreenshotReadback
+{
+    ScreenshotWriter* writer;
+    // Set from any thread, taken by the thread that swaps
+    std::atomic<bool> requested;
+    ScreenshotStage stage;
+    GLuint pbo;
+    size_t capacity;
+    int width, height;
+    GLsync fence;
+};
+
+// With the context current; false when the writer can't be started
+bool init_screenshot_readback(ScreenshotReadback* screenshots, const char* prefix);
+void destroy_screenshot_readback(ScreenshotReadback* screenshots);
+void request_screenshot(ScreenshotReadback* screenshots);
+// After the frame is drawn to the back buffer, before the swap
+void update_screenshot_readback(ScreenshotReadback* screenshots);
+
+// Live buffers, framebuffers, programs, shaders, textures and vertex
+// arrays of the current context, probing names 1 to GL_OBJECT_PROBE_NAMES
+// of each kind. Names are handed out low first, so a leak shows up as a
+// count that keeps growing.
+#define GL_OBJECT_PROBE_NAMES 1024
+size_t count_gl_objects();
+
+/*
+    Frame pipelines. Which backend a frame goes out through is settled
+    before the first one and never changes, yet every submit, swap, wait
+    and finish asked the uploader which presenter it had, down a chain
+    that grew with each backend. Each backend now has its steps built as
+    a specialization of one template on the backend, with the others'
+    branches compiled out, and the uploader points at its backend's row
+    of the table once the presenter is in. submit_frame(), swap_frame(),
+    wait_for_upload() and finish_frame() are one indirect call into it.
+    What still switches while the game runs stays a plain branch inside
+    the GL steps: the upload mode, the upload thread, the GPU renderer.
+*/
+enum PresentBackend: uint8_t
+{
+    PRESENT_GL,
+    PRESENT_VULKAN,
+    PRESENT_WAYLAND,
+    PRESENT_X11,
+    PRESENT_KMS,
+    PRESENT_TERMINAL,
+    NUM_PRESENT_BACKENDS
+};
+
+extern const char* present_backend_names[NUM_PRESENT_BACKENDS];
+
+struct FramePipeline
+{
+    PresentBackend backend;
+    void (*wait)(PixelUploader* uploader);
+    bool (*submit)(PixelUploader* uploader, Buffer* buffer);
+    void (*swap)(const Presenter& presenter, GLFWwindow* window, PixelUploader* uploader);
+    void (*finish)(PixelUploader* uploader);
+};
+
+extern const FramePipeline frame_pipelines[NUM_PRESENT_BACKENDS];
+
+// init_uploader() selects GL; call once the backend's presenter is in
+// 'uploader', before the first frame
+void select_frame_pipeline(PixelUploader* uploader, PresentBackend backend);
+void swap_frame(const Presenter& presenter, GLFWwindow* window, PixelUploader* uploader);
+// Blocks until the last swap has gone through
+void finish_frame(PixelUploader* uploader);
+
+/*
+    Frames in flight. The driver may queue several swaps ahead of the GPU,
+    each adding a refresh of latency that no swap interval takes back. On
+    the GL path a fence goes in after every swap, and the frame loop waits
+    for the one 'max_frames' swaps back before it samples input, so no
+    more than that many frames are ever queued. Waits are checked first
+    without blocking, and only those that did block are counted.
+*/
+#define FRAMES_IN_FLIGHT_MAX 3
+
+struct FrameFences
+{
+    // 0 leaves the queue to the driver
+    size_t max_frames;
+    size_t next;
+    GLsync fences[FRAMES_IN_FLIGHT_MAX];
+    size_t waits;
+    double waited;
+};
+
+void init_frame_fences(FrameFences* fences, size_t max_frames);
+void destroy_frame_fences(FrameFences* fences);
+// Right after the swap
+void fence_presented_frame(FrameFences* fences);
+// Before the next frame samples input
+void wait_frames_in_flight(FrameFences* fences);
+void print_frame_fences(const FrameFences& fences);
+
+/*
+    Frame pacing. Vsync and adaptive vsync (late frames tear instead of
+    waiting a whole refresh) are handled by the swap interval; uncapped
+    swaps immediately; fixed sleeps to each deadline, so the rate holds
+    without vsync.
+
+    VRR pacing is for G-Sync and FreeSync displays, which refresh when a
+    frame arrives rather than on a fixed grid. The limiter holds frames to
+    FRAME_VRR_CAP of the refresh rate, or --fps when that is lower, so a
+    swap never reaches the panel's top rate where it would wait on vsync
+    again, and the swap interval is adaptive where swap-control-tear is
+    supported: with VRR active a late frame goes out at once and the panel
+    stretches its refresh, without it the frame tears instead of waiting
+    a whole refresh. Each present interval is sorted by where it landed:
+    at the cap, on a multiple of the refresh (the display kept its grid,
+    so VRR is off) or elsewhere (late frames VRR, or tearing, let
+    through). print_vrr_pacing() gives the shares at exit.
+
+    The frame clock behind it learns the display from swap timestamps.
+    A swap that blocked on vsync returns just after a vblank, so each one
+    is matched to the vblank the clock predicted for it and the error
+    pulls the phase and, more gently, the refresh period, seeded from the
+    monitor's rate, back in line, the way a phase-locked loop does.
+    Scheduling jitter is averaged out rather than passed on, and a swap
+    far off the prediction, after a stall or in a mode that does not
+    block, starts the phase over instead of bending the period.
+    predict_present() gives the next frame's expected present time, which
+    the simulation and interpolation advance to instead of the noisy
+    time the loop happened to wake at. Sleeps aim at absolute deadlines
+    and start early by how late the OS has been waking them, so they
+    land on time without spinning.
+
+    Late input sampling goes further under vsync: rather than reading
+    input as soon as the last swap returns, the loop sleeps until the
+    next vblank less the recent frame work and LATE_INPUT_MARGIN, so the
+    input a frame shows is as fresh as it can be and still make that
+    vblank. The work estimate follows a slower frame at once and eases
+    back over a few dozen frames, so one spike doesn't miss vblanks
+    over and over.
+
+    With a reactor set the pacer's sleeps wait in it instead, so the
+    display connection, spectator sockets and whatever else it watches
+    are served the moment they have something, and the thread still
+    sleeps until the deadline when they don't.
+*/
+// Spare time a late-sampled frame leaves before the vblank
+#define LATE_INPUT_MARGIN 0.002
+// How far the work estimate eases back toward a faster frame
+#define LATE_INPUT_DECAY 0.05
+
+enum PacingMode: uint8_t
+{
+    PACING_VSYNC    = 0,
+    PACING_ADAPTIVE = 1,
+    PACING_UNCAPPED = 2,
+    PACING_FIXED    = 3,
+    PACING_VRR      = 4,
+    NUM_PACING_MODES
+};
+
+// Share of the refresh rate VRR pacing is held to
+#define FRAME_VRR_CAP 0.95
+
+enum VrrLanding: uint8_t
+{
+    VRR_AT_CAP     = 0,
+    VRR_ON_REFRESH = 1,
+    VRR_OFF_GRID   = 2,
+    NUM_VRR_LANDINGS
+};
+
+struct FrameClock
+{
+    // Filtered estimates of the refresh period and of the last vblank
+    double period;
+    double vblank;
+    size_t swaps;
+    size_t resyncs;
+
+    // How late sleeps have been waking, taken off the next one
+    double oversleep;
+    // predict_present() never goes back
+    double last_prediction;
+};
+
+struct FramePacer
+{
+    GLFWwindow* window;
+    PacingMode mode;
+    bool adaptive_supported;
+    double interval;
+    double deadline;
+
+    // Frames that skip the swap wait out the refresh it would have
+    double refresh_interval;
+    double last_frame;
+
+    // Set by govern_frame_rate(), 0 leaves the rate to the mode
+    double cap_interval;
+
+    // The limiter's interval in VRR pacing, when the last swap returned
+    // and where the present intervals since the mode was set landed
+    double vrr_interval;
+    double last_swap;
+    size_t vrr_landings[NUM_VRR_LANDINGS];
+
+    FrameClock clock;
+
+    // Late input sampling under vsync, and the work it leaves time for
+    bool late_input;
+    double input_lead;
+
+    // Sleeps wait in it when set, serving what arrives meanwhile
+    Reactor* reactor;
+
+    VulkanPresenter* vulkan;
+    WaylandPresenter* wayland;
+    X11Presenter* x11;
+    KmsPresenter* kms;
+    TerminalPresenter* terminal;
+
+    // Reported in the window title once per second
+    size_t frames;
+    double stats_start;
+    double fps;
+
+    // Off the main thread the title is handed over for it to set
+    bool defer_title;
+    std::atomic<bool> title_pending;
+    char title[64];
+};
+
+void init_frame_pacer(FramePacer* pacer, GLFWwindow* window, PacingMode mode, double fps, VulkanPresenter* vulkan, WaylandPresenter* wayland, X11Presenter* x11, KmsPresenter* kms, TerminalPresenter* terminal);
+const char* pacing_mode_name(PacingMode mode);
+void set_pacing_mode(FramePacer* pacer, PacingMode mode);
+void cycle_pacing_mode(FramePacer* pacer);
+void pace_frame(FramePacer* pacer);
+void pace_skipped_frame(FramePacer* pacer);
+// Before the frame pumps its events; sleeps only for late input sampling
+void wait_input_sampling(FramePacer* pacer);
+// After each drawn frame, with its work in seconds
+void record_input_lead(FramePacer* pacer, double work);
+// Where the frame being built is expected to reach the screen
+double predict_present(FramePacer* pacer);
+// Nothing unless VRR pacing presented frames
+void print_vrr_pacing(const FramePacer& pacer);
+
+/*
+    Power governor. On top of the pacing mode, the power profile caps how
+    often frames are presented by what the scene is doing. The simulation
+    keeps its fixed time step at any rate, and static screens are left to
+    the idle wait, which only presents when something wakes it.
+*/
+enum PowerProfile: uint8_t
+{
+    POWER_PERFORMANCE = 0,
+    POWER_BALANCED    = 1,
+    POWER_BATTERY     = 2,
+    NUM_POWER_PROFILES
+};
+
+enum SceneActivity: uint8_t
+{
+    SCENE_PLAY = 0,
+    SCENE_TEXT = 1,
+    NUM_SCENE_ACTIVITIES
+};
+
+const char* power_profile_name(PowerProfile profile);
+SceneActivity classify_scene(const GameState& state);
+void govern_frame_rate(FramePacer* pacer, PowerProfile profile, SceneActivity scene);
+void flush_pacer_title(FramePacer* pacer);
+
+/*
+    Quality governor. With --quality auto the frame loop holds its budget
+    by thinning out effects rather than dropping frames. The work of each
+    drawn frame, every phase but the swap's wait, is averaged over
+    QUALITY_WINDOW frames. A window over QUALITY_HIGH_WATER of the budget
+    steps quality down a level; after QUALITY_HOLD_WINDOWS windows under
+    QUALITY_LOW_WATER it steps back up. The gap between the two marks,
+    and the hold on the way up, keep a frame time near either mark from
+    flapping between levels.
+
+    Levels thin explosion debris, the one effect that only decorates:
+    full, one particle per pixel instead of two, then those living half
+    as long, then none. The logical resolution stays put, since the
+    simulation, recordings and spectators are laid out in it; the window
+    scaling is one texture fetch a pixel and costs nothing to keep.
+*/
+enum QualityLevel: uint8_t
+{
+    QUALITY_FULL    = 0,
+    QUALITY_REDUCED = 1,
+    QUALITY_LOW     = 2,
+    QUALITY_MINIMAL = 3,
+    NUM_QUALITY_LEVELS
+};
+
+#define QUALITY_WINDOW 30
+#define QUALITY_HIGH_WATER 0.85
+#define QUALITY_LOW_WATER 0.5
+#define QUALITY_HOLD_WINDOWS 4
+
+struct QualityGovernor
+{
+    bool automatic;
+    QualityLevel level;
+
+    double window_work;
+    size_t window_frames;
+    // Quiet windows in a row, counting towards a step up
+    size_t quiet_windows;
+
+    size_t steps_down, steps_up;
+    uint64_t frames_at[NUM_QUALITY_LEVELS];
+};
+
+const char* quality_level_name(QualityLevel level);
+void init_quality_governor(QualityGovernor* governor, QualityLevel level, bool automatic, ParticleSystem* particles);
+// After every drawn frame, with its work and budget in seconds
+void govern_quality(QualityGovernor* governor, ParticleSystem* particles, double work, double budget);
+void print_quality_governor(const QualityGovernor& governor);
+
+/*
+    Frame streaming. The buffer alternates between two pixel arrays: the
+    one just finished goes to the stream's writer as it is, and drawing
+    carries on in the other once the rectangles it missed are copied over
+    from the finished one. So a streamed frame costs a copy of its damage,
+    not of the frame, and a frame the writer is still busy for is dropped
+    with the game never waiting on the consumer.
+*/
+struct StreamedBuffer
+{
+    FrameStream* stream;
+    // pixels[0] is the buffer's own array
+    uint8_t* pixels[2];
+    size_t current;
+    // What the other array lacks of the current one
+    size_t num_stale;
+    Rect stale[BUFFER_MAX_DIRTY];
+};
+
+const char* stream_pixel_format(PixelFormat format);
+void init_streamed_buffer(StreamedBuffer* streamed, Buffer* buffer, FrameStream* stream);
+StreamStats destroy_streamed_buffer(StreamedBuffer* streamed, Buffer* buffer);
+void stream_buffer(StreamedBuffer* streamed, Buffer* buffer);
+bool submit_frame(PixelUploader* uploader, Buffer* buffer);
+// FNV-1a of 'size' more bytes, carrying on from 'hash'
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t size);
+// The frame as top-down R,G,B,A bytes, width * height * 4 of them
+void copy_buffer_rgba(const Buffer& buffer, uint8_t* out);
+void capture_buffer(FrameCapture* capture, const Buffer& buffer);
+void set_gl_window_hints();
+
+#endif
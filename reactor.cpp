@@ -0,0 +1,205 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "reactor.h"
+
+#if defined(_WIN32)
+#define REACTOR_USE_POSIX 0
+#else
+#define REACTOR_USE_POSIX 1
+#include <cerrno>
+#include <cmath>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#define REACTOR_USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#define REACTOR_USE_EPOLL 0
+#endif
+
+double reactor_now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* reactor_backend_name(const Reactor& reactor)
+{
+    return reactor.epoll_fd >= 0 ? "epoll and timerfd" : "poll";
+}
+
+void print_reactor_stats(const Reactor& reactor, const char* label)
+{
+    printf("%s: %s, %llu waits", label, reactor_backend_name(reactor), (unsigned long long)reactor.waits);
+    for(size_t si = 0; si < reactor.num_sources; ++si)
+    {
+        printf(", %s woke %llu", reactor.sources[si].name, (unsigned long long)reactor.sources[si].wakeups);
+    }
+    if(reactor.deadlines)
+    {
+        printf(
+            "; %llu deadlines woken %.3f ms late on average, %.3f ms at most",
+            (unsigned long long)reactor.deadlines, reactor.late_total / reactor.deadlines * 1000.0, reactor.late_max * 1000.0
+        );
+    }
+    printf("\n");
+}
+
+#if REACTOR_USE_POSIX
+
+#if REACTOR_USE_EPOLL
+// epoll hands back this for the timer, and source indices for the rest
+#define REACTOR_TIMER_TAG UINT64_MAX
+#endif
+
+bool open_reactor(Reactor* reactor)
+{
+    *reactor = Reactor{};
+    reactor->epoll_fd = reactor->timer_fd = -1;
+#if REACTOR_USE_EPOLL
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    // steady_clock is CLOCK_MONOTONIC on Linux, so deadlines carry over
+    reactor->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = REACTOR_TIMER_TAG;
+    if(reactor->epoll_fd < 0 || reactor->timer_fd < 0 || epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->timer_fd, &event) != 0)
+    {
+        fprintf(stderr, "Could not set up epoll and a timerfd: %s, polling instead.\n", strerror(errno));
+        if(reactor->epoll_fd >= 0) close(reactor->epoll_fd);
+        if(reactor->timer_fd >= 0) close(reactor->timer_fd);
+        reactor->epoll_fd = reactor->timer_fd = -1;
+    }
+#endif
+    return true;
+}
+
+void close_reactor(Reactor* reactor)
+{
+    if(reactor->epoll_fd >= 0) close(reactor->epoll_fd);
+    if(reactor->timer_fd >= 0) close(reactor->timer_fd);
+    reactor->epoll_fd = reactor->timer_fd = -1;
+    reactor->num_sources = 0;
+}
+
+bool watch_reactor_fd(Reactor* reactor, int fd, const char* name, void (*ready)(void* context), void* context)
+{
+    if(fd < 0 || reactor->num_sources == REACTOR_MAX_SOURCES) return false;
+    size_t index = reactor->num_sources;
+#if REACTOR_USE_EPOLL
+    if(reactor->epoll_fd >= 0)
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = index;
+        if(epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            fprintf(stderr, "Could not watch %s: %s\n", name, strerror(errno));
+            return false;
+        }
+    }
+#endif
+    reactor->sources[index] = ReactorSource{fd, name, ready, context, 0};
+    ++reactor->num_sources;
+    return true;
+}
+
+static void serve_source(Reactor* reactor, size_t index)
+{
+    ReactorSource& source = reactor->sources[index];
+    ++source.wakeups;
+    source.ready(source.context);
+}
+
+#if REACTOR_USE_EPOLL
+static void arm_reactor_timer(Reactor* reactor, double deadline)
+{
+    if(reactor->deadline == deadline) return;
+    reactor->deadline = deadline;
+    itimerspec spec = {};
+    // A deadline already gone still has to fire, the nearest it can
+    double whole = floor(deadline);
+    spec.it_value.tv_sec = (time_t)whole;
+    spec.it_value.tv_nsec = (long)((deadline - whole) * 1e9);
+    if(!spec.it_value.tv_sec && !spec.it_value.tv_nsec) spec.it_value.tv_nsec = 1;
+    timerfd_settime(reactor->timer_fd, TFD_TIMER_ABSTIME, &spec, 0);
+}
+#endif
+
+void run_reactor_until(Reactor* reactor, double deadline)
+{
+#if REACTOR_USE_EPOLL
+    if(reactor->epoll_fd >= 0)
+    {
+        arm_reactor_timer(reactor, deadline);
+        for(bool expired = false; !expired;)
+        {
+            epoll_event events[REACTOR_MAX_SOURCES + 1];
+            ++reactor->waits;
+            int count = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_SOURCES + 1, -1);
+            if(count < 0 && errno != EINTR) break;
+            // A signal ends the wait like the deadline, so the caller sees
+            // what its handler set
+            if(count < 0) return;
+            for(int ei = 0; ei < count; ++ei)
+            {
+                if(events[ei].data.u64 != REACTOR_TIMER_TAG)
+                {
+                    serve_source(reactor, (size_t)events[ei].data.u64);
+                    continue;
+                }
+                uint64_t expirations;
+                if(read(reactor->timer_fd, &expirations, sizeof(expirations)) > 0) expired = true;
+            }
+        }
+        reactor->deadline = 0.0;
+    }
+    else
+#endif
+    {
+        for(;;)
+        {
+            double left = deadline - reactor_now();
+            if(left <= 0.0) break;
+            pollfd fds[REACTOR_MAX_SOURCES];
+            for(size_t si = 0; si < reactor->num_sources; ++si) fds[si] = {reactor->sources[si].fd, POLLIN, 0};
+            ++reactor->waits;
+            // Rounded up so the wait never ends just short of the deadline
+            int count = poll(fds, (nfds_t)reactor->num_sources, (int)ceil(left * 1000.0));
+            if(count < 0)
+            {
+                if(errno == EINTR) return;
+                break;
+            }
+            for(size_t si = 0; count > 0 && si < reactor->num_sources; ++si)
+            {
+                if(fds[si].revents) serve_source(reactor, si);
+            }
+        }
+    }
+
+    double late = reactor_now() - deadline;
+    if(late < 0.0) late = 0.0;
+    ++reactor->deadlines;
+    reactor->late_total += late;
+    if(late > reactor->late_max) reactor->late_max = late;
+}
+
+#else
+
+bool open_reactor(Reactor* reactor)
+{
+    *reactor = Reactor{};
+    reactor->epoll_fd = reactor->timer_fd = -1;
+    fprintf(stderr, "The event reactor needs POSIX descriptors.\n");
+    return false;
+}
+
+void close_reactor(Reactor*) {}
+bool watch_reactor_fd(Reactor*, int, const char*, void (*)(void*), void*) { return false; }
+void run_reactor_until(Reactor*, double) {}
+
+#endif
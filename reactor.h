@@ -0,0 +1,64 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/*
+    Event reactor. One thread waits on every descriptor it serves and on
+    its next deadline in a single call: on Linux an epoll set holding the
+    sources and a timerfd armed at the deadline, absolute on
+    CLOCK_MONOTONIC; on other POSIX systems poll() with the time left as
+    its timeout, the way GLFW's posix_poll.c waits. A source that becomes
+    readable has its handler run at once, so datagrams and display events
+    are taken in as they arrive instead of at the next tick, and between
+    them the thread sleeps: nothing is polled on a timer.
+
+    Sources are level-triggered: a handler that leaves something unread
+    is called again straight away, so it should drain its descriptor.
+    Deadlines are seconds on reactor_now(), the steady clock, and how
+    late each one was woken for is kept so the wake-up latency can be
+    printed. Windows has neither epoll nor a pollable display,
+    open_reactor() fails there and callers keep sleeping.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+#define REACTOR_MAX_SOURCES 16
+
+struct ReactorSource
+{
+    int fd;
+    const char* name;
+    void (*ready)(void* context);
+    void* context;
+    uint64_t wakeups;
+};
+
+struct Reactor
+{
+    // -1 where poll() is used
+    int epoll_fd, timer_fd;
+    ReactorSource sources[REACTOR_MAX_SOURCES];
+    size_t num_sources;
+    // Armed deadline, 0 for none
+    double deadline;
+
+    uint64_t waits, deadlines;
+    // Past each deadline when the wait returned
+    double late_total, late_max;
+};
+
+double reactor_now();
+// False, having said why, where there is nothing to wait with
+bool open_reactor(Reactor* reactor);
+void close_reactor(Reactor* reactor);
+// 'fd' must be nonblocking. 'name' must outlive the reactor.
+bool watch_reactor_fd(Reactor* reactor, int fd, const char* name, void (*ready)(void* context), void* context);
+// Serves sources as they become ready until 'deadline' on reactor_now()
+// has passed
+void run_reactor_until(Reactor* reactor, double deadline);
+// "epoll and timerfd" or "poll"
+const char* reactor_backend_name(const Reactor& reactor);
+// One line: the waits, the wake-ups by source and how late deadlines woke
+void print_reactor_stats(const Reactor& reactor, const char* label);
+
+#endif
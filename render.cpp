@@ -0,0 +1,3197 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include "render.h"
+#include "present.h"
+#include "runtime.h"
+
+/*
+################################################
+##                  BUFFERS                   ##
+################################################
+*/
+
+inline size_t rect_area(const Rect& r)
+{
+    return r.width * r.height;
+}
+
+Rect rect_union(const Rect& a, const Rect& b)
+{
+    size_t x0 = a.x < b.x ? a.x : b.x;
+    size_t y0 = a.y < b.y ? a.y : b.y;
+    size_t x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    size_t y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return Rect{x0, y0, x1 - x0, y1 - y0};
+}
+
+// False when the rectangles don't overlap
+bool rect_intersection(const Rect& a, const Rect& b, Rect* out)
+{
+    size_t x0 = a.x > b.x ? a.x : b.x;
+    size_t y0 = a.y > b.y ? a.y : b.y;
+    size_t x1 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+    size_t y1 = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+    if(x0 >= x1 || y0 >= y1) return false;
+
+    *out = Rect{x0, y0, x1 - x0, y1 - y0};
+    return true;
+}
+
+// Merging is worth it when the union wastes little area over the two parts
+inline bool rects_should_merge(const Rect& a, const Rect& b)
+{
+    return rect_area(rect_union(a, b)) <= (rect_area(a) + rect_area(b)) * 5 / 4 + 64;
+}
+
+void mark_dirty(Buffer* buffer, const Rect& rect)
+{
+    if(!rect.width || !rect.height) return;
+
+    if(buffer->num_dirty && rects_should_merge(buffer->dirty[buffer->num_dirty - 1], rect))
+    {
+        buffer->dirty[buffer->num_dirty - 1] = rect_union(buffer->dirty[buffer->num_dirty - 1], rect);
+        return;
+    }
+
+    if(buffer->num_dirty == BUFFER_MAX_DIRTY)
+    {
+        // Out of slots, fall back to one bounding rectangle
+        Rect bounds = rect;
+        for(size_t i = 0; i < buffer->num_dirty; ++i) bounds = rect_union(bounds, buffer->dirty[i]);
+        buffer->dirty[0] = bounds;
+        buffer->num_dirty = 1;
+        return;
+    }
+
+    buffer->dirty[buffer->num_dirty++] = rect;
+}
+
+// Greedily coalesce rectangles in place, returns the new count
+size_t merge_rects(Rect* rects, size_t num_rects)
+{
+    bool merged = true;
+    while(merged)
+    {
+        merged = false;
+        for(size_t i = 0; i < num_rects; ++i)
+        {
+            for(size_t j = i + 1; j < num_rects; ++j)
+            {
+                if(!rects_should_merge(rects[i], rects[j])) continue;
+                rects[i] = rect_union(rects[i], rects[j]);
+                rects[j] = rects[--num_rects];
+                merged = true;
+                --j;
+            }
+        }
+    }
+    return num_rects;
+}
+
+// Look up a color in the palette, adding it on first use
+uint8_t palette_index(Palette* palette, uint32_t color)
+{
+    for(size_t i = 0; i < palette->num_colors; ++i)
+    {
+        if(palette->colors[i] == color) return (uint8_t)i;
+    }
+    if(palette->num_colors == PALETTE_MAX_COLORS) return 0;
+
+    palette->colors[palette->num_colors] = color;
+    palette->dirty = true;
+    return (uint8_t)palette->num_colors++;
+}
+
+// Seed the palette so every game color sits at its own index
+void init_palette(Palette* palette)
+{
+    palette->num_colors = NUM_COLORS;
+    palette->dirty = true;
+    palette->texture = 0;
+    for(size_t i = 0; i < NUM_COLORS; ++i) palette->colors[i] = color_tables[PIXEL_INDEXED8][i].rgba;
+}
+
+// Resolve an arbitrary color once, outside the draw loops
+Color resolve_color(Palette* palette, uint32_t rgba)
+{
+    return Color{rgba, palette_index(palette, rgba)};
+}
+
+// The value a draw writes into the buffer for 'color'
+inline uint32_t buffer_pixel_value(const Buffer* buffer, Color color)
+{
+    return buffer->format == PIXEL_INDEXED8 ? color.index : color.rgba;
+}
+
+// Calls draw(pixels, value) with the buffer's pixels typed for its format
+// and 'value' narrowed to match, so every kernel is written once over the
+// pixel type
+template<typename Draw>
+inline void with_buffer_pixels(Buffer* buffer, uint32_t value, Draw draw)
+{
+    switch(buffer->format)
+    {
+        case PIXEL_INDEXED8: draw(buffer->indices, (uint8_t)value); break;
+        case PIXEL_RGB565: draw(buffer->data16, (uint16_t)value); break;
+        default: draw(buffer->data, value); break;
+    }
+}
+
+// Frame 'index' of a spritesheet whose frames are stacked vertically
+Sprite sprite_frame(const Sprite& sheet, size_t index)
+{
+    Sprite frame = sheet;
+    frame.rows = static_cast<const uint8_t*>(sheet.rows) + index * sheet.height * sheet.row_bits / 8;
+    return frame;
+}
+
+/*
+################################################
+##                 DRAW LISTS                 ##
+################################################
+*/
+
+#define DRAW_BAND_MIN_ROWS 32
+
+void flush_draw_list(Buffer* buffer);
+
+inline void record_draw(Buffer* buffer, const DrawCommand& command)
+{
+    DrawList* list = buffer->draw_list;
+    if(list->num_commands == DRAW_LIST_MAX_COMMANDS) flush_draw_list(buffer);
+    list->commands[list->num_commands++] = command;
+}
+
+// Write each run of set bits in 'mask' as one contiguous fill
+template<typename Pixel>
+inline void blit_spans(Pixel* dst, uint64_t mask, Pixel color)
+{
+    while(mask)
+    {
+        unsigned start = count_trailing_zeros(mask);
+        uint64_t run = mask >> start;
+        unsigned len = ~run ? count_trailing_zeros(~run) : 64 - start;
+
+        Pixel* span = dst + start;
+        for(unsigned i = 0; i < len; ++i) span[i] = color;
+
+        mask &= len + start < 64 ? ~uint64_t(0) << (start + len) : 0;
+    }
+}
+
+// Sprite rows [y0, y1) masked by 'clip'; sprite and buffer rows both run
+// bottom-up, so source and destination advance together
+template<typename Pixel>
+void blit_sprite_rows(
+    Pixel* dst, size_t stride, const Sprite& sprite,
+    size_t y0, size_t y1, uint64_t clip, size_t x0, Pixel value)
+{
+    for(size_t yi = y0; yi < y1; ++yi, dst += stride)
+    {
+        blit_spans(dst, (sprite_row(sprite, yi) & clip) >> x0, value);
+    }
+}
+
+/*
+    Fixed-size sprite kernels. Every built-in sprite has one of a handful
+    of sizes, so an unclipped sprite of one of those sizes is drawn by a
+    kernel compiled for it: both loops have constant trip counts and are
+    unrolled, and each row is a straight select between the color and the
+    pixel already there, with no bit scans or branches on the mask. Any
+    other size, and any clipped sprite, takes the generic span loop.
+*/
+template<size_t W, size_t H, typename Pixel>
+void blit_fixed_sprite(Pixel* dst, size_t stride, const void* rows, Pixel value)
+{
+    const SpriteRow<W>* row = static_cast<const SpriteRow<W>*>(rows);
+    for(size_t yi = 0; yi < H; ++yi, dst += stride)
+    {
+        uint64_t mask = row[yi];
+        for(size_t xi = 0; xi < W; ++xi) dst[xi] = (mask >> xi) & 1 ? value : dst[xi];
+    }
+}
+
+struct FixedSpriteKernel
+{
+    size_t width, height;
+    void (*rgba)(uint32_t* dst, size_t stride, const void* rows, uint32_t value);
+    void (*rgb565)(uint16_t* dst, size_t stride, const void* rows, uint16_t value);
+    void (*indexed)(uint8_t* dst, size_t stride, const void* rows, uint8_t value);
+
+    void operator()(uint32_t* dst, size_t stride, const void* rows, uint32_t value) const { rgba(dst, stride, rows, value); }
+    void operator()(uint16_t* dst, size_t stride, const void* rows, uint16_t value) const { rgb565(dst, stride, rows, value); }
+    void operator()(uint8_t* dst, size_t stride, const void* rows, uint8_t value) const { indexed(dst, stride, rows, value); }
+};
+
+#define FIXED_SPRITE_KERNEL(W, H) \
+    {W, H, blit_fixed_sprite<W, H, uint32_t>, blit_fixed_sprite<W, H, uint16_t>, blit_fixed_sprite<W, H, uint8_t>}
+
+// The aliens, their death, the player, shots, muzzle flash and glyphs
+const FixedSpriteKernel fixed_sprite_kernels[] = {
+    FIXED_SPRITE_KERNEL(11, 8), FIXED_SPRITE_KERNEL(8, 8), FIXED_SPRITE_KERNEL(12, 8),
+    FIXED_SPRITE_KERNEL(13, 7), FIXED_SPRITE_KERNEL(11, 7), FIXED_SPRITE_KERNEL(1, 3),
+    FIXED_SPRITE_KERNEL(3, 2), FIXED_SPRITE_KERNEL(5, 7),
+};
+
+// 0 when no kernel was compiled for the sprite's size and row type
+inline const FixedSpriteKernel* find_fixed_sprite_kernel(const Sprite& sprite)
+{
+    // Every fixed size packs into 16-bit rows
+    if(sprite.row_bits != 16) return 0;
+    for(const FixedSpriteKernel& kernel: fixed_sprite_kernels)
+    {
+        if(kernel.width == sprite.width && kernel.height == sprite.height) return &kernel;
+    }
+    return 0;
+}
+
+// Clip the sprite rectangle once, then walk rows bottom to top
+void draw_sprite_buffer(
+    Buffer* buffer, const Sprite& sprite, size_t x, size_t y, Color color
+){
+    if(buffer->gpu)
+    {
+        gpu_batch_sprite(buffer->gpu, sprite, x, y, 1, color.rgba);
+        return;
+    }
+    if(buffer->draw_list)
+    {
+        record_draw(buffer, DrawCommand{DRAW_SPRITE, sprite, 0, 0, x, y, 1, color});
+        return;
+    }
+
+    ptrdiff_t left = (ptrdiff_t)x;
+    ptrdiff_t bottom = (ptrdiff_t)y;
+    ptrdiff_t bw = (ptrdiff_t)buffer->width;
+    ptrdiff_t bh = (ptrdiff_t)buffer->height;
+
+    if(left >= bw || left + (ptrdiff_t)sprite.width <= 0) return;
+    if(bottom >= bh || bottom + (ptrdiff_t)sprite.height <= 0) return;
+
+    size_t x0 = left < 0 ? (size_t)-left : 0;
+    size_t x1 = left + (ptrdiff_t)sprite.width > bw ? (size_t)(bw - left) : sprite.width;
+    size_t y0 = bottom < 0 ? (size_t)-bottom : 0;
+    size_t y1 = bottom + (ptrdiff_t)sprite.height > bh ? (size_t)(bh - bottom) : sprite.height;
+
+    mark_dirty(buffer, Rect{(size_t)(left + (ptrdiff_t)x0), (size_t)(bottom + (ptrdiff_t)y0), x1 - x0, y1 - y0});
+
+    uint64_t clip = (x1 - x0 < 64 ? (uint64_t(1) << (x1 - x0)) - 1 : ~uint64_t(0)) << x0;
+    size_t offset = (size_t)(bottom + (ptrdiff_t)y0) * buffer->width + (size_t)(left + (ptrdiff_t)x0);
+    uint32_t value = buffer_pixel_value(buffer, color);
+
+    const FixedSpriteKernel* kernel = x1 - x0 == sprite.width && y1 - y0 == sprite.height ? find_fixed_sprite_kernel(sprite) : 0;
+    with_buffer_pixels(buffer, value, [&](auto* pixels, auto pixel)
+    {
+        if(kernel) (*kernel)(pixels + offset, buffer->width, sprite.rows, pixel);
+        else blit_sprite_rows(pixels + offset, buffer->width, sprite, y0, y1, clip, x0, pixel);
+    });
+}
+
+template<typename Pixel>
+void fill_stamp(Pixel* pixels, Pixel* mask, const Sprite& sprite, Pixel value)
+{
+    for(size_t yi = 0; yi < sprite.height; ++yi)
+    {
+        uint64_t bits = sprite_row(sprite, yi);
+        for(size_t xi = 0; xi < sprite.width; ++xi, ++pixels, ++mask)
+        {
+            *mask = (bits >> xi) & 1 ? (Pixel)~Pixel(0) : 0;
+            *pixels = value & *mask;
+        }
+    }
+}
+
+void make_sprite_stamp(SpriteStamp* stamp, const Buffer& buffer, const Sprite& sprite, Color color)
+{
+    stamp->sprite = sprite;
+    stamp->color = color;
+    stamp->format = buffer.format;
+    stamp->valid = sprite.width * sprite.height <= STAMP_MAX_PIXELS;
+    if(!stamp->valid) return;
+
+    uint32_t value = buffer_pixel_value(&buffer, color);
+    switch(buffer.format)
+    {
+        case PIXEL_INDEXED8: fill_stamp(stamp->pixels, stamp->mask, sprite, (uint8_t)value); break;
+        case PIXEL_RGB565: fill_stamp((uint16_t*)stamp->pixels, (uint16_t*)stamp->mask, sprite, (uint16_t)value); break;
+        default: fill_stamp((uint32_t*)stamp->pixels, (uint32_t*)stamp->mask, sprite, value); break;
+    }
+}
+
+template<typename Pixel>
+void blit_stamp_rows(Pixel* dst, size_t stride, const Pixel* pixels, const Pixel* mask, size_t width, size_t height)
+{
+    for(size_t yi = 0; yi < height; ++yi, dst += stride, pixels += width, mask += width)
+    {
+        for(size_t xi = 0; xi < width; ++xi) dst[xi] = (dst[xi] & ~mask[xi]) | pixels[xi];
+    }
+}
+
+// The alien widths, with the row loop unrolled at compile time
+template<size_t W, typename Pixel>
+void blit_stamp_fixed(Pixel* dst, size_t stride, const Pixel* pixels, const Pixel* mask, size_t height)
+{
+    for(size_t yi = 0; yi < height; ++yi, dst += stride, pixels += W, mask += W)
+    {
+        for(size_t xi = 0; xi < W; ++xi) dst[xi] = (dst[xi] & ~mask[xi]) | pixels[xi];
+    }
+}
+
+template<typename Pixel>
+void blit_stamp(Pixel* dst, size_t stride, const Pixel* pixels, const Pixel* mask, size_t width, size_t height)
+{
+    switch(width)
+    {
+        case 8: blit_stamp_fixed<8>(dst, stride, pixels, mask, height); break;
+        case 11: blit_stamp_fixed<11>(dst, stride, pixels, mask, height); break;
+        case 12: blit_stamp_fixed<12>(dst, stride, pixels, mask, height); break;
+        default: blit_stamp_rows(dst, stride, pixels, mask, width, height); break;
+    }
+}
+
+void draw_stamp_buffer(Buffer* buffer, const SpriteStamp& stamp, size_t x, size_t y)
+{
+    const Sprite& sprite = stamp.sprite;
+    bool inside = sprite.width <= buffer->width && x <= buffer->width - sprite.width &&
+                  sprite.height <= buffer->height && y <= buffer->height - sprite.height;
+    if(!stamp.valid || !inside || stamp.format != buffer->format || buffer->gpu || buffer->draw_list)
+    {
+        draw_sprite_buffer(buffer, sprite, x, y, stamp.color);
+        return;
+    }
+
+    mark_dirty(buffer, Rect{x, y, sprite.width, sprite.height});
+    size_t offset = y * buffer->width + x;
+    with_buffer_pixels(buffer, 0, [&](auto* pixels, auto pixel)
+    {
+        using Pixel = decltype(pixel);
+        blit_stamp(pixels + offset, buffer->width, (const Pixel*)stamp.pixels, (const Pixel*)stamp.mask, sprite.width, sprite.height);
+    });
+}
+
+/*
+################################################
+##               CLEAR KERNELS                ##
+################################################
+*/
+
+#define FILL_STREAM_THRESHOLD (256 * 1024 / sizeof(uint32_t))
+
+void fill_pixels_scalar(uint32_t* dst, size_t count, uint32_t color)
+{
+    for(size_t i = 0; i < count; ++i) dst[i] = color;
+}
+#if defined(HAVE_X86_SIMD)
+void fill_pixels_sse2(uint32_t* dst, size_t count, uint32_t color)
+{
+    size_t i = 0;
+    for(; i < count && ((uintptr_t)(dst + i) & 15); ++i) dst[i] = color;
+
+    __m128i v = _mm_set1_epi32((int)color);
+    if(count >= FILL_STREAM_THRESHOLD)
+    {
+        for(; i + 4 <= count; i += 4) _mm_stream_si128((__m128i*)(dst + i), v);
+        _mm_sfence();
+    }
+    else
+    {
+        for(; i + 4 <= count; i += 4) _mm_store_si128((__m128i*)(dst + i), v);
+    }
+
+    for(; i < count; ++i) dst[i] = color;
+}
+
+TARGET_AVX2 void fill_pixels_avx2(uint32_t* dst, size_t count, uint32_t color)
+{
+    size_t i = 0;
+    for(; i < count && ((uintptr_t)(dst + i) & 31); ++i) dst[i] = color;
+
+    __m256i v = _mm256_set1_epi32((int)color);
+    if(count >= FILL_STREAM_THRESHOLD)
+    {
+        for(; i + 8 <= count; i += 8) _mm256_stream_si256((__m256i*)(dst + i), v);
+        _mm_sfence();
+    }
+    else
+    {
+        for(; i + 8 <= count; i += 8) _mm256_store_si256((__m256i*)(dst + i), v);
+    }
+
+    for(; i < count; ++i) dst[i] = color;
+}
+#endif
+#if defined(HAVE_NEON_SIMD)
+void fill_pixels_neon(uint32_t* dst, size_t count, uint32_t color)
+{
+    uint32x4_t v = vdupq_n_u32(color);
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        vst1q_u32(dst + i, v);
+        vst1q_u32(dst + i + 4, v);
+    }
+    for(; i < count; ++i) dst[i] = color;
+}
+#endif
+
+void (*fill_pixels)(uint32_t* dst, size_t count, uint32_t color) = fill_pixels_scalar;
+const char* fill_kernel_name = "scalar";
+
+void init_fill_kernels(bool simd)
+{
+    fill_pixels = fill_pixels_scalar;
+    fill_kernel_name = "scalar";
+    if(!simd) return;
+#if defined(HAVE_X86_SIMD)
+    fill_pixels = fill_pixels_sse2;
+    fill_kernel_name = "sse2";
+    if(cpu_has_avx2())
+    {
+        fill_pixels = fill_pixels_avx2;
+        fill_kernel_name = "avx2";
+    }
+#elif defined(HAVE_NEON_SIMD)
+    fill_pixels = fill_pixels_neon;
+    fill_kernel_name = "neon";
+#endif
+}
+
+// Pairs of 16-bit pixels go through the 32-bit kernel, with any odd pixel
+// at either end written on its own
+inline void fill_pixels16(uint16_t* dst, size_t count, uint16_t value)
+{
+    if(count && ((uintptr_t)dst & 2))
+    {
+        *dst++ = value;
+        --count;
+    }
+    fill_pixels((uint32_t*)dst, count / 2, value * 0x10001u);
+    if(count & 1) dst[count - 1] = value;
+}
+
+// Fill 'count' pixels starting at pixel 'offset' with a resolved pixel value
+inline void fill_buffer_pixels(Buffer* buffer, size_t offset, size_t count, uint32_t value)
+{
+    switch(buffer->format)
+    {
+        case PIXEL_INDEXED8: memset(buffer->indices + offset, (int)value, count); break;
+        case PIXEL_RGB565: fill_pixels16(buffer->data16 + offset, count, (uint16_t)value); break;
+        default: fill_pixels(buffer->data + offset, count, value); break;
+    }
+}
+
+void clear_buffer(Buffer* buffer, Color color)
+{
+    reset_text_list(buffer);
+    if(buffer->gpu)
+    {
+        buffer->gpu->clear_pending = true;
+        buffer->gpu->clear_color = color.rgba;
+        return;
+    }
+    if(buffer->draw_list)
+    {
+        buffer->draw_list->num_commands = 0;
+        record_draw(buffer, DrawCommand{DRAW_CLEAR, Sprite{}, 0, 0, 0, 0, 1, color});
+        return;
+    }
+
+    fill_buffer_pixels(buffer, 0, buffer->width * buffer->height, buffer_pixel_value(buffer, color));
+    buffer->num_dirty = 0;
+    mark_dirty(buffer, Rect{0, 0, buffer->width, buffer->height});
+}
+
+// Clear only the given rectangles, clipped to the buffer
+void clear_buffer_regions(Buffer* buffer, const Rect* regions, size_t num_regions, Color color)
+{
+    uint32_t value = buffer_pixel_value(buffer, color);
+    for(size_t ri = 0; ri < num_regions; ++ri)
+    {
+        const Rect& r = regions[ri];
+        if(r.x >= buffer->width || r.y >= buffer->height) continue;
+        size_t w = buffer->width - r.x < r.width ? buffer->width - r.x : r.width;
+        size_t h = buffer->height - r.y < r.height ? buffer->height - r.y : r.height;
+
+        size_t row = r.y * buffer->width + r.x;
+        for(size_t yi = 0; yi < h; ++yi, row += buffer->width)
+        {
+            fill_buffer_pixels(buffer, row, w, value);
+        }
+        mark_dirty(buffer, Rect{r.x, r.y, w, h});
+    }
+}
+
+// Erase only what the previous frame drew. upload_buffer() already sends
+// those rectangles, so they are not marked dirty again.
+void clear_buffer_dirty(Buffer* buffer, Color color)
+{
+    if(buffer->gpu)
+    {
+        clear_buffer(buffer, color);
+        return;
+    }
+    reset_text_list(buffer);
+
+    uint32_t value = buffer_pixel_value(buffer, color);
+    for(size_t ri = 0; ri < buffer->num_prev_dirty; ++ri)
+    {
+        const Rect& r = buffer->prev_dirty[ri];
+        size_t row = r.y * buffer->width + r.x;
+        for(size_t yi = 0; yi < r.height; ++yi, row += buffer->width)
+        {
+            fill_buffer_pixels(buffer, row, r.width, value);
+        }
+    }
+}
+
+/*
+################################################
+##               BLEND KERNELS                ##
+################################################
+*/
+
+// Per-draw constants of a blend, one entry per byte of a 32-bit pixel or
+// per RGB565 channel from blue up. BLEND_ALPHA and BLEND_MULTIPLY turn a
+// channel c into x = c * scale + bias, then (x + (x >> 8)) >> 8, a
+// rounded division by 255 that stays within 16 bits; BLEND_ADD adds bias
+// and saturates at limit, the channel's maximum.
+struct BlendTerms
+{
+    BlendMode mode;
+    uint16_t scale[4];
+    uint16_t bias[4];
+    uint16_t limit[4];
+};
+
+inline uint32_t div255_round(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// 'tint' is one channel at the depth 'limit' is the maximum of
+void set_blend_channel(BlendTerms* terms, size_t ci, uint32_t tint, uint32_t limit, uint32_t alpha)
+{
+    terms->limit[ci] = (uint16_t)limit;
+    switch(terms->mode)
+    {
+        case BLEND_ADD:
+            terms->scale[ci] = 255;
+            terms->bias[ci] = (uint16_t)div255_round(tint * alpha);
+            break;
+        case BLEND_MULTIPLY:
+        {
+            uint32_t factor = (tint * 255 + limit / 2) / limit;
+            terms->scale[ci] = (uint16_t)(255 - div255_round((255 - factor) * alpha));
+            terms->bias[ci] = 128;
+            break;
+        }
+        default:
+            terms->scale[ci] = (uint16_t)(255 - alpha);
+            terms->bias[ci] = (uint16_t)(tint * alpha + 128);
+            break;
+    }
+}
+
+BlendTerms make_blend_terms(PixelFormat format, Color tint, BlendMode mode, uint8_t alpha)
+{
+    BlendTerms terms = {};
+    terms.mode = mode;
+    if(format == PIXEL_RGB565)
+    {
+        set_blend_channel(&terms, 0, tint.rgba & 31, 31, alpha);
+        set_blend_channel(&terms, 1, (tint.rgba >> 5) & 63, 63, alpha);
+        set_blend_channel(&terms, 2, (tint.rgba >> 11) & 31, 31, alpha);
+        return terms;
+    }
+    for(size_t ci = 0; ci < 4; ++ci) set_blend_channel(&terms, ci, (tint.rgba >> (8 * ci)) & 255, 255, alpha);
+    return terms;
+}
+
+// The four 16-bit terms packed as one 64-bit lane pattern
+inline uint64_t pack_blend_terms(const uint16_t* terms)
+{
+    return terms[0] | (uint64_t)terms[1] << 16 | (uint64_t)terms[2] << 32 | (uint64_t)terms[3] << 48;
+}
+
+// BLEND_ADD biases fit a byte each, so they saturate whole pixels at once
+inline uint32_t pack_blend_bytes(const uint16_t* terms)
+{
+    return terms[0] | (uint32_t)terms[1] << 8 | (uint32_t)terms[2] << 16 | (uint32_t)terms[3] << 24;
+}
+
+inline uint32_t blend_channel(uint32_t value, const BlendTerms& terms, size_t ci)
+{
+    if(terms.mode == BLEND_ADD)
+    {
+        uint32_t sum = value + terms.bias[ci];
+        return sum < terms.limit[ci] ? sum : terms.limit[ci];
+    }
+    uint32_t x = value * terms.scale[ci] + terms.bias[ci];
+    return (x + (x >> 8)) >> 8;
+}
+
+const unsigned rgb565_shifts[3] = {0, 5, 11};
+
+// A blended draw clipped to its buffer: sprite rows [y0, y1) masked by
+// 'clip' and shifted down by x0, so bit 0 lands on the first drawn pixel
+struct BlendDraw
+{
+    const Sprite* sprite;
+    size_t y0, y1, x0;
+    uint64_t clip;
+    // Pixels from the first drawn one to the end of its buffer row
+    size_t room;
+    BlendTerms terms;
+};
+
+// Hands the draw's rows to 'step' 8 pixels and 8 mask bits at a time,
+// skipping steps with no bits set. A step may run past the sprite into
+// pixels it leaves as they are, but not past the buffer row: a last step
+// that would works on a copy.
+template<typename Pixel, typename Step>
+inline void blend_sprite_rows(Pixel* dst, size_t stride, const BlendDraw& draw, const Step& step)
+{
+    uint64_t columns = draw.clip >> draw.x0;
+    size_t count = ~columns ? count_trailing_zeros(~columns) : 64;
+    for(size_t yi = draw.y0; yi < draw.y1; ++yi, dst += stride)
+    {
+        uint64_t mask = (sprite_row(*draw.sprite, yi) & draw.clip) >> draw.x0;
+        for(size_t i = 0; i < count && mask; i += 8, mask >>= 8)
+        {
+            unsigned bits = (unsigned)mask & 0xFF;
+            if(!bits) continue;
+            if(i + 8 <= draw.room)
+            {
+                step(dst + i, bits);
+                continue;
+            }
+
+            size_t rest = draw.room - i;
+            Pixel pixels[8] = {};
+            for(size_t k = 0; k < rest; ++k) pixels[k] = dst[i + k];
+            step(pixels, bits);
+            for(size_t k = 0; k < rest; ++k) dst[i + k] = pixels[k];
+        }
+    }
+}
+
+struct BlendStepScalar
+{
+    const BlendTerms& terms;
+
+    void operator()(uint32_t* pixels, unsigned bits) const
+    {
+        for(; bits; bits &= bits - 1)
+        {
+            uint32_t* pixel = pixels + count_trailing_zeros(bits), out = 0;
+            for(size_t ci = 0; ci < 4; ++ci) out |= blend_channel((*pixel >> (8 * ci)) & 255, terms, ci) << (8 * ci);
+            *pixel = out;
+        }
+    }
+
+    void operator()(uint16_t* pixels, unsigned bits) const
+    {
+        for(; bits; bits &= bits - 1)
+        {
+            uint16_t* pixel = pixels + count_trailing_zeros(bits);
+            uint32_t out = 0;
+            for(size_t ci = 0; ci < 3; ++ci) out |= blend_channel((*pixel >> rgb565_shifts[ci]) & terms.limit[ci], terms, ci) << rgb565_shifts[ci];
+            *pixel = (uint16_t)out;
+        }
+    }
+};
+
+void blend_pixels_scalar(uint32_t* dst, size_t stride, const BlendDraw& draw)
+{
+    blend_sprite_rows(dst, stride, draw, BlendStepScalar{draw.terms});
+}
+
+void blend_pixels16_scalar(uint16_t* dst, size_t stride, const BlendDraw& draw)
+{
+    blend_sprite_rows(dst, stride, draw, BlendStepScalar{draw.terms});
+}
+#if defined(HAVE_X86_SIMD)
+struct BlendStepSse2
+{
+    __m128i bit, scale, bias, add;
+    bool additive;
+
+    // Four 32-bit pixels through the multiply and add, a byte per 16-bit lane
+    __m128i scaled(__m128i pixels) const
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), scale), bias);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), scale), bias);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    void operator()(uint32_t* pixels, unsigned bits) const
+    {
+        for(size_t half = 0; half < 8; half += 4)
+        {
+            __m128i p = _mm_loadu_si128((const __m128i*)(pixels + half));
+            __m128i blended = additive ? _mm_adds_epu8(p, add) : scaled(p);
+            __m128i select = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)(bits >> half)), bit), bit);
+            _mm_storeu_si128((__m128i*)(pixels + half), _mm_or_si128(_mm_and_si128(select, blended), _mm_andnot_si128(select, p)));
+        }
+    }
+};
+
+void blend_pixels_sse2(uint32_t* dst, size_t stride, const BlendDraw& draw)
+{
+    const BlendTerms& terms = draw.terms;
+    BlendStepSse2 step = {
+        _mm_setr_epi32(1, 2, 4, 8), _mm_set1_epi64x((long long)pack_blend_terms(terms.scale)),
+        _mm_set1_epi64x((long long)pack_blend_terms(terms.bias)), _mm_set1_epi32((int)pack_blend_bytes(terms.bias)),
+        terms.mode == BLEND_ADD
+    };
+    blend_sprite_rows(dst, stride, draw, step);
+}
+
+// Eight RGB565 pixels fill one register, so AVX2 has nothing wider to offer
+struct BlendStep16Sse2
+{
+    __m128i bit, scale[3], bias[3], limit[3];
+    bool additive;
+
+    void operator()(uint16_t* pixels, unsigned bits) const
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)pixels);
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), limit[1]);
+        __m128i b = _mm_and_si128(p, limit[0]);
+        __m128i* channels[3] = {&b, &g, &r};
+        for(size_t ci = 0; ci < 3; ++ci)
+        {
+            __m128i c = *channels[ci];
+            if(additive) c = _mm_min_epi16(_mm_add_epi16(c, bias[ci]), limit[ci]);
+            else
+            {
+                c = _mm_add_epi16(_mm_mullo_epi16(c, scale[ci]), bias[ci]);
+                c = _mm_srli_epi16(_mm_add_epi16(c, _mm_srli_epi16(c, 8)), 8);
+            }
+            *channels[ci] = c;
+        }
+        __m128i blended = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+        __m128i select = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16((short)bits), bit), bit);
+        _mm_storeu_si128((__m128i*)pixels, _mm_or_si128(_mm_and_si128(select, blended), _mm_andnot_si128(select, p)));
+    }
+};
+
+void blend_pixels16_sse2(uint16_t* dst, size_t stride, const BlendDraw& draw)
+{
+    const BlendTerms& terms = draw.terms;
+    BlendStep16Sse2 step;
+    step.bit = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+    for(size_t ci = 0; ci < 3; ++ci)
+    {
+        step.scale[ci] = _mm_set1_epi16((short)terms.scale[ci]);
+        step.bias[ci] = _mm_set1_epi16((short)terms.bias[ci]);
+        step.limit[ci] = _mm_set1_epi16((short)terms.limit[ci]);
+    }
+    step.additive = terms.mode == BLEND_ADD;
+    blend_sprite_rows(dst, stride, draw, step);
+}
+
+struct BlendStepAvx2
+{
+    __m256i bit, scale, bias, add;
+    bool additive;
+
+    TARGET_AVX2 void operator()(uint32_t* pixels, unsigned bits) const
+    {
+        __m256i p = _mm256_loadu_si256((const __m256i*)pixels);
+        __m256i blended;
+        if(additive) blended = _mm256_adds_epu8(p, add);
+        else
+        {
+            // Unpacking and packing both stay within 128-bit lanes, so the
+            // pixels come back in order
+            __m256i zero = _mm256_setzero_si256();
+            __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero), scale), bias);
+            __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero), scale), bias);
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+            blended = _mm256_packus_epi16(lo, hi);
+        }
+        __m256i select = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)bits), bit), bit);
+        _mm256_storeu_si256((__m256i*)pixels, _mm256_blendv_epi8(p, blended, select));
+    }
+};
+
+TARGET_AVX2_FLATTEN void blend_pixels_avx2(uint32_t* dst, size_t stride, const BlendDraw& draw)
+{
+    const BlendTerms& terms = draw.terms;
+    BlendStepAvx2 step = {
+        _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128), _mm256_set1_epi64x((long long)pack_blend_terms(terms.scale)),
+        _mm256_set1_epi64x((long long)pack_blend_terms(terms.bias)), _mm256_set1_epi32((int)pack_blend_bytes(terms.bias)),
+        terms.mode == BLEND_ADD
+    };
+    blend_sprite_rows(dst, stride, draw, step);
+}
+#elif defined(HAVE_NEON_SIMD)
+struct BlendStepNeon
+{
+    uint32x4_t bit;
+    // Two pixels' worth of scales, as bytes for the widening multiply
+    uint8x8_t scale;
+    uint16x8_t bias;
+    uint8x16_t add;
+    bool additive;
+
+    void operator()(uint32_t* pixels, unsigned bits) const
+    {
+        for(size_t half = 0; half < 8; half += 4)
+        {
+            uint32x4_t p = vld1q_u32(pixels + half);
+            uint8x16_t bytes = vreinterpretq_u8_u32(p);
+            uint8x16_t blended;
+            if(additive) blended = vqaddq_u8(bytes, add);
+            else
+            {
+                uint16x8_t lo = vmlal_u8(bias, vget_low_u8(bytes), scale);
+                uint16x8_t hi = vmlal_u8(bias, vget_high_u8(bytes), scale);
+                blended = vcombine_u8(vshrn_n_u16(vsraq_n_u16(lo, lo, 8), 8), vshrn_n_u16(vsraq_n_u16(hi, hi, 8), 8));
+            }
+            uint32x4_t select = vtstq_u32(vdupq_n_u32(bits >> half), bit);
+            vst1q_u32(pixels + half, vbslq_u32(select, vreinterpretq_u32_u8(blended), p));
+        }
+    }
+};
+
+void blend_pixels_neon(uint32_t* dst, size_t stride, const BlendDraw& draw)
+{
+    const BlendTerms& terms = draw.terms;
+    static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    BlendStepNeon step = {
+        vld1q_u32(lane_bits), vmovn_u16(vreinterpretq_u16_u64(vdupq_n_u64(pack_blend_terms(terms.scale)))),
+        vreinterpretq_u16_u64(vdupq_n_u64(pack_blend_terms(terms.bias))), vreinterpretq_u8_u32(vdupq_n_u32(pack_blend_bytes(terms.bias))),
+        terms.mode == BLEND_ADD
+    };
+    blend_sprite_rows(dst, stride, draw, step);
+}
+
+struct BlendStep16Neon
+{
+    uint16x8_t bit, scale[3], bias[3], limit[3];
+    bool additive;
+
+    void operator()(uint16_t* pixels, unsigned bits) const
+    {
+        uint16x8_t p = vld1q_u16(pixels);
+        uint16x8_t r = vshrq_n_u16(p, 11);
+        uint16x8_t g = vandq_u16(vshrq_n_u16(p, 5), limit[1]);
+        uint16x8_t b = vandq_u16(p, limit[0]);
+        uint16x8_t* channels[3] = {&b, &g, &r};
+        for(size_t ci = 0; ci < 3; ++ci)
+        {
+            uint16x8_t c = *channels[ci];
+            if(additive) c = vminq_u16(vaddq_u16(c, bias[ci]), limit[ci]);
+            else
+            {
+                c = vmlaq_u16(bias[ci], c, scale[ci]);
+                c = vshrq_n_u16(vsraq_n_u16(c, c, 8), 8);
+            }
+            *channels[ci] = c;
+        }
+        uint16x8_t blended = vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b);
+        uint16x8_t select = vtstq_u16(vdupq_n_u16((uint16_t)bits), bit);
+        vst1q_u16(pixels, vbslq_u16(select, blended, p));
+    }
+};
+
+void blend_pixels16_neon(uint16_t* dst, size_t stride, const BlendDraw& draw)
+{
+    const BlendTerms& terms = draw.terms;
+    static const uint16_t lane_bits[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    BlendStep16Neon step;
+    step.bit = vld1q_u16(lane_bits);
+    for(size_t ci = 0; ci < 3; ++ci)
+    {
+        step.scale[ci] = vdupq_n_u16(terms.scale[ci]);
+        step.bias[ci] = vdupq_n_u16(terms.bias[ci]);
+        step.limit[ci] = vdupq_n_u16(terms.limit[ci]);
+    }
+    step.additive = terms.mode == BLEND_ADD;
+    blend_sprite_rows(dst, stride, draw, step);
+}
+#endif
+
+void (*blend_pixels)(
+    uint32_t* dst, size_t stride, const BlendDraw& draw
+) = blend_pixels_scalar;
+void (*blend_pixels16)(
+    uint16_t* dst, size_t stride, const BlendDraw& draw
+) = blend_pixels16_scalar;
+const char* blend_kernel_name = "scalar";
+
+void init_blend_kernels(bool simd)
+{
+    blend_pixels = blend_pixels_scalar;
+    blend_pixels16 = blend_pixels16_scalar;
+    blend_kernel_name = "scalar";
+    if(!simd) return;
+#if defined(HAVE_X86_SIMD)
+    blend_pixels = blend_pixels_sse2;
+    blend_pixels16 = blend_pixels16_sse2;
+    blend_kernel_name = "sse2";
+    if(cpu_has_avx2())
+    {
+        blend_pixels = blend_pixels_avx2;
+        blend_kernel_name = "avx2";
+    }
+#elif defined(HAVE_NEON_SIMD)
+    blend_pixels = blend_pixels_neon;
+    blend_pixels16 = blend_pixels16_neon;
+    blend_kernel_name = "neon";
+#endif
+}
+
+void draw_sprite_blended(Buffer* buffer, const Sprite& sprite, size_t x, size_t y, Color tint, BlendMode mode, uint8_t alpha)
+{
+    // Every mode leaves the pixels alone at zero alpha
+    if(mode != BLEND_OPAQUE && !alpha) return;
+    bool indexed = buffer->format == PIXEL_INDEXED8 && !buffer->gpu;
+    if(indexed && alpha < 128) return;
+    if(mode == BLEND_OPAQUE || (mode == BLEND_ALPHA && alpha == 255) || indexed || buffer->gpu)
+    {
+        draw_sprite_buffer(buffer, sprite, x, y, tint);
+        return;
+    }
+    if(buffer->draw_list)
+    {
+        record_draw(buffer, DrawCommand{DRAW_BLEND, sprite, 0, 0, x, y, 1, tint, mode, alpha});
+        return;
+    }
+
+    ptrdiff_t left = (ptrdiff_t)x;
+    ptrdiff_t bottom = (ptrdiff_t)y;
+    ptrdiff_t bw = (ptrdiff_t)buffer->width;
+    ptrdiff_t bh = (ptrdiff_t)buffer->height;
+
+    if(left >= bw || left + (ptrdiff_t)sprite.width <= 0) return;
+    if(bottom >= bh || bottom + (ptrdiff_t)sprite.height <= 0) return;
+
+    size_t x0 = left < 0 ? (size_t)-left : 0;
+    size_t x1 = left + (ptrdiff_t)sprite.width > bw ? (size_t)(bw - left) : sprite.width;
+    size_t y0 = bottom < 0 ? (size_t)-bottom : 0;
+    size_t y1 = bottom + (ptrdiff_t)sprite.height > bh ? (size_t)(bh - bottom) : sprite.height;
+
+    mark_dirty(buffer, Rect{(size_t)(left + (ptrdiff_t)x0), (size_t)(bottom + (ptrdiff_t)y0), x1 - x0, y1 - y0});
+
+    uint64_t clip = (x1 - x0 < 64 ? (uint64_t(1) << (x1 - x0)) - 1 : ~uint64_t(0)) << x0;
+    size_t column = (size_t)(left + (ptrdiff_t)x0);
+    size_t offset = (size_t)(bottom + (ptrdiff_t)y0) * buffer->width + column;
+    BlendDraw draw = {&sprite, y0, y1, x0, clip, buffer->width - column, make_blend_terms(buffer->format, tint, mode, alpha)};
+    if(buffer->format == PIXEL_RGB565) blend_pixels16(buffer->data16 + offset, buffer->width, draw);
+    else blend_pixels(buffer->data + offset, buffer->width, draw);
+}
+
+/*
+################################################
+##                   LAYERS                   ##
+################################################
+*/
+
+// Everything but the pixels
+static void describe_layer(Layer* layer, const Buffer& target, Color clear)
+{
+    layer->buffer = Buffer{};
+    layer->buffer.width = target.width;
+    layer->buffer.height = target.height;
+    layer->buffer.format = target.format;
+    layer->buffer.palette = target.palette;
+    layer->clear = clear;
+    layer->opaque = buffer_pixel_value(&target, clear) != buffer_pixel_value(&target, layer_transparent);
+    layer->valid = false;
+    layer->redrawn = false;
+    layer->appended = false;
+}
+
+void init_layer(Layer* layer, const Buffer& target, Color clear)
+{
+    describe_layer(layer, target, clear);
+    set_buffer_pixels(&layer->buffer, (uint8_t*)alloc_pages(target.width * target.height * buffer_pixel_size(target)));
+    clear_buffer(&layer->buffer, clear);
+    layer->buffer.num_dirty = 0;
+}
+
+void destroy_layer(Layer* layer)
+{
+    free_pages(buffer_pixels(layer->buffer));
+    set_buffer_pixels(&layer->buffer, 0);
+    layer->valid = false;
+}
+
+// Plain stores rather than the clear kernels, which the frame loop may
+// switch meanwhile
+static void load_layer_pixels(LayerLoader* loader, size_t pixel_size)
+{
+    size_t count = loader->size / pixel_size;
+    for(size_t li = 0; li < loader->num_layers; ++li)
+    {
+        uint8_t* pixels = (uint8_t*)alloc_pages(loader->size);
+        uint32_t value = loader->values[li];
+        if(pixel_size == 4) std::fill_n((uint32_t*)pixels, count, value);
+        else if(pixel_size == 2) std::fill_n((uint16_t*)pixels, count, (uint16_t)value);
+        else if(value) memset(pixels, (int)value, count);
+        loader->pixels[li] = pixels;
+    }
+    loader->ready = glfwGetTime();
+}
+
+void start_layer_loader(LayerLoader* loader, Layer* layers, const Color* clears, size_t num_layers, const Buffer& target)
+{
+    loader->layers = layers;
+    loader->num_layers = num_layers;
+    loader->size = target.width * target.height * buffer_pixel_size(target);
+    for(size_t li = 0; li < num_layers; ++li)
+    {
+        describe_layer(&layers[li], target, clears[li]);
+        loader->values[li] = buffer_pixel_value(&target, clears[li]);
+    }
+    loader->pending = true;
+    loader->start = glfwGetTime();
+    loader->thread = std::thread(load_layer_pixels, loader, buffer_pixel_size(target));
+}
+
+void finish_layer_loader(LayerLoader* loader)
+{
+    if(!loader || !loader->pending) return;
+    double wait_start = glfwGetTime();
+    loader->thread.join();
+    double waited = glfwGetTime() - wait_start;
+    for(size_t li = 0; li < loader->num_layers; ++li)
+    {
+        set_buffer_pixels(&loader->layers[li].buffer, loader->pixels[li]);
+        loader->layers[li].buffer.num_dirty = 0;
+    }
+    loader->pending = false;
+    printf(
+        "Game layers: loaded in %.2f ms behind the title, the first game frame waited %.2f ms\n",
+        (loader->ready - loader->start) * 1000.0, waited * 1000.0
+    );
+}
+
+inline void invalidate_layer(Layer* layer)
+{
+    layer->valid = false;
+}
+
+template<typename Pixel>
+void patch_rows(Pixel* pixels, size_t stride, const Sprite& bitmap, size_t x, size_t y, uint64_t rows, Pixel set, Pixel clear)
+{
+    for(; rows; rows &= rows - 1)
+    {
+        size_t yi = count_trailing_zeros(rows);
+        Pixel* row = pixels + (y + yi) * stride + x;
+        uint64_t bits = sprite_row(bitmap, yi);
+        for(size_t xi = 0; xi < bitmap.width; ++xi) row[xi] = (bits >> xi) & 1 ? set : clear;
+    }
+}
+
+// Rewrite the rows of 'bitmap' set in 'rows' over the copy of it a valid
+// layer already holds at (x, y): set bits become 'color' and clear ones
+// the layer's clear color. Only those rows become damage on the frame,
+// the layer's own dirty rectangles already cover the bitmap.
+void patch_layer_rows(Buffer* frame, Layer* layer, const Sprite& bitmap, size_t x, size_t y, uint64_t rows, Color color)
+{
+    if(!rows) return;
+    Buffer* target = &layer->buffer;
+    if(x + bitmap.width > target->width || y + bitmap.height > target->height) return;
+
+    uint32_t set = buffer_pixel_value(target, color), clear = buffer_pixel_value(target, layer->clear);
+    with_buffer_pixels(target, set, [&](auto* pixels, auto pixel)
+    {
+        patch_rows(pixels, target->width, bitmap, x, y, rows, pixel, (decltype(pixel))clear);
+    });
+
+    for(; rows; rows &= rows - 1)
+    {
+        mark_dirty(frame, Rect{x, y + count_trailing_zeros(rows), bitmap.width, 1});
+    }
+}
+
+// Overwrite the whole framebuffer with the layer and send all of it
+void composite_layer(Buffer* buffer, Layer* layer)
+{
+    flush_draw_list(&layer->buffer);
+    if(buffer->text_overlay) show_text_lists(buffer->text_overlay, text_list_bit(layer->buffer));
+    memcpy(buffer_pixels(*buffer), buffer_pixels(layer->buffer), buffer->width * buffer->height * buffer_pixel_size(*buffer));
+    buffer->num_dirty = 0;
+    mark_dirty(buffer, Rect{0, 0, buffer->width, buffer->height});
+}
+
+// The buffer to rasterize 'layer' into, or null while its content is still
+// valid. The GPU backend has no offscreen layers and always draws straight
+// into the frame. The area the layer covered so far is erased and becomes
+// damage on the frame.
+Buffer* begin_layer(Buffer* frame, Layer* layer)
+{
+    if(frame->gpu) return frame;
+    if(layer->valid) return 0;
+
+    Buffer* target = &layer->buffer;
+    for(size_t ri = 0; ri < target->num_dirty; ++ri)
+    {
+        mark_dirty(frame, target->dirty[ri]);
+    }
+
+    memcpy(target->prev_dirty, target->dirty, target->num_dirty * sizeof(Rect));
+    target->num_prev_dirty = target->num_dirty;
+    clear_buffer_dirty(target, layer->clear);
+    target->num_dirty = 0;
+
+    layer->valid = true;
+    layer->redrawn = true;
+    return target;
+}
+
+// The buffer to draw more into a valid layer without erasing what it
+// holds, or null when it has to be redrawn whole with begin_layer().
+// Only 'area', which the draws have to stay inside, becomes damage.
+Buffer* append_layer(Buffer* frame, Layer* layer, const Rect& area)
+{
+    if(frame->gpu || !layer->valid) return 0;
+
+    Rect damage;
+    if(rect_intersection(area, Rect{0, 0, frame->width, frame->height}, &damage)) mark_dirty(frame, damage);
+    layer->appended = true;
+    return &layer->buffer;
+}
+
+template<typename Pixel>
+void copy_layer_rows(Pixel* dst, const Pixel* src, size_t stride, const Rect& r, bool opaque, Pixel key)
+{
+    size_t row = r.y * stride + r.x;
+    for(size_t yi = 0; yi < r.height; ++yi, row += stride)
+    {
+        if(opaque)
+        {
+            memcpy(dst + row, src + row, r.width * sizeof(Pixel));
+            continue;
+        }
+
+        for(size_t xi = 0; xi < r.width; ++xi)
+        {
+            Pixel p = src[row + xi];
+            if(p != key) dst[row + xi] = p;
+        }
+    }
+}
+
+void copy_layer_rect(Buffer* buffer, const Layer& layer, const Rect& r)
+{
+    uint32_t key = buffer_pixel_value(buffer, layer_transparent);
+    with_buffer_pixels(buffer, key, [&](auto* pixels, auto pixel)
+    {
+        copy_layer_rows(pixels, (decltype(pixels))buffer_pixels(layer.buffer), buffer->width, r, layer.opaque, pixel);
+    });
+}
+
+// Final pass: everything a redrawn layer covered before or covers now is
+// rebuilt bottom to top, untouched parts of the frame are left alone
+void composite_layers(Buffer* buffer, Layer* layers, size_t num_layers)
+{
+    if(buffer->gpu) return;
+
+    if(buffer->text_overlay)
+    {
+        uint32_t shown = 0;
+        for(size_t li = 0; li < num_layers; ++li) shown |= text_list_bit(layers[li].buffer);
+        show_text_lists(buffer->text_overlay, shown);
+    }
+
+    for(size_t li = 0; li < num_layers; ++li)
+    {
+        // Appended areas are already damage
+        if(layers[li].appended && !layers[li].redrawn) flush_draw_list(&layers[li].buffer);
+        layers[li].appended = false;
+        if(!layers[li].redrawn) continue;
+        flush_draw_list(&layers[li].buffer);
+
+        const Buffer& content = layers[li].buffer;
+        for(size_t ri = 0; ri < content.num_dirty; ++ri)
+        {
+            mark_dirty(buffer, content.dirty[ri]);
+        }
+        layers[li].redrawn = false;
+    }
+
+    for(size_t di = 0; di < buffer->num_dirty; ++di)
+    {
+        const Rect& damage = buffer->dirty[di];
+        for(size_t li = 0; li < num_layers; ++li)
+        {
+            const Layer& layer = layers[li];
+            if(layer.opaque)
+            {
+                copy_layer_rect(buffer, layer, damage);
+                continue;
+            }
+
+            for(size_t ri = 0; ri < layer.buffer.num_dirty; ++ri)
+            {
+                Rect r;
+                if(rect_intersection(layer.buffer.dirty[ri], damage, &r)) copy_layer_rect(buffer, layer, r);
+            }
+        }
+    }
+}
+
+/*
+################################################
+##                 GLYPH RUNS                 ##
+################################################
+*/
+
+#define TEXT_BATCH_GLYPHS 128
+
+template<typename Pixel>
+void blit_glyph_rows(
+    Pixel* pixels, size_t stride, const Font& font, const uint8_t* glyphs, const uint16_t* pens,
+    size_t g0, size_t g1, ptrdiff_t left, ptrdiff_t bottom,
+    size_t x0, size_t x1, size_t y0, size_t y1, Pixel value)
+{
+    const Sprite& sheet = font.sheet;
+    // Glyph by glyph, so each is clipped once for all of its rows
+    for(size_t gi = g0; gi < g1; ++gi)
+    {
+        const GlyphMetrics& metrics = font.metrics[glyphs[gi]];
+        size_t gx = pens[gi];
+        uint64_t clip = ~uint64_t(0);
+        if(x0 > gx) clip &= ~uint64_t(0) << (x0 - gx);
+        if(x1 < gx + metrics.advance) clip &= (uint64_t(1) << (x1 - gx)) - 1;
+
+        ptrdiff_t column = left + (ptrdiff_t)gx;
+        size_t skipped = 0;
+        if(column < 0)
+        {
+            skipped = (size_t)-column;
+            column = 0;
+        }
+
+        size_t first_row = glyphs[gi] * sheet.height;
+        Pixel* row = pixels + (size_t)(bottom + (ptrdiff_t)y0) * stride + column;
+        for(size_t yi = y0; yi < y1; ++yi, row += stride)
+        {
+            // Shifted so the ink starts at the pen
+            uint64_t mask = (sprite_row(sheet, first_row + yi) >> metrics.left) & clip;
+            if(mask) blit_spans(row, mask >> skipped, value);
+        }
+    }
+}
+
+// 'glyphs' are frames of the font sheet with their ink starting at
+// 'pens', laid out by layout_glyphs() to 'width' columns
+void draw_glyph_run(
+    Buffer* buffer, const Font& font, const uint8_t* glyphs, const uint16_t* pens, size_t num_glyphs,
+    size_t width, size_t x, size_t y, Color color)
+{
+    size_t height = font.sheet.height;
+    ptrdiff_t left = (ptrdiff_t)x;
+    ptrdiff_t bottom = (ptrdiff_t)y;
+    ptrdiff_t bw = (ptrdiff_t)buffer->width;
+    ptrdiff_t bh = (ptrdiff_t)buffer->height;
+
+    if(left >= bw || left + (ptrdiff_t)width <= 0) return;
+    if(bottom >= bh || bottom + (ptrdiff_t)height <= 0) return;
+
+    size_t x0 = left < 0 ? (size_t)-left : 0;
+    size_t x1 = left + (ptrdiff_t)width > bw ? (size_t)(bw - left) : width;
+    size_t y0 = bottom < 0 ? (size_t)-bottom : 0;
+    size_t y1 = bottom + (ptrdiff_t)height > bh ? (size_t)(bh - bottom) : height;
+
+    mark_dirty(buffer, Rect{(size_t)(left + (ptrdiff_t)x0), (size_t)(bottom + (ptrdiff_t)y0), x1 - x0, y1 - y0});
+
+    // Only glyphs overlapping the clipped columns are visited
+    size_t g0 = 0;
+    while(g0 < num_glyphs && pens[g0] + font.metrics[glyphs[g0]].advance <= x0) ++g0;
+    size_t g1 = g0;
+    while(g1 < num_glyphs && pens[g1] < x1) ++g1;
+
+    uint32_t value = buffer_pixel_value(buffer, color);
+    with_buffer_pixels(buffer, value, [&](auto* pixels, auto pixel)
+    {
+        blit_glyph_rows(pixels, buffer->width, font, glyphs, pens, g0, g1, left, bottom, x0, x1, y0, y1, pixel);
+    });
+}
+
+// One batch of glyphs from the pen at 'x', by whichever path the buffer
+// takes; returns how far it moved the pen
+size_t draw_glyphs(Buffer* buffer, const Font& font, const uint8_t* glyphs, size_t num_glyphs, size_t x, size_t y, Color color)
+{
+    uint16_t pens[TEXT_BATCH_GLYPHS];
+    size_t advance = layout_glyphs(font, glyphs, num_glyphs, pens);
+
+    size_t base;
+    if(text_overlay_glyph_base(*buffer, font.sheet, &base))
+    {
+        uint32_t rgba = text_overlay_color(*buffer, color);
+        for(size_t gi = 0; gi < num_glyphs; ++gi)
+        {
+            add_overlay_glyph(buffer, base + glyphs[gi], x + pens[gi] - font.metrics[glyphs[gi]].left, y, rgba);
+        }
+    }
+    // Recorded draws replay per glyph
+    else if(buffer->gpu || buffer->draw_list)
+    {
+        for(size_t gi = 0; gi < num_glyphs; ++gi)
+        {
+            Sprite sprite = sprite_frame(font.sheet, glyphs[gi]);
+            draw_sprite_buffer(buffer, sprite, x + pens[gi] - font.metrics[glyphs[gi]].left, y, color);
+        }
+    }
+    else draw_glyph_run(buffer, font, glyphs, pens, num_glyphs, advance - 1, x, y, color);
+    return advance;
+}
+
+void draw_text_buffer(
+    Buffer* buffer,
+    const Font& font,
+    const char* text,
+    size_t x, 
+    size_t y,
+    Color color,
+    size_t limit)
+{
+    size_t length = strnlen(text, limit);
+    uint8_t glyphs[TEXT_BATCH_GLYPHS];
+    size_t xp = x;
+    size_t offset = 0;
+    while(offset < length)
+    {
+        size_t num_glyphs = decode_glyphs(text, length, &offset, glyphs, TEXT_BATCH_GLYPHS);
+        if(!num_glyphs) break;
+        xp += draw_glyphs(buffer, font, glyphs, num_glyphs, xp, y, color);
+    }
+}
+
+// How far characters 'first' to 'last' of a compiled line move the pen
+size_t line_advance(const Font& font, const TextLine& line, size_t first, size_t last)
+{
+    size_t advance = 0;
+    for(size_t ci = first; ci < last; ++ci)
+    {
+        if(line.glyphs[ci] != GLYPH_NONE) advance += font.metrics[line.glyphs[ci]].advance;
+    }
+    return advance;
+}
+
+// Characters 'first' to 'last' of a compiled line from the pen at 'x',
+// taking its frames as they are; returns where the pen ends up
+size_t draw_line_glyphs(Buffer* buffer, const Font& font, const TextLine& line, size_t first, size_t last, size_t x, size_t y, Color color)
+{
+    uint8_t glyphs[TEXT_BATCH_GLYPHS];
+    size_t ci = first;
+    while(ci < last)
+    {
+        size_t num_glyphs = 0;
+        for(; ci < last && num_glyphs < TEXT_BATCH_GLYPHS; ++ci)
+        {
+            if(line.glyphs[ci] != GLYPH_NONE) glyphs[num_glyphs++] = line.glyphs[ci];
+        }
+        if(num_glyphs) x += draw_glyphs(buffer, font, glyphs, num_glyphs, x, y, color);
+    }
+    return x;
+}
+
+void draw_number_buffer(
+    Buffer* buffer,
+    const Sprite& number_spritesheet, size_t number,
+    size_t x, size_t y,
+    Color color)
+{
+    uint8_t digits[64];
+    size_t num_digits = 0;
+
+    size_t current_number = number;
+    do
+    {
+        digits[num_digits++] = current_number % 10;
+        current_number = current_number / 10;
+    }
+    while(current_number > 0);
+
+    size_t xp = x;
+    size_t base;
+    if(text_overlay_glyph_base(*buffer, number_spritesheet, &base))
+    {
+        uint32_t rgba = text_overlay_color(*buffer, color);
+        for(size_t i = 0; i < num_digits; ++i, xp += number_spritesheet.width + 1)
+        {
+            add_overlay_glyph(buffer, base + digits[num_digits - i - 1], xp, y, rgba);
+        }
+        return;
+    }
+
+    for(size_t i = 0; i < num_digits; ++i)
+    {
+        uint8_t digit = digits[num_digits - i - 1];
+        Sprite sprite = sprite_frame(number_spritesheet, digit);
+        draw_sprite_buffer(buffer, sprite, xp, y, color);   
+        xp += sprite.width + 1;
+    }
+}
+
+// Multi-word 1bpp rows, 'words' uint64_t per row, bit 0 of word 0 is the
+// leftmost pixel. Bottom row first, like the sprites they are built from.
+template<typename Pixel>
+void blit_strip_rows(
+    Pixel* pixels, size_t stride, const uint64_t* rows, size_t words,
+    ptrdiff_t left, ptrdiff_t bottom, size_t x0, size_t x1, size_t y0, size_t y1, Pixel value)
+{
+    for(size_t yi = y0; yi < y1; ++yi)
+    {
+        Pixel* row = pixels + (size_t)(bottom + (ptrdiff_t)yi) * stride;
+        const uint64_t* src = rows + yi * words;
+        for(size_t w = x0 / 64; w * 64 < x1; ++w)
+        {
+            size_t bit0 = w * 64;
+            uint64_t mask = src[w];
+            if(x0 > bit0) mask &= ~uint64_t(0) << (x0 - bit0);
+            if(x1 < bit0 + 64) mask &= (uint64_t(1) << (x1 - bit0)) - 1;
+            if(!mask) continue;
+
+            // Only the first word can start left of the buffer; its
+            // clipped-away low bits are already zero
+            ptrdiff_t column = left + (ptrdiff_t)bit0;
+            if(column < 0)
+            {
+                mask >>= -column;
+                column = 0;
+            }
+            blit_spans(row + column, mask, value);
+        }
+    }
+}
+
+void draw_strip_buffer(
+    Buffer* buffer, const uint64_t* rows, size_t words,
+    size_t width, size_t height, size_t x, size_t y, Color color)
+{
+    if(buffer->draw_list)
+    {
+        Sprite bounds = {(uint16_t)width, (uint16_t)height, 0, 0};
+        record_draw(buffer, DrawCommand{DRAW_STRIP, bounds, rows, words, x, y, 1, color});
+        return;
+    }
+
+    ptrdiff_t left = (ptrdiff_t)x;
+    ptrdiff_t bottom = (ptrdiff_t)y;
+    ptrdiff_t bw = (ptrdiff_t)buffer->width;
+    ptrdiff_t bh = (ptrdiff_t)buffer->height;
+
+    if(left >= bw || left + (ptrdiff_t)width <= 0) return;
+    if(bottom >= bh || bottom + (ptrdiff_t)height <= 0) return;
+
+    size_t x0 = left < 0 ? (size_t)-left : 0;
+    size_t x1 = left + (ptrdiff_t)width > bw ? (size_t)(bw - left) : width;
+    size_t y0 = bottom < 0 ? (size_t)-bottom : 0;
+    size_t y1 = bottom + (ptrdiff_t)height > bh ? (size_t)(bh - bottom) : height;
+
+    mark_dirty(buffer, Rect{(size_t)(left + (ptrdiff_t)x0), (size_t)(bottom + (ptrdiff_t)y0), x1 - x0, y1 - y0});
+
+    uint32_t value = buffer_pixel_value(buffer, color);
+    with_buffer_pixels(buffer, value, [&](auto* pixels, auto pixel)
+    {
+        blit_strip_rows(pixels, buffer->width, rows, words, left, bottom, x0, x1, y0, y1, pixel);
+    });
+}
+
+/*
+################################################
+##              GLYPH-RUN CACHE               ##
+################################################
+*/
+
+uint64_t hash_text(const char* text, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < length; ++i)
+    {
+        hash = (hash ^ (uint8_t)text[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Lay out 'text' into the run's strip, false if it doesn't fit a slot
+bool rasterize_text_run(TextRun* run, const Font& font, const char* text, size_t length)
+{
+    memset(run->rows, 0, sizeof(run->rows));
+    run->width = 0;
+    run->height = font.sheet.height;
+
+    // A slot holds no more characters than bytes
+    uint8_t glyphs[TEXT_RUN_MAX_CHARS];
+    uint16_t pens[TEXT_RUN_MAX_CHARS];
+    size_t offset = 0;
+    size_t num_glyphs = decode_glyphs(text, length, &offset, glyphs, TEXT_RUN_MAX_CHARS);
+    size_t advance = layout_glyphs(font, glyphs, num_glyphs, pens);
+    if(advance > TEXT_RUN_WORDS * 64 + 1) return false;
+
+    for(size_t gi = 0; gi < num_glyphs; ++gi)
+    {
+        const GlyphMetrics& metrics = font.metrics[glyphs[gi]];
+        Sprite glyph = sprite_frame(font.sheet, glyphs[gi]);
+        size_t ink = metrics.advance - 1;
+        size_t word = pens[gi] / 64, shift = pens[gi] % 64;
+        for(size_t yi = 0; yi < glyph.height; ++yi)
+        {
+            uint64_t bits = sprite_row(glyph, yi) >> metrics.left;
+            uint64_t* row = run->rows + yi * TEXT_RUN_WORDS;
+            row[word] |= bits << shift;
+            if(shift && shift + ink > 64) row[word + 1] |= bits >> (64 - shift);
+        }
+    }
+    run->width = num_glyphs ? advance - 1 : 0;
+    return true;
+}
+
+TextRun* find_text_run(TextCache* cache, const Font& font, const char* text, size_t length)
+{
+    uint64_t hash = hash_text(text, length);
+    TextRun* victim = 0;
+    ++cache->clock;
+
+    for(size_t i = 0; i < cache->num_runs; ++i)
+    {
+        TextRun* run = &cache->runs[i];
+        if(run->hash == hash && run->font == font.sheet.rows && run->length == length &&
+           memcmp(run->text, text, length) == 0)
+        {
+            run->last_used = cache->clock;
+            ++cache->hits;
+            return run;
+        }
+        if(!victim || run->last_used < victim->last_used) victim = run;
+    }
+
+    if(cache->num_runs < TEXT_CACHE_RUNS) victim = &cache->runs[cache->num_runs++];
+
+    ++cache->misses;
+    if(!rasterize_text_run(victim, font, text, length))
+    {
+        // Leave the slot as the next one to recycle
+        victim->hash = 0;
+        victim->font = 0;
+        victim->last_used = 0;
+        return 0;
+    }
+
+    victim->hash = hash;
+    victim->font = font.sheet.rows;
+    victim->length = length;
+    victim->last_used = cache->clock;
+    memcpy(victim->text, text, length);
+    return victim;
+}
+
+// Cached equivalent of draw_text_buffer; strings that don't fit a slot,
+// the GPU backend and the text overlay take the per-glyph path
+void draw_text_cached(
+    Buffer* buffer, TextCache* cache,
+    const Font& font,
+    const char* text,
+    size_t x,
+    size_t y,
+    Color color,
+    size_t limit = 9999)
+{
+    size_t length = strnlen(text, limit);
+
+    TextRun* run = 0;
+    if(!buffer->gpu && !buffer->draw_list && !buffer->text_overlay && length <= TEXT_RUN_MAX_CHARS && font.sheet.height <= TEXT_RUN_MAX_ROWS)
+    {
+        run = find_text_run(cache, font, text, length);
+    }
+
+    if(!run)
+    {
+        draw_text_buffer(buffer, font, text, x, y, color, length);
+        return;
+    }
+
+    if(run->width > 0)
+    {
+        draw_strip_buffer(buffer, run->rows, TEXT_RUN_WORDS, run->width, run->height, x, y, color);
+    }
+}
+
+// draw_text_cached for a compiled story line: the first 'limit'
+// characters end at a known byte, and the per-glyph path takes the
+// line's frames without decoding it again
+void draw_text_line(
+    Buffer* buffer, TextCache* cache,
+    const Font& font,
+    const TextLine& line,
+    size_t x,
+    size_t y,
+    Color color,
+    size_t limit = 9999)
+{
+    size_t length = limit < line.length ? limit : line.length;
+    size_t bytes = line.bytes_before[length];
+
+    TextRun* run = 0;
+    if(!buffer->gpu && !buffer->draw_list && !buffer->text_overlay && bytes <= TEXT_RUN_MAX_CHARS && font.sheet.height <= TEXT_RUN_MAX_ROWS)
+    {
+        run = find_text_run(cache, font, line.text, bytes);
+    }
+
+    if(run)
+    {
+        if(run->width > 0) draw_strip_buffer(buffer, run->rows, TEXT_RUN_WORDS, run->width, run->height, x, y, color);
+        return;
+    }
+    draw_line_glyphs(buffer, font, line, 0, length, x, y, color);
+}
+
+/*
+################################################
+##               NUMBER WIDGETS               ##
+################################################
+*/
+
+#define NUMBER_WIDGET_DIGITS 20
+
+void rasterize_number_widget(NumberWidget* widget, const Sprite& number_spritesheet, size_t number)
+{
+    uint8_t digits[NUMBER_WIDGET_DIGITS];
+    size_t num_digits = 0;
+    do
+    {
+        digits[num_digits++] = number % 10;
+        number /= 10;
+    }
+    while(number > 0);
+
+    memset(widget->rows, 0, sizeof(widget->rows));
+    size_t advance = number_spritesheet.width + 1;
+    for(size_t i = 0; i < num_digits; ++i)
+    {
+        Sprite glyph = sprite_frame(number_spritesheet, digits[num_digits - i - 1]);
+        size_t xp = i * advance, word = xp / 64, shift = xp % 64;
+        for(size_t yi = 0; yi < glyph.height; ++yi)
+        {
+            uint64_t bits = sprite_row(glyph, yi);
+            uint64_t* row = widget->rows + yi * NUMBER_WIDGET_WORDS;
+            row[word] |= bits << shift;
+            if(shift && shift + glyph.width > 64) row[word + 1] |= bits >> (64 - shift);
+        }
+    }
+    widget->width = num_digits * advance - 1;
+    widget->height = number_spritesheet.height;
+}
+
+// Same output as draw_number_buffer; the GPU backend and the text overlay
+// have no strips and stay on the per-digit path
+void draw_number_cached(
+    Buffer* buffer, NumberWidget* widget,
+    const Sprite& number_spritesheet, size_t number,
+    size_t x, size_t y,
+    Color color)
+{
+    if(buffer->gpu || buffer->text_overlay || number_spritesheet.height > TEXT_RUN_MAX_ROWS ||
+       NUMBER_WIDGET_DIGITS * (number_spritesheet.width + 1) > NUMBER_WIDGET_WORDS * 64)
+    {
+        draw_number_buffer(buffer, number_spritesheet, number, x, y, color);
+        return;
+    }
+
+    if(!widget->valid || widget->value != number || widget->font != number_spritesheet.rows)
+    {
+        rasterize_number_widget(widget, number_spritesheet, number);
+        widget->valid = true;
+        widget->value = number;
+        widget->font = number_spritesheet.rows;
+    }
+    draw_strip_buffer(buffer, widget->rows, NUMBER_WIDGET_WORDS, widget->width, widget->height, x, y, color);
+}
+
+// Each run of set source pixels becomes one fill of 'scale' times its
+// length, repeated on 'scale' destination rows
+template<typename Pixel>
+void blit_scaled_rows(
+    Pixel* pixels, size_t width, size_t height, const Sprite& sprite,
+    ptrdiff_t left, ptrdiff_t bottom, size_t scale, Pixel value)
+{
+    ptrdiff_t bw = (ptrdiff_t)width;
+    ptrdiff_t bh = (ptrdiff_t)height;
+    ptrdiff_t s = (ptrdiff_t)scale;
+
+    for(size_t yi = 0; yi < sprite.height; ++yi)
+    {
+        ptrdiff_t py0 = bottom + (ptrdiff_t)yi * s;
+        ptrdiff_t py1 = py0 + s;
+        if(py0 < 0) py0 = 0;
+        if(py1 > bh) py1 = bh;
+        if(py0 >= py1) continue;
+
+        uint64_t mask = sprite_row(sprite, yi);
+        while(mask)
+        {
+            unsigned start = count_trailing_zeros(mask);
+            uint64_t run = mask >> start;
+            unsigned len = ~run ? count_trailing_zeros(~run) : 64 - start;
+            mask &= len + start < 64 ? ~uint64_t(0) << (start + len) : 0;
+
+            ptrdiff_t px0 = left + (ptrdiff_t)start * s;
+            ptrdiff_t px1 = px0 + (ptrdiff_t)len * s;
+            if(px0 < 0) px0 = 0;
+            if(px1 > bw) px1 = bw;
+            if(px0 >= px1) continue;
+
+            for(ptrdiff_t py = py0; py < py1; ++py)
+            {
+                Pixel* span = pixels + (size_t)py * width;
+                for(ptrdiff_t px = px0; px < px1; ++px) span[px] = value;
+            }
+        }
+    }
+}
+
+void draw_sprite_scaled(
+    Buffer* buffer, const Sprite& sprite, 
+    size_t x, size_t y, 
+    size_t scale, Color color)
+{
+    if(buffer->gpu)
+    {
+        gpu_batch_sprite(buffer->gpu, sprite, x, y, scale, color.rgba);
+        return;
+    }
+    if(buffer->draw_list)
+    {
+        record_draw(buffer, DrawCommand{DRAW_SCALED, sprite, 0, 0, x, y, scale, color});
+        return;
+    }
+
+    ptrdiff_t left = (ptrdiff_t)x;
+    ptrdiff_t bottom = (ptrdiff_t)y;
+    ptrdiff_t right = left + (ptrdiff_t)(sprite.width * scale);
+    ptrdiff_t top = bottom + (ptrdiff_t)(sprite.height * scale);
+    if(left < 0) left = 0;
+    if(bottom < 0) bottom = 0;
+    if(right > (ptrdiff_t)buffer->width) right = (ptrdiff_t)buffer->width;
+    if(top > (ptrdiff_t)buffer->height) top = (ptrdiff_t)buffer->height;
+    if(left >= right || bottom >= top) return;
+
+    mark_dirty(buffer, Rect{(size_t)left, (size_t)bottom, (size_t)(right - left), (size_t)(top - bottom)});
+
+    uint32_t value = buffer_pixel_value(buffer, color);
+    with_buffer_pixels(buffer, value, [&](auto* pixels, auto pixel)
+    {
+        blit_scaled_rows(pixels, buffer->width, buffer->height, sprite, (ptrdiff_t)x, (ptrdiff_t)y, scale, pixel);
+    });
+}
+
+/*
+################################################
+##               SCALED SPRITES               ##
+################################################
+*/
+
+// Calls emit(start, length) for each run of set bits in 'mask'
+template<typename Emit>
+inline void for_each_run(uint64_t mask, Emit emit)
+{
+    while(mask)
+    {
+        unsigned start = count_trailing_zeros(mask);
+        uint64_t run = mask >> start;
+        unsigned len = ~run ? count_trailing_zeros(~run) : 64 - start;
+        emit(start, len);
+        mask &= len + start < 64 ? ~uint64_t(0) << (start + len) : 0;
+    }
+}
+
+void expand_scaled_sprite(ScaledSprite* entry, const Sprite& sprite, size_t scale)
+{
+    entry->rows = sprite.rows;
+    entry->source_width = sprite.width;
+    entry->source_height = sprite.height;
+    entry->scale = scale;
+    entry->width = sprite.width * scale;
+    entry->height = sprite.height * scale;
+    entry->words = (entry->width + 63) / 64;
+    entry->data = 0;
+    entry->spans = 0;
+    entry->row_spans = 0;
+
+    size_t num_spans = 0;
+    for(size_t yi = 0; yi < sprite.height; ++yi)
+    {
+        for_each_run(sprite_row(sprite, yi), [&](unsigned, unsigned){ ++num_spans; });
+    }
+
+    if(entry->words > 1 && num_spans <= entry->words * sprite.height && entry->width <= UINT16_MAX)
+    {
+        entry->spans = new SpriteSpan[num_spans ? num_spans : 1];
+        entry->row_spans = new uint32_t[sprite.height + 1];
+        size_t si = 0;
+        for(size_t yi = 0; yi < sprite.height; ++yi)
+        {
+            entry->row_spans[yi] = (uint32_t)si;
+            for_each_run(sprite_row(sprite, yi), [&](unsigned start, unsigned len)
+            {
+                entry->spans[si++] = SpriteSpan{(uint16_t)(start * scale), (uint16_t)(len * scale)};
+            });
+        }
+        entry->row_spans[sprite.height] = (uint32_t)si;
+        return;
+    }
+
+    entry->data = new uint64_t[entry->words * entry->height]();
+    for(size_t yi = 0; yi < sprite.height; ++yi)
+    {
+        uint64_t* row = entry->data + yi * scale * entry->words;
+        uint64_t mask = sprite_row(sprite, yi);
+        for(size_t xi = 0; xi < sprite.width; ++xi)
+        {
+            if(!((mask >> xi) & 1)) continue;
+            for(size_t bit = xi * scale; bit < (xi + 1) * scale; ++bit)
+            {
+                row[bit / 64] |= uint64_t(1) << (bit % 64);
+            }
+        }
+
+        for(size_t sy = 1; sy < scale; ++sy)
+        {
+            memcpy(row + sy * entry->words, row, entry->words * sizeof(uint64_t));
+        }
+    }
+}
+
+void release_scaled_sprite(ScaledSprite* entry)
+{
+    delete[] entry->data;
+    delete[] entry->spans;
+    delete[] entry->row_spans;
+}
+
+const ScaledSprite* find_scaled_sprite(ScaledSpriteCache* cache, const Sprite& sprite, size_t scale)
+{
+    ScaledSprite* victim = 0;
+    ++cache->clock;
+
+    for(size_t i = 0; i < cache->num_entries; ++i)
+    {
+        ScaledSprite* entry = &cache->entries[i];
+        if(entry->rows == sprite.rows && entry->scale == scale &&
+           entry->source_width == sprite.width && entry->source_height == sprite.height)
+        {
+            entry->last_used = cache->clock;
+            return entry;
+        }
+        if(!victim || entry->last_used < victim->last_used) victim = entry;
+    }
+
+    if(cache->num_entries < SCALED_CACHE_ENTRIES) victim = &cache->entries[cache->num_entries++];
+    else release_scaled_sprite(victim);
+
+    expand_scaled_sprite(victim, sprite, scale);
+    victim->last_used = cache->clock;
+    return victim;
+}
+
+void destroy_scaled_sprite_cache(ScaledSpriteCache* cache)
+{
+    for(size_t i = 0; i < cache->num_entries; ++i)
+    {
+        release_scaled_sprite(&cache->entries[i]);
+    }
+    cache->num_entries = 0;
+}
+
+// Each destination row replays its source row's spans, clipped to
+// columns [x0, x1)
+template<typename Pixel>
+void blit_span_rows(
+    Pixel* pixels, size_t stride, const ScaledSprite& entry,
+    ptrdiff_t left, ptrdiff_t bottom, size_t x0, size_t x1, size_t y0, size_t y1, Pixel value)
+{
+    for(size_t yi = y0; yi < y1; ++yi)
+    {
+        Pixel* row = pixels + (size_t)(bottom + (ptrdiff_t)yi) * stride;
+        size_t source_row = yi / entry.scale;
+        const SpriteSpan* span = entry.spans + entry.row_spans[source_row];
+        const SpriteSpan* end = entry.spans + entry.row_spans[source_row + 1];
+        for(; span != end; ++span)
+        {
+            size_t start = span->start > x0 ? span->start : x0;
+            size_t stop = (size_t)span->start + span->length < x1 ? (size_t)span->start + span->length : x1;
+            for(size_t xi = start; xi < stop; ++xi) row[left + (ptrdiff_t)xi] = value;
+        }
+    }
+}
+
+void draw_span_buffer(Buffer* buffer, const ScaledSprite* entry, size_t x, size_t y, Color color)
+{
+    ptrdiff_t left = (ptrdiff_t)x;
+    ptrdiff_t bottom = (ptrdiff_t)y;
+    ptrdiff_t bw = (ptrdiff_t)buffer->width;
+    ptrdiff_t bh = (ptrdiff_t)buffer->height;
+    ptrdiff_t width = (ptrdiff_t)entry->width;
+    ptrdiff_t height = (ptrdiff_t)entry->height;
+
+    if(left >= bw || left + width <= 0) return;
+    if(bottom >= bh || bottom + height <= 0) return;
+
+    size_t x0 = left < 0 ? (size_t)-left : 0;
+    size_t x1 = left + width > bw ? (size_t)(bw - left) : entry->width;
+    size_t y0 = bottom < 0 ? (size_t)-bottom : 0;
+    size_t y1 = bottom + height > bh ? (size_t)(bh - bottom) : entry->height;
+
+    mark_dirty(buffer, Rect{(size_t)(left + (ptrdiff_t)x0), (size_t)(bottom + (ptrdiff_t)y0), x1 - x0, y1 - y0});
+
+    uint32_t value = buffer_pixel_value(buffer, color);
+    with_buffer_pixels(buffer, value, [&](auto* pixels, auto pixel)
+    {
+        blit_span_rows(pixels, buffer->width, *entry, left, bottom, x0, x1, y0, y1, pixel);
+    });
+}
+
+void draw_sprite_scaled_cached(
+    Buffer* buffer, ScaledSpriteCache* cache, const Sprite& sprite,
+    size_t x, size_t y,
+    size_t scale, Color color)
+{
+    if(buffer->gpu || buffer->draw_list || scale == 0)
+    {
+        draw_sprite_scaled(buffer, sprite, x, y, scale, color);
+        return;
+    }
+
+    const ScaledSprite* entry = find_scaled_sprite(cache, sprite, scale);
+    if(entry->data) draw_strip_buffer(buffer, entry->data, entry->words, entry->width, entry->height, x, y, color);
+    else draw_span_buffer(buffer, entry, x, y, color);
+}
+
+/*
+################################################
+##                FRAME TIMING                ##
+################################################
+*/
+
+const char* phase_names[NUM_PHASES] =
+{
+    "CLEAR", "ALIENS", "TEXT", "SHOTS", "COMPOSE", "UPLOAD", "SWAP", "COLLIDE", "DEBRIS"
+};
+
+const char* gpu_phase_names[NUM_GPU_PHASES] = {"GPU UPL", "GPU SPR", "GPU PRS"};
+
+// Forgets every frame, keeping the counters attached
+void reset_frame_profiler(FrameProfiler* profiler)
+{
+    PerfCounters* counters = profiler->counters;
+    const GpuTimers* gpu = profiler->gpu;
+    *profiler = FrameProfiler();
+    profiler->counters = counters;
+    profiler->gpu = gpu;
+}
+
+void begin_profile_frame(FrameProfiler* profiler)
+{
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi) profiler->samples[pi][profiler->current] = 0.0f;
+    profiler->mark = glfwGetTime();
+    if(profiler->counters) read_perf_counters(*profiler->counters, profiler->counter_mark);
+}
+
+void count_phase(FrameProfiler* profiler, FramePhase phase)
+{
+    uint64_t now[NUM_PERF_COUNTERS];
+    if(!read_perf_counters(*profiler->counters, now)) return;
+    for(size_t ci = 0; ci < NUM_PERF_COUNTERS; ++ci)
+    {
+        uint64_t delta = now[ci] - profiler->counter_mark[ci];
+        profiler->counter_window[phase][ci] += delta;
+        profiler->counter_totals[phase][ci] += delta;
+        profiler->counter_mark[ci] = now[ci];
+    }
+}
+
+void end_profile_frame(FrameProfiler* profiler)
+{
+    double work = 0.0;
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        float sample = profiler->samples[pi][profiler->current];
+        record_histogram(&profiler->phase_histograms[pi], sample);
+        if(pi != PHASE_SWAP) work += sample;
+    }
+    record_histogram(&profiler->work_histogram, work);
+    profiler->last_work = work;
+
+    profiler->current = (profiler->current + 1) % PROFILE_FRAMES;
+    ++profiler->total_frames;
+    if(profiler->num_frames < PROFILE_FRAMES) ++profiler->num_frames;
+
+    if(profiler->counters && ++profiler->window_frames == COUNTER_WINDOW_FRAMES)
+    {
+        memcpy(profiler->counter_shown, profiler->counter_window, sizeof(profiler->counter_shown));
+        memset(profiler->counter_window, 0, sizeof(profiler->counter_window));
+        profiler->window_frames = 0;
+    }
+}
+
+void mark_present(FrameProfiler* profiler, bool presented)
+{
+    double now = presented ? glfwGetTime() : 0.0;
+    if(presented && profiler->last_present > 0.0) record_histogram(&profiler->present_histogram, now - profiler->last_present);
+    profiler->last_present = now;
+}
+
+static size_t histogram_bucket(uint64_t ns)
+{
+    const uint64_t top = ((uint64_t)1 << FRAME_HISTOGRAM_MAX_BITS) - 1;
+    if(ns > top) ns = top;
+    if(ns < (2u << FRAME_HISTOGRAM_SUB_BITS)) return (size_t)ns;
+    // Keep the SUB_BITS + 1 leading bits, the first of which is set
+    size_t shift = highest_set_bit(ns) - FRAME_HISTOGRAM_SUB_BITS;
+    return (shift << FRAME_HISTOGRAM_SUB_BITS) + (size_t)(ns >> shift);
+}
+
+static uint64_t bucket_highest(size_t bucket)
+{
+    if(bucket < (2u << FRAME_HISTOGRAM_SUB_BITS)) return bucket;
+    size_t shift = (bucket >> FRAME_HISTOGRAM_SUB_BITS) - 1;
+    uint64_t leading = bucket - (shift << FRAME_HISTOGRAM_SUB_BITS);
+    return ((leading + 1) << shift) - 1;
+}
+
+void record_histogram(FrameHistogram* histogram, double seconds)
+{
+    uint64_t ns = seconds > 0.0 ? (uint64_t)(seconds * 1e9) : 0;
+    ++histogram->counts[histogram_bucket(ns)];
+    ++histogram->count;
+    if(ns > histogram->max_ns) histogram->max_ns = ns;
+}
+
+HistogramSummary summarize_histogram(const FrameHistogram& histogram, const FrameHistogram* mark)
+{
+    HistogramSummary summary = {};
+    summary.count = histogram.count - (mark ? mark->count : 0);
+    if(!summary.count) return summary;
+
+    const double fractions[4] = {0.5, 0.9, 0.99, 0.999};
+    double* values[4] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    uint64_t ranks[4];
+    for(size_t qi = 0; qi < 4; ++qi)
+    {
+        ranks[qi] = (uint64_t)(fractions[qi] * summary.count + 0.999999);
+        if(!ranks[qi]) ranks[qi] = 1;
+    }
+
+    uint64_t seen = 0;
+    size_t qi = 0, highest = 0;
+    for(size_t bi = 0; bi < FRAME_HISTOGRAM_BUCKETS; ++bi)
+    {
+        uint64_t count = histogram.counts[bi] - (mark ? mark->counts[bi] : 0);
+        if(!count) continue;
+        seen += count;
+        highest = bi;
+        for(; qi < 4 && seen >= ranks[qi]; ++qi) *values[qi] = bucket_highest(bi) * 1e-9;
+    }
+    // The exact maximum only holds for the whole run
+    summary.max = mark ? bucket_highest(highest) * 1e-9 : histogram.max_ns * 1e-9;
+    for(size_t vi = 0; vi < 4; ++vi) if(*values[vi] > summary.max) *values[vi] = summary.max;
+    return summary;
+}
+
+PhaseStats phase_stats(const FrameProfiler& profiler, FramePhase phase)
+{
+    PhaseStats stats = {0.0f, 0.0f, 0.0f};
+    size_t n = profiler.num_frames;
+    if(n == 0) return stats;
+
+    // Older slots of a ring that hasn't wrapped yet are still zero
+    float sorted[PROFILE_FRAMES];
+    size_t first = n < PROFILE_FRAMES ? 0 : profiler.current;
+    for(size_t i = 0; i < n; ++i) sorted[i] = profiler.samples[phase][(first + i) % PROFILE_FRAMES];
+
+    // Insertion sort, n is small
+    float sum = 0.0f;
+    for(size_t i = 0; i < n; ++i)
+    {
+        float v = sorted[i];
+        sum += v;
+        size_t j = i;
+        for(; j > 0 && sorted[j - 1] > v; --j) sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+    }
+
+    stats.min = sorted[0];
+    stats.avg = sum / n;
+    stats.p99 = sorted[(n * 99 + 99) / 100 - 1];
+    return stats;
+}
+
+// One row per phase: name, then min/avg/p99 in microseconds, or with
+// counters the average, instructions per 100 cycles and the LLC and
+// branch misses per frame of the last window
+void draw_profiler_overlay(
+    Buffer* buffer, TextCache* cache, NumberWidget* widgets, const FrameProfiler& profiler,
+    const Font& font, const Sprite& number_spritesheet,
+    size_t x, size_t y, Color color)
+{
+    bool counters = profiler.counters != 0;
+    size_t column = (counters ? 6 : 8) * (font.sheet.width + 1);
+    size_t line = font.sheet.height + 2;
+
+    static const char* const time_titles[PROFILER_COLUMNS] = {"MIN", "AVG", "P99", ""};
+    static const char* const counter_titles[PROFILER_COLUMNS] = {"AVG", "IPC%", "LLC", "BRMISS"};
+    const char* const* titles = counters ? counter_titles : time_titles;
+    draw_text_cached(buffer, cache, font, "US", x, y, color);
+    for(size_t ci = 0; ci < PROFILER_COLUMNS; ++ci)
+    {
+        if(*titles[ci]) draw_text_cached(buffer, cache, font, titles[ci], x + (ci + 1) * column, y, color);
+    }
+
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        y -= line;
+        PhaseStats stats = phase_stats(profiler, (FramePhase)pi);
+        draw_text_cached(buffer, cache, font, phase_names[pi], x, y, color);
+
+        size_t values[PROFILER_COLUMNS] = {(size_t)(stats.min * 1e6f), (size_t)(stats.avg * 1e6f), (size_t)(stats.p99 * 1e6f), 0};
+        size_t num_values = 3;
+        if(counters)
+        {
+            const uint64_t* window = profiler.counter_shown[pi];
+            values[0] = (size_t)(stats.avg * 1e6f);
+            values[1] = window[PERF_CYCLES] ? (size_t)(100 * window[PERF_INSTRUCTIONS] / window[PERF_CYCLES]) : 0;
+            values[2] = (size_t)(window[PERF_LLC_MISSES] / COUNTER_WINDOW_FRAMES);
+            values[3] = (size_t)(window[PERF_BRANCH_MISSES] / COUNTER_WINDOW_FRAMES);
+            num_values = 4;
+        }
+        NumberWidget* row = widgets + PROFILER_COLUMNS * pi;
+        for(size_t ci = 0; ci < num_values; ++ci)
+        {
+            draw_number_cached(buffer, &row[ci], number_spritesheet, values[ci], x + (ci + 1) * column, y, color);
+        }
+    }
+
+    // GPU time lags a few frames behind, so only its average is shown
+    if(!profiler.gpu) return;
+    NumberWidget* gpu_widgets = widgets + PROFILER_COLUMNS * NUM_PHASES;
+    size_t avg_column = counters ? 1 : 2;
+    for(size_t gi = 0; gi < NUM_GPU_PHASES; ++gi)
+    {
+        y -= line;
+        draw_text_cached(buffer, cache, font, gpu_phase_names[gi], x, y, color);
+        draw_number_cached(
+            buffer, &gpu_widgets[gi], number_spritesheet, (size_t)profiler.gpu->shown[gi], x + avg_column * column, y, color
+        );
+    }
+}
+
+/*
+################################################
+##                   DEBRIS                   ##
+################################################
+*/
+
+#define PARTICLE_CHUNK 4096
+#define PARTICLES_PER_PIXEL 2
+#define PARTICLE_SPEED 40.0f
+#define PARTICLE_GRAVITY 90.0f
+#define PARTICLE_LIFETIME 0.6f
+#define PARTICLE_TILE_SHIFT 3
+
+void init_particle_system(ParticleSystem* particles, size_t capacity)
+{
+    *particles = ParticleSystem{};
+    particles->capacity = capacity;
+    particles->x = new float[capacity];
+    particles->y = new float[capacity];
+    particles->vx = new float[capacity];
+    particles->vy = new float[capacity];
+    particles->life = new float[capacity];
+    particles->color = new uint8_t[capacity];
+    particles->seed = 0x9e3779b9u;
+    particles->per_pixel = PARTICLES_PER_PIXEL;
+    particles->life_scale = 1.0f;
+}
+
+void destroy_particle_system(ParticleSystem* particles)
+{
+    delete[] particles->x;
+    delete[] particles->y;
+    delete[] particles->vx;
+    delete[] particles->vy;
+    delete[] particles->life;
+    delete[] particles->color;
+    *particles = ParticleSystem{};
+}
+
+// Particles [begin, end) by one semi-implicit Euler step under gravity
+void integrate_particles_scalar(ParticleSystem* particles, size_t begin, size_t end, float dt)
+{
+    float gravity = PARTICLE_GRAVITY * dt;
+    for(size_t i = begin; i < end; ++i)
+    {
+        particles->vy[i] -= gravity;
+        particles->x[i] += particles->vx[i] * dt;
+        particles->y[i] += particles->vy[i] * dt;
+        particles->life[i] -= dt;
+    }
+}
+#if defined(HAVE_X86_SIMD)
+void integrate_particles_sse2(ParticleSystem* particles, size_t begin, size_t end, float dt)
+{
+    __m128 step = _mm_set1_ps(dt);
+    __m128 gravity = _mm_set1_ps(PARTICLE_GRAVITY * dt);
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4)
+    {
+        __m128 vy = _mm_sub_ps(_mm_loadu_ps(particles->vy + i), gravity);
+        _mm_storeu_ps(particles->vy + i, vy);
+        _mm_storeu_ps(particles->x + i, _mm_add_ps(_mm_loadu_ps(particles->x + i), _mm_mul_ps(_mm_loadu_ps(particles->vx + i), step)));
+        _mm_storeu_ps(particles->y + i, _mm_add_ps(_mm_loadu_ps(particles->y + i), _mm_mul_ps(vy, step)));
+        _mm_storeu_ps(particles->life + i, _mm_sub_ps(_mm_loadu_ps(particles->life + i), step));
+    }
+    integrate_particles_scalar(particles, i, end, dt);
+}
+
+TARGET_AVX2 void integrate_particles_avx2(ParticleSystem* particles, size_t begin, size_t end, float dt)
+{
+    __m256 step = _mm256_set1_ps(dt);
+    __m256 gravity = _mm256_set1_ps(PARTICLE_GRAVITY * dt);
+    size_t i = begin;
+    for(; i + 8 <= end; i += 8)
+    {
+        __m256 vy = _mm256_sub_ps(_mm256_loadu_ps(particles->vy + i), gravity);
+        _mm256_storeu_ps(particles->vy + i, vy);
+        _mm256_storeu_ps(particles->x + i, _mm256_add_ps(_mm256_loadu_ps(particles->x + i), _mm256_mul_ps(_mm256_loadu_ps(particles->vx + i), step)));
+        _mm256_storeu_ps(particles->y + i, _mm256_add_ps(_mm256_loadu_ps(particles->y + i), _mm256_mul_ps(vy, step)));
+        _mm256_storeu_ps(particles->life + i, _mm256_sub_ps(_mm256_loadu_ps(particles->life + i), step));
+    }
+    integrate_particles_scalar(particles, i, end, dt);
+}
+#elif defined(HAVE_NEON_SIMD)
+void integrate_particles_neon(ParticleSystem* particles, size_t begin, size_t end, float dt)
+{
+    float32x4_t step = vdupq_n_f32(dt);
+    float32x4_t gravity = vdupq_n_f32(PARTICLE_GRAVITY * dt);
+    size_t i = begin;
+    for(; i + 4 <= end; i += 4)
+    {
+        float32x4_t vy = vsubq_f32(vld1q_f32(particles->vy + i), gravity);
+        vst1q_f32(particles->vy + i, vy);
+        vst1q_f32(particles->x + i, vaddq_f32(vld1q_f32(particles->x + i), vmulq_f32(vld1q_f32(particles->vx + i), step)));
+        vst1q_f32(particles->y + i, vaddq_f32(vld1q_f32(particles->y + i), vmulq_f32(vy, step)));
+        vst1q_f32(particles->life + i, vsubq_f32(vld1q_f32(particles->life + i), step));
+    }
+    integrate_particles_scalar(particles, i, end, dt);
+}
+#endif
+
+void (*integrate_particles)(ParticleSystem* particles, size_t begin, size_t end, float dt) = integrate_particles_scalar;
+const char* particle_kernel_name = "scalar";
+
+void init_particle_kernels(bool simd)
+{
+    integrate_particles = integrate_particles_scalar;
+    particle_kernel_name = "scalar";
+    if(!simd) return;
+#if defined(HAVE_X86_SIMD)
+    integrate_particles = integrate_particles_sse2;
+    particle_kernel_name = "sse2";
+    if(cpu_has_avx2())
+    {
+        integrate_particles = integrate_particles_avx2;
+        particle_kernel_name = "avx2";
+    }
+#elif defined(HAVE_NEON_SIMD)
+    integrate_particles = integrate_particles_neon;
+    particle_kernel_name = "neon";
+#endif
+}
+
+struct ParticleJob
+{
+    ParticleSystem* particles;
+    float dt;
+};
+
+void integrate_particle_chunk(void* context, size_t task)
+{
+    const ParticleJob* job = (const ParticleJob*)context;
+    size_t begin = task * PARTICLE_CHUNK;
+    size_t end = begin + PARTICLE_CHUNK < job->particles->count ? begin + PARTICLE_CHUNK : job->particles->count;
+    integrate_particles(job->particles, begin, end, job->dt);
+}
+
+// Integrate in parallel, then swap the dead and the ones that left the
+// screen out to keep the live particles contiguous
+void update_particles(ParticleSystem* particles, ThreadPool* pool, float dt, size_t width, size_t height)
+{
+    ALLOC_SCOPE(ALLOC_RENDER);
+    if(!particles->count || dt <= 0.0f) return;
+
+    ParticleJob job = {particles, dt};
+    run_parallel(pool, integrate_particle_chunk, &job, (particles->count + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK);
+
+    for(size_t i = 0; i < particles->count;)
+    {
+        if(particles->life[i] > 0.0f && particles->x[i] >= 0.0f && particles->x[i] < (float)width &&
+           particles->y[i] >= 0.0f && particles->y[i] < (float)height)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t last = --particles->count;
+        particles->x[i] = particles->x[last];
+        particles->y[i] = particles->y[last];
+        particles->vx[i] = particles->vx[last];
+        particles->vy[i] = particles->vy[last];
+        particles->life[i] = particles->life[last];
+        particles->color[i] = particles->color[last];
+    }
+}
+
+// xorshift32 mapped onto [-0.5, 0.5)
+inline float particle_jitter(uint32_t* seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return (float)(*seed >> 8) / (float)(1u << 24) - 0.5f;
+}
+
+void spawn_debris(ParticleSystem* particles, const Effect& effect, ColorId color)
+{
+    const Sprite& sprite = *effect_sprites[effect.kind];
+    float cx = (float)(sprite.width - 1) / 2;
+    float cy = (float)(sprite.height - 1) / 2;
+
+    // Top row first, the order debris has always been seeded in
+    for(size_t yi = sprite.height; yi-- > 0;)
+    {
+        float dy = (float)yi - cy;
+        for(uint64_t bits = sprite_row(sprite, yi); bits; bits &= bits - 1)
+        {
+            float dx = (float)count_trailing_zeros(bits) - cx;
+            for(size_t pi = 0; pi < particles->per_pixel; ++pi)
+            {
+                if(particles->count == particles->capacity)
+                {
+                    ++particles->dropped;
+                    continue;
+                }
+
+                size_t i = particles->count++;
+                particles->x[i] = fixed_float(effect.x) + cx + dx;
+                particles->y[i] = fixed_float(effect.y) + cy + dy;
+                particles->vx[i] = (dx / cx + particle_jitter(&particles->seed)) * PARTICLE_SPEED;
+                particles->vy[i] = (dy / cy + particle_jitter(&particles->seed) + 0.5f) * PARTICLE_SPEED;
+                particles->life[i] = PARTICLE_LIFETIME * particles->life_scale * (1.0f + particle_jitter(&particles->seed));
+                particles->color[i] = color;
+            }
+        }
+    }
+    if(particles->count > particles->high_water) particles->high_water = particles->count;
+}
+
+// Explosions spawned since the last call throw out their debris
+void spawn_new_debris(ParticleSystem* particles, const EffectPool& effects)
+{
+    uint64_t fresh = effects.spawned - particles->effects_seen;
+    particles->effects_seen = effects.spawned;
+    // Effects that expired before this call are gone, their debris with them
+    if(fresh > effects.count) fresh = effects.count;
+
+    for(size_t ei = effects.count - (size_t)fresh; ei < effects.count; ++ei)
+    {
+        const Effect& effect = effects.items[ei];
+        if(effect.kind == EFFECT_ALIEN_DEATH || effect.kind == EFFECT_PLAYER_HIT) spawn_debris(particles, effect, COLOR_MAROON);
+    }
+}
+
+// One pixel per particle, noting the tiles touched in 'tiles'
+template<typename Pixel>
+void splat_particles(
+    Pixel* pixels, size_t width, size_t height, const ParticleSystem& particles,
+    const Pixel* values, unsigned tile_shift, uint64_t* tiles)
+{
+    // update_particles() keeps every particle on screen; the check only
+    // guards targets smaller than the game area
+    for(size_t i = 0; i < particles.count; ++i)
+    {
+        uint32_t px = (uint32_t)(int32_t)particles.x[i], py = (uint32_t)(int32_t)particles.y[i];
+        if(px >= width || py >= height) continue;
+
+        pixels[py * width + px] = values[particles.color[i]];
+        tiles[py >> tile_shift] |= uint64_t(1) << (px >> tile_shift);
+    }
+}
+
+// 'splat' is the one-pixel sprite the GPU backend draws each particle with
+void draw_particles(Buffer* buffer, const ParticleSystem& particles, const Sprite& splat, const Color* colors)
+{
+    if(!buffer || !particles.count) return;
+    if(buffer->gpu)
+    {
+        for(size_t i = 0; i < particles.count; ++i)
+        {
+            gpu_batch_sprite(buffer->gpu, splat, (size_t)particles.x[i], (size_t)particles.y[i], 1, colors[particles.color[i]].rgba);
+        }
+        return;
+    }
+    // Splats go straight into the pixels, after everything recorded so far
+    if(buffer->draw_list) flush_draw_list(buffer);
+
+    uint32_t values[NUM_COLORS];
+    for(size_t ci = 0; ci < NUM_COLORS; ++ci) values[ci] = buffer_pixel_value(buffer, colors[ci]);
+
+    // Debris scatters, so damage is tracked on a grid of at most 64x64
+    // power-of-two tiles rather than as one box around every splat
+    size_t longest = buffer->width > buffer->height ? buffer->width : buffer->height;
+    unsigned tile_shift = PARTICLE_TILE_SHIFT;
+    while((longest >> tile_shift) >= 64) ++tile_shift;
+    size_t tile = size_t(1) << tile_shift;
+    uint64_t tiles[64] = {};
+
+    with_buffer_pixels(buffer, 0, [&](auto* pixels, auto pixel)
+    {
+        decltype(pixel) typed[NUM_COLORS];
+        for(size_t ci = 0; ci < NUM_COLORS; ++ci) typed[ci] = (decltype(pixel))values[ci];
+        splat_particles(pixels, buffer->width, buffer->height, particles, typed, tile_shift, tiles);
+    });
+
+    for(size_t ty = 0; ty < 64; ++ty)
+    {
+        uint64_t row = tiles[ty];
+        while(row)
+        {
+            unsigned start = count_trailing_zeros(row);
+            uint64_t run = row >> start;
+            unsigned len = ~run ? count_trailing_zeros(~run) : 64 - start;
+            row &= len + start < 64 ? ~uint64_t(0) << (start + len) : 0;
+
+            Rect r = {start * tile, ty * tile, len * tile, tile};
+            if(r.x + r.width > buffer->width) r.width = buffer->width - r.x;
+            if(r.y + r.height > buffer->height) r.height = buffer->height - r.y;
+            mark_dirty(buffer, r);
+        }
+    }
+}
+
+void execute_draw_command(Buffer* target, const DrawCommand& command, size_t y0)
+{
+    // Band-relative; rows above the band wrap around and are clipped as
+    // negative coordinates by the draw functions
+    size_t y = command.y - y0;
+    switch(command.op)
+    {
+        case DRAW_CLEAR:
+            clear_buffer(target, command.color);
+            break;
+        case DRAW_SPRITE:
+            draw_sprite_buffer(target, command.sprite, command.x, y, command.color);
+            break;
+        case DRAW_SCALED:
+            draw_sprite_scaled(target, command.sprite, command.x, y, command.scale, command.color);
+            break;
+        case DRAW_STRIP:
+            draw_strip_buffer(target, command.strip, command.words, command.sprite.width, command.sprite.height, command.x, y, command.color);
+            break;
+        case DRAW_BLEND:
+            draw_sprite_blended(target, command.sprite, command.x, y, command.color, command.blend, command.alpha);
+            break;
+    }
+}
+
+struct BandJob
+{
+    const DrawList* list;
+    size_t band_height;
+};
+
+void rasterize_band(void* context, size_t band)
+{
+    const BandJob* job = static_cast<const BandJob*>(context);
+    const DrawList* list = job->list;
+    Buffer* view = const_cast<Buffer*>(&list->bands[band]);
+    const uint16_t* commands = list->band_commands[band];
+    for(size_t ci = 0; ci < list->band_counts[band]; ++ci)
+    {
+        execute_draw_command(view, list->commands[commands[ci]], band * job->band_height);
+    }
+}
+
+// Rows [y0, y1) a command can touch, before clipping to the buffer
+inline void draw_command_rows(const DrawCommand& command, size_t height, ptrdiff_t* y0, ptrdiff_t* y1)
+{
+    if(command.op == DRAW_CLEAR)
+    {
+        *y0 = 0;
+        *y1 = (ptrdiff_t)height;
+        return;
+    }
+    size_t rows = command.op == DRAW_SCALED ? command.sprite.height * command.scale : command.sprite.height;
+    *y0 = (ptrdiff_t)command.y;
+    *y1 = *y0 + (ptrdiff_t)rows;
+}
+
+// Sprites whose draws may swap places: same op and color, and the same
+// value written by every set pixel
+inline bool draws_commute(const DrawCommand& a, const DrawCommand& b)
+{
+    return a.op == DRAW_SPRITE && b.op == DRAW_SPRITE && a.color.rgba == b.color.rgba && a.color.index == b.color.index;
+}
+
+// Row, then column
+inline bool draw_sorts_before(const DrawCommand& a, const DrawCommand& b)
+{
+    if(a.y != b.y) return a.y < b.y;
+    return a.x < b.x;
+}
+
+// Stable counting sort of order[0, count) by the bucket of the band's
+// rows each command starts in; those starting below the band go first
+static void bucket_draw_run(DrawList* list, uint16_t* order, size_t count, size_t y0, size_t band_height)
+{
+    auto bucket = [&](uint16_t index)
+    {
+        size_t y = list->commands[index].y;
+        size_t row = y > y0 ? y - y0 : 0;
+        size_t bi = row * DRAW_SORT_BUCKETS / band_height;
+        return bi < DRAW_SORT_BUCKETS ? bi : DRAW_SORT_BUCKETS - 1;
+    };
+
+    uint16_t* buckets = list->buckets;
+    memset(buckets, 0, sizeof(list->buckets));
+    for(size_t i = 0; i < count; ++i) ++buckets[bucket(order[i]) + 1];
+    for(size_t bi = 1; bi <= DRAW_SORT_BUCKETS; ++bi) buckets[bi] += buckets[bi - 1];
+    for(size_t i = 0; i < count; ++i) list->sorted[buckets[bucket(order[i])]++] = order[i];
+    memcpy(order, list->sorted, count * sizeof(uint16_t));
+}
+
+// Bin the commands by band in recorded order, then put each run of
+// commuting sprites in row order
+void sort_draw_list(DrawList* list, size_t num_bands, size_t band_height, size_t height)
+{
+    for(size_t band = 0; band < num_bands; ++band) list->band_counts[band] = 0;
+
+    for(size_t ci = 0; ci < list->num_commands; ++ci)
+    {
+        ptrdiff_t y0, y1;
+        draw_command_rows(list->commands[ci], height, &y0, &y1);
+        if(y0 < 0) y0 = 0;
+        if(y1 > (ptrdiff_t)height) y1 = (ptrdiff_t)height;
+        if(y0 >= y1) continue;
+        for(size_t band = (size_t)y0 / band_height; band <= (size_t)(y1 - 1) / band_height; ++band)
+        {
+            list->band_commands[band][list->band_counts[band]++] = (uint16_t)ci;
+        }
+    }
+
+    for(size_t band = 0; band < num_bands; ++band)
+    {
+        uint16_t* order = list->band_commands[band];
+        size_t count = list->band_counts[band];
+        for(size_t start = 0; start < count;)
+        {
+            size_t end = start + 1;
+            while(end < count && draws_commute(list->commands[order[start]], list->commands[order[end]])) ++end;
+
+            if(end - start >= DRAW_SORT_MIN_RUN)
+            {
+                bucket_draw_run(list, order + start, end - start, band * band_height, band_height);
+                start = end;
+                continue;
+            }
+            for(size_t i = start + 1; i < end; ++i)
+            {
+                uint16_t index = order[i];
+                size_t j = i;
+                for(; j > start && draw_sorts_before(list->commands[index], list->commands[order[j - 1]]); --j) order[j] = order[j - 1];
+                order[j] = index;
+            }
+            start = end;
+        }
+    }
+}
+
+// Replay the recorded draws into the buffer and fold the bands' dirty
+// rectangles back into it in band order
+void flush_draw_list(Buffer* buffer)
+{
+    DrawList* list = buffer->draw_list;
+    if(!list || list->num_commands == 0) return;
+
+    size_t num_bands = list->pool ? list->pool->num_workers + 1 : 1;
+    if(num_bands > DRAW_MAX_BANDS) num_bands = DRAW_MAX_BANDS;
+    if(num_bands > buffer->height / DRAW_BAND_MIN_ROWS) num_bands = buffer->height / DRAW_BAND_MIN_ROWS;
+    if(num_bands < 1) num_bands = 1;
+
+    BandJob job;
+    job.list = list;
+    job.band_height = (buffer->height + num_bands - 1) / num_bands;
+    num_bands = (buffer->height + job.band_height - 1) / job.band_height;
+
+    size_t pixel_size = buffer_pixel_size(*buffer);
+    for(size_t band = 0; band < num_bands; ++band)
+    {
+        size_t y0 = band * job.band_height;
+        Buffer& view = list->bands[band];
+        view.width = buffer->width;
+        view.height = buffer->height - y0 < job.band_height ? buffer->height - y0 : job.band_height;
+        view.format = buffer->format;
+        view.palette = buffer->palette;
+        view.gpu = 0;
+        view.draw_list = 0;
+        view.text_overlay = 0;
+        view.text_list = 0;
+        view.num_dirty = 0;
+        view.num_prev_dirty = 0;
+        view.data = 0;
+        view.indices = 0;
+        view.data16 = 0;
+        set_buffer_pixels(&view, buffer_pixels(*buffer) + y0 * buffer->width * pixel_size);
+    }
+
+    sort_draw_list(list, num_bands, job.band_height, buffer->height);
+    run_parallel(list->pool, rasterize_band, &job, num_bands);
+
+    for(size_t band = 0; band < num_bands; ++band)
+    {
+        const Buffer& view = list->bands[band];
+        for(size_t ri = 0; ri < view.num_dirty; ++ri)
+        {
+            Rect r = view.dirty[ri];
+            r.y += band * job.band_height;
+            mark_dirty(buffer, r);
+        }
+    }
+    list->num_commands = 0;
+}
+
+// Views into the sprite block; the sprites themselves are never copied
+constexpr Sprite builtin_particle_sprite = make_sprite(sprite_block.particle);
+constexpr Sprite builtin_title_sprite = make_sprite(sprite_block.title);
+constexpr Sprite builtin_text_spritesheet = make_sprite(sprite_block.font, 7);
+
+// Points each slot found in the atlas at its rows, returns how many were
+size_t apply_atlas(const AtlasFile& atlas, AtlasSlot* slots, size_t num_slots)
+{
+    size_t applied = 0;
+    for(size_t si = 0; si < num_slots; ++si)
+    {
+        const AtlasFileEntry* entry = find_atlas_file_entry(atlas, slots[si].name);
+        if(!entry) continue;
+        if(entry->num_frames != slots[si].num_frames)
+        {
+            fprintf(stderr, "Atlas sprite '%s' has %u frames, expected %zu.\n", slots[si].name, entry->num_frames, slots[si].num_frames);
+            continue;
+        }
+        *slots[si].sprite = atlas_file_sprite(atlas, *entry);
+        ++applied;
+    }
+    return applied;
+}
+
+static bool same_sprite_pixels(const Sprite& a, const Sprite& b, size_t num_frames)
+{
+    if(a.width != b.width || a.height != b.height || a.row_bits != b.row_bits) return false;
+    return a.rows == b.rows || !memcmp(a.rows, b.rows, num_frames * a.height * a.row_bits / 8);
+}
+
+// Text runs, scaled strips and number widgets are keyed by the rows they
+// were built from
+static void move_sprite_caches(FrameRenderer* renderer, const void* from, const void* to, bool changed)
+{
+    TextCache* text_cache = renderer->text_cache;
+    for(size_t ri = 0; ri < text_cache->num_runs; ++ri)
+    {
+        TextRun& run = text_cache->runs[ri];
+        if(run.font != from) continue;
+        run.font = changed ? 0 : to;
+        // A dropped run is the next to recycle
+        if(changed) run.hash = run.last_used = 0;
+    }
+
+    ScaledSpriteCache* scaled_cache = renderer->scaled_cache;
+    for(size_t ei = 0; ei < scaled_cache->num_entries; ++ei)
+    {
+        ScaledSprite& entry = scaled_cache->entries[ei];
+        if(entry.rows != from) continue;
+        entry.rows = changed ? 0 : to;
+        if(changed) entry.last_used = 0;
+    }
+
+    NumberWidget* widgets[PROFILER_WIDGETS + 1];
+    widgets[0] = &renderer->score_widget;
+    for(size_t wi = 0; wi < PROFILER_WIDGETS; ++wi) widgets[wi + 1] = renderer->profiler_widgets ? &renderer->profiler_widgets[wi] : 0;
+    for(NumberWidget* widget: widgets)
+    {
+        if(!widget || widget->font != from) continue;
+        widget->font = to;
+        if(changed) widget->valid = false;
+    }
+}
+
+bool replace_renderer_sprite(FrameRenderer* renderer, Sprite* sprite, const Sprite& replacement, size_t num_frames)
+{
+    bool changed = !same_sprite_pixels(*sprite, replacement, num_frames);
+    move_sprite_caches(renderer, sprite->rows, replacement.rows, changed);
+    bool font = sprite == &renderer->font.sheet;
+    if(font)
+    {
+        Sprite digits = sprite_frame(replacement, code_point_glyph('0'));
+        move_sprite_caches(renderer, renderer->number_spritesheet.rows, digits.rows, changed);
+        renderer->number_spritesheet = digits;
+    }
+    *sprite = replacement;
+    if(font) set_font_sheet(&renderer->font, replacement);
+
+    // The overlay finds glyphs by where they are in the sheet it uploaded
+    TextOverlay* overlay = renderer->buffer->text_overlay;
+    if(font && overlay) set_text_overlay_font(overlay, replacement, num_frames);
+    if(changed)
+    {
+        invalidate_layer(renderer->title_layer);
+        invalidate_hud(renderer);
+    }
+    return changed;
+}
+
+void invalidate_hud(FrameRenderer* renderer)
+{
+    invalidate_layer(&renderer->layers[LAYER_HUD]);
+    invalidate_layer(&renderer->layers[LAYER_TEXT]);
+}
+
+const char* raster_path_name(RasterPath path)
+{
+    switch(path)
+    {
+        case RASTER_STAMPED: return "stamped";
+        case RASTER_SIMD:    return "simd";
+        case RASTER_SCALAR:  return "scalar";
+        default: break;
+    }
+    return "unknown";
+}
+
+void set_raster_path(FrameRenderer* renderer, RasterPath path)
+{
+    renderer->raster_path = path;
+    init_fill_kernels(path != RASTER_SCALAR);
+    init_particle_kernels(path != RASTER_SCALAR);
+    init_blend_kernels(path != RASTER_SCALAR);
+    // The formation layer may hold the other path's aliens
+    invalidate_layer(&renderer->layers[LAYER_FORMATION]);
+}
+
+void invalidate_renderer(FrameRenderer* renderer)
+{
+    for(size_t li = 0; li < NUM_LAYERS; ++li) invalidate_layer(&renderer->layers[li]);
+    invalidate_layer(renderer->title_layer);
+}
+
+/*
+################################################
+##                RENDER LISTS                ##
+################################################
+*/
+
+void append_render_list(RenderList* list, const Archetype& archetype, double alpha)
+{
+    if(!archetype.sprite || !(archetype.components & COMPONENT_BIT(COMPONENT_Y))) return;
+
+    if(list->count + archetype.count > list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity : 64;
+        while(capacity < list->count + archetype.count) capacity *= 2;
+        RenderItem* items = new RenderItem[capacity];
+        memcpy(items, list->items, list->count * sizeof(RenderItem));
+        delete[] list->items;
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    const int16_t* x = archetype_column<int16_t>(archetype, COMPONENT_X);
+    const Fixed* y = archetype_column<Fixed>(archetype, COMPONENT_Y);
+    const Fixed* prev_y = archetype_column<Fixed>(archetype, COMPONENT_PREV_Y);
+    RenderItem* items = list->items + list->count;
+    for(size_t ei = 0; ei < archetype.count; ++ei)
+    {
+        double to = (double)y[ei], from = prev_y ? (double)prev_y[ei] : to;
+        double pixels = (from + (to - from) * alpha) / (1 << FIXED_SHIFT);
+        items[ei] = RenderItem{archetype.sprite, (size_t)x[ei], (size_t)pixels};
+    }
+    list->count += archetype.count;
+}
+
+// Counting sort of the items on the buffer into row buckets; returns
+// how many there are, those past the top or right edge dropped
+static size_t sort_render_list(RenderList* list, size_t width, size_t height)
+{
+    if(list->sorted_capacity < list->capacity)
+    {
+        delete[] list->sorted;
+        list->sorted_capacity = list->capacity;
+        list->sorted = new RenderItem[list->sorted_capacity];
+    }
+    size_t num_buckets = (height + SPLAT_BUCKET_ROWS - 1) / SPLAT_BUCKET_ROWS;
+    if(num_buckets + 1 > list->num_buckets)
+    {
+        delete[] list->buckets;
+        list->num_buckets = num_buckets + 1;
+        list->buckets = new uint32_t[list->num_buckets];
+    }
+
+    uint32_t* buckets = list->buckets;
+    memset(buckets, 0, (num_buckets + 1) * sizeof(uint32_t));
+    for(size_t ri = 0; ri < list->count; ++ri)
+    {
+        const RenderItem& item = list->items[ri];
+        if(item.x < width && item.y < height) ++buckets[item.y / SPLAT_BUCKET_ROWS + 1];
+    }
+    for(size_t bi = 1; bi <= num_buckets; ++bi) buckets[bi] += buckets[bi - 1];
+
+    size_t count = buckets[num_buckets];
+    for(size_t ri = 0; ri < list->count; ++ri)
+    {
+        const RenderItem& item = list->items[ri];
+        if(item.x < width && item.y < height) list->sorted[buckets[item.y / SPLAT_BUCKET_ROWS]++] = item;
+    }
+    return count;
+}
+
+void draw_render_list(Buffer* buffer, RenderList* list, Color color)
+{
+    if(buffer->gpu || buffer->draw_list || list->count < SPLAT_MIN_ITEMS)
+    {
+        for(size_t ri = 0; ri < list->count; ++ri)
+        {
+            const RenderItem& item = list->items[ri];
+            draw_sprite_buffer(buffer, *item.sprite, item.x, item.y, color);
+        }
+        return;
+    }
+
+    size_t width = buffer->width, height = buffer->height;
+    size_t count = list->count;
+    const RenderItem* items = list->items;
+    if(width * height * buffer_pixel_size(*buffer) >= SPLAT_SORT_MIN_BYTES)
+    {
+        count = sort_render_list(list, width, height);
+        items = list->sorted;
+    }
+    size_t min_x = width, min_y = height, max_x = 0, max_y = 0;
+    with_buffer_pixels(buffer, buffer_pixel_value(buffer, color), [&](auto* pixels, auto pixel)
+    {
+        for(size_t ri = 0; ri < count; ++ri)
+        {
+            const RenderItem& item = items[ri];
+            const Sprite& sprite = *item.sprite;
+            if(item.x >= width || item.y >= height) continue;
+
+            size_t columns = sprite.width < width - item.x ? sprite.width : width - item.x;
+            size_t rows = sprite.height < height - item.y ? sprite.height : height - item.y;
+            uint64_t clip = columns < 64 ? (uint64_t(1) << columns) - 1 : ~uint64_t(0);
+            blit_sprite_rows(pixels + item.y * width + item.x, width, sprite, 0, rows, clip, 0, pixel);
+
+            if(item.x < min_x) min_x = item.x;
+            if(item.y < min_y) min_y = item.y;
+            if(item.x + columns > max_x) max_x = item.x + columns;
+            if(item.y + rows > max_y) max_y = item.y + rows;
+        }
+    });
+    if(max_x > min_x) mark_dirty(buffer, Rect{min_x, min_y, max_x - min_x, max_y - min_y});
+}
+
+void destroy_render_list(RenderList* list)
+{
+    delete[] list->items;
+    delete[] list->sorted;
+    delete[] list->buckets;
+    *list = RenderList{};
+}
+
+/*
+################################################
+##                  DRAWING                   ##
+################################################
+*/
+
+// The title is a static layer: built and sent once, after which the
+// framebuffer and texture already hold it. Returns whether anything was
+// drawn that needs submitting.
+bool draw_title_screen(FrameRenderer* renderer)
+{
+    ALLOC_SCOPE(ALLOC_RENDER);
+    Buffer* buffer = renderer->buffer;
+    Layer* title_layer = renderer->title_layer;
+    if(!buffer->gpu && title_layer->valid) return false;
+
+    const Color* color_table = renderer->color_table;
+    const Font& font = renderer->font;
+    size_t layout_x = renderer->layout_x, layout_y = renderer->layout_y;
+
+    Buffer* target = buffer->gpu ? buffer : &title_layer->buffer;
+    // The GPU frame is drawn over as it is, but its text starts again
+    if(!buffer->gpu) clear_buffer(target, color_table[COLOR_BACKGROUND]);
+    else reset_text_list(target);
+
+    draw_sprite_scaled_cached(target, renderer->scaled_cache, renderer->title_sprite, layout_x + 35, layout_y + 130, 3, color_table[COLOR_MAROON]);
+    draw_text_cached(target, renderer->text_cache, font, "PRESS ENTER TO START", layout_x + 50, layout_y + 110, color_table[COLOR_MAROON]);
+    draw_text_cached(target, renderer->text_cache, font, "SPACE - SHOOT", 10, 7, color_table[COLOR_MAROON]);
+    draw_text_cached(target, renderer->text_cache, font, "<- -> - MOVE", buffer->width - DESIGN_WIDTH + 145, 7, color_table[COLOR_MAROON]);
+
+    if(!buffer->gpu)
+    {
+        title_layer->valid = true;
+        composite_layer(buffer, title_layer);
+    }
+    return true;
+}
+
+// Deaths fade out; the muzzle flash darkens what it lands on, since on
+// the light background an additive flash would barely show
+const BlendMode effect_blend_modes[NUM_EFFECT_KINDS] = {BLEND_ALPHA, BLEND_ALPHA, BLEND_MULTIPLY};
+
+// Rasterize and composite one frame of 'state', 'alpha' of the way from
+// its previous tick to its last
+void draw_game_frame(FrameRenderer* renderer, const GameState& state, double alpha, bool press_marker)
+{
+    ALLOC_SCOPE(ALLOC_RENDER);
+    finish_layer_loader(renderer->layer_loader);
+    Buffer* buffer = renderer->buffer;
+    Layer* layers = renderer->layers;
+    FrameProfiler* profiler = renderer->profiler;
+    TextCache* text_cache = renderer->text_cache;
+    const Color* color_table = renderer->color_table;
+    const Font& font = renderer->font;
+    const Sprite& number_spritesheet = renderer->number_spritesheet;
+    size_t layout_x = renderer->layout_x, layout_y = renderer->layout_y;
+
+    const Game& game = state.game;
+    const TextAnimation* msg_animation = &state.msg_animation;
+
+    // The formation layer holds one frame of every type's animation
+    size_t current_frame = 0;
+    const Sprite* type_sprites[NUM_ALIEN_TYPES];
+    for(size_t ni = 0; ni < NUM_ANIMATIONS; ++ni) current_frame = current_frame * 8 + state.animations[ni].current_frame;
+    for(size_t ti = 0; ti < NUM_ALIEN_TYPES; ++ti) type_sprites[ti] = state.animations[alien_types[ti].animation].current;
+
+    if(current_frame != renderer->formation_frame || state.formation_version != renderer->formation_version)
+    {
+        invalidate_layer(&layers[LAYER_FORMATION]);
+    }
+    invalidate_layer(&layers[LAYER_DYNAMIC]);
+
+    Buffer* background = begin_layer(buffer, &layers[LAYER_BACKGROUND]);
+    if(background) clear_buffer(background, color_table[COLOR_BACKGROUND]);
+
+    Buffer* formation = begin_layer(buffer, &layers[LAYER_FORMATION]);
+    Buffer* dynamic = begin_layer(buffer, &layers[LAYER_DYNAMIC]);
+    if(formation)
+    {
+        renderer->formation_frame = current_frame;
+        renderer->formation_version = state.formation_version;
+    }
+    end_phase(profiler, PHASE_CLEAR);
+
+    // Every alien of a type is the same frame in the same color, so each
+    // type is rasterized once and stamped wherever it lives
+    SpriteStamp* stamps = renderer->alien_stamps;
+    bool stamped = renderer->raster_path == RASTER_STAMPED;
+    if(formation && stamped)
+    {
+        for(size_t ti = 0; ti < NUM_ALIEN_TYPES; ++ti) make_sprite_stamp(&stamps[ti], *formation, *type_sprites[ti], color_table[COLOR_MAROON]);
+    }
+    for(size_t w = 0; w < game.aliens.num_words; ++w)
+    {
+        for(uint64_t bits = formation ? game.aliens.live[w] : 0; bits; bits &= bits - 1)
+        {
+            size_t ai = w * 64 + count_trailing_zeros(bits);
+            size_t x = (size_t)fixed_pixels(game.aliens.x[ai] + state.march.offset_x), y = (size_t)fixed_pixels(game.aliens.y[ai] + state.march.offset_y);
+            if(stamped) draw_stamp_buffer(formation, stamps[game.aliens.type[ai]], x, y);
+            else draw_sprite_buffer(formation, *type_sprites[game.aliens.type[ai]], x, y, color_table[COLOR_MAROON]);
+        }
+    }
+    // Hits only ever clear shield pixels, so unless a new wave rebuilt
+    // them the rows that changed are patched into the layer as it is
+    const Shield* shields = state.shields;
+    uint64_t changed_rows[SHIELD_COUNT] = {};
+    bool shields_changed = false;
+    if(state.shield_version != renderer->shield_version)
+    {
+        for(size_t si = 0; si < state.num_shields; ++si)
+        {
+            for(size_t yi = 0; yi < SHIELD_HEIGHT; ++yi)
+            {
+                uint32_t drawn = renderer->shield_rows[si][yi], now = shields[si].rows[yi];
+                if(now & ~drawn) invalidate_layer(&layers[LAYER_SHIELDS]);
+                if(now != drawn) changed_rows[si] |= uint64_t(1) << yi;
+            }
+            shields_changed |= changed_rows[si] != 0;
+        }
+        if(state.num_shields < SHIELD_COUNT)
+        {
+            memset(renderer->shield_rows, 0, sizeof(renderer->shield_rows));
+            invalidate_layer(&layers[LAYER_SHIELDS]);
+        }
+        renderer->shield_version = state.shield_version;
+    }
+
+    Buffer* shield_layer = begin_layer(buffer, &layers[LAYER_SHIELDS]);
+    for(size_t si = 0; si < state.num_shields; ++si)
+    {
+        const Shield& shield = shields[si];
+        if(shield_layer) draw_sprite_buffer(shield_layer, shield_sprite(shield), shield.x, shield.y, color_table[COLOR_MAROON]);
+        else if(shields_changed)
+        {
+            patch_layer_rows(buffer, &layers[LAYER_SHIELDS], shield_sprite(shield), shield.x, shield.y, changed_rows[si], color_table[COLOR_MAROON]);
+        }
+        if(shield_layer || shields_changed) memcpy(renderer->shield_rows[si], shield.rows, sizeof(shield.rows));
+    }
+    end_phase(profiler, PHASE_FORMATION);
+
+    bool show_message = !state.still_alive && !msg_animation->animation_complete;
+
+    RenderList* render_list = &renderer->render_list;
+    render_list->count = 0;
+    for (size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi) append_render_list(render_list, game.projectiles[oi], alpha);
+    draw_render_list(dynamic, render_list, color_table[COLOR_MAROON]);
+
+    float player_x = fixed_float(game.player.prev_x) + fixed_float(game.player.x - game.player.prev_x) * (float)alpha;
+    draw_sprite_buffer(dynamic, player_sprite, (size_t)player_x, (size_t)fixed_pixels(game.player.y), color_table[COLOR_MAROON]);
+    end_phase(profiler, PHASE_PROJECTILES);
+
+    draw_particles(dynamic, *renderer->particles, renderer->particle_sprite, color_table);
+    end_phase(profiler, PHASE_PARTICLES);
+
+    // Score and the choice aliens only change with the state captured here
+    size_t hud_current[4] = {state.score, show_message, state.choice_phase, state.choice_phase ? current_frame : 0};
+    if(memcmp(hud_current, renderer->hud_state, sizeof(renderer->hud_state)) != 0) invalidate_layer(&layers[LAYER_HUD]);
+
+    Buffer* hud = begin_layer(buffer, &layers[LAYER_HUD]);
+    if(hud)
+    {
+        memcpy(renderer->hud_state, hud_current, sizeof(renderer->hud_state));
+        draw_text_cached(hud, text_cache, font, "SCORE", 4, game.height - font.sheet.height - 7, color_table[COLOR_MAROON]);
+        draw_number_cached(hud, &renderer->score_widget, number_spritesheet, state.score, 4 + 2 * number_spritesheet.width, game.height - 2 * number_spritesheet.height - 12, color_table[COLOR_MAROON]);
+
+        if(show_message && state.choice_phase)
+        {
+            size_t yes_x = (size_t)fixed_pixels(state.yes_alien.x), yes_y = (size_t)fixed_pixels(state.yes_alien.y);
+            size_t no_x = (size_t)fixed_pixels(state.no_alien.x), no_y = (size_t)fixed_pixels(state.no_alien.y);
+            draw_text_cached(hud, text_cache, font, "YES", yes_x + 15, yes_y, color_table[COLOR_YES]);
+            draw_text_cached(hud, text_cache, font, "NO", no_x + 15, no_y, color_table[COLOR_NO]);
+
+            const Sprite& sprite = *type_sprites[state.yes_alien.type];
+            draw_sprite_buffer(hud, sprite, yes_x, yes_y, color_table[COLOR_YES]);
+            draw_sprite_buffer(hud, sprite, no_x, no_y, color_table[COLOR_NO]);
+        }
+    }
+
+    // The page being typed only grows: the glyphs revealed since the last
+    // frame are appended to the text layer, which is cleared only when the
+    // page changes or typing starts over
+    size_t page_index = msg_animation->current_page;
+    size_t line_index = msg_animation->current_line;
+    size_t chars = msg_animation->chars_visible;
+    bool text_rewound = line_index < renderer->text_line || (line_index == renderer->text_line && chars < renderer->text_chars);
+    if(show_message != renderer->text_shown || (show_message && (page_index != renderer->text_page || text_rewound)))
+    {
+        invalidate_layer(&layers[LAYER_TEXT]);
+    }
+
+    const TextLine* lines = show_message ? msg_animation->pages[page_index].compiled : 0;
+    size_t text_x = layout_x + 20;
+    Buffer* text = begin_layer(buffer, &layers[LAYER_TEXT]);
+    if(text)
+    {
+        size_t pen = text_x;
+        for(size_t i = 0; show_message && i <= line_index; ++i)
+        {
+            const TextLine& line = lines[i];
+            size_t limit = i == line_index ? chars : 9999;
+            draw_text_line(text, text_cache, font, line, text_x, layout_y + 200 - 12 * i, color_table[COLOR_MAROON], limit);
+            pen = text_x + line_advance(font, line, 0, limit < line.length ? limit : line.length);
+        }
+        renderer->text_pen = pen;
+    }
+    else if(show_message && (line_index != renderer->text_line || chars != renderer->text_chars))
+    {
+        // Finish the line that was being typed, then each line after it
+        // from its start
+        size_t first = renderer->text_chars;
+        size_t pen = renderer->text_pen;
+        for(size_t i = renderer->text_line; i <= line_index; ++i)
+        {
+            const TextLine& line = lines[i];
+            size_t last = i == line_index && chars < line.length ? chars : line.length;
+            if(first < last)
+            {
+                size_t y = layout_y + 200 - 12 * i;
+                Rect area = {pen, y, line_advance(font, line, first, last), font.sheet.height};
+                Buffer* target = append_layer(buffer, &layers[LAYER_TEXT], area);
+                pen = draw_line_glyphs(target, font, line, first, last, pen, y, color_table[COLOR_MAROON]);
+            }
+            if(i < line_index)
+            {
+                first = 0;
+                pen = text_x;
+            }
+        }
+        renderer->text_pen = pen;
+    }
+    renderer->text_shown = show_message;
+    renderer->text_page = page_index;
+    renderer->text_line = line_index;
+    renderer->text_chars = chars;
+
+    if(press_marker)
+    {
+        draw_sprite_scaled_cached(
+            dynamic, renderer->scaled_cache, renderer->particle_sprite, buffer->width - LATENCY_MARKER_SIZE - 4,
+            game.height - LATENCY_MARKER_SIZE - 4, LATENCY_MARKER_SIZE, color_table[COLOR_MAROON]
+        );
+    }
+
+    if(show_profiler)
+    {
+        draw_profiler_overlay(
+            dynamic, text_cache, renderer->profiler_widgets, *profiler, font, number_spritesheet,
+            layout_x + 4, game.height - 3 * font.sheet.height - 14, color_table[COLOR_MAROON]
+        );
+    }
+    end_phase(profiler, PHASE_TEXT);
+
+    composite_layers(buffer, layers, NUM_LAYERS);
+
+    // Effects fade out, and a keyed layer has nothing under it to fade
+    // into, so they are blended over the composited frame. Their area is
+    // kept in the dynamic layer's damage, so the next frame puts back
+    // what they covered.
+    for(size_t ei = 0; ei < state.effects.count; ++ei)
+    {
+        const Effect& effect = state.effects.items[ei];
+        const Sprite& sprite = *effect_sprites[effect.kind];
+        float fade = effect.remaining / effect_lifetimes[effect.kind];
+        uint8_t opacity = (uint8_t)((fade < 1.0f ? fade : 1.0f) * 255.0f + 0.5f);
+        size_t x = (size_t)fixed_pixels(effect.x), y = (size_t)fixed_pixels(effect.y);
+        draw_sprite_blended(buffer, sprite, x, y, color_table[COLOR_MAROON], effect_blend_modes[effect.kind], opacity);
+
+        Rect area;
+        if(!buffer->gpu && rect_intersection(Rect{x, y, sprite.width, sprite.height}, Rect{0, 0, buffer->width, buffer->height}, &area))
+        {
+            mark_dirty(&layers[LAYER_DYNAMIC].buffer, area);
+        }
+    }
+    end_phase(profiler, PHASE_COMPOSITE);
+}
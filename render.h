@@ -0,0 +1,850 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+/*
+    CPU rasterizer. Buffers are drawn bottom-up in one of the PixelFormat
+    layouts, or recorded into a draw list and replayed in bands on the
+    worker pool; every draw marks the rectangles it touched so only those
+    are uploaded. Layers, glyph runs, number widgets and scaled sprites
+    cache what doesn't change between frames, and draw_game_frame() turns
+    a GameState into pixels through them.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef SPACE_INVADERS_GLES
+// GLES 3.0 over EGL for boards without desktop GL, linked against libGLESv2
+#define GLFW_INCLUDE_ES3
+#else
+#include "gl_loader.h"
+#endif
+#include <GLFW/glfw3.h>
+#include "game.h"
+#include "font.h"
+#include "atlas.h"
+#include "trace.h"
+#include "jobs.h"
+#include "perf_counters.h"
+#include "alloc_stats.h"
+#include "pages.h"
+
+// Recorded by the GL backends in present.h
+struct GpuSpriteRenderer;
+struct TextOverlay;
+
+struct Rect
+{
+    size_t x, y, width, height;
+};
+
+#define BUFFER_MAX_DIRTY 64
+
+// 32-bit formats are named after the GL format/type pair they upload as.
+// PIXEL_RGB565 packs R, G and B into 5, 6 and 5 bits of a 16-bit pixel,
+// half the memory traffic of the 32-bit layouts for a coarser color.
+enum PixelFormat: uint8_t
+{
+    PIXEL_RGBA8888     = 0,
+    PIXEL_INDEXED8     = 1,
+    PIXEL_BGRA8888_REV = 2,
+    PIXEL_RGBA8888_REV = 3,
+    PIXEL_RGB565       = 4,
+    NUM_PIXEL_FORMATS
+};
+
+#define PALETTE_MAX_COLORS 256
+
+// A color resolved for a buffer's pixel format: 'rgba' holds the packed
+// pixel for direct-color formats, 'index' the palette slot for indexed ones
+struct Color
+{
+    uint32_t rgba;
+    uint8_t index;
+};
+
+enum ColorId: uint8_t
+{
+    COLOR_BACKGROUND = 0,
+    COLOR_MAROON     = 1,
+    COLOR_YES        = 2,
+    COLOR_NO         = 3,
+    NUM_COLORS
+};
+
+struct Palette
+{
+    size_t num_colors;
+    bool dirty;
+    uint32_t colors[PALETTE_MAX_COLORS];
+    GLuint texture;
+};
+
+struct DrawList;
+
+struct Buffer
+{
+    size_t width, height;
+    PixelFormat format;
+    uint32_t* data;
+
+    // PIXEL_INDEXED8 stores one byte per pixel, resolved through the palette
+    uint8_t* indices;
+    Palette* palette;
+
+    // PIXEL_RGB565 stores one 16-bit pixel
+    uint16_t* data16;
+
+    // When set, draws are recorded for the GPU backend instead of rasterized
+    GpuSpriteRenderer* gpu;
+
+    // When set, draws are recorded and rasterized in bands on flush_draw_list()
+    DrawList* draw_list;
+
+    // When set, text goes to this buffer's list in the overlay instead
+    TextOverlay* text_overlay;
+    size_t text_list;
+
+    // Rectangles drawn since the last upload, and those drawn the frame before
+    size_t num_dirty, num_prev_dirty;
+    Rect dirty[BUFFER_MAX_DIRTY];
+    Rect prev_dirty[BUFFER_MAX_DIRTY];
+};
+
+// Pack an opaque color the way 'format' lays out a pixel, RGB565 in the
+// low 16 bits. Indexed buffers keep RGBA8888 values, which is what the
+// palette texture holds.
+constexpr uint32_t rgb_to_uint32(uint8_t r, uint8_t g, uint8_t b, PixelFormat format = PIXEL_RGBA8888)
+{
+    return format == PIXEL_BGRA8888_REV ? (255u << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) | b
+         : format == PIXEL_RGBA8888_REV ? (255u << 24) | ((uint32_t)b << 16) | ((uint32_t)g << 8) | r
+         : format == PIXEL_RGB565 ? ((uint32_t)(r >> 3) << 11) | ((uint32_t)(g >> 2) << 5) | (b >> 3)
+         : ((uint32_t)r << 24) | ((uint32_t)g << 16) | ((uint32_t)b << 8) | 255;
+}
+
+/*
+    Game colors, packed at compile time for every pixel format. Each entry
+    carries its packed value and its fixed palette slot, so draws never
+    pack or look up colors; the game picks the table for its buffer once.
+*/
+#define GAME_COLOR_TABLE(format) \
+{ \
+    {rgb_to_uint32(255, 192, 203, format), COLOR_BACKGROUND}, \
+    {rgb_to_uint32(128,   0,   0, format), COLOR_MAROON}, \
+    {rgb_to_uint32(  0, 100,   0, format), COLOR_YES}, \
+    {rgb_to_uint32(139,   0,   0, format), COLOR_NO} \
+}
+
+constexpr Color color_tables[NUM_PIXEL_FORMATS][NUM_COLORS] =
+{
+    GAME_COLOR_TABLE(PIXEL_RGBA8888),
+    GAME_COLOR_TABLE(PIXEL_INDEXED8),
+    GAME_COLOR_TABLE(PIXEL_BGRA8888_REV),
+    GAME_COLOR_TABLE(PIXEL_RGBA8888_REV),
+    GAME_COLOR_TABLE(PIXEL_RGB565)
+};
+
+Rect rect_union(const Rect& a, const Rect& b);
+size_t merge_rects(Rect* rects, size_t num_rects);
+void init_palette(Palette* palette);
+
+inline size_t pixel_format_size(PixelFormat format)
+{
+    return format == PIXEL_INDEXED8 ? 1 : format == PIXEL_RGB565 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+inline size_t buffer_pixel_size(const Buffer& buffer)
+{
+    return pixel_format_size(buffer.format);
+}
+
+inline uint8_t* buffer_pixels(const Buffer& buffer)
+{
+    switch(buffer.format)
+    {
+        case PIXEL_INDEXED8: return buffer.indices;
+        case PIXEL_RGB565: return (uint8_t*)buffer.data16;
+        default: return (uint8_t*)buffer.data;
+    }
+}
+
+inline void set_buffer_pixels(Buffer* buffer, uint8_t* pixels)
+{
+    switch(buffer->format)
+    {
+        case PIXEL_INDEXED8: buffer->indices = pixels; break;
+        case PIXEL_RGB565: buffer->data16 = (uint16_t*)pixels; break;
+        default: buffer->data = (uint32_t*)pixels; break;
+    }
+}
+
+Sprite sprite_frame(const Sprite& sheet, size_t index);
+
+/*
+    Blended sprites. A blended draw mixes a tint into the pixels under the
+    sprite's set bits instead of overwriting them: BLEND_ALPHA moves each
+    pixel toward the tint by alpha / 255, BLEND_ADD adds the tint scaled
+    by alpha and saturates, and BLEND_MULTIPLY darkens the pixel by the
+    tint, pulled toward white as alpha drops. Tint and alpha are constant
+    over a draw, so they are folded into one multiply and add per channel
+    up front, and the kernel picked by init_blend_kernels() then blends 8
+    pixels per step, selected by 8 bits of the sprite row; steps whose
+    byte of the row is empty are skipped. BLEND_OPAQUE, and BLEND_ALPHA at
+    full alpha, are plain draw_sprite_buffer() calls. Indexed buffers have
+    no colors to mix, so there a blended sprite is drawn opaque while alpha
+    is at least 128 and not at all below; the GPU backend draws it opaque.
+*/
+enum BlendMode: uint8_t
+{
+    BLEND_OPAQUE    = 0,
+    BLEND_ALPHA     = 1,
+    BLEND_ADD       = 2,
+    BLEND_MULTIPLY  = 3,
+    NUM_BLEND_MODES
+};
+
+extern const char* blend_kernel_name;
+// 'simd' false puts the scalar kernels back
+void init_blend_kernels(bool simd = true);
+void draw_sprite_blended(Buffer* buffer, const Sprite& sprite, size_t x, size_t y, Color tint, BlendMode mode, uint8_t alpha);
+
+/*
+    Deferred draw lists. A buffer with a draw list records its draws, and
+    flush_draw_list() later replays them once per horizontal band of the
+    buffer on the thread pool. The flush first bins the commands by the
+    bands their rows touch, so a band only visits its own commands, each
+    clipped to its rows. Within a band, a run of sprites in one color is
+    then put in row order: those draws write the same value wherever they
+    land, so any order gives the same pixels, and the band's rows are
+    walked bottom up once rather than revisited by every sprite on them.
+    Runs of DRAW_SORT_MIN_RUN or more are counting-sorted into
+    DRAW_SORT_BUCKETS buckets of the band's rows, keeping recorded order
+    within a bucket; shorter ones are insertion-sorted by row and column.
+    Draws that don't commute keep their recorded order, so the result is
+    identical to drawing immediately.
+*/
+#define DRAW_LIST_MAX_COMMANDS 1024
+#define DRAW_MAX_BANDS 32
+#define DRAW_SORT_BUCKETS 64
+#define DRAW_SORT_MIN_RUN 32
+
+enum DrawOp: uint8_t
+{
+    DRAW_CLEAR  = 0,
+    DRAW_SPRITE = 1,
+    DRAW_SCALED = 2,
+    DRAW_STRIP  = 3,
+    DRAW_BLEND  = 4
+};
+
+struct DrawCommand
+{
+    DrawOp op;
+    Sprite sprite;
+
+    // DRAW_STRIP rows, 'words' uint64_t per row, sized by sprite.width/height
+    const uint64_t* strip;
+    size_t words;
+
+    size_t x, y, scale;
+    Color color;
+
+    // DRAW_BLEND only
+    BlendMode blend;
+    uint8_t alpha;
+};
+
+struct DrawList
+{
+    ThreadPool* pool;
+    size_t num_commands;
+    DrawCommand commands[DRAW_LIST_MAX_COMMANDS];
+
+    // Per-band views of the target, reused by every flush
+    Buffer bands[DRAW_MAX_BANDS];
+
+    // The commands each band executes, in execution order
+    size_t band_counts[DRAW_MAX_BANDS];
+    uint16_t band_commands[DRAW_MAX_BANDS][DRAW_LIST_MAX_COMMANDS];
+
+    // Scratch of the row sort
+    uint16_t sorted[DRAW_LIST_MAX_COMMANDS];
+    uint16_t buckets[DRAW_SORT_BUCKETS + 1];
+};
+
+void draw_sprite_buffer(
+    Buffer* buffer, const Sprite& sprite, size_t x, size_t y, Color color
+);
+
+/*
+    Stamps. A sprite rasterized once in one color for one buffer's pixel
+    format: each tile pixel holds the color where the sprite is set and 0
+    elsewhere, and the mask all ones where it is set. Drawing is then a
+    masked copy of every row, with no bit tests, and the formation draws
+    all aliens of a type from one stamp. Sprites past the buffer's edges,
+    and buffers that record their draws, go through draw_sprite_buffer().
+*/
+#define STAMP_MAX_PIXELS 256
+
+struct SpriteStamp
+{
+    Sprite sprite;
+    Color color;
+    PixelFormat format;
+    // Rows bottom first like the buffer's, in its pixel type; empty when
+    // the sprite has more than STAMP_MAX_PIXELS
+    bool valid;
+    alignas(16) uint8_t pixels[STAMP_MAX_PIXELS * 4];
+    alignas(16) uint8_t mask[STAMP_MAX_PIXELS * 4];
+};
+
+void make_sprite_stamp(SpriteStamp* stamp, const Buffer& buffer, const Sprite& sprite, Color color);
+void draw_stamp_buffer(Buffer* buffer, const SpriteStamp& stamp, size_t x, size_t y);
+
+/*
+    Clear kernels. The widest one the CPU supports is picked once by
+    init_fill_kernels(); large fills bypass the cache with streaming stores.
+*/
+
+extern const char* fill_kernel_name;
+// 'simd' false puts the scalar kernel back
+void init_fill_kernels(bool simd = true);
+void clear_buffer(Buffer* buffer, Color color);
+void clear_buffer_dirty(Buffer* buffer, Color color);
+
+/*
+    Layers. Content that doesn't change between frames is rasterized into
+    an offscreen buffer of the same size and format and kept until the game
+    invalidates it. Opaque layers replace what is under them; the others use
+    layer_transparent as a color key and their own dirty rectangles record
+    where they have content. Content that only grows, like a page being
+    typed out, is appended to a valid layer instead: nothing is erased and
+    only the area drawn this frame becomes damage.
+*/
+enum LayerId: uint8_t
+{
+    LAYER_BACKGROUND = 0,
+    LAYER_FORMATION = 1,
+    LAYER_SHIELDS = 2,
+    LAYER_DYNAMIC = 3,
+    LAYER_HUD = 4,
+    LAYER_TEXT = 5,
+    NUM_LAYERS
+};
+
+// The last palette slot is reserved as the key for indexed layers
+constexpr Color layer_transparent = {0, PALETTE_MAX_COLORS - 1};
+
+struct Layer
+{
+    Buffer buffer;
+    Color clear;
+    bool opaque;
+    bool valid;
+    bool redrawn;
+    bool appended;
+};
+
+void init_layer(Layer* layer, const Buffer& target, Color clear);
+void destroy_layer(Layer* layer);
+void patch_layer_rows(Buffer* frame, Layer* layer, const Sprite& bitmap, size_t x, size_t y, uint64_t rows, Color color);
+
+/*
+    Deferred layers. The title screen composites its own layer alone, yet
+    the game's layers are a full-size buffer each, most of what startup
+    spends at the larger resolutions. A LayerLoader describes them at
+    once, invalid and without pixels, and allocates and clears the pixels
+    on a thread of its own while the title is up. The first game frame
+    waits for whatever is left, so a start pressed the moment the title
+    shows only waits out the remainder. Until then the layers may be
+    invalidated but not drawn.
+*/
+struct LayerLoader
+{
+    std::thread thread;
+    Layer* layers;
+    size_t num_layers;
+    size_t size;
+    uint32_t values[NUM_LAYERS];
+    // Written by the loader thread, read once it is joined
+    uint8_t* pixels[NUM_LAYERS];
+    bool pending;
+    // When loading started and when the loader thread was done
+    double start, ready;
+};
+
+// 'clears' holds each layer's clear color
+void start_layer_loader(LayerLoader* loader, Layer* layers, const Color* clears, size_t num_layers, const Buffer& target);
+// Blocks until the pixels are in and hands them to the layers; does
+// nothing once they have them
+void finish_layer_loader(LayerLoader* loader);
+
+/*
+    Glyph runs. The font sheet is already a packed 1bpp atlas with the
+    glyphs stacked at a fixed row offset, so a run is clipped once as a
+    whole and each destination row is written in a single pass over the
+    glyphs, without building a Sprite or re-clipping per character. Text
+    is decoded and laid out a batch of glyphs at a time, see font.h.
+*/
+
+// 'text' is UTF-8, drawn up to its end or 'limit' bytes
+void draw_text_buffer(
+    Buffer* buffer,
+    const Font& font,
+    const char* text,
+    size_t x, 
+    size_t y,
+    Color color,
+    size_t limit = 9999);
+void draw_number_buffer(
+    Buffer* buffer,
+    const Sprite& number_spritesheet, size_t number,
+    size_t x, size_t y,
+    Color color);
+
+/*
+    Glyph-run cache. A string is laid out once into a packed 1bpp strip and
+    stamped with one span pass per row afterwards. Strips don't depend on
+    the color, so runs are keyed by text and font only. Slots come out of a
+    fixed budget and the least recently used one is recycled on a miss.
+*/
+#define TEXT_CACHE_BUDGET (8 * 1024)
+#define TEXT_RUN_WORDS 4
+#define TEXT_RUN_MAX_ROWS 8
+#define TEXT_RUN_MAX_CHARS 48
+#define TEXT_CACHE_RUNS (TEXT_CACHE_BUDGET / (TEXT_RUN_WORDS * TEXT_RUN_MAX_ROWS * sizeof(uint64_t)))
+
+struct TextRun
+{
+    uint64_t hash;
+    const void* font;
+    size_t length;
+    size_t width, height;
+    uint64_t last_used;
+    char text[TEXT_RUN_MAX_CHARS];
+    uint64_t rows[TEXT_RUN_MAX_ROWS * TEXT_RUN_WORDS];
+};
+
+struct TextCache
+{
+    uint64_t clock;
+    size_t num_runs;
+    size_t hits, misses;
+    TextRun runs[TEXT_CACHE_RUNS];
+};
+
+/*
+    Number widgets. A counter on screen keeps its digits laid out in a
+    strip and lays them out again only when its value changes; other
+    frames stamp the strip as it is. Twenty digits cover any size_t.
+*/
+#define NUMBER_WIDGET_WORDS 2
+
+struct NumberWidget
+{
+    bool valid;
+    size_t value;
+    const void* font;
+    size_t width, height;
+    uint64_t rows[TEXT_RUN_MAX_ROWS * NUMBER_WIDGET_WORDS];
+};
+
+void draw_sprite_scaled(
+    Buffer* buffer, const Sprite& sprite, 
+    size_t x, size_t y, 
+    size_t scale, Color color);
+
+/*
+    Scaled-sprite cache. A sprite is expanded once per integer scale into a
+    packed strip, after which drawing it is the same span pass as text runs.
+    The table is small and fixed; a full table recycles its oldest entry.
+
+    Sparse sprites wider than a word once scaled, like the title, are kept
+    as a list of spans per source row instead: each destination row is
+    then a few fills, with no blank words to scan and nothing stored for
+    the rows scaling repeats. Sprites with more runs than the strip has
+    words stay packed, since scanning their bits is the cheaper pass.
+*/
+#define SCALED_CACHE_ENTRIES 8
+
+// A run of set pixels in a scaled row, in destination pixels
+struct SpriteSpan
+{
+    uint16_t start, length;
+};
+
+struct ScaledSprite
+{
+    const void* rows;
+    size_t source_width, source_height;
+    size_t scale;
+    size_t width, height, words;
+    uint64_t last_used;
+    // Packed strip, or 0 when the sprite is span-encoded
+    uint64_t* data;
+    // Spans of source row yi are spans[row_spans[yi], row_spans[yi + 1])
+    SpriteSpan* spans;
+    uint32_t* row_spans;
+};
+
+struct ScaledSpriteCache
+{
+    uint64_t clock;
+    size_t num_entries;
+    ScaledSprite entries[SCALED_CACHE_ENTRIES];
+};
+
+void destroy_scaled_sprite_cache(ScaledSpriteCache* cache);
+// Draws from the cached expansion, or through draw_sprite_scaled on the
+// GPU and into draw lists
+void draw_sprite_scaled_cached(
+    Buffer* buffer, ScaledSpriteCache* cache, const Sprite& sprite,
+    size_t x, size_t y,
+    size_t scale, Color color);
+
+/*
+    Per-phase frame timing. Each phase adds the time since the previous
+    mark to its sample for the current frame; the last PROFILE_FRAMES
+    frames are kept in a ring and summarized on demand. With hardware
+    counters attached, the same marks read them too, and their deltas are
+    summed per phase over windows of COUNTER_WINDOW_FRAMES frames.
+*/
+enum FramePhase: uint8_t
+{
+    PHASE_CLEAR       = 0,
+    PHASE_FORMATION   = 1,
+    PHASE_TEXT        = 2,
+    PHASE_PROJECTILES = 3,
+    PHASE_COMPOSITE   = 4,
+    PHASE_UPLOAD      = 5,
+    PHASE_SWAP        = 6,
+    PHASE_COLLISION   = 7,
+    PHASE_PARTICLES   = 8,
+    NUM_PHASES
+};
+
+#define PROFILE_FRAMES 128
+#define COUNTER_WINDOW_FRAMES 60
+
+extern const char* phase_names[NUM_PHASES];
+
+/*
+    Frame-time histograms. Beside the ring, every frame's phase times, its
+    work (every phase but the swap, which waits on the display) and the
+    interval between two presented frames go into histograms over the
+    whole run, bucketed the way HdrHistogram does: nanoseconds, exact below
+    2 << FRAME_HISTOGRAM_SUB_BITS, then 1 << FRAME_HISTOGRAM_SUB_BITS
+    buckets per doubling, so any percentile is read to within 1/32 of
+    itself from a nanosecond to a minute. Recording is one increment in a
+    fixed array. A hitch in the work histogram is ours; one only in the
+    present intervals came from the driver or the compositor.
+*/
+#define FRAME_HISTOGRAM_SUB_BITS 5
+// Longest value kept apart, about 68 s; longer ones go in the last bucket
+#define FRAME_HISTOGRAM_MAX_BITS 36
+#define FRAME_HISTOGRAM_BUCKETS ((FRAME_HISTOGRAM_MAX_BITS - FRAME_HISTOGRAM_SUB_BITS + 1) << FRAME_HISTOGRAM_SUB_BITS)
+
+struct FrameHistogram
+{
+    uint64_t counts[FRAME_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max_ns;
+};
+
+// In seconds, each the highest value its bucket stands for
+struct HistogramSummary
+{
+    uint64_t count;
+    double p50, p90, p99, p999, max;
+};
+
+void record_histogram(FrameHistogram* histogram, double seconds);
+// Of what was recorded since 'mark', a copy taken earlier, or of
+// everything when 'mark' is 0
+HistogramSummary summarize_histogram(const FrameHistogram& histogram, const FrameHistogram* mark);
+
+/*
+    GPU timing. Each GPU phase is bracketed by a GL_TIME_ELAPSED query and
+    ended with a GL_TIMESTAMP, in a ring GPU_TIMER_LATENCY frames deep: a
+    frame's results are read when its slot comes round again, and only if
+    the driver already has them, so reading never stalls. Results missed
+    that way are counted as dropped. Averages over COUNTER_WINDOW_FRAMES
+    frames feed the overlay, and with a trace recording each result
+    becomes an event on a "gpu" track, placed by the GL_TIMESTAMP against
+    the trace clock.
+*/
+enum GpuPhase: uint8_t
+{
+    GPU_UPLOAD,
+    GPU_SPRITES,
+    GPU_PRESENT,
+    NUM_GPU_PHASES
+};
+
+#define GPU_TIMER_LATENCY 4
+
+extern const char* gpu_phase_names[NUM_GPU_PHASES];
+
+struct GpuTimers
+{
+    GLuint elapsed[GPU_TIMER_LATENCY][NUM_GPU_PHASES];
+    GLuint stamps[GPU_TIMER_LATENCY][NUM_GPU_PHASES];
+    bool issued[GPU_TIMER_LATENCY][NUM_GPU_PHASES];
+    size_t slot;
+    // Trace clock minus GL clock, measured each window
+    int64_t clock_offset;
+    int trace_track;
+
+    size_t window_frames;
+    uint64_t window_ns[NUM_GPU_PHASES];
+    size_t window_samples[NUM_GPU_PHASES];
+    // Microseconds per timed frame over the last window
+    float shown[NUM_GPU_PHASES];
+    uint64_t total_ns[NUM_GPU_PHASES];
+    size_t total_samples[NUM_GPU_PHASES], dropped;
+};
+
+struct FrameProfiler
+{
+    double mark;
+    size_t current, num_frames;
+    float samples[NUM_PHASES][PROFILE_FRAMES];
+
+    // Running totals over every profiled frame
+    size_t total_frames;
+    double totals[NUM_PHASES];
+
+    // Optional, read on the thread that opened them at every mark
+    PerfCounters* counters;
+    uint64_t counter_mark[NUM_PERF_COUNTERS];
+    uint64_t counter_totals[NUM_PHASES][NUM_PERF_COUNTERS];
+    // The window being summed and the last complete one, which is shown
+    size_t window_frames;
+    uint64_t counter_window[NUM_PHASES][NUM_PERF_COUNTERS];
+    uint64_t counter_shown[NUM_PHASES][NUM_PERF_COUNTERS];
+
+    // Optional, owned by the uploader of the GL context being profiled
+    const GpuTimers* gpu;
+
+    FrameHistogram phase_histograms[NUM_PHASES];
+    FrameHistogram work_histogram, present_histogram;
+    // 0 when the last frame wasn't presented
+    double last_present;
+    // Every phase but the swap, of the last profiled frame
+    double last_work;
+};
+
+struct PhaseStats
+{
+    float min, avg, p99;
+};
+
+void reset_frame_profiler(FrameProfiler* profiler);
+void begin_profile_frame(FrameProfiler* profiler);
+void count_phase(FrameProfiler* profiler, FramePhase phase);
+
+inline void end_phase(FrameProfiler* profiler, FramePhase phase)
+{
+    double now = glfwGetTime();
+    profiler->samples[phase][profiler->current] += (float)(now - profiler->mark);
+    profiler->totals[phase] += now - profiler->mark;
+    TRACE_SPAN(phase_names[phase], now - profiler->mark);
+    profiler->mark = now;
+    if(profiler->counters) count_phase(profiler, phase);
+}
+
+void end_profile_frame(FrameProfiler* profiler);
+// Right after the swap, or with 'presented' unset for a frame left
+// unpresented, which breaks the run of intervals
+void mark_present(FrameProfiler* profiler, bool presented);
+PhaseStats phase_stats(const FrameProfiler& profiler, FramePhase phase);
+
+// One widget per phase for each number column: min, avg and p99, or with
+// counters avg, IPC, LLC and branch misses, then one per GPU phase average
+#define PROFILER_COLUMNS 4
+#define PROFILER_WIDGETS (PROFILER_COLUMNS * NUM_PHASES + NUM_GPU_PHASES)
+
+/*
+    Explosion debris. When an alien or the player blows up, every lit pixel
+    of the explosion sprite throws out a few particles. Particles are kept
+    as parallel arrays, integrated four or eight at a time in chunks spread
+    over the worker pool, and drawn as single-pixel splats. They only
+    decorate the frame; the simulation never reads them.
+*/
+#define PARTICLE_CAPACITY 65536
+
+struct ParticleSystem
+{
+    size_t count, capacity;
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    float* life;
+    uint8_t* color;
+
+    // Thrown per lit pixel of an explosion, and their lifetime against
+    // PARTICLE_LIFETIME; the quality governor lowers both
+    size_t per_pixel;
+    float life_scale;
+
+    // Effects already turned into debris, see EffectPool::spawned
+    uint64_t effects_seen;
+    uint32_t seed;
+    size_t high_water, dropped;
+};
+
+void init_particle_system(ParticleSystem* particles, size_t capacity);
+void destroy_particle_system(ParticleSystem* particles);
+
+extern const char* particle_kernel_name;
+void init_particle_kernels(bool simd = true);
+void update_particles(ParticleSystem* particles, ThreadPool* pool, float dt, size_t width, size_t height);
+void spawn_new_debris(ParticleSystem* particles, const EffectPool& effects);
+
+/*
+################################################
+##                SPRITE DATA                 ##
+################################################
+*/
+
+extern const Sprite builtin_particle_sprite;
+extern const Sprite builtin_title_sprite;
+extern const Sprite builtin_text_spritesheet;
+
+// A sheet --atlas may replace, and how many frames the replacement needs
+struct AtlasSlot
+{
+    const char* name;
+    Sprite* sprite;
+    size_t num_frames;
+};
+
+size_t apply_atlas(const AtlasFile& atlas, AtlasSlot* slots, size_t num_slots);
+
+/*
+    Render lists. Archetypes with a position and a shared sprite are
+    gathered into one flat list of draws, each placed 'alpha' of the way
+    from its previous y when the archetype keeps one, so drawing every
+    kind of entity is a single loop over the list. The list keeps its
+    storage between frames and only grows.
+
+    A list of SPLAT_MIN_ITEMS or more, a bullet-hell screen, is splatted
+    rather than drawn: one pass writes every item's set pixels straight
+    into the buffer and marks one dirty rectangle around them all, where
+    draw_sprite_buffer() would clip, dispatch and mark a rectangle per
+    item. Buffers that record their draws take the per-item path.
+
+    Items come in storage order, which scatters them over the buffer's
+    rows. On a buffer of SPLAT_SORT_MIN_BYTES or more, too big to stay in
+    cache, the splat first counting-sorts them into buckets of
+    SPLAT_BUCKET_ROWS rows, bottom up, and then walks the buffer once
+    instead of reloading the same rows for every item that lands on them.
+    A smaller buffer stays cached anyway and the sort would only cost.
+    Every item of a list writes the same value, so the order changes no
+    pixel.
+*/
+#define SPLAT_MIN_ITEMS 256
+#define SPLAT_BUCKET_ROWS 4
+#define SPLAT_SORT_MIN_BYTES ((size_t)8 << 20)
+
+struct RenderItem
+{
+    const Sprite* sprite;
+    size_t x, y;
+};
+
+struct RenderList
+{
+    RenderItem* items;
+    size_t count, capacity;
+    // The items in row order and the first sorted item of each bucket,
+    // both only allocated once a list is sorted
+    RenderItem* sorted;
+    size_t sorted_capacity;
+    uint32_t* buckets;
+    size_t num_buckets;
+};
+
+void append_render_list(RenderList* list, const Archetype& archetype, double alpha);
+void draw_render_list(Buffer* buffer, RenderList* list, Color color);
+void destroy_render_list(RenderList* list);
+
+/*
+    Rasterizer paths, switchable between frames. Stamped is what ships:
+    the widest clear and particle kernels the CPU has and one stamp per
+    alien type. SIMD draws every alien with draw_sprite_buffer() instead,
+    and scalar also goes back to the scalar kernels; it is the reference
+    the others are checked against.
+*/
+enum RasterPath: uint8_t
+{
+    RASTER_STAMPED = 0,
+    RASTER_SIMD    = 1,
+    RASTER_SCALAR  = 2,
+    NUM_RASTER_PATHS
+};
+
+const char* raster_path_name(RasterPath path);
+
+/*
+    Drawing. A FrameRenderer holds everything the rasterizer keeps between
+    frames; the frame itself is drawn from a GameState alone, so the same
+    code draws the live state or a snapshot of it.
+*/
+struct FrameRenderer
+{
+    Buffer* buffer;
+    Layer* layers;
+    Layer* title_layer;
+    TextCache* text_cache;
+    ScaledSpriteCache* scaled_cache;
+    NumberWidget score_widget;
+    NumberWidget* profiler_widgets;
+    FrameProfiler* profiler;
+    ParticleSystem* particles;
+    RenderList render_list;
+    ThreadPool* thread_pool;
+    const Color* color_table;
+    Sprite title_sprite, particle_sprite, number_spritesheet;
+    Font font;
+    size_t layout_x, layout_y;
+
+    // What the formation, shield and HUD layers were last rasterized from
+    size_t formation_frame;
+    uint32_t formation_version;
+    uint32_t shield_version;
+    uint32_t shield_rows[SHIELD_COUNT][SHIELD_HEIGHT];
+    size_t hud_state[4];
+    // What the text layer holds: the page, how far it is typed and where
+    // the next glyph of the line being typed goes
+    bool text_shown;
+    size_t text_page, text_line, text_chars, text_pen;
+
+    // Each alien type's current frame, stamped over the formation layer
+    SpriteStamp alien_stamps[NUM_ALIEN_TYPES];
+    RasterPath raster_path;
+    // Still filling 'layers' when set, finished before a game frame draws
+    LayerLoader* layer_loader;
+};
+
+bool draw_title_screen(FrameRenderer* renderer);
+void draw_game_frame(FrameRenderer* renderer, const GameState& state, double alpha, bool press_marker);
+
+// Points one of the renderer's own sprites, 'num_frames' tall, at
+// 'replacement' and returns whether its pixels changed. Caches built
+// from the old rows are moved over when they did not and dropped along
+// with the layers drawn from them when they did. A new font sheet is
+// measured again.
+bool replace_renderer_sprite(FrameRenderer* renderer, Sprite* sprite, const Sprite& replacement, size_t num_frames);
+// Takes effect from the next frame drawn; the kernels are process-wide
+void set_raster_path(FrameRenderer* renderer, RasterPath path);
+// Drops every layer, so the next frame is drawn and composited whole
+void invalidate_renderer(FrameRenderer* renderer);
+// The story text changed under the HUD
+void invalidate_hud(FrameRenderer* renderer);
+
+#endif
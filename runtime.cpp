@@ -0,0 +1,2666 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include "runtime.h"
+
+#if defined(_WIN32)
+#define REPLAY_USE_MMAP 0
+#define FLIGHT_USE_SIGNALS 0
+#else
+#define REPLAY_USE_MMAP 1
+#define FLIGHT_USE_SIGNALS 1
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Set from GLFW callbacks on the main thread, some read by the render thread
+std::atomic<bool> game_start(false);
+bool game_running = false;
+std::atomic<bool> framebuffer_resized(false);
+std::atomic<bool> window_damaged(true);
+std::atomic<int> framebuffer_width(0), framebuffer_height(0);
+std::atomic<bool> pacing_cycle_pressed(false);
+std::atomic<bool> show_profiler(false);
+std::atomic<bool> show_debug_overlay(false);
+std::atomic<bool> raster_cycle_pressed(false);
+std::atomic<bool> upload_cycle_pressed(false);
+std::atomic<bool> trace_key_pressed(false);
+std::atomic<bool> screenshot_pressed(false);
+std::atomic<bool> histogram_key_pressed(false);
+
+/*
+################################################
+##                   INPUT                    ##
+################################################
+*/
+
+InputQueue input_queue;
+
+bool push_input_event(InputQueue* queue, InputKey key, bool pressed, double time)
+{
+    size_t tail = queue->tail.load(std::memory_order_relaxed);
+    if(tail - queue->head.load(std::memory_order_acquire) == INPUT_QUEUE_CAPACITY)
+    {
+        ++queue->dropped;
+        return false;
+    }
+    queue->events[tail % INPUT_QUEUE_CAPACITY] = InputEvent{time, key, pressed};
+    queue->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// Applies every event up to 'tick_end' and returns the input for that tick.
+// Later events stay queued for the ticks they belong to.
+GameInput drain_input(InputQueue* queue, InputLatch* latch, double tick_end)
+{
+    size_t head = queue->head.load(std::memory_order_relaxed);
+    size_t tail = queue->tail.load(std::memory_order_acquire);
+    for(; head != tail; ++head)
+    {
+        const InputEvent& event = queue->events[head % INPUT_QUEUE_CAPACITY];
+        if(event.time > tick_end) break;
+        if(event.pressed && !latch->has_press)
+        {
+            latch->has_press = true;
+            latch->press_time = event.time;
+        }
+
+        if(event.key == INPUT_FIRE)
+        {
+            if(event.pressed) ++latch->pending_fire;
+        }
+        else
+        {
+            latch->held[event.key] = event.pressed;
+            if(event.pressed) latch->tapped[event.key] = true;
+        }
+    }
+    queue->head.store(head, std::memory_order_release);
+
+    bool left = latch->held[INPUT_LEFT] || latch->tapped[INPUT_LEFT];
+    bool right = latch->held[INPUT_RIGHT] || latch->tapped[INPUT_RIGHT];
+    latch->tapped[INPUT_LEFT] = latch->tapped[INPUT_RIGHT] = false;
+
+    // One shot per tick; extra presses fire on the ticks after
+    GameInput input = {(int)right - (int)left, latch->pending_fire > 0};
+    if(latch->pending_fire) --latch->pending_fire;
+    return input;
+}
+
+void error_callback(int error, const char* description)
+{
+    fprintf(stderr, "Error: %s\n", description);
+}
+
+bool keys_from_evdev = false;
+
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    // evdev_input.h reads the same presses straight from the kernel.
+    // GLFW's time is the platform's own stamp where it keeps one.
+    if(!keys_from_evdev) handle_key(key, action, glfwGetKeyEventTime());
+}
+
+void handle_key(int key, int action, double time)
+{
+    switch(key)
+    {
+        case GLFW_KEY_ESCAPE:
+            if (action == GLFW_PRESS) game_running = false;
+            break;
+        case GLFW_KEY_RIGHT:
+        case GLFW_KEY_LEFT:
+        case GLFW_KEY_SPACE:
+            if (game_start && action != GLFW_REPEAT)
+            {
+                InputKey input = key == GLFW_KEY_RIGHT ? INPUT_RIGHT : key == GLFW_KEY_LEFT ? INPUT_LEFT : INPUT_FIRE;
+                push_input_event(&input_queue, input, action == GLFW_PRESS, time);
+            }
+            break;
+        case GLFW_KEY_ENTER:
+            if (action == GLFW_RELEASE) game_start = true;
+            break;
+        case GLFW_KEY_P:
+            if (action == GLFW_PRESS) pacing_cycle_pressed = true;
+            break;
+        case GLFW_KEY_F2:
+            // Hiding it has to be swapped too
+            if (action == GLFW_PRESS)
+            {
+                show_debug_overlay = !show_debug_overlay;
+                window_damaged = true;
+            }
+            break;
+        case GLFW_KEY_F3:
+            if (action == GLFW_PRESS) show_profiler = !show_profiler;
+            break;
+        case GLFW_KEY_F4:
+            if (action == GLFW_PRESS) raster_cycle_pressed = true;
+            break;
+        case GLFW_KEY_F5:
+            if (action == GLFW_PRESS) upload_cycle_pressed = true;
+            break;
+        case GLFW_KEY_F6:
+            if (action == GLFW_PRESS) histogram_key_pressed = true;
+            break;
+        case GLFW_KEY_F9:
+            if (action == GLFW_PRESS) trace_key_pressed = true;
+            break;
+        case GLFW_KEY_F12:
+            if (action == GLFW_PRESS) screenshot_pressed = true;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+################################################
+##                  GAMEPADS                  ##
+################################################
+*/
+
+#define GAMEPAD_DEADZONE 0.5f
+
+GamepadInput gamepads;
+
+void joystick_callback(int jid, int event)
+{
+    if(jid < 0 || jid >= GAMEPAD_SLOTS) return;
+
+    // Joysticks without a gamepad mapping are left alone
+    bool connected = event == GLFW_CONNECTED && glfwJoystickIsGamepad(jid);
+    if(connected == gamepads.connected[jid]) return;
+    gamepads.connected[jid] = connected;
+    if(connected) ++gamepads.num_connected;
+    else --gamepads.num_connected;
+}
+
+void poll_gamepads(GamepadInput* pads, InputQueue* queue)
+{
+    if(!pads->num_connected) return;
+
+    bool held[INPUT_FIRE + 1] = {};
+    bool start = false;
+    for(int jid = 0; jid < GAMEPAD_SLOTS; ++jid)
+    {
+        GLFWgamepadstate state;
+        if(!pads->connected[jid] || !glfwGetGamepadState(jid, &state)) continue;
+
+        float stick = state.axes[GLFW_GAMEPAD_AXIS_LEFT_X];
+        held[INPUT_LEFT] |= state.buttons[GLFW_GAMEPAD_BUTTON_DPAD_LEFT] || stick < -GAMEPAD_DEADZONE;
+        held[INPUT_RIGHT] |= state.buttons[GLFW_GAMEPAD_BUTTON_DPAD_RIGHT] || stick > GAMEPAD_DEADZONE;
+        held[INPUT_FIRE] |= state.buttons[GLFW_GAMEPAD_BUTTON_A] == GLFW_PRESS;
+        start |= state.buttons[GLFW_GAMEPAD_BUTTON_START] == GLFW_PRESS;
+    }
+
+    // START behaves like Enter, starting the game when it is let go
+    if(pads->start && !start) game_start = true;
+    pads->start = start;
+
+    double now = glfwGetTime();
+    for(size_t ki = 0; ki <= INPUT_FIRE; ++ki)
+    {
+        if(held[ki] == pads->held[ki]) continue;
+        pads->held[ki] = held[ki];
+        if(game_start) push_input_event(queue, (InputKey)ki, held[ki], now);
+    }
+}
+
+/*
+################################################
+##               STATIC SCREENS               ##
+################################################
+*/
+
+#define IDLE_GAMEPAD_POLL (1.0 / 30.0)
+
+void wait_idle_events(const GamepadInput& pads)
+{
+    if(pads.num_connected) glfwWaitEventsTimeout(IDLE_GAMEPAD_POLL);
+    else glfwWaitEvents();
+}
+
+// No key is held and no shot is waiting for the next tick
+bool input_is_idle(const InputLatch& latch)
+{
+    return !latch.held[INPUT_LEFT] && !latch.held[INPUT_RIGHT] && !latch.pending_fire;
+}
+
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    framebuffer_width = width;
+    framebuffer_height = height;
+    framebuffer_resized = true;
+    window_damaged = true;
+}
+
+// The window system lost the window's contents, the next frame must swap
+// even if it is unchanged
+void window_refresh_callback(GLFWwindow* window)
+{
+    window_damaged = true;
+}
+
+/*
+################################################
+##                 EVENT PUMP                 ##
+################################################
+*/
+
+const char* event_pump_mode_names[NUM_PUMP_MODES] = {"always", "adaptive"};
+
+void init_event_pump(EventPump* pump, EventPumpMode mode)
+{
+    *pump = EventPump{};
+    pump->mode = mode;
+    if(mode != PUMP_ADAPTIVE) return;
+    int platform = glfwGetPlatform();
+    if(platform == GLFW_PLATFORM_X11) pump->pending = x11_events_pending;
+    else if(platform == GLFW_PLATFORM_WAYLAND) pump->pending = wayland_events_pending;
+}
+
+void pump_events(EventPump* pump)
+{
+    if(pump->pending && pump->skips_in_row < EVENT_PUMP_MAX_SKIPS && !pump->pending())
+    {
+        ++pump->skips_in_row;
+        ++pump->skips;
+        return;
+    }
+    glfwPollEvents();
+    pump->skips_in_row = 0;
+    ++pump->pumps;
+}
+
+void print_event_pump(const EventPump& pump)
+{
+    if(pump.mode != PUMP_ADAPTIVE) return;
+    if(!pump.pending)
+    {
+        printf("Event pump: adaptive has no check on this platform, pumped every frame\n");
+        return;
+    }
+    uint64_t frames = pump.pumps + pump.skips;
+    printf(
+        "Event pump: adaptive, dispatched on %llu of %llu frames (%.1f%%)\n", (unsigned long long)pump.pumps,
+        (unsigned long long)frames, frames ? 100.0 * pump.pumps / frames : 0.0
+    );
+}
+
+/*
+################################################
+##                 EVENT LOOP                 ##
+################################################
+*/
+
+const char* event_loop_mode_names[NUM_EVENT_LOOP_MODES] = {"sleep", "reactor"};
+
+static void display_ready(void*)
+{
+    glfwPollEvents();
+}
+
+static void spectate_packets_ready(void* context)
+{
+    receive_spectate_packets((SpectateClient*)context, glfwGetTime());
+}
+
+static void spectator_acks_ready(void* context)
+{
+    receive_spectator_acks((SpectateServer*)context, glfwGetTime());
+}
+
+bool open_event_loop(Reactor* reactor, SpectateClient* client, SpectateServer* server)
+{
+    if(!open_reactor(reactor)) return false;
+    int platform = glfwGetPlatform();
+    int display_fd = platform == GLFW_PLATFORM_X11 ? x11_connection_fd() :
+        platform == GLFW_PLATFORM_WAYLAND ? wayland_connection_fd() : -1;
+    if(display_fd >= 0) watch_reactor_fd(reactor, display_fd, "display", display_ready, 0);
+    if(client) watch_reactor_fd(reactor, spectate_client_fd(client), "spectate", spectate_packets_ready, client);
+    if(server) watch_reactor_fd(reactor, spectate_server_fd(server), "spectators", spectator_acks_ready, server);
+    return true;
+}
+
+/*
+################################################
+##              STARTUP PROFILE               ##
+################################################
+*/
+
+const char* startup_phase_names[NUM_STARTUP_PHASES] =
+{
+    "options", "glfw_init", "window", "gl_loader", "buffers", "shaders", "textures", "sprites", "formation", "first_frame"
+};
+
+// Closed by whichever thread swaps first, after main() has set it up
+StartupProfile startup_profile;
+
+void begin_startup_profile(StartupProfile* profile)
+{
+    *profile = StartupProfile{};
+    profile->start = profile->mark = std::chrono::steady_clock::now();
+}
+
+void mark_startup_phase(StartupProfile* profile, StartupPhase phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    profile->seconds[phase] += std::chrono::duration<double>(now - profile->mark).count();
+    profile->mark = now;
+}
+
+void write_startup_profile(const StartupProfile& profile, double total)
+{
+    FILE* file = fopen(profile.json_path, "w");
+    if(!file)
+    {
+        fprintf(stderr, "Could not create '%s'.\n", profile.json_path);
+        return;
+    }
+    fprintf(file, "{\n  \"total_ms\": %.3f,\n  \"phases\": {\n", total * 1000.0);
+    for(size_t pi = 0; pi < NUM_STARTUP_PHASES; ++pi)
+    {
+        fprintf(file, "    \"%s\": %.3f%s\n", startup_phase_names[pi], profile.seconds[pi] * 1000.0, pi + 1 < NUM_STARTUP_PHASES ? "," : "");
+    }
+    fprintf(file, "  },\n  \"background\": {\"assets_ms\": %.3f, \"waited_ms\": %.3f},\n",
+        profile.background_seconds * 1000.0, profile.background_waited * 1000.0);
+    fprintf(file, "  \"pages\": {\n    \"huge_pages\": %s,\n", huge_pages_enabled() ? "true" : "false");
+    PageStats pages;
+    read_page_stats(&pages);
+    for(size_t ki = 0; ki < NUM_PAGE_KINDS; ++ki)
+    {
+        fprintf(file, "    \"%s\": {\"blocks\": %llu, \"bytes\": %llu},\n", page_kind_names[ki],
+            (unsigned long long)pages.blocks[ki], (unsigned long long)pages.bytes[ki]);
+    }
+    fprintf(file, "    \"fallbacks\": %llu,\n    \"huge_resident_bytes\": %llu\n  }\n}\n",
+        (unsigned long long)pages.fallbacks, (unsigned long long)pages.huge_resident);
+    if(fclose(file) != 0) fprintf(stderr, "Could not write '%s'.\n", profile.json_path);
+}
+
+void finish_startup_profile(StartupProfile* profile)
+{
+    if(profile->done) return;
+    profile->done = true;
+    mark_startup_phase(profile, STARTUP_FIRST_FRAME);
+
+    double total = std::chrono::duration<double>(profile->mark - profile->start).count();
+    printf("Startup: %.2f ms to the first frame\n", total * 1000.0);
+    for(size_t pi = 0; pi < NUM_STARTUP_PHASES; ++pi)
+    {
+        printf("  %-12s %8.2f ms\n", startup_phase_names[pi], profile->seconds[pi] * 1000.0);
+    }
+    if(profile->background_seconds > 0.0)
+    {
+        printf("  %-12s %8.2f ms alongside, %.2f ms of it waited for\n", "assets",
+            profile->background_seconds * 1000.0, profile->background_waited * 1000.0);
+    }
+    print_page_stats();
+    if(profile->json_path) write_startup_profile(*profile, total);
+}
+
+static void load_startup_assets(StartupAssets* assets)
+{
+    enter_thread_role(THREAD_WORKER);
+    if(assets->atlas_path && open_atlas_file(&assets->atlas, assets->atlas_path))
+    {
+        AtlasSlot slots[] = {
+            {"title", &assets->title_sprite, 1},
+            {"particle", &assets->particle_sprite, 1},
+            {"font", &assets->text_spritesheet, FONT_NUM_GLYPHS},
+        };
+        assets->atlas_applied = apply_atlas(assets->atlas, slots, sizeof(slots) / sizeof(slots[0]));
+    }
+
+    GameState* state = assets->state;
+    init_game_state(state, assets->width, assets->height);
+    if(assets->start_wave)
+    {
+        state->wave = assets->start_wave;
+        reset_formation(state);
+    }
+    assets->story = assets->pages_path ? load_story_pages(assets->pages_path) : 0;
+    if(assets->story) apply_story_pages(state, *assets->story);
+
+    if(assets->audio)
+    {
+        bool have_bank = assets->sounds_path && open_sound_bank(&assets->sound_bank, assets->sounds_path);
+        assets->mixer = create_audio_mixer(have_bank ? &assets->sound_bank : 0);
+    }
+    assets->ready = std::chrono::steady_clock::now();
+}
+
+void start_startup_assets(StartupAssets* assets, GameState* state, size_t width, size_t height, size_t start_wave,
+    const char* atlas_path, const char* pages_path, const char* sounds_path, bool audio)
+{
+    assets->atlas_path = atlas_path;
+    assets->pages_path = pages_path;
+    assets->sounds_path = sounds_path;
+    assets->width = width;
+    assets->height = height;
+    assets->start_wave = start_wave;
+    assets->audio = audio;
+    assets->state = state;
+    assets->atlas = AtlasFile{};
+    assets->atlas_applied = 0;
+    assets->title_sprite = builtin_title_sprite;
+    assets->particle_sprite = builtin_particle_sprite;
+    assets->text_spritesheet = builtin_text_spritesheet;
+    assets->story = 0;
+    assets->sound_bank = SoundBank{};
+    assets->mixer = 0;
+    assets->pending = true;
+    assets->start = std::chrono::steady_clock::now();
+    assets->thread = std::thread(load_startup_assets, assets);
+}
+
+void finish_startup_assets(StartupAssets* assets, StartupProfile* profile)
+{
+    if(!assets->pending) return;
+    auto wait_start = std::chrono::steady_clock::now();
+    assets->thread.join();
+    assets->pending = false;
+    profile->background_waited += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+    profile->background_seconds += std::chrono::duration<double>(assets->ready - assets->start).count();
+}
+
+/*
+################################################
+##             HEADLESS BENCHMARK             ##
+################################################
+*/
+
+// Scripted key presses for frame 'frame', stamped at the frame's start
+void bench_input(InputQueue* queue, size_t frame, double time)
+{
+    // Coprime periods, so shots eventually leave from every column
+    InputKey key = (frame / 97) % 2 ? INPUT_LEFT : INPUT_RIGHT;
+    if(frame % 97 == 0)
+    {
+        if(frame) push_input_event(queue, key == INPUT_LEFT ? INPUT_RIGHT : INPUT_LEFT, false, time);
+        push_input_event(queue, key, true, time);
+    }
+    if(frame % 11 == 0)
+    {
+        push_input_event(queue, INPUT_FIRE, true, time);
+        push_input_event(queue, INPUT_FIRE, false, time);
+    }
+}
+
+/*
+################################################
+##              INPUT RECORDINGS              ##
+################################################
+*/
+
+#define REPLAY_MAGIC 0x594c5052u // "RPLY"
+#define REPLAY_VERSION 3
+// Version 1 recordings have no keyframes, and their runs follow the
+// header's fields up to the checksum; version 2 ones have no hashes,
+// and their runs follow the fields up to the block size
+#define REPLAY_V1_HEADER_SIZE 40
+#define REPLAY_V2_HEADER_SIZE 80
+static_assert(offsetof(ReplayHeader, hashes_offset) == REPLAY_V2_HEADER_SIZE, "version 2 headers end before the hashes");
+
+inline uint64_t align_replay(uint64_t offset)
+{
+    return (offset + REPLAY_ALIGNMENT - 1) & ~(uint64_t)(REPLAY_ALIGNMENT - 1);
+}
+
+// Bit 0 is fire, bits 1-2 the direction: 1 right, 2 left
+inline uint8_t encode_replay_input(const GameInput& input)
+{
+    return (input.fire ? 1 : 0) | (input.move_dir > 0 ? 2 : input.move_dir < 0 ? 4 : 0);
+}
+
+inline GameInput decode_replay_input(uint8_t code)
+{
+    return GameInput{(code & 2) ? 1 : (code & 4) ? -1 : 0, (code & 1) != 0};
+}
+
+void init_input_recording(InputReplay* replay, size_t width, size_t height, size_t wave, uint32_t flags, size_t keyframe_ticks, bool hashes)
+{
+    *replay = InputReplay{};
+    ReplayHeader& header = replay->header;
+    header.magic = REPLAY_MAGIC;
+    header.version = REPLAY_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.wave = (uint32_t)wave;
+    header.flags = flags;
+    header.keyframe_ticks = (uint32_t)keyframe_ticks;
+    replay->capacity = 1024;
+    replay->recorded = new ReplayRun[replay->capacity];
+    replay->runs = replay->recorded;
+    replay->record_hashes = hashes;
+    if(hashes)
+    {
+        replay->hashes_capacity = 4096;
+        replay->recorded_hashes = new uint64_t[replay->hashes_capacity];
+    }
+    replay->diverged = UINT64_MAX;
+}
+
+// The state before tick num_ticks, and where the runs stand then
+static void record_keyframe(InputReplay* replay, const GameState& state)
+{
+    ReplayHeader& header = replay->header;
+    if(!header.num_keyframes)
+    {
+        header.state_size = sizeof(GameState);
+        header.block_size = (uint32_t)state.block.size;
+        header.keyframe_stride = align_replay(sizeof(ReplayKeyframe) + sizeof(GameState) + state.block.size);
+    }
+    // A block that changed size would leave a gap, so keyframes end there
+    if(state.block.size != header.block_size || (uint64_t)header.num_keyframes * header.keyframe_ticks != header.num_ticks) return;
+
+    size_t stride = (size_t)header.keyframe_stride;
+    if((header.num_keyframes + 1) * stride > replay->keyframes_capacity)
+    {
+        size_t capacity = replay->keyframes_capacity ? 2 * replay->keyframes_capacity : 16 * stride;
+        uint8_t* keyframes = new uint8_t[capacity];
+        if(replay->keyframes) memcpy(keyframes, replay->keyframes, header.num_keyframes * stride);
+        delete[] replay->keyframes;
+        replay->keyframes = keyframes;
+        replay->keyframes_capacity = capacity;
+    }
+
+    uint8_t* record = replay->keyframes + header.num_keyframes * stride;
+    memset(record, 0, stride);
+    ReplayKeyframe keyframe = {header.num_ticks, 0, 0};
+    if(replay->num_runs)
+    {
+        keyframe.run = replay->num_runs - 1;
+        keyframe.run_tick = replay->recorded[keyframe.run].count;
+    }
+    memcpy(record, &keyframe, sizeof(ReplayKeyframe));
+    memcpy(record + sizeof(ReplayKeyframe), &state, sizeof(GameState));
+    memcpy(record + sizeof(ReplayKeyframe) + sizeof(GameState), state.block.data, state.block.size);
+    ++header.num_keyframes;
+}
+
+// 'state' is the state the input is about to step
+void record_input(InputReplay* replay, const GameState& state, const GameInput& input)
+{
+    if(replay->header.keyframe_ticks && replay->header.num_ticks % replay->header.keyframe_ticks == 0) record_keyframe(replay, state);
+    if(replay->record_hashes)
+    {
+        if(replay->header.num_ticks == replay->hashes_capacity)
+        {
+            uint64_t* hashes = new uint64_t[2 * replay->hashes_capacity];
+            memcpy(hashes, replay->recorded_hashes, replay->hashes_capacity * sizeof(uint64_t));
+            delete[] replay->recorded_hashes;
+            replay->recorded_hashes = hashes;
+            replay->hashes_capacity *= 2;
+        }
+        replay->recorded_hashes[replay->header.num_ticks] = game_state_hash(state);
+    }
+
+    uint8_t code = encode_replay_input(input);
+    ++replay->header.num_ticks;
+    if(replay->num_runs)
+    {
+        ReplayRun& last = replay->recorded[replay->num_runs - 1];
+        if(last.input == code && last.count < UINT8_MAX)
+        {
+            ++last.count;
+            return;
+        }
+    }
+
+    if(replay->num_runs == replay->capacity)
+    {
+        ReplayRun* runs = new ReplayRun[2 * replay->capacity];
+        memcpy(runs, replay->recorded, replay->num_runs * sizeof(ReplayRun));
+        delete[] replay->recorded;
+        replay->recorded = runs;
+        replay->runs = runs;
+        replay->capacity *= 2;
+    }
+    replay->recorded[replay->num_runs++] = ReplayRun{code, 1};
+}
+
+bool write_input_recording(InputReplay* replay, const char* path, uint64_t checksum)
+{
+    FILE* file = fopen(path, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Could not create '%s'.\n", path);
+        return false;
+    }
+
+    ReplayHeader& header = replay->header;
+    header.checksum = checksum;
+    header.num_runs = replay->num_runs;
+    uint64_t runs_end = sizeof(ReplayHeader) + replay->num_runs * sizeof(ReplayRun);
+    header.keyframes_offset = header.num_keyframes ? align_replay(runs_end) : 0;
+    uint64_t keyframes_end = header.num_keyframes ? header.keyframes_offset + header.num_keyframes * header.keyframe_stride : runs_end;
+    size_t num_hashes = replay->record_hashes ? (size_t)header.num_ticks : 0;
+    header.hashes_offset = num_hashes ? align_replay(keyframes_end) : 0;
+    uint64_t size = num_hashes ? header.hashes_offset + num_hashes * sizeof(uint64_t) : keyframes_end;
+
+    static const uint8_t padding[REPLAY_ALIGNMENT] = {};
+    size_t num_padding = header.num_keyframes ? (size_t)(header.keyframes_offset - runs_end) : 0;
+    size_t num_hash_padding = num_hashes ? (size_t)(header.hashes_offset - keyframes_end) : 0;
+    bool ok = fwrite(&header, sizeof(ReplayHeader), 1, file) == 1 &&
+              fwrite(replay->recorded, sizeof(ReplayRun), replay->num_runs, file) == replay->num_runs &&
+              fwrite(padding, 1, num_padding, file) == num_padding &&
+              fwrite(replay->keyframes, (size_t)header.keyframe_stride, header.num_keyframes, file) == header.num_keyframes &&
+              fwrite(padding, 1, num_hash_padding, file) == num_hash_padding &&
+              fwrite(replay->recorded_hashes, sizeof(uint64_t), num_hashes, file) == num_hashes;
+    if(fclose(file) != 0) ok = false;
+    if(!ok) fprintf(stderr, "Could not write '%s'.\n", path);
+    else
+    {
+        printf("Recorded %llu ticks to '%s' in %llu bytes, %u keyframes%s\n",
+            (unsigned long long)header.num_ticks, path, (unsigned long long)size, header.num_keyframes,
+            num_hashes ? ", tick hashes" : "");
+    }
+    return ok;
+}
+
+// Maps the whole file read-only; without mmap it is read into one block
+static bool map_replay_file(InputReplay* replay, const char* path)
+{
+#if REPLAY_USE_MMAP
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(0, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return false;
+
+    replay->file = (const uint8_t*)data;
+    replay->file_size = (size_t)info.st_size;
+    replay->mapped = true;
+    return true;
+#else
+    FILE* file = fopen(path, "rb");
+    if(!file) return false;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(size <= 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    // uint64_t storage keeps the keyframes as aligned as in a mapping
+    uint64_t* data = new uint64_t[((size_t)size + 7) / 8];
+    bool ok = fread(data, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if(!ok)
+    {
+        delete[] data;
+        return false;
+    }
+
+    replay->file = (const uint8_t*)data;
+    replay->file_size = (size_t)size;
+    return true;
+#endif
+}
+
+static void unmap_replay_file(InputReplay* replay)
+{
+    if(!replay->file) return;
+#if REPLAY_USE_MMAP
+    munmap((void*)replay->file, replay->file_size);
+#else
+    delete[] (const uint64_t*)replay->file;
+#endif
+    replay->file = 0;
+}
+
+// Everything the header points at has to lie within the file
+static bool validate_replay_file(InputReplay* replay)
+{
+    size_t size = replay->file_size;
+    if(size < REPLAY_V1_HEADER_SIZE) return false;
+
+    ReplayHeader& header = replay->header;
+    header = ReplayHeader{};
+    memcpy(&header, replay->file, size < sizeof(ReplayHeader) ? size : sizeof(ReplayHeader));
+    if(header.magic != REPLAY_MAGIC) return false;
+
+    size_t runs_offset;
+    if(header.version == 1)
+    {
+        ReplayHeader v1 = {};
+        memcpy(&v1, replay->file, REPLAY_V1_HEADER_SIZE);
+        header = v1;
+        runs_offset = REPLAY_V1_HEADER_SIZE;
+        header.num_runs = (size - runs_offset) / sizeof(ReplayRun);
+    }
+    else if((header.version == 2 && size >= REPLAY_V2_HEADER_SIZE) || (header.version == REPLAY_VERSION && size >= sizeof(ReplayHeader)))
+    {
+        runs_offset = sizeof(ReplayHeader);
+        if(header.version == 2)
+        {
+            ReplayHeader v2 = {};
+            memcpy(&v2, replay->file, REPLAY_V2_HEADER_SIZE);
+            header = v2;
+            runs_offset = REPLAY_V2_HEADER_SIZE;
+        }
+        if(header.num_runs > (size - runs_offset) / sizeof(ReplayRun)) return false;
+        uint64_t runs_end = runs_offset + header.num_runs * sizeof(ReplayRun);
+        if(header.num_keyframes)
+        {
+            uint64_t record_size = sizeof(ReplayKeyframe) + (uint64_t)header.state_size + header.block_size;
+            if(!header.keyframe_ticks || header.keyframes_offset % REPLAY_ALIGNMENT || header.keyframe_stride < record_size) return false;
+            if(header.keyframes_offset < runs_end || header.keyframes_offset > size) return false;
+            if(header.num_keyframes > (size - header.keyframes_offset) / header.keyframe_stride) return false;
+        }
+        if(header.hashes_offset)
+        {
+            if(header.hashes_offset % REPLAY_ALIGNMENT || header.hashes_offset < runs_end || header.hashes_offset > size) return false;
+            if(header.num_ticks > (size - header.hashes_offset) / sizeof(uint64_t)) return false;
+        }
+    }
+    else return false;
+
+    replay->runs = (const ReplayRun*)(replay->file + runs_offset);
+    replay->num_runs = (size_t)header.num_runs;
+    replay->hashes = header.hashes_offset ? (const uint64_t*)(replay->file + header.hashes_offset) : 0;
+    return true;
+}
+
+// Maps the recording; only the runs are read here, keyframes when a seek
+// loads one
+bool read_input_recording(InputReplay* replay, const char* path)
+{
+    *replay = InputReplay{};
+    replay->diverged = UINT64_MAX;
+    if(!map_replay_file(replay, path))
+    {
+        fprintf(stderr, "Could not open recording '%s'.\n", path);
+        return false;
+    }
+    bool ok = validate_replay_file(replay);
+
+    // The runs have to add up to the ticks the header promises
+    uint64_t ticks = 0;
+    for(size_t ri = 0; ok && ri < replay->num_runs; ++ri) ticks += replay->runs[ri].count;
+    if(!ok || ticks != replay->header.num_ticks)
+    {
+        fprintf(stderr, "'%s' is not a valid input recording.\n", path);
+        destroy_input_replay(replay);
+        return false;
+    }
+    return true;
+}
+
+// The next recorded tick's input, false once the recording is used up
+bool next_replay_input(InputReplay* replay, GameInput* input)
+{
+    while(replay->run < replay->num_runs && replay->run_tick == replay->runs[replay->run].count)
+    {
+        ++replay->run;
+        replay->run_tick = 0;
+    }
+    if(replay->run == replay->num_runs) return false;
+
+    *input = decode_replay_input(replay->runs[replay->run].input);
+    ++replay->run_tick;
+    ++replay->played;
+    return true;
+}
+
+void check_replay_hash(InputReplay* replay, const GameState& state)
+{
+    uint64_t tick = replay->played;
+    if(!replay->hashes || replay->diverged != UINT64_MAX || tick >= replay->header.num_ticks) return;
+    ++replay->checked;
+    if(game_state_hash(state) == replay->hashes[tick]) return;
+
+    replay->diverged = tick;
+    fprintf(stderr, "Replay diverged from the recording at tick %llu%s.\n", (unsigned long long)tick,
+        tick ? "" : ", before any input; recorded by another build?");
+}
+
+// Keyframes only fit the build and the size that recorded them
+static const ReplayKeyframe* find_keyframe(const InputReplay& replay, const GameState& state, uint64_t tick)
+{
+    const ReplayHeader& header = replay.header;
+    if(!header.num_keyframes || header.state_size != sizeof(GameState) || header.block_size != state.block.size) return 0;
+
+    uint64_t index = tick / header.keyframe_ticks;
+    if(index >= header.num_keyframes) index = header.num_keyframes - 1;
+    const ReplayKeyframe* keyframe = (const ReplayKeyframe*)(replay.file + header.keyframes_offset + index * header.keyframe_stride);
+    if(keyframe->tick > tick || keyframe->run > replay.num_runs) return 0;
+    if(keyframe->run < replay.num_runs && keyframe->run_tick > replay.runs[keyframe->run].count) return 0;
+    return keyframe;
+}
+
+uint64_t seek_input_replay(InputReplay* replay, GameState* state, uint64_t tick)
+{
+    const ReplayHeader& header = replay->header;
+    if(tick > header.num_ticks) tick = header.num_ticks;
+
+    const ReplayKeyframe* keyframe = find_keyframe(*replay, *state, tick);
+    if(keyframe && (keyframe->tick >= replay->played || tick < replay->played))
+    {
+        // The image follows the keyframe header, short of the state's alignment
+        const uint8_t* image = (const uint8_t*)(keyframe + 1);
+        GameState saved;
+        memcpy((void*)&saved, image, sizeof(GameState));
+        if(load_game_state(state, saved, image + header.state_size))
+        {
+            replay->run = (size_t)keyframe->run;
+            replay->run_tick = (size_t)keyframe->run_tick;
+            replay->played = keyframe->tick;
+        }
+    }
+
+    // Waves go on as run_ticks() and the main loop would have them
+    uint64_t simulated = 0;
+    GameInput input;
+    while(replay->played < tick)
+    {
+        check_replay_hash(replay, *state);
+        if(!next_replay_input(replay, &input)) break;
+        if(!state->game.aliens.num_live)
+        {
+            if(header.flags & REPLAY_ENDLESS)
+            {
+                ++state->wave;
+                reset_formation(state);
+            }
+            else if(header.flags & REPLAY_RESPAWN) reset_formation(state);
+        }
+        step_game(state, input, SIM_DT);
+        ++simulated;
+    }
+    return simulated;
+}
+
+void print_replay_results(const InputReplay& replay, uint64_t checksum)
+{
+    // A flight recording ends where the game stopped, with nothing to compare
+    if(replay.header.flags & REPLAY_FLIGHT)
+    {
+        printf("Replayed %llu ticks of a flight recording, state checksum %016llx\n",
+            (unsigned long long)replay.header.num_ticks, (unsigned long long)checksum);
+    }
+    else
+    {
+        printf("Replayed %llu ticks, state checksum %016llx (%s the recording)\n",
+            (unsigned long long)replay.header.num_ticks, (unsigned long long)checksum,
+            checksum == replay.header.checksum ? "matches" : "DIFFERS from");
+    }
+    if(replay.diverged != UINT64_MAX) printf("  Tick hashes diverged first at tick %llu\n", (unsigned long long)replay.diverged);
+    else if(replay.checked) printf("  Tick hashes match on all %llu ticks checked\n", (unsigned long long)replay.checked);
+}
+
+void destroy_input_replay(InputReplay* replay)
+{
+    delete[] replay->recorded;
+    delete[] replay->keyframes;
+    delete[] replay->recorded_hashes;
+    unmap_replay_file(replay);
+    *replay = InputReplay{};
+}
+
+/*
+################################################
+##              FLIGHT RECORDER               ##
+################################################
+*/
+
+void init_flight_recorder(FlightRecorder* recorder, const GameState& state, size_t seconds, size_t width, size_t height, uint32_t flags, const char* path)
+{
+    recorder->capacity = (seconds ? seconds : 1) * SIM_TICK_RATE;
+    recorder->inputs = new uint8_t[recorder->capacity];
+    recorder->hashes = new uint64_t[recorder->capacity];
+    recorder->ticks.store(0, std::memory_order_relaxed);
+
+    // One slot more than the window spans, and one being written
+    recorder->snapshot_interval = FLIGHT_SNAPSHOT_TICKS < recorder->capacity ? FLIGHT_SNAPSHOT_TICKS : recorder->capacity;
+    recorder->num_snapshots = recorder->capacity / recorder->snapshot_interval + 2;
+    recorder->block_size = state.block.size;
+    recorder->stride = (size_t)align_replay(sizeof(ReplayKeyframe) + sizeof(GameState) + state.block.size);
+    // Zeroed, so the padding a dump writes is the same every time
+    recorder->snapshots = new uint8_t[recorder->num_snapshots * recorder->stride]();
+    recorder->snapshot_ticks = new std::atomic<uint64_t>[recorder->num_snapshots];
+    for(size_t si = 0; si < recorder->num_snapshots; ++si) recorder->snapshot_ticks[si].store(UINT64_MAX, std::memory_order_relaxed);
+    recorder->snapshot_waves = new uint32_t[recorder->num_snapshots]();
+
+    ReplayHeader& header = recorder->header;
+    header = ReplayHeader{};
+    header.magic = REPLAY_MAGIC;
+    header.version = REPLAY_VERSION;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.flags = flags | REPLAY_FLIGHT;
+    header.keyframe_ticks = (uint32_t)recorder->snapshot_interval;
+    header.state_size = sizeof(GameState);
+    header.block_size = (uint32_t)state.block.size;
+    header.keyframe_stride = recorder->stride;
+    recorder->runs = new ReplayRun[recorder->capacity];
+
+    snprintf(recorder->path, sizeof(recorder->path), "%s", path);
+    recorder->dump_requested.store(false, std::memory_order_relaxed);
+    recorder->snapshots_taken = recorder->dumps = 0;
+}
+
+void destroy_flight_recorder(FlightRecorder* recorder)
+{
+    delete[] recorder->inputs;
+    delete[] recorder->hashes;
+    delete[] recorder->snapshots;
+    delete[] recorder->snapshot_ticks;
+    delete[] recorder->snapshot_waves;
+    delete[] recorder->runs;
+}
+
+// Copies the state into its slot, as a keyframe at tick 0 of the dump
+static void take_flight_snapshot(FlightRecorder* recorder, const GameState& state, uint64_t tick)
+{
+    if(state.block.size != recorder->block_size) return;
+    size_t slot = (size_t)(tick / recorder->snapshot_interval % recorder->num_snapshots);
+    recorder->snapshot_ticks[slot].store(UINT64_MAX, std::memory_order_release);
+    uint8_t* record = recorder->snapshots + slot * recorder->stride;
+    ReplayKeyframe keyframe = {0, 0, 0};
+    memcpy(record, &keyframe, sizeof(ReplayKeyframe));
+    memcpy(record + sizeof(ReplayKeyframe), &state, sizeof(GameState));
+    memcpy(record + sizeof(ReplayKeyframe) + sizeof(GameState), state.block.data, state.block.size);
+    recorder->snapshot_waves[slot] = (uint32_t)state.wave;
+    recorder->snapshot_ticks[slot].store(tick, std::memory_order_release);
+    ++recorder->snapshots_taken;
+}
+
+void record_flight_tick(FlightRecorder* recorder, const GameState& state, const GameInput& input)
+{
+    if(recorder->dump_requested.exchange(false, std::memory_order_relaxed))
+    {
+        uint64_t written = dump_flight_recorder(recorder);
+        if(written) printf("Flight recorder: dumped the last %llu ticks to '%s'\n", (unsigned long long)written, recorder->path);
+    }
+
+    uint64_t tick = recorder->ticks.load(std::memory_order_relaxed);
+    if(tick % recorder->snapshot_interval == 0) take_flight_snapshot(recorder, state, tick);
+    size_t entry = (size_t)(tick % recorder->capacity);
+    recorder->inputs[entry] = encode_replay_input(input);
+    recorder->hashes[entry] = game_state_hash(state);
+    recorder->ticks.store(tick + 1, std::memory_order_release);
+}
+
+#if FLIGHT_USE_SIGNALS
+
+static const int flight_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGUSR1};
+#define FLIGHT_NUM_SIGNALS (sizeof(flight_signals) / sizeof(flight_signals[0]))
+
+static FlightRecorder* flight_recorder;
+static struct sigaction flight_saved_actions[FLIGHT_NUM_SIGNALS];
+static uint8_t* flight_signal_stack;
+
+static bool write_flight_bytes(int fd, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    while(size)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if(written < 0 && errno == EINTR) continue;
+        if(written <= 0) return false;
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static void write_flight_message(const char* text)
+{
+    if(write(STDERR_FILENO, text, strlen(text)) < 0) return;
+}
+
+uint64_t dump_flight_recorder(FlightRecorder* recorder)
+{
+    uint64_t end = recorder->ticks.load(std::memory_order_acquire);
+    uint64_t oldest = end > recorder->capacity ? end - recorder->capacity : 0;
+
+    // The oldest whole keyframe whose ticks are all still in the ring
+    size_t slot = SIZE_MAX;
+    uint64_t start = UINT64_MAX;
+    for(size_t si = 0; si < recorder->num_snapshots; ++si)
+    {
+        uint64_t tick = recorder->snapshot_ticks[si].load(std::memory_order_acquire);
+        if(tick == UINT64_MAX || tick < oldest || tick > end || tick >= start) continue;
+        start = tick;
+        slot = si;
+    }
+    if(slot == SIZE_MAX) return 0;
+
+    // Runs as record_input() makes them
+    size_t num_runs = 0;
+    for(uint64_t tick = start; tick < end; ++tick)
+    {
+        uint8_t code = recorder->inputs[tick % recorder->capacity];
+        if(num_runs && recorder->runs[num_runs - 1].input == code && recorder->runs[num_runs - 1].count < UINT8_MAX) ++recorder->runs[num_runs - 1].count;
+        else recorder->runs[num_runs++] = ReplayRun{code, 1};
+    }
+
+    ReplayHeader header = recorder->header;
+    header.wave = recorder->snapshot_waves[slot];
+    header.num_ticks = end - start;
+    header.num_runs = num_runs;
+    header.num_keyframes = 1;
+    uint64_t runs_end = sizeof(ReplayHeader) + num_runs * sizeof(ReplayRun);
+    header.keyframes_offset = align_replay(runs_end);
+    uint64_t keyframes_end = header.keyframes_offset + header.keyframe_stride;
+    header.hashes_offset = align_replay(keyframes_end);
+
+    int fd = open(recorder->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) return 0;
+    static const uint8_t padding[REPLAY_ALIGNMENT] = {};
+    size_t first = (size_t)(start % recorder->capacity), count = (size_t)(end - start);
+    size_t wrapped = first + count > recorder->capacity ? first + count - recorder->capacity : 0;
+    bool ok = write_flight_bytes(fd, &header, sizeof(ReplayHeader)) &&
+              write_flight_bytes(fd, recorder->runs, num_runs * sizeof(ReplayRun)) &&
+              write_flight_bytes(fd, padding, (size_t)(header.keyframes_offset - runs_end)) &&
+              write_flight_bytes(fd, recorder->snapshots + slot * recorder->stride, recorder->stride) &&
+              write_flight_bytes(fd, padding, (size_t)(header.hashes_offset - keyframes_end)) &&
+              write_flight_bytes(fd, recorder->hashes + first, (count - wrapped) * sizeof(uint64_t)) &&
+              write_flight_bytes(fd, recorder->hashes, wrapped * sizeof(uint64_t));
+    if(close(fd) != 0) ok = false;
+    // The slot was written over while it went out
+    if(recorder->snapshot_ticks[slot].load(std::memory_order_acquire) != start) ok = false;
+    if(!ok) return 0;
+    ++recorder->dumps;
+    return header.num_ticks;
+}
+
+static void flight_signal(int signal)
+{
+    FlightRecorder* recorder = flight_recorder;
+    if(signal == SIGUSR1)
+    {
+        if(recorder) recorder->dump_requested.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    if(recorder)
+    {
+        write_flight_message(dump_flight_recorder(recorder) ? "Flight recorder: dumped the last ticks to '" : "Flight recorder: could not dump to '");
+        write_flight_message(recorder->path);
+        write_flight_message("'\n");
+    }
+    // Whatever handled the signal before handles it now, the default
+    // ending the process with its core dump
+    for(size_t si = 0; si < FLIGHT_NUM_SIGNALS; ++si)
+    {
+        if(flight_signals[si] == signal) sigaction(signal, &flight_saved_actions[si], 0);
+    }
+    raise(signal);
+}
+
+bool install_flight_recorder(FlightRecorder* recorder)
+{
+    if(!flight_signal_stack)
+    {
+        flight_signal_stack = new uint8_t[FLIGHT_SIGNAL_STACK];
+        stack_t stack = {};
+        stack.ss_sp = flight_signal_stack;
+        stack.ss_size = FLIGHT_SIGNAL_STACK;
+        sigaltstack(&stack, 0);
+    }
+    flight_recorder = recorder;
+    struct sigaction action = {};
+    action.sa_handler = flight_signal;
+    action.sa_flags = SA_ONSTACK | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    for(size_t si = 0; si < FLIGHT_NUM_SIGNALS; ++si) sigaction(flight_signals[si], &action, &flight_saved_actions[si]);
+    return true;
+}
+
+void uninstall_flight_recorder()
+{
+    if(!flight_recorder) return;
+    for(size_t si = 0; si < FLIGHT_NUM_SIGNALS; ++si) sigaction(flight_signals[si], &flight_saved_actions[si], 0);
+    flight_recorder = 0;
+}
+
+#else
+
+uint64_t dump_flight_recorder(FlightRecorder*) { return 0; }
+
+bool install_flight_recorder(FlightRecorder*)
+{
+    fprintf(stderr, "The flight recorder dumps from POSIX signal handlers, it is off.\n");
+    return false;
+}
+
+void uninstall_flight_recorder() {}
+
+#endif
+
+void print_bench_results(const FrameProfiler& profiler, size_t frames, double seconds, size_t waves, size_t score)
+{
+    printf("Bench: %zu frames in %.3f s, %.1f frames/s, %zu waves cleared, score %zu\n",
+        frames, seconds, frames / seconds, waves, score);
+    printf("  %-8s %10s %10s\n", "phase", "avg us", "p99 us");
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        PhaseStats stats = phase_stats(profiler, (FramePhase)pi);
+        double avg = profiler.total_frames ? profiler.totals[pi] / profiler.total_frames : 0.0;
+        printf("  %-8s %10.2f %10.2f\n", phase_names[pi], avg * 1e6, stats.p99 * 1e6);
+    }
+    if(!profiler.counters || !profiler.total_frames) return;
+
+    // Per frame, so phases compare by their share of a frame's work
+    printf("  %-8s %12s %12s %6s %10s %10s\n", "phase", "cycles", "instructions", "IPC", "LLC miss", "br miss");
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        const uint64_t* totals = profiler.counter_totals[pi];
+        double frames = (double)profiler.total_frames;
+        double ipc = totals[PERF_CYCLES] ? (double)totals[PERF_INSTRUCTIONS] / totals[PERF_CYCLES] : 0.0;
+        printf(
+            "  %-8s %12.0f %12.0f %6.2f %10.1f %10.1f\n", phase_names[pi], totals[PERF_CYCLES] / frames,
+            totals[PERF_INSTRUCTIONS] / frames, ipc, totals[PERF_LLC_MISSES] / frames, totals[PERF_BRANCH_MISSES] / frames
+        );
+    }
+}
+
+static void print_histogram_row(const char* name, const FrameHistogram& histogram)
+{
+    // Phases a run never enters, like the swap of a headless one, are left out
+    if(!histogram.max_ns) return;
+    HistogramSummary summary = summarize_histogram(histogram, 0);
+    printf(
+        "  %-8s %10llu %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, (unsigned long long)summary.count,
+        summary.p50 * 1e6, summary.p90 * 1e6, summary.p99 * 1e6, summary.p999 * 1e6, summary.max * 1e6
+    );
+}
+
+void print_frame_histograms(const FrameProfiler& profiler)
+{
+    printf("Frame times:\n  %-8s %10s %9s %9s %9s %9s %9s\n", "us", "count", "p50", "p90", "p99", "p99.9", "max");
+    print_histogram_row("WORK", profiler.work_histogram);
+    print_histogram_row("PRESENT", profiler.present_histogram);
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi) print_histogram_row(phase_names[pi], profiler.phase_histograms[pi]);
+}
+
+// One sample per percentile of what the block added to 'histogram'
+static void add_histogram_samples(BenchReport* report, const char* series, const FrameHistogram& histogram, FrameHistogram* mark)
+{
+    HistogramSummary summary = summarize_histogram(histogram, mark);
+    *mark = histogram;
+    if(!summary.count || !histogram.max_ns) return;
+
+    const char* suffixes[5] = {"p50", "p90", "p99", "p99.9", "max"};
+    double values[5] = {summary.p50, summary.p90, summary.p99, summary.p999, summary.max};
+    char name[BENCH_NAME_LENGTH];
+    for(size_t si = 0; si < 5; ++si)
+    {
+        snprintf(name, sizeof(name), "%s/%s", series, suffixes[si]);
+        add_bench_sample(report, name, "us", values[si] * 1e6);
+    }
+}
+
+void init_bench_recorder(BenchRecorder* recorder, size_t frames, double now)
+{
+    init_bench_report(&recorder->report, "SpaceInvaders");
+    recorder->block_frames = frames > BENCH_REPORT_BLOCKS ? frames / BENCH_REPORT_BLOCKS : 1;
+    recorder->mark_frame = 0;
+    recorder->mark_time = now;
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi) recorder->mark_totals[pi] = 0.0;
+    memset(recorder->mark_phases, 0, sizeof(recorder->mark_phases));
+    memset(&recorder->mark_work, 0, sizeof(recorder->mark_work));
+    memset(&recorder->mark_present, 0, sizeof(recorder->mark_present));
+}
+
+void record_bench_block(BenchRecorder* recorder, const FrameProfiler& profiler, size_t frame, double now, bool last)
+{
+    size_t frames = frame - recorder->mark_frame;
+    if(!frames || (!last && frames < recorder->block_frames)) return;
+
+    char name[BENCH_NAME_LENGTH];
+    add_bench_sample(&recorder->report, "frame/total", "us", (now - recorder->mark_time) * 1e6 / frames);
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        snprintf(name, sizeof(name), "phase/%s", phase_names[pi]);
+        add_bench_sample(&recorder->report, name, "us", (profiler.totals[pi] - recorder->mark_totals[pi]) * 1e6 / frames);
+        recorder->mark_totals[pi] = profiler.totals[pi];
+    }
+    add_histogram_samples(&recorder->report, "frame/work", profiler.work_histogram, &recorder->mark_work);
+    add_histogram_samples(&recorder->report, "frame/present", profiler.present_histogram, &recorder->mark_present);
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        snprintf(name, sizeof(name), "phase/%s", phase_names[pi]);
+        add_histogram_samples(&recorder->report, name, profiler.phase_histograms[pi], &recorder->mark_phases[pi]);
+    }
+    recorder->mark_frame = frame;
+    recorder->mark_time = now;
+}
+
+/*
+################################################
+##                  AUTOPLAY                  ##
+################################################
+*/
+
+void init_autoplay_bot(AutoplayBot* bot, uint8_t answer)
+{
+    bot->answer = answer;
+    bot->held = INPUT_FIRE;
+    bot->next_fire_tick = 0;
+    bot->shots = 0;
+}
+
+AutoplayDecision decide_autoplay(const AutoplayBot& bot, const GameState& state)
+{
+    AutoplayDecision decision = {INPUT_FIRE, false};
+    Fixed target;
+    if(state.choice_phase)
+    {
+        const Alien& answer = bot.answer == CHOICE_YES ? state.yes_alien : state.no_alien;
+        target = answer.x + (to_fixed(alien_sprite.width) - to_fixed(player_sprite.width)) / 2;
+    }
+    else if(state.game.aliens.num_live)
+    {
+        // The column whose centre is nearest the player's, or the nearest
+        // live one to it
+        const FormationMarch& march = state.march;
+        const Player& player = state.game.player;
+        Fixed centre = player.x + to_fixed(player_sprite.width) / 2;
+        Fixed home = centre - march.offset_x - march.column_x - to_fixed(state.alien_box_width) / 2;
+        size_t column = nearest_firing_column(march, home > 0 ? (size_t)((home + march.pitch_x / 2) / march.pitch_x) : 0);
+        target = march.column_x + (Fixed)column * march.pitch_x + march.offset_x + (to_fixed(state.alien_box_width) - to_fixed(player_sprite.width)) / 2;
+
+        // Led by the steps the march takes while the shot climbs to the
+        // column's lowest alien, turns at the edges aside
+        Fixed bottom = march.row_y + (Fixed)march.column_bottom[column] * march.pitch_y + march.offset_y;
+        Fixed climb = bottom - (player.y + to_fixed(player_sprite.height));
+        size_t flight = climb > 0 ? (size_t)(climb / to_fixed(PROJECTILE_SPEED)) : 0;
+        if(flight >= march.ticks_left)
+        {
+            size_t steps = 1 + (flight - march.ticks_left) / march_period(march, state.game.aliens.num_live);
+            target += to_fixed(march.dir * MARCH_STEP_X) * (Fixed)steps;
+        }
+    }
+    else return decision;
+
+    Fixed offset = target - state.game.player.x;
+    if(offset > AUTOPLAY_ALIGNMENT) decision.move = INPUT_RIGHT;
+    else if(offset < -AUTOPLAY_ALIGNMENT) decision.move = INPUT_LEFT;
+    else decision.fire = state.tick >= bot.next_fire_tick;
+    return decision;
+}
+
+void autoplay_input(AutoplayBot* bot, InputQueue* queue, const GameState& state, double time)
+{
+    AutoplayDecision decision = decide_autoplay(*bot, state);
+    if(decision.move != bot->held)
+    {
+        if(bot->held != INPUT_FIRE) push_input_event(queue, bot->held, false, time);
+        if(decision.move != INPUT_FIRE) push_input_event(queue, decision.move, true, time);
+        bot->held = decision.move;
+    }
+    if(decision.fire)
+    {
+        // A press fires on one tick only, so it is let go at once
+        push_input_event(queue, INPUT_FIRE, true, time);
+        push_input_event(queue, INPUT_FIRE, false, time);
+        bot->next_fire_tick = state.tick + AUTOPLAY_FIRE_TICKS;
+        ++bot->shots;
+    }
+}
+
+void release_autoplay_keys(AutoplayBot* bot, InputQueue* queue, double time)
+{
+    if(bot->held != INPUT_FIRE) push_input_event(queue, bot->held, false, time);
+    bot->held = INPUT_FIRE;
+}
+
+/*
+################################################
+##                PGO TRAINING                ##
+################################################
+*/
+
+#define TRAINING_PAGE_LINES 3
+
+// Letters, digits and punctuation, so most of the font gets drawn
+static const char* const training_lines[TRAINING_PAGE_LINES] = {
+    "PROFILE TRAINING RUN",
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+    "0123456789 <>=*?-"
+};
+
+static const char* const training_stage_names[NUM_TRAINING_STAGES] = {"title", "combat", "story", "choice", "ending"};
+
+void fill_training_pages(GameState* state)
+{
+    TextAnimation* msg_animation = &state->msg_animation;
+    for(size_t pi = 0; pi < msg_animation->num_pages; ++pi)
+    {
+        TextPage& page = msg_animation->pages[pi];
+        if(page.num_lines) continue;
+        page.num_lines = TRAINING_PAGE_LINES;
+        page.lines = arena_array<const char*>(&state->level, TRAINING_PAGE_LINES);
+        for(size_t li = 0; li < TRAINING_PAGE_LINES; ++li) page.lines[li] = training_lines[li];
+        page.display_time = 1.0f;
+        compile_text_page(&page, &state->level);
+    }
+}
+
+// Press or release whichever direction the choice needs next
+static void hold_training_key(PgoTraining* training, InputQueue* queue, InputKey key, double time)
+{
+    if(key == training->held) return;
+    if(training->held != INPUT_FIRE) push_input_event(queue, training->held, false, time);
+    if(key != INPUT_FIRE) push_input_event(queue, key, true, time);
+    training->held = key;
+}
+
+void pgo_train_input(PgoTraining* training, InputQueue* queue, const GameState& state, size_t frame, double time)
+{
+    size_t stage_frame = frame - training->stage_start;
+    TrainingStage next = training->stage;
+    switch(training->stage)
+    {
+        case TRAINING_TITLE:
+            if(stage_frame < PGO_TRAIN_TITLE_FRAMES) break;
+            game_start = true;
+            next = TRAINING_COMBAT;
+            break;
+        case TRAINING_COMBAT:
+            if(!state.game.aliens.num_live)
+            {
+                if(training->bot) release_autoplay_keys(training->bot, queue, time);
+                else
+                {
+                    push_input_event(queue, INPUT_LEFT, false, time);
+                    push_input_event(queue, INPUT_RIGHT, false, time);
+                }
+                next = TRAINING_STORY;
+                break;
+            }
+            if(training->bot) autoplay_input(training->bot, queue, state, time);
+            else bench_input(queue, stage_frame, time);
+            break;
+        case TRAINING_STORY:
+            if(state.choice_phase) next = TRAINING_CHOICE;
+            break;
+        case TRAINING_CHOICE:
+        {
+            if(!state.choice_phase)
+            {
+                hold_training_key(training, queue, INPUT_FIRE, time);
+                next = TRAINING_ENDING;
+                break;
+            }
+            // Line up under NO, then fire at the benchmark's rate
+            Fixed target = state.no_alien.x + (to_fixed(alien_sprite.width) - to_fixed(player_sprite.width)) / 2;
+            Fixed offset = target - state.game.player.x;
+            InputKey key = offset > to_fixed(2) ? INPUT_RIGHT : offset < -to_fixed(2) ? INPUT_LEFT : INPUT_FIRE;
+            hold_training_key(training, queue, key, time);
+            if(key == INPUT_FIRE && stage_frame % 11 == 0)
+            {
+                push_input_event(queue, INPUT_FIRE, true, time);
+                push_input_event(queue, INPUT_FIRE, false, time);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if(next != training->stage)
+    {
+        training->stage_frames[training->stage] = stage_frame;
+        training->stage_start = frame;
+        training->stage = next;
+    }
+}
+
+void print_pgo_training(const PgoTraining& training, size_t frames)
+{
+    printf("PGO training: %zu frames,", frames);
+    for(size_t si = 0; si < NUM_TRAINING_STAGES; ++si)
+    {
+        size_t stage_frames = si == training.stage ? frames - training.stage_start : training.stage_frames[si];
+        printf(" %s %zu", training_stage_names[si], stage_frames);
+    }
+    printf(training.stage == TRAINING_ENDING ? "\n" : ", stopped before the ending\n");
+}
+
+/*
+################################################
+##                STRESS SWEEP                ##
+################################################
+*/
+
+// From one real wave up to the grid's limit, and from the real pool size
+// to thousands of shots in flight
+static const size_t stress_default_aliens[] = {72, 576, 2304, 9216, STRESS_MAX_ALIENS};
+static const size_t stress_default_shots[] = {128, 1024, 8192};
+
+void init_stress_sweep(StressSweep* sweep)
+{
+    *sweep = StressSweep{};
+    sweep->num_aliens = sizeof(stress_default_aliens) / sizeof(stress_default_aliens[0]);
+    sweep->num_shots = sizeof(stress_default_shots) / sizeof(stress_default_shots[0]);
+    memcpy(sweep->aliens, stress_default_aliens, sizeof(stress_default_aliens));
+    memcpy(sweep->shots, stress_default_shots, sizeof(stress_default_shots));
+}
+
+// A comma separated list of at most STRESS_MAX_STEPS counts, 0 if malformed
+size_t parse_stress_counts(const char* text, size_t* counts)
+{
+    size_t count = 0;
+    while(count < STRESS_MAX_STEPS)
+    {
+        char* end;
+        counts[count++] = (size_t)strtoul(text, &end, 10);
+        if(end == text) return 0;
+        if(!*end) return count;
+        if(*end != ',') return 0;
+        text = end + 1;
+    }
+    return 0;
+}
+
+void start_stress_run(const StressSweep& sweep, GameState* state)
+{
+    configure_stress(state, sweep.aliens[sweep.current / sweep.num_shots], sweep.shots[sweep.current % sweep.num_shots]);
+}
+
+void print_stress_row(const StressSweep& sweep, const FrameProfiler& profiler, size_t frames, double seconds)
+{
+    if(!sweep.current)
+    {
+        printf("%7s %7s %9s", "aliens", "shots", "frames/s");
+        for(size_t pi = 0; pi < NUM_PHASES; ++pi) printf(" %8s", phase_names[pi]);
+        printf("  (avg us)\n");
+    }
+    printf("%7zu %7zu %9.1f", sweep.aliens[sweep.current / sweep.num_shots], sweep.shots[sweep.current % sweep.num_shots], frames / seconds);
+    for(size_t pi = 0; pi < NUM_PHASES; ++pi)
+    {
+        double avg = profiler.total_frames ? profiler.totals[pi] / profiler.total_frames : 0.0;
+        printf(" %8.1f", avg * 1e6);
+    }
+    printf("\n");
+}
+
+/*
+################################################
+##               INPUT LATENCY                ##
+################################################
+*/
+
+void record_latency(LatencyMeter* meter, double seconds)
+{
+    meter->samples[meter->count % LATENCY_SAMPLES] = (float)seconds;
+    ++meter->count;
+}
+
+int compare_floats(const void* a, const void* b)
+{
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// Percentiles over the last LATENCY_SAMPLES presses
+void print_latency_results(const LatencyMeter& meter)
+{
+    size_t n = meter.count < LATENCY_SAMPLES ? meter.count : LATENCY_SAMPLES;
+    if(n == 0)
+    {
+        printf("Input latency: no presses measured\n");
+        return;
+    }
+
+    float sorted[LATENCY_SAMPLES];
+    memcpy(sorted, meter.samples, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compare_floats);
+    printf("Input latency: %zu presses, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+        meter.count, sorted[(n - 1) / 2] * 1e3f, sorted[(n * 99 + 99) / 100 - 1] * 1e3f, sorted[n - 1] * 1e3f);
+}
+
+/*
+################################################
+##              RENDER VARIANTS               ##
+################################################
+*/
+
+void init_render_variants(RenderVariants* variants, const Buffer& buffer, bool switch_raster, bool switch_upload)
+{
+    *variants = RenderVariants{};
+    variants->switch_raster = switch_raster;
+    variants->switch_upload = switch_upload;
+    variants->requested_raster = NUM_RASTER_PATHS;
+    variants->requested_upload = NUM_UPLOAD_MODES;
+    variants->size = buffer.width * buffer.height * buffer_pixel_size(buffer);
+    if(switch_raster) variants->pixels = new uint8_t[variants->size];
+}
+
+void destroy_render_variants(RenderVariants* variants)
+{
+    delete[] variants->pixels;
+    variants->pixels = 0;
+}
+
+void request_raster_path(RenderVariants* variants, RasterPath path)
+{
+    if(variants->switch_raster) variants->requested_raster = path;
+}
+
+void request_upload_mode(RenderVariants* variants, UploadMode mode)
+{
+    if(variants->switch_upload) variants->requested_upload = mode;
+}
+
+void apply_render_variants(RenderVariants* variants, FrameRenderer* renderer, PixelUploader* uploader)
+{
+    if(raster_cycle_pressed.exchange(false)) request_raster_path(variants, (RasterPath)((renderer->raster_path + 1) % NUM_RASTER_PATHS));
+    if(upload_cycle_pressed.exchange(false)) request_upload_mode(variants, (UploadMode)((uploader->mode + 1) % NUM_UPLOAD_MODES));
+
+    RasterPath path = variants->requested_raster;
+    if(path != NUM_RASTER_PATHS && path != renderer->raster_path)
+    {
+        set_raster_path(renderer, path);
+        variants->check_pending = path != RASTER_SCALAR;
+        printf("Raster path: %s\n", raster_path_name(path));
+    }
+    variants->requested_raster = NUM_RASTER_PATHS;
+
+    // A mode the driver lacks falls back, so cycling skips over it
+    UploadMode mode = variants->requested_upload;
+    if(mode != NUM_UPLOAD_MODES && mode != uploader->mode)
+    {
+        UploadMode chosen = switch_upload_mode(uploader, renderer->buffer, mode);
+        if(chosen != mode) printf("Upload: %s unavailable, using %s\n", upload_mode_name(mode), upload_mode_name(chosen));
+        else printf("Upload: %s\n", upload_mode_name(chosen));
+    }
+    variants->requested_upload = NUM_UPLOAD_MODES;
+}
+
+void check_raster_path(RenderVariants* variants, FrameRenderer* renderer, const GameState& state, double alpha, bool press_marker)
+{
+    if(!variants->check_pending || show_profiler) return;
+    variants->check_pending = false;
+    variants->skip_frame = true;
+
+    Buffer* buffer = renderer->buffer;
+    RasterPath path = renderer->raster_path;
+    memcpy(variants->pixels, buffer_pixels(*buffer), variants->size);
+
+    // The reference draws everything from scratch, so the comparison
+    // also covers what the incremental frame kept from earlier ones
+    set_raster_path(renderer, RASTER_SCALAR);
+    invalidate_renderer(renderer);
+    draw_game_frame(renderer, state, alpha, press_marker);
+    set_raster_path(renderer, path);
+
+    size_t pixel_size = buffer_pixel_size(*buffer);
+    const uint8_t* reference = buffer_pixels(*buffer);
+    size_t mismatch = 0;
+    for(size_t offset = 0; offset < variants->size; offset += pixel_size)
+    {
+        if(memcmp(variants->pixels + offset, reference + offset, pixel_size)) ++mismatch;
+    }
+
+    ++variants->checks;
+    if(mismatch) ++variants->failed_checks;
+    variants->last_checked = path;
+    variants->last_mismatch = mismatch;
+    if(mismatch) fprintf(stderr, "Raster check: %s differs from scalar in %zu pixels.\n", raster_path_name(path), mismatch);
+    else printf("Raster check: %s matches scalar\n", raster_path_name(path));
+}
+
+void record_variant_frame(RenderVariants* variants, const FrameRenderer& renderer, UploadMode upload, const FrameProfiler& profiler)
+{
+    if(variants->skip_frame)
+    {
+        variants->skip_frame = false;
+        return;
+    }
+
+    // Particles are left out, their phase also steps the simulation's debris
+    static const FramePhase draw_phases[] = {PHASE_CLEAR, PHASE_FORMATION, PHASE_PROJECTILES, PHASE_TEXT, PHASE_COMPOSITE};
+    VariantStats& stats = variants->stats[renderer.raster_path][upload];
+    for(FramePhase phase: draw_phases) stats.draw += profiler.samples[phase][profiler.current];
+    stats.upload += profiler.samples[PHASE_UPLOAD][profiler.current];
+    ++stats.frames;
+}
+
+// Only once more than one pair has run or a path was checked
+void print_render_variants(const RenderVariants& variants)
+{
+    size_t pairs = 0;
+    for(size_t ri = 0; ri < NUM_RASTER_PATHS; ++ri)
+    {
+        for(size_t ui = 0; ui < NUM_UPLOAD_MODES; ++ui) pairs += variants.stats[ri][ui].frames != 0;
+    }
+    if(pairs < 2 && !variants.checks) return;
+
+    bool any = false;
+    for(size_t ri = 0; ri < NUM_RASTER_PATHS; ++ri)
+    {
+        for(size_t ui = 0; ui < NUM_UPLOAD_MODES; ++ui)
+        {
+            const VariantStats& stats = variants.stats[ri][ui];
+            if(!stats.frames) continue;
+            if(!any) printf("Render variants (us per frame):\n  raster    upload       frames      draw    upload\n");
+            any = true;
+            printf(
+                "  %-9s %-10s %8zu %9.1f %9.1f\n", raster_path_name((RasterPath)ri), upload_mode_name((UploadMode)ui),
+                stats.frames, stats.draw / stats.frames * 1e6, stats.upload / stats.frames * 1e6
+            );
+        }
+    }
+    if(variants.checks) printf("Raster checks: %zu, %zu differed from scalar\n", variants.checks, variants.failed_checks);
+}
+
+/*
+################################################
+##                CONFORMANCE                 ##
+################################################
+*/
+
+void init_conformance_check(ConformanceCheck* check, const Buffer& buffer)
+{
+    *check = ConformanceCheck{};
+    check->size = buffer.width * buffer.height * buffer_pixel_size(buffer);
+    check->pixels = new uint8_t[check->size];
+    check->image = new uint8_t[buffer.width * buffer.height * 4];
+    check->digest = 14695981039346656037ull;
+}
+
+void destroy_conformance_check(ConformanceCheck* check)
+{
+    delete[] check->pixels;
+    delete[] check->image;
+    check->pixels = check->image = 0;
+}
+
+void begin_conformance_frame(ConformanceCheck* check, FrameRenderer* renderer)
+{
+    if(renderer->raster_path != check->next_path) set_raster_path(renderer, check->next_path);
+    check->next_path = (RasterPath)((check->next_path + 1) % NUM_RASTER_PATHS);
+}
+
+// The reference dimmed to a quarter, with 'frame''s differing pixels in
+// magenta. Returns how many differ.
+static size_t write_conformance_diff(ConformanceCheck* check, const Buffer& reference, RasterPath path, size_t frame)
+{
+    copy_buffer_rgba(reference, check->image);
+    size_t pixel_size = buffer_pixel_size(reference);
+    const uint8_t* expected = buffer_pixels(reference);
+    size_t mismatch = 0;
+    for(size_t yi = 0; yi < reference.height; ++yi)
+    {
+        // Buffers are bottom-up, the image top-down
+        uint8_t* out = check->image + (reference.height - 1 - yi) * reference.width * 4;
+        for(size_t xi = 0; xi < reference.width; ++xi, out += 4)
+        {
+            size_t offset = (yi * reference.width + xi) * pixel_size;
+            bool differs = memcmp(check->pixels + offset, expected + offset, pixel_size) != 0;
+            mismatch += differs;
+            out[0] = differs ? 255 : out[0] / 4;
+            out[1] = differs ? 0 : out[1] / 4;
+            out[2] = differs ? 255 : out[2] / 4;
+        }
+    }
+
+    char name[CONFORM_MAX_PATH];
+    snprintf(name, sizeof(name), "conform-%s-%zu.png", raster_path_name(path), frame);
+    if(!write_png_image(name, reference.width, reference.height, check->image))
+    {
+        fprintf(stderr, "Could not write '%s'.\n", name);
+    }
+    return mismatch;
+}
+
+void check_conformance_frame(ConformanceCheck* check, FrameRenderer* renderer, const GameState& state, double alpha, bool press_marker)
+{
+    Buffer* buffer = renderer->buffer;
+    RasterPath path = renderer->raster_path;
+    size_t frame = check->frames++;
+    memcpy(check->pixels, buffer_pixels(*buffer), check->size);
+    uint64_t tested = hash_bytes(14695981039346656037ull, check->pixels, check->size);
+
+    // Drawn straight into the layers, so banding is checked too
+    DrawList* lists[NUM_LAYERS];
+    for(size_t li = 0; li < NUM_LAYERS; ++li)
+    {
+        lists[li] = renderer->layers[li].buffer.draw_list;
+        renderer->layers[li].buffer.draw_list = 0;
+    }
+    set_raster_path(renderer, RASTER_SCALAR);
+    invalidate_renderer(renderer);
+    draw_game_frame(renderer, state, alpha, press_marker);
+    for(size_t li = 0; li < NUM_LAYERS; ++li) renderer->layers[li].buffer.draw_list = lists[li];
+
+    uint64_t expected = hash_bytes(14695981039346656037ull, buffer_pixels(*buffer), check->size);
+    // Over the colors rather than the bytes, so the pixel formats agree
+    copy_buffer_rgba(*buffer, check->image);
+    check->digest = hash_bytes(check->digest, check->image, buffer->width * buffer->height * 4);
+    ++check->checked[path];
+    if(tested == expected) return;
+
+    if(!check->failed[path]++)
+    {
+        check->first_failure[path] = frame;
+        size_t mismatch = write_conformance_diff(check, *buffer, path, frame);
+        fprintf(
+            stderr, "Conformance: %s differs from scalar at frame %zu in %zu pixels, see conform-%s-%zu.png\n",
+            raster_path_name(path), frame, mismatch, raster_path_name(path), frame
+        );
+    }
+}
+
+bool print_conformance(const ConformanceCheck& check)
+{
+    bool passed = true;
+    printf("Conformance: %zu frames, reference digest %016llx\n", check.frames, (unsigned long long)check.digest);
+    for(size_t ri = 0; ri < NUM_RASTER_PATHS; ++ri)
+    {
+        if(!check.checked[ri]) continue;
+        printf("  %-9s %6zu checked, %6zu differed", raster_path_name((RasterPath)ri), check.checked[ri], check.failed[ri]);
+        if(check.failed[ri]) printf(", first at frame %zu", check.first_failure[ri]);
+        printf("\n");
+        passed = passed && !check.failed[ri];
+    }
+    return passed;
+}
+
+/*
+################################################
+##               TRACE REQUESTS               ##
+################################################
+*/
+
+static void write_requested_trace(TraceRequest* request)
+{
+    stop_trace();
+    request->remaining = 0;
+    TraceStats stats;
+    if(!write_trace(request->path, &stats))
+    {
+        fprintf(stderr, "Could not write the trace to '%s'.\n", request->path);
+        return;
+    }
+    printf("Traced %zu events on %zu threads to '%s'", stats.events, stats.threads, request->path);
+    if(stats.overwritten) printf(", %zu overwritten", stats.overwritten);
+    if(stats.dropped_threads) printf(", %zu threads past %d not traced", stats.dropped_threads, TRACE_MAX_THREADS);
+    printf("\n");
+}
+
+// Called once per frame, by whichever thread draws
+void step_trace_request(TraceRequest* request)
+{
+    if(!TRACE_ENABLED) return;
+    if(trace_key_pressed.exchange(false) && !request->remaining)
+    {
+        start_trace();
+        request->remaining = request->frames;
+        printf("Tracing %zu frames\n", request->frames);
+        return;
+    }
+    if(request->remaining && !--request->remaining) write_requested_trace(request);
+}
+
+// A trace still running at exit keeps the frames it got
+void finish_trace_request(TraceRequest* request)
+{
+    if(request->remaining) write_requested_trace(request);
+}
+
+/*
+################################################
+##            ALLOCATION TELEMETRY            ##
+################################################
+*/
+
+// GLFW's allocations come out of this pool, which lives until exit so
+// nothing GLFW frees after glfwTerminate() outlives it
+static BlockPool glfw_pool;
+
+static void* glfw_allocate(size_t size, void* user)
+{
+    return pool_alloc((BlockPool*)user, size);
+}
+
+static void* glfw_reallocate(void* block, size_t size, void* user)
+{
+    return pool_realloc((BlockPool*)user, block, size);
+}
+
+static void glfw_deallocate(void* block, void* user)
+{
+    pool_free((BlockPool*)user, block);
+}
+
+// Must come before glfwInit()
+void install_glfw_allocator()
+{
+    init_block_pool(&glfw_pool, ALLOC_GLFW);
+    GLFWallocator allocator = {glfw_allocate, glfw_reallocate, glfw_deallocate, &glfw_pool};
+    glfwInitAllocator(&allocator);
+}
+
+void begin_alloc_frame(AllocTelemetry* telemetry)
+{
+    read_alloc_counts(&telemetry->mark);
+    if(telemetry->guard && telemetry->frames >= ALLOC_WARMUP_FRAMES) set_alloc_guard(true);
+}
+
+void end_alloc_frame(AllocTelemetry* telemetry)
+{
+    set_alloc_guard(false);
+    AllocCounts now;
+    read_alloc_counts(&now);
+    uint64_t allocations = 0;
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti)
+    {
+        uint64_t count = now.allocations[ti] - telemetry->mark.allocations[ti];
+        telemetry->allocations[ti] += count;
+        telemetry->bytes[ti] += now.bytes[ti] - telemetry->mark.bytes[ti];
+        allocations += count;
+    }
+    ++telemetry->frames;
+    if(allocations) ++telemetry->allocating_frames;
+    if(allocations > telemetry->max_allocations) telemetry->max_allocations = allocations;
+}
+
+void print_alloc_telemetry(const AllocTelemetry& telemetry)
+{
+    uint64_t allocations = 0;
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti) allocations += telemetry.allocations[ti];
+    double frames = telemetry.frames ? (double)telemetry.frames : 1.0;
+    printf(
+        "Allocations: %zu of %zu frames allocated, %.2f per frame, at most %llu\n",
+        telemetry.allocating_frames, telemetry.frames, allocations / frames, (unsigned long long)telemetry.max_allocations
+    );
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti)
+    {
+        if(!telemetry.allocations[ti]) continue;
+        printf(
+            "  %-10s %10llu allocations %12llu bytes\n", alloc_tag_names[ti],
+            (unsigned long long)telemetry.allocations[ti], (unsigned long long)telemetry.bytes[ti]
+        );
+    }
+    std::lock_guard<std::mutex> guard(glfw_pool.lock);
+    printf(
+        "GLFW pool: %llu blocks pooled, %llu oversized, %llu KiB of chunks\n",
+        (unsigned long long)glfw_pool.pooled, (unsigned long long)glfw_pool.oversized,
+        (unsigned long long)(glfw_pool.chunk_bytes / 1024)
+    );
+}
+
+/*
+################################################
+##               MEMORY BUDGET                ##
+################################################
+*/
+
+void configure_game_state(GameState* state, InputReplay* replay, bool pgo_train, size_t bullet_hell, const StressSweep* stress, uint64_t seek_tick)
+{
+    if(pgo_train && !replay) fill_training_pages(state);
+    if(bullet_hell)
+    {
+        configure_bullet_hell(state, bullet_hell);
+        printf("Bullet hell: %zu alien shots\n", bullet_hell);
+    }
+    if(stress) start_stress_run(*stress, state);
+    // Before the wave prefetcher and rollback look at the state
+    if(seek_tick && !replay) fprintf(stderr, "--seek needs --replay, ignoring it.\n");
+    // A flight recording starts from its keyframe rather than a fresh wave
+    else if(seek_tick || (replay && (replay->header.flags & REPLAY_FLIGHT)))
+    {
+        uint64_t simulated = seek_input_replay(replay, state, seek_tick);
+        printf("Seeked to tick %llu of %llu, simulating %llu ticks to get there\n",
+            (unsigned long long)replay->played, (unsigned long long)replay->header.num_ticks, (unsigned long long)simulated);
+    }
+}
+
+void measure_memory_footprint(MemoryFootprint* footprint, size_t budget, const GameState& state, size_t width, size_t height, PixelFormat format)
+{
+    *footprint = MemoryFootprint{};
+    footprint->budget = budget;
+    size_t frame = width * height * pixel_format_size(format);
+    footprint->framebuffer = frame;
+    footprint->state = sizeof(GameState);
+    footprint->state_block = state.block.size;
+    for(const ArenaBlock* block = state.level.blocks; block; block = block->next) footprint->arena += block->size;
+    // The game's layers and the title's own
+    footprint->layers = (NUM_LAYERS + 1) * frame;
+}
+
+size_t budget_particle_capacity(MemoryFootprint* footprint)
+{
+    size_t used = footprint->framebuffer + footprint->state + footprint->state_block + footprint->arena;
+    size_t capacity = used < footprint->budget ? (footprint->budget - used) / PARTICLE_BYTES : 0;
+    if(capacity > PARTICLE_CAPACITY) capacity = PARTICLE_CAPACITY;
+    footprint->particles = capacity * PARTICLE_BYTES;
+    return capacity;
+}
+
+bool print_memory_footprint(const MemoryFootprint& footprint)
+{
+    size_t counted = footprint.framebuffer + footprint.state + footprint.state_block + footprint.arena + footprint.particles;
+    printf("Memory budget: %.1f KiB\n", footprint.budget / 1024.0);
+    printf("  %-14s %9.1f KiB\n", "framebuffer", footprint.framebuffer / 1024.0);
+    printf("  %-14s %9.1f KiB\n", "game state", footprint.state / 1024.0);
+    printf("  %-14s %9.1f KiB\n", "state block", footprint.state_block / 1024.0);
+    printf("  %-14s %9.1f KiB\n", "level arena", footprint.arena / 1024.0);
+    printf("  %-14s %9.1f KiB, %zu particles\n", "particles", footprint.particles / 1024.0, footprint.particles / PARTICLE_BYTES);
+    printf("  %-14s %9.1f KiB, state and framebuffer %.1f KiB\n", "counted", counted / 1024.0,
+        (footprint.framebuffer + footprint.state + footprint.state_block + footprint.arena) / 1024.0);
+    printf("  %-14s %9.1f KiB, not counted\n", "layers", footprint.layers / 1024.0);
+    if(counted <= footprint.budget) return true;
+    fprintf(stderr, "The game needs %.1f KiB, over the %.1f KiB budget.\n", counted / 1024.0, footprint.budget / 1024.0);
+    return false;
+}
+
+/*
+################################################
+##                 SOAK TESTS                 ##
+################################################
+*/
+
+void init_soak_test(SoakTest* soak, double hours, double now)
+{
+    soak->start = now;
+    soak->duration = hours * 3600.0;
+    soak->next_sample = now + SOAK_SAMPLE_SECONDS;
+    soak->last_frame = glfwGetTime();
+    memset(soak->bins, 0, sizeof(soak->bins));
+    soak->frames = 0;
+    soak->max_frame = 0.0f;
+    // One more for the sample taken when the run ends between two
+    soak->capacity = (size_t)(soak->duration / SOAK_SAMPLE_SECONDS) + 2;
+    soak->samples = new SoakSample[soak->capacity];
+    soak->num_samples = 0;
+}
+
+void destroy_soak_test(SoakTest* soak)
+{
+    delete[] soak->samples;
+    soak->samples = 0;
+}
+
+void record_soak_frame(SoakTest* soak)
+{
+    double now = glfwGetTime();
+    double frame = now - soak->last_frame;
+    soak->last_frame = now;
+    size_t bin = (size_t)(frame / SOAK_BIN_SECONDS);
+    ++soak->bins[bin < SOAK_BINS ? bin : SOAK_BINS - 1];
+    ++soak->frames;
+    if((float)frame > soak->max_frame) soak->max_frame = (float)frame;
+}
+
+bool soak_sample_due(const SoakTest& soak, double now)
+{
+    return now >= soak.next_sample;
+}
+
+// Upper edge of the bin the 'fraction' of frames falls in
+static float soak_percentile(const SoakTest& soak, double fraction)
+{
+    size_t rank = (size_t)(soak.frames * fraction + 0.5), seen = 0;
+    if(rank < 1) rank = 1;
+    for(size_t bi = 0; bi < SOAK_BINS; ++bi)
+    {
+        seen += soak.bins[bi];
+        if(seen >= rank) return (float)((bi + 1) * SOAK_BIN_SECONDS);
+    }
+    return soak.max_frame;
+}
+
+void take_soak_sample(SoakTest* soak, double now, size_t gl_objects)
+{
+    if(soak->num_samples == soak->capacity) return;
+
+    AllocCounts counts;
+    read_alloc_counts(&counts);
+    SoakSample& sample = soak->samples[soak->num_samples++];
+    sample.time = now - soak->start;
+    sample.rss = read_resident_bytes();
+    sample.allocations = 0;
+    for(size_t ti = 0; ti < NUM_ALLOC_TAGS; ++ti) sample.allocations += counts.allocations[ti];
+    sample.live_blocks = sample.allocations - counts.frees;
+    sample.gl_objects = gl_objects;
+    sample.frames = soak->frames;
+    sample.p50 = soak_percentile(*soak, 0.5);
+    sample.p99 = soak_percentile(*soak, 0.99);
+    sample.max = soak->max_frame;
+    printf(
+        "Soak %6.1f min: RSS %8.2f MiB, %llu live blocks, %llu allocations, %zu GL objects, %zu frames p50 %.2f p99 %.2f max %.2f ms\n",
+        sample.time / 60.0, sample.rss / (1024.0 * 1024.0), (unsigned long long)sample.live_blocks,
+        (unsigned long long)sample.allocations, sample.gl_objects, sample.frames,
+        sample.p50 * 1e3f, sample.p99 * 1e3f, sample.max * 1e3f
+    );
+
+    memset(soak->bins, 0, sizeof(soak->bins));
+    soak->frames = 0;
+    soak->max_frame = 0.0f;
+    while(soak->next_sample <= now) soak->next_sample += SOAK_SAMPLE_SECONDS;
+}
+
+bool soak_finished(const SoakTest& soak, double now)
+{
+    return now - soak.start >= soak.duration;
+}
+
+static double average_soak_p99(const SoakSample* samples, size_t count)
+{
+    double sum = 0.0;
+    for(size_t si = 0; si < count; ++si) sum += samples[si].p99;
+    return sum / (double)count;
+}
+
+bool print_soak_report(const SoakTest& soak)
+{
+    printf("Soak: %zu samples over %.1f minutes\n", soak.num_samples, soak.num_samples ? soak.samples[soak.num_samples - 1].time / 60.0 : 0.0);
+    if(soak.num_samples < SOAK_WARMUP_SAMPLES + 2)
+    {
+        printf("  too short to judge, %d samples are needed\n", SOAK_WARMUP_SAMPLES + 2);
+        return true;
+    }
+
+    const SoakSample& first = soak.samples[SOAK_WARMUP_SAMPLES];
+    const SoakSample& last = soak.samples[soak.num_samples - 1];
+
+    int64_t rss = (int64_t)last.rss - (int64_t)first.rss;
+    bool rss_grew = rss > SOAK_RSS_SLACK;
+    if(first.rss) printf("  RSS          %+10.2f MiB %s\n", rss / (1024.0 * 1024.0), rss_grew ? "GREW" : "ok");
+    else printf("  RSS          not read on this platform\n");
+
+    int64_t blocks = (int64_t)last.live_blocks - (int64_t)first.live_blocks;
+    bool blocks_grew = blocks > SOAK_BLOCK_SLACK;
+    printf("  live blocks  %+10lld     %s\n", (long long)blocks, blocks_grew ? "GREW" : "ok");
+    printf("  allocations  %10.1f per minute\n", (double)(last.allocations - first.allocations) * 60.0 / (last.time - first.time));
+
+    int64_t gl_objects = (int64_t)last.gl_objects - (int64_t)first.gl_objects;
+    bool gl_grew = gl_objects > 0;
+    printf("  GL objects   %+10lld     %s\n", (long long)gl_objects, gl_grew ? "GREW" : "ok");
+
+    size_t measured = soak.num_samples - SOAK_WARMUP_SAMPLES;
+    size_t quarter = measured / 4 ? measured / 4 : 1;
+    double early = average_soak_p99(&first, quarter);
+    double late = average_soak_p99(&last - (quarter - 1), quarter);
+    bool drifted = late > early * SOAK_DRIFT_RATIO && late - early > SOAK_DRIFT_FLOOR;
+    printf("  frame p99    %10.2f ms to %.2f ms %s\n", early * 1e3, late * 1e3, drifted ? "DRIFTED" : "ok");
+
+    bool ok = !rss_grew && !blocks_grew && !gl_grew && !drifted;
+    printf("Soak %s\n", ok ? "passed" : "FAILED");
+    return ok;
+}
+
+/*
+################################################
+##              BATCH SIMULATION              ##
+################################################
+*/
+
+struct alignas(64) BatchGame
+{
+    GameState state;
+    size_t seed;
+    size_t waves;
+    uint64_t checksum;
+};
+
+struct BatchRun
+{
+    BatchGame* games;
+    size_t ticks;
+    size_t start_wave;
+};
+
+void init_batch_game(void* context, size_t task)
+{
+    const BatchRun* run = (const BatchRun*)context;
+    BatchGame& batch = run->games[task];
+    init_game_state(&batch.state, DESIGN_WIDTH, DESIGN_HEIGHT);
+    if(run->start_wave)
+    {
+        batch.state.wave = run->start_wave;
+        reset_formation(&batch.state);
+    }
+    batch.seed = task;
+    batch.waves = 0;
+    batch.checksum = 0;
+}
+
+void step_batch_game(void* context, size_t task)
+{
+    const BatchRun* run = (const BatchRun*)context;
+    BatchGame& batch = run->games[task];
+    for(size_t tick = 0; tick < run->ticks; ++tick)
+    {
+        // A cleared wave is followed at once by the next one in the table
+        if(!batch.state.game.aliens.num_live)
+        {
+            ++batch.state.wave;
+            reset_formation(&batch.state);
+            ++batch.waves;
+        }
+        step_game(&batch.state, bot_input(batch.state, batch.seed), SIM_DT);
+    }
+    batch.checksum = game_state_checksum(batch.state);
+}
+
+void destroy_batch_game(void* context, size_t task)
+{
+    destroy_game_state(&((BatchRun*)context)->games[task].state);
+}
+
+// 'num_threads' counts the calling thread, 0 means one per core
+void run_simulation_batch(size_t num_games, size_t ticks, size_t start_wave, size_t num_threads)
+{
+    init_overlap_kernels();
+    init_move_kernels();
+
+    ThreadPool pool;
+    init_thread_pool(&pool, num_threads);
+
+    BatchRun run;
+    run.games = new BatchGame[num_games];
+    run.ticks = ticks;
+    run.start_wave = start_wave;
+
+    // Each worker allocates the games it later steps, so on NUMA machines
+    // their memory stays local to it
+    run_parallel(&pool, init_batch_game, &run, num_games);
+
+    auto start = std::chrono::steady_clock::now();
+    run_parallel(&pool, step_batch_game, &run, num_games);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t waves = 0, score = 0;
+    uint64_t checksum = 0;
+    for(size_t gi = 0; gi < num_games; ++gi)
+    {
+        waves += run.games[gi].waves;
+        score += run.games[gi].state.score;
+        checksum = (checksum ^ run.games[gi].checksum) * 1099511628211ull;
+    }
+
+    double total_ticks = (double)num_games * ticks;
+    printf("Simulated %zu games x %zu ticks on %zu threads in %.3f s, %.0f ticks/s\n",
+        num_games, ticks, pool.num_workers + 1, seconds, seconds > 0 ? total_ticks / seconds : 0.0);
+    printf("  %zu waves cleared, total score %zu, checksum %016llx\n", waves, score, (unsigned long long)checksum);
+
+    run_parallel(&pool, destroy_batch_game, &run, num_games);
+    delete[] run.games;
+    destroy_thread_pool(&pool);
+}
+
+// Steps every whole tick in 'accumulator', each with the input that was
+// due by its end, and returns how many ran. 'now' is the wall time the
+// accumulator was last topped up to.
+size_t run_ticks(
+    GameState* state, double* accumulator, double now,
+    InputLatch* latch, InputReplay* replay, InputReplay* recording, FlightRecorder* flight, WavePrefetcher* waves, RollbackSession* rollback
+)
+{
+    TRACE_SCOPE("simulate");
+    ALLOC_SCOPE(ALLOC_SIMULATION);
+    size_t ticks = 0;
+    while(*accumulator >= SIM_DT)
+    {
+        *accumulator -= SIM_DT;
+        // What is left in the accumulator is time after this tick
+        GameInput input = drain_input(&input_queue, latch, now - *accumulator);
+        // A rolled back state runs ahead on predictions, there is nothing to compare
+        if(replay && !rollback) check_replay_hash(replay, *state);
+        if(replay && !next_replay_input(replay, &input)) break;
+        if(recording) record_input(recording, *state, input);
+        if(flight) record_flight_tick(flight, *state, input);
+        if(rollback) step_rollback(rollback, state, input);
+        else
+        {
+            if(waves && !state->game.aliens.num_live) advance_wave(waves, state);
+            step_game(state, input, SIM_DT);
+        }
+        ++ticks;
+    }
+    return ticks;
+}
+
+void init_frame_scheduler(FrameScheduler* scheduler, bool skip_frames)
+{
+    *scheduler = FrameScheduler{};
+    scheduler->skip_frames = skip_frames;
+}
+
+double frame_budget(const FramePacer& pacer)
+{
+    if(pacer.cap_interval > 0.0) return pacer.cap_interval;
+    if(pacer.mode == PACING_FIXED) return pacer.interval;
+    return pacer.mode == PACING_VRR ? pacer.vrr_interval : pacer.refresh_interval;
+}
+
+bool schedule_frame(FrameScheduler* scheduler, double* accumulator, double dt, double budget, bool waited)
+{
+    ++scheduler->frames;
+    if(waited)
+    {
+        // Nothing was owed while the game sat still
+        scheduler->dropped += scheduler->debt;
+        scheduler->debt = 0.0;
+        *accumulator += dt < SIM_MAX_FRAME_TIME ? dt : SIM_MAX_FRAME_TIME;
+    }
+    else
+    {
+        if(dt > budget * SCHEDULER_OVERLOAD) ++scheduler->overloaded;
+        double owed = scheduler->debt + dt;
+        double paid = owed < SIM_MAX_FRAME_TIME ? owed : SIM_MAX_FRAME_TIME;
+        *accumulator += paid;
+        scheduler->debt = owed - paid;
+        if(scheduler->debt > SCHEDULER_MAX_DEBT)
+        {
+            scheduler->dropped += scheduler->debt - SCHEDULER_MAX_DEBT;
+            scheduler->debt = SCHEDULER_MAX_DEBT;
+        }
+        if(scheduler->debt > scheduler->max_debt) scheduler->max_debt = scheduler->debt;
+    }
+
+    bool skip = scheduler->skip_frames && scheduler->debt > 0.0 && scheduler->skip_run < FRAME_SKIP_MAX;
+    if(skip)
+    {
+        ++scheduler->skipped;
+        if(++scheduler->skip_run > scheduler->longest_skip) scheduler->longest_skip = scheduler->skip_run;
+    }
+    else scheduler->skip_run = 0;
+    return skip;
+}
+
+void print_frame_scheduler(const FrameScheduler& scheduler)
+{
+    if(!scheduler.frames) return;
+    printf(
+        "Scheduler: %llu of %llu frames overloaded, %llu skipped (longest run %zu), most owed %.0f ms, %.2f s dropped\n",
+        (unsigned long long)scheduler.overloaded, (unsigned long long)scheduler.frames, (unsigned long long)scheduler.skipped,
+        scheduler.longest_skip, scheduler.max_debt * 1000.0, scheduler.dropped
+    );
+}
+
+/*
+################################################
+##                  ROLLBACK                  ##
+################################################
+*/
+
+void init_rollback_session(RollbackSession* session, const GameState& state, size_t delay, bool respawn_waves)
+{
+    for(size_t si = 0; si < ROLLBACK_MAX_TICKS; ++si)
+    {
+        init_saved_state(&session->saved[si], state);
+        session->saved_respawns[si] = 0;
+        session->inputs[si] = GameInput{};
+        session->input_ticks[si] = UINT64_MAX;
+        session->arrived[si] = false;
+        session->sent[si] = GameInput{};
+    }
+    session->first_unarrived = state.tick;
+    session->last_arrived = GameInput{};
+    session->delay = delay;
+    session->respawn_waves = respawn_waves;
+    session->respawns = 0;
+    session->rollbacks = session->resimulated = session->max_resimulated = 0;
+    session->rollback_seconds = session->max_rollback_seconds = 0.0;
+    session->max_saved_bytes = 0;
+}
+
+void destroy_rollback_session(RollbackSession* session)
+{
+    for(size_t si = 0; si < ROLLBACK_MAX_TICKS; ++si) destroy_saved_state(&session->saved[si]);
+}
+
+static GameInput predict_input(const RollbackSession& session)
+{
+    GameInput input = session.last_arrived;
+    input.fire = false;
+    return input;
+}
+
+// Saves the state before the tick it is at, then steps that tick
+static void simulate_rollback_tick(RollbackSession* session, GameState* state, const GameInput& input)
+{
+    size_t slot = state->tick % ROLLBACK_MAX_TICKS;
+    size_t bytes = save_game_state(&session->saved[slot], *state);
+    if(bytes > session->max_saved_bytes) session->max_saved_bytes = bytes;
+    session->saved_respawns[slot] = session->respawns;
+
+    if(session->respawn_waves && !state->game.aliens.num_live)
+    {
+        reset_formation(state);
+        ++session->respawns;
+    }
+    step_game(state, input, SIM_DT);
+}
+
+static void arrive_input(RollbackSession* session, GameState* state, uint64_t tick, const GameInput& input)
+{
+    session->last_arrived = input;
+    size_t slot = tick % ROLLBACK_MAX_TICKS;
+    const GameInput& used = session->inputs[slot];
+    bool simulated = tick < state->tick;
+    bool mispredicted = simulated && (used.move_dir != input.move_dir || used.fire != input.fire);
+    session->inputs[slot] = input;
+    session->input_ticks[slot] = tick;
+    session->arrived[slot] = true;
+    if(!mispredicted) return;
+
+    TRACE_SCOPE("rollback");
+    auto start = std::chrono::steady_clock::now();
+    uint64_t present = state->tick;
+    restore_game_state(state, session->saved[slot]);
+    session->respawns = session->saved_respawns[slot];
+    // Ticks after this one still run on predictions, now from this input
+    for(uint64_t t = tick; t < present; ++t)
+    {
+        size_t ts = t % ROLLBACK_MAX_TICKS;
+        if(!session->arrived[ts]) session->inputs[ts] = predict_input(*session);
+        simulate_rollback_tick(session, state, session->inputs[ts]);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++session->rollbacks;
+    session->resimulated += present - tick;
+    if(present - tick > session->max_resimulated) session->max_resimulated = present - tick;
+    session->rollback_seconds += seconds;
+    if(seconds > session->max_rollback_seconds) session->max_rollback_seconds = seconds;
+}
+
+void step_rollback(RollbackSession* session, GameState* state, const GameInput& input)
+{
+    uint64_t tick = state->tick;
+    session->sent[tick % ROLLBACK_MAX_TICKS] = input;
+    for(; session->first_unarrived + session->delay <= tick; ++session->first_unarrived)
+    {
+        uint64_t sent = session->first_unarrived;
+        arrive_input(session, state, sent, session->sent[sent % ROLLBACK_MAX_TICKS]);
+    }
+
+    size_t slot = tick % ROLLBACK_MAX_TICKS;
+    if(session->input_ticks[slot] != tick)
+    {
+        session->inputs[slot] = predict_input(*session);
+        session->input_ticks[slot] = tick;
+        session->arrived[slot] = false;
+    }
+    simulate_rollback_tick(session, state, session->inputs[slot]);
+}
+
+void settle_rollback(RollbackSession* session, GameState* state)
+{
+    for(; session->first_unarrived < state->tick; ++session->first_unarrived)
+    {
+        uint64_t sent = session->first_unarrived;
+        arrive_input(session, state, sent, session->sent[sent % ROLLBACK_MAX_TICKS]);
+    }
+}
+
+void print_rollback_stats(const RollbackSession& session)
+{
+    printf(
+        "Rollback: %zu ticks of delay, %llu rollbacks re-simulated %llu ticks (at most %llu), %.1f us mean and %.1f us max each, saves of %zu bytes\n",
+        session.delay, (unsigned long long)session.rollbacks, (unsigned long long)session.resimulated,
+        (unsigned long long)session.max_resimulated,
+        session.rollbacks ? session.rollback_seconds * 1e6 / (double)session.rollbacks : 0.0,
+        session.max_rollback_seconds * 1e6, session.max_saved_bytes
+    );
+}
+
+/*
+################################################
+##               WAVE PREFETCH                ##
+################################################
+*/
+
+static void wave_prefetch_main(WavePrefetcher* prefetcher)
+{
+    name_trace_thread("wave prefetch");
+    enter_thread_role(THREAD_BACKGROUND);
+    std::unique_lock<std::mutex> lock(prefetcher->mutex);
+    while(true)
+    {
+        prefetcher->wake.wait(lock, [prefetcher]{ return prefetcher->quit || prefetcher->requested != SIZE_MAX; });
+        if(prefetcher->quit) break;
+
+        size_t wave = prefetcher->requested;
+        prefetcher->requested = SIZE_MAX;
+        lock.unlock();
+        {
+            TRACE_SCOPE("prepare wave");
+            prepare_wave(&prefetcher->prepared, wave, prefetcher->layout_x, prefetcher->layout_y);
+        }
+        lock.lock();
+        prefetcher->ready = true;
+        prefetcher->done.notify_one();
+    }
+}
+
+void start_wave_prefetcher(WavePrefetcher* prefetcher, GameState* state)
+{
+    init_prepared_wave(&prefetcher->prepared, state);
+    prefetcher->layout_x = state->layout_x;
+    prefetcher->layout_y = state->layout_y;
+    prefetcher->requested = state->wave + 1;
+    prefetcher->ready = false;
+    prefetcher->quit = false;
+    prefetcher->thread = std::thread(wave_prefetch_main, prefetcher);
+}
+
+void stop_wave_prefetcher(WavePrefetcher* prefetcher)
+{
+    {
+        std::lock_guard<std::mutex> lock(prefetcher->mutex);
+        prefetcher->quit = true;
+    }
+    prefetcher->wake.notify_one();
+    prefetcher->thread.join();
+}
+
+void advance_wave(WavePrefetcher* prefetcher, GameState* state)
+{
+    TRACE_SCOPE("next wave");
+    std::unique_lock<std::mutex> lock(prefetcher->mutex);
+    prefetcher->done.wait(lock, [prefetcher]{ return prefetcher->ready; });
+    prefetcher->ready = false;
+    start_prepared_wave(state, &prefetcher->prepared);
+    prefetcher->requested = state->wave + 1;
+    prefetcher->wake.notify_one();
+}
+
+/*
+################################################
+##               RENDER THREAD                ##
+################################################
+*/
+
+#define SNAPSHOT_FRESH 4u
+#define SNAPSHOT_INDEX 3u
+
+void init_snapshot_exchange(SnapshotExchange* exchange, const GameState& state)
+{
+    for(size_t si = 0; si < 3; ++si)
+    {
+        GameSnapshot& snapshot = exchange->slots[si];
+        snapshot = GameSnapshot{};
+        snapshot.capacity = state.block.size;
+        snapshot.block = (uint8_t*)alloc_pages(snapshot.capacity);
+    }
+    exchange->back = 0;
+    exchange->middle = 1;
+    exchange->front = 2;
+    exchange->wakes = 0;
+}
+
+void destroy_snapshot_exchange(SnapshotExchange* exchange)
+{
+    for(size_t si = 0; si < 3; ++si)
+    {
+        free_pages(exchange->slots[si].block);
+    }
+}
+
+// Copies 'state' into the back slot, for publish_snapshot() to hand over
+GameSnapshot* capture_snapshot(SnapshotExchange* exchange, const GameState& state)
+{
+    GameSnapshot* snapshot = &exchange->slots[exchange->back];
+    // Only a stress configuration resizes the block
+    if(state.block.size > snapshot->capacity)
+    {
+        free_pages(snapshot->block);
+        snapshot->capacity = state.block.size;
+        snapshot->block = (uint8_t*)alloc_pages(snapshot->capacity);
+    }
+    copy_game_state(&snapshot->state, snapshot->block, state);
+    return snapshot;
+}
+
+void publish_snapshot(SnapshotExchange* exchange)
+{
+    exchange->back = exchange->middle.exchange(exchange->back | SNAPSHOT_FRESH, std::memory_order_acq_rel) & SNAPSHOT_INDEX;
+}
+
+// The newest published snapshot; it stays valid until the next call
+const GameSnapshot* acquire_snapshot(SnapshotExchange* exchange)
+{
+    if(exchange->middle.load(std::memory_order_acquire) & SNAPSHOT_FRESH)
+    {
+        exchange->front = exchange->middle.exchange(exchange->front, std::memory_order_acq_rel) & SNAPSHOT_INDEX;
+    }
+    return &exchange->slots[exchange->front];
+}
+
+void wake_render_thread(SnapshotExchange* exchange)
+{
+    {
+        std::lock_guard<std::mutex> lock(exchange->mutex);
+        ++exchange->wakes;
+    }
+    exchange->wake.notify_one();
+}
+
+// Sleeps until wake_render_thread() is called after '*seen' wakes
+void wait_for_snapshot(SnapshotExchange* exchange, uint64_t* seen)
+{
+    std::unique_lock<std::mutex> lock(exchange->mutex);
+    while(exchange->wakes == *seen) exchange->wake.wait(lock);
+    *seen = exchange->wakes;
+}
+
+void render_thread_main(RenderThread* context)
+{
+    FrameRenderer* renderer = context->renderer;
+    Buffer* buffer = renderer->buffer;
+    FrameProfiler* profiler = renderer->profiler;
+    TRACE_THREAD("render");
+    enter_thread_role(THREAD_RENDER);
+    set_alloc_tag(ALLOC_RENDER);
+    glfwMakeContextCurrent(context->window);
+    // Counters only count the thread that opened them, which must be this one
+    if(profiler->counters)
+    {
+        close_perf_counters(profiler->counters);
+        if(!open_perf_counters(profiler->counters)) profiler->counters = 0;
+    }
+
+    uint64_t drawn_tick = 0, wakes_seen = 0;
+    bool first_frame = true, idle = false;
+    while(context->running.load(std::memory_order_acquire))
+    {
+        if(idle && !(context->exchange->middle.load(std::memory_order_acquire) & SNAPSHOT_FRESH))
+        {
+            wait_for_snapshot(context->exchange, &wakes_seen);
+            if(!context->running.load(std::memory_order_acquire)) break;
+        }
+        idle = false;
+        step_trace_request(context->trace);
+
+        if(context->presenter->in_flight) wait_frames_in_flight(context->presenter->in_flight);
+        wait_for_upload(context->uploader);
+        if(pacing_cycle_pressed.exchange(false)) cycle_pacing_mode(context->pacer);
+        if(screenshot_pressed.exchange(false) && context->presenter->screenshots) request_screenshot(context->presenter->screenshots);
+        if(histogram_key_pressed.exchange(false)) print_frame_histograms(*profiler);
+        if(framebuffer_resized.exchange(false))
+        {
+            update_present_viewport(context->presenter, framebuffer_width, framebuffer_height);
+        }
+        if(buffer->gpu) clear_buffer_dirty(buffer, renderer->color_table[COLOR_BACKGROUND]);
+
+        const GameSnapshot* snapshot = acquire_snapshot(context->exchange);
+        if(!snapshot->game_start)
+        {
+            bool changed = draw_title_screen(renderer) && submit_frame(context->uploader, buffer);
+            if(window_damaged.exchange(false) || changed)
+            {
+                swap_frame(*context->presenter, context->window, context->uploader);
+                pace_frame(context->pacer);
+            }
+            else pace_skipped_frame(context->pacer);
+            idle = true;
+            continue;
+        }
+
+        begin_profile_frame(profiler);
+        const GameState& state = snapshot->state;
+        bool fresh = first_frame || state.tick != drawn_tick;
+        size_t ticks = first_frame ? 0 : (size_t)(state.tick - drawn_tick);
+        drawn_tick = state.tick;
+        first_frame = false;
+
+        update_particles(renderer->particles, renderer->thread_pool, (float)(ticks * SIM_DT), state.game.width, state.game.height);
+        spawn_new_debris(renderer->particles, state.effects);
+        context->animating.store(renderer->particles->count != 0, std::memory_order_release);
+        idle = snapshot->idle && !renderer->particles->count;
+        end_phase(profiler, PHASE_PARTICLES);
+
+        // Frames between ticks are placed by how long before they reach
+        // the screen the last one ran
+        double alpha = (predict_present(context->pacer) - snapshot->tick_time) / SIM_DT;
+        alpha = alpha < 0.0 ? 0.0 : alpha > 1.0 ? 1.0 : alpha;
+        bool press = fresh && snapshot->has_press;
+        draw_game_frame(renderer, state, alpha, context->latency && press);
+        govern_frame_rate(context->pacer, context->power, classify_scene(state));
+
+        bool changed = submit_frame(context->uploader, buffer);
+        end_phase(profiler, PHASE_UPLOAD);
+
+        if(window_damaged.exchange(false) || changed)
+        {
+            swap_frame(*context->presenter, context->window, context->uploader);
+            mark_present(profiler, true);
+            if(context->latency)
+            {
+                finish_frame(context->uploader);
+                if(press) record_latency(context->latency, glfwGetTime() - snapshot->press_time);
+            }
+            pace_frame(context->pacer);
+        }
+        else
+        {
+            mark_present(profiler, false);
+            pace_skipped_frame(context->pacer);
+        }
+        end_phase(profiler, PHASE_SWAP);
+        end_profile_frame(profiler);
+        govern_quality(context->quality, renderer->particles, profiler->last_work, frame_budget(*context->pacer));
+        if(context->metrics) publish_metrics(context->metrics, *profiler, *renderer->particles, state, 0);
+    }
+
+    glfwMakeContextCurrent(0);
+}
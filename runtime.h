@@ -0,0 +1,1025 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+/*
+    Game loop support. Input events from GLFW callbacks and gamepads,
+    fixed-step simulation, input recordings, the headless benchmark, the
+    startup profile and latency meter, batch simulation and the render
+    thread that draws snapshots of the state on its own.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "present.h"
+#include "bench_report.h"
+#include "spectate.h"
+#include "metrics.h"
+#include "threads.h"
+#include "assets.h"
+#include "audio.h"
+
+extern std::atomic<bool> game_start;
+extern bool game_running;
+extern std::atomic<bool> framebuffer_resized;
+extern std::atomic<bool> window_damaged;
+extern std::atomic<int> framebuffer_width, framebuffer_height;
+extern std::atomic<bool> pacing_cycle_pressed;
+extern std::atomic<bool> show_profiler;
+extern std::atomic<bool> show_debug_overlay;
+extern std::atomic<bool> raster_cycle_pressed;
+extern std::atomic<bool> upload_cycle_pressed;
+extern std::atomic<bool> trace_key_pressed;
+extern std::atomic<bool> screenshot_pressed;
+extern std::atomic<bool> histogram_key_pressed;
+
+/*
+    Gameplay keys reach the simulation through a single-producer,
+    single-consumer ring of timestamped events. The key callback pushes and
+    the frame loop drains them tick by tick, each tick taking the events
+    that happened before it ends, so presses are never merged or lost
+    however many arrive in a frame.
+*/
+#define INPUT_QUEUE_CAPACITY 256
+
+enum InputKey: uint8_t
+{
+    INPUT_LEFT,
+    INPUT_RIGHT,
+    INPUT_FIRE
+};
+
+struct InputEvent
+{
+    double time;
+    InputKey key;
+    bool pressed;
+};
+
+struct InputQueue
+{
+    // head is only written by the consumer and tail by the producer
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    size_t dropped;
+    InputEvent events[INPUT_QUEUE_CAPACITY];
+};
+
+// Held keys and shots not yet taken, carried from tick to tick
+struct InputLatch
+{
+    bool held[INPUT_FIRE];
+    // Pressed since the last tick, so a tap inside one tick still moves
+    bool tapped[INPUT_FIRE];
+    size_t pending_fire;
+
+    // Oldest press taken since the frame loop last cleared it, for --latency
+    bool has_press;
+    double press_time;
+};
+
+extern InputQueue input_queue;
+// Set while evdev_input.h delivers the keys, key_callback() then drops them
+extern bool keys_from_evdev;
+void error_callback(int error, const char* description);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+// A GLFW key and action that happened at 'time', on the frame loop's thread
+void handle_key(int key, int action, double time);
+
+/*
+    Gamepads. GLFW reports connections through the joystick callback (the
+    inotify watch on Linux), so only pads known to be connected are read,
+    once a frame right after the events are pumped. Button and stick edges
+    become the same queued events as keyboard presses.
+*/
+#define GAMEPAD_SLOTS (GLFW_JOYSTICK_LAST + 1)
+
+struct GamepadInput
+{
+    bool connected[GAMEPAD_SLOTS];
+    size_t num_connected;
+    // Combined over every pad as of the last poll
+    bool held[INPUT_FIRE + 1];
+    bool start;
+};
+
+extern GamepadInput gamepads;
+void joystick_callback(int jid, int event);
+void poll_gamepads(GamepadInput* pads, InputQueue* queue);
+
+/*
+    Static screens. Once the title or a held story page has been drawn and
+    nothing is left to animate, the loop blocks in the event wait instead
+    of redrawing at the refresh rate. It still wakes for gamepads, which
+    GLFW only reports when polled.
+*/
+
+void wait_idle_events(const GamepadInput& pads);
+bool input_is_idle(const InputLatch& latch);
+void framebuffer_size_callback(GLFWwindow* window, int width, int height);
+void window_refresh_callback(GLFWwindow* window);
+
+/*
+    Event pump. glfwPollEvents() is a trip into the window system every
+    frame, even on the many frames mid-game when nothing arrived. The
+    adaptive pump first asks GLFW's display connection whether anything is
+    queued or readable, a poll() on its socket, and only dispatches when
+    something is. GLFW also reads descriptors of its own that the check
+    can't see (joystick hotplug, Wayland key repeat and decorations), so
+    a full pump still runs at least every EVENT_PUMP_MAX_SKIPS frames.
+    Platforms without a check always pump.
+*/
+#define EVENT_PUMP_MAX_SKIPS 8
+
+enum EventPumpMode: uint8_t
+{
+    PUMP_ALWAYS     = 0,
+    PUMP_ADAPTIVE   = 1,
+    NUM_PUMP_MODES
+};
+
+extern const char* event_pump_mode_names[NUM_PUMP_MODES];
+
+struct EventPump
+{
+    EventPumpMode mode;
+    // The platform's check, 0 where there is none
+    bool (*pending)();
+    uint32_t skips_in_row;
+    uint64_t pumps, skips;
+};
+
+// After glfwInit(), which picks the platform
+void init_event_pump(EventPump* pump, EventPumpMode mode);
+// Stands in for glfwPollEvents()
+void pump_events(EventPump* pump);
+void print_event_pump(const EventPump& pump);
+
+/*
+    Event loop. By default the loop sleeps to each frame's deadline and
+    takes in whatever arrived meanwhile when it wakes: display events at
+    the next pump, spectator datagrams at the next tick. The reactor loop
+    has the pacer wait in a Reactor instead, watching GLFW's display
+    connection and the spectator sockets alongside the deadline, so each
+    is served as it arrives and key presses are dispatched with the time
+    they came in. Evdev keeps the blocking reader thread it already has.
+    Only the X11 and Wayland platforms have a connection to watch; on the
+    others the reactor still serves the sockets.
+*/
+enum EventLoopMode: uint8_t
+{
+    EVENT_LOOP_SLEEP   = 0,
+    EVENT_LOOP_REACTOR = 1,
+    NUM_EVENT_LOOP_MODES
+};
+
+extern const char* event_loop_mode_names[NUM_EVENT_LOOP_MODES];
+
+// After glfwInit(). False, having said why, when there's no reactor here.
+// Either of 'client' and 'server' may be 0.
+bool open_event_loop(Reactor* reactor, SpectateClient* client, SpectateServer* server);
+
+/*
+    Startup profile. main() marks the end of each setup phase and the first
+    swap closes the profile, so every millisecond from main() to the first
+    presented frame lands in exactly one phase. Phases a run skips, like
+    the GL ones under Vulkan, stay at zero.
+*/
+enum StartupPhase: uint8_t
+{
+    STARTUP_OPTIONS     = 0,
+    STARTUP_GLFW_INIT   = 1,
+    STARTUP_WINDOW      = 2,
+    STARTUP_GL_LOADER   = 3,
+    // CPU kernels, pacing and the pixel buffer
+    STARTUP_BUFFERS     = 4,
+    STARTUP_SHADERS     = 5,
+    // Including the uploader and the GPU renderer's own setup
+    STARTUP_TEXTURES    = 6,
+    STARTUP_SPRITES     = 7,
+    STARTUP_FORMATION   = 8,
+    STARTUP_FIRST_FRAME = 9,
+    NUM_STARTUP_PHASES
+};
+
+struct StartupProfile
+{
+    std::chrono::steady_clock::time_point start, mark;
+    double seconds[NUM_STARTUP_PHASES];
+    // Written as JSON when set, printed either way
+    const char* json_path;
+    bool done;
+    // What StartupAssets spent on its thread alongside the phases, and how
+    // much of that the phase that joined it waited out
+    double background_seconds, background_waited;
+};
+
+extern StartupProfile startup_profile;
+void begin_startup_profile(StartupProfile* profile);
+void mark_startup_phase(StartupProfile* profile, StartupPhase phase);
+void finish_startup_profile(StartupProfile* profile);
+
+/*
+    Startup assets. Nothing the game loads from disk or builds on the CPU
+    needs a window or a GL context, so a thread started once the options
+    are parsed maps the sprite atlas and applies it to the sprites drawn
+    from it, loads the story pages, builds the starting formation with
+    them and maps the sound bank and synthesizes the sounds it lacks,
+    while main() goes through glfwInit, the window, the GL loader,
+    buffers, shaders and textures. The sprites phase joins it, before the
+    GPU atlas and the text overlay want the sprites; the GPU atlas itself
+    is packed and uploaded there as before, on the thread with the
+    context. The startup profile prints what the thread took alongside
+    and how long the join waited.
+*/
+struct StartupAssets
+{
+    std::thread thread;
+    const char* atlas_path;
+    const char* pages_path;
+    const char* sounds_path;
+    size_t width, height, start_wave;
+    bool audio;
+
+    // Written by the loader thread, read once it is joined. The sprites
+    // start out as the built-in ones.
+    GameState* state;
+    AtlasFile atlas;
+    size_t atlas_applied;
+    Sprite title_sprite, particle_sprite, text_spritesheet;
+    StoryPages* story;
+    SoundBank sound_bank;
+    // 0 without audio
+    AudioMixer* mixer;
+    bool pending;
+    std::chrono::steady_clock::time_point start, ready;
+};
+
+// Starts filling 'assets' and 'state'; the paths may be 0. 'state' must
+// not be touched until finish_startup_assets(). Mixes audio unless
+// 'audio' is false.
+void start_startup_assets(StartupAssets* assets, GameState* state, size_t width, size_t height, size_t start_wave,
+    const char* atlas_path, const char* pages_path, const char* sounds_path, bool audio);
+// Blocks until the thread is done and adds it to 'profile'
+void finish_startup_assets(StartupAssets* assets, StartupProfile* profile);
+
+/*
+    Headless benchmark. The input is scripted so every run plays the same
+    game: the player sweeps left and right and fires at a steady rate, and
+    the simulation advances by exactly one tick per frame.
+*/
+#define BENCH_DT SIM_DT
+
+// Most a frame simulates; the frame scheduler owes what is beyond
+#define SIM_MAX_FRAME_TIME 0.25
+
+void bench_input(InputQueue* queue, size_t frame, double time);
+
+/*
+    Input recordings. Every tick's GameInput is stored, run-length encoded
+    as (input, count) byte pairs, along with what the simulation was
+    started from, so a replay steps the exact same ticks: same input, same
+    state checksum, whichever renderer or upload path draws it.
+
+    The hash of the state before every tick, game_state_hash(), is
+    stored too, and a replay compares each one as it gets to that tick,
+    so a replay that stops matching names the tick it went wrong on, not
+    just the end. Recordings made under --rollback have none, the live
+    state running ahead on predicted input.
+
+    Every keyframe_ticks ticks the recording also stores the whole state,
+    the GameState and its block, with where the input runs stood at that
+    tick. Keyframes all have the same size and follow the runs, so a
+    replay is mapped rather than read: playing streams the runs from the
+    mapping, and seeking to a tick loads the keyframe at or before it,
+    found by a division, then simulates the few ticks left. Keyframes are
+    only loaded by the build that wrote them, as they are raw state.
+
+    header | runs | padding to REPLAY_ALIGNMENT | keyframes, each a
+    ReplayKeyframe, a GameState and a block, padded to REPLAY_ALIGNMENT |
+    padding to REPLAY_ALIGNMENT | a hash per tick
+*/
+// Cleared waves are laid out again, as the benchmark does
+#define REPLAY_RESPAWN 1u
+// Cleared waves are followed by the next one, as with --endless
+#define REPLAY_ENDLESS 2u
+// Dumped by the flight recorder: played from its first keyframe, and
+// ending where the game stopped, with no final checksum
+#define REPLAY_FLIGHT 4u
+#define REPLAY_KEYFRAME_TICKS (10 * SIM_TICK_RATE)
+#define REPLAY_ALIGNMENT 64
+
+struct ReplayHeader
+{
+    uint32_t magic, version;
+    uint32_t width, height;
+    uint32_t wave, flags;
+    uint64_t num_ticks;
+    // State checksum after the last tick
+    uint64_t checksum;
+
+    uint64_t num_runs;
+    // 0 when the recording has no keyframes
+    uint32_t keyframe_ticks, num_keyframes;
+    uint64_t keyframes_offset, keyframe_stride;
+    uint32_t state_size, block_size;
+    // num_ticks hashes from here, 0 when the recording has none
+    uint64_t hashes_offset;
+};
+
+struct ReplayRun
+{
+    uint8_t input, count;
+};
+
+struct ReplayKeyframe
+{
+    uint64_t tick;
+    // Where next_replay_input() stands once 'tick' ticks were played
+    uint64_t run, run_tick;
+};
+
+// Used both to record, appending runs and keyframes, and to replay,
+// walking the runs of a mapped file
+struct InputReplay
+{
+    ReplayHeader header;
+    const ReplayRun* runs;
+    size_t num_runs;
+    size_t run, run_tick;
+    uint64_t played;
+
+    // Recording: the runs, keyframes and hashes so far
+    ReplayRun* recorded;
+    size_t capacity;
+    uint8_t* keyframes;
+    size_t keyframes_capacity;
+    bool record_hashes;
+    uint64_t* recorded_hashes;
+    size_t hashes_capacity;
+
+    // Replaying: the recorded hashes, 0 without, and the first tick whose
+    // state hashed differently, UINT64_MAX while none has
+    const uint64_t* hashes;
+    uint64_t checked, diverged;
+
+    // Replaying: the file, mapped or read whole
+    const uint8_t* file;
+    size_t file_size;
+    bool mapped;
+};
+
+// 'keyframe_ticks' 0 records none, and 'hashes' false no tick hashes
+void init_input_recording(InputReplay* replay, size_t width, size_t height, size_t wave, uint32_t flags, size_t keyframe_ticks, bool hashes);
+bool write_input_recording(InputReplay* replay, const char* path, uint64_t checksum);
+bool read_input_recording(InputReplay* replay, const char* path);
+// Moves a replay and the state it drives to 'tick', from the nearest
+// keyframe, or from the start when the recording has none this build can
+// load. 'state' has to be where the replay is. Returns the ticks simulated.
+uint64_t seek_input_replay(InputReplay* replay, GameState* state, uint64_t tick);
+
+// Before the replay's next tick is stepped from 'state'
+void check_replay_hash(InputReplay* replay, const GameState& state);
+
+inline bool replay_finished(const InputReplay& replay)
+{
+    return replay.played == replay.header.num_ticks;
+}
+
+void print_replay_results(const InputReplay& replay, uint64_t checksum);
+void destroy_input_replay(InputReplay* replay);
+
+/*
+    Flight recorder. A recording of the last few seconds, kept in memory
+    all through play so a crash in the field leaves something to replay.
+    Each tick stores its input code and the state hash before it in a
+    ring of that many ticks, and every FLIGHT_SNAPSHOT_TICKS a keyframe
+    of the whole state goes into a ring of slots, enough that the oldest
+    still falls inside the ticks kept. Everything is allocated up front
+    and only the simulation thread writes, without locks: a tick's
+    entries are in place before the tick count that covers them is
+    stored, and a slot is marked torn while it is copied into.
+
+    A fatal signal, SIGSEGV, SIGBUS, SIGFPE, SIGILL or SIGABRT, dumps the
+    ring from the handler, on a stack of its own, with nothing but
+    open() and write(): the oldest whole keyframe, the ticks from there
+    run-length encoded into a buffer kept for it, and their hashes. The
+    handler that was there before then gets the signal. SIGUSR1 asks for
+    the same dump without stopping, written before the next tick. The
+    dump is an input recording flagged REPLAY_FLIGHT, which --replay
+    plays from its keyframe, checking every tick's hash, so the crash
+    happens again on the tick it happened on. POSIX only.
+*/
+#define FLIGHT_DEFAULT_SECONDS 30
+#define FLIGHT_MAX_SECONDS 3600
+#define FLIGHT_SNAPSHOT_TICKS (5 * SIM_TICK_RATE)
+#define FLIGHT_DUMP_PATH "flight.rply"
+#define FLIGHT_MAX_PATH 256
+// The handler's own stack, so a dump still runs after a stack overflow
+#define FLIGHT_SIGNAL_STACK (64 * 1024)
+
+struct FlightRecorder
+{
+    // Tick t's input code and state hash are entry t % capacity
+    uint8_t* inputs;
+    uint64_t* hashes;
+    size_t capacity;
+    // Ticks recorded, stored once their entries are
+    std::atomic<uint64_t> ticks;
+
+    // Keyframe records as a recording lays them out, each 'stride' bytes,
+    // the tick each was taken before, UINT64_MAX while it is copied, and
+    // the wave it was in
+    uint8_t* snapshots;
+    std::atomic<uint64_t>* snapshot_ticks;
+    uint32_t* snapshot_waves;
+    size_t num_snapshots, snapshot_interval, stride, block_size;
+
+    // The dump's header so far, and room for its runs
+    ReplayHeader header;
+    ReplayRun* runs;
+    char path[FLIGHT_MAX_PATH];
+
+    std::atomic<bool> dump_requested;
+    uint64_t snapshots_taken, dumps;
+};
+
+// Sized for 'state', which must keep its block size; 'flags' as for a
+// recording
+void init_flight_recorder(FlightRecorder* recorder, const GameState& state, size_t seconds, size_t width, size_t height, uint32_t flags, const char* path);
+void destroy_flight_recorder(FlightRecorder* recorder);
+// Dumps 'recorder' on the fatal signals and SIGUSR1 until uninstalled.
+// False, having said why, where there are no signals to catch.
+bool install_flight_recorder(FlightRecorder* recorder);
+void uninstall_flight_recorder();
+// 'state' is the state the input is about to step
+void record_flight_tick(FlightRecorder* recorder, const GameState& state, const GameInput& input);
+// Writes the recording out; only async-signal-safe calls, so a handler
+// can. Returns the ticks written, 0 when nothing could be.
+uint64_t dump_flight_recorder(FlightRecorder* recorder);
+void print_bench_results(const FrameProfiler& profiler, size_t frames, double seconds, size_t waves, size_t score);
+// p50, p90, p99, p99.9 and max of the work, the present intervals and
+// every phase, over the run so far
+void print_frame_histograms(const FrameProfiler& profiler);
+
+/*
+    --bench-json report of a headless run. The run is cut into
+    BENCH_REPORT_BLOCKS equal blocks of frames and each block's average
+    time per frame, and per phase, is one sample, so a single run yields
+    the repetitions confidence intervals need without replaying it. The
+    block's percentiles of the frame histograms are samples too.
+*/
+#define BENCH_REPORT_BLOCKS 10
+
+struct BenchRecorder
+{
+    BenchReport report;
+    size_t block_frames, mark_frame;
+    double mark_time;
+    double mark_totals[NUM_PHASES];
+    // The histograms as they were at the last block
+    FrameHistogram mark_phases[NUM_PHASES];
+    FrameHistogram mark_work, mark_present;
+};
+
+void init_bench_recorder(BenchRecorder* recorder, size_t frames, double now);
+// Records a sample once 'frame' ends a block, or whenever 'last' is set
+void record_bench_block(BenchRecorder* recorder, const FrameProfiler& profiler, size_t frame, double now, bool last);
+
+/*
+    Autoplay. --autoplay hands the controls to a bot that presses and
+    releases keys through the input queue, the way the keyboard does, so
+    latching, recording and rollback see ordinary input. It lines the
+    player up under the nearest column that still has a live alien, ahead
+    by the steps the march takes while a shot climbs to it, fires once
+    aligned, at most every AUTOPLAY_FIRE_TICKS ticks, and on a choice
+    page shoots at the answer it was given. A decision reads a few fields
+    and walks columns outwards from the player's, so it costs next to
+    nothing beside a frame.
+*/
+// How far off a column the player may be and still fire at it
+#define AUTOPLAY_ALIGNMENT to_fixed(2)
+#define AUTOPLAY_FIRE_TICKS 8
+
+struct AutoplayDecision
+{
+    // INPUT_LEFT or INPUT_RIGHT to move, INPUT_FIRE to stay put
+    InputKey move;
+    bool fire;
+};
+
+struct AutoplayBot
+{
+    // CHOICE_YES or CHOICE_NO
+    uint8_t answer;
+    // Direction key held down, INPUT_FIRE for none
+    InputKey held;
+    uint64_t next_fire_tick;
+    size_t shots;
+};
+
+void init_autoplay_bot(AutoplayBot* bot, uint8_t answer);
+AutoplayDecision decide_autoplay(const AutoplayBot& bot, const GameState& state);
+// Once a frame, before its ticks run, with the time the events are stamped
+void autoplay_input(AutoplayBot* bot, InputQueue* queue, const GameState& state, double time);
+void release_autoplay_keys(AutoplayBot* bot, InputQueue* queue, double time);
+
+/*
+    Profile-guided training. --pgo-train plays one scripted session on the
+    headless path: the title screen, the benchmark's input (the autoplay
+    bot's with --autoplay) until the formation is cleared, the story
+    typed out without input, and a shot at NO on the choice page, whose
+    PAGE_TERMINATE ends the game so main() returns and the profile is
+    written. Story pages left empty get placeholder lines so the text
+    paths are trained too.
+*/
+#define PGO_TRAIN_TITLE_FRAMES 120
+// Ends a session that never reaches the end, e.g. with custom page flows
+#define PGO_TRAIN_MAX_FRAMES 60000
+
+enum TrainingStage: uint8_t
+{
+    TRAINING_TITLE,
+    TRAINING_COMBAT,
+    TRAINING_STORY,
+    TRAINING_CHOICE,
+    TRAINING_ENDING,
+    NUM_TRAINING_STAGES
+};
+
+struct PgoTraining
+{
+    TrainingStage stage;
+    size_t stage_start;
+    size_t stage_frames[NUM_TRAINING_STAGES];
+    // Direction key held down during the choice, INPUT_FIRE for none
+    InputKey held;
+    // Plays the combat stage when set, instead of the benchmark's input
+    AutoplayBot* bot;
+};
+
+void fill_training_pages(GameState* state);
+void pgo_train_input(PgoTraining* training, InputQueue* queue, const GameState& state, size_t frame, double time);
+void print_pgo_training(const PgoTraining& training, size_t frames);
+
+/*
+    Stress sweeps. --stress runs the headless benchmark once for every
+    pair of alien and shot counts, each on a fresh stress formation, and
+    prints the average cost of every phase per pair, so a cliff shows up
+    as the row where one column jumps.
+*/
+#define STRESS_MAX_STEPS 8
+#define STRESS_FRAMES 600
+
+struct StressSweep
+{
+    size_t aliens[STRESS_MAX_STEPS], shots[STRESS_MAX_STEPS];
+    size_t num_aliens, num_shots;
+    // Pair being measured, every shot count for each alien count in turn
+    size_t current;
+};
+
+void init_stress_sweep(StressSweep* sweep);
+size_t parse_stress_counts(const char* text, size_t* counts);
+void start_stress_run(const StressSweep& sweep, GameState* state);
+void print_stress_row(const StressSweep& sweep, const FrameProfiler& profiler, size_t frames, double seconds);
+
+/*
+    Input latency, measured like GLFW's tests/inputlag.c: from a key
+    press's timestamp to the glFinish() after the swap of the first frame
+    that simulated it. That frame also flashes a marker in the corner, for
+    checking the numbers against a photodiode or a high-speed camera.
+*/
+#define LATENCY_SAMPLES 1024
+#define LATENCY_MARKER_SIZE 16
+
+struct LatencyMeter
+{
+    float samples[LATENCY_SAMPLES];
+    size_t count;
+};
+
+void record_latency(LatencyMeter* meter, double seconds);
+void print_latency_results(const LatencyMeter& meter);
+
+/*
+    Live A/B of the render paths. F4 cycles the rasterizer path and F5
+    the GL upload mode between frames, as does the F2 overlay, and every
+    frame's draw and upload time is added to the pair it ran on, printed
+    as a table on exit. The frame after a switch to a path other than
+    scalar is drawn again by the scalar reference over freshly invalidated
+    layers and the two are compared pixel by pixel, so a faster path that
+    draws something else shows up at once. The check waits while the F3
+    overlay is up, since it times the very draws it shows.
+*/
+struct VariantStats
+{
+    size_t frames;
+    double draw, upload;
+};
+
+struct RenderVariants
+{
+    bool switch_raster, switch_upload;
+    // Applied by apply_render_variants(), NUM_ values when none is pending
+    RasterPath requested_raster;
+    UploadMode requested_upload;
+
+    bool check_pending;
+    // The checked frame is drawn twice, so it isn't timed
+    bool skip_frame;
+    uint8_t* pixels;
+    size_t size;
+    size_t checks, failed_checks;
+    RasterPath last_checked;
+    size_t last_mismatch;
+
+    VariantStats stats[NUM_RASTER_PATHS][NUM_UPLOAD_MODES];
+};
+
+void init_render_variants(RenderVariants* variants, const Buffer& buffer, bool switch_raster, bool switch_upload);
+void destroy_render_variants(RenderVariants* variants);
+void request_raster_path(RenderVariants* variants, RasterPath path);
+void request_upload_mode(RenderVariants* variants, UploadMode mode);
+// Between frames, with the upload of the last one waited for
+void apply_render_variants(RenderVariants* variants, FrameRenderer* renderer, PixelUploader* uploader);
+// Right after draw_game_frame(), with what it was given
+void check_raster_path(RenderVariants* variants, FrameRenderer* renderer, const GameState& state, double alpha, bool press_marker);
+// Before end_profile_frame()
+void record_variant_frame(RenderVariants* variants, const FrameRenderer& renderer, UploadMode upload, const FrameProfiler& profiler);
+void print_render_variants(const RenderVariants& variants);
+
+/*
+    Conformance runs. With --conform, every frame of a benchmark or a
+    headless replay is drawn twice: first by the path under test, which
+    takes turns among all three a frame at a time and draws incrementally
+    over the layers the last frame left, with the banded draw lists when
+    there are threads; then from scratch by the scalar reference, straight
+    into the layers on this thread. The two frames' hashes are compared,
+    and the first frame each path gets wrong is reported with its count
+    of differing pixels and written to conform-<path>-<frame>.png, the
+    reference dimmed with the differing pixels in magenta. The reference
+    frames' colors fold into a digest printed at the end, the same for
+    every lossless pixel format, so runs in other formats, builds or
+    thread counts or on other machines can be compared by it. The GPU
+    renderer has no CPU pixels to hash and isn't covered.
+*/
+#define CONFORM_MAX_PATH 64
+
+struct ConformanceCheck
+{
+    // The tested frame, and the diff image
+    uint8_t* pixels;
+    uint8_t* image;
+    size_t size;
+    RasterPath next_path;
+    size_t frames;
+    size_t checked[NUM_RASTER_PATHS];
+    size_t failed[NUM_RASTER_PATHS];
+    size_t first_failure[NUM_RASTER_PATHS];
+    uint64_t digest;
+};
+
+void init_conformance_check(ConformanceCheck* check, const Buffer& buffer);
+void destroy_conformance_check(ConformanceCheck* check);
+// Before draw_game_frame(), which then draws with the path under test
+void begin_conformance_frame(ConformanceCheck* check, FrameRenderer* renderer);
+// Right after draw_game_frame(), with what it was given
+void check_conformance_frame(ConformanceCheck* check, FrameRenderer* renderer, const GameState& state, double alpha, bool press_marker);
+// False when any frame differed
+bool print_conformance(const ConformanceCheck& check);
+
+/*
+    Trace requests. --trace N records the first N frames, F9 records the
+    next N (TRACE_HOTKEY_FRAMES without --trace), and once they are drawn
+    the events of every thread go to --trace-file as Chrome trace JSON.
+*/
+#define TRACE_HOTKEY_FRAMES 300
+#define TRACE_DEFAULT_PATH "trace.json"
+
+struct TraceRequest
+{
+    const char* path;
+    size_t frames;
+    // Frames left in the running trace, 0 when none is
+    size_t remaining;
+};
+
+void step_trace_request(TraceRequest* request);
+void finish_trace_request(TraceRequest* request);
+
+/*
+    Per-frame allocation telemetry. Each frame of the loop is bracketed by
+    reads of the allocation counts. --alloc-stats prints how many frames
+    allocated, the average and worst count per frame and the split by
+    subsystem; --no-alloc arms the guard for every frame after
+    ALLOC_WARMUP_FRAMES, by which time caches and pools have grown.
+    install_glfw_allocator() serves GLFW from a BlockPool, so only the
+    pool's chunk refills count as GLFW allocations.
+*/
+#define ALLOC_WARMUP_FRAMES 120
+
+struct AllocTelemetry
+{
+    AllocCounts mark;
+    bool guard;
+    size_t frames, allocating_frames;
+    uint64_t max_allocations;
+    uint64_t allocations[NUM_ALLOC_TAGS], bytes[NUM_ALLOC_TAGS];
+};
+
+void install_glfw_allocator();
+void begin_alloc_frame(AllocTelemetry* telemetry);
+void end_alloc_frame(AllocTelemetry* telemetry);
+void print_alloc_telemetry(const AllocTelemetry& telemetry);
+
+/*
+    Memory budgets. --memory-budget KB runs the game the way a low-RAM
+    board would have to: at the design resolution, into an 8-bit indexed
+    buffer wherever the presenter takes one, from the 1bpp packed sprites
+    it always draws, with the particle pool sized to what the budget
+    leaves and the --no-alloc guard on, so nothing is allocated once the
+    pools are in. Counted against the budget is what the game needs to
+    run: the framebuffer, the GameState with its state block and level
+    arena, and the particle pool. The desktop renderer's layer buffers,
+    one a frame each, are reported beside that but not counted. The
+    report is printed before the window or any device is opened, and a
+    run whose counted memory doesn't fit exits with 1 right after it.
+*/
+// x, y, vx, vy, life and color
+#define PARTICLE_BYTES (5 * sizeof(float) + sizeof(uint8_t))
+
+struct MemoryFootprint
+{
+    size_t budget;
+    // Counted against the budget
+    size_t framebuffer, state, state_block, arena, particles;
+    // Reported only
+    size_t layers;
+};
+
+// Sets up the state the options ask for: training pages, a bullet hell,
+// a stress formation or a seek into the recording. A budgeted game does
+// so before measuring, the others once their window is up
+void configure_game_state(GameState* state, InputReplay* replay, bool pgo_train, size_t bullet_hell, const StressSweep* stress, uint64_t seek_tick);
+// Everything but the particles, which budget_particle_capacity() sizes,
+// with a width x height framebuffer of 'format' pixels
+void measure_memory_footprint(MemoryFootprint* footprint, size_t budget, const GameState& state, size_t width, size_t height, PixelFormat format);
+// Particles what is left of the budget holds, at most PARTICLE_CAPACITY;
+// sets footprint->particles to match
+size_t budget_particle_capacity(MemoryFootprint* footprint);
+// False, having said so, when what is counted exceeds the budget
+bool print_memory_footprint(const MemoryFootprint& footprint);
+
+/*
+    Soak tests. --soak HOURS has the autoplay bot play endless waves for
+    that long while a sample is taken every SOAK_SAMPLE_SECONDS of the
+    loop's clock: resident memory, live heap blocks and allocations so
+    far from the allocation counters, live GL objects, and the frame-time
+    percentiles of the minute, binned into a fixed histogram as frames
+    end. The samples are allocated up front for the whole run, so the
+    soak adds nothing to what it measures. The report compares the end of
+    the run with its start, once SOAK_WARMUP_SAMPLES have let caches and
+    pools fill, and flags memory, blocks or GL objects that grew and a
+    p99 that drifted.
+*/
+#define SOAK_SAMPLE_SECONDS 60.0
+#define SOAK_WARMUP_SAMPLES 2
+// Frame times in SOAK_BIN_SECONDS bins, the last one open-ended
+#define SOAK_BINS 1000
+#define SOAK_BIN_SECONDS 0.00005
+// Growth past these after the warm-up is flagged
+#define SOAK_RSS_SLACK (1024 * 1024)
+#define SOAK_BLOCK_SLACK 16
+// The last quarter's average p99 over the first quarter's, and by at
+// least SOAK_DRIFT_FLOOR seconds
+#define SOAK_DRIFT_RATIO 1.2
+#define SOAK_DRIFT_FLOOR 0.0005
+
+struct SoakSample
+{
+    double time;
+    uint64_t rss;
+    uint64_t live_blocks, allocations;
+    size_t gl_objects;
+    size_t frames;
+    float p50, p99, max;
+};
+
+struct SoakTest
+{
+    double start, duration, next_sample, last_frame;
+    uint32_t bins[SOAK_BINS];
+    size_t frames;
+    float max_frame;
+    SoakSample* samples;
+    size_t num_samples, capacity;
+};
+
+void init_soak_test(SoakTest* soak, double hours, double now);
+void destroy_soak_test(SoakTest* soak);
+// At the end of every frame, with the loop's clock
+void record_soak_frame(SoakTest* soak);
+bool soak_sample_due(const SoakTest& soak, double now);
+// 'gl_objects' from count_gl_objects(), 0 without a GL context
+void take_soak_sample(SoakTest* soak, double now, size_t gl_objects);
+bool soak_finished(const SoakTest& soak, double now);
+// Returns false when something was flagged
+bool print_soak_report(const SoakTest& soak);
+
+/*
+    Wave prefetch. With --endless a cleared wave is followed by the next
+    instead of the story. A worker thread lays the next wave out while the
+    current one is played, and run_ticks() starts it between two ticks by
+    copying its arrays into the state block, so the transition costs the
+    simulation thread no layout and no allocation. Layouts only depend on the wave number, so a
+    prefetched wave is the same as one laid out in place.
+*/
+struct WavePrefetcher
+{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    PreparedWave prepared;
+    size_t layout_x, layout_y;
+    // The wave the worker is asked for, SIZE_MAX once it has taken it
+    size_t requested;
+    bool ready, quit;
+};
+
+void start_wave_prefetcher(WavePrefetcher* prefetcher, GameState* state);
+void stop_wave_prefetcher(WavePrefetcher* prefetcher);
+// Starts the prepared wave, waiting if it is still being laid out, and
+// asks for the one after it
+void advance_wave(WavePrefetcher* prefetcher, GameState* state);
+
+/*
+    Rollback. With --rollback N the player's input is treated as a remote
+    player's would be in versus play: it reaches the simulation N ticks
+    after it was sent. Until then the tick runs on a prediction, the last
+    input that arrived with the trigger released, since a press fires on
+    one tick only. The state before each of the last ROLLBACK_MAX_TICKS
+    ticks is saved, so an arrival that contradicts the prediction restores
+    the state before its tick and simulates again up to the present, all
+    within the frame it arrived in. Waves that respawn do so inside the
+    ticks, where a rollback replays them too. Once every input is in, the
+    game has played exactly as it would have without rollback.
+*/
+#define ROLLBACK_MAX_TICKS 8
+
+struct RollbackSession
+{
+    // Tick t keeps slot t % ROLLBACK_MAX_TICKS: the state before it, the
+    // input it ran on and whether that input had arrived
+    SavedState saved[ROLLBACK_MAX_TICKS];
+    size_t saved_respawns[ROLLBACK_MAX_TICKS];
+    GameInput inputs[ROLLBACK_MAX_TICKS];
+    uint64_t input_ticks[ROLLBACK_MAX_TICKS];
+    bool arrived[ROLLBACK_MAX_TICKS];
+    // Inputs sent but not yet arrived, one per tick in flight
+    GameInput sent[ROLLBACK_MAX_TICKS];
+    uint64_t first_unarrived;
+    GameInput last_arrived;
+    size_t delay;
+
+    bool respawn_waves;
+    size_t respawns;
+
+    uint64_t rollbacks, resimulated, max_resimulated;
+    double rollback_seconds, max_rollback_seconds;
+    size_t max_saved_bytes;
+};
+
+void init_rollback_session(RollbackSession* session, const GameState& state, size_t delay, bool respawn_waves);
+void destroy_rollback_session(RollbackSession* session);
+// Sends this tick's input, takes in whatever arrives and steps the tick
+void step_rollback(RollbackSession* session, GameState* state, const GameInput& input);
+// Lets every input in flight arrive, leaving the state it settles on
+void settle_rollback(RollbackSession* session, GameState* state);
+void print_rollback_stats(const RollbackSession& session);
+
+/*
+    Batch simulation. Independent games are stepped on the worker pool
+    for balancing runs and bot training. Each game owns its state, its
+    bot and its results, so the workers share nothing but the task
+    counter, and every game plays the same whatever the thread count.
+*/
+#define BATCH_DEFAULT_TICKS (60 * SIM_TICK_RATE)
+
+void run_simulation_batch(size_t num_games, size_t ticks, size_t start_wave, size_t num_threads);
+size_t run_ticks(
+    GameState* state, double* accumulator, double now,
+    InputLatch* latch, InputReplay* replay, InputReplay* recording, FlightRecorder* flight, WavePrefetcher* waves, RollbackSession* rollback
+);
+
+/*
+    Frame scheduler. The accumulator takes at most SIM_MAX_FRAME_TIME a
+    frame, so a stall doesn't run a burst of ticks the player can't see.
+    What a longer frame took beyond that is kept as debt instead of being
+    lost, and paid into the accumulator on the frames after, so the game
+    comes back to the wall clock rather than slowing down. While there is
+    debt the loop puts ticks first: frames skip drawing, uploading and
+    presenting, which also means they skip the vblank wait, up to
+    FRAME_SKIP_MAX in a row before one is shown, so the picture keeps
+    moving however far behind the game is. Debt past SCHEDULER_MAX_DEBT
+    is dropped and counted, a stall that long being a pause and not
+    something to fast-forward through; so is the time spent idle waiting
+    for input. Frames that took SCHEDULER_OVERLOAD times the budget the
+    pacer gives them are counted as overloaded.
+*/
+#define FRAME_SKIP_MAX 4
+#define SCHEDULER_MAX_DEBT 1.0
+#define SCHEDULER_OVERLOAD 1.5
+
+struct FrameScheduler
+{
+    bool skip_frames;
+    double debt;
+    size_t skip_run;
+
+    uint64_t frames, overloaded, skipped;
+    size_t longest_skip;
+    // Seconds: the most owed at once, and what was dropped
+    double max_debt, dropped;
+};
+
+// With 'skip_frames' false debt is still paid, but every frame is drawn
+void init_frame_scheduler(FrameScheduler* scheduler, bool skip_frames);
+// Seconds a frame has at the pacer's rate, the refresh when uncapped
+double frame_budget(const FramePacer& pacer);
+// Tops the accumulator up with 'dt' and what is owed; true when this
+// frame should go to ticks alone. 'waited' frames slept for input.
+bool schedule_frame(FrameScheduler* scheduler, double* accumulator, double dt, double budget, bool waited);
+void print_frame_scheduler(const FrameScheduler& scheduler);
+
+/*
+    Render thread. With --render-thread the main thread only pumps events
+    and steps the simulation, publishing a snapshot of the state after
+    every batch of ticks, while a second thread owns the GL context and
+    draws the newest one. Three slots mean neither side waits on the
+    other: the simulation fills its back slot and swaps it with the shared
+    middle one, and the renderer swaps the middle one for its front slot
+    whenever it is newer. A swap blocking on vsync never holds up a tick.
+*/
+struct GameSnapshot
+{
+    // A copy whose arrays point into the block below. The story pages
+    // still belong to the live state.
+    GameState state;
+    uint8_t* block;
+    size_t capacity;
+
+    // Wall time of the last tick, so frames can be placed between ticks
+    double tick_time;
+    bool game_start;
+    // Oldest press these ticks took, for --latency
+    bool has_press;
+    double press_time;
+    // The simulation is waiting for input, see game_is_idle()
+    bool idle;
+};
+
+struct SnapshotExchange
+{
+    GameSnapshot slots[3];
+    uint32_t back, front;
+    std::atomic<uint32_t> middle;
+
+    // An idle render thread sleeps until the simulation wakes it
+    std::mutex mutex;
+    std::condition_variable wake;
+    uint64_t wakes;
+};
+
+void init_snapshot_exchange(SnapshotExchange* exchange, const GameState& state);
+void destroy_snapshot_exchange(SnapshotExchange* exchange);
+GameSnapshot* capture_snapshot(SnapshotExchange* exchange, const GameState& state);
+void publish_snapshot(SnapshotExchange* exchange);
+void wake_render_thread(SnapshotExchange* exchange);
+
+struct RenderThread
+{
+    FrameRenderer* renderer;
+    SnapshotExchange* exchange;
+    GLFWwindow* window;
+    PixelUploader* uploader;
+    Presenter* presenter;
+    FramePacer* pacer;
+    LatencyMeter* latency;
+    TraceRequest* trace;
+    PowerProfile power;
+    QualityGovernor* quality;
+    MetricsExporter* metrics;
+    std::atomic<bool> running;
+    // Debris is still moving, so the simulation must keep ticking
+    std::atomic<bool> animating;
+    std::thread thread;
+};
+
+void render_thread_main(RenderThread* context);
+
+#endif
@@ -0,0 +1,277 @@
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include "scores.h"
+#include "threads.h"
+#include "trace.h"
+
+#if defined(_WIN32)
+#define SCORES_USE_POSIX 0
+#else
+#define SCORES_USE_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SCORES_MAX_PATH 256
+// Records read at a time while the index catches up
+#define SCORES_SCAN_RECORDS 256
+
+struct ScoreLog
+{
+    char path[SCORES_MAX_PATH];
+    int fd, index_fd;
+    ScoreIndex* index;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit;
+    ScoreRecord queue[SCORE_QUEUE_RUNS];
+    size_t queued, dropped;
+
+    // Writer side: valid records in the log and what became of the runs
+    uint64_t runs;
+    size_t written, failed, torn;
+    uint64_t last_record;
+    bool has_last;
+};
+
+static uint32_t record_check(const ScoreRecord& record)
+{
+    uint32_t hash = 2166136261u;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    for(size_t bi = 0; bi < offsetof(ScoreRecord, check); ++bi)
+    {
+        hash = (hash ^ bytes[bi]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool record_valid(const ScoreRecord& record)
+{
+    return record.magic == SCORE_RECORD_MAGIC && record.check == record_check(record);
+}
+
+// Into the table if it beats the last entry; an equal score stays behind
+// the runs that got it first
+static void rank_run(ScoreIndex* index, const ScoreRecord& record, uint64_t number)
+{
+    size_t position = index->count;
+    while(position > 0 && index->top[position - 1].score < record.score) --position;
+    if(position >= SCORE_TOP_RUNS) return;
+
+    size_t last = index->count < SCORE_TOP_RUNS ? index->count : SCORE_TOP_RUNS - 1;
+    memmove(index->top + position + 1, index->top + position, (last - position) * sizeof(ScoreEntry));
+    index->top[position] = ScoreEntry{record.score, record.ended, number};
+    if(index->count < SCORE_TOP_RUNS) ++index->count;
+}
+
+/*
+################################################
+##                   WRITER                   ##
+################################################
+*/
+
+#if SCORES_USE_POSIX
+// Ranks the records the index hasn't seen, and cuts the log back to the
+// last whole one when a run was torn
+static void catch_up_index(ScoreLog* log)
+{
+    TRACE_SCOPE("catch up score index");
+    struct stat info;
+    uint64_t stored = fstat(log->fd, &info) == 0 ? (uint64_t)info.st_size / sizeof(ScoreRecord) : 0;
+
+    ScoreIndex* index = log->index;
+    if(index->magic != SCORE_INDEX_MAGIC || index->version != SCORE_INDEX_VERSION || index->runs > stored || index->count > SCORE_TOP_RUNS)
+    {
+        memset(index, 0, sizeof(ScoreIndex));
+        index->magic = SCORE_INDEX_MAGIC;
+        index->version = SCORE_INDEX_VERSION;
+    }
+
+    ScoreRecord records[SCORES_SCAN_RECORDS];
+    uint64_t number = index->runs;
+    bool torn = false;
+    while(number < stored && !torn)
+    {
+        uint64_t count = stored - number < SCORES_SCAN_RECORDS ? stored - number : SCORES_SCAN_RECORDS;
+        ssize_t bytes = pread(log->fd, records, count * sizeof(ScoreRecord), (off_t)(number * sizeof(ScoreRecord)));
+        if(bytes < (ssize_t)sizeof(ScoreRecord)) break;
+        count = (uint64_t)bytes / sizeof(ScoreRecord);
+        for(uint64_t ri = 0; ri < count; ++ri, ++number)
+        {
+            torn = !record_valid(records[ri]);
+            if(torn) break;
+            rank_run(index, records[ri], number);
+        }
+    }
+    log->runs = index->runs = number;
+
+    if((uint64_t)info.st_size != number * sizeof(ScoreRecord))
+    {
+        log->torn = (size_t)(stored - number) + ((uint64_t)info.st_size % sizeof(ScoreRecord) != 0);
+        if(ftruncate(log->fd, (off_t)(number * sizeof(ScoreRecord))) != 0) ++log->failed;
+    }
+}
+
+static void append_runs(ScoreLog* log, const ScoreRecord* records, size_t count)
+{
+    TRACE_SCOPE("append runs");
+    size_t bytes = count * sizeof(ScoreRecord);
+    ssize_t written = write(log->fd, records, bytes);
+    if(written != (ssize_t)bytes)
+    {
+        // Part of a batch would shift every record appended after it
+        if(written > 0 && ftruncate(log->fd, (off_t)(log->runs * sizeof(ScoreRecord))) != 0)
+        {
+            fprintf(stderr, "Could not cut a partial run from '%s'.\n", log->path);
+        }
+        log->failed += count;
+        return;
+    }
+
+    for(size_t ri = 0; ri < count; ++ri)
+    {
+        rank_run(log->index, records[ri], log->runs);
+        log->last_record = log->runs++;
+    }
+    log->index->runs = log->runs;
+    log->written += count;
+    log->has_last = true;
+}
+
+static void score_writer(ScoreLog* log)
+{
+    TRACE_THREAD("scores");
+    enter_thread_role(THREAD_BACKGROUND);
+    catch_up_index(log);
+
+    ScoreRecord batch[SCORE_QUEUE_RUNS];
+    std::unique_lock<std::mutex> lock(log->mutex);
+    for(;;)
+    {
+        while(!log->quit && !log->queued) log->wake.wait(lock);
+        if(!log->queued) break;
+        size_t count = log->queued;
+        memcpy(batch, log->queue, count * sizeof(ScoreRecord));
+        log->queued = 0;
+        lock.unlock();
+
+        append_runs(log, batch, count);
+
+        lock.lock();
+    }
+}
+#endif
+
+/*
+################################################
+##                 FRAME LOOP                 ##
+################################################
+*/
+
+ScoreLog* open_score_log(const char* path)
+{
+#if SCORES_USE_POSIX
+    if(strlen(path) + 4 >= SCORES_MAX_PATH)
+    {
+        fprintf(stderr, "Score log path '%s' is too long.\n", path);
+        return 0;
+    }
+    char index_path[SCORES_MAX_PATH];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    int index_fd = fd >= 0 ? open(index_path, O_RDWR | O_CREAT, 0644) : -1;
+    void* mapped = MAP_FAILED;
+    if(index_fd >= 0 && ftruncate(index_fd, sizeof(ScoreIndex)) == 0)
+    {
+        mapped = mmap(0, sizeof(ScoreIndex), PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    }
+    if(mapped == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not open score log '%s'.\n", path);
+        if(index_fd >= 0) close(index_fd);
+        if(fd >= 0) close(fd);
+        return 0;
+    }
+
+    ScoreLog* log = new ScoreLog;
+    strcpy(log->path, path);
+    log->fd = fd;
+    log->index_fd = index_fd;
+    log->index = static_cast<ScoreIndex*>(mapped);
+    log->quit = false;
+    log->queued = log->dropped = 0;
+    log->runs = 0;
+    log->written = log->failed = log->torn = 0;
+    log->last_record = 0;
+    log->has_last = false;
+    log->writer = std::thread(score_writer, log);
+    return log;
+#else
+    (void)path;
+    fprintf(stderr, "The score log needs POSIX file mapping.\n");
+    return 0;
+#endif
+}
+
+void record_run(ScoreLog* log, const GameState& state)
+{
+    ScoreRecord record = {};
+    record.magic = SCORE_RECORD_MAGIC;
+    record.wave = (uint32_t)state.wave;
+    record.score = state.score;
+    record.ended = (int64_t)time(0);
+    record.ticks = state.tick < UINT32_MAX ? (uint32_t)state.tick : UINT32_MAX;
+    record.shots_fired = (uint32_t)state.shots_fired;
+    record.shots_hit = (uint32_t)state.shots_hit;
+    record.check = record_check(record);
+
+    {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        if(log->queued == SCORE_QUEUE_RUNS)
+        {
+            ++log->dropped;
+            return;
+        }
+        log->queue[log->queued++] = record;
+    }
+    log->wake.notify_one();
+}
+
+void close_score_log(ScoreLog* log)
+{
+#if SCORES_USE_POSIX
+    {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        log->quit = true;
+    }
+    log->wake.notify_one();
+    log->writer.join();
+
+    const ScoreIndex& index = *log->index;
+    printf("Scores: %llu runs in '%s'", (unsigned long long)log->runs, log->path);
+    if(index.count) printf(", best %llu", (unsigned long long)index.top[0].score);
+    if(log->has_last)
+    {
+        size_t rank = 0;
+        while(rank < index.count && index.top[rank].record != log->last_record) ++rank;
+        if(rank < index.count) printf(", this run ranks #%zu", rank + 1);
+    }
+    printf("\n");
+    if(log->torn) printf("Scores: dropped %zu torn records from the end of the log\n", log->torn);
+    if(log->failed || log->dropped) fprintf(stderr, "Scores: %zu runs not written.\n", log->failed + log->dropped);
+
+    munmap(log->index, sizeof(ScoreIndex));
+    close(log->index_fd);
+    close(log->fd);
+#endif
+    delete log;
+}
@@ -0,0 +1,76 @@
+#ifndef SCORES_H
+#define SCORES_H
+
+/*
+    Score log. Each finished run is one fixed-size ScoreRecord appended to
+    --scores PATH: the score, ticks played, shots fired and shots that hit,
+    the wave and when the run ended. The log is only ever appended to, so
+    recording a run costs the same on a cabinet's first day as after a
+    million runs. A record cut short by a power cut fails its check and is
+    dropped, with whatever follows it, the next time the log is opened.
+
+    PATH.idx holds the SCORE_TOP_RUNS best runs and how many records of the
+    log they account for. It is mapped shared and updated in place, so a
+    new best run is a few stores into the page cache and the kernel writes
+    it back when it likes. An index that is missing, damaged or behind the
+    log is brought up to date by reading the records it hasn't seen.
+
+    The frame loop only copies a finished run into a queue. A writer
+    thread appends everything queued with one write() and updates the
+    index; nothing is fsync'ed. A crash may lose the last runs but never
+    the ones before them.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "game.h"
+
+#define SCORE_RECORD_MAGIC 0x4e555253u // "SRUN"
+#define SCORE_INDEX_MAGIC 0x58444953u  // "SIDX"
+#define SCORE_INDEX_VERSION 1
+#define SCORE_TOP_RUNS 10
+// Runs waiting for the writer; one more is dropped and counted
+#define SCORE_QUEUE_RUNS 16
+
+struct ScoreRecord
+{
+    uint32_t magic;
+    uint32_t wave;
+    uint64_t score;
+    // Unix seconds
+    int64_t ended;
+    uint32_t ticks;
+    uint32_t shots_fired, shots_hit;
+    // FNV-1a of the bytes before it
+    uint32_t check;
+};
+static_assert(sizeof(ScoreRecord) == 40, "records are written as bytes");
+
+struct ScoreEntry
+{
+    uint64_t score;
+    int64_t ended;
+    // Position of its record in the log
+    uint64_t record;
+};
+
+struct ScoreIndex
+{
+    uint32_t magic, version;
+    // Records of the log the table accounts for
+    uint64_t runs;
+    uint32_t count, reserved;
+    // Best first; ties keep the earlier run ahead
+    ScoreEntry top[SCORE_TOP_RUNS];
+};
+
+struct ScoreLog;
+
+// 0 when the log can't be opened for appending
+ScoreLog* open_score_log(const char* path);
+// Queues the run 'state' has played so far; never blocks on the disk
+void record_run(ScoreLog* log, const GameState& state);
+// Writes what is queued, prints the best runs and frees the log
+void close_score_log(ScoreLog* log);
+
+#endif
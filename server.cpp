@@ -0,0 +1,134 @@
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "sessions.h"
+#include "pages.h"
+#include "reactor.h"
+
+/*
+    Headless match server:
+
+        SpaceInvadersServer PORT [--sessions N] [--threads N] [--wave N] [--ticks N] [--huge-pages]
+
+    plays games at SIM_TICK_RATE with nothing but the simulation, the job
+    system and spectator networking linked in, no GLFW and no GL, so it
+    starts in milliseconds on a machine without a display. It is the
+    authority for N sessions, one by default, sharded over --threads
+    workers, one per core by default: a bot plays each, a match that ends
+    is followed by a new one, and every tick is sent to the spectators of
+    each session on UDP PORT, who join with HOST:PORT/SESSION. Every
+    SERVER_REPORT_SECONDS it prints the sessions per core and the tick
+    latency. Between ticks it waits in a reactor on the socket and a
+    timer for the next tick together, taking acknowledgements in as they
+    arrive. --ticks stops it after N ticks, otherwise it runs until
+    interrupted. --huge-pages maps the shards' arenas and the state blocks
+    in 2 MiB pages where the system allows.
+*/
+
+// How far behind the clock the server may fall before it skips ahead
+#define SERVER_MAX_LAG 0.25
+#define SERVER_REPORT_SECONDS 10.0
+
+static volatile sig_atomic_t serving = 1;
+
+static void stop_serving(int)
+{
+    serving = 0;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct AckReader
+{
+    SessionHost* host;
+    std::chrono::steady_clock::time_point start;
+};
+
+static void read_acks(void* context)
+{
+    AckReader* reader = (AckReader*)context;
+    receive_session_acks(reader->host, seconds_since(reader->start));
+}
+
+int main(int argc, char** argv)
+{
+    auto start = std::chrono::steady_clock::now();
+    unsigned long port = argc > 1 ? strtoul(argv[1], 0, 10) : 0;
+    size_t num_sessions = 1, num_threads = 0, start_wave = 0;
+    uint64_t max_ticks = 0;
+    for(int i = 2; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "--sessions") && i + 1 < argc) num_sessions = (size_t)strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--threads") && i + 1 < argc) num_threads = (size_t)strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--wave") && i + 1 < argc) start_wave = (size_t)strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--ticks") && i + 1 < argc) max_ticks = strtoull(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "--huge-pages")) set_huge_pages(true);
+        else port = 0;
+    }
+    if(!port || port > 65535 || !num_sessions)
+    {
+        fprintf(stderr, "Usage: %s PORT [--sessions N] [--threads N] [--wave N] [--ticks N] [--huge-pages]\n", argv[0]);
+        return 1;
+    }
+
+    SessionHost* host = open_session_host((uint16_t)port, num_sessions, num_threads, start_wave);
+    if(!host)
+    {
+        fprintf(stderr, "Could not listen for spectators on UDP port %lu.\n", port);
+        return 1;
+    }
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+    printf("Serving %zu sessions on UDP port %lu, started in %.1f ms\n", num_sessions, port, seconds_since(start) * 1000.0);
+    print_page_stats();
+
+    // Without one the server sleeps between ticks and reads at each
+    Reactor reactor;
+    AckReader reader = {host, start};
+    bool reacting = open_reactor(&reactor) && watch_reactor_fd(&reactor, session_host_fd(host), "spectators", read_acks, &reader);
+
+    uint64_t ticks = 0, late_ticks = 0;
+    double next_report = SERVER_REPORT_SECONDS;
+    auto tick_duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIM_DT));
+    auto next_tick = std::chrono::steady_clock::now();
+    while(serving && (!max_ticks || ticks < max_ticks))
+    {
+        double now = seconds_since(start);
+        step_session_host(host, now);
+        ++ticks;
+        if(now >= next_report)
+        {
+            print_session_report(report_session_host(host));
+            next_report += SERVER_REPORT_SECONDS;
+        }
+
+        // A stalled server drops the backlog rather than racing through it
+        next_tick += tick_duration;
+        auto wake = std::chrono::steady_clock::now();
+        if(wake - next_tick > std::chrono::duration<double>(SERVER_MAX_LAG))
+        {
+            next_tick = wake;
+            ++late_ticks;
+        }
+        if(reacting) run_reactor_until(&reactor, std::chrono::duration<double>(next_tick.time_since_epoch()).count());
+        else std::this_thread::sleep_until(next_tick);
+    }
+
+    SessionReport report = report_session_host(host);
+    print_session_report(report);
+    uint64_t checksum;
+    SpectateStats stats = close_session_host(host, &checksum);
+    printf("Served %llu ticks in %.1f s: %zu matches, %zu waves cleared, checksum %016llx\n",
+        (unsigned long long)ticks, seconds_since(start), report.matches, report.waves, (unsigned long long)checksum);
+    if(late_ticks) fprintf(stderr, "Fell behind %llu times.\n", (unsigned long long)late_ticks);
+    print_spectate_stats("Served", stats);
+    if(reacting) print_reactor_stats(reactor, "Event loop");
+    close_reactor(&reactor);
+    return 0;
+}
@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "sessions.h"
+#include "jobs.h"
+#include "trace.h"
+
+#if defined(_WIN32)
+#define SESSIONS_USE_POSIX 0
+#else
+#define SESSIONS_USE_POSIX 1
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) || defined(__FreeBSD__)
+#define SESSIONS_USE_MMSG 1
+#else
+#define SESSIONS_USE_MMSG 0
+#endif
+
+// Bursts of a tick's snapshots queue up in the kernel rather than drop
+#define SESSION_SOCKET_BUFFER (4 << 20)
+
+#if SESSIONS_USE_POSIX
+#if SESSIONS_USE_MMSG
+typedef mmsghdr SessionMessage;
+#else
+struct SessionMessage
+{
+    msghdr msg_hdr;
+    unsigned msg_len;
+};
+#endif
+
+struct SessionSpectator
+{
+    sockaddr_storage address;
+    socklen_t address_length;
+    // Newest snapshot the spectator decoded, SPECTATE_KEYFRAME for none
+    uint32_t acked;
+    double last_heard;
+};
+
+struct Session
+{
+    GameState state;
+    size_t shard, seed;
+    size_t matches, waves;
+    SessionSpectator spectators[SESSION_MAX_SPECTATORS];
+    size_t num_spectators;
+    // From the shard's arena once the first spectator joins
+    SnapshotHistory* history;
+};
+
+struct SessionShard
+{
+    Arena arena;
+    Session* sessions;
+    size_t first, count;
+
+    // Snapshots queued for the next sendmmsg()
+    uint8_t (*packets)[SPECTATE_MAX_PACKET];
+    iovec iovecs[SESSION_BATCH];
+    SessionMessage messages[SESSION_BATCH];
+    bool keyframes[SESSION_BATCH];
+    size_t queued;
+
+    SpectateStats stats;
+    uint64_t send_calls;
+};
+
+struct SessionHost
+{
+    int fd;
+    ThreadPool pool;
+    size_t num_sessions, num_shards, start_wave;
+    SessionShard* shards;
+    // By session number
+    Session** sessions;
+    SpectateSnapshot zero;
+    double now;
+    uint64_t ticks;
+
+    // One recvmmsg() worth of acknowledgements
+    SpectateAck acks[SESSION_BATCH];
+    sockaddr_storage from[SESSION_BATCH];
+    iovec ack_iovecs[SESSION_BATCH];
+    SessionMessage ack_messages[SESSION_BATCH];
+
+    double latency[SESSION_LATENCY_TICKS];
+};
+
+/*
+################################################
+##                  DATAGRAMS                 ##
+################################################
+*/
+
+// Up to 'count' datagrams, with each msg_len set to its size
+static size_t receive_messages(int fd, SessionMessage* messages, size_t count)
+{
+#if SESSIONS_USE_MMSG
+    int got = recvmmsg(fd, messages, (unsigned)count, MSG_DONTWAIT, 0);
+    return got > 0 ? (size_t)got : 0;
+#else
+    size_t received = 0;
+    for(; received < count; ++received)
+    {
+        ssize_t got = recvmsg(fd, &messages[received].msg_hdr, MSG_DONTWAIT);
+        if(got < 0) break;
+        messages[received].msg_len = (unsigned)got;
+    }
+    return received;
+#endif
+}
+
+// Sends every message it can, leaving msg_len 0 on those it couldn't
+static void send_messages(int fd, SessionMessage* messages, size_t count, uint64_t* calls)
+{
+#if SESSIONS_USE_MMSG
+    for(size_t at = 0; at < count;)
+    {
+        ++*calls;
+        int sent = sendmmsg(fd, messages + at, (unsigned)(count - at), 0);
+        // The datagram that failed is dropped and the rest go on
+        at += sent > 0 ? (size_t)sent : 1;
+    }
+#else
+    for(size_t mi = 0; mi < count; ++mi)
+    {
+        ++*calls;
+        ssize_t sent = sendmsg(fd, &messages[mi].msg_hdr, 0);
+        messages[mi].msg_len = sent > 0 ? (unsigned)sent : 0;
+    }
+#endif
+}
+
+/*
+################################################
+##                  SESSIONS                  ##
+################################################
+*/
+
+static void start_session_match(Session* session, size_t start_wave)
+{
+    init_game_state(&session->state, DESIGN_WIDTH, DESIGN_HEIGHT);
+    if(start_wave)
+    {
+        session->state.wave = start_wave;
+        reset_formation(&session->state);
+    }
+}
+
+static void hear_spectator(SessionHost* host, Session* session, const sockaddr_storage& address, socklen_t length, uint32_t tick)
+{
+    SessionSpectator* spectator = 0;
+    for(size_t si = 0; si < session->num_spectators && !spectator; ++si)
+    {
+        SessionSpectator& candidate = session->spectators[si];
+        if(candidate.address_length == length && memcmp(&candidate.address, &address, length) == 0) spectator = &candidate;
+    }
+    if(!spectator)
+    {
+        if(session->num_spectators == SESSION_MAX_SPECTATORS) return;
+        // The shards are idle while acknowledgements are read
+        if(!session->history)
+        {
+            SessionShard& shard = host->shards[session->shard];
+            session->history = (SnapshotHistory*)arena_alloc(&shard.arena, sizeof(SnapshotHistory), alignof(SnapshotHistory));
+        }
+        spectator = &session->spectators[session->num_spectators++];
+        spectator->address = address;
+        spectator->address_length = length;
+        spectator->acked = SPECTATE_KEYFRAME;
+    }
+    // A hello starts the spectator over; otherwise acks only move forward
+    if(tick == SPECTATE_KEYFRAME || spectator->acked == SPECTATE_KEYFRAME || (int32_t)(tick - spectator->acked) > 0)
+    {
+        spectator->acked = tick;
+    }
+    spectator->last_heard = host->now;
+}
+
+static void read_session_acks(SessionHost* host)
+{
+    TRACE_SCOPE("read acks");
+    size_t received;
+    do
+    {
+        for(size_t mi = 0; mi < SESSION_BATCH; ++mi) host->ack_messages[mi].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        received = receive_messages(host->fd, host->ack_messages, SESSION_BATCH);
+        for(size_t mi = 0; mi < received; ++mi)
+        {
+            const SessionMessage& message = host->ack_messages[mi];
+            const SpectateAck& ack = host->acks[mi];
+            if(message.msg_len != sizeof(ack) || (message.msg_hdr.msg_flags & MSG_TRUNC)) continue;
+            if(ack.magic != SPECTATE_MAGIC || ack.session >= host->num_sessions) continue;
+            hear_spectator(host, host->sessions[ack.session], host->from[mi], message.msg_hdr.msg_namelen, ack.tick);
+        }
+    } while(received == SESSION_BATCH);
+}
+
+static void flush_session_packets(SessionHost* host, SessionShard* shard)
+{
+    if(!shard->queued) return;
+    TRACE_SCOPE("send snapshots");
+    send_messages(host->fd, shard->messages, shard->queued, &shard->send_calls);
+    for(size_t pi = 0; pi < shard->queued; ++pi)
+    {
+        if(shard->messages[pi].msg_len != shard->iovecs[pi].iov_len)
+        {
+            ++shard->stats.dropped;
+            continue;
+        }
+        ++shard->stats.snapshots;
+        shard->stats.keyframes += shard->keyframes[pi];
+        shard->stats.bytes += shard->iovecs[pi].iov_len;
+    }
+    shard->queued = 0;
+}
+
+static void queue_snapshot(SessionHost* host, SessionShard* shard, Session* session, const SessionSpectator& spectator, uint32_t tick)
+{
+    if(shard->queued == SESSION_BATCH) flush_session_packets(host, shard);
+    const SpectateSnapshot* snapshot = find_snapshot(*session->history, tick);
+    const SpectateSnapshot* baseline = 0;
+    if(spectator.acked != SPECTATE_KEYFRAME && spectator.acked != tick) baseline = find_snapshot(*session->history, spectator.acked);
+
+    size_t pi = shard->queued++;
+    uint8_t* packet = shard->packets[pi];
+    SpectatePacketHeader header = {SPECTATE_MAGIC, tick, baseline ? spectator.acked : SPECTATE_KEYFRAME, 0};
+    header.length = (uint32_t)encode_snapshot_delta(
+        (const uint8_t*)snapshot, (const uint8_t*)(baseline ? baseline : &host->zero), sizeof(SpectateSnapshot), packet + sizeof(header)
+    );
+    memcpy(packet, &header, sizeof(header));
+
+    shard->iovecs[pi].iov_base = packet;
+    shard->iovecs[pi].iov_len = sizeof(header) + header.length;
+    SessionMessage& message = shard->messages[pi];
+    message = SessionMessage{};
+    message.msg_hdr.msg_name = (void*)&spectator.address;
+    message.msg_hdr.msg_namelen = spectator.address_length;
+    message.msg_hdr.msg_iov = &shard->iovecs[pi];
+    message.msg_hdr.msg_iovlen = 1;
+    shard->keyframes[pi] = !baseline;
+}
+
+static void step_session(SessionHost* host, SessionShard* shard, Session* session)
+{
+    GameState& state = session->state;
+    if(!state.running)
+    {
+        // Spectators only take snapshots newer than the last, so the
+        // next match counts on from this one's tick
+        uint64_t tick = state.tick;
+        destroy_game_state(&state);
+        start_session_match(session, host->start_wave);
+        state.tick = tick;
+        ++session->matches;
+    }
+    // A cleared wave is followed at once by the next one in the table
+    if(!state.game.aliens.num_live)
+    {
+        ++state.wave;
+        reset_formation(&state);
+        ++session->waves;
+    }
+    step_game(&state, bot_input(state, session->seed + session->matches), SIM_DT);
+    state.sounds = 0;
+
+    for(size_t si = 0; si < session->num_spectators;)
+    {
+        if(host->now - session->spectators[si].last_heard > SPECTATE_CLIENT_TIMEOUT)
+        {
+            session->spectators[si] = session->spectators[--session->num_spectators];
+        }
+        else ++si;
+    }
+    if(!session->num_spectators) return;
+
+    uint32_t tick = (uint32_t)state.tick;
+    pack_spectate_snapshot(store_snapshot(session->history, tick), state);
+    for(size_t si = 0; si < session->num_spectators; ++si) queue_snapshot(host, shard, session, session->spectators[si], tick);
+}
+
+/*
+################################################
+##                   SHARDS                   ##
+################################################
+*/
+
+// On the worker that will mostly step the shard, so on NUMA machines its
+// memory starts out local to it
+static void init_session_shard(void* context, size_t task)
+{
+    SessionHost* host = (SessionHost*)context;
+    SessionShard& shard = host->shards[task];
+    shard.first = task * host->num_sessions / host->num_shards;
+    shard.count = (task + 1) * host->num_sessions / host->num_shards - shard.first;
+    init_arena(&shard.arena, SESSION_ARENA_BLOCK);
+    shard.sessions = arena_array<Session>(&shard.arena, shard.count);
+    shard.packets = (uint8_t(*)[SPECTATE_MAX_PACKET])arena_alloc(&shard.arena, SESSION_BATCH * SPECTATE_MAX_PACKET, alignof(SpectatePacketHeader));
+    shard.queued = 0;
+    shard.stats = {};
+    shard.send_calls = 0;
+
+    for(size_t si = 0; si < shard.count; ++si)
+    {
+        Session& session = shard.sessions[si];
+        session.shard = task;
+        session.seed = shard.first + si;
+        start_session_match(&session, host->start_wave);
+        host->sessions[shard.first + si] = &session;
+    }
+}
+
+static void step_session_shard(void* context, size_t task)
+{
+    SessionHost* host = (SessionHost*)context;
+    SessionShard& shard = host->shards[task];
+    TRACE_SCOPE("session shard");
+    for(size_t si = 0; si < shard.count; ++si) step_session(host, &shard, &shard.sessions[si]);
+    flush_session_packets(host, &shard);
+}
+
+static void destroy_session_shard(void* context, size_t task)
+{
+    SessionShard& shard = ((SessionHost*)context)->shards[task];
+    for(size_t si = 0; si < shard.count; ++si) destroy_game_state(&shard.sessions[si].state);
+    destroy_arena(&shard.arena);
+}
+
+/*
+################################################
+##                    HOST                    ##
+################################################
+*/
+
+SessionHost* open_session_host(uint16_t port, size_t num_sessions, size_t num_threads, size_t start_wave)
+{
+    int fd = bind_spectate_socket(port);
+    if(fd < 0) return 0;
+    int buffer = SESSION_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    init_overlap_kernels();
+    init_move_kernels();
+
+    SessionHost* host = new SessionHost;
+    host->fd = fd;
+    init_thread_pool(&host->pool, num_threads);
+    host->num_sessions = num_sessions;
+    // A shard per thread, and none without a session
+    host->num_shards = host->pool.num_workers + 1 < num_sessions ? host->pool.num_workers + 1 : num_sessions;
+    host->start_wave = start_wave;
+    host->shards = new SessionShard[host->num_shards];
+    host->sessions = new Session*[num_sessions];
+    memset(&host->zero, 0, sizeof(host->zero));
+    host->now = 0.0;
+    host->ticks = 0;
+    for(size_t mi = 0; mi < SESSION_BATCH; ++mi)
+    {
+        host->ack_iovecs[mi].iov_base = &host->acks[mi];
+        host->ack_iovecs[mi].iov_len = sizeof(SpectateAck);
+        SessionMessage& message = host->ack_messages[mi];
+        message = SessionMessage{};
+        message.msg_hdr.msg_name = &host->from[mi];
+        message.msg_hdr.msg_iov = &host->ack_iovecs[mi];
+        message.msg_hdr.msg_iovlen = 1;
+    }
+
+    run_parallel(&host->pool, init_session_shard, host, host->num_shards);
+    return host;
+}
+
+void step_session_host(SessionHost* host, double now)
+{
+    TRACE_SCOPE("host sessions");
+    auto start = std::chrono::steady_clock::now();
+    host->now = now;
+    read_session_acks(host);
+    run_parallel(&host->pool, step_session_shard, host, host->num_shards);
+    host->latency[host->ticks++ % SESSION_LATENCY_TICKS] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int session_host_fd(const SessionHost* host)
+{
+    return host->fd;
+}
+
+void receive_session_acks(SessionHost* host, double now)
+{
+    host->now = now;
+    read_session_acks(host);
+}
+
+SessionReport report_session_host(const SessionHost* host)
+{
+    SessionReport report = {};
+    report.sessions = host->num_sessions;
+    report.threads = host->pool.num_workers + 1;
+    report.ticks = host->ticks;
+    for(size_t si = 0; si < host->num_sessions; ++si)
+    {
+        const Session& session = *host->sessions[si];
+        report.spectators += session.num_spectators;
+        report.matches += session.matches + 1;
+        report.waves += session.waves;
+    }
+    for(size_t hi = 0; hi < host->num_shards; ++hi)
+    {
+        report.snapshots += host->shards[hi].stats.snapshots;
+        report.send_calls += host->shards[hi].send_calls;
+    }
+
+    size_t count = host->ticks < SESSION_LATENCY_TICKS ? (size_t)host->ticks : SESSION_LATENCY_TICKS;
+    if(!count) return report;
+    double* sorted = new double[count];
+    memcpy(sorted, host->latency, count * sizeof(double));
+    std::sort(sorted, sorted + count);
+    report.p50 = sorted[(count - 1) / 2];
+    report.p99 = sorted[(count - 1) * 99 / 100];
+    report.max = sorted[count - 1];
+    delete[] sorted;
+    return report;
+}
+
+SpectateStats close_session_host(SessionHost* host, uint64_t* checksum)
+{
+    SpectateStats stats = {};
+    *checksum = 0;
+    for(size_t si = 0; si < host->num_sessions; ++si)
+    {
+        *checksum = (*checksum ^ game_state_checksum(host->sessions[si]->state)) * 1099511628211ull;
+    }
+    for(size_t hi = 0; hi < host->num_shards; ++hi)
+    {
+        const SpectateStats& shard = host->shards[hi].stats;
+        stats.snapshots += shard.snapshots;
+        stats.keyframes += shard.keyframes;
+        stats.dropped += shard.dropped;
+        stats.bytes += shard.bytes;
+    }
+    stats.ticks = host->ticks;
+
+    run_parallel(&host->pool, destroy_session_shard, host, host->num_shards);
+    destroy_thread_pool(&host->pool);
+    close(host->fd);
+    delete[] host->sessions;
+    delete[] host->shards;
+    delete host;
+    return stats;
+}
+
+#else
+SessionHost* open_session_host(uint16_t, size_t, size_t, size_t)
+{
+    fprintf(stderr, "Hosting sessions needs POSIX sockets.\n");
+    return 0;
+}
+
+void step_session_host(SessionHost*, double) {}
+int session_host_fd(const SessionHost*) { return -1; }
+void receive_session_acks(SessionHost*, double) {}
+SessionReport report_session_host(const SessionHost*) { return SessionReport{}; }
+SpectateStats close_session_host(SessionHost*, uint64_t* checksum)
+{
+    *checksum = 0;
+    return SpectateStats{};
+}
+#endif
+
+void print_session_report(const SessionReport& report)
+{
+    double per_core = report.threads ? (double)report.sessions / report.threads : 0.0;
+    printf(
+        "Sessions: %zu on %zu %s, %.1f per core, %zu spectators; tick p50 %.3f ms, p99 %.3f ms, max %.3f ms of %.2f ms",
+        report.sessions, report.threads, report.threads == 1 ? "thread" : "threads", per_core, report.spectators, report.p50 * 1000.0, report.p99 * 1000.0, report.max * 1000.0,
+        SIM_DT * 1000.0
+    );
+    // Ticks scale about linearly with the sessions stepped
+    if(report.p99 > 0.0) printf(", room for about %.0f per core", per_core * SIM_DT / report.p99);
+    if(report.send_calls) printf(", %.1f snapshots per send", (double)report.snapshots / report.send_calls);
+    printf("\n");
+}
@@ -0,0 +1,69 @@
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+/*
+    Session host. One server process holds hundreds of independent games,
+    each a session with its own GameState, whose level data already comes
+    from an arena of its own, its spectators and its snapshot history.
+    Sessions are split into one shard per thread of the job system, a
+    contiguous run of sessions whose memory the shard allocates from its
+    own arena on the worker that first steps it.
+
+    Every tick runs in three steps. The tick thread drains whatever the
+    spectators of all sessions sent with recvmmsg(), SESSION_BATCH
+    datagrams a call, and hands each acknowledgement to its session by
+    the session number it carries. Then the shards run on the job system:
+    each steps its sessions one tick, packs a snapshot for every session
+    that has spectators, delta-encodes it against each spectator's last
+    acknowledgement the way a single-game server does, and sends what it
+    queued with sendmmsg(), again SESSION_BATCH datagrams a call, so a
+    shard of fifty watched games costs a handful of system calls. Shards
+    share only the socket, which the kernel serializes.
+
+    The time each tick took goes into a ring of the last
+    SESSION_LATENCY_TICKS ticks, from which the host reports its tick
+    latency against the SIM_DT budget, and how many sessions each core
+    holds. Where sendmmsg() and recvmmsg() are missing, the same batches
+    go out one sendto() at a time.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "spectate.h"
+
+#define SESSION_BATCH 64
+#define SESSION_MAX_SPECTATORS 8
+#define SESSION_LATENCY_TICKS (60 * SIM_TICK_RATE)
+// Room for a shard's sessions and the histories of those watched
+#define SESSION_ARENA_BLOCK (1u << 20)
+
+struct SessionReport
+{
+    size_t sessions, threads, spectators;
+    uint64_t ticks;
+    size_t matches, waves;
+    // Snapshots sent and the system calls that sent them
+    uint64_t snapshots, send_calls;
+    // Over the ticks still in the ring, in seconds
+    double p50, p99, max;
+};
+
+struct SessionHost;
+
+// 'num_threads' counts the calling thread, 0 means one per core. 0 when
+// the port can't be bound.
+SessionHost* open_session_host(uint16_t port, size_t num_sessions, size_t num_threads, size_t start_wave);
+// Takes in what spectators sent, steps every session a tick and sends
+// their snapshots; 'now' is seconds on the host's clock
+void step_session_host(SessionHost* host, double now);
+// The socket spectators write to, for a reactor to wait on
+int session_host_fd(const SessionHost* host);
+// Takes in what spectators sent by now, as step_session_host() does first
+void receive_session_acks(SessionHost* host, double now);
+SessionReport report_session_host(const SessionHost* host);
+// One line, sessions per core and tick latency against the tick budget
+void print_session_report(const SessionReport& report);
+// Frees every session; 'checksum' folds their game state checksums
+SpectateStats close_session_host(SessionHost* host, uint64_t* checksum);
+
+#endif
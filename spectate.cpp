@@ -0,0 +1,663 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "spectate.h"
+
+#if defined(_WIN32)
+#define SPECTATE_USE_POSIX 0
+#else
+#define SPECTATE_USE_POSIX 1
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define SPECTATE_MAX_ADDRESS 256
+
+/*
+################################################
+##                 SNAPSHOTS                  ##
+################################################
+*/
+
+void pack_spectate_snapshot(SpectateSnapshot* snapshot, const GameState& state)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    const Game& game = state.game;
+    snapshot->width = (uint32_t)game.width;
+    snapshot->height = (uint32_t)game.height;
+    snapshot->wave = (uint32_t)state.wave;
+    snapshot->score = (uint32_t)state.score;
+    snapshot->player_x = game.player.x;
+    snapshot->player_y = game.player.y;
+    snapshot->march_x = state.march.offset_x;
+    snapshot->march_y = state.march.offset_y;
+
+    size_t num_words = game.aliens.num_words < SPECTATE_LIVE_WORDS ? game.aliens.num_words : SPECTATE_LIVE_WORDS;
+    memcpy(snapshot->live, game.aliens.live, num_words * sizeof(uint64_t));
+
+    snapshot->num_shields = (uint8_t)state.num_shields;
+    for(size_t si = 0; si < state.num_shields; ++si)
+    {
+        memcpy(snapshot->shield_rows[si], state.shields[si].rows, sizeof(snapshot->shield_rows[si]));
+    }
+
+    const TextAnimation& msg_animation = state.msg_animation;
+    snapshot->msg_page = (uint16_t)msg_animation.current_page;
+    snapshot->msg_line = (uint16_t)msg_animation.current_line;
+    snapshot->msg_chars = (uint16_t)msg_animation.chars_visible;
+    snapshot->flags = (state.still_alive ? SPECTATE_STILL_ALIVE : 0) | (state.choice_phase ? SPECTATE_CHOICE_PHASE : 0) |
+                      (msg_animation.animation_complete ? SPECTATE_MESSAGE_DONE : 0);
+    for(size_t ni = 0; ni < NUM_ANIMATIONS; ++ni) snapshot->animation_frames[ni] = (uint8_t)state.animations[ni].current_frame;
+
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        const Archetype& projectiles = game.projectiles[oi];
+        const int16_t* shot_x = archetype_column<int16_t>(projectiles, COMPONENT_X);
+        const Fixed* shot_y = archetype_column<Fixed>(projectiles, COMPONENT_Y);
+        int16_t velocity = (int16_t)fixed_pixels(projectiles.velocity);
+        size_t count = projectiles.count < SPECTATE_MAX_SHOTS ? projectiles.count : SPECTATE_MAX_SHOTS;
+        snapshot->num_shots[oi] = (uint8_t)count;
+        for(size_t pi = 0; pi < count; ++pi)
+        {
+            snapshot->shots[oi][pi] = SpectateShot{(uint16_t)shot_x[pi], (uint16_t)fixed_pixels(shot_y[pi]), velocity};
+        }
+    }
+
+    snapshot->effects_spawned = (uint32_t)state.effects.spawned;
+    snapshot->num_effects = (uint8_t)state.effects.count;
+    for(size_t ei = 0; ei < state.effects.count; ++ei)
+    {
+        const Effect& effect = state.effects.items[ei];
+        snapshot->effects[ei] = SpectateEffect{(int16_t)fixed_pixels(effect.x), (int16_t)fixed_pixels(effect.y), effect.kind};
+    }
+}
+
+bool spectate_snapshot_valid(const SpectateSnapshot& snapshot)
+{
+    return snapshot.num_shields <= SHIELD_COUNT;
+}
+
+void apply_spectate_snapshot(GameState* state, const SpectateSnapshot& snapshot)
+{
+    Game& game = state->game;
+    if(snapshot.wave != state->wave)
+    {
+        state->wave = snapshot.wave;
+        reset_formation(state);
+    }
+    if(memcmp(game.aliens.live, snapshot.live, game.aliens.num_words * sizeof(uint64_t)) != 0)
+    {
+        memcpy(game.aliens.live, snapshot.live, game.aliens.num_words * sizeof(uint64_t));
+        game.aliens.num_live = 0;
+        for(size_t w = 0; w < game.aliens.num_words; ++w)
+        {
+            for(uint64_t bits = game.aliens.live[w]; bits; bits &= bits - 1) ++game.aliens.num_live;
+        }
+        ++state->formation_version;
+    }
+
+    // Erosion is all a bunker ever goes through between waves
+    bool shields_changed = snapshot.num_shields != state->num_shields;
+    state->num_shields = snapshot.num_shields;
+    for(size_t si = 0; si < state->num_shields; ++si)
+    {
+        uint32_t* rows = state->shields[si].rows;
+        if(memcmp(rows, snapshot.shield_rows[si], sizeof(snapshot.shield_rows[si])) == 0) continue;
+        memcpy(rows, snapshot.shield_rows[si], sizeof(snapshot.shield_rows[si]));
+        shields_changed = true;
+    }
+    if(shields_changed) ++state->shield_version;
+
+    // Drawn as they are, so the previous positions are the current ones
+    game.player.x = game.player.prev_x = snapshot.player_x;
+    game.player.y = snapshot.player_y;
+    state->march.offset_x = snapshot.march_x;
+    state->march.offset_y = snapshot.march_y;
+    state->score = snapshot.score;
+    state->still_alive = (snapshot.flags & SPECTATE_STILL_ALIVE) != 0;
+    state->choice_phase = (snapshot.flags & SPECTATE_CHOICE_PHASE) != 0;
+
+    TextAnimation* msg_animation = &state->msg_animation;
+    msg_animation->animation_complete = (snapshot.flags & SPECTATE_MESSAGE_DONE) != 0;
+    if(snapshot.msg_page < msg_animation->num_pages)
+    {
+        const TextPage& page = msg_animation->pages[snapshot.msg_page];
+        msg_animation->current_page = snapshot.msg_page;
+        msg_animation->current_line = snapshot.msg_line < page.num_lines ? snapshot.msg_line : 0;
+        // A typed-out line shows one past its length, and never more
+        size_t most = page.num_lines ? page.compiled[msg_animation->current_line].length + 1 : 0;
+        msg_animation->chars_visible = snapshot.msg_chars < most ? snapshot.msg_chars : most;
+    }
+
+    for(size_t ni = 0; ni < NUM_ANIMATIONS; ++ni)
+    {
+        SpriteAnimation* animation = &state->animations[ni];
+        if(snapshot.animation_frames[ni] >= animation->num_frames) continue;
+        animation->current_frame = snapshot.animation_frames[ni];
+        animation->current = animation->frames[animation->current_frame];
+    }
+
+    for(size_t oi = 0; oi < NUM_PROJECTILE_OWNERS; ++oi)
+    {
+        Archetype* projectiles = &game.projectiles[oi];
+        projectiles->count = 0;
+        for(size_t pi = 0; pi < snapshot.num_shots[oi] && pi < SPECTATE_MAX_SHOTS; ++pi)
+        {
+            const SpectateShot& shot = snapshot.shots[oi][pi];
+            spawn_projectile(projectiles, shot.x, shot.y);
+        }
+    }
+
+    EffectPool* effects = &state->effects;
+    effects->count = 0;
+    for(size_t ei = 0; ei < snapshot.num_effects && ei < EFFECT_CAPACITY; ++ei)
+    {
+        const SpectateEffect& effect = snapshot.effects[ei];
+        if(effect.kind >= NUM_EFFECT_KINDS) continue;
+        EffectKind kind = (EffectKind)effect.kind;
+        effects->items[effects->count++] = Effect{to_fixed(effect.x), to_fixed(effect.y), effect_lifetimes[kind], kind};
+    }
+    effects->spawned = snapshot.effects_spawned;
+}
+
+/*
+################################################
+##                DELTA CODING                ##
+################################################
+*/
+
+static uint8_t* put_varint(uint8_t* out, size_t value)
+{
+    for(; value >= 0x80; value >>= 7) *out++ = (uint8_t)(value | 0x80);
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static bool get_varint(const uint8_t** in, const uint8_t* end, size_t* value)
+{
+    *value = 0;
+    for(size_t shift = 0; *in < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *(*in)++;
+        *value |= (size_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Runs of (unchanged bytes, changed bytes) pairs, the changed ones XORed
+// against the baseline. A lone unchanged byte between changes stays in
+// the literal, where it costs one byte instead of a new pair.
+size_t encode_snapshot_delta(const uint8_t* image, const uint8_t* baseline, size_t size, uint8_t* out)
+{
+    uint8_t* start = out;
+    size_t at = 0;
+    while(at < size)
+    {
+        size_t same = at;
+        while(same < size && image[same] == baseline[same]) ++same;
+        size_t changed = same;
+        while(changed < size)
+        {
+            if(image[changed] != baseline[changed]) ++changed;
+            else if(changed + 1 < size && image[changed + 1] != baseline[changed + 1]) changed += 2;
+            else break;
+        }
+
+        out = put_varint(out, same - at);
+        out = put_varint(out, changed - same);
+        for(size_t bi = same; bi < changed; ++bi) *out++ = image[bi] ^ baseline[bi];
+        at = changed;
+    }
+    return (size_t)(out - start);
+}
+
+bool decode_snapshot_delta(const uint8_t* in, size_t length, const uint8_t* baseline, size_t size, uint8_t* image)
+{
+    const uint8_t* end = in + length;
+    size_t at = 0;
+    while(in < end)
+    {
+        size_t same, changed;
+        if(!get_varint(&in, end, &same) || !get_varint(&in, end, &changed)) return false;
+        if(same > size - at || changed > size - at - same || changed > (size_t)(end - in)) return false;
+
+        memcpy(image + at, baseline + at, same);
+        at += same;
+        for(size_t bi = 0; bi < changed; ++bi, ++at) image[at] = baseline[at] ^ *in++;
+    }
+    return at == size;
+}
+
+void print_spectate_stats(const char* verb, const SpectateStats& stats)
+{
+    double seconds = (double)stats.ticks / SIM_TICK_RATE;
+    printf(
+        "%s %zu snapshots, %zu keyframes, %zu dropped: %llu bytes, %.1f per snapshot, %.2f KB/s\n", verb,
+        stats.snapshots, stats.keyframes, stats.dropped, (unsigned long long)stats.bytes,
+        stats.snapshots ? (double)stats.bytes / stats.snapshots : 0.0, seconds > 0.0 ? stats.bytes / seconds / 1024.0 : 0.0
+    );
+}
+
+/*
+################################################
+##                   SERVER                   ##
+################################################
+*/
+
+#if SPECTATE_USE_POSIX
+struct SpectateClientSlot
+{
+    sockaddr_storage address;
+    socklen_t address_length;
+    // Newest snapshot the spectator decoded, SPECTATE_KEYFRAME for none
+    uint32_t acked;
+    double last_heard;
+};
+
+struct SpectateServer
+{
+    int fd;
+    SpectateClientSlot clients[SPECTATE_MAX_CLIENTS];
+    size_t num_clients;
+    SnapshotHistory history;
+    SpectateSnapshot zero;
+    uint8_t packet[SPECTATE_MAX_PACKET];
+
+    SpectateStats stats;
+    bool has_first_tick;
+    uint64_t first_tick, last_tick;
+};
+
+static bool same_address(const SpectateClientSlot& client, const sockaddr_storage& address, socklen_t length)
+{
+    return client.address_length == length && memcmp(&client.address, &address, length) == 0;
+}
+
+static void read_spectator_acks(SpectateServer* server, double now)
+{
+    for(;;)
+    {
+        SpectateAck ack;
+        sockaddr_storage address;
+        socklen_t length = sizeof(address);
+        ssize_t got = recvfrom(server->fd, &ack, sizeof(ack), 0, (sockaddr*)&address, &length);
+        if(got < 0) break;
+        if(got != sizeof(ack) || ack.magic != SPECTATE_MAGIC) continue;
+
+        SpectateClientSlot* client = 0;
+        for(size_t ci = 0; ci < server->num_clients && !client; ++ci)
+        {
+            if(same_address(server->clients[ci], address, length)) client = &server->clients[ci];
+        }
+        if(!client)
+        {
+            if(server->num_clients == SPECTATE_MAX_CLIENTS) continue;
+            client = &server->clients[server->num_clients++];
+            client->address = address;
+            client->address_length = length;
+            client->acked = SPECTATE_KEYFRAME;
+            printf("Spectator joined, %zu watching\n", server->num_clients);
+        }
+        // A hello starts the spectator over; otherwise acks only move forward
+        if(ack.tick == SPECTATE_KEYFRAME || client->acked == SPECTATE_KEYFRAME || (int32_t)(ack.tick - client->acked) > 0)
+        {
+            client->acked = ack.tick;
+        }
+        client->last_heard = now;
+    }
+
+    for(size_t ci = 0; ci < server->num_clients;)
+    {
+        if(now - server->clients[ci].last_heard > SPECTATE_CLIENT_TIMEOUT)
+        {
+            server->clients[ci] = server->clients[--server->num_clients];
+            printf("Spectator left, %zu watching\n", server->num_clients);
+        }
+        else ++ci;
+    }
+}
+
+int bind_spectate_socket(uint16_t port)
+{
+    int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    // Dual-stack where it can be, plain IPv4 where it can't
+    bool ipv6 = fd >= 0;
+    if(ipv6)
+    {
+        int off = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        sockaddr_in6 address = {};
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        if(bind(fd, (sockaddr*)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(fd < 0)
+    {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(fd >= 0 && bind(fd, (sockaddr*)&address, sizeof(address)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+SpectateServer* open_spectate_server(uint16_t port)
+{
+    int fd = bind_spectate_socket(port);
+    if(fd < 0) return 0;
+
+    SpectateServer* server = new SpectateServer;
+    server->fd = fd;
+    server->num_clients = 0;
+    memset(&server->history, 0, sizeof(server->history));
+    memset(&server->zero, 0, sizeof(server->zero));
+    server->stats = {};
+    server->has_first_tick = false;
+    server->first_tick = server->last_tick = 0;
+    return server;
+}
+
+int spectate_server_fd(const SpectateServer* server)
+{
+    return server->fd;
+}
+
+void receive_spectator_acks(SpectateServer* server, double now)
+{
+    read_spectator_acks(server, now);
+}
+
+void broadcast_spectate_snapshot(SpectateServer* server, const GameState& state, double now)
+{
+    read_spectator_acks(server, now);
+    if(!server->num_clients) return;
+    // The rate counts from the first spectator on
+    if(!server->has_first_tick)
+    {
+        server->first_tick = state.tick;
+        server->has_first_tick = true;
+    }
+    server->last_tick = state.tick;
+
+    uint32_t tick = (uint32_t)state.tick;
+    SpectateSnapshot* snapshot = store_snapshot(&server->history, tick);
+    pack_spectate_snapshot(snapshot, state);
+
+    for(size_t ci = 0; ci < server->num_clients; ++ci)
+    {
+        SpectateClientSlot& client = server->clients[ci];
+        const SpectateSnapshot* baseline = 0;
+        if(client.acked != SPECTATE_KEYFRAME && client.acked != tick) baseline = find_snapshot(server->history, client.acked);
+
+        SpectatePacketHeader header = {SPECTATE_MAGIC, tick, baseline ? client.acked : SPECTATE_KEYFRAME, 0};
+        header.length = (uint32_t)encode_snapshot_delta(
+            (const uint8_t*)snapshot, (const uint8_t*)(baseline ? baseline : &server->zero), sizeof(SpectateSnapshot),
+            server->packet + sizeof(header)
+        );
+        memcpy(server->packet, &header, sizeof(header));
+
+        size_t length = sizeof(header) + header.length;
+        if(sendto(server->fd, server->packet, length, 0, (const sockaddr*)&client.address, client.address_length) != (ssize_t)length)
+        {
+            ++server->stats.dropped;
+            continue;
+        }
+        ++server->stats.snapshots;
+        if(!baseline) ++server->stats.keyframes;
+        server->stats.bytes += length;
+    }
+}
+
+size_t spectate_server_clients(const SpectateServer* server)
+{
+    return server->num_clients;
+}
+
+SpectateStats close_spectate_server(SpectateServer* server)
+{
+    SpectateStats stats = server->stats;
+    stats.ticks = server->last_tick - server->first_tick;
+    close(server->fd);
+    delete server;
+    return stats;
+}
+
+/*
+################################################
+##                 SPECTATOR                  ##
+################################################
+*/
+
+struct SpectateClient
+{
+    int fd;
+    uint32_t session;
+    SnapshotHistory history;
+    SpectateSnapshot zero;
+    uint8_t packet[SPECTATE_MAX_PACKET];
+
+    // Newest snapshot decoded, and whether it is applied yet
+    bool has_snapshot, applied;
+    uint32_t newest;
+    double last_sent;
+    SpectateStats stats;
+    uint32_t first_tick;
+};
+
+static void send_spectate_ack(SpectateClient* client, uint32_t tick, double now)
+{
+    SpectateAck ack = {SPECTATE_MAGIC, tick, client->session};
+    send(client->fd, &ack, sizeof(ack), 0);
+    client->last_sent = now;
+}
+
+// Decodes whatever arrived, acknowledging every snapshot kept
+static void read_spectate_packets(SpectateClient* client, double now)
+{
+    for(;;)
+    {
+        ssize_t got = recv(client->fd, client->packet, sizeof(client->packet), 0);
+        if(got < 0) break;
+
+        SpectatePacketHeader header;
+        if((size_t)got < sizeof(header)) continue;
+        memcpy(&header, client->packet, sizeof(header));
+        if(header.magic != SPECTATE_MAGIC || header.length != (size_t)got - sizeof(header)) continue;
+        // Late arrivals are older than what is on screen already
+        if(client->has_snapshot && (int32_t)(header.tick - client->newest) <= 0) continue;
+
+        const SpectateSnapshot* baseline = &client->zero;
+        if(header.baseline != SPECTATE_KEYFRAME) baseline = find_snapshot(client->history, header.baseline);
+        if(!baseline)
+        {
+            ++client->stats.dropped;
+            continue;
+        }
+
+        SpectateSnapshot decoded;
+        if(!decode_snapshot_delta(
+            client->packet + sizeof(header), header.length, (const uint8_t*)baseline, sizeof(decoded), (uint8_t*)&decoded
+        ))
+        {
+            ++client->stats.dropped;
+            continue;
+        }
+        if(!spectate_snapshot_valid(decoded))
+        {
+            ++client->stats.dropped;
+            continue;
+        }
+        *store_snapshot(&client->history, header.tick) = decoded;
+        if(!client->has_snapshot) client->first_tick = header.tick;
+        client->has_snapshot = true;
+        client->applied = false;
+        client->newest = header.tick;
+
+        ++client->stats.snapshots;
+        if(header.baseline == SPECTATE_KEYFRAME) ++client->stats.keyframes;
+        client->stats.bytes += (uint64_t)got;
+        send_spectate_ack(client, header.tick, now);
+    }
+}
+
+static double spectate_seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int connect_spectate_socket(const char* address, uint32_t* session)
+{
+    char host[SPECTATE_MAX_ADDRESS], port[SPECTATE_MAX_ADDRESS];
+    const char* colon = strrchr(address, ':');
+    if(!colon || (size_t)(colon - address) >= sizeof(host)) return -1;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    const char* slash = strchr(colon, '/');
+    size_t port_length = slash ? (size_t)(slash - colon - 1) : strlen(colon + 1);
+    if(port_length >= sizeof(port)) return -1;
+    memcpy(port, colon + 1, port_length);
+    port[port_length] = '\0';
+    *session = slash ? (uint32_t)strtoul(slash + 1, 0, 10) : 0;
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* found = 0;
+    if(getaddrinfo(host, port, &hints, &found) != 0) return -1;
+
+    int fd = -1;
+    for(addrinfo* ai = found; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+SpectateClient* connect_spectate_client(const char* address, SpectateSnapshot* first)
+{
+    uint32_t session;
+    int fd = connect_spectate_socket(address, &session);
+    if(fd < 0) return 0;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    SpectateClient* client = new SpectateClient;
+    client->fd = fd;
+    client->session = session;
+    memset(&client->history, 0, sizeof(client->history));
+    memset(&client->zero, 0, sizeof(client->zero));
+    client->has_snapshot = client->applied = false;
+    client->newest = 0;
+    client->stats = {};
+    client->first_tick = 0;
+
+    double start = spectate_seconds();
+    send_spectate_ack(client, SPECTATE_KEYFRAME, 0.0);
+    for(double now = start; now - start < SPECTATE_CONNECT_TIMEOUT; now = spectate_seconds())
+    {
+        read_spectate_packets(client, now - start);
+        if(client->has_snapshot)
+        {
+            *first = *find_snapshot(client->history, client->newest);
+            return client;
+        }
+        if(now - start - client->last_sent > SPECTATE_HELLO_INTERVAL) send_spectate_ack(client, SPECTATE_KEYFRAME, now - start);
+        // Asleep until a packet arrives or the next hello is due
+        double wait = client->last_sent + SPECTATE_HELLO_INTERVAL - (now - start);
+        if(wait > SPECTATE_CONNECT_TIMEOUT - (now - start)) wait = SPECTATE_CONNECT_TIMEOUT - (now - start);
+        pollfd fd = {client->fd, POLLIN, 0};
+        poll(&fd, 1, wait > 0.0 ? (int)(wait * 1000.0) + 1 : 0);
+    }
+    close_spectate_client(client);
+    return 0;
+}
+
+int spectate_client_fd(const SpectateClient* client)
+{
+    return client->fd;
+}
+
+void receive_spectate_packets(SpectateClient* client, double now)
+{
+    read_spectate_packets(client, now);
+}
+
+size_t poll_spectate_client(SpectateClient* client, GameState* state, double now)
+{
+    read_spectate_packets(client, now);
+    // Until something arrives the server may have lost track of us
+    if(now - client->last_sent > SPECTATE_HELLO_INTERVAL)
+    {
+        send_spectate_ack(client, client->has_snapshot ? client->newest : SPECTATE_KEYFRAME, now);
+    }
+    if(client->applied) return 0;
+
+    apply_spectate_snapshot(state, *find_snapshot(client->history, client->newest));
+    client->applied = true;
+    size_t ticks = (size_t)(uint32_t)(client->newest - (uint32_t)state->tick);
+    state->tick = client->newest;
+    return ticks;
+}
+
+SpectateStats close_spectate_client(SpectateClient* client)
+{
+    SpectateStats stats = client->stats;
+    stats.ticks = client->newest - client->first_tick;
+    close(client->fd);
+    delete client;
+    return stats;
+}
+
+#else
+int bind_spectate_socket(uint16_t)
+{
+    return -1;
+}
+
+SpectateServer* open_spectate_server(uint16_t)
+{
+    fprintf(stderr, "Networked spectators need POSIX sockets.\n");
+    return 0;
+}
+
+void broadcast_spectate_snapshot(SpectateServer*, const GameState&, double) {}
+size_t spectate_server_clients(const SpectateServer*) { return 0; }
+int spectate_server_fd(const SpectateServer*) { return -1; }
+void receive_spectator_acks(SpectateServer*, double) {}
+SpectateStats close_spectate_server(SpectateServer*) { return SpectateStats{}; }
+
+SpectateClient* connect_spectate_client(const char*, SpectateSnapshot*)
+{
+    fprintf(stderr, "Networked spectators need POSIX sockets.\n");
+    return 0;
+}
+
+size_t poll_spectate_client(SpectateClient*, GameState*, double) { return 0; }
+int spectate_client_fd(const SpectateClient*) { return -1; }
+void receive_spectate_packets(SpectateClient*, double) {}
+SpectateStats close_spectate_client(SpectateClient*) { return SpectateStats{}; }
+#endif
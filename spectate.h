@@ -0,0 +1,190 @@
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+/*
+    Networked spectators. The game that simulates is the authority: after
+    every batch of ticks it packs what a frame needs, and nothing the
+    simulation alone reads, into a fixed-layout SpectateSnapshot and sends
+    it over UDP to every spectator that has been heard from. Spectators
+    rebuild a GameState from the snapshots and draw it with the usual
+    renderer, so they never simulate and cannot drift.
+
+    Snapshots go out delta-encoded against the newest one the spectator
+    acknowledged: the two images are XORed and the result written as runs
+    of unchanged bytes and literal changed ones, which leaves a marching
+    formation with a few shots in flight well under a hundred bytes a
+    tick. Both ends keep the last SPECTATE_HISTORY snapshots by tick, so a
+    lost packet costs nothing but a slightly larger delta; a spectator
+    whose acknowledgement has fallen out of the server's history, or who
+    has none yet, gets a keyframe, the delta against an all-zero image.
+
+    The formation itself is not sent. Waves are laid out the same way on
+    both ends from the wave number, so only the live bits travel. Nor is
+    anything interpolated: with a snapshot per tick, spectators draw the
+    newest one as it is.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "game.h"
+
+#define SPECTATE_MAGIC 0x43455053u
+#define SPECTATE_HISTORY 64
+#define SPECTATE_MAX_CLIENTS 16
+// Shots of either side beyond these are not shown to spectators
+#define SPECTATE_MAX_SHOTS 32
+// Spectators not heard from for this long are dropped by the server; a
+// spectator still waiting for snapshots says hello again this often
+#define SPECTATE_CLIENT_TIMEOUT 5.0
+#define SPECTATE_HELLO_INTERVAL 1.0
+// How long a spectator waits for the first snapshot before giving up
+#define SPECTATE_CONNECT_TIMEOUT 5.0
+#define SPECTATE_KEYFRAME UINT32_MAX
+#define SPECTATE_LIVE_WORDS ((FORMATION_CELLS + 63) / 64)
+
+enum SpectateFlag: uint8_t
+{
+    SPECTATE_STILL_ALIVE = 1,
+    SPECTATE_CHOICE_PHASE = 2,
+    SPECTATE_MESSAGE_DONE = 4
+};
+
+struct SpectateShot
+{
+    uint16_t x, y;
+    // The owner's, in whole pixels per tick; a spectator's archetypes
+    // already move at it
+    int16_t velocity;
+};
+
+struct SpectateEffect
+{
+    int16_t x, y;
+    uint8_t kind;
+};
+
+// Zeroed before it is filled, padding included, so equal states give
+// equal images and deltas see only what changed
+struct SpectateSnapshot
+{
+    uint64_t live[SPECTATE_LIVE_WORDS];
+    uint32_t width, height;
+    uint32_t wave, score;
+    Fixed player_x, player_y;
+    Fixed march_x, march_y;
+    uint32_t shield_rows[SHIELD_COUNT][SHIELD_HEIGHT];
+    uint32_t effects_spawned;
+    uint16_t msg_page, msg_line, msg_chars;
+    uint8_t flags, num_shields, num_effects;
+    uint8_t animation_frames[NUM_ANIMATIONS];
+    uint8_t num_shots[NUM_PROJECTILE_OWNERS];
+    SpectateShot shots[NUM_PROJECTILE_OWNERS][SPECTATE_MAX_SHOTS];
+    SpectateEffect effects[EFFECT_CAPACITY];
+};
+
+void pack_spectate_snapshot(SpectateSnapshot* snapshot, const GameState& state);
+// False when a count in 'snapshot' is beyond the arrays it indexes, as
+// only a corrupt or forged packet can make it; spectators drop those
+bool spectate_snapshot_valid(const SpectateSnapshot& snapshot);
+// 'state' must have been set up by init_game_state() at the snapshot's size
+void apply_spectate_snapshot(GameState* state, const SpectateSnapshot& snapshot);
+
+// Worst-case encoded size of a 'size' byte image, every other byte changed
+#define SPECTATE_DELTA_BOUND(size) ((size) * 3 / 2 + 8)
+size_t encode_snapshot_delta(const uint8_t* image, const uint8_t* baseline, size_t size, uint8_t* out);
+// False when 'in' is malformed or doesn't cover exactly 'size' bytes
+bool decode_snapshot_delta(const uint8_t* in, size_t length, const uint8_t* baseline, size_t size, uint8_t* image);
+
+struct SpectatePacketHeader
+{
+    uint32_t magic;
+    uint32_t tick;
+    // Tick of the snapshot the payload is a delta against
+    uint32_t baseline;
+    uint32_t length;
+};
+
+// Sent by spectators: the newest tick they decoded, SPECTATE_KEYFRAME to
+// say hello, and which game of a session host they watch. A server with
+// one game answers every session.
+struct SpectateAck
+{
+    uint32_t magic;
+    uint32_t tick;
+    uint32_t session;
+};
+
+#define SPECTATE_MAX_PACKET (sizeof(SpectatePacketHeader) + SPECTATE_DELTA_BOUND(sizeof(SpectateSnapshot)))
+
+// Snapshot 'tick' sits in slot tick % SPECTATE_HISTORY while it lasts
+struct SnapshotHistory
+{
+    uint32_t ticks[SPECTATE_HISTORY];
+    bool valid[SPECTATE_HISTORY];
+    SpectateSnapshot snapshots[SPECTATE_HISTORY];
+};
+
+inline const SpectateSnapshot* find_snapshot(const SnapshotHistory& history, uint32_t tick)
+{
+    size_t slot = tick % SPECTATE_HISTORY;
+    return history.valid[slot] && history.ticks[slot] == tick ? &history.snapshots[slot] : 0;
+}
+
+inline SpectateSnapshot* store_snapshot(SnapshotHistory* history, uint32_t tick)
+{
+    size_t slot = tick % SPECTATE_HISTORY;
+    history->ticks[slot] = tick;
+    history->valid[slot] = true;
+    return &history->snapshots[slot];
+}
+
+struct SpectateStats
+{
+    size_t snapshots, keyframes, dropped;
+    uint64_t bytes;
+    // Ticks the snapshots spanned, to turn bytes into a rate
+    uint64_t ticks;
+};
+
+// One line, the rate per second of game time the snapshots spanned
+void print_spectate_stats(const char* verb, const SpectateStats& stats);
+
+/*
+    The server side. Broadcasting also reads whatever spectators sent
+    since the last call, hellos and acknowledgements alike, so it never
+    blocks and needs no thread of its own.
+*/
+struct SpectateServer;
+
+// A nonblocking UDP socket on 'port' of every interface, dual-stack where
+// it can be; -1 when the port can't be bound
+int bind_spectate_socket(uint16_t port);
+// Listens on UDP 'port' on every interface; 0 when the port can't be bound
+SpectateServer* open_spectate_server(uint16_t port);
+void broadcast_spectate_snapshot(SpectateServer* server, const GameState& state, double now);
+size_t spectate_server_clients(const SpectateServer* server);
+// The server's socket, and what broadcasting reads from it first, for a
+// reactor to take in as it arrives
+int spectate_server_fd(const SpectateServer* server);
+void receive_spectator_acks(SpectateServer* server, double now);
+SpectateStats close_spectate_server(SpectateServer* server);
+
+/*
+    The spectator side. Connecting sends a hello and blocks until the
+    first snapshot arrives, whose size and wave the game is then set up
+    with; polling drains the socket and applies the newest snapshot.
+*/
+struct SpectateClient;
+
+// 'address' is HOST:PORT, or HOST:PORT/SESSION to watch one game of a
+// session host; 0 when nothing answered in time
+SpectateClient* connect_spectate_client(const char* address, SpectateSnapshot* first);
+// The ticks the game moved on by, 0 when no newer snapshot came in
+size_t poll_spectate_client(SpectateClient* client, GameState* state, double now);
+// The client's socket, and what polling reads from it first, for a
+// reactor to take in and acknowledge as it arrives
+int spectate_client_fd(const SpectateClient* client);
+void receive_spectate_packets(SpectateClient* client, double now);
+SpectateStats close_spectate_client(SpectateClient* client);
+
+#endif
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "spectate.h"
+
+/*
+    Plays a server to a spectator over loopback and sends it a forged
+    keyframe claiming more shields than a GameState holds, then a sound
+    one. The forged one must be dropped before it is stored, so the
+    spectator starts from the sound one. Exits with 1 on any failure.
+*/
+
+static bool check(bool passed, const char* what)
+{
+    if(!passed) fprintf(stderr, "FAILED: %s\n", what);
+    return passed;
+}
+
+static void send_keyframe(int fd, const sockaddr_in& to, uint32_t tick, const SpectateSnapshot& snapshot)
+{
+    static SpectateSnapshot zero;
+    static uint8_t packet[SPECTATE_MAX_PACKET];
+    size_t length = encode_snapshot_delta(
+        (const uint8_t*)&snapshot, (const uint8_t*)&zero, sizeof(snapshot), packet + sizeof(SpectatePacketHeader)
+    );
+    SpectatePacketHeader header = {SPECTATE_MAGIC, tick, SPECTATE_KEYFRAME, (uint32_t)length};
+    memcpy(packet, &header, sizeof(header));
+    sendto(fd, packet, sizeof(header) + length, 0, (const sockaddr*)&to, sizeof(to));
+}
+
+// Waits for the spectator's hello and answers it with both keyframes
+static void serve_forged_snapshots(int fd)
+{
+    pollfd ready = {fd, POLLIN, 0};
+    if(poll(&ready, 1, (int)(SPECTATE_CONNECT_TIMEOUT * 1000.0)) <= 0) return;
+    SpectateAck hello;
+    sockaddr_in from = {};
+    socklen_t from_size = sizeof(from);
+    if(recvfrom(fd, &hello, sizeof(hello), 0, (sockaddr*)&from, &from_size) != sizeof(hello)) return;
+
+    static SpectateSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.width = DESIGN_WIDTH;
+    snapshot.height = DESIGN_HEIGHT;
+    snapshot.num_shields = 255;
+    snapshot.score = 1;
+    send_keyframe(fd, from, 1, snapshot);
+
+    snapshot.num_shields = SHIELD_COUNT;
+    snapshot.score = 2;
+    send_keyframe(fd, from, 2, snapshot);
+}
+
+int main()
+{
+    bool passed = true;
+
+    static SpectateSnapshot forged;
+    memset(&forged, 0, sizeof(forged));
+    forged.num_shields = SHIELD_COUNT + 1;
+    passed &= check(!spectate_snapshot_valid(forged), "a snapshot with too many shields is valid");
+    forged.num_shields = SHIELD_COUNT;
+    passed &= check(spectate_snapshot_valid(forged), "a snapshot with every shield is invalid");
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_size = sizeof(address);
+    if(fd < 0 || bind(fd, (const sockaddr*)&address, sizeof(address)) != 0 || getsockname(fd, (sockaddr*)&address, &address_size) != 0)
+    {
+        fprintf(stderr, "Could not open a loopback socket.\n");
+        return 1;
+    }
+    std::thread server(serve_forged_snapshots, fd);
+
+    char target[64];
+    snprintf(target, sizeof(target), "127.0.0.1:%u", (unsigned)ntohs(address.sin_port));
+    static SpectateSnapshot first;
+    SpectateClient* client = connect_spectate_client(target, &first);
+    server.join();
+    close(fd);
+
+    if(!check(client != 0, "the spectator got no snapshot")) return 1;
+    passed &= check(first.score == 2, "the spectator started from the forged snapshot");
+    passed &= check(first.num_shields == SHIELD_COUNT, "the spectator's first snapshot has the wrong shields");
+    SpectateStats stats = close_spectate_client(client);
+    passed &= check(stats.dropped == 1, "the forged snapshot was not counted as dropped");
+
+    if(passed) printf("Spectator snapshot checks passed\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,1769 @@
+#include "font.h"
+
+/*
+################################################
+##                SPRITE BLOCK                ##
+################################################
+*/
+
+// The renderer's own art; the game's is in game.h
+static constexpr auto particle_rows = pack_sprite<1, 1>("@");
+
+static constexpr auto title_rows = pack_sprite<64, 16>(
+    // ROW 1: S P A C E
+    "................................................................"
+    "................................................................"
+    "...........@@@..@@@@...@@@...@@@..@@@@@........................."
+    "..........@@.@@.@@.@@.@@@@@.@@.@@.@@..@........................."
+    "..........@@....@@.@@.@@.@@.@@....@@............................"
+    "...........@@@..@@@@..@@@@@.@@....@@@..........................."
+    ".............@@.@@....@@.@@.@@....@@............................"
+    "..........@@.@@.@@....@@.@@.@@.@@.@@..@........................."
+    "...........@@@..@@....@@.@@..@@@..@@@@@........................."
+    "................................................................"
+    // ROW 2: I N V A D E R S
+    "..@@@@.@@..@@.@@.@@..@@@..@@@@..@@@@@.@@@@...@@@................"
+    "...@@..@@@.@@.@@.@@.@@.@@.@@.@@.@@..@.@@.@@.@@.@@..............."
+    "...@@..@@@@@@.@@.@@.@@.@@.@@.@@.@@....@@.@@.@@.................."
+    "...@@..@@.@@@.@@.@@.@@@@@.@@.@@.@@@...@@@@...@@@................"
+    "...@@..@@..@@.@@.@@.@@.@@.@@.@@.@@..@.@@@@..@..@@..............."
+    "..@@@@.@@..@@..@@@..@@.@@.@@@@..@@@@@.@@.@@.@@@@................"
+);
+
+// The FONT_NUM_GLYPHS glyphs of font.h, ' ' to '~' and then Latin-1, 5x7 each
+static constexpr auto text_rows = pack_sprite<5, FONT_NUM_GLYPHS * 7, 7>(
+    // ' '
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // '!'
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "....."
+    "..@.."
+
+    // '"'
+    ".@.@."
+    ".@.@."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // '#'
+    ".@.@."
+    ".@.@."
+    "@@@@@"
+    ".@.@."
+    "@@@@@"
+    ".@.@."
+    ".@.@."
+
+    // '$'
+    "..@.."
+    ".@@@."
+    "@.@.."
+    ".@@@."
+    "..@.@"
+    ".@@@."
+    "..@.."
+
+    // '%'
+    "@@.@."
+    "@@.@."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@.@@"
+    ".@.@@"
+
+    // '&'
+    ".@@.."
+    "@..@."
+    "@..@."
+    ".@@.."
+    "@..@."
+    "@...@"
+    ".@@@@"
+
+    // '''
+    "...@."
+    "..@.."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // '('
+    "....@"
+    "...@."
+    "..@.."
+    "..@.."
+    "..@.."
+    "...@."
+    "....@"
+
+    // ')'
+    "@...."
+    ".@..."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@..."
+    "@...."
+
+    // '*'
+    "..@.."
+    "@.@.@"
+    ".@@@."
+    "..@.."
+    ".@@@."
+    "@.@.@"
+    "..@.."
+
+    // '+'
+    "....."
+    "..@.."
+    "..@.."
+    "@@@@@"
+    "..@.."
+    "..@.."
+    "....."
+
+    // ','
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "..@.."
+    "..@.."
+
+    // '-'
+    "....."
+    "....."
+    "....."
+    "@@@@@"
+    "....."
+    "....."
+    "....."
+
+    // '.'
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "..@.."
+
+    // '/'
+    "...@."
+    "...@."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@..."
+    ".@..."
+
+    // '0'
+    ".@@@."
+    "@...@"
+    "@..@@"
+    "@.@.@"
+    "@@..@"
+    "@...@"
+    ".@@@."
+
+    // '1'
+    "..@.."
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // '2'
+    ".@@@."
+    "@...@"
+    "....@"
+    "..@@."
+    ".@..."
+    "@...."
+    "@@@@@"
+
+    // '3'
+    "@@@@@"
+    "....@"
+    "...@."
+    "..@@."
+    "....@"
+    "@...@"
+    ".@@@."
+
+    // '4'
+    "...@."
+    "..@@."
+    ".@.@."
+    "@..@."
+    "@@@@@"
+    "...@."
+    "...@."
+
+    // '5'
+    "@@@@@"
+    "@...."
+    "@@@@."
+    "....@"
+    "....@"
+    "@...@"
+    ".@@@."
+
+    // '6'
+    ".@@@."
+    "@...@"
+    "@...."
+    "@@@@."
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // '7'
+    "@@@@@"
+    "....@"
+    "...@."
+    "..@.."
+    ".@..."
+    ".@..."
+    ".@..."
+
+    // '8'
+    ".@@@."
+    "@...@"
+    "@...@"
+    ".@@@."
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // '9'
+    ".@@@."
+    "@...@"
+    "@...@"
+    ".@@@@"
+    "....@"
+    "@...@"
+    ".@@@."
+
+    // ':'
+    "....."
+    "..@.."
+    "....."
+    "....."
+    "....."
+    "..@.."
+    "....."
+
+    // ';'
+    "....."
+    "..@.."
+    "....."
+    "....."
+    "....."
+    "..@.."
+    "..@.."
+
+    // '<'
+    "....@"
+    "...@."
+    "..@.."
+    ".@..."
+    "..@.."
+    "...@."
+    "....@"
+
+    // '='
+    "....."
+    "....."
+    "@@@@@"
+    "....."
+    "@@@@@"
+    "....."
+    "....."
+
+    // '>'
+    "@...."
+    ".@..."
+    "..@.."
+    "...@."
+    "..@.."
+    ".@..."
+    "@...."
+
+    // '?'
+    ".@@@."
+    "@...@"
+    "...@."
+    "..@.."
+    "..@.."
+    "....."
+    "..@.."
+
+    // '@'
+    ".@@@."
+    "@...@"
+    "@.@.@"
+    "@@.@@"
+    "@.@.."
+    "@...@"
+    ".@@@."
+
+    // 'A'
+    "..@.."
+    ".@.@."
+    "@...@"
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+
+    // 'B'
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+
+    // 'C'
+    ".@@@."
+    "@...@"
+    "@...."
+    "@...."
+    "@...."
+    "@...@"
+    ".@@@."
+
+    // 'D'
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    "@@@@."
+
+    // 'E'
+    "@@@@@"
+    "@...."
+    "@...."
+    "@@@@."
+    "@...."
+    "@...."
+    "@@@@@"
+
+    // 'F'
+    "@@@@@"
+    "@...."
+    "@...."
+    "@@@@."
+    "@...."
+    "@...."
+    "@...."
+
+    // 'G'
+    ".@@@."
+    "@...@"
+    "@...."
+    "@.@@@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // 'H'
+    "@...@"
+    "@...@"
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+    "@...@"
+
+    // 'I'
+    ".@@@."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // 'J'
+    "....@"
+    "....@"
+    "....@"
+    "....@"
+    "....@"
+    "@...@"
+    ".@@@."
+
+    // 'K'
+    "@...@"
+    "@..@."
+    "@.@.."
+    "@@..."
+    "@.@.."
+    "@..@."
+    "@...@"
+
+    // 'L'
+    "@...."
+    "@...."
+    "@...."
+    "@...."
+    "@...."
+    "@...."
+    "@@@@@"
+
+    // 'M'
+    "@...@"
+    "@@.@@"
+    "@.@.@"
+    "@.@.@"
+    "@...@"
+    "@...@"
+    "@...@"
+
+    // 'N'
+    "@...@"
+    "@...@"
+    "@@..@"
+    "@.@.@"
+    "@..@@"
+    "@...@"
+    "@...@"
+
+    // 'O'
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // 'P'
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+    "@...."
+    "@...."
+    "@...."
+
+    // 'Q'
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@.@.@"
+    "@..@@"
+    ".@@@@"
+
+    // 'R'
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+    "@.@.."
+    "@..@."
+    "@...@"
+
+    // 'S'
+    ".@@@."
+    "@...@"
+    "@...."
+    ".@@@."
+    "@...@"
+    "....@"
+    ".@@@."
+
+    // 'T'
+    "@@@@@"
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+
+    // 'U'
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // 'V'
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@.@."
+    "..@.."
+
+    // 'W'
+    "@...@"
+    "@...@"
+    "@...@"
+    "@.@.@"
+    "@.@.@"
+    "@@.@@"
+    "@...@"
+
+    // 'X'
+    "@...@"
+    "@...@"
+    ".@.@."
+    "..@.."
+    ".@.@."
+    "@...@"
+    "@...@"
+
+    // 'Y'
+    "@...@"
+    "@...@"
+    ".@.@."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+
+    // 'Z'
+    "@@@@@"
+    "....@"
+    "...@."
+    "..@.."
+    ".@..."
+    "@...."
+    "@@@@@"
+
+    // '['
+    "...@@"
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "...@@"
+
+    // '\\'
+    ".@..."
+    ".@..."
+    "..@.."
+    "..@.."
+    "..@.."
+    "...@."
+    "...@."
+
+    // ']'
+    "@@..."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "@@..."
+
+    // '^'
+    "..@.."
+    ".@.@."
+    "@...@"
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // '_'
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "@@@@@"
+
+    // '`'
+    "..@.."
+    "...@."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // 'a'
+    "....."
+    "....."
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+
+    // 'b'
+    "@...."
+    "@...."
+    "@.@@."
+    "@@..@"
+    "@...@"
+    "@...@"
+    "@@@@."
+
+    // 'c'
+    "....."
+    "....."
+    ".@@@."
+    "@...."
+    "@...."
+    "@...@"
+    ".@@@."
+
+    // 'd'
+    "....@"
+    "....@"
+    ".@@.@"
+    "@..@@"
+    "@...@"
+    "@...@"
+    ".@@@@"
+
+    // 'e'
+    "....."
+    "....."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...."
+    ".@@@."
+
+    // 'f'
+    "..@@."
+    ".@..@"
+    ".@..."
+    "@@@.."
+    ".@..."
+    ".@..."
+    ".@..."
+
+    // 'g'
+    "....."
+    ".@@@@"
+    "@...@"
+    "@...@"
+    ".@@@@"
+    "....@"
+    ".@@@."
+
+    // 'h'
+    "@...."
+    "@...."
+    "@.@@."
+    "@@..@"
+    "@...@"
+    "@...@"
+    "@...@"
+
+    // 'i'
+    "..@.."
+    "....."
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // 'j'
+    "...@."
+    "....."
+    "..@@."
+    "...@."
+    "...@."
+    "@..@."
+    ".@@.."
+
+    // 'k'
+    "@...."
+    "@...."
+    "@..@."
+    "@.@.."
+    "@@..."
+    "@.@.."
+    "@..@."
+
+    // 'l'
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // 'm'
+    "....."
+    "....."
+    "@@.@."
+    "@.@.@"
+    "@.@.@"
+    "@...@"
+    "@...@"
+
+    // 'n'
+    "....."
+    "....."
+    "@.@@."
+    "@@..@"
+    "@...@"
+    "@...@"
+    "@...@"
+
+    // 'o'
+    "....."
+    "....."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // 'p'
+    "....."
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+    "@...."
+    "@...."
+
+    // 'q'
+    "....."
+    ".@@.@"
+    "@..@@"
+    "@...@"
+    ".@@@@"
+    "....@"
+    "....@"
+
+    // 'r'
+    "....."
+    "....."
+    "@.@@."
+    "@@..@"
+    "@...."
+    "@...."
+    "@...."
+
+    // 's'
+    "....."
+    "....."
+    ".@@@."
+    "@...."
+    ".@@@."
+    "....@"
+    "@@@@."
+
+    // 't'
+    ".@..."
+    ".@..."
+    "@@@.."
+    ".@..."
+    ".@..."
+    ".@..@"
+    "..@@."
+
+    // 'u'
+    "....."
+    "....."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@..@@"
+    ".@@.@"
+
+    // 'v'
+    "....."
+    "....."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@.@."
+    "..@.."
+
+    // 'w'
+    "....."
+    "....."
+    "@...@"
+    "@...@"
+    "@.@.@"
+    "@.@.@"
+    ".@.@."
+
+    // 'x'
+    "....."
+    "....."
+    "@...@"
+    ".@.@."
+    "..@.."
+    ".@.@."
+    "@...@"
+
+    // 'y'
+    "....."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@@"
+    "....@"
+    ".@@@."
+
+    // 'z'
+    "....."
+    "....."
+    "@@@@@"
+    "...@."
+    "..@.."
+    ".@..."
+    "@@@@@"
+
+    // '{'
+    "...@."
+    "..@.."
+    "..@.."
+    ".@..."
+    "..@.."
+    "..@.."
+    "...@."
+
+    // '|'
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+
+    // '}'
+    ".@..."
+    "..@.."
+    "..@.."
+    "...@."
+    "..@.."
+    "..@.."
+    ".@..."
+
+    // '~'
+    "....."
+    "....."
+    ".@..."
+    "@.@.@"
+    "...@."
+    "....."
+    "....."
+
+    // U+00A0 no-break space
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // U+00A1 inverted exclamation mark
+    "..@.."
+    "....."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    "..@.."
+
+    // U+00A2 cent sign
+    "..@.."
+    ".@@@."
+    "@.@.."
+    "@.@.."
+    "@.@.@"
+    ".@@@."
+    "..@.."
+
+    // U+00A3 pound sign
+    "..@@."
+    ".@..@"
+    ".@..."
+    "@@@.."
+    ".@..."
+    ".@..@"
+    "@.@@."
+
+    // U+00A4 currency sign
+    "....."
+    "@...@"
+    ".@@@."
+    ".@.@."
+    ".@@@."
+    "@...@"
+    "....."
+
+    // U+00A5 yen sign
+    "@...@"
+    ".@.@."
+    "..@.."
+    "@@@@@"
+    "..@.."
+    "@@@@@"
+    "..@.."
+
+    // U+00A6 broken bar
+    "..@.."
+    "..@.."
+    "..@.."
+    "....."
+    "..@.."
+    "..@.."
+    "..@.."
+
+    // U+00A7 section sign
+    ".@@@."
+    "@...."
+    ".@@@."
+    "@...@"
+    ".@@@."
+    "....@"
+    ".@@@."
+
+    // U+00A8 diaeresis
+    ".@.@."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // U+00A9 copyright sign
+    ".@@@."
+    "@...@"
+    "@.@@@"
+    "@.@.@"
+    "@.@@@"
+    "@...@"
+    ".@@@."
+
+    // U+00AA feminine ordinal indicator
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+    "....."
+    "@@@@@"
+
+    // U+00AB left-pointing double angle quotation mark
+    "....."
+    "..@.@"
+    ".@.@."
+    "@.@.."
+    ".@.@."
+    "..@.@"
+    "....."
+
+    // U+00AC not sign
+    "....."
+    "....."
+    "@@@@@"
+    "....@"
+    "....@"
+    "....."
+    "....."
+
+    // U+00AD soft hyphen
+    "....."
+    "....."
+    "....."
+    "@@@@@"
+    "....."
+    "....."
+    "....."
+
+    // U+00AE registered sign
+    ".@@@."
+    "@...@"
+    "@@@.@"
+    "@@.@@"
+    "@@@.@"
+    "@@.@@"
+    ".@@@."
+
+    // U+00AF macron
+    "@@@@@"
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // U+00B0 degree sign
+    ".@@.."
+    "@..@."
+    "@..@."
+    ".@@.."
+    "....."
+    "....."
+    "....."
+
+    // U+00B1 plus-minus sign
+    "..@.."
+    "..@.."
+    "@@@@@"
+    "..@.."
+    "..@.."
+    "....."
+    "@@@@@"
+
+    // U+00B2 superscript two
+    ".@@.."
+    "@..@."
+    "..@.."
+    ".@..."
+    "@@@@."
+    "....."
+    "....."
+
+    // U+00B3 superscript three
+    "@@@.."
+    "...@."
+    ".@@.."
+    "...@."
+    "@@@.."
+    "....."
+    "....."
+
+    // U+00B4 acute accent
+    "...@."
+    "..@.."
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+
+    // U+00B5 micro sign
+    "....."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@..@@"
+    "@@@.@"
+    "@...."
+
+    // U+00B6 pilcrow sign
+    ".@@@@"
+    "@@@.@"
+    "@@@.@"
+    ".@@.@"
+    "..@.@"
+    "..@.@"
+    "..@.@"
+
+    // U+00B7 middle dot
+    "....."
+    "....."
+    "....."
+    "..@.."
+    "....."
+    "....."
+    "....."
+
+    // U+00B8 cedilla
+    "....."
+    "....."
+    "....."
+    "....."
+    "....."
+    "..@.."
+    ".@@.."
+
+    // U+00B9 superscript one
+    ".@..."
+    "@@..."
+    ".@..."
+    ".@..."
+    "@@@.."
+    "....."
+    "....."
+
+    // U+00BA masculine ordinal indicator
+    ".@@@."
+    "@...@"
+    "@...@"
+    ".@@@."
+    "....."
+    "@@@@@"
+    "....."
+
+    // U+00BB right-pointing double angle quotation mark
+    "....."
+    "@.@.."
+    ".@.@."
+    "..@.@"
+    ".@.@."
+    "@.@.."
+    "....."
+
+    // U+00BC vulgar fraction one quarter
+    "@...."
+    "@..@."
+    "@.@.."
+    "..@.."
+    ".@.@."
+    "@.@@@"
+    "...@."
+
+    // U+00BD vulgar fraction one half
+    "@...."
+    "@..@."
+    "@.@.."
+    "..@@."
+    ".@..@"
+    "@..@."
+    "...@@"
+
+    // U+00BE vulgar fraction three quarters
+    "@@..."
+    ".@.@."
+    "@@@.."
+    "..@.."
+    ".@.@."
+    "@.@@@"
+    "...@."
+
+    // U+00BF inverted question mark
+    "..@.."
+    "....."
+    "..@.."
+    ".@..."
+    "@...."
+    "@...@"
+    ".@@@."
+
+    // U+00C0 capital A with grave
+    ".@..."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+
+    // U+00C1 capital A with acute
+    "...@."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+
+    // U+00C2 capital A with circumflex
+    "..@.."
+    ".@.@."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+
+    // U+00C3 capital A with tilde
+    ".@@.@"
+    "@..@."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+
+    // U+00C4 capital A with diaeresis
+    ".@.@."
+    "....."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...@"
+    "@...@"
+
+    // U+00C5 capital A with ring above
+    "..@.."
+    ".@.@."
+    "..@.."
+    ".@.@."
+    "@...@"
+    "@@@@@"
+    "@...@"
+
+    // U+00C6 capital AE
+    ".@@@@"
+    "@.@.."
+    "@.@.."
+    "@@@@@"
+    "@.@.."
+    "@.@.."
+    "@.@@@"
+
+    // U+00C7 capital C with cedilla
+    ".@@@."
+    "@...@"
+    "@...."
+    "@...@"
+    ".@@@."
+    "..@.."
+    ".@@.."
+
+    // U+00C8 capital E with grave
+    ".@..."
+    "..@.."
+    "@@@@@"
+    "@...."
+    "@@@@."
+    "@...."
+    "@@@@@"
+
+    // U+00C9 capital E with acute
+    "...@."
+    "..@.."
+    "@@@@@"
+    "@...."
+    "@@@@."
+    "@...."
+    "@@@@@"
+
+    // U+00CA capital E with circumflex
+    "..@.."
+    ".@.@."
+    "@@@@@"
+    "@...."
+    "@@@@."
+    "@...."
+    "@@@@@"
+
+    // U+00CB capital E with diaeresis
+    ".@.@."
+    "....."
+    "@@@@@"
+    "@...."
+    "@@@@."
+    "@...."
+    "@@@@@"
+
+    // U+00CC capital I with grave
+    ".@..."
+    "..@.."
+    ".@@@."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00CD capital I with acute
+    "...@."
+    "..@.."
+    ".@@@."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00CE capital I with circumflex
+    "..@.."
+    ".@.@."
+    ".@@@."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00CF capital I with diaeresis
+    ".@.@."
+    "....."
+    ".@@@."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00D0 capital eth
+    "@@@@."
+    ".@..@"
+    ".@..@"
+    "@@@.@"
+    ".@..@"
+    ".@..@"
+    "@@@@."
+
+    // U+00D1 capital N with tilde
+    ".@@.@"
+    "@..@."
+    "@...@"
+    "@@..@"
+    "@.@.@"
+    "@..@@"
+    "@...@"
+
+    // U+00D2 capital O with grave
+    ".@..."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00D3 capital O with acute
+    "...@."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00D4 capital O with circumflex
+    "..@.."
+    ".@.@."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00D5 capital O with tilde
+    ".@@.@"
+    "@..@."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00D6 capital O with diaeresis
+    ".@.@."
+    "....."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00D7 multiplication sign
+    "....."
+    "@...@"
+    ".@.@."
+    "..@.."
+    ".@.@."
+    "@...@"
+    "....."
+
+    // U+00D8 capital O with stroke
+    ".@@@."
+    "@..@@"
+    "@.@.@"
+    "@.@.@"
+    "@.@.@"
+    "@@..@"
+    ".@@@."
+
+    // U+00D9 capital U with grave
+    ".@..."
+    "..@.."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00DA capital U with acute
+    "...@."
+    "..@.."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00DB capital U with circumflex
+    "..@.."
+    ".@.@."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00DC capital U with diaeresis
+    ".@.@."
+    "....."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00DD capital Y with acute
+    "...@."
+    "..@.."
+    "@...@"
+    ".@.@."
+    "..@.."
+    "..@.."
+    "..@.."
+
+    // U+00DE capital thorn
+    "@...."
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+    "@...."
+    "@...."
+
+    // U+00DF sharp s
+    ".@@.."
+    "@..@."
+    "@..@."
+    "@.@.."
+    "@..@."
+    "@...@"
+    "@.@@."
+
+    // U+00E0 small a with grave
+    ".@..."
+    "..@.."
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+
+    // U+00E1 small a with acute
+    "...@."
+    "..@.."
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+
+    // U+00E2 small a with circumflex
+    "..@.."
+    ".@.@."
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+
+    // U+00E3 small a with tilde
+    ".@@.@"
+    "@..@."
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+
+    // U+00E4 small a with diaeresis
+    ".@.@."
+    "....."
+    ".@@@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@@"
+
+    // U+00E5 small a with ring above
+    "..@.."
+    ".@.@."
+    "..@.."
+    ".@@@@"
+    "@...@"
+    "@..@@"
+    ".@@.@"
+
+    // U+00E6 small ae
+    "....."
+    "....."
+    "@@.@."
+    "..@.@"
+    "@@@@@"
+    "@.@.."
+    "@@.@@"
+
+    // U+00E7 small c with cedilla
+    "....."
+    ".@@@."
+    "@...."
+    "@...@"
+    ".@@@."
+    "..@.."
+    ".@@.."
+
+    // U+00E8 small e with grave
+    ".@..."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...."
+    ".@@@."
+
+    // U+00E9 small e with acute
+    "...@."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...."
+    ".@@@."
+
+    // U+00EA small e with circumflex
+    "..@.."
+    ".@.@."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...."
+    ".@@@."
+
+    // U+00EB small e with diaeresis
+    ".@.@."
+    "....."
+    ".@@@."
+    "@...@"
+    "@@@@@"
+    "@...."
+    ".@@@."
+
+    // U+00EC small i with grave
+    ".@..."
+    "..@.."
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00ED small i with acute
+    "...@."
+    "..@.."
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00EE small i with circumflex
+    "..@.."
+    ".@.@."
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00EF small i with diaeresis
+    ".@.@."
+    "....."
+    ".@@.."
+    "..@.."
+    "..@.."
+    "..@.."
+    ".@@@."
+
+    // U+00F0 small eth
+    ".@.@."
+    "..@.."
+    ".@.@."
+    "....@"
+    ".@@@@"
+    "@...@"
+    ".@@@."
+
+    // U+00F1 small n with tilde
+    ".@@.@"
+    "@..@."
+    "@.@@."
+    "@@..@"
+    "@...@"
+    "@...@"
+    "@...@"
+
+    // U+00F2 small o with grave
+    ".@..."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00F3 small o with acute
+    "...@."
+    "..@.."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00F4 small o with circumflex
+    "..@.."
+    ".@.@."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00F5 small o with tilde
+    ".@@.@"
+    "@..@."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00F6 small o with diaeresis
+    ".@.@."
+    "....."
+    ".@@@."
+    "@...@"
+    "@...@"
+    "@...@"
+    ".@@@."
+
+    // U+00F7 division sign
+    "....."
+    "..@.."
+    "....."
+    "@@@@@"
+    "....."
+    "..@.."
+    "....."
+
+    // U+00F8 small o with stroke
+    "....."
+    "....."
+    ".@@@."
+    "@..@@"
+    "@.@.@"
+    "@@..@"
+    ".@@@."
+
+    // U+00F9 small u with grave
+    ".@..."
+    "..@.."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@..@@"
+    ".@@.@"
+
+    // U+00FA small u with acute
+    "...@."
+    "..@.."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@..@@"
+    ".@@.@"
+
+    // U+00FB small u with circumflex
+    "..@.."
+    ".@.@."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@..@@"
+    ".@@.@"
+
+    // U+00FC small u with diaeresis
+    ".@.@."
+    "....."
+    "@...@"
+    "@...@"
+    "@...@"
+    "@..@@"
+    ".@@.@"
+
+    // U+00FD small y with acute
+    "...@."
+    "..@.."
+    "@...@"
+    "@...@"
+    ".@@@@"
+    "....@"
+    ".@@@."
+
+    // U+00FE small thorn
+    "....."
+    "@...."
+    "@@@@."
+    "@...@"
+    "@...@"
+    "@@@@."
+    "@...."
+
+    // U+00FF small y with diaeresis
+    ".@.@."
+    "....."
+    "@...@"
+    "@...@"
+    ".@@@@"
+    "....@"
+    ".@@@."
+);
+
+// In draw order, see SpriteBlock
+const SpriteBlock sprite_block = {
+    projectile_rows,
+    particle_rows,
+    alien_rows, alien_rows1,
+    squid_rows, squid_rows1,
+    octopus_rows, octopus_rows1,
+    player_rows,
+    muzzle_flash_rows,
+    alien_death_rows,
+    shield_erosion_rows,
+    text_rows,
+    title_rows,
+    shield_rows,
+};
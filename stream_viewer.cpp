@@ -0,0 +1,191 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "capture.h"
+
+/*
+    Decodes a delta frame stream back to raw video on stdout:
+
+        stream_viewer PORT | ffplay -f rawvideo -pix_fmt FORMAT -s WxH -i -
+
+    listens for the game's --stream tcp:HOST:PORT on PORT, or reads the
+    stream from stdin with '-' in place of the port. Frames come out top-down
+    in the game's pixel layout, so FORMAT and the size are the ones the
+    game's startup line names.
+*/
+
+struct Viewer
+{
+    DeltaStreamHeader header;
+    size_t row_bytes;
+    uint8_t* frame;
+    uint8_t* indices;
+    uint32_t palette[DELTA_MAX_PALETTE];
+    size_t palette_size;
+    uint8_t* payload;
+    size_t capacity;
+};
+
+static bool read_bytes(int fd, void* data, size_t size)
+{
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    while(size)
+    {
+        ssize_t count = read(fd, bytes, size);
+        if(count <= 0) return false;
+        bytes += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+// XORs a row's tokens into the frame, or into its indices and then the
+// frame through the palette
+static bool apply_row(Viewer* viewer, bool indexed, size_t y, const uint8_t* tokens, size_t length)
+{
+    size_t width = viewer->header.width;
+    size_t unit_bytes = indexed ? 1 : viewer->header.pixel_bytes;
+    uint8_t* units = indexed ? viewer->indices + y * width : viewer->frame + y * viewer->row_bytes;
+
+    size_t ui = 0;
+    for(size_t ti = 0; ti < length;)
+    {
+        uint8_t token = tokens[ti++];
+        if(token < DELTA_TOKEN_LITERAL)
+        {
+            ui += token + 1u;
+            continue;
+        }
+        size_t run = token - DELTA_TOKEN_LITERAL + 1u;
+        if(ui + run > width || ti + run * unit_bytes > length) return false;
+        for(size_t bi = 0; bi < run * unit_bytes; ++bi) units[ui * unit_bytes + bi] ^= tokens[ti + bi];
+        ti += run * unit_bytes;
+        ui += run;
+    }
+    if(!indexed) return true;
+
+    uint8_t* pixels = viewer->frame + y * viewer->row_bytes;
+    for(size_t xi = 0; xi < width; ++xi)
+    {
+        if(units[xi] >= viewer->palette_size) return false;
+        memcpy(pixels + xi * viewer->header.pixel_bytes, &viewer->palette[units[xi]], viewer->header.pixel_bytes);
+    }
+    return true;
+}
+
+static bool apply_frame(Viewer* viewer, const DeltaFrameHeader& header, size_t length)
+{
+    const uint8_t* data = viewer->payload;
+    size_t palette_bytes = header.palette_added * sizeof(uint32_t);
+    if(palette_bytes > length || viewer->palette_size + header.palette_added > DELTA_MAX_PALETTE) return false;
+    memcpy(viewer->palette + viewer->palette_size, data, palette_bytes);
+    viewer->palette_size += header.palette_added;
+
+    size_t offset = palette_bytes;
+    for(size_t ri = 0; ri < header.rows; ++ri)
+    {
+        uint16_t fields[2];
+        if(offset + sizeof(fields) > length) return false;
+        memcpy(fields, data + offset, sizeof(fields));
+        offset += sizeof(fields);
+        if(fields[0] >= viewer->header.height || offset + fields[1] > length) return false;
+        if(!apply_row(viewer, (header.flags & DELTA_FRAME_INDEXED) != 0, fields[0], data + offset, fields[1])) return false;
+        offset += fields[1];
+    }
+    return offset == length;
+}
+
+// False unless 'text' is all digits naming a port from 1 to 65535
+static bool parse_port(const char* text, uint16_t* port)
+{
+    if(*text < '0' || *text > '9') return false;
+    char* end = 0;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 10);
+    if(*end || errno || value < 1 || value > 65535) return false;
+    *port = (uint16_t)value;
+    return true;
+}
+
+static int accept_stream(uint16_t port)
+{
+    int server = socket(AF_INET6, SOCK_STREAM, 0);
+    if(server < 0) return -1;
+    int on = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    int off = 0;
+    setsockopt(server, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    sockaddr_in6 address = {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+    int fd = -1;
+    if(bind(server, (sockaddr*)&address, sizeof(address)) == 0 && listen(server, 1) == 0) fd = accept(server, 0, 0);
+    close(server);
+    return fd;
+}
+
+int main(int argc, char** argv)
+{
+    bool from_stdin = argc == 2 && !strcmp(argv[1], "-");
+    uint16_t port = 0;
+    if(argc != 2 || (!from_stdin && !parse_port(argv[1], &port)))
+    {
+        fprintf(stderr, "Usage: %s PORT|-\n", argv[0]);
+        return 1;
+    }
+    int fd = from_stdin ? 0 : accept_stream(port);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Could not listen on port %s.\n", argv[1]);
+        return 1;
+    }
+
+    Viewer viewer = {};
+    DeltaStreamHeader& header = viewer.header;
+    if(!read_bytes(fd, &header, sizeof(header)) || header.magic != DELTA_STREAM_MAGIC || header.version != DELTA_STREAM_VERSION ||
+       !header.pixel_bytes || header.pixel_bytes > sizeof(uint32_t))
+    {
+        fprintf(stderr, "Not a delta frame stream.\n");
+        return 1;
+    }
+    fprintf(stderr, "Receiving %ux%u frames of %u bytes per pixel\n", header.width, header.height, header.pixel_bytes);
+
+    viewer.row_bytes = (size_t)header.width * header.pixel_bytes;
+    size_t frame_bytes = viewer.row_bytes * header.height;
+    viewer.frame = new uint8_t[frame_bytes]();
+    viewer.indices = new uint8_t[(size_t)header.width * header.height]();
+    viewer.palette_size = 1;
+
+    size_t frames = 0;
+    bool ok = true;
+    DeltaFrameHeader frame;
+    while(ok && read_bytes(fd, &frame, sizeof(frame)))
+    {
+        size_t length = frame.size - (sizeof(frame) - sizeof(frame.size));
+        if(frame.size < sizeof(frame) - sizeof(frame.size)) ok = false;
+        else if(length > viewer.capacity)
+        {
+            delete[] viewer.payload;
+            viewer.capacity = length;
+            viewer.payload = new uint8_t[length];
+        }
+        ok = ok && read_bytes(fd, viewer.payload, length) && apply_frame(&viewer, frame, length);
+        ok = ok && fwrite(viewer.frame, 1, frame_bytes, stdout) == frame_bytes;
+        if(ok) ++frames;
+    }
+    fflush(stdout);
+    if(!ok) fprintf(stderr, "Frame %zu is damaged or could not be written.\n", frames + 1);
+    fprintf(stderr, "Decoded %zu frames\n", frames);
+
+    delete[] viewer.payload;
+    delete[] viewer.indices;
+    delete[] viewer.frame;
+    if(fd) close(fd);
+    return ok ? 0 : 1;
+}
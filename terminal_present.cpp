@@ -0,0 +1,386 @@
+#include <cstdio>
+#include <cstring>
+#include "terminal_present.h"
+
+#if defined(_WIN32)
+#define TERMINAL_USE_POSIX 0
+#else
+#define TERMINAL_USE_POSIX 1
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#if TERMINAL_USE_POSIX
+
+// Worst case for one cell: a cursor move, both colors and a half block
+#define TERMINAL_CELL_BYTES 64
+// The clear and the hidden cursor a repaint starts with
+#define TERMINAL_REPAINT_BYTES 32
+// No cell shows this, colors are 24-bit
+#define TERMINAL_NO_COLOR 0xFFFFFFFFu
+#define TERMINAL_FINISH_TIMEOUT_MS 100
+
+static const int terminal_signals[] = {SIGWINCH, SIGINT, SIGTERM, SIGHUP};
+#define TERMINAL_NUM_SIGNALS (sizeof(terminal_signals) / sizeof(terminal_signals[0]))
+
+static volatile sig_atomic_t terminal_resized;
+static volatile sig_atomic_t terminal_quit;
+
+struct TerminalPresenter
+{
+    int fd;
+    termios saved_termios;
+    struct sigaction saved_actions[TERMINAL_NUM_SIGNALS];
+
+    uint32_t width, height;
+    // Source pixels on each side of a box, and the boxes of the frame,
+    // two to a cell vertically
+    uint32_t box;
+    uint32_t grid_width, grid_height;
+    // Cells the frame takes, and where it starts on the terminal
+    uint32_t view_rows;
+    uint32_t left, top;
+
+    // 0xRRGGBB for every box, top row first, an even number of rows
+    uint32_t* pixels;
+    // Top color in the high half, bottom in the low, as the terminal has
+    // each cell
+    uint64_t* shown;
+    // The next copy samples every box, the next frame clears and writes
+    // every cell
+    bool resample;
+    bool repaint;
+    // Colors the terminal draws with after the last write
+    uint32_t fg, bg;
+
+    char* out;
+    size_t out_capacity, out_length, out_sent;
+    // The terminal went away, say the SSH session closed
+    bool lost;
+    bool closed;
+
+    uint64_t frames, skipped, bytes;
+};
+
+static void terminal_signal(int signal)
+{
+    if(signal == SIGWINCH) terminal_resized = 1;
+    else terminal_quit = 1;
+}
+
+// Fits the frame into the terminal as it is now, in whole boxes
+static void lay_out_terminal(TerminalPresenter* term)
+{
+    winsize size = {};
+    if(ioctl(term->fd, TIOCGWINSZ, &size) != 0 || !size.ws_col || !size.ws_row)
+    {
+        size.ws_col = 80;
+        size.ws_row = 24;
+    }
+    uint32_t cols = size.ws_col, rows = size.ws_row;
+    uint32_t across = (term->width + cols - 1) / cols;
+    uint32_t down = (term->height + 2 * rows - 1) / (2 * rows);
+    term->box = across > down ? across : down;
+    if(!term->box) term->box = 1;
+    term->grid_width = (term->width + term->box - 1) / term->box;
+    term->grid_height = (term->height + term->box - 1) / term->box;
+    term->view_rows = (term->grid_height + 1) / 2;
+    term->left = cols > term->grid_width ? (cols - term->grid_width) / 2 : 0;
+    term->top = rows > term->view_rows ? (rows - term->view_rows) / 2 : 0;
+
+    size_t cells = (size_t)term->grid_width * term->view_rows;
+    delete[] term->pixels;
+    delete[] term->shown;
+    delete[] term->out;
+    term->pixels = new uint32_t[2 * cells]();
+    term->shown = new uint64_t[cells];
+    term->out_capacity = cells * TERMINAL_CELL_BYTES + TERMINAL_REPAINT_BYTES;
+    term->out = new char[term->out_capacity];
+    term->out_length = term->out_sent = 0;
+    term->resample = true;
+    term->repaint = true;
+}
+
+// Sends as much of the pending output as the terminal takes without
+// blocking, returning whether all of it went
+static bool flush_terminal(TerminalPresenter* term)
+{
+    while(term->out_sent < term->out_length)
+    {
+        ssize_t written = write(term->fd, term->out + term->out_sent, term->out_length - term->out_sent);
+        if(written > 0)
+        {
+            term->out_sent += (size_t)written;
+            continue;
+        }
+        if(written < 0 && errno == EINTR) continue;
+        if(written < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            term->lost = true;
+            break;
+        }
+        return false;
+    }
+    term->out_length = term->out_sent = 0;
+    return true;
+}
+
+TerminalPresenter* create_terminal_presenter(uint32_t width, uint32_t height)
+{
+    // An open file description of its own, so not blocking on it leaves
+    // stdout alone
+    int fd = open("/dev/tty", O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0)
+    {
+        fprintf(stderr, "No terminal to draw on: %s\n", strerror(errno));
+        return 0;
+    }
+    TerminalPresenter* term = new TerminalPresenter{};
+    term->fd = fd;
+    term->width = width;
+    term->height = height;
+
+    // Keys typed at the terminal would echo over the frame
+    tcgetattr(fd, &term->saved_termios);
+    termios quiet = term->saved_termios;
+    quiet.c_lflag &= ~(ECHO | ICANON);
+    tcsetattr(fd, TCSANOW, &quiet);
+
+    terminal_resized = terminal_quit = 0;
+    struct sigaction action = {};
+    action.sa_handler = terminal_signal;
+    sigemptyset(&action.sa_mask);
+    for(size_t si = 0; si < TERMINAL_NUM_SIGNALS; ++si) sigaction(terminal_signals[si], &action, &term->saved_actions[si]);
+
+    lay_out_terminal(term);
+    printf("Terminal: %ux%u cells, %u pixel boxes\n", term->grid_width, term->view_rows, term->box);
+    return term;
+}
+
+void close_terminal_view(TerminalPresenter* term)
+{
+    if(term->closed) return;
+    finish_terminal_frames(term);
+    fcntl(term->fd, F_SETFL, fcntl(term->fd, F_GETFL) & ~O_NONBLOCK);
+    char text[64];
+    int length = snprintf(text, sizeof(text), "\033[0m\033[?25h\033[%u;1H\n", term->top + term->view_rows + 1);
+    if(!term->lost && write(term->fd, text, (size_t)length) < 0) term->lost = true;
+    tcflush(term->fd, TCIFLUSH);
+    tcsetattr(term->fd, TCSANOW, &term->saved_termios);
+    for(size_t si = 0; si < TERMINAL_NUM_SIGNALS; ++si) sigaction(terminal_signals[si], &term->saved_actions[si], 0);
+    term->closed = true;
+}
+
+void destroy_terminal_presenter(TerminalPresenter* term)
+{
+    close_terminal_view(term);
+    close(term->fd);
+    delete[] term->pixels;
+    delete[] term->shown;
+    delete[] term->out;
+    delete term;
+}
+
+// The mean color of the box, so a shot narrower than a box still tints
+// its cell
+static uint32_t sample_box(const TerminalPresenter* term, const uint32_t* pixels, uint32_t bx, uint32_t by)
+{
+    uint32_t x0 = bx * term->box, x1 = x0 + term->box;
+    uint32_t y0 = by * term->box, y1 = y0 + term->box;
+    if(x1 > term->width) x1 = term->width;
+    if(y1 > term->height) y1 = term->height;
+    uint32_t r = 0, g = 0, b = 0;
+    for(uint32_t yi = y0; yi < y1; ++yi)
+    {
+        // The Buffer is bottom row first
+        const uint32_t* row = pixels + (size_t)(term->height - 1 - yi) * term->width;
+        for(uint32_t xi = x0; xi < x1; ++xi)
+        {
+            uint32_t pixel = row[xi];
+            r += (pixel >> 16) & 0xFF;
+            g += (pixel >> 8) & 0xFF;
+            b += pixel & 0xFF;
+        }
+    }
+    uint32_t count = (x1 - x0) * (y1 - y0);
+    return (r / count) << 16 | (g / count) << 8 | b / count;
+}
+
+static void sample_rect(TerminalPresenter* term, const uint32_t* pixels, const Rect& r)
+{
+    if(!r.width || !r.height) return;
+    // Rows top first
+    uint32_t top = term->height - (uint32_t)(r.y + r.height), bottom = term->height - 1 - (uint32_t)r.y;
+    for(uint32_t by = top / term->box; by <= bottom / term->box; ++by)
+    {
+        for(uint32_t bx = (uint32_t)r.x / term->box; bx <= (uint32_t)(r.x + r.width - 1) / term->box; ++bx)
+        {
+            term->pixels[(size_t)by * term->grid_width + bx] = sample_box(term, pixels, bx, by);
+        }
+    }
+}
+
+void copy_terminal_rects(TerminalPresenter* term, const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    // Laid out again only once nothing of the old layout is left to send
+    if(terminal_resized && term->out_sent == term->out_length)
+    {
+        terminal_resized = 0;
+        lay_out_terminal(term);
+    }
+    const uint32_t* pixels = reinterpret_cast<const uint32_t*>(buffer_pixels(buffer));
+    if(term->resample)
+    {
+        Rect whole = {0, 0, term->width, term->height};
+        sample_rect(term, pixels, whole);
+        term->resample = false;
+        return;
+    }
+    for(size_t i = 0; i < num_rects; ++i) sample_rect(term, pixels, rects[i]);
+}
+
+static void append_text(TerminalPresenter* term, const char* text, size_t length)
+{
+    memcpy(term->out + term->out_length, text, length);
+    term->out_length += length;
+}
+
+// One SGR for whichever of the two colors changes
+static void set_terminal_colors(TerminalPresenter* term, uint32_t fg, uint32_t bg)
+{
+    if(fg == term->fg && bg == term->bg) return;
+    char* out = term->out + term->out_length;
+    int length = 0;
+    if(fg != term->fg && bg != term->bg)
+    {
+        length = sprintf(
+            out, "\033[38;2;%u;%u;%u;48;2;%u;%u;%um", fg >> 16, (fg >> 8) & 0xFF, fg & 0xFF, bg >> 16, (bg >> 8) & 0xFF, bg & 0xFF
+        );
+    }
+    else if(fg != term->fg) length = sprintf(out, "\033[38;2;%u;%u;%um", fg >> 16, (fg >> 8) & 0xFF, fg & 0xFF);
+    else length = sprintf(out, "\033[48;2;%u;%u;%um", bg >> 16, (bg >> 8) & 0xFF, bg & 0xFF);
+    term->out_length += (size_t)length;
+    term->fg = fg;
+    term->bg = bg;
+}
+
+// Every cell that differs from what the terminal shows
+static void compose_terminal_frame(TerminalPresenter* term)
+{
+    size_t cells = (size_t)term->grid_width * term->view_rows;
+    if(term->repaint)
+    {
+        static const char clear[] = "\033[0m\033[2J\033[?25l";
+        append_text(term, clear, sizeof(clear) - 1);
+        for(size_t ci = 0; ci < cells; ++ci) term->shown[ci] = ~(uint64_t)0;
+        term->fg = term->bg = TERMINAL_NO_COLOR;
+        term->repaint = false;
+    }
+
+    // Whatever else wrote to the terminal may have moved the cursor
+    uint32_t cursor_row = UINT32_MAX, cursor_col = UINT32_MAX;
+    for(uint32_t row = 0; row < term->view_rows; ++row)
+    {
+        const uint32_t* upper = term->pixels + (size_t)2 * row * term->grid_width;
+        const uint32_t* lower = upper + term->grid_width;
+        uint64_t* shown = term->shown + (size_t)row * term->grid_width;
+        for(uint32_t col = 0; col < term->grid_width; ++col)
+        {
+            uint64_t cell = (uint64_t)upper[col] << 32 | lower[col];
+            if(shown[col] == cell) continue;
+            shown[col] = cell;
+
+            if(row != cursor_row || col != cursor_col)
+            {
+                term->out_length += (size_t)sprintf(term->out + term->out_length, "\033[%u;%uH", term->top + row + 1, term->left + col + 1);
+            }
+            if(upper[col] == lower[col])
+            {
+                // A space shows the background alone
+                set_terminal_colors(term, term->fg, upper[col]);
+                append_text(term, " ", 1);
+            }
+            else
+            {
+                // An upper or a lower half block, whichever needs fewer
+                // colors changed
+                int upper_changes = (term->fg != upper[col]) + (term->bg != lower[col]);
+                int lower_changes = (term->fg != lower[col]) + (term->bg != upper[col]);
+                if(lower_changes < upper_changes)
+                {
+                    set_terminal_colors(term, lower[col], upper[col]);
+                    append_text(term, "\xE2\x96\x84", 3);
+                }
+                else
+                {
+                    set_terminal_colors(term, upper[col], lower[col]);
+                    append_text(term, "\xE2\x96\x80", 3);
+                }
+            }
+            cursor_row = row;
+            cursor_col = col + 1;
+        }
+    }
+}
+
+void present_terminal_frame(TerminalPresenter* term)
+{
+    if(term->lost || term->closed) return;
+    if(!flush_terminal(term))
+    {
+        ++term->skipped;
+        return;
+    }
+    compose_terminal_frame(term);
+    term->bytes += term->out_length;
+    ++term->frames;
+    flush_terminal(term);
+}
+
+void finish_terminal_frames(TerminalPresenter* term)
+{
+    while(!term->lost && !flush_terminal(term))
+    {
+        pollfd fd = {term->fd, POLLOUT, 0};
+        if(poll(&fd, 1, TERMINAL_FINISH_TIMEOUT_MS) <= 0) break;
+    }
+}
+
+bool terminal_interrupted(TerminalPresenter* term)
+{
+    return terminal_quit || term->lost;
+}
+
+void print_terminal_stats(const TerminalPresenter* term)
+{
+    printf(
+        "Terminal: %llu frames written, %llu skipped while the link was behind, %.2f KiB a frame\n",
+        (unsigned long long)term->frames, (unsigned long long)term->skipped,
+        term->frames ? term->bytes / 1024.0 / term->frames : 0.0
+    );
+}
+
+#else
+
+struct TerminalPresenter {};
+
+TerminalPresenter* create_terminal_presenter(uint32_t, uint32_t)
+{
+    fprintf(stderr, "The terminal backend needs a POSIX terminal.\n");
+    return 0;
+}
+
+void destroy_terminal_presenter(TerminalPresenter* term) { delete term; }
+void close_terminal_view(TerminalPresenter*) {}
+void copy_terminal_rects(TerminalPresenter*, const Buffer&, const Rect*, size_t) {}
+void present_terminal_frame(TerminalPresenter*) {}
+void finish_terminal_frames(TerminalPresenter*) {}
+bool terminal_interrupted(TerminalPresenter*) { return false; }
+void print_terminal_stats(const TerminalPresenter*) {}
+
+#endif
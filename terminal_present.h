@@ -0,0 +1,61 @@
+#ifndef TERMINAL_PRESENT_H
+#define TERMINAL_PRESENT_H
+
+/*
+    ANSI terminal backend for looking at a cabinet over SSH. The frame is
+    drawn with upper half blocks in 24-bit color, each character cell two
+    pixels tall: the foreground colors the top one and the background the
+    bottom one. The Buffer is boxed down to fit the terminal, each box
+    the mean of the pixels under it, so a shot narrower than a box still
+    tints its cell. Only the boxes under changed rectangles are sampled
+    again.
+
+    Each frame writes nothing but the cells that differ from what the
+    terminal shows, with a cursor move only where the changed cells
+    aren't contiguous and a color only where it changes. Writes don't
+    block: while the last frame is still on its way out, a slow link
+    skips frames rather than stalling the game, and the next one that
+    goes out carries every change since. The terminal has no vblank, the
+    pacer's own deadline paces it.
+
+    Frames go to the controlling terminal, /dev/tty, so log lines printed
+    while running draw over the view until the cells under them change;
+    redirect stdout to keep it clean. A resize redraws everything. POSIX
+    only; create_terminal_presenter() returns 0 anywhere else.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "render.h"
+
+// Paces the terminal unless --fps asks otherwise, plenty for a look at
+// the game and kind to slow links
+#define TERMINAL_DEFAULT_FPS 30.0
+
+struct TerminalPresenter;
+
+// Pixels are PIXEL_BGRA8888_REV. Returns 0 without a terminal to draw on.
+TerminalPresenter* create_terminal_presenter(uint32_t width, uint32_t height);
+// Closes the view if it is still open
+void destroy_terminal_presenter(TerminalPresenter* term);
+
+// Sends what is left, puts the cursor below the frame and the terminal
+// back as it was. Nothing is drawn after.
+void close_terminal_view(TerminalPresenter* term);
+
+// Samples the boxes under 'rects' of 'buffer' again
+void copy_terminal_rects(TerminalPresenter* term, const Buffer& buffer, const Rect* rects, size_t num_rects);
+
+// Writes the cells that changed, unless the last frame is still being sent
+void present_terminal_frame(TerminalPresenter* term);
+
+// Blocks until everything written has gone out
+void finish_terminal_frames(TerminalPresenter* term);
+
+// Ctrl-C or a hangup asked the game to quit
+bool terminal_interrupted(TerminalPresenter* term);
+
+// One line: frames written and skipped, and the bytes they took
+void print_terminal_stats(const TerminalPresenter* term);
+
+#endif
@@ -0,0 +1,376 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include "threads.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#include <avrt.h>
+#endif
+
+const char* thread_role_names[NUM_THREAD_ROLES] = {"game", "render", "upload", "input", "audio", "worker", "background"};
+const char* thread_priority_names[NUM_THREAD_PRIORITIES] = {"default", "low", "high", "realtime"};
+
+/*
+################################################
+##                  POLICIES                  ##
+################################################
+*/
+
+static uint64_t cpu_bit(size_t cpu)
+{
+    return cpu < THREAD_MAX_CPUS ? 1ull << cpu : 0;
+}
+
+void cabinet_thread_policy(ThreadPolicy* policy, size_t num_cpus, bool render_thread)
+{
+    *policy = ThreadPolicy{};
+    if(num_cpus > THREAD_MAX_CPUS) num_cpus = THREAD_MAX_CPUS;
+    if(num_cpus >= 2)
+    {
+        uint64_t all = num_cpus == THREAD_MAX_CPUS ? ~0ull : cpu_bit(num_cpus) - 1;
+        size_t render_cpu = render_thread ? 1 : 0;
+        policy->roles[THREAD_GAME].cpus = cpu_bit(0);
+        if(render_thread) policy->roles[THREAD_RENDER].cpus = cpu_bit(render_cpu);
+        policy->roles[THREAD_WORKER].cpus = all & ~cpu_bit(render_cpu);
+        // Two CPUs with a render thread leave the background nowhere else
+        uint64_t background = all & ~cpu_bit(0) & ~cpu_bit(render_cpu);
+        policy->roles[THREAD_BACKGROUND].cpus = background;
+    }
+    policy->roles[THREAD_GAME].priority = PRIORITY_HIGH;
+    policy->roles[THREAD_RENDER].priority = PRIORITY_HIGH;
+    policy->roles[THREAD_INPUT].priority = PRIORITY_REALTIME;
+    policy->roles[THREAD_AUDIO].priority = PRIORITY_REALTIME;
+    policy->roles[THREAD_BACKGROUND].priority = PRIORITY_LOW;
+    policy->cpus_given = policy->priority_given = (1u << NUM_THREAD_ROLES) - 1;
+}
+
+// The role before the '=' of 'text', or NUM_THREAD_ROLES
+static ThreadRole parse_thread_role(const char* text, const char** value)
+{
+    const char* equals = strchr(text, '=');
+    if(equals)
+    {
+        for(size_t ri = 0; ri < NUM_THREAD_ROLES; ++ri)
+        {
+            size_t length = strlen(thread_role_names[ri]);
+            if(length == (size_t)(equals - text) && !strncmp(text, thread_role_names[ri], length))
+            {
+                *value = equals + 1;
+                return (ThreadRole)ri;
+            }
+        }
+    }
+    fprintf(stderr, "Unknown thread role in '%s', expected game, render, upload, input, audio, worker or background.\n", text);
+    return NUM_THREAD_ROLES;
+}
+
+bool parse_thread_pin(ThreadPolicy* policy, const char* text)
+{
+    const char* list = 0;
+    ThreadRole role = parse_thread_role(text, &list);
+    if(role == NUM_THREAD_ROLES) return false;
+
+    uint64_t cpus = 0;
+    for(const char* cursor = list;;)
+    {
+        char* end = 0;
+        unsigned long first = strtoul(cursor, &end, 10), last = first;
+        if(end == cursor) break;
+        if(*end == '-')
+        {
+            cursor = end + 1;
+            last = strtoul(cursor, &end, 10);
+            if(end == cursor) break;
+        }
+        if(first > last || last >= THREAD_MAX_CPUS)
+        {
+            fprintf(stderr, "CPUs in '%s' must be below %d and ranges ascending.\n", text, THREAD_MAX_CPUS);
+            return false;
+        }
+        for(unsigned long cpu = first; cpu <= last; ++cpu) cpus |= cpu_bit(cpu);
+
+        if(!*end)
+        {
+            policy->roles[role].cpus = cpus;
+            policy->cpus_given |= 1u << role;
+            return true;
+        }
+        if(*end != ',') break;
+        cursor = end + 1;
+    }
+    fprintf(stderr, "Unknown CPU list in '%s', expected ROLE=CPUS like worker=2-7 or render=1.\n", text);
+    return false;
+}
+
+bool parse_thread_priority(ThreadPolicy* policy, const char* text)
+{
+    const char* name = 0;
+    ThreadRole role = parse_thread_role(text, &name);
+    if(role == NUM_THREAD_ROLES) return false;
+
+    for(size_t pi = 0; pi < NUM_THREAD_PRIORITIES; ++pi)
+    {
+        if(strcmp(name, thread_priority_names[pi])) continue;
+        policy->roles[role].priority = (ThreadPriority)pi;
+        policy->priority_given |= 1u << role;
+        return true;
+    }
+    fprintf(stderr, "Unknown priority in '%s', expected default, low, high or realtime.\n", text);
+    return false;
+}
+
+void merge_thread_policy(ThreadPolicy* policy, const ThreadPolicy& overrides)
+{
+    for(size_t ri = 0; ri < NUM_THREAD_ROLES; ++ri)
+    {
+        if(overrides.cpus_given & (1u << ri)) policy->roles[ri].cpus = overrides.roles[ri].cpus;
+        if(overrides.priority_given & (1u << ri)) policy->roles[ri].priority = overrides.roles[ri].priority;
+    }
+    policy->cpus_given |= overrides.cpus_given;
+    policy->priority_given |= overrides.priority_given;
+}
+
+bool thread_policy_empty(const ThreadPolicy& policy)
+{
+    return !policy.cpus_given && !policy.priority_given;
+}
+
+// "0,2-7"
+static void format_cpus(uint64_t cpus, char* text, size_t size)
+{
+    size_t length = 0;
+    text[0] = '\0';
+    for(size_t cpu = 0; cpu < THREAD_MAX_CPUS && length < size; ++cpu)
+    {
+        if(!(cpus & cpu_bit(cpu))) continue;
+        size_t last = cpu;
+        while(last + 1 < THREAD_MAX_CPUS && (cpus & cpu_bit(last + 1))) ++last;
+        int written = last == cpu ? snprintf(text + length, size - length, "%s%zu", length ? "," : "", cpu)
+                                  : snprintf(text + length, size - length, "%s%zu-%zu", length ? "," : "", cpu, last);
+        if(written < 0 || (size_t)written >= size - length) break;
+        length += (size_t)written;
+        cpu = last;
+    }
+}
+
+/*
+################################################
+##                 PLACEMENT                  ##
+################################################
+*/
+
+struct ThreadRoleResult
+{
+    std::atomic<uint32_t> threads;
+    // Written by the role's first thread only
+    ThreadPriority priority;
+    bool pinned;
+    // What the first failing call returned, 0 when nothing did
+    int error;
+};
+
+static ThreadPolicy thread_policy;
+static std::atomic<bool> thread_policy_set(false);
+static ThreadRoleResult thread_results[NUM_THREAD_ROLES];
+
+#if defined(__linux__)
+
+// What the process was started on, which "any CPU" means
+static cpu_set_t process_cpus;
+
+static void capture_process_cpus()
+{
+    if(sched_getaffinity(0, sizeof(process_cpus), &process_cpus) != 0)
+    {
+        CPU_ZERO(&process_cpus);
+        for(size_t cpu = 0; cpu < std::thread::hardware_concurrency() && cpu < CPU_SETSIZE; ++cpu) CPU_SET(cpu, &process_cpus);
+    }
+}
+
+static int set_thread_cpus(uint64_t cpus)
+{
+    cpu_set_t set = process_cpus;
+    if(cpus)
+    {
+        CPU_ZERO(&set);
+        for(size_t cpu = 0; cpu < THREAD_MAX_CPUS; ++cpu)
+        {
+            if(cpus & cpu_bit(cpu)) CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Nice values are per thread on Linux, keyed by its tid
+static int set_thread_nice(int nice)
+{
+    return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) == 0 ? 0 : errno;
+}
+
+static ThreadPriority set_thread_priority(ThreadPriority priority, int* error)
+{
+    sched_param param = {};
+    if(priority == PRIORITY_REALTIME)
+    {
+        param.sched_priority = THREAD_REALTIME_PRIORITY;
+        *error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(!*error) return PRIORITY_REALTIME;
+        priority = PRIORITY_HIGH;
+    }
+    else
+    {
+        // Undoes whatever the creating thread passed on
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+
+    int nice = priority == PRIORITY_HIGH ? THREAD_HIGH_NICE : priority == PRIORITY_LOW ? THREAD_LOW_NICE : 0;
+    int nice_error = set_thread_nice(nice);
+    if(!*error) *error = nice_error;
+    if(!nice_error) return priority;
+    // Lowering the nice of a thread is always allowed
+    set_thread_nice(0);
+    return PRIORITY_DEFAULT;
+}
+
+#elif defined(_WIN32)
+
+static void capture_process_cpus() {}
+
+static int set_thread_cpus(uint64_t cpus)
+{
+    DWORD_PTR process = 0, system = 0;
+    if(!cpus && GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) cpus = process;
+    if(!cpus) return 0;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)cpus) ? 0 : (int)GetLastError();
+}
+
+// MMCSS boosts a registered thread over everything but its own service
+static ThreadPriority set_thread_priority(ThreadPriority priority, int* error)
+{
+    if(priority == PRIORITY_REALTIME || priority == PRIORITY_HIGH)
+    {
+        DWORD task = 0;
+        HANDLE mmcss = AvSetMmThreadCharacteristicsW(priority == PRIORITY_REALTIME ? L"Pro Audio" : L"Games", &task);
+        if(mmcss && (priority == PRIORITY_HIGH || AvSetMmThreadPriority(mmcss, AVRT_PRIORITY_HIGH))) return priority;
+        if(!*error) *error = (int)GetLastError();
+    }
+
+    int level = priority == PRIORITY_REALTIME ? THREAD_PRIORITY_TIME_CRITICAL :
+                priority == PRIORITY_HIGH ? THREAD_PRIORITY_HIGHEST :
+                priority == PRIORITY_LOW ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL;
+    if(SetThreadPriority(GetCurrentThread(), level)) return priority;
+    if(!*error) *error = (int)GetLastError();
+    return PRIORITY_DEFAULT;
+}
+
+#else
+
+static void capture_process_cpus() {}
+static int set_thread_cpus(uint64_t) { return ENOSYS; }
+
+static ThreadPriority set_thread_priority(ThreadPriority, int* error)
+{
+    *error = ENOSYS;
+    return PRIORITY_DEFAULT;
+}
+
+#endif
+
+void set_thread_policy(const ThreadPolicy& policy)
+{
+    capture_process_cpus();
+    thread_policy = policy;
+    thread_policy_set.store(true, std::memory_order_release);
+}
+
+void enter_thread_role(ThreadRole role)
+{
+    if(!thread_policy_set.load(std::memory_order_acquire)) return;
+
+    const ThreadRolePolicy& wanted = thread_policy.roles[role];
+    int error = set_thread_cpus(wanted.cpus);
+    bool pinned = wanted.cpus && !error;
+    ThreadPriority priority = set_thread_priority(wanted.priority, &error);
+
+    ThreadRoleResult& result = thread_results[role];
+    if(result.threads.fetch_add(1) == 0)
+    {
+        result.priority = priority;
+        result.pinned = pinned;
+        result.error = error;
+    }
+}
+
+void print_thread_policy()
+{
+    if(!thread_policy_set.load(std::memory_order_acquire)) return;
+
+    printf("Thread policy:\n");
+    for(size_t ri = 0; ri < NUM_THREAD_ROLES; ++ri)
+    {
+        const ThreadRoleResult& result = thread_results[ri];
+        uint32_t threads = result.threads.load();
+        if(!threads) continue;
+
+        const ThreadRolePolicy& wanted = thread_policy.roles[ri];
+        char cpus[128];
+        format_cpus(wanted.cpus, cpus, sizeof(cpus));
+        char got[160] = "";
+        if(wanted.cpus && !result.pinned) snprintf(got, sizeof(got), ", not pinned");
+        if(result.priority != wanted.priority)
+        {
+            size_t length = strlen(got);
+            snprintf(got + length, sizeof(got) - length, ", got %s", thread_priority_names[result.priority]);
+        }
+        if(result.error && got[0])
+        {
+            size_t length = strlen(got);
+#if defined(_WIN32)
+            snprintf(got + length, sizeof(got) - length, " (error %d)", result.error);
+#else
+            snprintf(got + length, sizeof(got) - length, " (%s)", strerror(result.error));
+#endif
+        }
+        printf(
+            "  %-10s x%-2u on CPUs %s, %s%s\n",
+            thread_role_names[ri], threads, wanted.cpus ? cpus : "any", thread_priority_names[wanted.priority], got
+        );
+    }
+}
+
+void describe_thread_policy(char* text, size_t size)
+{
+    size_t length = 0;
+    text[0] = '\0';
+    const ThreadPolicy& policy = thread_policy;
+    for(size_t ri = 0; thread_policy_set.load(std::memory_order_acquire) && ri < NUM_THREAD_ROLES && length < size; ++ri)
+    {
+        const ThreadRolePolicy& role = policy.roles[ri];
+        if(!role.cpus && role.priority == PRIORITY_DEFAULT) continue;
+
+        char cpus[128] = "";
+        if(role.cpus)
+        {
+            cpus[0] = '@';
+            format_cpus(role.cpus, cpus + 1, sizeof(cpus) - 1);
+        }
+        int written = snprintf(
+            text + length, size - length, "%s%s%s%s%s", length ? " " : "", thread_role_names[ri], cpus,
+            role.priority != PRIORITY_DEFAULT ? ":" : "", role.priority != PRIORITY_DEFAULT ? thread_priority_names[role.priority] : ""
+        );
+        if(written < 0 || (size_t)written >= size - length) break;
+        length += (size_t)written;
+    }
+    if(!length) snprintf(text, size, "none");
+}
@@ -0,0 +1,100 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+/*
+    Thread roles and the policy that places them. Every thread the game
+    starts names its role first thing, and the installed policy decides
+    which CPUs the role runs on and at what priority. Nothing is touched
+    until a policy is set, so by default the OS schedules as it likes.
+
+    Once a policy is set every role is placed, the ones it says nothing
+    about on any CPU at default priority, since threads otherwise inherit
+    the pinned game thread's placement. The cabinet preset keeps the game
+    thread on CPU 0 and a render thread on CPU 1, with job workers on
+    every CPU but the one that renders and the background writers on
+    neither. Audio and evdev input, which block until they have something
+    to do and then must do it now, run at real-time priority, the game
+    and render threads high and the background low.
+
+    On Linux real-time is SCHED_FIFO and affinity pthread_setaffinity_np;
+    high and low are a nice value on the thread alone. Without the
+    privilege for SCHED_FIFO (CAP_SYS_NICE or an RLIMIT_RTPRIO) a thread
+    falls back to high, and without the one for a negative nice stays as
+    it was. On Windows high and real-time register the thread with MMCSS
+    as a "Games" or "Pro Audio" task. Elsewhere policies are only
+    reported. What the first thread of each role got is printed at exit.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+// Affinity masks cover this many CPUs
+#define THREAD_MAX_CPUS 64
+// SCHED_FIFO priority of real-time threads: above every normal thread,
+// below the kernel's interrupt threads at 50
+#define THREAD_REALTIME_PRIORITY 10
+#define THREAD_HIGH_NICE -10
+#define THREAD_LOW_NICE 10
+
+enum ThreadRole: uint8_t
+{
+    // Simulation, input pumping and, without --render-thread, rendering
+    THREAD_GAME,
+    THREAD_RENDER,
+    THREAD_UPLOAD,
+    THREAD_INPUT,
+    THREAD_AUDIO,
+    THREAD_WORKER,
+    // Capture, stream and score writers, metrics, hot reload, prefetch
+    THREAD_BACKGROUND,
+    NUM_THREAD_ROLES
+};
+
+enum ThreadPriority: uint8_t
+{
+    // What the OS gives a new process
+    PRIORITY_DEFAULT,
+    PRIORITY_LOW,
+    PRIORITY_HIGH,
+    PRIORITY_REALTIME,
+    NUM_THREAD_PRIORITIES
+};
+
+extern const char* thread_role_names[NUM_THREAD_ROLES];
+extern const char* thread_priority_names[NUM_THREAD_PRIORITIES];
+
+struct ThreadRolePolicy
+{
+    // Bit i for CPU i, 0 for any the process may run on
+    uint64_t cpus;
+    ThreadPriority priority;
+};
+
+struct ThreadPolicy
+{
+    ThreadRolePolicy roles[NUM_THREAD_ROLES];
+    // Bit r when role r's cpus or priority was given, for merging
+    uint32_t cpus_given, priority_given;
+};
+
+// For 'num_cpus' CPUs; with one there is nothing to pin
+void cabinet_thread_policy(ThreadPolicy* policy, size_t num_cpus, bool render_thread);
+// Parse "ROLE=CPUS", CPUS like "0,2-7", and "ROLE=PRIORITY" into
+// 'policy'. False, having said why, on anything else.
+bool parse_thread_pin(ThreadPolicy* policy, const char* text);
+bool parse_thread_priority(ThreadPolicy* policy, const char* text);
+// What 'overrides' sets replaces what 'policy' has
+void merge_thread_policy(ThreadPolicy* policy, const ThreadPolicy& overrides);
+bool thread_policy_empty(const ThreadPolicy& policy);
+
+// Call before starting any thread; those already running keep what they have
+void set_thread_policy(const ThreadPolicy& policy);
+// Places the calling thread as its role says
+void enter_thread_role(ThreadRole role);
+// One line per role a thread entered: what it asked for and what it got
+void print_thread_policy();
+// The policy in one line, e.g. "game@0:high render@1:high audio:realtime",
+// or "none"
+void describe_thread_policy(char* text, size_t size);
+
+#endif
@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <chrono>
+#include "trace.h"
+
+struct TraceBuffer
+{
+    const char* name;
+    // Every event this thread has recorded, only stored by the thread itself
+    std::atomic<uint64_t> count;
+    // What count was when the current trace started
+    uint64_t start;
+    TraceEvent events[TRACE_EVENTS_PER_THREAD];
+};
+
+std::atomic<bool> trace_recording(false);
+
+// Buffers are never freed, so a trace still shows threads that have exited
+static std::atomic<TraceBuffer*> trace_buffers[TRACE_MAX_THREADS];
+static std::atomic<size_t> trace_num_buffers(0);
+static std::atomic<size_t> trace_dropped_threads(0);
+static thread_local TraceBuffer* thread_buffer = 0;
+static thread_local bool thread_without_buffer = false;
+static int64_t trace_epoch_ns = 0;
+
+int64_t trace_now()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+static int claim_trace_buffer(const char* name)
+{
+    size_t slot = trace_num_buffers.fetch_add(1, std::memory_order_relaxed);
+    if(slot >= TRACE_MAX_THREADS)
+    {
+        trace_dropped_threads.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    TraceBuffer* buffer = new TraceBuffer;
+    buffer->name = name;
+    buffer->count = 0;
+    buffer->start = 0;
+    trace_buffers[slot].store(buffer, std::memory_order_release);
+    return (int)slot;
+}
+
+// Claims a slot the first time a thread records or names itself
+static TraceBuffer* get_thread_buffer()
+{
+    if(thread_buffer || thread_without_buffer) return thread_buffer;
+
+    int slot = claim_trace_buffer(0);
+    if(slot < 0)
+    {
+        thread_without_buffer = true;
+        return 0;
+    }
+    thread_buffer = trace_buffers[slot].load(std::memory_order_relaxed);
+    return thread_buffer;
+}
+
+static void push_trace_event(TraceBuffer* buffer, const char* name, int64_t begin_ns, int64_t end_ns)
+{
+    // The ring overwrites its oldest events; the reader skips those
+    uint64_t count = buffer->count.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer->events[count % TRACE_EVENTS_PER_THREAD];
+    event.name = name;
+    event.begin_ns = begin_ns;
+    event.end_ns = end_ns;
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+void record_trace_event(const char* name, int64_t begin_ns, int64_t end_ns)
+{
+    TraceBuffer* buffer = get_thread_buffer();
+    if(buffer) push_trace_event(buffer, name, begin_ns, end_ns);
+}
+
+int open_trace_track(const char* name)
+{
+    return claim_trace_buffer(name);
+}
+
+void record_track_event(int track, const char* name, int64_t begin_ns, int64_t end_ns)
+{
+    if(track < 0) return;
+    TraceBuffer* buffer = trace_buffers[track].load(std::memory_order_acquire);
+    if(buffer) push_trace_event(buffer, name, begin_ns, end_ns);
+}
+
+void name_trace_thread(const char* name)
+{
+    TraceBuffer* buffer = get_thread_buffer();
+    if(buffer) buffer->name = name;
+}
+
+void start_trace()
+{
+    trace_epoch_ns = trace_now();
+    size_t num_buffers = trace_num_buffers.load(std::memory_order_acquire);
+    for(size_t bi = 0; bi < num_buffers && bi < TRACE_MAX_THREADS; ++bi)
+    {
+        TraceBuffer* buffer = trace_buffers[bi].load(std::memory_order_acquire);
+        if(buffer) buffer->start = buffer->count.load(std::memory_order_acquire);
+    }
+    trace_recording.store(true, std::memory_order_relaxed);
+}
+
+void stop_trace()
+{
+    trace_recording.store(false, std::memory_order_relaxed);
+}
+
+// Chrome's JSON trace format: one metadata event naming each thread, then
+// complete ("X") events in microseconds since start_trace()
+bool write_trace(const char* path, TraceStats* stats)
+{
+    *stats = TraceStats{};
+    FILE* file = fopen(path, "w");
+    if(!file) return false;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    size_t num_buffers = trace_num_buffers.load(std::memory_order_acquire);
+    for(size_t bi = 0; bi < num_buffers && bi < TRACE_MAX_THREADS; ++bi)
+    {
+        TraceBuffer* buffer = trace_buffers[bi].load(std::memory_order_acquire);
+        if(!buffer) continue;
+        ++stats->threads;
+        char index_name[32];
+        snprintf(index_name, sizeof(index_name), "thread %zu", bi);
+        fprintf(
+            file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", bi, buffer->name ? buffer->name : index_name
+        );
+        first = false;
+
+        uint64_t end = buffer->count.load(std::memory_order_acquire);
+        uint64_t begin = buffer->start;
+        if(end - begin > TRACE_EVENTS_PER_THREAD)
+        {
+            stats->overwritten += (size_t)(end - begin - TRACE_EVENTS_PER_THREAD);
+            begin = end - TRACE_EVENTS_PER_THREAD;
+        }
+        for(uint64_t ei = begin; ei < end; ++ei)
+        {
+            const TraceEvent& event = buffer->events[ei % TRACE_EVENTS_PER_THREAD];
+            fprintf(
+                file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+                bi, event.name, (event.begin_ns - trace_epoch_ns) / 1e3, (event.end_ns - event.begin_ns) / 1e3
+            );
+            ++stats->events;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    stats->dropped_threads = trace_dropped_threads.load(std::memory_order_relaxed);
+    return fclose(file) == 0;
+}
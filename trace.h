@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+    Trace events. Scoped events land in a ring owned by the thread that
+    records them, written only by that thread and published with one
+    release store, so recording never takes a lock and costs a relaxed
+    load while no trace is running. write_trace() gathers every thread's
+    ring into Chrome trace JSON, which chrome://tracing and
+    ui.perfetto.dev both open with one track per named thread. Building
+    with SPACE_INVADERS_NO_TRACE compiles every TRACE_ macro away.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#define TRACE_EVENTS_PER_THREAD 16384
+#define TRACE_MAX_THREADS 64
+
+// 'name' must outlive the trace, in practice a string literal
+struct TraceEvent
+{
+    const char* name;
+    int64_t begin_ns, end_ns;
+};
+
+extern std::atomic<bool> trace_recording;
+
+int64_t trace_now();
+void record_trace_event(const char* name, int64_t begin_ns, int64_t end_ns);
+// Names the calling thread's track; threads never named show their index
+void name_trace_thread(const char* name);
+// A track of its own for events timed off the CPU, like GPU queries. Only
+// one thread may record on it. Returns -1 once every slot is taken.
+int open_trace_track(const char* name);
+void record_track_event(int track, const char* name, int64_t begin_ns, int64_t end_ns);
+
+struct TraceScope
+{
+    const char* name;
+    int64_t begin_ns;
+
+    explicit TraceScope(const char* scope_name)
+    {
+        name = scope_name;
+        begin_ns = trace_recording.load(std::memory_order_relaxed) ? trace_now() : -1;
+    }
+    ~TraceScope()
+    {
+        if(begin_ns >= 0) record_trace_event(name, begin_ns, trace_now());
+    }
+};
+
+// An event that ended now after 'seconds', for spans timed elsewhere
+inline void record_trace_span(const char* name, double seconds)
+{
+    if(!trace_recording.load(std::memory_order_relaxed)) return;
+    int64_t end_ns = trace_now();
+    record_trace_event(name, end_ns - (int64_t)(seconds * 1e9), end_ns);
+}
+
+struct TraceStats
+{
+    size_t events, threads;
+    // Events overwritten before the trace was written, and threads past
+    // TRACE_MAX_THREADS that could not record at all
+    size_t overwritten, dropped_threads;
+};
+
+// Everything recorded before start_trace() is left out of the next write
+void start_trace();
+void stop_trace();
+bool write_trace(const char* path, TraceStats* stats);
+
+#ifdef SPACE_INVADERS_NO_TRACE
+#define TRACE_ENABLED 0
+#define TRACE_SCOPE(name)
+#define TRACE_SPAN(name, seconds)
+#define TRACE_THREAD(name)
+#else
+#define TRACE_ENABLED 1
+#define TRACE_JOIN(a, b) a##b
+#define TRACE_SCOPE_AT(name, line) TraceScope TRACE_JOIN(trace_scope_, line)(name)
+#define TRACE_SCOPE(name) TRACE_SCOPE_AT(name, __LINE__)
+#define TRACE_SPAN(name, seconds) record_trace_span(name, seconds)
+#define TRACE_THREAD(name) name_trace_thread(name)
+#endif
+
+#endif
@@ -0,0 +1,631 @@
+#include <cstdio>
+#include <cstring>
+#define GLAD_VULKAN_IMPLEMENTATION
+#include <glad/vulkan.h>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include "vulkan_present.h"
+
+#define VULKAN_FRAMES_IN_FLIGHT 2
+#define VULKAN_MAX_IMAGES 8
+#define VULKAN_MAX_REGIONS 64
+
+struct VulkanPresenter
+{
+    GLFWwindow* window;
+    VkInstance instance;
+    VkSurfaceKHR surface;
+    VkPhysicalDevice gpu;
+    VkDevice device;
+    uint32_t queue_family;
+    VkQueue queue;
+
+    VulkanPresentMode requested_mode;
+    bool mode_supported[VULKAN_PRESENT_MAILBOX + 1];
+
+    VkSwapchainKHR swapchain;
+    VkExtent2D extent;
+    uint32_t num_images;
+    VkImage images[VULKAN_MAX_IMAGES];
+    // Signalled when the blit into each image is done, waited on by present
+    VkSemaphore rendered[VULKAN_MAX_IMAGES];
+    bool swapchain_stale;
+
+    // The CPU buffer's pixels and the image they are copied into
+    uint32_t width, height;
+    VkFormat source_format;
+    VkBuffer staging;
+    VkDeviceMemory staging_memory;
+    uint8_t* staging_pixels;
+    VkImage source;
+    VkDeviceMemory source_memory;
+    bool source_initialized;
+    // A frame that was dropped after its rectangles were retired
+    bool full_copy_pending;
+
+    VkCommandPool command_pool;
+    VkCommandBuffer commands[VULKAN_FRAMES_IN_FLIGHT];
+    VkSemaphore acquired[VULKAN_FRAMES_IN_FLIGHT];
+    VkFence fences[VULKAN_FRAMES_IN_FLIGHT];
+    size_t frame;
+    bool submitted[VULKAN_FRAMES_IN_FLIGHT];
+};
+
+const char* vulkan_present_mode_name(VulkanPresentMode mode)
+{
+    switch(mode)
+    {
+        case VULKAN_PRESENT_FIFO:         return "fifo";
+        case VULKAN_PRESENT_FIFO_RELAXED: return "fifo_relaxed";
+        case VULKAN_PRESENT_MAILBOX:      return "mailbox";
+    }
+    return "unknown";
+}
+
+// Emscripten's GLFW has no Vulkan surfaces to create
+#ifndef __EMSCRIPTEN__
+
+static VkPresentModeKHR vk_present_mode(VulkanPresentMode mode)
+{
+    switch(mode)
+    {
+        case VULKAN_PRESENT_FIFO_RELAXED: return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+        case VULKAN_PRESENT_MAILBOX:      return VK_PRESENT_MODE_MAILBOX_KHR;
+        default:                          return VK_PRESENT_MODE_FIFO_KHR;
+    }
+}
+
+static bool find_memory_type(VulkanPresenter* vk, uint32_t type_bits, VkMemoryPropertyFlags flags, uint32_t* type)
+{
+    VkPhysicalDeviceMemoryProperties properties;
+    vkGetPhysicalDeviceMemoryProperties(vk->gpu, &properties);
+    for(uint32_t mi = 0; mi < properties.memoryTypeCount; ++mi)
+    {
+        if((type_bits & (1u << mi)) && (properties.memoryTypes[mi].propertyFlags & flags) == flags)
+        {
+            *type = mi;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool create_instance(VulkanPresenter* vk)
+{
+    uint32_t num_extensions = 0;
+    const char** extensions = glfwGetRequiredInstanceExtensions(&num_extensions);
+    if(!extensions) return false;
+
+    VkApplicationInfo app = {};
+    app.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app.pApplicationName = "Space Invaders";
+    app.apiVersion = VK_API_VERSION_1_0;
+
+    VkInstanceCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    info.pApplicationInfo = &app;
+    info.enabledExtensionCount = num_extensions;
+    info.ppEnabledExtensionNames = extensions;
+    if(vkCreateInstance(&info, 0, &vk->instance) != VK_SUCCESS) return false;
+
+    gladLoadVulkanUserPtr(0, (GLADuserptrloadfunc)glfwGetInstanceProcAddress, vk->instance);
+    return glfwCreateWindowSurface(vk->instance, vk->window, 0, &vk->surface) == VK_SUCCESS;
+}
+
+static bool has_swapchain_extension(VkPhysicalDevice gpu)
+{
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(gpu, 0, &count, 0);
+    VkExtensionProperties* extensions = new VkExtensionProperties[count];
+    vkEnumerateDeviceExtensionProperties(gpu, 0, &count, extensions);
+
+    bool found = false;
+    for(uint32_t ei = 0; ei < count && !found; ++ei)
+    {
+        found = !strcmp(extensions[ei].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+    delete[] extensions;
+    return found;
+}
+
+// The first device with a queue that can both blit and present
+static bool pick_device(VulkanPresenter* vk)
+{
+    uint32_t num_gpus = 0;
+    vkEnumeratePhysicalDevices(vk->instance, &num_gpus, 0);
+    if(!num_gpus) return false;
+    VkPhysicalDevice* gpus = new VkPhysicalDevice[num_gpus];
+    vkEnumeratePhysicalDevices(vk->instance, &num_gpus, gpus);
+
+    bool found = false;
+    for(uint32_t gi = 0; gi < num_gpus && !found; ++gi)
+    {
+        if(!has_swapchain_extension(gpus[gi])) continue;
+
+        uint32_t num_families = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(gpus[gi], &num_families, 0);
+        VkQueueFamilyProperties* families = new VkQueueFamilyProperties[num_families];
+        vkGetPhysicalDeviceQueueFamilyProperties(gpus[gi], &num_families, families);
+        for(uint32_t fi = 0; fi < num_families && !found; ++fi)
+        {
+            VkBool32 present = VK_FALSE;
+            vkGetPhysicalDeviceSurfaceSupportKHR(gpus[gi], fi, vk->surface, &present);
+            if(!(families[fi].queueFlags & VK_QUEUE_GRAPHICS_BIT) || !present) continue;
+            vk->gpu = gpus[gi];
+            vk->queue_family = fi;
+            found = true;
+        }
+        delete[] families;
+    }
+    delete[] gpus;
+    return found;
+}
+
+static bool create_device(VulkanPresenter* vk)
+{
+    gladLoadVulkanUserPtr(vk->gpu, (GLADuserptrloadfunc)glfwGetInstanceProcAddress, vk->instance);
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queue = {};
+    queue.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue.queueFamilyIndex = vk->queue_family;
+    queue.queueCount = 1;
+    queue.pQueuePriorities = &priority;
+
+    const char* extensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    VkDeviceCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    info.queueCreateInfoCount = 1;
+    info.pQueueCreateInfos = &queue;
+    info.enabledExtensionCount = 1;
+    info.ppEnabledExtensionNames = extensions;
+    if(vkCreateDevice(vk->gpu, &info, 0, &vk->device) != VK_SUCCESS) return false;
+
+    vkGetDeviceQueue(vk->device, vk->queue_family, 0, &vk->queue);
+
+    uint32_t num_modes = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(vk->gpu, vk->surface, &num_modes, 0);
+    VkPresentModeKHR* modes = new VkPresentModeKHR[num_modes];
+    vkGetPhysicalDeviceSurfacePresentModesKHR(vk->gpu, vk->surface, &num_modes, modes);
+    for(uint32_t mi = 0; mi < num_modes; ++mi)
+    {
+        if(modes[mi] == VK_PRESENT_MODE_FIFO_RELAXED_KHR) vk->mode_supported[VULKAN_PRESENT_FIFO_RELAXED] = true;
+        if(modes[mi] == VK_PRESENT_MODE_MAILBOX_KHR) vk->mode_supported[VULKAN_PRESENT_MAILBOX] = true;
+    }
+    vk->mode_supported[VULKAN_PRESENT_FIFO] = true;
+    delete[] modes;
+    return true;
+}
+
+static void destroy_swapchain_semaphores(VulkanPresenter* vk)
+{
+    for(uint32_t ii = 0; ii < vk->num_images; ++ii)
+    {
+        vkDestroySemaphore(vk->device, vk->rendered[ii], 0);
+        vk->rendered[ii] = VK_NULL_HANDLE;
+    }
+    vk->num_images = 0;
+}
+
+// (Re)creates the swapchain at the framebuffer size. Returns false while
+// the window has no area, e.g. when minimized.
+static bool create_swapchain(VulkanPresenter* vk, int framebuffer_width, int framebuffer_height)
+{
+    VkSurfaceCapabilitiesKHR caps;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk->gpu, vk->surface, &caps);
+
+    VkExtent2D extent = caps.currentExtent;
+    if(extent.width == 0xFFFFFFFFu)
+    {
+        extent.width = (uint32_t)framebuffer_width;
+        extent.height = (uint32_t)framebuffer_height;
+        if(extent.width < caps.minImageExtent.width) extent.width = caps.minImageExtent.width;
+        if(extent.width > caps.maxImageExtent.width) extent.width = caps.maxImageExtent.width;
+        if(extent.height < caps.minImageExtent.height) extent.height = caps.minImageExtent.height;
+        if(extent.height > caps.maxImageExtent.height) extent.height = caps.maxImageExtent.height;
+    }
+    if(!extent.width || !extent.height) return false;
+
+    uint32_t num_formats = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(vk->gpu, vk->surface, &num_formats, 0);
+    VkSurfaceFormatKHR* formats = new VkSurfaceFormatKHR[num_formats];
+    vkGetPhysicalDeviceSurfaceFormatsKHR(vk->gpu, vk->surface, &num_formats, formats);
+    // UNORM like GL_RGBA8, so colors come out as they do on the GL path
+    VkSurfaceFormatKHR format = formats[0];
+    if(format.format == VK_FORMAT_UNDEFINED) format.format = VK_FORMAT_B8G8R8A8_UNORM;
+    for(uint32_t fi = 0; fi < num_formats; ++fi)
+    {
+        if(formats[fi].format == VK_FORMAT_B8G8R8A8_UNORM || formats[fi].format == VK_FORMAT_R8G8B8A8_UNORM)
+        {
+            format = formats[fi];
+            break;
+        }
+    }
+    delete[] formats;
+
+    uint32_t num_images = caps.minImageCount + 1;
+    if(caps.maxImageCount && num_images > caps.maxImageCount) num_images = caps.maxImageCount;
+    if(num_images > VULKAN_MAX_IMAGES) num_images = VULKAN_MAX_IMAGES;
+
+    VulkanPresentMode mode = vk->mode_supported[vk->requested_mode] ? vk->requested_mode : VULKAN_PRESENT_FIFO;
+    VkCompositeAlphaFlagBitsKHR alpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if(!(caps.supportedCompositeAlpha & alpha)) alpha = (VkCompositeAlphaFlagBitsKHR)(caps.supportedCompositeAlpha & -caps.supportedCompositeAlpha);
+
+    VkSwapchainCreateInfoKHR info = {};
+    info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    info.surface = vk->surface;
+    info.minImageCount = num_images;
+    info.imageFormat = format.format;
+    info.imageColorSpace = format.colorSpace;
+    info.imageExtent = extent;
+    info.imageArrayLayers = 1;
+    info.imageUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.preTransform = caps.currentTransform;
+    info.compositeAlpha = alpha;
+    info.presentMode = vk_present_mode(mode);
+    info.clipped = VK_TRUE;
+    info.oldSwapchain = vk->swapchain;
+
+    VkSwapchainKHR swapchain;
+    VkResult result = vkCreateSwapchainKHR(vk->device, &info, 0, &swapchain);
+    if(vk->swapchain)
+    {
+        vkDeviceWaitIdle(vk->device);
+        vkDestroySwapchainKHR(vk->device, vk->swapchain, 0);
+        destroy_swapchain_semaphores(vk);
+    }
+    vk->swapchain = VK_NULL_HANDLE;
+    if(result != VK_SUCCESS)
+    {
+        fprintf(stderr, "Could not create a Vulkan swapchain.\n");
+        return false;
+    }
+
+    vk->swapchain = swapchain;
+    vk->extent = extent;
+    vk->num_images = VULKAN_MAX_IMAGES;
+    vkGetSwapchainImagesKHR(vk->device, swapchain, &vk->num_images, vk->images);
+
+    VkSemaphoreCreateInfo semaphore = {};
+    semaphore.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for(uint32_t ii = 0; ii < vk->num_images; ++ii)
+    {
+        vkCreateSemaphore(vk->device, &semaphore, 0, &vk->rendered[ii]);
+    }
+    vk->swapchain_stale = false;
+    return true;
+}
+
+static bool create_pixel_storage(VulkanPresenter* vk)
+{
+    VkDeviceSize size = (VkDeviceSize)vk->width * vk->height * 4;
+    VkBufferCreateInfo buffer = {};
+    buffer.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer.size = size;
+    buffer.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(vkCreateBuffer(vk->device, &buffer, 0, &vk->staging) != VK_SUCCESS) return false;
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(vk->device, vk->staging, &requirements);
+    VkMemoryAllocateInfo allocate = {};
+    allocate.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate.allocationSize = requirements.size;
+    // Coherent, so the rasterizer's writes need no flush before a copy
+    VkMemoryPropertyFlags host = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if(!find_memory_type(vk, requirements.memoryTypeBits, host, &allocate.memoryTypeIndex)) return false;
+    if(vkAllocateMemory(vk->device, &allocate, 0, &vk->staging_memory) != VK_SUCCESS) return false;
+    vkBindBufferMemory(vk->device, vk->staging, vk->staging_memory, 0);
+
+    void* mapped = 0;
+    if(vkMapMemory(vk->device, vk->staging_memory, 0, size, 0, &mapped) != VK_SUCCESS) return false;
+    vk->staging_pixels = (uint8_t*)mapped;
+    memset(vk->staging_pixels, 0, (size_t)size);
+
+    VkImageCreateInfo image = {};
+    image.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image.imageType = VK_IMAGE_TYPE_2D;
+    image.format = vk->source_format;
+    image.extent = {vk->width, vk->height, 1};
+    image.mipLevels = 1;
+    image.arrayLayers = 1;
+    image.samples = VK_SAMPLE_COUNT_1_BIT;
+    image.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    image.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if(vkCreateImage(vk->device, &image, 0, &vk->source) != VK_SUCCESS) return false;
+
+    vkGetImageMemoryRequirements(vk->device, vk->source, &requirements);
+    allocate.allocationSize = requirements.size;
+    if(!find_memory_type(vk, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &allocate.memoryTypeIndex) &&
+       !find_memory_type(vk, requirements.memoryTypeBits, 0, &allocate.memoryTypeIndex))
+    {
+        return false;
+    }
+    if(vkAllocateMemory(vk->device, &allocate, 0, &vk->source_memory) != VK_SUCCESS) return false;
+    vkBindImageMemory(vk->device, vk->source, vk->source_memory, 0);
+    return true;
+}
+
+static bool create_frame_resources(VulkanPresenter* vk)
+{
+    VkCommandPoolCreateInfo pool = {};
+    pool.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool.queueFamilyIndex = vk->queue_family;
+    if(vkCreateCommandPool(vk->device, &pool, 0, &vk->command_pool) != VK_SUCCESS) return false;
+
+    VkCommandBufferAllocateInfo allocate = {};
+    allocate.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate.commandPool = vk->command_pool;
+    allocate.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate.commandBufferCount = VULKAN_FRAMES_IN_FLIGHT;
+    if(vkAllocateCommandBuffers(vk->device, &allocate, vk->commands) != VK_SUCCESS) return false;
+
+    VkSemaphoreCreateInfo semaphore = {};
+    semaphore.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkFenceCreateInfo fence = {};
+    fence.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    for(size_t fi = 0; fi < VULKAN_FRAMES_IN_FLIGHT; ++fi)
+    {
+        if(vkCreateSemaphore(vk->device, &semaphore, 0, &vk->acquired[fi]) != VK_SUCCESS) return false;
+        if(vkCreateFence(vk->device, &fence, 0, &vk->fences[fi]) != VK_SUCCESS) return false;
+    }
+    return true;
+}
+
+VulkanPresenter* create_vulkan_presenter(GLFWwindow* window, uint32_t width, uint32_t height, bool bgra, VulkanPresentMode mode)
+{
+    if(!glfwVulkanSupported())
+    {
+        fprintf(stderr, "No Vulkan loader was found.\n");
+        return 0;
+    }
+    gladLoadVulkanUserPtr(0, (GLADuserptrloadfunc)glfwGetInstanceProcAddress, 0);
+
+    VulkanPresenter* vk = new VulkanPresenter();
+    vk->window = window;
+    vk->width = width;
+    vk->height = height;
+    vk->source_format = bgra ? VK_FORMAT_B8G8R8A8_UNORM : VK_FORMAT_R8G8B8A8_UNORM;
+    vk->requested_mode = mode;
+
+    int framebuffer_width, framebuffer_height;
+    glfwGetFramebufferSize(window, &framebuffer_width, &framebuffer_height);
+    bool ok = create_instance(vk) && pick_device(vk) && create_device(vk) &&
+              create_pixel_storage(vk) && create_frame_resources(vk);
+    if(ok) vk->swapchain_stale = !create_swapchain(vk, framebuffer_width, framebuffer_height);
+    if(!ok)
+    {
+        fprintf(stderr, "Could not set up Vulkan presentation.\n");
+        destroy_vulkan_presenter(vk);
+        return 0;
+    }
+    return vk;
+}
+
+void destroy_vulkan_presenter(VulkanPresenter* vk)
+{
+    if(vk->device)
+    {
+        vkDeviceWaitIdle(vk->device);
+        for(size_t fi = 0; fi < VULKAN_FRAMES_IN_FLIGHT; ++fi)
+        {
+            if(vk->acquired[fi]) vkDestroySemaphore(vk->device, vk->acquired[fi], 0);
+            if(vk->fences[fi]) vkDestroyFence(vk->device, vk->fences[fi], 0);
+        }
+        if(vk->command_pool) vkDestroyCommandPool(vk->device, vk->command_pool, 0);
+        destroy_swapchain_semaphores(vk);
+        if(vk->swapchain) vkDestroySwapchainKHR(vk->device, vk->swapchain, 0);
+        if(vk->source) vkDestroyImage(vk->device, vk->source, 0);
+        if(vk->source_memory) vkFreeMemory(vk->device, vk->source_memory, 0);
+        if(vk->staging) vkDestroyBuffer(vk->device, vk->staging, 0);
+        if(vk->staging_memory) vkFreeMemory(vk->device, vk->staging_memory, 0);
+        vkDestroyDevice(vk->device, 0);
+    }
+    if(vk->surface) vkDestroySurfaceKHR(vk->instance, vk->surface, 0);
+    if(vk->instance) vkDestroyInstance(vk->instance, 0);
+    delete vk;
+}
+
+uint8_t* vulkan_staging_pixels(VulkanPresenter* vk)
+{
+    return vk->staging_pixels;
+}
+
+void set_vulkan_present_mode(VulkanPresenter* vk, VulkanPresentMode mode)
+{
+    if(mode == vk->requested_mode) return;
+    if(!vk->mode_supported[mode])
+    {
+        fprintf(stderr, "Vulkan present mode %s is not supported, using fifo.\n", vulkan_present_mode_name(mode));
+    }
+    vk->requested_mode = mode;
+    vk->swapchain_stale = true;
+}
+
+void wait_for_vulkan_upload(VulkanPresenter* vk)
+{
+    size_t last = (vk->frame + VULKAN_FRAMES_IN_FLIGHT - 1) % VULKAN_FRAMES_IN_FLIGHT;
+    if(vk->submitted[last]) vkWaitForFences(vk->device, 1, &vk->fences[last], VK_TRUE, UINT64_MAX);
+}
+
+static void image_barrier(
+    VkCommandBuffer commands, VkImage image, VkImageLayout from, VkImageLayout to,
+    VkAccessFlags src_access, VkAccessFlags dst_access, VkPipelineStageFlags dst_stage
+)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = from;
+    barrier.newLayout = to;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, 0, 0, 0, 1, &barrier);
+}
+
+// Staging rows to source image, only where the buffer changed
+static void record_source_copy(VulkanPresenter* vk, VkCommandBuffer commands, const VulkanRect* rects, size_t num_rects)
+{
+    VulkanRect full = {0, 0, vk->width, vk->height};
+    if(!vk->source_initialized || vk->full_copy_pending || num_rects > VULKAN_MAX_REGIONS)
+    {
+        rects = &full;
+        num_rects = 1;
+    }
+    if(!num_rects) return;
+
+    image_barrier(
+        commands, vk->source,
+        vk->source_initialized ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+
+    VkBufferImageCopy regions[VULKAN_MAX_REGIONS];
+    for(size_t ri = 0; ri < num_rects; ++ri)
+    {
+        const VulkanRect& r = rects[ri];
+        VkBufferImageCopy& region = regions[ri];
+        region = VkBufferImageCopy{};
+        region.bufferOffset = ((VkDeviceSize)r.y * vk->width + r.x) * 4;
+        region.bufferRowLength = vk->width;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {(int32_t)r.x, (int32_t)r.y, 0};
+        region.imageExtent = {r.width, r.height, 1};
+    }
+    vkCmdCopyBufferToImage(commands, vk->staging, vk->source, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)num_rects, regions);
+
+    image_barrier(
+        commands, vk->source, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+    vk->source_initialized = true;
+    vk->full_copy_pending = false;
+}
+
+void present_vulkan_frame(
+    VulkanPresenter* vk, const VulkanRect* rects, size_t num_rects,
+    const int viewport[4], int framebuffer_width, int framebuffer_height
+)
+{
+    if(vk->swapchain_stale || !vk->swapchain ||
+       vk->extent.width != (uint32_t)framebuffer_width || vk->extent.height != (uint32_t)framebuffer_height)
+    {
+        if(!create_swapchain(vk, framebuffer_width, framebuffer_height))
+        {
+            vk->full_copy_pending = true;
+            return;
+        }
+    }
+
+    size_t slot = vk->frame;
+    vkWaitForFences(vk->device, 1, &vk->fences[slot], VK_TRUE, UINT64_MAX);
+
+    uint32_t index = 0;
+    VkResult result = vkAcquireNextImageKHR(vk->device, vk->swapchain, UINT64_MAX, vk->acquired[slot], VK_NULL_HANDLE, &index);
+    if(result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+    {
+        // Out of date: the rectangles are lost with this frame
+        vk->swapchain_stale = true;
+        vk->full_copy_pending = true;
+        return;
+    }
+    vkResetFences(vk->device, 1, &vk->fences[slot]);
+
+    VkCommandBuffer commands = vk->commands[slot];
+    vkResetCommandBuffer(commands, 0);
+    VkCommandBufferBeginInfo begin = {};
+    begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commands, &begin);
+
+    record_source_copy(vk, commands, rects, num_rects);
+
+    VkImage target = vk->images[index];
+    image_barrier(
+        commands, target, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+    VkClearColorValue black = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdClearColorImage(commands, target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1, &range);
+    image_barrier(
+        commands, target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+
+    // Buffer row 0 is the bottom of the screen, image row 0 the top
+    int32_t left = viewport[0], right = viewport[0] + viewport[2];
+    int32_t top = framebuffer_height - (viewport[1] + viewport[3]), bottom = framebuffer_height - viewport[1];
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.srcOffsets[1] = {(int32_t)vk->width, (int32_t)vk->height, 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[0] = {left, bottom, 0};
+    blit.dstOffsets[1] = {right, top, 1};
+    vkCmdBlitImage(
+        commands, vk->source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST
+    );
+
+    image_barrier(
+        commands, target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+    );
+    vkEndCommandBuffer(commands);
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo submit = {};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.waitSemaphoreCount = 1;
+    submit.pWaitSemaphores = &vk->acquired[slot];
+    submit.pWaitDstStageMask = &wait_stage;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &commands;
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &vk->rendered[index];
+    vkQueueSubmit(vk->queue, 1, &submit, vk->fences[slot]);
+    vk->submitted[slot] = true;
+
+    VkPresentInfoKHR present = {};
+    present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present.waitSemaphoreCount = 1;
+    present.pWaitSemaphores = &vk->rendered[index];
+    present.swapchainCount = 1;
+    present.pSwapchains = &vk->swapchain;
+    present.pImageIndices = &index;
+    result = vkQueuePresentKHR(vk->queue, &present);
+    if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) vk->swapchain_stale = true;
+
+    vk->frame = (slot + 1) % VULKAN_FRAMES_IN_FLIGHT;
+}
+
+void finish_vulkan_frames(VulkanPresenter* vk)
+{
+    vkQueueWaitIdle(vk->queue);
+}
+
+#else
+
+VulkanPresenter* create_vulkan_presenter(GLFWwindow*, uint32_t, uint32_t, bool, VulkanPresentMode)
+{
+    fprintf(stderr, "Browsers have no Vulkan, present through WebGL2 instead.\n");
+    return 0;
+}
+
+void destroy_vulkan_presenter(VulkanPresenter* vk) { delete vk; }
+uint8_t* vulkan_staging_pixels(VulkanPresenter*) { return 0; }
+void set_vulkan_present_mode(VulkanPresenter*, VulkanPresentMode) {}
+void wait_for_vulkan_upload(VulkanPresenter*) {}
+void present_vulkan_frame(VulkanPresenter*, const VulkanRect*, size_t, const int[4], int, int) {}
+void finish_vulkan_frames(VulkanPresenter*) {}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef VULKAN_PRESENT_H
+#define VULKAN_PRESENT_H
+
+/*
+    Vulkan present backend. The CPU buffer lives in a persistently mapped
+    staging buffer; each frame copies its changed rectangles into a source
+    image and blits that, scaled like the GL viewport, into the next
+    swapchain image. Surfaces come from GLFW's src/vulkan.c and the entry
+    points from the glad loader it vendors, so nothing is linked.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+struct GLFWwindow;
+struct VulkanPresenter;
+
+enum VulkanPresentMode: uint8_t
+{
+    VULKAN_PRESENT_FIFO         = 0,
+    VULKAN_PRESENT_FIFO_RELAXED = 1,
+    VULKAN_PRESENT_MAILBOX      = 2
+};
+
+struct VulkanRect
+{
+    uint32_t x, y, width, height;
+};
+
+const char* vulkan_present_mode_name(VulkanPresentMode mode);
+
+// 'window' must have been created with GLFW_NO_API. Staging pixels are
+// B,G,R,A bytes when 'bgra' is set and R,G,B,A otherwise. Returns 0 when
+// there is no usable device.
+VulkanPresenter* create_vulkan_presenter(GLFWwindow* window, uint32_t width, uint32_t height, bool bgra, VulkanPresentMode mode);
+void destroy_vulkan_presenter(VulkanPresenter* vk);
+
+// width * height * 4 bytes, mapped for as long as the presenter lives
+uint8_t* vulkan_staging_pixels(VulkanPresenter* vk);
+
+// Unsupported modes fall back to FIFO, which every driver has
+void set_vulkan_present_mode(VulkanPresenter* vk, VulkanPresentMode mode);
+
+// Blocks until the GPU has copied the last frame out of the staging pixels
+void wait_for_vulkan_upload(VulkanPresenter* vk);
+
+// Copies 'rects' of the staging pixels into the source image and presents
+// it into 'viewport', which counts y from the bottom like glViewport()
+void present_vulkan_frame(
+    VulkanPresenter* vk, const VulkanRect* rects, size_t num_rects,
+    const int viewport[4], int framebuffer_width, int framebuffer_height
+);
+
+// Blocks until every submitted frame has been presented
+void finish_vulkan_frames(VulkanPresenter* vk);
+
+#endif
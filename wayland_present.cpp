@@ -0,0 +1,346 @@
+#include <cstdio>
+#include <cstring>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include "wayland_present.h"
+
+#ifdef SPACE_INVADERS_WAYLAND
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "viewporter-client-protocol.h"
+#define GLFW_EXPOSE_NATIVE_WAYLAND
+#include <GLFW/glfw3native.h>
+
+#define WAYLAND_BUFFERS 2
+// A hidden window gets no frame callbacks, so vsync gives up on one
+// after this long instead of stalling the game
+#define WAYLAND_FRAME_TIMEOUT_MS 100
+
+struct WaylandPresenter
+{
+    GLFWwindow* window;
+    wl_display* display;
+    // Everything the presenter waits on is dispatched from its own queue,
+    // apart from the events GLFW dispatches on the default one
+    wl_event_queue* queue;
+    wl_registry* registry;
+    wl_shm* shm;
+    wp_viewporter* viewporter;
+
+    // GLFW's surface, wrapped so frame callbacks land on 'queue'
+    wl_surface* surface;
+    wp_viewport* viewport;
+    int destination_width, destination_height;
+    bool damage_buffer;
+
+    uint32_t width, height;
+    size_t frame_size;
+    int fd;
+    uint8_t* pool_pixels;
+    wl_shm_pool* pool;
+    wl_buffer* buffers[WAYLAND_BUFFERS];
+    // Attached and not yet released by the compositor
+    bool busy[WAYLAND_BUFFERS];
+    size_t back;
+
+    Buffer* target;
+    // What the last presented frame changed, still to be copied into the
+    // back buffer before it is drawn into
+    Rect staged[2 * BUFFER_MAX_DIRTY];
+    size_t num_staged;
+    bool catch_up_pending;
+
+    bool vsync;
+    wl_callback* frame_callback;
+};
+
+static void registry_global(void* data, wl_registry* registry, uint32_t name, const char* interface, uint32_t)
+{
+    WaylandPresenter* wl = static_cast<WaylandPresenter*>(data);
+    if(!strcmp(interface, wl_shm_interface.name))
+    {
+        wl->shm = static_cast<wl_shm*>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+    }
+    else if(!strcmp(interface, wp_viewporter_interface.name))
+    {
+        wl->viewporter = static_cast<wp_viewporter*>(wl_registry_bind(registry, name, &wp_viewporter_interface, 1));
+    }
+}
+
+static void registry_global_remove(void*, wl_registry*, uint32_t) {}
+
+static const wl_registry_listener registry_listener = {registry_global, registry_global_remove};
+
+static void buffer_release(void* data, wl_buffer*)
+{
+    *static_cast<bool*>(data) = false;
+}
+
+static const wl_buffer_listener buffer_listener = {buffer_release};
+
+static void frame_done(void* data, wl_callback* callback, uint32_t)
+{
+    WaylandPresenter* wl = static_cast<WaylandPresenter*>(data);
+    wl_callback_destroy(callback);
+    wl->frame_callback = 0;
+}
+
+static const wl_callback_listener frame_listener = {frame_done};
+
+// Reads and dispatches whatever arrives for the presenter's queue within
+// 'timeout_ms', -1 to block. False on a timeout or a broken connection.
+static bool dispatch_wayland_events(WaylandPresenter* wl, int timeout_ms)
+{
+    while(wl_display_prepare_read_queue(wl->display, wl->queue) != 0)
+    {
+        if(wl_display_dispatch_queue_pending(wl->display, wl->queue) == -1) return false;
+    }
+    wl_display_flush(wl->display);
+
+    pollfd fd = {wl_display_get_fd(wl->display), POLLIN, 0};
+    if(poll(&fd, 1, timeout_ms) <= 0)
+    {
+        wl_display_cancel_read(wl->display);
+        return false;
+    }
+    if(wl_display_read_events(wl->display) == -1) return false;
+    return wl_display_dispatch_queue_pending(wl->display, wl->queue) != -1;
+}
+
+static bool create_shm_pool(WaylandPresenter* wl)
+{
+    size_t pool_size = wl->frame_size * WAYLAND_BUFFERS;
+    wl->fd = memfd_create("space-invaders-frames", MFD_CLOEXEC);
+    if(wl->fd < 0 || ftruncate(wl->fd, (off_t)pool_size) < 0) return false;
+
+    void* pixels = mmap(0, pool_size, PROT_READ | PROT_WRITE, MAP_SHARED, wl->fd, 0);
+    if(pixels == MAP_FAILED) return false;
+    wl->pool_pixels = static_cast<uint8_t*>(pixels);
+
+    wl->pool = wl_shm_create_pool(wl->shm, wl->fd, (int32_t)pool_size);
+    for(size_t i = 0; i < WAYLAND_BUFFERS; ++i)
+    {
+        wl->buffers[i] = wl_shm_pool_create_buffer(
+            wl->pool, (int32_t)(i * wl->frame_size), (int32_t)wl->width, (int32_t)wl->height,
+            (int32_t)(wl->width * 4), WL_SHM_FORMAT_XRGB8888
+        );
+        wl->busy[i] = false;
+        wl_buffer_add_listener(wl->buffers[i], &buffer_listener, &wl->busy[i]);
+    }
+    return true;
+}
+
+static uint8_t* wayland_frame(WaylandPresenter* wl, size_t index)
+{
+    return wl->pool_pixels + index * wl->frame_size;
+}
+
+WaylandPresenter* create_wayland_presenter(GLFWwindow* window, uint32_t width, uint32_t height)
+{
+    if(glfwGetPlatform() != GLFW_PLATFORM_WAYLAND)
+    {
+        fprintf(stderr, "wl_shm presents on Wayland only.\n");
+        return 0;
+    }
+
+    WaylandPresenter* wl = new WaylandPresenter{};
+    wl->window = window;
+    wl->display = glfwGetWaylandDisplay();
+    wl->fd = -1;
+    wl->width = width;
+    wl->height = height;
+    wl->frame_size = (size_t)width * height * 4;
+
+    wl->queue = wl_display_create_queue(wl->display);
+    wl_display* display = static_cast<wl_display*>(wl_proxy_create_wrapper(wl->display));
+    wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(display), wl->queue);
+    wl->registry = wl_display_get_registry(display);
+    wl_proxy_wrapper_destroy(display);
+    wl_registry_add_listener(wl->registry, &registry_listener, wl);
+    wl_display_roundtrip_queue(wl->display, wl->queue);
+
+    if(!wl->shm || !create_shm_pool(wl))
+    {
+        fprintf(stderr, "Could not set up a wl_shm pool.\n");
+        destroy_wayland_presenter(wl);
+        return 0;
+    }
+
+    wl_surface* surface = glfwGetWaylandWindow(window);
+    wl->surface = static_cast<wl_surface*>(wl_proxy_create_wrapper(surface));
+    wl_proxy_set_queue(reinterpret_cast<wl_proxy*>(wl->surface), wl->queue);
+    uint32_t version = wl_proxy_get_version(reinterpret_cast<wl_proxy*>(surface));
+    wl->damage_buffer = version >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+    if(version >= WL_SURFACE_SET_BUFFER_TRANSFORM_SINCE_VERSION)
+    {
+        wl_surface_set_buffer_transform(wl->surface, WL_OUTPUT_TRANSFORM_FLIPPED_180);
+    }
+    else fprintf(stderr, "The compositor can't flip buffers, the picture is upside down.\n");
+
+    // The viewport stretches the buffer over the whole window, so the
+    // window keeps the buffer's shape instead of being letterboxed
+    if(wl->viewporter) wl->viewport = wp_viewporter_get_viewport(wl->viewporter, wl->surface);
+    else fprintf(stderr, "No wp_viewporter, presenting the buffer unscaled.\n");
+    glfwSetWindowAspectRatio(window, (int)width, (int)height);
+
+    wl->vsync = true;
+    return wl;
+}
+
+void destroy_wayland_presenter(WaylandPresenter* wl)
+{
+    if(wl->frame_callback) wl_callback_destroy(wl->frame_callback);
+    if(wl->viewport) wp_viewport_destroy(wl->viewport);
+    if(wl->surface)
+    {
+        // Leave nothing attached that points into the pool
+        wl_surface_attach(wl->surface, 0, 0, 0);
+        wl_surface_commit(wl->surface);
+        wl_proxy_wrapper_destroy(wl->surface);
+    }
+    for(size_t i = 0; i < WAYLAND_BUFFERS; ++i)
+    {
+        if(wl->buffers[i]) wl_buffer_destroy(wl->buffers[i]);
+    }
+    if(wl->pool) wl_shm_pool_destroy(wl->pool);
+    if(wl->pool_pixels) munmap(wl->pool_pixels, wl->frame_size * WAYLAND_BUFFERS);
+    if(wl->fd >= 0) close(wl->fd);
+    if(wl->viewporter) wp_viewporter_destroy(wl->viewporter);
+    if(wl->shm) wl_shm_destroy(wl->shm);
+    if(wl->registry) wl_registry_destroy(wl->registry);
+    wl_display_flush(wl->display);
+    if(wl->queue) wl_event_queue_destroy(wl->queue);
+    delete wl;
+}
+
+void bind_wayland_buffer(WaylandPresenter* wl, Buffer* buffer)
+{
+    wl->target = buffer;
+    set_buffer_pixels(buffer, wayland_frame(wl, wl->back));
+}
+
+void set_wayland_vsync(WaylandPresenter* wl, bool vsync)
+{
+    wl->vsync = vsync;
+}
+
+void wait_for_wayland_buffer(WaylandPresenter* wl)
+{
+    if(!wl->catch_up_pending) return;
+    while(wl->busy[wl->back] && dispatch_wayland_events(wl, -1)) {}
+
+    // Both buffers agree again once the back one has the last frame's changes
+    const uint8_t* front = wayland_frame(wl, (wl->back + WAYLAND_BUFFERS - 1) % WAYLAND_BUFFERS);
+    uint8_t* back = wayland_frame(wl, wl->back);
+    size_t stride = (size_t)wl->width * 4;
+    for(size_t i = 0; i < wl->num_staged; ++i)
+    {
+        const Rect& r = wl->staged[i];
+        for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+        {
+            memcpy(back + yi * stride + r.x * 4, front + yi * stride + r.x * 4, r.width * 4);
+        }
+    }
+    wl->catch_up_pending = false;
+}
+
+void present_wayland_frame(WaylandPresenter* wl, const Rect* rects, size_t num_rects)
+{
+    wait_for_wayland_buffer(wl);
+    if(wl->vsync)
+    {
+        while(wl->frame_callback && dispatch_wayland_events(wl, WAYLAND_FRAME_TIMEOUT_MS)) {}
+        if(wl->frame_callback)
+        {
+            wl_callback_destroy(wl->frame_callback);
+            wl->frame_callback = 0;
+        }
+    }
+
+    int window_width, window_height;
+    glfwGetWindowSize(wl->window, &window_width, &window_height);
+    if(wl->viewport && window_width > 0 && window_height > 0 &&
+       (window_width != wl->destination_width || window_height != wl->destination_height))
+    {
+        wp_viewport_set_destination(wl->viewport, window_width, window_height);
+        wl->destination_width = window_width;
+        wl->destination_height = window_height;
+    }
+
+    wl_surface_attach(wl->surface, wl->buffers[wl->back], 0, 0);
+    // Buffer rows are the Buffer's, the transform flips them on screen
+    if(wl->damage_buffer)
+    {
+        for(size_t i = 0; i < num_rects; ++i)
+        {
+            const Rect& r = rects[i];
+            wl_surface_damage_buffer(wl->surface, (int32_t)r.x, (int32_t)r.y, (int32_t)r.width, (int32_t)r.height);
+        }
+    }
+    else wl_surface_damage(wl->surface, 0, 0, INT32_MAX, INT32_MAX);
+
+    if(wl->vsync && !wl->frame_callback)
+    {
+        wl->frame_callback = wl_surface_frame(wl->surface);
+        wl_callback_add_listener(wl->frame_callback, &frame_listener, wl);
+    }
+    wl_surface_commit(wl->surface);
+    wl_display_flush(wl->display);
+
+    wl->busy[wl->back] = true;
+    memcpy(wl->staged, rects, num_rects * sizeof(Rect));
+    wl->num_staged = num_rects;
+    wl->catch_up_pending = true;
+    wl->back = (wl->back + 1) % WAYLAND_BUFFERS;
+    if(wl->target) set_buffer_pixels(wl->target, wayland_frame(wl, wl->back));
+}
+
+void finish_wayland_frames(WaylandPresenter* wl)
+{
+    wl_display_roundtrip_queue(wl->display, wl->queue);
+}
+
+bool wayland_events_pending()
+{
+    wl_display* display = glfwGetWaylandDisplay();
+    if(!display) return true;
+    // Fails while the default queue already holds events, which GLFW
+    // dispatches
+    if(wl_display_prepare_read(display) != 0) return true;
+    wl_display_flush(display);
+    pollfd fd = {wl_display_get_fd(display), POLLIN, 0};
+    bool pending = poll(&fd, 1, 0) != 0;
+    wl_display_cancel_read(display);
+    return pending;
+}
+
+int wayland_connection_fd()
+{
+    wl_display* display = glfwGetWaylandDisplay();
+    return display ? wl_display_get_fd(display) : -1;
+}
+
+#else
+
+struct WaylandPresenter {};
+
+WaylandPresenter* create_wayland_presenter(GLFWwindow*, uint32_t, uint32_t)
+{
+    fprintf(stderr, "Built without Wayland, wl_shm is unavailable.\n");
+    return 0;
+}
+
+void destroy_wayland_presenter(WaylandPresenter* wl) { delete wl; }
+void bind_wayland_buffer(WaylandPresenter*, Buffer*) {}
+void set_wayland_vsync(WaylandPresenter*, bool) {}
+void wait_for_wayland_buffer(WaylandPresenter*) {}
+void present_wayland_frame(WaylandPresenter*, const Rect*, size_t) {}
+void finish_wayland_frames(WaylandPresenter*) {}
+bool wayland_events_pending() { return true; }
+int wayland_connection_fd() { return -1; }
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef WAYLAND_PRESENT_H
+#define WAYLAND_PRESENT_H
+
+/*
+    Wayland wl_shm present backend. The CPU buffer draws straight into one
+    of two wl_shm buffers in a shared memory pool, which is attached to
+    the GLFW window's surface and committed with damage equal to the
+    changed rectangles: no GL, no copy of whole frames. The surface is
+    given a vertical flip as its buffer transform, so rows stay bottom
+    first like the Buffer's, and wp_viewporter scales it to the window.
+
+    The compositor reads a committed buffer until it releases it, so the
+    next frame goes to the other one, which first waits for its release
+    and copies in the rectangles the frame before changed. Vsync waits
+    for the surface's frame callback. Only built where GLFW's Wayland
+    platform is; create_wayland_presenter() returns 0 anywhere else.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "render.h"
+
+struct GLFWwindow;
+struct WaylandPresenter;
+
+// 'window' must have been created with GLFW_NO_API and without
+// GLFW_SCALE_FRAMEBUFFER. Pixels are PIXEL_BGRA8888_REV, which is
+// WL_SHM_FORMAT_XRGB8888. Returns 0 when not running on Wayland.
+WaylandPresenter* create_wayland_presenter(GLFWwindow* window, uint32_t width, uint32_t height);
+void destroy_wayland_presenter(WaylandPresenter* wl);
+
+// From now on 'buffer' draws into the shm buffer the next frame goes to
+void bind_wayland_buffer(WaylandPresenter* wl, Buffer* buffer);
+
+void set_wayland_vsync(WaylandPresenter* wl, bool vsync);
+
+// Blocks until the buffer drawn into next is released and up to date
+void wait_for_wayland_buffer(WaylandPresenter* wl);
+
+// Attaches the buffer drawn into, damaged by 'rects', commits it and
+// moves the bound Buffer over to the other one
+void present_wayland_frame(WaylandPresenter* wl, const Rect* rects, size_t num_rects);
+
+// Blocks until the compositor has seen every commit
+void finish_wayland_frames(WaylandPresenter* wl);
+
+// Whether GLFW's display has events queued on its default queue or
+// waiting on its socket, found without dispatching any. True wherever it
+// can't tell, so callers fall back to pumping.
+bool wayland_events_pending();
+
+// The socket of GLFW's display, for waiting on with other descriptors, or
+// -1 without one
+int wayland_connection_fd();
+
+#endif
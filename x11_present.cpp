@@ -0,0 +1,414 @@
+#include <cstdio>
+#include <cstring>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include "x11_present.h"
+
+#ifdef SPACE_INVADERS_X11
+#include <chrono>
+#include <thread>
+#include <poll.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+// Xlib's font handle would clash with the game's Font
+#define Font XFont
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#ifdef SPACE_INVADERS_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+#define GLFW_EXPOSE_NATIVE_X11
+#include <GLFW/glfw3native.h>
+#undef Font
+
+// A hidden window never reaches a vblank, so vsync gives up on one after
+// this long instead of stalling the game
+#define X11_VBLANK_TIMEOUT_MS 100
+
+struct X11Presenter
+{
+    GLFWwindow* window;
+    // The presenter's own connection, see x11_present.h
+    Display* display;
+    Window target;
+    GC gc;
+    int completion_event;
+
+    XShmSegmentInfo segment;
+    XImage* image;
+    uint32_t width, height;
+    // Cleared until the first frame copies all of itself in
+    bool image_filled;
+    // Put and not yet read by the server
+    bool put_pending;
+    // Copied in since the last put
+    Rect staged[2 * BUFFER_MAX_DIRTY];
+    size_t num_staged;
+
+    int window_width, window_height;
+    // Set when the window lost its contents, the next frame puts all of it
+    bool full_put;
+
+    bool vsync;
+    double refresh_interval;
+    double last_present;
+#ifdef SPACE_INVADERS_XPRESENT
+    int present_opcode;
+    XID present_events;
+    uint32_t notify_serial;
+    // A PresentNotifyMSC for the next vblank is out
+    bool vblank_pending;
+#endif
+};
+
+static bool shm_attach_failed;
+
+static int catch_shm_attach_error(Display*, XErrorEvent*)
+{
+    shm_attach_failed = true;
+    return 0;
+}
+
+static void handle_x11_event(X11Presenter* x11, XEvent* event)
+{
+    if(event->type == x11->completion_event)
+    {
+        x11->put_pending = false;
+    }
+    else if(event->type == Expose)
+    {
+        x11->full_put = true;
+    }
+#ifdef SPACE_INVADERS_XPRESENT
+    else if(event->type == GenericEvent && event->xcookie.extension == x11->present_opcode &&
+            XGetEventData(x11->display, &event->xcookie))
+    {
+        if(event->xcookie.evtype == PresentCompleteNotify)
+        {
+            const XPresentCompleteNotifyEvent* complete = static_cast<XPresentCompleteNotifyEvent*>(event->xcookie.data);
+            if(complete->serial_number == x11->notify_serial) x11->vblank_pending = false;
+        }
+        XFreeEventData(x11->display, &event->xcookie);
+    }
+#endif
+}
+
+static void drain_x11_events(X11Presenter* x11)
+{
+    while(XPending(x11->display))
+    {
+        XEvent event;
+        XNextEvent(x11->display, &event);
+        handle_x11_event(x11, &event);
+    }
+}
+
+// Handles whatever arrives within 'timeout_ms', -1 to block, until 'done'
+// is cleared. False on a timeout.
+static bool wait_for_x11_events(X11Presenter* x11, const bool* done, int timeout_ms)
+{
+    XFlush(x11->display);
+    while(*done)
+    {
+        drain_x11_events(x11);
+        if(!*done) break;
+
+        pollfd fd = {ConnectionNumber(x11->display), POLLIN, 0};
+        if(poll(&fd, 1, timeout_ms) <= 0) return false;
+    }
+    return true;
+}
+
+// Only a 32-bit TrueColor visual with red, green and blue in the bytes
+// PIXEL_BGRA8888_REV puts them in takes the Buffer's pixels as they are
+static bool create_shm_image(X11Presenter* x11, Visual* visual, int depth)
+{
+    x11->image = XShmCreateImage(x11->display, visual, (unsigned)depth, ZPixmap, 0, &x11->segment, x11->width, x11->height);
+    if(!x11->image) return false;
+    if(x11->image->bits_per_pixel != 32 || x11->image->byte_order != LSBFirst ||
+       x11->image->bytes_per_line != (int)x11->width * 4)
+    {
+        return false;
+    }
+
+    x11->segment.shmid = shmget(IPC_PRIVATE, (size_t)x11->image->bytes_per_line * x11->height, IPC_CREAT | 0600);
+    if(x11->segment.shmid < 0) return false;
+    x11->segment.shmaddr = static_cast<char*>(shmat(x11->segment.shmid, 0, 0));
+    // Marked for removal right away, it goes once both sides detach
+    shmctl(x11->segment.shmid, IPC_RMID, 0);
+    if(x11->segment.shmaddr == reinterpret_cast<char*>(-1))
+    {
+        x11->segment.shmaddr = 0;
+        return false;
+    }
+    x11->image->data = x11->segment.shmaddr;
+    x11->segment.readOnly = True;
+
+    // A remote server fails the attach asynchronously
+    shm_attach_failed = false;
+    XErrorHandler previous = XSetErrorHandler(catch_shm_attach_error);
+    Status attached = XShmAttach(x11->display, &x11->segment);
+    XSync(x11->display, False);
+    XSetErrorHandler(previous);
+    if(!attached || shm_attach_failed)
+    {
+        x11->segment.shmseg = 0;
+        return false;
+    }
+    return true;
+}
+
+X11Presenter* create_x11_presenter(GLFWwindow* window, uint32_t width, uint32_t height)
+{
+    if(glfwGetPlatform() != GLFW_PLATFORM_X11)
+    {
+        fprintf(stderr, "MIT-SHM presents on X11 only.\n");
+        return 0;
+    }
+
+    X11Presenter* x11 = new X11Presenter{};
+    x11->window = window;
+    x11->target = glfwGetX11Window(window);
+    x11->width = width;
+    x11->height = height;
+    x11->segment.shmid = -1;
+    x11->display = XOpenDisplay(DisplayString(glfwGetX11Display()));
+    if(!x11->display || !XShmQueryExtension(x11->display))
+    {
+        fprintf(stderr, "The X server has no MIT-SHM.\n");
+        destroy_x11_presenter(x11);
+        return 0;
+    }
+
+    XWindowAttributes attributes;
+    XGetWindowAttributes(x11->display, x11->target, &attributes);
+    Visual* visual = attributes.visual;
+    if(visual->c_class != TrueColor || visual->red_mask != 0xff0000 ||
+       visual->green_mask != 0xff00 || visual->blue_mask != 0xff ||
+       !create_shm_image(x11, visual, attributes.depth))
+    {
+        fprintf(stderr, "Could not share a BGRA image with the X server.\n");
+        destroy_x11_presenter(x11);
+        return 0;
+    }
+    x11->completion_event = XShmGetEventBase(x11->display) + ShmCompletion;
+    x11->gc = XCreateGC(x11->display, x11->target, 0, 0);
+    XSetForeground(x11->display, x11->gc, BlackPixel(x11->display, DefaultScreen(x11->display)));
+    // Every client selects its own events, GLFW's connection keeps its own
+    XSelectInput(x11->display, x11->target, ExposureMask);
+
+#ifdef SPACE_INVADERS_XPRESENT
+    int event_base, error_base;
+    if(XPresentQueryExtension(x11->display, &x11->present_opcode, &event_base, &error_base))
+    {
+        x11->present_events = XPresentSelectInput(x11->display, x11->target, PresentCompleteNotifyMask);
+    }
+    else fprintf(stderr, "The X server has no Present extension, vsync sleeps for the refresh interval.\n");
+#endif
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode* video_mode = monitor ? glfwGetVideoMode(monitor) : 0;
+    x11->refresh_interval = 1.0 / (video_mode && video_mode->refreshRate > 0 ? video_mode->refreshRate : 60);
+
+    x11->full_put = true;
+    x11->vsync = true;
+    return x11;
+}
+
+void destroy_x11_presenter(X11Presenter* x11)
+{
+    if(x11->display)
+    {
+        if(x11->put_pending) wait_for_x11_events(x11, &x11->put_pending, -1);
+#ifdef SPACE_INVADERS_XPRESENT
+        if(x11->present_events) XPresentFreeInput(x11->display, x11->target, x11->present_events);
+#endif
+        if(x11->gc) XFreeGC(x11->display, x11->gc);
+        if(x11->segment.shmseg) XShmDetach(x11->display, &x11->segment);
+        if(x11->image)
+        {
+            // The pixels belong to the segment, not to Xlib
+            x11->image->data = 0;
+            XDestroyImage(x11->image);
+        }
+        XCloseDisplay(x11->display);
+    }
+    if(x11->segment.shmaddr) shmdt(x11->segment.shmaddr);
+    delete x11;
+}
+
+void set_x11_vsync(X11Presenter* x11, bool vsync)
+{
+    x11->vsync = vsync;
+}
+
+// Flips 'r' from the Buffer's bottom-up rows into the image's top-down ones
+static void copy_rect_to_image(X11Presenter* x11, const Buffer& buffer, const Rect& r)
+{
+    const uint8_t* pixels = buffer_pixels(buffer);
+    uint8_t* image = reinterpret_cast<uint8_t*>(x11->image->data);
+    size_t stride = (size_t)x11->width * 4;
+    for(size_t yi = r.y; yi < r.y + r.height; ++yi)
+    {
+        memcpy(image + (x11->height - 1 - yi) * stride + r.x * 4, pixels + yi * stride + r.x * 4, r.width * 4);
+    }
+}
+
+static void wait_for_vblank(X11Presenter* x11)
+{
+#ifdef SPACE_INVADERS_XPRESENT
+    if(x11->present_events)
+    {
+        if(x11->vblank_pending && !wait_for_x11_events(x11, &x11->vblank_pending, X11_VBLANK_TIMEOUT_MS))
+        {
+            x11->vblank_pending = false;
+        }
+        return;
+    }
+#endif
+    double wait = x11->last_present + x11->refresh_interval - glfwGetTime();
+    if(wait > 0.0) std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+void copy_x11_rects(X11Presenter* x11, const Buffer& buffer, const Rect* rects, size_t num_rects)
+{
+    if(x11->put_pending) wait_for_x11_events(x11, &x11->put_pending, -1);
+
+    Rect whole = {0, 0, x11->width, x11->height};
+    if(!x11->image_filled)
+    {
+        rects = &whole;
+        num_rects = 1;
+        x11->image_filled = true;
+    }
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        copy_rect_to_image(x11, buffer, rects[i]);
+        if(x11->num_staged < 2 * BUFFER_MAX_DIRTY) x11->staged[x11->num_staged++] = rects[i];
+        else x11->full_put = true;
+    }
+}
+
+void present_x11_frame(X11Presenter* x11)
+{
+    // Expose events that came in since, the put below covers them
+    drain_x11_events(x11);
+
+    int window_width, window_height;
+    glfwGetWindowSize(x11->window, &window_width, &window_height);
+    if(window_width != x11->window_width || window_height != x11->window_height)
+    {
+        x11->window_width = window_width;
+        x11->window_height = window_height;
+        x11->full_put = true;
+    }
+    // Unscaled and centered, possibly cropped by a small window
+    int left = (window_width - (int)x11->width) / 2;
+    int top = (window_height - (int)x11->height) / 2;
+
+    // The image always holds the whole frame, so it can stand in for the
+    // staged rectangles
+    Rect whole = {0, 0, x11->width, x11->height};
+    const Rect* rects = x11->staged;
+    size_t num_rects = x11->num_staged;
+    if(x11->full_put)
+    {
+        rects = &whole;
+        num_rects = 1;
+    }
+
+    if(x11->vsync) wait_for_vblank(x11);
+
+    if(x11->full_put)
+    {
+        XFillRectangle(x11->display, x11->target, x11->gc, 0, 0, (unsigned)window_width, (unsigned)window_height);
+        x11->full_put = false;
+    }
+    for(size_t i = 0; i < num_rects; ++i)
+    {
+        const Rect& r = rects[i];
+        int image_y = (int)(x11->height - r.y - r.height);
+        // Only the last put asks for a completion event, the server
+        // handles one client's requests in order
+        XShmPutImage(
+            x11->display, x11->target, x11->gc, x11->image,
+            (int)r.x, image_y, left + (int)r.x, top + image_y, (unsigned)r.width, (unsigned)r.height,
+            i + 1 == num_rects ? True : False
+        );
+    }
+    x11->put_pending = num_rects > 0;
+    x11->num_staged = 0;
+
+#ifdef SPACE_INVADERS_XPRESENT
+    if(x11->vsync && x11->present_events)
+    {
+        // Divisor 1, remainder 0: whichever vblank comes next
+        XPresentNotifyMSC(x11->display, x11->target, ++x11->notify_serial, 0, 1, 0);
+        x11->vblank_pending = true;
+    }
+#endif
+    XFlush(x11->display);
+    x11->last_present = glfwGetTime();
+}
+
+void finish_x11_frames(X11Presenter* x11)
+{
+    if(x11->put_pending) wait_for_x11_events(x11, &x11->put_pending, -1);
+}
+
+bool x11_events_pending()
+{
+    Display* display = glfwGetX11Display();
+    if(!display) return true;
+    if(XEventsQueued(display, QueuedAlready)) return true;
+    // Anything GLFW wrote since it last pumped has to reach the server
+    // before the replies can arrive
+    XFlush(display);
+    pollfd fd = {ConnectionNumber(display), POLLIN, 0};
+    return poll(&fd, 1, 0) != 0;
+}
+
+bool x11_compositor_running(bool* running)
+{
+    Display* display = glfwGetX11Display();
+    if(!display) return false;
+
+    char name[32];
+    snprintf(name, sizeof(name), "_NET_WM_CM_S%d", DefaultScreen(display));
+    *running = XGetSelectionOwner(display, XInternAtom(display, name, False)) != None;
+    return true;
+}
+
+int x11_connection_fd()
+{
+    Display* display = glfwGetX11Display();
+    return display ? ConnectionNumber(display) : -1;
+}
+
+void sync_x11_events()
+{
+    Display* display = glfwGetX11Display();
+    if(display) XSync(display, False);
+}
+
+#else
+
+struct X11Presenter {};
+
+X11Presenter* create_x11_presenter(GLFWwindow*, uint32_t, uint32_t)
+{
+    fprintf(stderr, "Built without X11, MIT-SHM is unavailable.\n");
+    return 0;
+}
+
+void destroy_x11_presenter(X11Presenter* x11) { delete x11; }
+void set_x11_vsync(X11Presenter*, bool) {}
+void copy_x11_rects(X11Presenter*, const Buffer&, const Rect*, size_t) {}
+void present_x11_frame(X11Presenter*) {}
+void finish_x11_frames(X11Presenter*) {}
+bool x11_events_pending() { return true; }
+void sync_x11_events() {}
+bool x11_compositor_running(bool*) { return false; }
+int x11_connection_fd() { return -1; }
+
+#endif
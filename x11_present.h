@@ -0,0 +1,68 @@
+#ifndef X11_PRESENT_H
+#define X11_PRESENT_H
+
+/*
+    X11 MIT-SHM present backend. Frames reach the window through
+    XShmPutImage from a shared memory XImage, one request per changed
+    rectangle, so the X server reads the pixels straight out of memory it
+    shares with the game: no GL, no socket copy. XImages are top row
+    first while the Buffer is bottom row first, so each changed rectangle
+    is copied into the image flipped on the way, which is the only copy a
+    frame costs. XShmPutImage cannot scale, the image is shown unscaled
+    in the middle of the window.
+
+    The presenter talks to the server on a display connection of its own,
+    so the completion and expose events it waits for never go through
+    GLFW's event loop. The server may still be reading the image until
+    its completion event, which the next frame waits for before copying.
+    With the X Present extension vsync waits for the next vblank through
+    PresentNotifyMSC, otherwise for the monitor's refresh interval. Only
+    built where GLFW's X11 platform is; create_x11_presenter() returns 0
+    anywhere else.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include "render.h"
+
+struct GLFWwindow;
+struct X11Presenter;
+
+// 'window' must have been created with GLFW_NO_API. Pixels are
+// PIXEL_BGRA8888_REV, which a depth 24 TrueColor visual reads as they
+// are. Returns 0 off X11, without MIT-SHM or on any other visual.
+X11Presenter* create_x11_presenter(GLFWwindow* window, uint32_t width, uint32_t height);
+void destroy_x11_presenter(X11Presenter* x11);
+
+void set_x11_vsync(X11Presenter* x11, bool vsync);
+
+// Waits until the server has read the image, then copies 'rects' of
+// 'buffer' into it
+void copy_x11_rects(X11Presenter* x11, const Buffer& buffer, const Rect* rects, size_t num_rects);
+
+// Puts the copied rectangles into the window, all of the image after
+// the window was resized or exposed
+void present_x11_frame(X11Presenter* x11);
+
+// Blocks until the server has read every put
+void finish_x11_frames(X11Presenter* x11);
+
+// Whether GLFW's own connection has events queued or waiting on its
+// socket, found without reading or dispatching any. True wherever it
+// can't tell, so callers fall back to pumping.
+bool x11_events_pending();
+
+// Whether a compositing manager owns the _NET_WM_CM_Sn selection of
+// GLFW's screen. False, leaving '*running' be, where it can't tell.
+bool x11_compositor_running(bool* running);
+
+// The socket of GLFW's connection, for waiting on with other descriptors,
+// or -1 without one. Events Xlib has already read off it don't make it
+// readable, so pump before waiting.
+int x11_connection_fd();
+
+// Round trip on GLFW's connection, so every event the server has sent by
+// now is queued
+void sync_x11_events();
+
+#endif